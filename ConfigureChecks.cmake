@@ -66,6 +66,10 @@ check_include_file(byteswap.h HAVE_BYTESWAP_H)
 check_include_file(glob.h HAVE_GLOB_H)
 check_include_file(valgrind/valgrind.h HAVE_VALGRIND_VALGRIND_H)
 
+if (WITH_USDT)
+    check_include_file(sys/sdt.h HAVE_SYS_SDT_H)
+endif (WITH_USDT)
+
 if (WIN32)
   check_include_file(io.h HAVE_IO_H)
 
@@ -163,12 +167,16 @@ check_function_exists(strndup HAVE_STRNDUP)
 check_function_exists(strtoull HAVE_STRTOULL)
 check_function_exists(explicit_bzero HAVE_EXPLICIT_BZERO)
 check_function_exists(memset_s HAVE_MEMSET_S)
+check_function_exists(getpeereid HAVE_GETPEEREID)
 
 if (HAVE_GLOB_H)
     check_struct_has_member(glob_t gl_flags glob.h HAVE_GLOB_GL_FLAGS_MEMBER)
     check_function_exists(glob HAVE_GLOB)
 endif (HAVE_GLOB_H)
 
+check_struct_has_member("struct stat" st_mtim.tv_nsec sys/stat.h HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+check_struct_has_member("struct stat" st_mtimespec.tv_nsec sys/stat.h HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+
 if (NOT WIN32)
   check_function_exists(vsnprintf HAVE_VSNPRINTF)
   check_function_exists(snprintf HAVE_SNPRINTF)
@@ -379,6 +387,25 @@ int main(void)
     return 0;
 }" HAVE_GCC_VOLATILE_MEMORY_PROTECTION)
 
+check_c_source_compiles("
+#include <immintrin.h>
+
+__attribute__((target(\"avx2\")))
+static int test_avx2(void)
+{
+    __m256i v = _mm256_setzero_si256();
+
+    return _mm256_movemask_epi8(v);
+}
+
+int main(void) {
+    if (__builtin_cpu_supports(\"avx2\")) {
+        return test_avx2();
+    }
+
+    return 0;
+}" HAVE_X86_TARGET_ATTRIBUTE)
+
 check_c_source_compiles("
 #include <stdio.h>
 int main(void) {
@@ -10,11 +10,13 @@ option(WITH_GCRYPT "Compile against libgcrypt" OFF)
 option(WITH_MBEDTLS "Compile against libmbedtls" OFF)
 option(WITH_BLOWFISH_CIPHER "Compile with blowfish support" OFF)
 option(WITH_PCAP "Compile with Pcap generation support" ON)
+option(WITH_USDT "Compile with static tracepoints if sys/sdt.h is available" ON)
 option(WITH_INTERNAL_DOC "Compile doxygen internal documentation" OFF)
 option(UNIT_TESTING "Build with unit tests" OFF)
 option(CLIENT_TESTING "Build with client tests; requires openssh" OFF)
 option(SERVER_TESTING "Build with server tests; requires openssh and dropbear" OFF)
 option(WITH_BENCHMARKS "Build benchmarks tools" OFF)
+option(WITH_ALLOC_STATS "Build the allocation accounting tests; requires GNU ld" OFF)
 option(WITH_EXAMPLES "Build examples" ON)
 option(WITH_NACL "Build with libnacl (curve25519)" ON)
 option(WITH_SYMBOL_VERSIONING "Build with symbol versioning" ON)
@@ -34,6 +36,10 @@ if (WITH_BENCHMARKS)
   set(CLIENT_TESTING ON)
 endif()
 
+if (WITH_ALLOC_STATS)
+  set(UNIT_TESTING ON)
+endif()
+
 if (WITH_STATIC_LIB)
     set(BUILD_STATIC_LIB ON)
 endif (WITH_STATIC_LIB)
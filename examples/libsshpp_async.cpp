@@ -0,0 +1,70 @@
+/*
+This file is part of the SSH Library
+
+You are free to copy this file, modify it in any way, consider it being public
+domain. This does not apply to the rest of the library though, but it is
+allowed to cut-and-paste working code from this file to any license of
+program.
+*/
+
+/* This file demonstrates the asynchronous C++ wrapper: a command runs on
+ * several hosts at the same time, from a single thread.
+ *
+ * usage: libsshpp_async command host [host ...]
+ */
+
+#include <iostream>
+#include <string>
+#include <libssh/libsshpp.hpp>
+
+static ssh::Task<> run(ssh::Executor &executor,
+                       const char *host,
+                       const char *command){
+  ssh::AsyncSession session(executor);
+  std::string output;
+  char buffer[4096];
+  int nbytes;
+
+  try {
+    session.getSession().setOption(SSH_OPTIONS_HOST, host);
+    co_await session.connect();
+    if (co_await session.userauthPublickeyAuto() != SSH_AUTH_SUCCESS) {
+      std::cerr << host << ": authentication failed" << std::endl;
+      co_return;
+    }
+
+    ssh::AsyncChannel channel(session);
+    co_await channel.openSession();
+    co_await channel.requestExec(command);
+    while ((nbytes = co_await channel.read(buffer, sizeof(buffer))) > 0) {
+      output.append(buffer, nbytes);
+    }
+    co_await channel.close();
+
+    std::cout << host << ": " << output;
+    if (output.empty() || output[output.size() - 1] != '\n') {
+      std::cout << std::endl;
+    }
+  } catch (ssh::SshException &e) {
+    std::cerr << host << ": " << e.getError() << std::endl;
+  }
+}
+
+int main(int argc, const char **argv){
+  ssh::Executor executor;
+  int i;
+
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " command host [host ...]" << std::endl;
+    return 1;
+  }
+
+  ssh_init();
+  for (i = 2; i < argc; i++) {
+    executor.spawn(run(executor, argv[i], argv[1]));
+  }
+  executor.run();
+  ssh_finalize();
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+This file is part of the SSH Library
+
+You are free to copy this file, modify it in any way, consider it being public
+domain. This does not apply to the rest of the library though, but it is
+allowed to cut-and-paste working code from this file to any license of
+program.
+*/
+
+/* This file measures the throughput of many sessions driven by one thread
+ * with the asynchronous C++ wrapper. Every session connects, runs a command
+ * which discards its input and uploads the same amount of data to it.
+ *
+ * usage: libsshpp_async_bench host [port] [sessions] [megabytes per session]
+ *                             [command]
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <libssh/libsshpp.hpp>
+
+#define CHUNK_SIZE (32 * 1024)
+
+struct Bench {
+  const char *host;
+  int port;
+  int sessions;
+  size_t megabytes;
+  std::string command;
+  std::vector<char> chunk;
+  int connected;
+  int failed;
+  double connect_time;
+};
+
+static ssh::Task<> upload(ssh::Executor &executor, Bench &bench){
+  ssh::AsyncSession session(executor);
+  size_t total = bench.megabytes * 1024 * 1024;
+  size_t sent = 0;
+  char buffer[256];
+  int rc;
+
+  auto start = std::chrono::steady_clock::now();
+  try {
+    session.getSession().setOption(SSH_OPTIONS_HOST, bench.host);
+    session.getSession().setOption(SSH_OPTIONS_PORT, (long int)bench.port);
+    co_await session.connect();
+    rc = co_await session.userauthNone();
+    if (rc != SSH_AUTH_SUCCESS) {
+      rc = co_await session.userauthPublickeyAuto();
+    }
+    if (rc != SSH_AUTH_SUCCESS) {
+      std::cerr << "authentication failed" << std::endl;
+      bench.failed++;
+      co_return;
+    }
+
+    ssh::AsyncChannel channel(session);
+    co_await channel.openSession();
+    co_await channel.requestExec(bench.command.c_str());
+    bench.connected++;
+    bench.connect_time += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    while (sent < total) {
+      size_t len = std::min(total - sent, bench.chunk.size());
+
+      co_await channel.write(bench.chunk.data(), len);
+      sent += len;
+    }
+    co_await channel.sendEof();
+    while (co_await channel.read(buffer, sizeof(buffer)) > 0) {
+    }
+    co_await channel.close();
+    if (channel.getExitStatus() != 0) {
+      std::cerr << "the command failed" << std::endl;
+      bench.failed++;
+    }
+  } catch (ssh::SshException &e) {
+    std::cerr << e.getError() << std::endl;
+    bench.failed++;
+  }
+}
+
+int main(int argc, const char **argv){
+  ssh::Executor executor;
+  Bench bench;
+  double elapsed;
+  int i;
+
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " host [port] [sessions] [megabytes per session] [command]"
+              << std::endl;
+    return 1;
+  }
+  bench.host = argv[1];
+  bench.port = argc > 2 ? atoi(argv[2]) : 22;
+  bench.sessions = argc > 3 ? atoi(argv[3]) : 16;
+  bench.megabytes = argc > 4 ? strtoul(argv[4], NULL, 10) : 16;
+  bench.command = argc > 5 ? argv[5] : "cat > /dev/null";
+  bench.chunk.assign(CHUNK_SIZE, 'A');
+  bench.connected = 0;
+  bench.failed = 0;
+  bench.connect_time = 0.0;
+
+  ssh_init();
+  auto start = std::chrono::steady_clock::now();
+  for (i = 0; i < bench.sessions; i++) {
+    executor.spawn(upload(executor, bench));
+  }
+  executor.run();
+  elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          start).count();
+  ssh_finalize();
+
+  std::cout << bench.sessions << " sessions, " << bench.failed << " failed, "
+            << elapsed << " s" << std::endl;
+  if (bench.connected > 0) {
+    std::cout << "connection setup: " << bench.connect_time / bench.connected * 1000
+              << " ms on average" << std::endl;
+  }
+  std::cout << "uploaded " << bench.connected * bench.megabytes << " MB, "
+            << bench.connected * bench.megabytes / elapsed << " MB/s"
+            << std::endl;
+
+  return bench.failed == 0 ? 0 : 1;
+}
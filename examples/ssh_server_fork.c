@@ -143,6 +143,14 @@ static struct argp_option options[] = {
         .doc   = "Do not set default key locations.",
         .group = 0
     },
+    {
+        .name  = "maxstartups",
+        .key   = 'm',
+        .arg   = "BEGIN:RATE:FULL",
+        .flags = 0,
+        .doc   = "Limit the sessions which did not authenticate yet.",
+        .group = 0
+    },
     {
         .name  = "verbose",
         .key   = 'v',
@@ -191,6 +199,12 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 'a':
             strncpy(authorizedkeys, arg, DEF_STR_SIZE-1);
             break;
+        case 'm':
+            if (ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_MAX_STARTUPS,
+                                     arg) != SSH_OK) {
+                argp_error(state, "%s", ssh_get_error(sshbind));
+            }
+            break;
         case 'v':
             ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_LOG_VERBOSITY_STR,
                                  "3");
@@ -676,10 +690,21 @@ static void handle_session(ssh_event event, ssh_session session) {
     }
 }
 
-/* SIGCHLD handler for cleaning up dead children. */
+static volatile sig_atomic_t children_exited;
+
+/* SIGCHLD handler, the dead children are cleaned up by the main loop. */
 static void sigchld_handler(int signo) {
     (void) signo;
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+    children_exited = 1;
+}
+
+/* Clean up the dead children, their sessions no longer count against
+ * --maxstartups. */
+static void reap_children(ssh_bind sshbind) {
+    children_exited = 0;
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+        ssh_bind_admission_done(sshbind);
+    }
 }
 
 int main(int argc, char **argv) {
@@ -689,10 +714,11 @@ int main(int argc, char **argv) {
     struct sigaction sa;
     int rc;
 
-    /* Set up SIGCHLD handler. */
+    /* Set up SIGCHLD handler. Without SA_RESTART, it interrupts the accept()
+     * so that the children are reaped before the next one is admitted. */
     sa.sa_handler = sigchld_handler;
     sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sa.sa_flags = SA_NOCLDSTOP;
     if (sigaction(SIGCHLD, &sa, NULL) != 0) {
         fprintf(stderr, "Failed to register SIGCHLD handler\n");
         return 1;
@@ -725,6 +751,8 @@ int main(int argc, char **argv) {
     }
 
     while (1) {
+        reap_children(sshbind);
+
         session = ssh_new();
         if (session == NULL) {
             fprintf(stderr, "Failed to allocate session\n");
@@ -757,8 +785,13 @@ int main(int argc, char **argv) {
                     exit(0);
                 case -1:
                     fprintf(stderr, "Failed to fork\n");
+                    break;
+                default:
+                    /* The session keeps its place in the startups count
+                     * until the child exits. */
+                    ssh_bind_admission_detach(session);
             }
-        } else {
+        } else if (!children_exited) {
             fprintf(stderr, "%s\n", ssh_get_error(sshbind));
         }
         /* Since the session has been passed to a child fork, do some cleaning
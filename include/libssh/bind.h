@@ -32,6 +32,7 @@ struct ssh_bind_struct {
   struct ssh_poll_handle_struct *poll;
   /* options */
   char *wanted_methods[10];
+  struct ssh_kex_algos wanted_algos[10];
   char *banner;
   char *ecdsakey;
   char *dsakey;
@@ -46,10 +47,25 @@ struct ssh_bind_struct {
   unsigned int bindport;
   int blocking;
   int toaccept;
+  struct ssh_bind_admission_struct *admission;
 };
 
 struct ssh_poll_handle_struct *ssh_bind_get_poll(struct ssh_bind_struct
     *sshbind);
 
+/* bind_admission.c */
+struct sockaddr;
+
+int ssh_bind_admission_set_startups(struct ssh_bind_struct *sshbind,
+                                    const char *spec);
+int ssh_bind_admission_set_source_limit(struct ssh_bind_struct *sshbind,
+                                        const char *spec);
+int ssh_bind_admit(struct ssh_bind_struct *sshbind,
+                   ssh_session session,
+                   socket_t fd,
+                   const struct sockaddr *addr);
+void ssh_bind_admission_release(ssh_session session);
+void ssh_bind_admission_free(struct ssh_bind_struct *sshbind);
+
 
 #endif /* BIND_H_ */
@@ -65,6 +65,9 @@ void Blowfish_encipher(ssh_blf_ctx *, uint32_t *, uint32_t *);
 void Blowfish_decipher(ssh_blf_ctx *, uint32_t *, uint32_t *);
 void Blowfish_initstate(ssh_blf_ctx *);
 void Blowfish_expand0state(ssh_blf_ctx *, const uint8_t *, uint16_t);
+void Blowfish_expand0state_words(ssh_blf_ctx *, const uint32_t *);
+void Blowfish_expand0state_words2(ssh_blf_ctx *, const uint32_t *,
+    ssh_blf_ctx *, const uint32_t *);
 void Blowfish_expandstate
 (ssh_blf_ctx *, const uint8_t *, uint16_t, const uint8_t *, uint16_t);
 
@@ -82,6 +85,8 @@ void ssh_blf_cbc_decrypt(ssh_blf_ctx *, uint8_t *, uint8_t *, uint32_t);
 
 /* Converts uint8_t to uint32_t */
 uint32_t Blowfish_stream2word(const uint8_t *, uint16_t , uint16_t *);
+/* Converts a cyclic uint8_t stream to the given number of uint32_t */
+void Blowfish_stream2words(const uint8_t *, uint16_t, uint32_t *, uint16_t);
 
 #endif /* !defined(HAVE_BCRYPT_PBKDF) && !defined(HAVE_BLH_H) */
 #endif /* _BLF_H */
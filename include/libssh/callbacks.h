@@ -774,6 +774,23 @@ typedef int (*ssh_channel_write_wontblock_callback) (ssh_session session,
                                                      size_t bytes,
                                                      void *userdata);
 
+/**
+ * @brief SSH channel open response callback. Called when the server answered
+ * the opening of a channel which was not waited for.
+ *
+ * @param session Current session handler
+ *
+ * @param channel the actual channel
+ *
+ * @param is_success 1 if the channel is open, 0 if it was refused
+ *
+ * @param userdata Userdata to be passed to the callback function.
+ */
+typedef void (*ssh_channel_open_resp_callback) (ssh_session session,
+                                                ssh_channel channel,
+                                                int is_success,
+                                                void *userdata);
+
 struct ssh_channel_callbacks_struct {
   /** DON'T SET THIS use ssh_callbacks_init() instead. */
   size_t size;
@@ -841,6 +858,10 @@ struct ssh_channel_callbacks_struct {
    * not to block.
    */
   ssh_channel_write_wontblock_callback channel_write_wontblock_function;
+  /** This function will be called when the server accepted or refused the
+   * opening of the channel.
+   */
+  ssh_channel_open_resp_callback channel_open_response_function;
 };
 
 typedef struct ssh_channel_callbacks_struct *ssh_channel_callbacks;
@@ -103,6 +103,20 @@ int ssh_channel_flush(ssh_channel channel);
 uint32_t ssh_channel_new_id(ssh_session session);
 ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id);
 void ssh_channel_do_free(ssh_channel channel);
+int channel_open_forward_nowait(ssh_channel channel,
+                                const char *remotehost,
+                                int remoteport,
+                                const char *sourcehost,
+                                int localport);
+int channel_open_session_nowait(ssh_channel channel);
+int channel_write_nowait(ssh_channel channel, const void *data, uint32_t len);
+int channel_write_stderr_nowait(ssh_channel channel,
+                                const void *data,
+                                uint32_t len);
+int channel_request_nowait(ssh_channel channel,
+                           const char *request,
+                           ssh_buffer buffer,
+                           int reply);
 int ssh_global_request(ssh_session session,
                        const char *request,
                        ssh_buffer buffer,
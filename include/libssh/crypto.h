@@ -147,6 +147,7 @@ struct ssh_crypto_struct {
     struct ssh_kex_struct server_kex;
     struct ssh_kex_struct client_kex;
     char *kex_methods[SSH_KEX_METHODS];
+    uint8_t kex_algos[SSH_KEX_METHODS]; /* ids of the negotiated methods */
     enum ssh_key_exchange_e kex_type;
     enum ssh_mac_e mac_type; /* Mac operations to use for key gen */
     enum ssh_crypto_direction_e used; /* Is this crypto still used for either of directions? */
@@ -181,6 +182,8 @@ struct ssh_cipher_struct {
     /* Counters for rekeying initialization */
     uint32_t packets;
     uint64_t blocks;
+    /* Blocks run through encrypt() or decrypt(), where the counter of CTR is */
+    uint64_t stream_blocks;
     /* Rekeying limit for the cipher or manually enforced */
     uint64_t max_blocks;
     /* sets the new key for immediate use */
@@ -47,6 +47,9 @@ void ssh_server_dh_init(ssh_session session);
 int ssh_dh_init_common(ssh_session session);
 void ssh_dh_cleanup(struct ssh_crypto_struct *crypto);
 int ssh_dh_generate_secret(ssh_session session, bignum dest);
+int ssh_dh_compute_pubkey(struct ssh_crypto_struct *crypto,
+                          bignum secret,
+                          bignum dest);
 int ssh_server_dh_process_init(ssh_session session, ssh_buffer packet);
 
 #endif /* DH_H_ */
@@ -75,5 +75,12 @@ int crypto_sign_ed25519_open(
     const unsigned char *sm,unsigned long long smlen,
     const ed25519_pubkey pk);
 
+int crypto_sign_ed25519_open_batch(
+    const unsigned char * const *sig,
+    const unsigned char * const *m,
+    const unsigned long long *mlen,
+    const unsigned char * const *pk,
+    size_t n);
+
 /** @} */
 #endif /* ED25519_H_ */
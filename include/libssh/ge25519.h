@@ -18,6 +18,8 @@
 #define ge25519_pack                      crypto_sign_ed25519_ref_pack
 #define ge25519_isneutral_vartime         crypto_sign_ed25519_ref_isneutral_vartime
 #define ge25519_double_scalarmult_vartime crypto_sign_ed25519_ref_double_scalarmult_vartime
+#define ge25519_multi_scalarmult_vartime  crypto_sign_ed25519_ref_multi_scalarmult_vartime
+#define ge25519_mul_cofactor              crypto_sign_ed25519_ref_mul_cofactor
 #define ge25519_scalarmult_base           crypto_sign_ed25519_ref_scalarmult_base
 
 typedef struct
@@ -38,6 +40,10 @@ int ge25519_isneutral_vartime(const ge25519 *p);
 
 void ge25519_double_scalarmult_vartime(ge25519 *r, const ge25519 *p1, const sc25519 *s1, const ge25519 *p2, const sc25519 *s2);
 
+int ge25519_multi_scalarmult_vartime(ge25519 *r, const ge25519 *p, const sc25519 *s, size_t n);
+
+void ge25519_mul_cofactor(ge25519 *r, const ge25519 *p);
+
 void ge25519_scalarmult_base(ge25519 *r, const sc25519 *s);
 
 #endif
@@ -41,5 +41,6 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_gssapi_response);
 
 
 int ssh_gssapi_auth_mic(ssh_session session);
+void ssh_gssapi_free(ssh_session session);
 
 #endif /* GSSAPI_H */
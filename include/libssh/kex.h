@@ -26,9 +26,21 @@
 
 #define SSH_KEX_METHODS 10
 
+/* The number of known algorithm names must fit in the bitset */
+#define SSH_KEX_ALGO_MAX 64
+
+/* An algorithm list, as ids of known algorithm names in preference order */
+struct ssh_kex_algos {
+    uint64_t set;
+    uint8_t count;
+    uint8_t ids[SSH_KEX_ALGO_MAX];
+};
+
 struct ssh_kex_struct {
     unsigned char cookie[16];
     char *methods[SSH_KEX_METHODS];
+    /* the methods parsed into algorithm ids, without the languages */
+    struct ssh_kex_algos algos[SSH_KEX_METHODS];
 };
 
 SSH_PACKET_CALLBACK(ssh_packet_kexinit);
@@ -42,6 +54,10 @@ char *ssh_keep_known_algos(enum ssh_kex_types_e algo, const char *list);
 char **ssh_space_tokenize(const char *chain);
 int ssh_get_kex1(ssh_session session);
 char *ssh_find_matching(const char *in_d, const char *what_d);
+int ssh_kex_algo_id(const char *name, size_t len);
+const char *ssh_kex_algo_name(int id);
+void ssh_kex_algos_parse(struct ssh_kex_algos *algos, const char *list);
+void ssh_kex_set_algos(ssh_session session, struct ssh_kex_struct *kex);
 const char *ssh_kex_get_supported_method(uint32_t algo);
 const char *ssh_kex_get_default_methods(uint32_t algo);
 const char *ssh_kex_get_description(uint32_t algo);
@@ -113,17 +113,26 @@ struct ssh_counter_struct {
 };
 typedef struct ssh_counter_struct *ssh_counter;
 
+/* A piece of the data written by ssh_channel_writev() */
+struct ssh_iovec {
+    const void *data;
+    size_t len;
+};
+
 typedef struct ssh_agent_struct* ssh_agent;
 typedef struct ssh_buffer_struct* ssh_buffer;
 typedef struct ssh_channel_struct* ssh_channel;
 typedef struct ssh_message_struct* ssh_message;
 typedef struct ssh_pcap_file_struct* ssh_pcap_file;
 typedef struct ssh_key_struct* ssh_key;
+typedef struct ssh_key_cache_struct* ssh_key_cache;
 typedef struct ssh_scp_struct* ssh_scp;
 typedef struct ssh_session_struct* ssh_session;
+typedef struct ssh_session_template_struct* ssh_session_template;
 typedef struct ssh_string_struct* ssh_string;
 typedef struct ssh_event_struct* ssh_event;
 typedef struct ssh_connector_struct * ssh_connector;
+typedef struct ssh_forwarder_struct * ssh_forwarder;
 typedef void* ssh_gssapi_creds;
 
 /* Socket type */
@@ -408,6 +417,7 @@ enum ssh_options_e {
   SSH_OPTIONS_PROCESS_CONFIG,
   SSH_OPTIONS_REKEY_DATA,
   SSH_OPTIONS_REKEY_TIME,
+  SSH_OPTIONS_CONTROL_PATH,
 };
 
 enum {
@@ -456,6 +466,8 @@ LIBSSH_API int ssh_channel_open_forward(ssh_channel channel, const char *remoteh
     int remoteport, const char *sourcehost, int localport);
 LIBSSH_API int ssh_channel_open_session(ssh_channel channel);
 LIBSSH_API int ssh_channel_open_x11(ssh_channel channel, const char *orig_addr, int orig_port);
+LIBSSH_API int ssh_channel_consume(ssh_channel channel, uint32_t len, int is_stderr);
+LIBSSH_API int ssh_channel_peek_timeout(ssh_channel channel, const void **data, int is_stderr, int timeout_ms);
 LIBSSH_API int ssh_channel_poll(ssh_channel channel, int is_stderr);
 LIBSSH_API int ssh_channel_poll_timeout(ssh_channel channel, int timeout, int is_stderr);
 LIBSSH_API int ssh_channel_read(ssh_channel channel, void *dest, uint32_t count, int is_stderr);
@@ -485,6 +497,12 @@ LIBSSH_API int ssh_channel_write(ssh_channel channel, const void *data, uint32_t
 LIBSSH_API int ssh_channel_write_stderr(ssh_channel channel,
                                         const void *data,
                                         uint32_t len);
+LIBSSH_API int ssh_channel_writev(ssh_channel channel,
+                                  const struct ssh_iovec *iov,
+                                  int iovcnt);
+LIBSSH_API int ssh_channel_writev_stderr(ssh_channel channel,
+                                         const struct ssh_iovec *iov,
+                                         int iovcnt);
 LIBSSH_API uint32_t ssh_channel_window_size(ssh_channel channel);
 
 LIBSSH_API char *ssh_basename (const char *path);
@@ -507,6 +525,26 @@ LIBSSH_API void ssh_disconnect(ssh_session session);
 LIBSSH_API char *ssh_dirname (const char *path);
 LIBSSH_API int ssh_finalize(void);
 
+LIBSSH_API ssh_forwarder ssh_forwarder_new(ssh_session session);
+LIBSSH_API void ssh_forwarder_free(ssh_forwarder forwarder);
+LIBSSH_API int ssh_forwarder_listen(ssh_forwarder forwarder,
+                                    const char *address,
+                                    int port,
+                                    const char *remote_host,
+                                    int remote_port,
+                                    int *bound_port);
+LIBSSH_API int ssh_forwarder_listen_dynamic(ssh_forwarder forwarder,
+                                            const char *address,
+                                            int port,
+                                            int *bound_port);
+LIBSSH_API int ssh_forwarder_listen_control(ssh_forwarder forwarder,
+                                            const char *path);
+LIBSSH_API socket_t ssh_forwarder_connect_control(const char *path,
+                                                  const char *host,
+                                                  int port);
+LIBSSH_API int ssh_forwarder_dopoll(ssh_forwarder forwarder, int timeout);
+LIBSSH_API int ssh_forwarder_get_connections(ssh_forwarder forwarder);
+
 /* REVERSE PORT FORWARDING */
 LIBSSH_API ssh_channel ssh_channel_accept_forward(ssh_session session,
                                                   int timeout_ms,
@@ -583,6 +621,12 @@ LIBSSH_API enum ssh_known_hosts_e
 ssh_session_get_known_hosts_entry(ssh_session session,
                                   struct ssh_knownhosts_entry **pentry);
 LIBSSH_API enum ssh_known_hosts_e ssh_session_is_known_server(ssh_session session);
+LIBSSH_API int ssh_session_export(ssh_session session, ssh_buffer buffer);
+LIBSSH_API int ssh_session_import(ssh_session session,
+                                  socket_t fd,
+                                  ssh_buffer buffer,
+                                  ssh_channel *channels,
+                                  int max);
 
 /* LOGGING */
 LIBSSH_API int ssh_set_log_level(int level);
@@ -608,6 +652,9 @@ LIBSSH_API int ssh_message_subtype(ssh_message msg);
 LIBSSH_API int ssh_message_type(ssh_message msg);
 LIBSSH_API int ssh_mkdir (const char *pathname, mode_t mode);
 LIBSSH_API ssh_session ssh_new(void);
+LIBSSH_API ssh_session ssh_new_from_template(ssh_session_template tmpl);
+LIBSSH_API ssh_session_template ssh_session_template_new(ssh_session session);
+LIBSSH_API void ssh_session_template_free(ssh_session_template tmpl);
 
 LIBSSH_API int ssh_options_copy(ssh_session src, ssh_session *dest);
 LIBSSH_API int ssh_options_getopt(ssh_session session, int *argcptr, char **argv);
@@ -668,6 +715,15 @@ LIBSSH_API int ssh_pki_import_privkey_file(const char *filename,
                                            ssh_auth_callback auth_fn,
                                            void *auth_data,
                                            ssh_key *pkey);
+LIBSSH_API int ssh_pki_import_privkey_file_cached(ssh_key_cache cache,
+                                                  const char *filename,
+                                                  const char *passphrase,
+                                                  ssh_auth_callback auth_fn,
+                                                  void *auth_data,
+                                                  ssh_key *pkey);
+LIBSSH_API ssh_key_cache ssh_key_cache_new(size_t max_entries);
+LIBSSH_API void ssh_key_cache_flush(ssh_key_cache cache);
+LIBSSH_API void ssh_key_cache_free(ssh_key_cache cache);
 LIBSSH_API int ssh_pki_export_privkey_file(const ssh_key privkey,
                                            const char *passphrase,
                                            ssh_auth_callback auth_fn,
@@ -705,6 +761,8 @@ LIBSSH_API void ssh_print_hash(enum ssh_publickey_hash_type type, unsigned char
 LIBSSH_API int ssh_send_ignore (ssh_session session, const char *data);
 LIBSSH_API int ssh_send_debug (ssh_session session, const char *message, int always_display);
 LIBSSH_API void ssh_gssapi_set_creds(ssh_session session, const ssh_gssapi_creds creds);
+LIBSSH_API int ssh_gssapi_prefetch(ssh_session session);
+LIBSSH_API void ssh_gssapi_cache_flush(void);
 LIBSSH_API int ssh_scp_accept_request(ssh_scp scp);
 LIBSSH_API int ssh_scp_close(ssh_scp scp);
 LIBSSH_API int ssh_scp_deny_request(ssh_scp scp, const char *reason);
@@ -39,6 +39,14 @@
  * @see ssh::Session
  * @see ssh::Channel
  *
+ * The objects own what they wrap. With C++11 they can be moved but not
+ * copied; with C++20 the data of channels and sftp files can also be passed
+ * as std::span, and received channel data can be read in place with
+ * Channel::peek() and Channel::consume().
+ *
+ * With a C++20 compiler, the asynchronous wrapper runs many sessions from one
+ * thread with coroutines, see @ref ssh_cpp_async.
+ *
  * If you wish not to use C++ exceptions, please define SSH_NO_CPP_EXCEPTIONS:
  * @code
  * #define SSH_NO_CPP_EXCEPTIONS
@@ -57,6 +65,20 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string>
+#if __cplusplus >= 201103L
+#include <memory>
+#endif
+#ifdef __has_include
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <cstddef>
+#include <initializer_list>
+#include <span>
+#endif
+#if __has_include(<libssh/sftp.h>)
+#include <libssh/sftp.h>
+#define SSH_CPP_SFTP 1
+#endif
+#endif
 
 namespace ssh {
 
@@ -77,6 +99,10 @@ public:
     code=ssh_get_error_code(csession);
     description=std::string(ssh_get_error(csession));
   }
+  SshException(int code, const std::string &description){
+    this->code=code;
+    this->description=description;
+  }
   SshException(const SshException &e){
     code=e.code;
     description=e.description;
@@ -133,6 +159,24 @@ public:
     ssh_free(c_session);
     c_session=NULL;
   }
+#if __cplusplus >= 201103L
+  /** @brief Takes the session of another object, which is left empty.
+   * Its channels keep working on the session, but Channel::getSession()
+   * still returns the object they were created from.
+   */
+  Session(Session &&other) noexcept {
+    c_session=other.c_session;
+    other.c_session=NULL;
+  }
+  Session &operator=(Session &&other) noexcept {
+    if (this != &other) {
+      ssh_free(c_session);
+      c_session=other.c_session;
+      other.c_session=NULL;
+    }
+    return *this;
+  }
+#endif
   /** @brief sets an SSH session options
    * @param type Type of option
    * @param option cstring containing the value of option
@@ -414,13 +458,17 @@ public:
 
   /** @brief accept an incoming forward connection
    * @param[in] timeout_ms timeout for waiting, in ms
-   * @returns new Channel pointer on the forward connection
+   * @returns new Channel on the forward connection
    * @returns NULL in case of error
-   * @warning you have to delete this pointer after use
    * @see ssh_channel_forward_accept
    * @see Session::listenForward
    */
+#if __cplusplus >= 201103L
+  inline std::unique_ptr<Channel> acceptForward(int timeout_ms);
+#else
+  /* @warning you have to delete this pointer after use */
   inline Channel *acceptForward(int timeout_ms);
+#endif
   /* implemented outside the class due Channel references */
 
   void_throwable cancelForward(const char *address, int port){
@@ -457,28 +505,56 @@ class Channel {
   friend class Session;
 public:
   Channel(Session &ssh_session){
-    channel = ssh_channel_new(ssh_session.getCSession());
+    c_session = ssh_session.getCSession();
+    channel = ssh_channel_new(c_session);
     this->session = &ssh_session;
   }
   ~Channel(){
     ssh_channel_free(channel);
     channel=NULL;
   }
+#if __cplusplus >= 201103L
+  /** @brief Takes the channel of another object, which is left empty. */
+  Channel(Channel &&other) noexcept {
+    channel=other.channel;
+    c_session=other.c_session;
+    session=other.session;
+    other.channel=NULL;
+  }
+  Channel &operator=(Channel &&other) noexcept {
+    if (this != &other) {
+      ssh_channel_free(channel);
+      channel=other.channel;
+      c_session=other.c_session;
+      session=other.session;
+      other.channel=NULL;
+    }
+    return *this;
+  }
+#endif
 
   /** @brief accept an incoming X11 connection
    * @param[in] timeout_ms timeout for waiting, in ms
-   * @returns new Channel pointer on the X11 connection
+   * @returns new Channel on the X11 connection
    * @returns NULL in case of error
-   * @warning you have to delete this pointer after use
    * @see ssh_channel_accept_x11
    * @see Channel::requestX11
    */
+#if __cplusplus >= 201103L
+  std::unique_ptr<Channel> acceptX11(int timeout_ms){
+    ssh_channel x11chan = ssh_channel_accept_x11(channel,timeout_ms);
+    ssh_throw_null(getCSession(),x11chan);
+    return std::unique_ptr<Channel>(new Channel(*session,c_session,x11chan));
+  }
+#else
+  /* @warning you have to delete this pointer after use */
   Channel *acceptX11(int timeout_ms){
     ssh_channel x11chan = ssh_channel_accept_x11(channel,timeout_ms);
     ssh_throw_null(getCSession(),x11chan);
-    Channel *newchan = new Channel(getSession(),x11chan);
+    Channel *newchan = new Channel(*session,c_session,x11chan);
     return newchan;
   }
+#endif
   /** @brief change the size of a pseudoterminal
    * @param[in] cols number of columns
    * @param[in] rows number of rows
@@ -503,6 +579,10 @@ public:
   int getExitStatus(){
     return ssh_channel_get_exit_status(channel);
   }
+  /** @brief returns the Session object the channel was created from
+   * @warning it is not updated when that object is moved, use
+   * getCSession() for the session the channel works on.
+   */
   Session &getSession(){
     return *session;
   }
@@ -578,6 +658,50 @@ public:
     ssh_throw(err);
     return err;
   }
+#ifdef __cpp_lib_span
+  /** @brief Reads data on the channel into a span.
+   * @param dest destination of the data
+   * @param is_stderr read from the stderr stream
+   * @param timeout timeout in milliseconds, -1 for infinite
+   * @returns number of bytes read, 0 at end of file
+   * @throws SshException on error
+   * @see ssh_channel_read_timeout
+   */
+  int read(std::span<std::byte> dest, bool is_stderr=false, int timeout=-1){
+    return read(dest.data(), dest.size(), is_stderr, timeout);
+  }
+  /** @brief Lends the data received on the channel, without copying it.
+   *
+   * The view points into the buffer of the channel. It stays valid until
+   * consume() or any other function processing the packets of the session
+   * is called, and the window of the channel only grows once the data was
+   * consumed.
+   * @param[out] view set to the received data, empty at end of file
+   * @param is_stderr read from the stderr stream
+   * @param timeout timeout in milliseconds, -1 for infinite
+   * @returns number of bytes in the view
+   * @throws SshException on error
+   * @see ssh_channel_peek_timeout
+   */
+  int peek(std::span<const std::byte> &view, bool is_stderr=false, int timeout=-1){
+    const void *data;
+    int err;
+
+    err=ssh_channel_peek_timeout(channel,&data,is_stderr,timeout);
+    ssh_throw(err);
+    view=std::span<const std::byte>(static_cast<const std::byte *>(data),
+                                    data != NULL ? (size_t)err : 0);
+    return err;
+  }
+  /** @brief Releases the first len bytes of the data lent by peek().
+   * @throws SshException on error
+   * @see ssh_channel_consume
+   */
+  void_throwable consume(size_t len, bool is_stderr=false){
+    ssh_throw(ssh_channel_consume(channel,(uint32_t)len,is_stderr));
+    return_throwable;
+  }
+#endif
   void_throwable requestEnv(const char *name, const char *value){
     int err=ssh_channel_request_env(channel,name,value);
     ssh_throw(err);
@@ -645,9 +769,58 @@ public:
     ssh_throw(ret);
     return ret;
   }
+#ifdef __cpp_lib_span
+  /** @brief Writes a span on the channel.
+   * @returns number of bytes written
+   * @throws SshException in case of error
+   * @see ssh_channel_write
+   */
+  int write(std::span<const std::byte> data, bool is_stderr=false){
+    return write(data.data(), data.size(), is_stderr);
+  }
+  /** @brief Writes several spans on the channel as one stream, without
+   * copying them together first.
+   * @returns number of bytes written
+   * @throws SshException in case of error
+   * @see ssh_channel_writev
+   */
+  int writev(std::span<const std::span<const std::byte> > pieces,
+             bool is_stderr=false){
+    struct ssh_iovec iov[16];
+    size_t expected, i = 0;
+    int total = 0;
+    int n, ret;
+
+    while (i < pieces.size()) {
+      expected = 0;
+      for (n = 0; n < 16 && i < pieces.size(); n++, i++) {
+        iov[n].data = pieces[i].data();
+        iov[n].len = pieces[i].size();
+        expected += pieces[i].size();
+      }
+      if (is_stderr) {
+        ret=ssh_channel_writev_stderr(channel,iov,n);
+      } else {
+        ret=ssh_channel_writev(channel,iov,n);
+      }
+      ssh_throw(ret);
+      total += ret;
+      if ((size_t)ret < expected) {
+        break;
+      }
+    }
+    return total;
+  }
+  int writev(std::initializer_list<std::span<const std::byte> > pieces,
+             bool is_stderr=false){
+    return writev(std::span<const std::span<const std::byte> >(pieces.begin(),
+                                                               pieces.size()),
+                  is_stderr);
+  }
+#endif
 
   ssh_session getCSession(){
-    return session->getCSession();
+    return c_session;
   }
 
   ssh_channel getCChannel() {
@@ -656,12 +829,15 @@ public:
 
 protected:
   Session *session;
+  /* kept apart, the Session object may be moved */
+  ssh_session c_session;
   ssh_channel channel;
 
 private:
-  Channel (Session &ssh_session, ssh_channel c_channel){
+  Channel (Session &owner, ssh_session c_session, ssh_channel c_channel){
     this->channel=c_channel;
-    this->session = &ssh_session;
+    this->c_session=c_session;
+    this->session = &owner;
   }
   /* No copy and no = operator */
   Channel(const Channel &);
@@ -669,15 +845,1314 @@ private:
 };
 
 
+#if __cplusplus >= 201103L
+inline std::unique_ptr<Channel> Session::acceptForward(int timeout_ms){
+    ssh_channel forward =
+        ssh_channel_accept_forward(c_session, timeout_ms, NULL);
+    ssh_throw_null(c_session,forward);
+    return std::unique_ptr<Channel>(new Channel(*this,c_session,forward));
+  }
+#else
 inline Channel *Session::acceptForward(int timeout_ms){
     ssh_channel forward =
         ssh_channel_accept_forward(c_session, timeout_ms, NULL);
     ssh_throw_null(c_session,forward);
-    Channel *newchan = new Channel(*this,forward);
+    Channel *newchan = new Channel(*this,c_session,forward);
     return newchan;
   }
+#endif
+
+#ifdef SSH_CPP_SFTP
+/** @brief the ssh::SftpFile class owns a file opened on a sftp session,
+ * which it closes when it is destroyed.
+ * @see sftp_file
+ */
+class SftpFile {
+public:
+  /** @brief Takes the ownership of an open file. */
+  explicit SftpFile(sftp_file c_file=NULL){
+    file=c_file;
+  }
+  /** @brief Opens a file.
+   * @throws SshException on error. Without exceptions, check isOpen().
+   * @see sftp_open
+   */
+  SftpFile(sftp_session sftp, const char *path, int accesstype, mode_t mode){
+    file=sftp_open(sftp,path,accesstype,mode);
+#ifndef SSH_NO_CPP_EXCEPTIONS
+    if (file == NULL) {
+      throw SshException(sftp->session);
+    }
+#endif
+  }
+  ~SftpFile(){
+    if (file != NULL) {
+      sftp_close(file);
+    }
+    file=NULL;
+  }
+#if __cplusplus >= 201103L
+  SftpFile(SftpFile &&other) noexcept {
+    file=other.file;
+    other.file=NULL;
+  }
+  SftpFile &operator=(SftpFile &&other) noexcept {
+    if (this != &other) {
+      if (file != NULL) {
+        sftp_close(file);
+      }
+      file=other.file;
+      other.file=NULL;
+    }
+    return *this;
+  }
+#endif
+
+  bool isOpen(){
+    return file != NULL;
+  }
+  /** @brief Closes the file now rather than when the object is destroyed.
+   * @throws SshException on error
+   * @see sftp_close
+   */
+  void_throwable close(){
+    ssh_session c_session;
+    int err;
+
+    if (file == NULL) {
+      return_throwable;
+    }
+    c_session=getCSession();
+    err=sftp_close(file);
+    file=NULL;
+#ifndef SSH_NO_CPP_EXCEPTIONS
+    if (err == SSH_ERROR) {
+      throw SshException(c_session);
+    }
+#else
+    (void)c_session;
+    if (err == SSH_ERROR) {
+      return SSH_ERROR;
+    }
+#endif
+    return_throwable;
+  }
+  /** @brief Reads from the current offset of the file.
+   * @returns number of bytes read, 0 at end of file
+   * @throws SshException on error
+   * @see sftp_read
+   */
+  ssize_t read(void *dest, size_t count){
+    ssize_t err=sftp_read(file,dest,count);
+    ssh_throw(err);
+    return err;
+  }
+  /** @brief Writes at the current offset of the file.
+   * @returns number of bytes written
+   * @throws SshException on error
+   * @see sftp_write
+   */
+  ssize_t write(const void *data, size_t count){
+    ssize_t err=sftp_write(file,data,count);
+    ssh_throw(err);
+    return err;
+  }
+#ifdef __cpp_lib_span
+  ssize_t read(std::span<std::byte> dest){
+    return read(dest.data(), dest.size());
+  }
+  ssize_t write(std::span<const std::byte> data){
+    return write(data.data(), data.size());
+  }
+#endif
+  /** @brief Moves the offset of the file.
+   * @throws SshException on error
+   * @see sftp_seek64
+   */
+  void_throwable seek(uint64_t offset){
+    ssh_throw(sftp_seek64(file,offset));
+    return_throwable;
+  }
+  uint64_t tell(){
+    return sftp_tell64(file);
+  }
+  /** @brief Gives up the ownership of the file, which is returned. */
+  sftp_file release(){
+    sftp_file c_file=file;
+    file=NULL;
+    return c_file;
+  }
+
+  ssh_session getCSession(){
+    return file != NULL ? file->sftp->session : NULL;
+  }
+
+  sftp_file getCFile(){
+    return file;
+  }
+
+private:
+  sftp_file file;
+
+  /* No copy and no = operator */
+  SftpFile(const SftpFile &);
+  SftpFile &operator=(const SftpFile &);
+};
+#endif /* SSH_CPP_SFTP */
 
 } // namespace ssh
 
 /** @} */
+
+/*
+ * The asynchronous interface needs the coroutines of C++20. It is left out
+ * when the header is compiled with an older standard.
+ */
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+namespace ssh {
+
+/**
+ * @defgroup ssh_cpp_async The asynchronous C++ wrapper
+ * @ingroup ssh_cpp
+ *
+ * With a C++20 compiler, connecting, authenticating, opening channels,
+ * reading, writing and the sftp operations are also available as awaitables
+ * for coroutines returning a ssh::Task. A ssh::Executor runs the tasks of any
+ * number of sessions on the calling thread: it waits on the sockets of the
+ * sessions with a ssh_event and retries the nonblocking C functions of the
+ * sessions whose socket became ready.
+ *
+ * @code
+ * ssh::Task<> uptime(ssh::Executor &executor, const char *host)
+ * {
+ *     ssh::AsyncSession session(executor);
+ *     char buffer[256];
+ *     int nbytes;
+ *
+ *     session.getSession().setOption(SSH_OPTIONS_HOST, host);
+ *     co_await session.connect();
+ *     co_await session.userauthPublickeyAuto();
+ *
+ *     ssh::AsyncChannel channel(session);
+ *     co_await channel.openSession();
+ *     co_await channel.requestExec("uptime");
+ *     while ((nbytes = co_await channel.read(buffer, sizeof(buffer))) > 0) {
+ *         fwrite(buffer, 1, nbytes, stdout);
+ *     }
+ *     co_await channel.close();
+ * }
+ *
+ * ssh::Executor executor;
+ * executor.spawn(uptime(executor, "host1"));
+ * executor.spawn(uptime(executor, "host2"));
+ * executor.run();
+ * @endcode
+ *
+ * The awaitables return what the C functions return and throw a
+ * ssh::SshException on error like the synchronous wrapper, or return the
+ * error with SSH_NO_CPP_EXCEPTIONS. An executor, its sessions and their
+ * channels must be used by a single thread; run one executor per thread to
+ * spread the sessions over several cores.
+ * @{
+ */
+
+class Executor;
+template <typename T = void> class Task;
+
+namespace detail {
+
+/*
+ * A coroutine suspended until poll() returns true, or until cancel() when
+ * its session is removed
+ */
+struct Waiter {
+  bool (*poll)(void *awaitable);
+  void (*cancel)(void *awaitable);
+  void *awaitable;
+  std::coroutine_handle<> handle;
+};
+
+/* What the executor knows about one session */
+struct SessionState {
+  Executor *executor;
+  ssh_session session;
+  struct ssh_counter_struct counter;
+  uint64_t seen_packets;
+  socket_t fd;
+  short events;
+  bool ready;
+  std::vector<Waiter> waiters;
+};
+
+class TaskPromiseBase {
+public:
+  struct FinalAwaiter {
+    bool await_ready() noexcept {
+      return false;
+    }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+      std::coroutine_handle<> next = h.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept {
+    return {};
+  }
+  FinalAwaiter final_suspend() noexcept {
+    return {};
+  }
+  void unhandled_exception() {
+#ifdef __cpp_exceptions
+    error = std::current_exception();
+#else
+    std::terminate();
+#endif
+  }
+
+  std::coroutine_handle<> continuation;
+
+protected:
+  void rethrow() {
+#ifdef __cpp_exceptions
+    if (error) {
+      std::rethrow_exception(error);
+    }
+#endif
+  }
+
+private:
+#ifdef __cpp_exceptions
+  std::exception_ptr error;
+#endif
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+  Task<T> get_return_object() noexcept;
+  template <typename U>
+  void return_value(U &&v) {
+    value.emplace(std::forward<U>(v));
+  }
+  T result() {
+    rethrow();
+    return std::move(*value);
+  }
+private:
+  std::optional<T> value;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+  Task<void> get_return_object() noexcept;
+  void return_void() noexcept {}
+  void result() {
+    rethrow();
+  }
+};
+
+/* The coroutine frame of a task started by Executor::spawn() */
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() noexcept {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+} // namespace detail
+
+/**
+ * @brief A coroutine returning a T, started when it is awaited.
+ *
+ * The value, or the exception the coroutine did not catch, is given to the
+ * coroutine awaiting the task. Tasks which are not awaited by another task
+ * are run with Executor::spawn().
+ */
+template <typename T>
+class Task {
+public:
+  using promise_type = detail::TaskPromise<T>;
+
+  Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+  ~Task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    handle.promise().continuation = awaiting;
+    return handle;
+  }
+  T await_resume() {
+    return handle.promise().result();
+  }
+
+private:
+  friend class detail::TaskPromise<T>;
+  explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  /* No copy and no = operator */
+  Task(const Task &);
+  Task &operator=(const Task &);
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept {
+  return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+  return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * @brief Runs tasks and the sessions they use on the calling thread.
+ *
+ * The executor polls the sockets of the sessions which have suspended
+ * operations with a ssh_event, so a wakeup costs one poll over these
+ * sockets and a retry of the operations of the sessions which are ready.
+ * The sessions and channels must be destroyed before their executor.
+ *
+ * The operations still waiting on a session when it is destroyed fail, the
+ * next run() resumes them with a SshException of code SSH_FATAL, or with
+ * SSH_ERROR or NULL without exceptions.
+ */
+class Executor {
+public:
+  Executor(){
+    event=ssh_event_new();
+    running=0;
+  }
+  ~Executor(){
+    ssh_event_free(event);
+    event=NULL;
+  }
+
+  /** @brief Starts a task which nobody awaits.
+   * @param task The task. It runs until its first suspension before spawn()
+   *             returns, and the rest of it in run().
+   */
+  template <typename T>
+  void spawn(Task<T> task){
+    running++;
+    detach(this, std::move(task));
+  }
+
+  /** @brief Runs the spawned tasks until all of them completed.
+   * @returns SSH_OK when all the tasks completed
+   * @returns SSH_ERROR if polling failed, or if tasks are left which do not
+   *          wait for a session
+   * @throws the first exception a spawned task did not catch
+   */
+  int run(){
+    int rc = SSH_OK;
+
+    while (running > 0) {
+      if (step()) {
+        continue;
+      }
+      if (running == 0) {
+        break;
+      }
+      rc = ssh_event_dopoll(event, -1);
+      if (rc == SSH_ERROR) {
+        break;
+      }
+      rc = SSH_OK;
+    }
+#ifdef __cpp_exceptions
+    if (error) {
+      std::rethrow_exception(std::exchange(error, nullptr));
+    }
+#endif
+    return rc;
+  }
+
+  /** @brief Returns the number of spawned tasks which did not complete. */
+  size_t pending(){
+    return running;
+  }
+
+  ssh_event getCEvent(){
+    return event;
+  }
+
+  /** @internal
+   * @brief Starts managing a session, which is made nonblocking.
+   */
+  void addSession(detail::SessionState *state){
+    state->executor = this;
+    state->counter = {0, 0, 0, 0};
+    state->seen_packets = 0;
+    state->fd = SSH_INVALID_SOCKET;
+    state->events = 0;
+    state->ready = false;
+    ssh_set_blocking(state->session, 0);
+    ssh_set_counters(state->session, NULL, &state->counter);
+    sessions.push_back(state);
+  }
+
+  /** @internal
+   * @brief Stops managing a session, and fails the operations waiting on it.
+   */
+  void removeSession(detail::SessionState *state){
+    size_t i;
+
+    unwatch(state);
+    ssh_set_counters(state->session, NULL, NULL);
+    /* resumed by step(), not from the destructor of the session */
+    for (i = 0; i < state->waiters.size(); i++) {
+      state->waiters[i].cancel(state->waiters[i].awaitable);
+      cancelled.push_back(state->waiters[i].handle);
+    }
+    state->waiters.clear();
+    for (i = 0; i < sessions.size(); i++) {
+      if (sessions[i] == state) {
+        /* compacted by step(), which may be iterating */
+        sessions[i] = NULL;
+        break;
+      }
+    }
+  }
+
+  /** @internal
+   * @brief Suspends a coroutine until poll(awaitable) returns true.
+   */
+  void wait(detail::SessionState *state,
+            bool (*poll)(void *),
+            void (*cancel)(void *),
+            void *awaitable,
+            std::coroutine_handle<> handle){
+    detail::Waiter waiter = {poll, cancel, awaitable, handle};
+
+    state->waiters.push_back(waiter);
+    watch(state);
+  }
+
+private:
+  template <typename T>
+  static detail::Detached detach(Executor *executor, Task<T> task){
+#ifdef __cpp_exceptions
+    try {
+      co_await task;
+    } catch (...) {
+      if (!executor->error) {
+        executor->error = std::current_exception();
+      }
+    }
+#else
+    co_await task;
+#endif
+    executor->running--;
+  }
+
+  static int onSocket(socket_t fd, int revents, void *userdata){
+    detail::SessionState *state = static_cast<detail::SessionState *>(userdata);
+
+    (void)fd;
+    (void)revents;
+    state->ready = true;
+
+    return 0;
+  }
+
+  /* Poll the socket of the session for what libssh waits for */
+  void watch(detail::SessionState *state){
+    socket_t fd = ssh_get_fd(state->session);
+    int flags = ssh_get_poll_flags(state->session);
+    short events = POLLIN;
+
+    if (flags & SSH_WRITE_PENDING) {
+      events |= POLLOUT;
+    }
+    if (fd == state->fd && events == state->events) {
+      return;
+    }
+    unwatch(state);
+    if (fd == SSH_INVALID_SOCKET) {
+      return;
+    }
+    if (ssh_event_add_fd(event, fd, events, onSocket, state) == SSH_OK) {
+      state->fd = fd;
+      state->events = events;
+    }
+  }
+
+  void unwatch(detail::SessionState *state){
+    if (state->events != 0) {
+      ssh_event_remove_fd(event, state->fd);
+    }
+    state->fd = SSH_INVALID_SOCKET;
+    state->events = 0;
+  }
+
+  /*
+   * Retry the operations of the sessions whose socket was ready, or which
+   * received packets since they were last retried. Returns true if any
+   * coroutine was resumed or any packet was received.
+   */
+  bool step(){
+    bool progress = false;
+    size_t i, j;
+
+    /* the operations of the removed sessions fail */
+    resuming.swap(cancelled);
+    for (j = 0; j < resuming.size(); j++) {
+      progress = true;
+      resuming[j].resume();
+    }
+    resuming.clear();
+
+    for (i = 0; i < sessions.size(); i++) {
+      detail::SessionState *state = sessions[i];
+
+      if (state == NULL) {
+        continue;
+      }
+      if (state->waiters.empty()) {
+        /* nobody reads what arrives, stop polling until somebody waits */
+        if (state->ready) {
+          unwatch(state);
+          state->ready = false;
+        }
+        state->seen_packets = state->counter.in_packets;
+        continue;
+      }
+      if (!state->ready && state->seen_packets == state->counter.in_packets) {
+        continue;
+      }
+      state->ready = false;
+      state->seen_packets = state->counter.in_packets;
+
+      retrying.swap(state->waiters);
+      for (j = 0; j < retrying.size(); j++) {
+        if (retrying[j].poll(retrying[j].awaitable)) {
+          resuming.push_back(retrying[j].handle);
+        } else {
+          state->waiters.push_back(retrying[j]);
+        }
+      }
+      retrying.clear();
+
+      if (state->seen_packets != state->counter.in_packets) {
+        progress = true;
+      }
+      if (!state->waiters.empty()) {
+        watch(state);
+      }
+
+      /* the resumed coroutines may destroy the session */
+      for (j = 0; j < resuming.size(); j++) {
+        progress = true;
+        resuming[j].resume();
+      }
+      resuming.clear();
+    }
+
+    for (i = 0, j = 0; i < sessions.size(); i++) {
+      if (sessions[i] != NULL) {
+        sessions[j++] = sessions[i];
+      }
+    }
+    sessions.resize(j);
+
+    return progress;
+  }
+
+  ssh_event event;
+  size_t running;
+  std::vector<detail::SessionState *> sessions;
+  std::vector<detail::Waiter> retrying;
+  std::vector<std::coroutine_handle<> > resuming;
+  std::vector<std::coroutine_handle<> > cancelled;
+#ifdef __cpp_exceptions
+  std::exception_ptr error;
+#endif
+
+  /* No copy and no = operator */
+  Executor(const Executor &);
+  Executor &operator=(const Executor &);
+};
+
+namespace detail {
+
+/*
+ * Awaits a nonblocking C call, retried while it returns SSH_AGAIN. The call
+ * is a function object, which may keep the state of a multi-step operation.
+ */
+template <typename Call>
+class Retry {
+public:
+  Retry(SessionState *state, Call call) : state(state), call(std::move(call)), rc(SSH_AGAIN) {}
+
+  bool await_ready(){
+    return poll(this);
+  }
+  void await_suspend(std::coroutine_handle<> handle){
+    state->executor->wait(state, poll, cancel, this, handle);
+  }
+  int await_resume(){
+    if (state == NULL) {
+      /* the session is gone */
+#ifndef SSH_NO_CPP_EXCEPTIONS
+      throw SshException(SSH_FATAL, "The session was destroyed");
+#else
+      return SSH_ERROR;
+#endif
+    }
+    ssh_throw(rc);
+    return rc;
+  }
+
+  ssh_session getCSession(){
+    return state->session;
+  }
+
+private:
+  static bool poll(void *awaitable){
+    Retry *self = static_cast<Retry *>(awaitable);
+
+    self->rc = self->call();
+    return self->rc != SSH_AGAIN;
+  }
+  static void cancel(void *awaitable){
+    Retry *self = static_cast<Retry *>(awaitable);
+
+    self->state = NULL;
+    self->rc = SSH_ERROR;
+  }
+
+  SessionState *state;
+  Call call;
+  int rc;
+};
+
+template <typename Call>
+inline Retry<Call> retry(SessionState *state, Call call){
+  return Retry<Call>(state, std::move(call));
+}
+
+} // namespace detail
+
+/**
+ * @brief A ssh::Session driven by a ssh::Executor.
+ *
+ * The session is nonblocking, and its packet counters are used by the
+ * executor. Set the options on getSession() before connecting.
+ */
+class AsyncSession {
+public:
+  AsyncSession(Executor &executor){
+    state.session=session.getCSession();
+    executor.addSession(&state);
+  }
+  ~AsyncSession(){
+    state.executor->removeSession(&state);
+  }
+
+  /** @brief connects to the remote host
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_connect
+   */
+  auto connect(){
+    return detail::retry(&state, [this]() {
+      return ssh_connect(getCSession());
+    });
+  }
+  /** @brief Authenticates using the "none" method.
+   * @returns an awaitable of SSH_AUTH_SUCCESS, SSH_AUTH_PARTIAL, SSH_AUTH_DENIED
+   * @throws SshException on error
+   * @see ssh_userauth_none
+   */
+  auto userauthNone(){
+    return detail::retry(&state, [this]() {
+      return authResult(ssh_userauth_none(getCSession(), NULL));
+    });
+  }
+  /** @brief Authenticates using the password method.
+   * @param[in] password password to use for authentication
+   * @returns an awaitable of SSH_AUTH_SUCCESS, SSH_AUTH_PARTIAL, SSH_AUTH_DENIED
+   * @throws SshException on error
+   * @see ssh_userauth_password
+   */
+  auto userauthPassword(const char *password){
+    return detail::retry(&state, [this, password]() {
+      return authResult(ssh_userauth_password(getCSession(), NULL, password));
+    });
+  }
+  /** @brief Authenticates automatically using public key
+   * @returns an awaitable of SSH_AUTH_SUCCESS, SSH_AUTH_PARTIAL, SSH_AUTH_DENIED
+   * @throws SshException on error
+   * @see ssh_userauth_publickey_auto
+   */
+  auto userauthPublickeyAuto(){
+    return detail::retry(&state, [this]() {
+      return authResult(ssh_userauth_publickey_auto(getCSession(), NULL, NULL));
+    });
+  }
+
+  Session &getSession(){
+    return session;
+  }
+
+  ssh_session getCSession(){
+    return session.getCSession();
+  }
+
+  Executor &getExecutor(){
+    return *state.executor;
+  }
+
+private:
+  friend class AsyncChannel;
+#ifdef SSH_CPP_SFTP
+  friend class AsyncSftp;
+#endif
+
+  static int authResult(int rc){
+    return rc == SSH_AUTH_AGAIN ? SSH_AGAIN : rc;
+  }
+
+  Session session;
+  detail::SessionState state;
+
+  /* No copy and no = operator */
+  AsyncSession(const AsyncSession &);
+  AsyncSession &operator=(const AsyncSession &);
+};
+
+/**
+ * @brief A ssh::Channel of a ssh::AsyncSession.
+ */
+class AsyncChannel {
+public:
+  AsyncChannel(AsyncSession &session){
+    this->session=&session;
+    channel=ssh_channel_new(session.getCSession());
+  }
+  ~AsyncChannel(){
+    ssh_channel_free(channel);
+    channel=NULL;
+  }
+
+  /** @brief Opens a session channel.
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_channel_open_session
+   */
+  auto openSession(){
+    return detail::retry(&session->state, [this]() {
+      return ssh_channel_open_session(channel);
+    });
+  }
+  /** @brief Opens a TCP/IP forwarding channel.
+   * @param remotehost The remote host to connect to
+   * @param remoteport The remote port to connect to
+   * @param sourcehost The numeric IP address of the machine from where the
+   *                   connection request originates
+   * @param localport  The port on the host from where the connection
+   *                   originated
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_channel_open_forward
+   */
+  auto openForward(const char *remotehost, int remoteport,
+                   const char *sourcehost, int localport=0){
+    return detail::retry(&session->state,
+        [this, remotehost, remoteport, sourcehost, localport]() {
+      return ssh_channel_open_forward(channel, remotehost, remoteport,
+                                      sourcehost, localport);
+    });
+  }
+  /** @brief Runs a command on the remote host.
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_channel_request_exec
+   */
+  auto requestExec(const char *cmd){
+    return detail::retry(&session->state, [this, cmd]() {
+      return ssh_channel_request_exec(channel, cmd);
+    });
+  }
+  /** @brief Requests a shell on the remote host.
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_channel_request_shell
+   */
+  auto requestShell(){
+    return detail::retry(&session->state, [this]() {
+      return ssh_channel_request_shell(channel);
+    });
+  }
+  /** @brief Requests a subsystem, like "sftp".
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_channel_request_subsystem
+   */
+  auto requestSubsystem(const char *subsystem){
+    return detail::retry(&session->state, [this, subsystem]() {
+      return ssh_channel_request_subsystem(channel, subsystem);
+    });
+  }
+  /** @brief Reads what arrived on the channel, waiting for at least one byte.
+   * @param dest destination buffer
+   * @param count maximum number of bytes to read
+   * @param is_stderr read from the stderr stream
+   * @returns an awaitable of the number of bytes read, 0 at end of file
+   * @throws SshException on error
+   * @see ssh_channel_read_nonblocking
+   */
+  auto read(void *dest, size_t count, bool is_stderr=false){
+    return detail::retry(&session->state, [this, dest, count, is_stderr]() {
+      int rc = ssh_channel_read_nonblocking(channel, dest, count, is_stderr);
+
+      if (rc == SSH_EOF) {
+        return 0;
+      }
+      if (rc == 0 && !ssh_channel_is_eof(channel)) {
+        return SSH_AGAIN;
+      }
+      return rc;
+    });
+  }
+#ifdef __cpp_lib_span
+  auto read(std::span<std::byte> dest, bool is_stderr=false){
+    return read(dest.data(), dest.size(), is_stderr);
+  }
+  /** @brief Lends what arrived on the channel, waiting for at least one
+   * byte, without copying it.
+   * @param[out] view set to the received data, valid until consume() or the
+   *                  next operation on the session
+   * @param is_stderr read from the stderr stream
+   * @returns an awaitable of the number of bytes in the view, 0 at end of
+   *          file
+   * @throws SshException on error
+   * @see ssh_channel_peek_timeout
+   */
+  auto peek(std::span<const std::byte> &view, bool is_stderr=false){
+    return detail::retry(&session->state, [this, &view, is_stderr]() {
+      const void *data;
+      int rc = ssh_channel_poll(channel, is_stderr);
+
+      if (rc == SSH_EOF) {
+        view = std::span<const std::byte>();
+        return 0;
+      }
+      if (rc <= 0) {
+        return rc == 0 ? SSH_AGAIN : rc;
+      }
+      rc = ssh_channel_peek_timeout(channel, &data, is_stderr, 0);
+      if (rc > 0) {
+        view = std::span<const std::byte>(static_cast<const std::byte *>(data),
+                                          (size_t)rc);
+      }
+      return rc;
+    });
+  }
+  /** @brief Releases the first len bytes of the data lent by peek().
+   * @throws SshException on error
+   * @see ssh_channel_consume
+   */
+  int consume(size_t len, bool is_stderr=false){
+    int err=ssh_channel_consume(channel,(uint32_t)len,is_stderr);
+    ssh_throw(err);
+    return err;
+  }
+#endif
+  /** @brief Writes on the channel, waiting for the remote window when it is
+   * exhausted.
+   * @param data data to write.
+   * @param len number of bytes to write.
+   * @param is_stderr write on the stderr stream (server only)
+   * @returns an awaitable of len
+   * @throws SshException in case of error
+   * @see ssh_channel_write
+   */
+  auto write(const void *data, size_t len, bool is_stderr=false){
+    return detail::retry(&session->state,
+        [this, data, len, is_stderr, written = (size_t)0]() mutable {
+      const char *p = static_cast<const char *>(data);
+
+      while (written < len) {
+        uint32_t n = (uint32_t)std::min(len - written, (size_t)1 << 30);
+        int rc;
+
+        if (is_stderr) {
+          rc = ssh_channel_write_stderr(channel, p + written, n);
+        } else {
+          rc = ssh_channel_write(channel, p + written, n);
+        }
+        if (rc < 0) {
+          return rc;
+        }
+        if (rc == 0) {
+          return SSH_AGAIN;
+        }
+        written += rc;
+      }
+      return (int)written;
+    });
+  }
+#ifdef __cpp_lib_span
+  auto write(std::span<const std::byte> data, bool is_stderr=false){
+    return write(data.data(), data.size(), is_stderr);
+  }
+#endif
+  /** @brief Sends an end of file on the channel, and waits until it left.
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_channel_send_eof
+   */
+  auto sendEof(){
+    return detail::retry(&session->state, [this, sent = false]() mutable {
+      if (!sent) {
+        int rc = ssh_channel_send_eof(channel);
+
+        sent = true;
+        if (rc != SSH_AGAIN) {
+          return rc;
+        }
+      }
+      return ssh_blocking_flush(getCSession(), 0);
+    });
+  }
+  /** @brief Closes the channel, and waits until the close message left.
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see ssh_channel_close
+   */
+  auto close(){
+    return detail::retry(&session->state, [this]() {
+      int rc = ssh_channel_close(channel);
+
+      if (rc != SSH_OK) {
+        return rc;
+      }
+      return ssh_blocking_flush(getCSession(), 0);
+    });
+  }
+  /** @brief Returns the exit status of the command, once the remote host
+   * closed the channel.
+   * @see ssh_channel_get_exit_status
+   */
+  int getExitStatus(){
+    return ssh_channel_get_exit_status(channel);
+  }
+  bool isEof(){
+    return ssh_channel_is_eof(channel) != 0;
+  }
+
+  ssh_session getCSession(){
+    return session->getCSession();
+  }
+
+  ssh_channel getCChannel(){
+    return channel;
+  }
+
+private:
+  AsyncSession *session;
+  ssh_channel channel;
+
+  /* No copy and no = operator */
+  AsyncChannel(const AsyncChannel &);
+  AsyncChannel &operator=(const AsyncChannel &);
+};
+
+#ifdef SSH_CPP_SFTP
+namespace detail {
+
+/*
+ * Awaits a request of the asynchronous sftp interface and takes its result,
+ * which is NULL or SSH_ERROR on error.
+ */
+template <typename Take>
+class SftpCall {
+public:
+  typedef decltype(std::declval<Take>()(sftp_request())) Result;
+
+  SftpCall(SessionState *state, sftp_session sftp, sftp_request request, Take take)
+    : state(state), sftp(sftp), request(request), take(std::move(take)), rc(SSH_OK) {}
+  ~SftpCall(){
+    sftp_request_free(request);
+  }
+
+  bool await_ready(){
+    if (request == NULL) {
+      rc = SSH_ERROR;
+      return true;
+    }
+    return poll(this);
+  }
+  void await_suspend(std::coroutine_handle<> handle){
+    state->executor->wait(state, poll, cancel, this, handle);
+  }
+  Result await_resume(){
+    if (rc != SSH_ERROR && sftp_request_get_status(request) == SSH_FX_OK) {
+      return take(request);
+    }
+#ifndef SSH_NO_CPP_EXCEPTIONS
+    if (state == NULL) {
+      /* the session is gone */
+      throw SshException(SSH_FATAL, "The session was destroyed");
+    }
+    if (rc == SSH_ERROR) {
+      throw SshException(state->session);
+    }
+    const char *msg = sftp_request_get_error(request);
+    if (msg == NULL || msg[0] == '\0') {
+      throw SshException(SSH_REQUEST_DENIED, "SFTP server: status " +
+          std::to_string(sftp_request_get_status(request)));
+    }
+    throw SshException(SSH_REQUEST_DENIED, std::string("SFTP server: ") + msg);
+#else
+    if constexpr (std::is_pointer<Result>::value) {
+      return NULL;
+    } else {
+      return SSH_ERROR;
+    }
+#endif
+  }
+
+private:
+  static bool poll(void *awaitable){
+    SftpCall *self = static_cast<SftpCall *>(awaitable);
+
+    self->rc = sftp_async_process(self->sftp, 0);
+    return self->rc == SSH_ERROR || sftp_request_is_done(self->request);
+  }
+  static void cancel(void *awaitable){
+    SftpCall *self = static_cast<SftpCall *>(awaitable);
+
+    self->state = NULL;
+    self->rc = SSH_ERROR;
+  }
+
+  SessionState *state;
+  sftp_session sftp;
+  sftp_request request;
+  Take take;
+  int rc;
+};
+
+template <typename Take>
+inline SftpCall<Take> sftpCall(SessionState *state, sftp_session sftp,
+                               sftp_request request, Take take){
+  return SftpCall<Take>(state, sftp, request, std::move(take));
+}
+
+} // namespace detail
+
+/**
+ * @brief A sftp session over a ssh::AsyncSession.
+ *
+ * Only the version exchange of init() blocks the executor; the other
+ * operations use the asynchronous sftp interface and can be pipelined by
+ * awaiting several of them from different tasks.
+ */
+class AsyncSftp {
+public:
+  AsyncSftp(AsyncSession &session){
+    this->session=&session;
+    sftp=NULL;
+  }
+  ~AsyncSftp(){
+    sftp_free(sftp);
+    sftp=NULL;
+  }
+
+  /** @brief Opens the sftp channel and negotiates the protocol version.
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see sftp_init
+   */
+  auto init(){
+    return detail::retry(&session->state,
+        [this, channel = (ssh_channel)NULL, opened = false]() mutable {
+      ssh_session c_session = session->getCSession();
+      int rc;
+
+      if (channel == NULL) {
+        channel = ssh_channel_new(c_session);
+        if (channel == NULL) {
+          return SSH_ERROR;
+        }
+        sftp = sftp_new_channel(c_session, channel);
+        if (sftp == NULL) {
+          ssh_channel_free(channel);
+          channel = NULL;
+          return SSH_ERROR;
+        }
+      }
+      if (!opened) {
+        rc = ssh_channel_open_session(channel);
+        if (rc != SSH_OK) {
+          return rc;
+        }
+        opened = true;
+      }
+      rc = ssh_channel_request_subsystem(channel, "sftp");
+      if (rc != SSH_OK) {
+        return rc;
+      }
+      /* one round trip, sftp_init() has no nonblocking variant */
+      ssh_set_blocking(c_session, 1);
+      rc = sftp_init(sftp);
+      ssh_set_blocking(c_session, 0);
+      return rc;
+    });
+  }
+
+  /** @brief Opens a file.
+   * @returns an awaitable of the nonblocking file handle, to be closed with
+   *          close()
+   * @throws SshException on error
+   * @see sftp_open
+   */
+  auto open(const char *path, int flags, mode_t mode){
+    return detail::sftpCall(&session->state, sftp,
+        send([&]() {
+          return sftp_async_open(sftp, path, flags, mode, NULL, NULL);
+        }),
+        [](sftp_request request) {
+          sftp_file file = sftp_request_get_file(request);
+
+          if (file != NULL) {
+            sftp_file_set_nonblocking(file);
+          }
+          return file;
+        });
+  }
+  /** @brief Closes a file, which is freed immediately.
+   * @returns an awaitable of SSH_OK
+   * @throws SshException on error
+   * @see sftp_close
+   */
+  auto close(sftp_file file){
+    return detail::sftpCall(&session->state, sftp,
+        send([&]() {
+          return sftp_async_close(file, NULL, NULL);
+        }),
+        [](sftp_request) {
+          return SSH_OK;
+        });
+  }
+  /** @brief Gets the attributes of a file.
+   * @returns an awaitable of the attributes, to be freed with
+   *          sftp_attributes_free()
+   * @throws SshException on error
+   * @see sftp_stat
+   */
+  auto stat(const char *path){
+    return detail::sftpCall(&session->state, sftp,
+        send([&]() {
+          return sftp_async_stat(sftp, path, NULL, NULL);
+        }),
+        [](sftp_request request) {
+          return sftp_request_get_attributes(request);
+        });
+  }
+  /** @brief Writes at the offset of a file, which is advanced as soon as
+   * the request is sent.
+   * @returns an awaitable of count
+   * @throws SshException on error
+   * @see sftp_write
+   */
+  auto write(sftp_file file, const void *buf, size_t count){
+    return detail::sftpCall(&session->state, sftp,
+        send([&]() {
+          return sftp_async_write(file, buf, count, NULL, NULL);
+        }),
+        [count](sftp_request) {
+          return (int)count;
+        });
+  }
+  /** @brief Reads from the offset of a file.
+   * @returns an awaitable of the number of bytes read, 0 at end of file
+   * @throws SshException on error
+   * @see sftp_async_read_begin
+   * @see sftp_async_read
+   */
+  auto read(sftp_file file, void *data, uint32_t len){
+    int id = send([&]() {
+      return sftp_async_read_begin(file, len);
+    });
+
+    return detail::retry(&session->state, [file, data, len, id]() {
+      if (id < 0) {
+        return SSH_ERROR;
+      }
+      return sftp_async_read(file, data, len, id);
+    });
+  }
+
+  sftp_session getCSftp(){
+    return sftp;
+  }
+
+private:
+  /*
+   * A request is sent in blocking mode, as the sftp packet would be cut if
+   * the window of the channel were exhausted in the middle of it.
+   */
+  template <typename Send>
+  auto send(Send s) -> decltype(s()){
+    ssh_session c_session = session->getCSession();
+
+    ssh_set_blocking(c_session, 1);
+    auto r = s();
+    ssh_set_blocking(c_session, 0);
+    return r;
+  }
+
+  AsyncSession *session;
+  sftp_session sftp;
+
+  /* No copy and no = operator */
+  AsyncSftp(const AsyncSftp &);
+  AsyncSftp &operator=(const AsyncSftp &);
+};
+#endif /* SSH_CPP_SFTP */
+
+/** @} */
+} // namespace ssh
+
+#endif /* __cplusplus >= 202002L */
+
 #endif /* LIBSSHPP_HPP_ */
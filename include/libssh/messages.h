@@ -97,6 +97,15 @@ SSH_PACKET_CALLBACK(ssh_packet_global_request);
 #ifdef WITH_SERVER
 SSH_PACKET_CALLBACK(ssh_packet_service_request);
 SSH_PACKET_CALLBACK(ssh_packet_userauth_request);
+
+struct ssh_signature_struct;
+
+void ssh_message_userauth_verified(ssh_message msg, int valid);
+void ssh_verify_queue_push(struct ssh_verify_queue_struct *queue,
+                           ssh_message msg,
+                           struct ssh_signature_struct *sig,
+                           ssh_buffer digest);
+void ssh_verify_queue_cancel(ssh_session session);
 #endif /* WITH_SERVER */
 
 int ssh_message_handle_channel_request(ssh_session session, ssh_channel channel, ssh_buffer packet,
@@ -85,6 +85,8 @@ int ssh_packet_hmac_verify(ssh_session session, const void *data, size_t len,
                            unsigned char *mac, enum ssh_hmac_e type);
 int ssh_packet_set_newkeys(ssh_session session,
                            enum ssh_crypto_direction_e direction);
+void ssh_init_rekey_state(struct ssh_session_struct *session,
+                          struct ssh_cipher_struct *cipher);
 struct ssh_crypto_struct *ssh_packet_get_current_crypto(ssh_session session,
         enum ssh_crypto_direction_e direction);
 
@@ -124,6 +124,7 @@ int ssh_pki_import_pubkey_blob(const ssh_string key_blob,
 
 int ssh_pki_import_cert_blob(const ssh_string cert_blob,
                              ssh_key *pkey);
+int ssh_pki_import_cert_key(const ssh_key cert, ssh_key *pkey);
 
 
 /* SSH Signing Functions */
@@ -137,6 +137,11 @@ int pki_ed25519_sign(const ssh_key privkey, ssh_signature sig,
         const unsigned char *hash, size_t hlen);
 int pki_ed25519_verify(const ssh_key pubkey, ssh_signature sig,
         const unsigned char *hash, size_t hlen);
+int pki_ed25519_verify_batch(const ssh_key *pubkeys,
+                             const ssh_signature *sigs,
+                             const unsigned char * const *hashes,
+                             const size_t *hlens,
+                             size_t n);
 int pki_ed25519_key_cmp(const ssh_key k1,
                 const ssh_key k2,
                 enum ssh_keycmp_e what);
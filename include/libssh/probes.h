@@ -0,0 +1,50 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#include "config.h"
+
+/*
+ * Static tracepoints (USDT) of the provider "libssh", for bpftrace, perf,
+ * SystemTap or DTrace. A probe which is not enabled is a single nop in the
+ * code, but <sys/sdt.h> computes its arguments every time it is passed, the
+ * probe is enabled or not. They must stay values at hand, like a field or a
+ * load of a few bytes, never a call. The double underscores become dashes
+ * in some tools.
+ *
+ * The probes and their arguments are listed in doc/tracing.dox, keep both
+ * in sync.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define SSH_PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(libssh, name, a1, a2)
+#define SSH_PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(libssh, name, a1, a2, a3)
+#define SSH_PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(libssh, name, a1, a2, a3, a4)
+#else
+#define SSH_PROBE2(name, a1, a2) do { } while (0)
+#define SSH_PROBE3(name, a1, a2, a3) do { } while (0)
+#define SSH_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* PROBES_H_ */
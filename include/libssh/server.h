@@ -51,7 +51,9 @@ enum ssh_bind_options_e {
   SSH_BIND_OPTIONS_CIPHERS_C_S,
   SSH_BIND_OPTIONS_CIPHERS_S_C,
   SSH_BIND_OPTIONS_HMAC_C_S,
-  SSH_BIND_OPTIONS_HMAC_S_C
+  SSH_BIND_OPTIONS_HMAC_S_C,
+  SSH_BIND_OPTIONS_MAX_STARTUPS,
+  SSH_BIND_OPTIONS_SOURCE_LIMIT
 };
 
 typedef struct ssh_bind_struct* ssh_bind;
@@ -162,7 +164,10 @@ LIBSSH_API void ssh_bind_fd_toaccept(ssh_bind ssh_bind_o);
  * @param  ssh_bind_o     The ssh server bind to accept a connection.
  * @param  session			A preallocated ssh session
  * @see ssh_new
- * @return SSH_OK when a connection is established
+ * @return SSH_OK when a connection is established, SSH_ERROR with the
+ *         SSH_REQUEST_DENIED error code when the connection was refused by
+ *         SSH_BIND_OPTIONS_MAX_STARTUPS or SSH_BIND_OPTIONS_SOURCE_LIMIT,
+ *         its socket is closed then and the server should keep accepting.
  */
 LIBSSH_API int ssh_bind_accept(ssh_bind ssh_bind_o, ssh_session session);
 
@@ -176,11 +181,16 @@ LIBSSH_API int ssh_bind_accept(ssh_bind ssh_bind_o, ssh_session session);
  *                          inbound connection
  * @see ssh_new
  * @see ssh_bind_accept
- * @return SSH_OK when a connection is established
+ * @return SSH_OK when a connection is established, SSH_ERROR with the
+ *         SSH_REQUEST_DENIED error code when the connection was refused
+ *         by the admission control of the bind, the caller still owns fd.
  */
 LIBSSH_API int ssh_bind_accept_fd(ssh_bind ssh_bind_o, ssh_session session,
         socket_t fd);
 
+LIBSSH_API int ssh_bind_admission_detach(ssh_session session);
+LIBSSH_API void ssh_bind_admission_done(ssh_bind sshbind);
+
 LIBSSH_API ssh_gssapi_creds ssh_gssapi_get_creds(ssh_session session);
 
 /**
@@ -360,6 +370,43 @@ LIBSSH_API int ssh_channel_request_send_exit_signal(ssh_channel channel,
 
 LIBSSH_API int ssh_send_keepalive(ssh_session session);
 
+typedef struct ssh_verify_queue_struct* ssh_verify_queue;
+
+LIBSSH_API ssh_verify_queue ssh_verify_queue_new(unsigned int batch_size);
+LIBSSH_API void ssh_verify_queue_free(ssh_verify_queue queue);
+LIBSSH_API int ssh_set_verify_queue(ssh_session session,
+                                    ssh_verify_queue queue);
+LIBSSH_API int ssh_verify_queue_flush(ssh_verify_queue queue);
+LIBSSH_API unsigned int ssh_verify_queue_pending(ssh_verify_queue queue);
+
+typedef struct ssh_authorized_keys_struct* ssh_authorized_keys;
+
+LIBSSH_API ssh_authorized_keys ssh_authorized_keys_new(void);
+LIBSSH_API void ssh_authorized_keys_free(ssh_authorized_keys keys);
+LIBSSH_API int ssh_authorized_keys_load_file(ssh_authorized_keys keys,
+                                             const char *filename);
+LIBSSH_API int ssh_authorized_keys_reload(ssh_authorized_keys keys);
+LIBSSH_API unsigned int ssh_authorized_keys_count(ssh_authorized_keys keys);
+LIBSSH_API int ssh_authorized_keys_match(ssh_authorized_keys keys,
+                                         const ssh_key key,
+                                         char **options);
+LIBSSH_API int ssh_message_auth_authorized_keys(ssh_message msg,
+                                                ssh_authorized_keys keys);
+
+typedef struct ssh_cert_verifier_struct* ssh_cert_verifier;
+
+LIBSSH_API ssh_cert_verifier ssh_cert_verifier_new(ssh_authorized_keys cas,
+                                                   unsigned int cache_size);
+LIBSSH_API void ssh_cert_verifier_free(ssh_cert_verifier verifier);
+LIBSSH_API void ssh_cert_verifier_set_revoked(ssh_cert_verifier verifier,
+                                              ssh_authorized_keys revoked);
+LIBSSH_API int ssh_cert_verifier_check(ssh_cert_verifier verifier,
+                                       ssh_session session,
+                                       const ssh_key cert,
+                                       const char *principal);
+LIBSSH_API int ssh_message_auth_cert(ssh_message msg,
+                                     ssh_cert_verifier verifier);
+
 /* deprecated functions */
 SSH_DEPRECATED LIBSSH_API int ssh_accept(ssh_session session);
 SSH_DEPRECATED LIBSSH_API int channel_write_stderr(ssh_channel channel,
@@ -75,6 +75,9 @@ enum ssh_pending_call_e {
 /* Client successfully authenticated */
 #define SSH_SESSION_FLAG_AUTHENTICATED 2
 
+/* Client connected through the control socket of a forwarder */
+#define SSH_SESSION_FLAG_CONTROL 4
+
 /* codes to use with ssh_handle_packets*() */
 /* Infinite timeout */
 #define SSH_TIMEOUT_INFINITE -1
@@ -188,7 +191,11 @@ struct ssh_session_struct {
         ssh_key ed25519_key;
         /* The type of host key wanted by client */
         enum ssh_keytypes_e hostkey;
+        /* batches the signature verifications of user authentication */
+        struct ssh_verify_queue_struct *verify_queue;
     } srv;
+    /* counts the session until it authenticates, if its bind limits that */
+    struct ssh_bind_admission_struct *admission;
 
     /* auths accepted by server */
     struct ssh_list *ssh_message_list; /* list of delayed SSH messages */
@@ -200,6 +207,8 @@ struct ssh_session_struct {
     struct ssh_list *packet_callbacks;
     struct ssh_socket_callbacks_struct socket_callbacks;
     ssh_poll_ctx default_poll_ctx;
+    /* the template the options are shared with, if any */
+    struct ssh_session_template_struct *session_template;
     /* options */
 #ifdef WITH_PCAP
     ssh_pcap_context pcap_ctx; /* pcap debugging context */
@@ -213,8 +222,10 @@ struct ssh_session_struct {
         char *knownhosts;
         char *global_knownhosts;
         char *wanted_methods[10];
+        struct ssh_kex_algos wanted_algos[10];
         char *pubkey_accepted_types;
         char *ProxyCommand;
+        char *control_path;
         char *custombanner;
         unsigned long timeout; /* seconds */
         unsigned long timeout_usec;
@@ -249,5 +260,25 @@ int ssh_handle_packets_termination(ssh_session session,
                                    ssh_termination_function fct,
                                    void *user);
 void ssh_socket_exception_callback(int code, int errno_code, void *user);
+void ssh_client_connection_callback(ssh_session session);
+#ifdef WITH_SERVER
+void ssh_server_connection_callback(ssh_session session);
+#endif /* WITH_SERVER */
+
+bool ssh_session_template_owns(ssh_session session, const void *value);
+int ssh_session_template_get_identity(ssh_session session,
+                                      const char *path,
+                                      ssh_key *privkey,
+                                      ssh_key *pubkey);
+
+/* Free an option value, unless it is shared with the session template */
+#define SSH_OPTIONS_FREE(session, x) \
+    do { \
+        if (ssh_session_template_owns((session), (x))) { \
+            (x) = NULL; \
+        } else { \
+            SAFE_FREE(x); \
+        } \
+    } while (0)
 
 #endif /* SESSION_H_ */
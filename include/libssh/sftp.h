@@ -66,18 +66,38 @@ extern "C" {
 
 #define LIBSFTP_VERSION 3
 
+/* The largest write every server accepts in a single request */
+#define SFTP_ASYNC_WRITE_SIZE_MAX 32768
+
 typedef struct sftp_attributes_struct* sftp_attributes;
+typedef struct sftp_cache_struct* sftp_cache;
+typedef struct sftp_cache_stats_struct* sftp_cache_stats;
 typedef struct sftp_client_message_struct* sftp_client_message;
 typedef struct sftp_dir_struct* sftp_dir;
 typedef struct sftp_ext_struct *sftp_ext;
 typedef struct sftp_file_struct* sftp_file;
 typedef struct sftp_message_struct* sftp_message;
 typedef struct sftp_packet_struct* sftp_packet;
+typedef struct sftp_request_struct* sftp_request;
 typedef struct sftp_request_queue_struct* sftp_request_queue;
 typedef struct sftp_session_struct* sftp_session;
 typedef struct sftp_status_message_struct* sftp_status_message;
 typedef struct sftp_statvfs_struct* sftp_statvfs_t;
 
+/**
+ * @brief Callback called when the reply to an asynchronous request arrived.
+ *
+ * The callback is called from sftp_async_process(), from ssh_event_dopoll()
+ * once the session was added with sftp_async_event_add(), or from a blocking
+ * sftp function reading replies on the same session. It may free the request
+ * with sftp_request_free() and send new requests.
+ *
+ * @param request       The completed request.
+ *
+ * @param userdata      The pointer passed when the request was sent.
+ */
+typedef void (*sftp_request_callback)(sftp_request request, void *userdata);
+
 struct sftp_session_struct {
     ssh_session session;
     ssh_channel channel;
@@ -90,6 +110,9 @@ struct sftp_session_struct {
     void **handles;
     sftp_ext ext;
     sftp_packet read_packet;
+    sftp_cache cache;
+    struct sftp_async_struct *async;
+    int lazy_owner_group;
 };
 
 struct sftp_packet_struct {
@@ -115,6 +138,9 @@ struct sftp_dir_struct {
     ssh_buffer buffer; /* contains raw attributes from server which haven't been parsed */
     uint32_t count; /* counts the number of following attributes structures into buffer */
     int eof; /* end of directory listing */
+    sftp_attributes *listing; /* entries served from or collected for the cache */
+    uint32_t listing_count;
+    uint32_t listing_pos;
 };
 
 struct sftp_message_struct {
@@ -181,6 +207,8 @@ struct sftp_attributes_struct {
     uint32_t extended_count;
     ssh_string extended_type;
     ssh_string extended_data;
+    /* owner and group are still to be taken from the longname */
+    int owner_group_lazy;
 };
 
 /**
@@ -200,6 +228,17 @@ struct sftp_statvfs_struct {
   uint64_t f_namemax; /** maximum filename length */
 };
 
+/**
+ * @brief SFTP metadata cache statistics.
+ */
+struct sftp_cache_stats_struct {
+  uint64_t hits;          /** lookups answered from the cache */
+  uint64_t misses;        /** lookups which needed a round trip */
+  uint64_t invalidations; /** entries dropped by local modifications */
+  uint64_t evictions;     /** entries dropped because the cache was full */
+  uint64_t entries;       /** number of paths currently cached */
+};
+
 /**
  * @brief Start a new sftp session.
  *
@@ -400,6 +439,52 @@ LIBSSH_API sftp_attributes sftp_fstat(sftp_file file);
  */
 LIBSSH_API void sftp_attributes_free(sftp_attributes file);
 
+/**
+ * @brief Get the owner name of a file.
+ *
+ * With sftp version 3 the owner is taken from the longname sent by OpenSSH
+ * servers. If it has not been extracted yet, because the session uses
+ * sftp_set_lazy_owner_group(), it is extracted now.
+ *
+ * @param attr          The sftp attributes of the file.
+ *
+ * @return              The owner name, NULL if it is unknown. It is freed
+ *                      with the attributes.
+ *
+ * @see sftp_set_lazy_owner_group()
+ */
+LIBSSH_API const char *sftp_attributes_get_owner(sftp_attributes attr);
+
+/**
+ * @brief Get the group name of a file.
+ *
+ * @param attr          The sftp attributes of the file.
+ *
+ * @return              The group name, NULL if it is unknown. It is freed
+ *                      with the attributes.
+ *
+ * @see sftp_attributes_get_owner()
+ */
+LIBSSH_API const char *sftp_attributes_get_group(sftp_attributes attr);
+
+/**
+ * @brief Only extract the owner and group of files when they are asked for.
+ *
+ * By default the owner and group fields of the attributes returned by
+ * sftp_readdir() are filled from the longname of every entry. Large
+ * directory listings are parsed faster if this is deferred until
+ * sftp_attributes_get_owner() or sftp_attributes_get_group() is called.
+ * The owner and group fields must not be read directly then.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param enable        1 to extract the owner and group lazily, 0 to extract
+ *                      them for every entry.
+ *
+ * @return              0 on success, -1 on error.
+ */
+LIBSSH_API int sftp_set_lazy_owner_group(sftp_session sftp, int enable);
+
 /**
  * @brief Close a directory handle opened by sftp_opendir().
  *
@@ -539,6 +624,580 @@ LIBSSH_API int sftp_async_read_begin(sftp_file file, uint32_t len);
  */
 LIBSSH_API int sftp_async_read(sftp_file file, void *data, uint32_t len, uint32_t id);
 
+/**
+ * @brief Download a file over several sftp sessions in parallel.
+ *
+ * The file is split into ranges which are requested over all the given sftp
+ * sessions at the same time, each of them keeping several read requests in
+ * flight. The data is written at the matching offsets of the local file, so
+ * the throughput is not limited by the window of a single channel anymore.
+ *
+ * The sessions can be several sftp_new() channels on the same ssh session or
+ * on different ssh sessions to the same server. If a channel fails, the
+ * ranges it was working on are transferred again on the remaining ones.
+ *
+ * @param sftp          An array of initialized sftp sessions.
+ *
+ * @param count         The number of sftp sessions in the array.
+ *
+ * @param path          The remote file to download.
+ *
+ * @param fd            A file descriptor of the local file, opened for
+ *                      writing. It is resized to the size of the remote file.
+ *
+ * @return              SSH_OK on success, SSH_ERROR if the transfer failed on
+ *                      all the channels or the local file could not be
+ *                      written. The error is set on the ssh session of the
+ *                      failing sftp session.
+ *
+ * @see sftp_striped_upload()
+ */
+LIBSSH_API int sftp_striped_download(sftp_session *sftp,
+                                     size_t count,
+                                     const char *path,
+                                     int fd);
+
+/**
+ * @brief Upload a file over several sftp sessions in parallel.
+ *
+ * This is the counterpart of sftp_striped_download(). The remote file is
+ * created or truncated and the ranges of the local file are written with
+ * pipelined write requests over all the given sftp sessions.
+ *
+ * @param sftp          An array of initialized sftp sessions.
+ *
+ * @param count         The number of sftp sessions in the array.
+ *
+ * @param fd            A file descriptor of the local file, opened for
+ *                      reading.
+ *
+ * @param path          The remote file to create.
+ *
+ * @param mode          The permissions to use if the remote file is created.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see sftp_striped_download()
+ */
+LIBSSH_API int sftp_striped_upload(sftp_session *sftp,
+                                   size_t count,
+                                   int fd,
+                                   const char *path,
+                                   mode_t mode);
+
+/**
+ * @brief Resume an interrupted download.
+ *
+ * If the local file already contains the start of the remote file, for
+ * example from a transfer which was interrupted, only the missing part is
+ * downloaded. Before resuming, the last verify_size bytes of the local file
+ * are read back from the server and compared, if they differ the download
+ * restarts from the beginning.
+ *
+ * The local file is only extended as data arrives, in order, so a download
+ * interrupted again can be resumed the same way.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The remote file to download.
+ *
+ * @param fd            A file descriptor of the local file, opened for
+ *                      reading and writing.
+ *
+ * @param verify_size   The number of bytes at the end of the partial file to
+ *                      compare, 0 for the default of 1 MiB.
+ *
+ * @param resumed       A pointer to store the offset the download resumed
+ *                      from, may be NULL.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see sftp_resume_upload()
+ */
+LIBSSH_API int sftp_resume_download(sftp_session sftp,
+                                    const char *path,
+                                    int fd,
+                                    uint64_t verify_size,
+                                    uint64_t *resumed);
+
+/**
+ * @brief Resume an interrupted upload.
+ *
+ * This is the counterpart of sftp_resume_download(). The tail of the remote
+ * file is read back and compared with the local file, and only the missing
+ * part is uploaded if it matches.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param fd            A file descriptor of the local file, opened for
+ *                      reading.
+ *
+ * @param path          The remote file to complete.
+ *
+ * @param mode          The permissions to use if the remote file is created.
+ *
+ * @param verify_size   The number of bytes at the end of the partial file to
+ *                      compare, 0 for the default of 1 MiB.
+ *
+ * @param resumed       A pointer to store the offset the upload resumed from,
+ *                      may be NULL.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see sftp_resume_download()
+ */
+LIBSSH_API int sftp_resume_upload(sftp_session sftp,
+                                  int fd,
+                                  const char *path,
+                                  mode_t mode,
+                                  uint64_t verify_size,
+                                  uint64_t *resumed);
+
+/**
+ * @brief Send an open request without waiting for the reply.
+ *
+ * The asynchronous request functions send the request and return at once.
+ * Many requests can be in flight at the same time on one sftp session, the
+ * replies are matched to their requests by sftp_async_process(), which calls
+ * the completion callback of each request as its reply arrives.
+ *
+ * @code
+ * static void stat_done(sftp_request req, void *userdata)
+ * {
+ *     sftp_attributes attr = sftp_request_get_attributes(req);
+ *
+ *     ...
+ *     sftp_attributes_free(attr);
+ *     sftp_request_free(req);
+ * }
+ *
+ * for (i = 0; i < n; i++) {
+ *     sftp_async_stat(sftp, paths[i], stat_done, NULL);
+ * }
+ * while (sftp_async_pending(sftp) > 0) {
+ *     rc = sftp_async_process(sftp, -1);
+ *     if (rc < 0) {
+ *         break;
+ *     }
+ * }
+ * @endcode
+ *
+ * Use sftp_request_get_file() to get the opened file once the request
+ * completed with SSH_FX_OK. The O_APPEND flag is not supported.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The file to open.
+ *
+ * @param flags         The open flags, like for sftp_open().
+ *
+ * @param mode          The permissions to use if the file is created.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ *
+ * @see sftp_async_process()
+ * @see sftp_request_free()
+ */
+LIBSSH_API sftp_request sftp_async_open(sftp_session sftp,
+                                        const char *path,
+                                        int flags,
+                                        mode_t mode,
+                                        sftp_request_callback callback,
+                                        void *userdata);
+
+/**
+ * @brief Send a close request for a file without waiting for the reply.
+ *
+ * The file handle is freed immediately and must not be used anymore.
+ *
+ * @param file          The file to close.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_close(sftp_file file,
+                                         sftp_request_callback callback,
+                                         void *userdata);
+
+/**
+ * @brief Send an opendir request without waiting for the reply.
+ *
+ * Use sftp_request_get_dir() to get the directory once the request completed
+ * with SSH_FX_OK.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The directory to open.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_opendir(sftp_session sftp,
+                                           const char *path,
+                                           sftp_request_callback callback,
+                                           void *userdata);
+
+/**
+ * @brief Send a readdir request without waiting for the reply.
+ *
+ * Call sftp_request_get_attributes() on the completed request until it
+ * returns NULL to get the entries of the reply. The request completes with
+ * SSH_FX_EOF at the end of the directory.
+ *
+ * @param dir           The directory opened with sftp_opendir() or
+ *                      sftp_async_opendir().
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_readdir(sftp_dir dir,
+                                           sftp_request_callback callback,
+                                           void *userdata);
+
+/**
+ * @brief Send a close request for a directory without waiting for the reply.
+ *
+ * The directory handle is freed immediately and must not be used anymore.
+ *
+ * @param dir           The directory to close.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_closedir(sftp_dir dir,
+                                            sftp_request_callback callback,
+                                            void *userdata);
+
+/**
+ * @brief Send a stat request without waiting for the reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The file to stat, symbolic links are followed.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ *
+ * @see sftp_request_get_attributes()
+ */
+LIBSSH_API sftp_request sftp_async_stat(sftp_session sftp,
+                                        const char *path,
+                                        sftp_request_callback callback,
+                                        void *userdata);
+
+/**
+ * @brief Send a lstat request without waiting for the reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The file to stat, symbolic links are not followed.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ *
+ * @see sftp_request_get_attributes()
+ */
+LIBSSH_API sftp_request sftp_async_lstat(sftp_session sftp,
+                                         const char *path,
+                                         sftp_request_callback callback,
+                                         void *userdata);
+
+/**
+ * @brief Send a mkdir request without waiting for the reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The directory to create.
+ *
+ * @param mode          The permissions of the new directory.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_mkdir(sftp_session sftp,
+                                         const char *path,
+                                         mode_t mode,
+                                         sftp_request_callback callback,
+                                         void *userdata);
+
+/**
+ * @brief Send a rmdir request without waiting for the reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The directory to remove.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_rmdir(sftp_session sftp,
+                                         const char *path,
+                                         sftp_request_callback callback,
+                                         void *userdata);
+
+/**
+ * @brief Send a remove request without waiting for the reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The file to remove.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_unlink(sftp_session sftp,
+                                          const char *path,
+                                          sftp_request_callback callback,
+                                          void *userdata);
+
+/**
+ * @brief Send a rename request without waiting for the reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param original      The file to rename.
+ *
+ * @param newname       The new name of the file.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_rename(sftp_session sftp,
+                                          const char *original,
+                                          const char *newname,
+                                          sftp_request_callback callback,
+                                          void *userdata);
+
+/**
+ * @brief Send a setstat request without waiting for the reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param path          The file to change.
+ *
+ * @param attr          The attributes to set.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_setstat(sftp_session sftp,
+                                           const char *path,
+                                           sftp_attributes attr,
+                                           sftp_request_callback callback,
+                                           void *userdata);
+
+/**
+ * @brief Send a write request without waiting for the reply.
+ *
+ * The data is copied into the request and the file offset is advanced by
+ * count, so several writes can be pipelined. Larger data has to be split in
+ * writes of at most SFTP_ASYNC_WRITE_SIZE_MAX bytes.
+ *
+ * @param file          The open sftp file handle.
+ *
+ * @param buf           The data to write.
+ *
+ * @param count         The number of bytes to write, at most
+ *                      SFTP_ASYNC_WRITE_SIZE_MAX.
+ *
+ * @param callback      The completion callback, may be NULL.
+ *
+ * @param userdata      The pointer passed to the callback.
+ *
+ * @return              The request, NULL if it could not be sent.
+ */
+LIBSSH_API sftp_request sftp_async_write(sftp_file file,
+                                         const void *buf,
+                                         size_t count,
+                                         sftp_request_callback callback,
+                                         void *userdata);
+
+/**
+ * @brief Process the replies to asynchronous requests.
+ *
+ * Reads the replies available on the channel and completes the matching
+ * requests, calling their callbacks. Replies to the blocking functions are
+ * kept for them, so both can be mixed on the same session.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param timeout       How long to wait for at least one reply in
+ *                      milliseconds, 0 to only process what already arrived,
+ *                      -1 to wait until a request completed.
+ *
+ * @return              The number of completed requests, SSH_ERROR on error.
+ */
+LIBSSH_API int sftp_async_process(sftp_session sftp, int timeout);
+
+/**
+ * @brief Process the replies to asynchronous requests in an event loop.
+ *
+ * Adds the session of the sftp session to the event. From then on the
+ * replies are processed as they arrive during ssh_event_dopoll(), which calls
+ * the completion callbacks, and sftp_async_process() is not needed. The
+ * callbacks must not call the blocking sftp functions then, as they run while
+ * the packets of the session are processed.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param event         The event to add the session to.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see sftp_async_event_remove()
+ */
+LIBSSH_API int sftp_async_event_add(sftp_session sftp, ssh_event event);
+
+/**
+ * @brief Stop processing the replies in an event loop.
+ *
+ * Removes the session from the event it was added to with
+ * sftp_async_event_add(). This is done by sftp_free() too.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @param event         The event the session was added to.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+LIBSSH_API int sftp_async_event_remove(sftp_session sftp, ssh_event event);
+
+/**
+ * @brief Get the number of asynchronous requests waiting for a reply.
+ *
+ * @param sftp          The sftp session handle.
+ *
+ * @return              The number of pending requests.
+ */
+LIBSSH_API int sftp_async_pending(sftp_session sftp);
+
+/**
+ * @brief Wait until an asynchronous request completed.
+ *
+ * @param request       The request to wait for.
+ *
+ * @return              The status of the request, SSH_ERROR on error.
+ */
+LIBSSH_API int sftp_request_wait(sftp_request request);
+
+/**
+ * @brief Check if an asynchronous request completed.
+ *
+ * @param request       The request to check.
+ *
+ * @return              1 if the reply arrived, 0 otherwise.
+ */
+LIBSSH_API int sftp_request_is_done(sftp_request request);
+
+/**
+ * @brief Get the sftp identifier of a request.
+ *
+ * @param request       The request.
+ *
+ * @return              The identifier of the request.
+ */
+LIBSSH_API uint32_t sftp_request_get_id(sftp_request request);
+
+/**
+ * @brief Get the status of a completed request.
+ *
+ * @param request       The request.
+ *
+ * @return              The SSH_FX_* status code of the reply, SSH_AGAIN if
+ *                      the reply did not arrive yet.
+ */
+LIBSSH_API int sftp_request_get_status(sftp_request request);
+
+/**
+ * @brief Get the error message the server sent with a failure status.
+ *
+ * @param request       The request.
+ *
+ * @return              The message, NULL if there is none. It is freed with
+ *                      the request.
+ */
+LIBSSH_API const char *sftp_request_get_error(sftp_request request);
+
+/**
+ * @brief Get the attributes returned by a stat, lstat or readdir request.
+ *
+ * For a readdir request every call returns the next entry of the reply.
+ *
+ * @param request       The completed request.
+ *
+ * @return              The attributes, NULL if there are no (more). Free them
+ *                      with sftp_attributes_free().
+ */
+LIBSSH_API sftp_attributes sftp_request_get_attributes(sftp_request request);
+
+/**
+ * @brief Get the file opened by an open request.
+ *
+ * @param request       The completed request.
+ *
+ * @return              The file, NULL if the open failed. The caller owns it
+ *                      and closes it with sftp_close().
+ */
+LIBSSH_API sftp_file sftp_request_get_file(sftp_request request);
+
+/**
+ * @brief Get the directory opened by an opendir request.
+ *
+ * @param request       The completed request.
+ *
+ * @return              The directory, NULL if the opendir failed. The caller
+ *                      owns it and closes it with sftp_closedir().
+ */
+LIBSSH_API sftp_dir sftp_request_get_dir(sftp_request request);
+
+/**
+ * @brief Free an asynchronous request.
+ *
+ * If the reply did not arrive yet, the request is freed when it does and its
+ * callback is not called anymore. Results not taken from the request are
+ * freed with it.
+ *
+ * @param request       The request to free.
+ */
+LIBSSH_API void sftp_request_free(sftp_request request);
+
 /**
  * @brief Write to a file using an opened sftp file handle.
  *
@@ -833,6 +1492,80 @@ LIBSSH_API char *sftp_canonicalize_path(sftp_session sftp, const char *path);
  */
 LIBSSH_API int sftp_server_version(sftp_session sftp);
 
+/**
+ * @brief Create a new metadata cache for sftp sessions.
+ *
+ * The cache keeps the attributes returned by sftp_stat(), sftp_lstat() and
+ * sftp_readdir() as well as complete directory listings for ttl_ms
+ * milliseconds. Local modifications done through sftp_rename(),
+ * sftp_unlink(), sftp_rmdir(), sftp_mkdir(), sftp_setstat(), sftp_symlink()
+ * and sftp_write() invalidate the affected entries. Changes done by other
+ * clients on the server are not seen until the entries expire.
+ *
+ * A cache is thread-safe and can be attached to several sftp sessions
+ * connected to the same server with sftp_set_cache().
+ *
+ * @param ttl_ms        The time in milliseconds an entry stays valid.
+ *
+ * @param max_entries   The maximum number of paths to keep. When the cache is
+ *                      full the oldest entry is dropped.
+ *
+ * @return              A new cache or NULL on error.
+ *
+ * @see sftp_cache_free()
+ * @see sftp_set_cache()
+ */
+LIBSSH_API sftp_cache sftp_cache_new(unsigned int ttl_ms, size_t max_entries);
+
+/**
+ * @brief Free a metadata cache.
+ *
+ * The cache must not be attached to any sftp session anymore.
+ *
+ * @param cache         The cache to free.
+ */
+LIBSSH_API void sftp_cache_free(sftp_cache cache);
+
+/**
+ * @brief Attach a metadata cache to a sftp session.
+ *
+ * @param sftp          The sftp session to use the cache with.
+ *
+ * @param cache         The cache to use or NULL to disable caching. The cache
+ *                      must outlive the sftp session.
+ *
+ * @return              0 on success, < 0 on error.
+ */
+LIBSSH_API int sftp_set_cache(sftp_session sftp, sftp_cache cache);
+
+/**
+ * @brief Drop the cached attributes of a path.
+ *
+ * Use this if the path has been modified by other means than the sftp
+ * session(s) the cache is attached to.
+ *
+ * @param cache         The cache to use.
+ *
+ * @param path          The path to invalidate.
+ */
+LIBSSH_API void sftp_cache_invalidate(sftp_cache cache, const char *path);
+
+/**
+ * @brief Drop all entries of a metadata cache.
+ *
+ * @param cache         The cache to flush.
+ */
+LIBSSH_API void sftp_cache_flush(sftp_cache cache);
+
+/**
+ * @brief Get the hit and miss counters of a metadata cache.
+ *
+ * @param cache         The cache to query.
+ *
+ * @param stats         A pointer to a structure to fill with the statistics.
+ */
+LIBSSH_API void sftp_cache_get_stats(sftp_cache cache, sftp_cache_stats stats);
+
 #ifdef WITH_SERVER
 /**
  * @brief Create a new sftp server session.
@@ -0,0 +1,47 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SFTP_CACHE_H_
+#define SFTP_CACHE_H_
+
+#include "libssh/sftp.h"
+
+sftp_attributes sftp_attributes_dup(sftp_attributes attr);
+
+sftp_attributes sftp_cache_lookup(sftp_cache cache,
+                                  const char *path,
+                                  int follow_links);
+void sftp_cache_store(sftp_cache cache,
+                      const char *path,
+                      int follow_links,
+                      sftp_attributes attr);
+void sftp_cache_invalidate_tree(sftp_cache cache, const char *path);
+void sftp_cache_store_dir_entry(sftp_cache cache,
+                                const char *dirname,
+                                sftp_attributes attr);
+
+int sftp_cache_listing_lookup(sftp_cache cache,
+                              const char *dirname,
+                              sftp_attributes **entries,
+                              uint32_t *count);
+void sftp_cache_listing_store(sftp_cache cache,
+                              const char *dirname,
+                              sftp_attributes *entries,
+                              uint32_t count);
+
+#endif /* SFTP_CACHE_H_ */
@@ -54,6 +54,7 @@ void ssh_socket_set_except(ssh_socket s);
 int ssh_socket_get_status(ssh_socket s);
 int ssh_socket_get_poll_flags(ssh_socket s);
 int ssh_socket_buffered_write_bytes(ssh_socket s);
+ssh_buffer ssh_socket_get_in_buffer(ssh_socket s);
 int ssh_socket_data_available(ssh_socket s);
 int ssh_socket_data_writable(ssh_socket s);
 int ssh_socket_set_nonblocking(socket_t fd);
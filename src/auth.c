@@ -1074,7 +1074,14 @@ int ssh_userauth_publickey_auto(ssh_session session,
             state->pubkey = NULL;
             snprintf(pubkey_file, sizeof(pubkey_file), "%s.pub", privkey_file);
 
-            rc = ssh_pki_import_pubkey_file(pubkey_file, &state->pubkey);
+            /* The template of the session may have read the key already */
+            rc = ssh_session_template_get_identity(session,
+                                                   privkey_file,
+                                                   &state->privkey,
+                                                   &state->pubkey);
+            if (rc != SSH_OK) {
+                rc = ssh_pki_import_pubkey_file(pubkey_file, &state->pubkey);
+            }
             if (rc == SSH_ERROR) {
                 ssh_set_error(session,
                         SSH_FATAL,
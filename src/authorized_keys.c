@@ -0,0 +1,897 @@
+/*
+ * authorized_keys.c - indexed authorized_keys files for the servers
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libssh/priv.h"
+#include "libssh/libssh.h"
+#include "libssh/server.h"
+#include "libssh/authorized_keys.h"
+#include "libssh/buffer.h"
+#include "libssh/bytearray.h"
+#include "libssh/pki.h"
+#include "libssh/threads.h"
+
+/*
+ * The keys of a file are kept as the blobs their lines decode to, in a
+ * single allocation with the options of the lines, and indexed by a hash of
+ * the blob in an open addressing table. A client key is looked up by its own
+ * blob, so that neither the lines nor the keys are parsed again on logins.
+ *
+ * The tables are immutable: a changed file is read into a new one, outside
+ * of the lock, which then replaces the old one.
+ */
+
+/* the longest line read, the options of a 16384 bits RSA key fit */
+#define SSH_AUTHORIZED_KEYS_LINE 16384
+#define SSH_AUTHORIZED_KEYS_NO_OPTIONS UINT32_MAX
+
+struct ssh_authorized_keys_entry {
+    uint64_t hash;
+    uint32_t blob;
+    uint32_t blob_len;
+    uint32_t options;
+};
+
+struct ssh_authorized_keys_table {
+    /* the blobs and the options, nul-terminated */
+    unsigned char *data;
+    size_t data_len;
+    size_t data_size;
+
+    struct ssh_authorized_keys_entry *entries;
+    uint32_t nentries;
+    uint32_t entries_size;
+
+    /* indexes in entries plus one, 0 for a free slot */
+    uint32_t *slots;
+    uint32_t mask;
+    uint32_t count;
+};
+
+struct ssh_authorized_keys_struct {
+    char *filename;
+    struct stat st;
+    /* when the file was last looked at, for the reloads */
+    time_t checked;
+    int reloading;
+
+    struct ssh_authorized_keys_table *table;
+};
+
+/* the stores are shared by the threads serving the sessions */
+static SSH_MUTEX ssh_authorized_keys_mutex = SSH_MUTEX_STATIC_INIT;
+
+/**
+ * @addtogroup libssh_server
+ *
+ * @{
+ */
+
+static uint64_t ssh_authorized_keys_hash(const unsigned char *blob,
+                                         size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ blob[i]) * 0x100000001b3ULL;
+    }
+
+    /* 0 marks the free slots */
+    return h | 1;
+}
+
+static void
+ssh_authorized_keys_table_free(struct ssh_authorized_keys_table *table)
+{
+    if (table == NULL) {
+        return;
+    }
+
+    SAFE_FREE(table->data);
+    SAFE_FREE(table->entries);
+    SAFE_FREE(table->slots);
+    SAFE_FREE(table);
+}
+
+static uint32_t
+ssh_authorized_keys_table_put(struct ssh_authorized_keys_table *table,
+                              const void *data,
+                              size_t len)
+{
+    unsigned char *p = NULL;
+    size_t size;
+    uint32_t offset;
+
+    if (table->data_len + len > UINT32_MAX - 1) {
+        return SSH_AUTHORIZED_KEYS_NO_OPTIONS;
+    }
+
+    if (table->data_len + len > table->data_size) {
+        size = MAX(table->data_size * 2, table->data_len + len);
+        size = MAX(size, 4096);
+        p = realloc(table->data, size);
+        if (p == NULL) {
+            return SSH_AUTHORIZED_KEYS_NO_OPTIONS;
+        }
+        table->data = p;
+        table->data_size = size;
+    }
+
+    offset = (uint32_t)table->data_len;
+    memcpy(table->data + table->data_len, data, len);
+    table->data_len += len;
+
+    return offset;
+}
+
+static int
+ssh_authorized_keys_table_add(struct ssh_authorized_keys_table *table,
+                              const unsigned char *blob,
+                              size_t blob_len,
+                              const char *options)
+{
+    struct ssh_authorized_keys_entry *entry = NULL;
+    struct ssh_authorized_keys_entry *entries = NULL;
+    uint32_t size;
+
+    if (table->nentries == table->entries_size) {
+        if (table->entries_size > UINT32_MAX / 2 - 1) {
+            return SSH_ERROR;
+        }
+        size = MAX(table->entries_size * 2, 64);
+        entries = realloc(table->entries,
+                          size * sizeof(struct ssh_authorized_keys_entry));
+        if (entries == NULL) {
+            return SSH_ERROR;
+        }
+        table->entries = entries;
+        table->entries_size = size;
+    }
+
+    entry = &table->entries[table->nentries];
+    entry->hash = ssh_authorized_keys_hash(blob, blob_len);
+    entry->blob_len = (uint32_t)blob_len;
+    entry->blob = ssh_authorized_keys_table_put(table, blob, blob_len);
+    if (entry->blob == SSH_AUTHORIZED_KEYS_NO_OPTIONS) {
+        return SSH_ERROR;
+    }
+    entry->options = SSH_AUTHORIZED_KEYS_NO_OPTIONS;
+    if (options != NULL) {
+        entry->options = ssh_authorized_keys_table_put(table,
+                                                       options,
+                                                       strlen(options) + 1);
+        if (entry->options == SSH_AUTHORIZED_KEYS_NO_OPTIONS) {
+            return SSH_ERROR;
+        }
+    }
+    table->nentries++;
+
+    return SSH_OK;
+}
+
+static const struct ssh_authorized_keys_entry *
+ssh_authorized_keys_table_lookup(const struct ssh_authorized_keys_table *table,
+                                 const unsigned char *blob,
+                                 size_t len,
+                                 uint64_t hash,
+                                 uint32_t *slot)
+{
+    const struct ssh_authorized_keys_entry *entry = NULL;
+    uint32_t i;
+
+    for (i = (uint32_t)hash & table->mask;
+         table->slots[i] != 0;
+         i = (i + 1) & table->mask) {
+        entry = &table->entries[table->slots[i] - 1];
+        if (entry->hash == hash &&
+            entry->blob_len == len &&
+            memcmp(table->data + entry->blob, blob, len) == 0) {
+            return entry;
+        }
+    }
+    if (slot != NULL) {
+        *slot = i;
+    }
+
+    return NULL;
+}
+
+/* indexes the entries once they were all read, the first line wins */
+static int
+ssh_authorized_keys_table_index(struct ssh_authorized_keys_table *table)
+{
+    struct ssh_authorized_keys_entry *entry = NULL;
+    uint32_t size = 16;
+    uint32_t slot;
+    uint32_t i;
+
+    while (size < table->nentries * 2) {
+        if (size > UINT32_MAX / 2) {
+            return SSH_ERROR;
+        }
+        size *= 2;
+    }
+    table->slots = calloc(size, sizeof(uint32_t));
+    if (table->slots == NULL) {
+        return SSH_ERROR;
+    }
+    table->mask = size - 1;
+
+    for (i = 0; i < table->nentries; i++) {
+        entry = &table->entries[i];
+        if (ssh_authorized_keys_table_lookup(table,
+                                             table->data + entry->blob,
+                                             entry->blob_len,
+                                             entry->hash,
+                                             &slot) != NULL) {
+            continue;
+        }
+        table->slots[slot] = i + 1;
+        table->count++;
+    }
+
+    return SSH_OK;
+}
+
+/*
+ * Splits a line in its options, key type and base64 blob, the comment is
+ * ignored. Returns SSH_AGAIN for the lines without a key.
+ */
+static int ssh_authorized_keys_parse_line(char *line,
+                                          char **options,
+                                          char **type,
+                                          char **b64)
+{
+    char *p = line;
+    char *q = NULL;
+    int quoted = 0;
+    size_t len;
+
+    *options = NULL;
+
+    while (isspace((int)*p)) {
+        p++;
+    }
+    if (*p == '\0' || *p == '#') {
+        return SSH_AGAIN;
+    }
+
+    len = strcspn(p, " \t");
+    if (p[len] == '\0') {
+        return SSH_ERROR;
+    }
+    p[len] = '\0';
+    if (ssh_key_type_from_name(p) == SSH_KEYTYPE_UNKNOWN) {
+        p[len] = ' ';
+        /* the options, with spaces in their quoted values */
+        for (q = p; *q != '\0'; q++) {
+            if (*q == '\\' && q[1] == '"') {
+                q++;
+            } else if (*q == '"') {
+                quoted = !quoted;
+            } else if (!quoted && (*q == ' ' || *q == '\t')) {
+                break;
+            }
+        }
+        if (*q == '\0') {
+            return SSH_ERROR;
+        }
+        *q = '\0';
+        *options = p;
+
+        for (p = q + 1; *p == ' ' || *p == '\t'; p++);
+        len = strcspn(p, " \t");
+        if (p[len] == '\0') {
+            return SSH_ERROR;
+        }
+        p[len] = '\0';
+    }
+    *type = p;
+
+    for (p += len + 1; *p == ' ' || *p == '\t'; p++);
+    len = strcspn(p, " \t\r\n");
+    if (len == 0) {
+        return SSH_ERROR;
+    }
+    p[len] = '\0';
+    *b64 = p;
+
+    return SSH_OK;
+}
+
+/*
+ * Whether the options of a line hold the given one, alone or with a value.
+ * The names are compared without case, as sshd does.
+ */
+static int ssh_authorized_keys_has_option(const char *options,
+                                          const char *name)
+{
+    const char *p = options;
+    size_t len = strlen(name);
+    int quoted = 0;
+
+    while (p != NULL && *p != '\0') {
+        if (strncasecmp(p, name, len) == 0 &&
+            (p[len] == '\0' || p[len] == ',' || p[len] == '=')) {
+            return 1;
+        }
+        /* the next option, after the comma out of the quoted values */
+        for (; *p != '\0'; p++) {
+            if (*p == '\\' && p[1] == '"') {
+                p++;
+            } else if (*p == '"') {
+                quoted = !quoted;
+            } else if (!quoted && *p == ',') {
+                p++;
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+ssh_authorized_keys_table_add_line(struct ssh_authorized_keys_table *table,
+                                   char *line,
+                                   const char *filename,
+                                   size_t lineno)
+{
+    ssh_buffer blob = NULL;
+    const unsigned char *data = NULL;
+    char *options = NULL;
+    char *type = NULL;
+    char *b64 = NULL;
+    size_t type_len;
+    uint32_t len;
+    int rc;
+
+    rc = ssh_authorized_keys_parse_line(line, &options, &type, &b64);
+    if (rc == SSH_AGAIN) {
+        return SSH_OK;
+    }
+    if (rc == SSH_OK && ssh_key_type_from_name(type) == SSH_KEYTYPE_UNKNOWN) {
+        SSH_LOG(SSH_LOG_DEBUG,
+                "%s:%zu: skipping a key of unsupported type %s",
+                filename, lineno, type);
+        return SSH_OK;
+    }
+    if (rc == SSH_OK && ssh_authorized_keys_has_option(options,
+                                                       "cert-authority")) {
+        /* it authorizes the certificates it signed, not itself */
+        SSH_LOG(SSH_LOG_DEBUG,
+                "%s:%zu: skipping a certificate authority",
+                filename, lineno);
+        return SSH_OK;
+    }
+    if (rc == SSH_OK) {
+        blob = base64_to_bin(b64);
+    }
+
+    /* the blob starts with the type of the key, as a string */
+    type_len = type != NULL ? strlen(type) : 0;
+    if (blob == NULL ||
+        ssh_buffer_get_len(blob) < 4 + type_len) {
+        SSH_LOG(SSH_LOG_WARN, "%s:%zu: invalid key", filename, lineno);
+        ssh_buffer_free(blob);
+        return SSH_OK;
+    }
+    data = ssh_buffer_get(blob);
+    len = PULL_BE_U32(data, 0);
+    if (len != type_len || memcmp(data + 4, type, type_len) != 0) {
+        SSH_LOG(SSH_LOG_WARN, "%s:%zu: the key is not of type %s",
+                filename, lineno, type);
+        ssh_buffer_free(blob);
+        return SSH_OK;
+    }
+
+    rc = ssh_authorized_keys_table_add(table,
+                                       data,
+                                       ssh_buffer_get_len(blob),
+                                       options);
+    ssh_buffer_free(blob);
+
+    return rc;
+}
+
+/*
+ * Reads the file in a new table, a missing file giving an empty one. The
+ * lines without a key or with an invalid one are skipped as sshd does.
+ */
+static struct ssh_authorized_keys_table *
+ssh_authorized_keys_read(const char *filename, struct stat *st)
+{
+    struct ssh_authorized_keys_table *table = NULL;
+    char *line = NULL;
+    size_t lineno = 0;
+    size_t len;
+    FILE *fp = NULL;
+    int skip = 0;
+    int rc;
+
+    table = calloc(1, sizeof(struct ssh_authorized_keys_table));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT) {
+            SSH_LOG(SSH_LOG_WARN, "Failed to open %s: %s",
+                    filename, strerror(errno));
+            goto error;
+        }
+        ZERO_STRUCTP(st);
+        goto index;
+    }
+    if (fstat(fileno(fp), st) < 0) {
+        goto error;
+    }
+
+    line = malloc(SSH_AUTHORIZED_KEYS_LINE);
+    if (line == NULL) {
+        goto error;
+    }
+
+    while (fgets(line, SSH_AUTHORIZED_KEYS_LINE, fp) != NULL) {
+        len = strlen(line);
+        if (len > 0 && line[len - 1] != '\n' && !feof(fp)) {
+            /* the rest of a line too long to hold a key */
+            if (!skip) {
+                SSH_LOG(SSH_LOG_WARN, "%s:%zu: line too long",
+                        filename, lineno + 1);
+            }
+            skip = 1;
+            continue;
+        }
+        lineno++;
+        if (skip) {
+            skip = 0;
+            continue;
+        }
+
+        rc = ssh_authorized_keys_table_add_line(table, line, filename, lineno);
+        if (rc != SSH_OK) {
+            goto error;
+        }
+    }
+    if (ferror(fp)) {
+        goto error;
+    }
+    fclose(fp);
+    SAFE_FREE(line);
+
+index:
+    rc = ssh_authorized_keys_table_index(table);
+    if (rc != SSH_OK) {
+        ssh_authorized_keys_table_free(table);
+        return NULL;
+    }
+
+    return table;
+error:
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    SAFE_FREE(line);
+    ssh_authorized_keys_table_free(table);
+    return NULL;
+}
+
+/**
+ * @brief Create an empty store of authorized keys.
+ *
+ * A store holds the keys of an authorized_keys file, indexed so that the
+ * public key authentication requests of the clients are resolved without
+ * parsing the file nor the keys again. It may be shared by the threads
+ * serving the sessions.
+ *
+ * @return              A new store, NULL on error.
+ *
+ * @see ssh_authorized_keys_load_file()
+ * @see ssh_message_auth_authorized_keys()
+ */
+ssh_authorized_keys ssh_authorized_keys_new(void)
+{
+    ssh_authorized_keys keys = NULL;
+
+    keys = calloc(1, sizeof(struct ssh_authorized_keys_struct));
+    if (keys == NULL) {
+        return NULL;
+    }
+
+    keys->table = calloc(1, sizeof(struct ssh_authorized_keys_table));
+    if (keys->table == NULL ||
+        ssh_authorized_keys_table_index(keys->table) != SSH_OK) {
+        ssh_authorized_keys_free(keys);
+        return NULL;
+    }
+
+    return keys;
+}
+
+/**
+ * @brief Free a store of authorized keys.
+ *
+ * @param[in]  keys     The store to free, no lookup may be running on it.
+ */
+void ssh_authorized_keys_free(ssh_authorized_keys keys)
+{
+    if (keys == NULL) {
+        return;
+    }
+
+    ssh_authorized_keys_table_free(keys->table);
+    SAFE_FREE(keys->filename);
+    SAFE_FREE(keys);
+}
+
+/**
+ * @brief Load the keys of an authorized_keys file in a store.
+ *
+ * The file has the format of the authorized_keys files of OpenSSH: a key
+ * per line, optionally preceded by options and followed by a comment. The
+ * keys replace those the store held. The file is read again when it changes,
+ * see ssh_authorized_keys_reload().
+ *
+ * A missing file is loaded as no key, as sshd does, and the invalid lines
+ * are skipped. So are the cert-authority lines: the keys of the certificate
+ * authorities go in a store of their own, given to ssh_cert_verifier_new().
+ *
+ * @param[in]  keys     The store to load the keys in.
+ *
+ * @param[in]  filename The authorized_keys file.
+ *
+ * @return              SSH_OK on success, SSH_ERROR if the file could not
+ *                      be read.
+ */
+int ssh_authorized_keys_load_file(ssh_authorized_keys keys,
+                                  const char *filename)
+{
+    struct ssh_authorized_keys_table *table = NULL;
+    struct stat st;
+    char *name = NULL;
+
+    if (keys == NULL || filename == NULL) {
+        return SSH_ERROR;
+    }
+
+    name = strdup(filename);
+    if (name == NULL) {
+        return SSH_ERROR;
+    }
+
+    table = ssh_authorized_keys_read(filename, &st);
+    if (table == NULL) {
+        SAFE_FREE(name);
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&ssh_authorized_keys_mutex);
+    SAFE_FREE(keys->filename);
+    keys->filename = name;
+    keys->st = st;
+    keys->checked = time(NULL);
+    ssh_authorized_keys_table_free(keys->table);
+    keys->table = table;
+    ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+
+    return SSH_OK;
+}
+
+static int ssh_authorized_keys_changed(const struct stat *a,
+                                       const struct stat *b)
+{
+    return a->st_mtime != b->st_mtime ||
+           a->st_size != b->st_size ||
+           a->st_ino != b->st_ino ||
+           a->st_dev != b->st_dev;
+}
+
+/**
+ * @brief Read the file of a store again if it changed.
+ *
+ * The modification time, size and inode of the file are compared with
+ * those it had when it was read. The lookups do this at most once a second
+ * on their own, a server may call it when it knows the file changed.
+ *
+ * The lookups keep using the keys previously read while the file is read
+ * again.
+ *
+ * @param[in]  keys     The store to reload.
+ *
+ * @return              SSH_OK if the keys are up to date, SSH_ERROR if the
+ *                      file could not be read, the previous keys are kept
+ *                      then.
+ */
+int ssh_authorized_keys_reload(ssh_authorized_keys keys)
+{
+    struct ssh_authorized_keys_table *table = NULL;
+    struct stat st;
+    char *filename = NULL;
+    int rc;
+
+    if (keys == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&ssh_authorized_keys_mutex);
+    if (keys->filename == NULL || keys->reloading) {
+        ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+        return SSH_OK;
+    }
+    keys->checked = time(NULL);
+    filename = strdup(keys->filename);
+    ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+    if (filename == NULL) {
+        return SSH_ERROR;
+    }
+
+    rc = stat(filename, &st);
+    if (rc < 0 && errno == ENOENT) {
+        ZERO_STRUCT(st);
+        rc = 0;
+    }
+    if (rc < 0) {
+        SAFE_FREE(filename);
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&ssh_authorized_keys_mutex);
+    if (keys->reloading || !ssh_authorized_keys_changed(&st, &keys->st)) {
+        ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+        SAFE_FREE(filename);
+        return SSH_OK;
+    }
+    keys->reloading = 1;
+    ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+
+    SSH_LOG(SSH_LOG_DEBUG, "Reloading %s", filename);
+    table = ssh_authorized_keys_read(filename, &st);
+    SAFE_FREE(filename);
+
+    ssh_mutex_lock(&ssh_authorized_keys_mutex);
+    keys->reloading = 0;
+    if (table != NULL) {
+        keys->st = st;
+        ssh_authorized_keys_table_free(keys->table);
+        keys->table = table;
+    }
+    ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+
+    return table != NULL ? SSH_OK : SSH_ERROR;
+}
+
+/**
+ * @brief Get the number of distinct keys of a store.
+ *
+ * @param[in]  keys     The store.
+ *
+ * @return              The number of keys.
+ */
+unsigned int ssh_authorized_keys_count(ssh_authorized_keys keys)
+{
+    unsigned int count;
+
+    if (keys == NULL) {
+        return 0;
+    }
+
+    ssh_mutex_lock(&ssh_authorized_keys_mutex);
+    count = keys->table->count;
+    ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+
+    return count;
+}
+
+/**
+ * @internal
+ *
+ * @brief Look the blob of a public key up in a store of authorized keys.
+ *
+ * @see ssh_authorized_keys_match()
+ */
+int ssh_authorized_keys_match_blob(ssh_authorized_keys keys,
+                                   const void *blob,
+                                   size_t len,
+                                   char **options)
+{
+    const struct ssh_authorized_keys_entry *entry = NULL;
+    char *copy = NULL;
+    int reload;
+    int rc = 0;
+
+    if (options != NULL) {
+        *options = NULL;
+    }
+    if (keys == NULL || blob == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&ssh_authorized_keys_mutex);
+    reload = keys->filename != NULL && keys->checked != time(NULL);
+    ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+    if (reload) {
+        /* the keys already read are still good for this lookup */
+        ssh_authorized_keys_reload(keys);
+    }
+
+    ssh_mutex_lock(&ssh_authorized_keys_mutex);
+    entry = ssh_authorized_keys_table_lookup(keys->table,
+                                             blob,
+                                             len,
+                                             ssh_authorized_keys_hash(blob,
+                                                                      len),
+                                             NULL);
+    if (entry != NULL) {
+        rc = 1;
+        if (options != NULL &&
+            entry->options != SSH_AUTHORIZED_KEYS_NO_OPTIONS) {
+            copy = strdup((const char *)keys->table->data + entry->options);
+            if (copy == NULL) {
+                rc = SSH_ERROR;
+            }
+        }
+    }
+    ssh_mutex_unlock(&ssh_authorized_keys_mutex);
+
+    if (options != NULL) {
+        *options = copy;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Look a public key up in a store of authorized keys.
+ *
+ * The file of the store is read again first if it changed, see
+ * ssh_authorized_keys_reload().
+ *
+ * @param[in]  keys     The store.
+ *
+ * @param[in]  key      The key to look up, e.g. ssh_message_auth_pubkey().
+ *
+ * The options of the line, such as from=, command= or expiry-time=, are
+ * not enforced here: the caller has to apply them, or refuse the key.
+ *
+ * @param[out] options  If not NULL, set to a copy of the options of the line
+ *                      of the key, NULL if it has none. Free it with
+ *                      ssh_string_free_char().
+ *
+ * @return              1 if the key is authorized, 0 if not, SSH_ERROR on
+ *                      error.
+ */
+int ssh_authorized_keys_match(ssh_authorized_keys keys,
+                              const ssh_key key,
+                              char **options)
+{
+    ssh_string blob = NULL;
+    int rc;
+
+    if (options != NULL) {
+        *options = NULL;
+    }
+    if (keys == NULL || key == NULL) {
+        return SSH_ERROR;
+    }
+
+    rc = ssh_pki_export_pubkey_blob(key, &blob);
+    if (rc < 0) {
+        return SSH_ERROR;
+    }
+    rc = ssh_authorized_keys_match_blob(keys,
+                                        ssh_string_data(blob),
+                                        ssh_string_len(blob),
+                                        options);
+    ssh_string_free(blob);
+
+    return rc;
+}
+
+/**
+ * @brief Resolve a public key authentication request with a store of
+ *        authorized keys.
+ *
+ * The request is answered unless the key is authorized and its signature
+ * valid: with a failure if the key is not in the store or the signature is
+ * wrong, and with SSH_MSG_USERAUTH_PK_OK if the client only asked whether
+ * the key would be accepted.
+ *
+ * The keys whose line has options are refused, as none of them is enforced
+ * here: from= or expiry-time= would not limit the login, no-pty or command=
+ * the session. A server supporting options looks the key up with
+ * ssh_authorized_keys_match() and applies them itself.
+ *
+ * @code
+ * case SSH_AUTH_METHOD_PUBLICKEY:
+ *     rc = ssh_message_auth_authorized_keys(msg, keys);
+ *     if (rc == SSH_AUTH_SUCCESS) {
+ *         ssh_message_auth_reply_success(msg, 0);
+ *     }
+ *     break;
+ * @endcode
+ *
+ * @param[in]  msg      A SSH_REQUEST_AUTH message of the publickey method.
+ *
+ * @param[in]  keys     The keys of the user of the request.
+ *
+ * @return              SSH_AUTH_SUCCESS if the key is authorized and signed
+ *                      the request, the caller replies then;\n
+ *                      SSH_AUTH_AGAIN if the key is authorized and the
+ *                      client was told so, it will sign a request next;\n
+ *                      SSH_AUTH_DENIED if the request was refused;\n
+ *                      SSH_AUTH_ERROR on error.
+ */
+int ssh_message_auth_authorized_keys(ssh_message msg, ssh_authorized_keys keys)
+{
+    enum ssh_publickey_state_e state;
+    char *options = NULL;
+    int rc;
+
+    if (msg == NULL || keys == NULL ||
+        ssh_message_type(msg) != SSH_REQUEST_AUTH ||
+        ssh_message_subtype(msg) != SSH_AUTH_METHOD_PUBLICKEY) {
+        return SSH_AUTH_ERROR;
+    }
+
+    state = ssh_message_auth_publickey_state(msg);
+    if (state != SSH_PUBLICKEY_STATE_NONE &&
+        state != SSH_PUBLICKEY_STATE_VALID) {
+        ssh_message_reply_default(msg);
+        return SSH_AUTH_DENIED;
+    }
+
+    rc = ssh_authorized_keys_match(keys,
+                                   ssh_message_auth_pubkey(msg),
+                                   &options);
+    if (rc == 1 && options != NULL) {
+        SSH_LOG(SSH_LOG_PACKET,
+                "Key refused, the options of its line are not enforced: %s",
+                options);
+        SSH_STRING_FREE_CHAR(options);
+        rc = 0;
+    }
+    if (rc != 1) {
+        ssh_message_reply_default(msg);
+        return rc == 0 ? SSH_AUTH_DENIED : SSH_AUTH_ERROR;
+    }
+
+    if (state == SSH_PUBLICKEY_STATE_NONE) {
+        rc = ssh_message_auth_reply_pk_ok_simple(msg);
+        return rc == SSH_OK ? SSH_AUTH_AGAIN : SSH_AUTH_ERROR;
+    }
+
+    return SSH_AUTH_SUCCESS;
+}
+
+/** @} */
@@ -21,216 +21,367 @@
  * MA 02111-1307, USA.
  */
 
-/* just the dirtiest part of code i ever made */
 #include "config.h"
 
 #include <stdio.h>
+#include <stdint.h>
 
 #include "libssh/priv.h"
 #include "libssh/buffer.h"
 
-static char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                         "abcdefghijklmnopqrstuvwxyz"
-                         "0123456789+/";
+#ifdef HAVE_X86_TARGET_ATTRIBUTE
+#include <immintrin.h>
+#endif
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               "abcdefghijklmnopqrstuvwxyz"
+                               "0123456789+/";
+
+/* Value of each base64 character, 0xff for the others */
+static const uint8_t decode_table[256] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+  0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/* Decodes 4 characters to 3 bytes, returns -1 on an invalid character */
+static int decode_block4(uint8_t *dest, const uint8_t *source)
+{
+  uint32_t a = decode_table[source[0]];
+  uint32_t b = decode_table[source[1]];
+  uint32_t c = decode_table[source[2]];
+  uint32_t d = decode_table[source[3]];
+  uint32_t n;
+
+  if ((a | b | c | d) & 0x80) {
+    return -1;
+  }
+  n = (a << 18) | (b << 12) | (c << 6) | d;
+  dest[0] = (uint8_t)(n >> 16);
+  dest[1] = (uint8_t)(n >> 8);
+  dest[2] = (uint8_t)n;
 
-/* Transformations */
-#define SET_A(n, i) do { (n) |= ((i) & 63) <<18; } while (0)
-#define SET_B(n, i) do { (n) |= ((i) & 63) <<12; } while (0)
-#define SET_C(n, i) do { (n) |= ((i) & 63) << 6; } while (0)
-#define SET_D(n, i) do { (n) |= ((i) & 63); } while (0)
+  return 0;
+}
 
-#define GET_A(n) (unsigned char) (((n) & 0xff0000) >> 16)
-#define GET_B(n) (unsigned char) (((n) & 0xff00) >> 8)
-#define GET_C(n) (unsigned char) ((n) & 0xff)
+#ifdef HAVE_X86_TARGET_ATTRIBUTE
+/*
+ * Vectorized codecs after Wojciech Mula and Daniel Lemire, "Faster Base64
+ * Encoding and Decoding Using AVX2 Instructions". The characters are
+ * classified and translated with nibble indexed lookups through pshufb,
+ * then the 6 bit values are packed with multiply-adds. They process whole
+ * blocks and leave the rest to the scalar code, picked at run time.
+ */
 
-static int _base64_to_bin(unsigned char dest[3], const char *source, int num);
-static int get_equals(char *string);
+/* Decodes 16 characters to 12 bytes, but stores 16 */
+__attribute__((target("ssse3")))
+static int decode_ssse3_16(uint8_t *dest, const uint8_t *source)
+{
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x13, 0x1a,
+                                       0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02,
+                                       0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10,
+                                       0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_0f = _mm_set1_epi8(0x0f);
+  __m128i in = _mm_loadu_si128((const __m128i *)(const void *)source);
+  __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_0f);
+  __m128i lo_nibbles = _mm_and_si128(in, mask_0f);
+  __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+  __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+  __m128i roll;
+  __m128i out;
+
+  /* only the characters of the alphabet have no common class bit */
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                                       _mm_setzero_si128())) != 0xffff) {
+    return -1;
+  }
 
-/* First part: base64 to binary */
+  /* '/' shares its high nibble with '+' */
+  roll = _mm_shuffle_epi8(lut_roll,
+                          _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8(0x2f)),
+                                       hi_nibbles));
+  in = _mm_add_epi8(in, roll);
+
+  out = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+  out = _mm_madd_epi16(out, _mm_set1_epi32(0x00011000));
+  out = _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                            8, 14, 13, 12, -1, -1, -1, -1));
+  _mm_storeu_si128((__m128i *)(void *)dest, out);
+
+  return 0;
+}
+
+/* Decodes 32 characters to 24 bytes, but stores 32 */
+__attribute__((target("avx2")))
+static int decode_avx2_32(uint8_t *dest, const uint8_t *source)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a,
+                                          0x1b, 0x1b, 0x1b, 0x1a,
+                                          0x15, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a,
+                                          0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02,
+                                          0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02,
+                                          0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_0f = _mm256_set1_epi8(0x0f);
+  __m256i in = _mm256_loadu_si256((const __m256i *)(const void *)source);
+  __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_0f);
+  __m256i lo_nibbles = _mm256_and_si256(in, mask_0f);
+  __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+  __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+  __m256i roll;
+  __m256i out;
+
+  if (!_mm256_testz_si256(lo, hi)) {
+    return -1;
+  }
+
+  roll = _mm256_shuffle_epi8(lut_roll,
+                             _mm256_add_epi8(_mm256_cmpeq_epi8(in,
+                                                 _mm256_set1_epi8(0x2f)),
+                                             hi_nibbles));
+  in = _mm256_add_epi8(in, roll);
+
+  out = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+  out = _mm256_madd_epi16(out, _mm256_set1_epi32(0x00011000));
+  out = _mm256_shuffle_epi8(out,
+                            _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                             8, 14, 13, 12, -1, -1, -1, -1,
+                                             2, 1, 0, 6, 5, 4, 10, 9,
+                                             8, 14, 13, 12, -1, -1, -1, -1));
+  /* the 12 bytes of each lane next to each other */
+  out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4,
+                                                           5, 6, 7, 7));
+  _mm256_storeu_si256((__m256i *)(void *)dest, out);
+
+  return 0;
+}
+
+/* Encodes 12 bytes, but loads 16, to 16 characters */
+__attribute__((target("ssse3")))
+static void encode_ssse3_12(uint8_t *dest, const uint8_t *source)
+{
+  const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+  __m128i in = _mm_loadu_si128((const __m128i *)(const void *)source);
+  __m128i t0;
+  __m128i t1;
+  __m128i indices;
+  __m128i result;
+  __m128i less;
+
+  in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                          7, 6, 8, 7, 10, 9, 11, 10));
+  t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                       _mm_set1_epi32(0x04000040));
+  t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                       _mm_set1_epi32(0x01000010));
+  indices = _mm_or_si128(t0, t1);
+
+  /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+  result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  result = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+
+  _mm_storeu_si128((__m128i *)(void *)dest, result);
+}
+
+/*
+ * Decodes as many whole blocks as possible, as long as the stores past the
+ * 3/4 of each block stay inside the len * 3 / 4 bytes of dest.
+ */
+static size_t decode_simd(uint8_t *dest, const uint8_t *source, size_t len)
+{
+  size_t done = 0;
+
+  if (__builtin_cpu_supports("avx2")) {
+    while (len - done >= 48) {
+      if (decode_avx2_32(dest + done / 4 * 3, source + done) < 0) {
+        return done;
+      }
+      done += 32;
+    }
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    while (len - done >= 24) {
+      if (decode_ssse3_16(dest + done / 4 * 3, source + done) < 0) {
+        return done;
+      }
+      done += 16;
+    }
+  }
+
+  return done;
+}
+
+static size_t encode_simd(uint8_t *dest, const uint8_t *source, size_t len)
+{
+  size_t done = 0;
+
+  if (__builtin_cpu_supports("ssse3")) {
+    while (len - done >= 16) {
+      encode_ssse3_12(dest + done / 3 * 4, source + done);
+      done += 12;
+    }
+  }
+
+  return done;
+}
+#endif /* HAVE_X86_TARGET_ATTRIBUTE */
 
 /**
  * @internal
  *
  * @brief Translates a base64 string into a binary one.
  *
+ * The data ends at the first "=" sign, and the number of "=" signs must
+ * match the padding of the last quantum.
+ *
  * @returns A buffer containing the decoded string, NULL if something went
  *          wrong (e.g. incorrect char).
  */
 ssh_buffer base64_to_bin(const char *source) {
+  const uint8_t *in = (const uint8_t *)source;
   ssh_buffer buffer = NULL;
-  unsigned char block[3];
-  char *base64;
-  char *ptr;
+  uint8_t *out;
+  uint8_t block[3];
+  size_t total;
   size_t len;
-  int equals;
-
-  base64 = strdup(source);
-  if (base64 == NULL) {
-    return NULL;
+  size_t full;
+  size_t outlen;
+  size_t done = 0;
+  size_t i;
+  int equals = 0;
+
+  /* The data stops at the first "=", the padding */
+  total = strlen(source);
+  len = strcspn(source, "=");
+  for (i = len; i < total; i++) {
+    if (in[i] == '=') {
+      equals++;
+    }
   }
-  ptr = base64;
-
-  /* Get the number of equals signs, which mirrors the padding */
-  equals = get_equals(ptr);
   if (equals > 2) {
-    SAFE_FREE(base64);
     return NULL;
   }
 
-  buffer = ssh_buffer_new();
-  if (buffer == NULL) {
-    SAFE_FREE(base64);
-    return NULL;
-  }
-  /*
-   * The base64 buffer often contains sensitive data. Make sure we don't leak
-   * sensitive data
-   */
-  ssh_buffer_set_secure(buffer);
-
-  len = strlen(ptr);
-  while (len > 4) {
-    if (_base64_to_bin(block, ptr, 3) < 0) {
-      goto error;
-    }
-    if (ssh_buffer_add_data(buffer, block, 3) < 0) {
-      goto error;
-    }
-    len -= 4;
-    ptr += 4;
-  }
-
   /*
    * Depending on the number of bytes resting, there are 3 possibilities
    * from the RFC.
+   *
+   * (1) The final quantum of encoding input is an integral multiple of
+   *     24 bits. Here, the final unit of encoded output will be an integral
+   *     multiple of 4 characters with no "=" padding
+   * (2) The final quantum of encoding input is exactly 8 bits; here, the
+   *     final unit of encoded output will be two characters followed by
+   *     two "=" padding characters.
+   * (3) The final quantum of encoding input is exactly 16 bits. Here, the
+   *     final unit of encoded output will be three characters followed by
+   *     one "=" padding character.
    */
-  switch (len) {
-    /*
-     * (1) The final quantum of encoding input is an integral multiple of
-     *     24 bits. Here, the final unit of encoded output will be an integral
-     *     multiple of 4 characters with no "=" padding
-     */
-    case 4:
-      if (equals != 0) {
-        goto error;
-      }
-      if (_base64_to_bin(block, ptr, 3) < 0) {
-        goto error;
+  switch (len % 4) {
+    case 0:
+      if (len == 0 || equals != 0) {
+        return NULL;
       }
-      if (ssh_buffer_add_data(buffer, block, 3) < 0) {
-        goto error;
-      }
-      SAFE_FREE(base64);
-
-      return buffer;
-    /*
-     * (2) The final quantum of encoding input is exactly 8 bits; here, the
-     *     final unit of encoded output will be two characters followed by
-     *     two "=" padding characters.
-     */
+      break;
     case 2:
-      if (equals != 2){
-        goto error;
-      }
-
-      if (_base64_to_bin(block, ptr, 1) < 0) {
-        goto error;
+      if (equals != 2) {
+        return NULL;
       }
-      if (ssh_buffer_add_data(buffer, block, 1) < 0) {
-        goto error;
-      }
-      SAFE_FREE(base64);
-
-      return buffer;
-    /*
-     * The final quantum of encoding input is exactly 16 bits. Here, the final
-     * unit of encoded output will be three characters followed by one "="
-     * padding character.
-     */
+      break;
     case 3:
       if (equals != 1) {
-        goto error;
-      }
-      if (_base64_to_bin(block, ptr, 2) < 0) {
-        goto error;
+        return NULL;
       }
-      if (ssh_buffer_add_data(buffer,block,2) < 0) {
-        goto error;
-      }
-      SAFE_FREE(base64);
-
-      return buffer;
+      break;
     default:
       /* 4,3,2 are the only padding size allowed */
-      goto error;
+      return NULL;
   }
-
-error:
-  SAFE_FREE(base64);
-  ssh_buffer_free(buffer);
-  return NULL;
-}
-
-#define BLOCK(letter, n) do {ptr = strchr(alphabet, source[n]); \
-                             if(!ptr) return -1; \
-                             i = ptr - alphabet; \
-                             SET_##letter(*block, i); \
-                         } while(0)
-
-/* Returns 0 if ok, -1 if not (ie invalid char into the stuff) */
-static int to_block4(unsigned long *block, const char *source, int num) {
-  char *ptr;
-  unsigned int i;
-
-  *block = 0;
-  if (num < 1) {
-    return 0;
+  full = len - len % 4;
+  outlen = full / 4 * 3 + (len % 4 == 0 ? 0 : len % 4 - 1);
+  if (outlen > UINT32_MAX) {
+    return NULL;
   }
 
-  BLOCK(A, 0); /* 6 bit */
-  BLOCK(B,1); /* 12 bit */
-
-  if (num < 2) {
-    return 0;
+  buffer = ssh_buffer_new();
+  if (buffer == NULL) {
+    return NULL;
   }
+  /*
+   * The base64 buffer often contains sensitive data. Make sure we don't leak
+   * sensitive data
+   */
+  ssh_buffer_set_secure(buffer);
 
-  BLOCK(C, 2); /* 18 bit */
-
-  if (num < 3) {
-    return 0;
+  /* Decode straight into the buffer, sized once */
+  out = ssh_buffer_allocate(buffer, (uint32_t)outlen);
+  if (out == NULL) {
+    goto error;
   }
 
-  BLOCK(D, 3); /* 24 bit */
-
-  return 0;
-}
-
-/* num = numbers of final bytes to be decoded */
-static int _base64_to_bin(unsigned char dest[3], const char *source, int num) {
-  unsigned long block;
-
-  if (to_block4(&block, source, num) < 0) {
-    return -1;
+#ifdef HAVE_X86_TARGET_ATTRIBUTE
+  done = decode_simd(out, in, full);
+#endif
+  for (; done < full; done += 4) {
+    if (decode_block4(out + done / 4 * 3, in + done) < 0) {
+      goto error;
+    }
   }
-  dest[0] = GET_A(block);
-  dest[1] = GET_B(block);
-  dest[2] = GET_C(block);
 
-  return 0;
-}
-
-/* Count the number of "=" signs and replace them by zeroes */
-static int get_equals(char *string) {
-  char *ptr = string;
-  int num = 0;
+  /* The last quantum, only the significant bits of the last character */
+  if (len % 4 != 0) {
+    uint8_t last[4] = {'A', 'A', 'A', 'A'};
 
-  while ((ptr=strchr(ptr,'=')) != NULL) {
-    num++;
-    *ptr = '\0';
-    ptr++;
+    memcpy(last, in + full, len % 4);
+    if (decode_block4(block, last) < 0) {
+      goto error;
+    }
+    memcpy(out + full / 4 * 3, block, len % 4 - 1);
+    explicit_bzero(block, sizeof(block));
   }
 
-  return num;
+  return buffer;
+
+error:
+  ssh_buffer_free(buffer);
+  return NULL;
 }
 
 /* thanks sysk for debugging my mess :) */
@@ -269,6 +420,7 @@ static void _bin_to_base64(unsigned char *dest, const unsigned char source[3],
 unsigned char *bin_to_base64(const unsigned char *source, int len) {
   unsigned char *base64;
   unsigned char *ptr;
+  size_t done = 0;
   int flen = len + (3 - (len % 3)); /* round to upper 3 multiple */
   flen = (4 * flen) / 3 + 1;
 
@@ -278,6 +430,17 @@ unsigned char *bin_to_base64(const unsigned char *source, int len) {
   }
   ptr = base64;
 
+#ifdef HAVE_X86_TARGET_ATTRIBUTE
+  if (len > 0) {
+    done = encode_simd(ptr, source, (size_t)len);
+    ptr += done / 3 * 4;
+    source += done;
+    len -= (int)done;
+  }
+#else
+  (void)done;
+#endif
+
   while(len > 0){
     _bin_to_base64(ptr, source, len > 3 ? 3 : len);
     ptr += 4;
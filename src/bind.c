@@ -415,10 +415,15 @@ void ssh_bind_free(ssh_bind sshbind){
     }
   }
 
+  ssh_bind_admission_free(sshbind);
+
   SAFE_FREE(sshbind);
 }
 
-int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd){
+static int ssh_bind_accept_session(ssh_bind sshbind,
+                                   ssh_session session,
+                                   socket_t fd)
+{
     int i, rc;
 
     if (session == NULL){
@@ -435,13 +440,14 @@ int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd){
         if (session->opts.wanted_methods[i] == NULL) {
           return SSH_ERROR;
         }
+        session->opts.wanted_algos[i] = sshbind->wanted_algos[i];
       }
     }
 
     if (sshbind->bindaddr == NULL)
       session->opts.bindaddr = NULL;
     else {
-      SAFE_FREE(session->opts.bindaddr);
+      SSH_OPTIONS_FREE(session, session->opts.bindaddr);
       session->opts.bindaddr = strdup(sshbind->bindaddr);
       if (session->opts.bindaddr == NULL) {
         return SSH_ERROR;
@@ -514,7 +520,26 @@ int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd){
     return SSH_OK;
 }
 
+int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd)
+{
+    int rc;
+
+    if (session == NULL) {
+        ssh_set_error(sshbind, SSH_FATAL, "session is null");
+        return SSH_ERROR;
+    }
+
+    rc = ssh_bind_admit(sshbind, session, fd, NULL);
+    if (rc != SSH_OK) {
+        return rc;
+    }
+
+    return ssh_bind_accept_session(sshbind, session, fd);
+}
+
 int ssh_bind_accept(ssh_bind sshbind, ssh_session session) {
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
   socket_t fd = SSH_INVALID_SOCKET;
   int rc;
   if (sshbind->bindfd == SSH_INVALID_SOCKET) {
@@ -528,14 +553,22 @@ int ssh_bind_accept(ssh_bind sshbind, ssh_session session) {
       return SSH_ERROR;
   }
 
-  fd = accept(sshbind->bindfd, NULL, NULL);
+  fd = accept(sshbind->bindfd, (struct sockaddr *)&addr, &addrlen);
   if (fd == SSH_INVALID_SOCKET) {
     ssh_set_error(sshbind, SSH_FATAL,
         "Accepting a new connection: %s",
         strerror(errno));
     return SSH_ERROR;
   }
-  rc = ssh_bind_accept_fd(sshbind, session, fd);
+
+  /* refused before anything is read or written on it */
+  rc = ssh_bind_admit(sshbind, session, fd, (struct sockaddr *)&addr);
+  if (rc != SSH_OK) {
+      CLOSE_SOCKET(fd);
+      return rc;
+  }
+
+  rc = ssh_bind_accept_session(sshbind, session, fd);
 
   if(rc == SSH_ERROR){
       CLOSE_SOCKET(fd);
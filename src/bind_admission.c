@@ -0,0 +1,569 @@
+/*
+ * bind_admission.c - admission control of the connections of a ssh_bind
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "libssh/priv.h"
+#include "libssh/server.h"
+#include "libssh/bind.h"
+#include "libssh/misc.h"
+#include "libssh/session.h"
+#include "libssh/threads.h"
+
+/*
+ * The connections are refused before anything is sent or read on them, so
+ * that a flood of them costs an accept() and a close() each instead of a
+ * key exchange.
+ *
+ * Two limits can be set, as sshd does with MaxStartups and its per source
+ * penalties:
+ *
+ * - the number of accepted sessions which did not authenticate yet, beyond
+ *   which the new connections are dropped with a probability growing from
+ *   rate% at begin to 100% at full;
+ * - the number of connections a source may open over a period, counted in a
+ *   token bucket per source address, or per /64 for IPv6.
+ *
+ * The buckets are kept in a fixed table of small entries, indexed by a keyed
+ * hash of the address. A set of SSH_BIND_SOURCE_WAYS entries is searched for
+ * each address, and the least recently seen of them is replaced when the
+ * address is not there: a source forgotten that way starts again with a full
+ * bucket, so the table never refuses more than it should.
+ */
+
+#define SSH_BIND_SOURCE_SLOTS 4096
+#define SSH_BIND_SOURCE_WAYS 4
+/* the credit of one connection, the buckets count in thousandths */
+#define SSH_BIND_SOURCE_UNIT 1000
+
+struct ssh_bind_source {
+    /* upper bits of the hash of the address, 0 for a free entry */
+    uint32_t tag;
+    /* connections the source may still open, in SSH_BIND_SOURCE_UNITs */
+    uint32_t credit;
+    /* when the credit was last updated, in ms */
+    uint64_t last;
+};
+
+struct ssh_bind_admission_struct {
+    /* the ssh_bind and every session it admitted */
+    unsigned int refcount;
+    /* admitted sessions which did not authenticate yet */
+    unsigned int startups;
+    /* those of them handed over by ssh_bind_admission_detach() */
+    unsigned int detached;
+
+    unsigned int startups_begin;
+    unsigned int startups_rate;
+    unsigned int startups_full;
+
+    unsigned int source_count;
+    uint64_t source_period;
+    uint64_t hash_key;
+    struct ssh_bind_source *sources;
+};
+
+/* shared by every ssh_bind, sessions are released from any thread */
+static SSH_MUTEX ssh_bind_admission_mutex = SSH_MUTEX_STATIC_INIT;
+
+static uint64_t ssh_bind_admission_now(void)
+{
+    struct ssh_timestamp ts;
+
+    ssh_timestamp_init(&ts);
+
+    return (uint64_t)ts.seconds * 1000 + ts.useconds / 1000;
+}
+
+static struct ssh_bind_admission_struct *
+ssh_bind_admission_get(ssh_bind sshbind)
+{
+    struct ssh_bind_admission_struct *admission = sshbind->admission;
+
+    if (admission != NULL) {
+        return admission;
+    }
+
+    admission = calloc(1, sizeof(struct ssh_bind_admission_struct));
+    if (admission == NULL) {
+        ssh_set_error_oom(sshbind);
+        return NULL;
+    }
+    admission->refcount = 1;
+    sshbind->admission = admission;
+
+    return admission;
+}
+
+static int ssh_bind_admission_parse(const char *spec,
+                                    unsigned int *values,
+                                    int max)
+{
+    const char *p = spec;
+    char *end = NULL;
+    unsigned long v;
+    int n = 0;
+
+    for (;;) {
+        if (*p < '0' || *p > '9' || n == max) {
+            return -1;
+        }
+        errno = 0;
+        v = strtoul(p, &end, 10);
+        if (errno != 0 || v > UINT32_MAX) {
+            return -1;
+        }
+        values[n++] = (unsigned int)v;
+        if (*end == '\0') {
+            return n;
+        }
+        if (*end != ':') {
+            return -1;
+        }
+        p = end + 1;
+    }
+}
+
+/**
+ * @internal
+ *
+ * @brief Set the limit of sessions which did not authenticate yet.
+ *
+ * @param[in]  sshbind  The ssh server bind.
+ *
+ * @param[in]  spec     "full", or "begin:rate:full" to drop rate% of the
+ *                      new connections at begin sessions, growing to all
+ *                      of them at full. "0" removes the limit.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_bind_admission_set_startups(ssh_bind sshbind, const char *spec)
+{
+    struct ssh_bind_admission_struct *admission = NULL;
+    unsigned int values[3];
+    int n;
+
+    n = ssh_bind_admission_parse(spec, values, 3);
+    if (n == 1) {
+        values[2] = values[0];
+        values[1] = 100;
+    } else if (n != 3 || values[1] > 100 || values[0] > values[2]) {
+        ssh_set_error(sshbind, SSH_REQUEST_DENIED,
+                      "Invalid startups limit: %s", spec);
+        return SSH_ERROR;
+    }
+
+    admission = ssh_bind_admission_get(sshbind);
+    if (admission == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&ssh_bind_admission_mutex);
+    admission->startups_begin = values[0];
+    admission->startups_rate = values[1];
+    admission->startups_full = values[2];
+    ssh_mutex_unlock(&ssh_bind_admission_mutex);
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Set the number of connections a source address may open.
+ *
+ * @param[in]  sshbind  The ssh server bind.
+ *
+ * @param[in]  spec     "count:seconds", a source opening count connections
+ *                      at once may open another one every seconds / count
+ *                      seconds. "0" removes the limit.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_bind_admission_set_source_limit(ssh_bind sshbind, const char *spec)
+{
+    struct ssh_bind_admission_struct *admission = NULL;
+    struct ssh_bind_source *sources = NULL;
+    unsigned int values[2];
+    int n;
+
+    n = ssh_bind_admission_parse(spec, values, 2);
+    if (n == 1 && values[0] == 0) {
+        values[1] = 0;
+    } else if (n != 2 || values[0] == 0 || values[1] == 0 ||
+               values[0] > UINT32_MAX / SSH_BIND_SOURCE_UNIT) {
+        ssh_set_error(sshbind, SSH_REQUEST_DENIED,
+                      "Invalid source limit: %s", spec);
+        return SSH_ERROR;
+    }
+
+    admission = ssh_bind_admission_get(sshbind);
+    if (admission == NULL) {
+        return SSH_ERROR;
+    }
+
+    if (values[0] != 0 && admission->sources == NULL) {
+        sources = calloc(SSH_BIND_SOURCE_SLOTS,
+                         sizeof(struct ssh_bind_source));
+        if (sources == NULL) {
+            ssh_set_error_oom(sshbind);
+            return SSH_ERROR;
+        }
+        if (!ssh_get_random(&admission->hash_key,
+                            sizeof(admission->hash_key), 0)) {
+            SAFE_FREE(sources);
+            ssh_set_error(sshbind, SSH_FATAL, "PRNG error");
+            return SSH_ERROR;
+        }
+    }
+
+    ssh_mutex_lock(&ssh_bind_admission_mutex);
+    if (sources != NULL) {
+        admission->sources = sources;
+    }
+    admission->source_count = values[0];
+    admission->source_period = (uint64_t)values[1] * 1000;
+    ssh_mutex_unlock(&ssh_bind_admission_mutex);
+
+    return SSH_OK;
+}
+
+/* the address a source is counted by, 0 if it is not an IP one */
+static size_t ssh_bind_admission_source(const struct sockaddr *addr,
+                                        unsigned char key[8])
+{
+    const struct sockaddr_in6 *sin6 = NULL;
+    const unsigned char *a = NULL;
+
+    if (addr->sa_family == AF_INET) {
+        memcpy(key, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+        return 4;
+    }
+    if (addr->sa_family != AF_INET6) {
+        return 0;
+    }
+
+    sin6 = (const struct sockaddr_in6 *)addr;
+    a = (const unsigned char *)&sin6->sin6_addr;
+    if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+        memcpy(key, a + 12, 4);
+        return 4;
+    }
+    /* the hosts of a /64 are usually in the hands of the same party */
+    memcpy(key, a, 8);
+    return 8;
+}
+
+static uint64_t ssh_bind_admission_hash(uint64_t hash_key,
+                                        const unsigned char *key,
+                                        size_t len)
+{
+    uint64_t h = hash_key;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ key[i]) * 0x100000001b3ULL;
+    }
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+
+    return h;
+}
+
+/* the bucket of the source, refilled up to now */
+static struct ssh_bind_source *
+ssh_bind_admission_bucket(struct ssh_bind_admission_struct *admission,
+                          const unsigned char *key,
+                          size_t len,
+                          uint64_t now)
+{
+    struct ssh_bind_source *set = NULL;
+    struct ssh_bind_source *source = NULL;
+    uint64_t full = (uint64_t)admission->source_count * SSH_BIND_SOURCE_UNIT;
+    uint64_t credit;
+    uint64_t h;
+    uint32_t tag;
+    int i;
+
+    h = ssh_bind_admission_hash(admission->hash_key, key, len);
+    tag = (uint32_t)(h >> 32) | 1;
+    set = &admission->sources[h & (SSH_BIND_SOURCE_SLOTS - 1) &
+                              ~(uint64_t)(SSH_BIND_SOURCE_WAYS - 1)];
+
+    for (i = 0; i < SSH_BIND_SOURCE_WAYS; i++) {
+        if (set[i].tag == tag) {
+            source = &set[i];
+            break;
+        }
+        if (source == NULL || set[i].last < source->last) {
+            source = &set[i];
+        }
+    }
+
+    if (source->tag != tag) {
+        source->tag = tag;
+        source->credit = (uint32_t)full;
+    } else if (now > source->last) {
+        credit = source->credit + (now - source->last) * full /
+                                  admission->source_period;
+        source->credit = (uint32_t)MIN(credit, full);
+    }
+    source->last = now;
+
+    return source;
+}
+
+/* whether a new connection is dropped by the startups limit */
+static int ssh_bind_admission_drop(struct ssh_bind_admission_struct *admission)
+{
+    unsigned int p;
+    uint32_t r;
+
+    if (admission->startups_full == 0 ||
+        admission->startups < admission->startups_begin) {
+        return 0;
+    }
+    if (admission->startups >= admission->startups_full) {
+        return 1;
+    }
+
+    p = 100 - admission->startups_rate;
+    p *= admission->startups - admission->startups_begin;
+    p /= admission->startups_full - admission->startups_begin;
+    p += admission->startups_rate;
+
+    if (!ssh_get_random(&r, sizeof(r), 0)) {
+        return 1;
+    }
+
+    /* the bias of the modulo is below 1 / 2^25 */
+    return r % 100 < p;
+}
+
+/**
+ * @internal
+ *
+ * @brief Decide whether a new connection of the bind is served.
+ *
+ * On success the session counts as not authenticated until it authenticates
+ * or is freed.
+ *
+ * @param[in]  sshbind  The ssh server bind.
+ *
+ * @param[in]  session  The session the connection will be served by.
+ *
+ * @param[in]  fd       The socket of the connection.
+ *
+ * @param[in]  addr     The address of the peer, NULL to look it up.
+ *
+ * @return              SSH_OK if the connection is admitted, SSH_ERROR with
+ *                      SSH_REQUEST_DENIED set on the bind if it is refused.
+ */
+int ssh_bind_admit(ssh_bind sshbind,
+                   ssh_session session,
+                   socket_t fd,
+                   const struct sockaddr *addr)
+{
+    struct ssh_bind_admission_struct *admission = sshbind->admission;
+    struct ssh_bind_source *source = NULL;
+    struct sockaddr_storage peer;
+    socklen_t peerlen = sizeof(peer);
+    unsigned char key[8];
+    char host[64] = "unknown";
+    const char *reason = NULL;
+    size_t keylen = 0;
+
+    if (admission == NULL ||
+        (admission->startups_full == 0 && admission->source_count == 0)) {
+        return SSH_OK;
+    }
+
+    if (addr == NULL && admission->source_count != 0) {
+        if (getpeername(fd, (struct sockaddr *)&peer, &peerlen) == 0) {
+            addr = (struct sockaddr *)&peer;
+        }
+    }
+    if (addr != NULL && admission->source_count != 0) {
+        keylen = ssh_bind_admission_source(addr, key);
+    }
+
+    ssh_mutex_lock(&ssh_bind_admission_mutex);
+    if (keylen != 0 && admission->sources != NULL) {
+        source = ssh_bind_admission_bucket(admission,
+                                           key,
+                                           keylen,
+                                           ssh_bind_admission_now());
+        if (source->credit < SSH_BIND_SOURCE_UNIT) {
+            reason = "too many connections from its source";
+        }
+    }
+    if (reason == NULL && ssh_bind_admission_drop(admission)) {
+        reason = "too many unauthenticated sessions";
+    }
+    if (reason == NULL) {
+        if (source != NULL) {
+            source->credit -= SSH_BIND_SOURCE_UNIT;
+        }
+        admission->startups++;
+        admission->refcount++;
+        session->admission = admission;
+    }
+    ssh_mutex_unlock(&ssh_bind_admission_mutex);
+
+    if (reason == NULL) {
+        return SSH_OK;
+    }
+
+    if (addr != NULL && addr->sa_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)addr)->sin_addr,
+                  host, sizeof(host));
+    } else if (addr != NULL && addr->sa_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)addr)->sin6_addr,
+                  host, sizeof(host));
+    }
+    ssh_set_error(sshbind, SSH_REQUEST_DENIED,
+                  "Connection from %s refused: %s", host, reason);
+    SSH_LOG(SSH_LOG_PROTOCOL, "%s", ssh_get_error(sshbind));
+
+    return SSH_ERROR;
+}
+
+static void
+ssh_bind_admission_unref(struct ssh_bind_admission_struct *admission)
+{
+    admission->refcount--;
+    if (admission->refcount == 0) {
+        SAFE_FREE(admission->sources);
+        SAFE_FREE(admission);
+    }
+}
+
+/**
+ * @internal
+ *
+ * @brief Stop counting a session as not authenticated, once it authenticated
+ *        or when it is freed.
+ *
+ * @param[in]  session  The session, admitted by a bind or not.
+ */
+void ssh_bind_admission_release(ssh_session session)
+{
+    if (session->admission == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&ssh_bind_admission_mutex);
+    session->admission->startups--;
+    ssh_bind_admission_unref(session->admission);
+    session->admission = NULL;
+    ssh_mutex_unlock(&ssh_bind_admission_mutex);
+}
+
+/**
+ * @brief Keep counting a session as not authenticated once it is freed.
+ *
+ * A server which forks a child for each connection frees the session in
+ * the parent, which would release its place in the count of
+ * SSH_BIND_OPTIONS_MAX_STARTUPS at once. Called in the parent before
+ * ssh_free(), the place is kept until ssh_bind_admission_done() is called
+ * on the bind, when the child exits or tells it authenticated the user.
+ *
+ * @param[in]  session  The session accepted by the bind, handed to a child.
+ *
+ * @return              SSH_OK if the place of the session is kept,
+ *                      SSH_ERROR if it held none, as it authenticated or was
+ *                      accepted without a limit: no ssh_bind_admission_done()
+ *                      is owed for it then.
+ *
+ * @see ssh_bind_admission_done()
+ */
+int ssh_bind_admission_detach(ssh_session session)
+{
+    if (session == NULL || session->admission == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&ssh_bind_admission_mutex);
+    session->admission->detached++;
+    ssh_bind_admission_unref(session->admission);
+    session->admission = NULL;
+    ssh_mutex_unlock(&ssh_bind_admission_mutex);
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Release the place of a session detached from the bind.
+ *
+ * @param[in]  sshbind  The ssh server bind which accepted the session.
+ *
+ * @see ssh_bind_admission_detach()
+ */
+void ssh_bind_admission_done(ssh_bind sshbind)
+{
+    struct ssh_bind_admission_struct *admission = NULL;
+
+    if (sshbind == NULL || sshbind->admission == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&ssh_bind_admission_mutex);
+    admission = sshbind->admission;
+    if (admission->detached > 0) {
+        admission->detached--;
+        admission->startups--;
+    }
+    ssh_mutex_unlock(&ssh_bind_admission_mutex);
+}
+
+/**
+ * @internal
+ *
+ * @brief Release the admission control of a bind being freed, the sessions
+ *        it admitted may outlive it.
+ *
+ * @param[in]  sshbind  The ssh server bind.
+ */
+void ssh_bind_admission_free(ssh_bind sshbind)
+{
+    if (sshbind->admission == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&ssh_bind_admission_mutex);
+    ssh_bind_admission_unref(sshbind->admission);
+    sshbind->admission = NULL;
+    ssh_mutex_unlock(&ssh_bind_admission_mutex);
+}
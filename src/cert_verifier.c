@@ -0,0 +1,643 @@
+/*
+ * cert_verifier.c - verification of the user certificates for the servers
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libssh/priv.h"
+#include "libssh/libssh.h"
+#include "libssh/server.h"
+#include "libssh/authorized_keys.h"
+#include "libssh/buffer.h"
+#include "libssh/messages.h"
+#include "libssh/bytearray.h"
+#include "libssh/pki.h"
+#include "libssh/threads.h"
+#include "libssh/wrapper.h"
+
+/*
+ * A certificate is checked as sshd does with TrustedUserCAKeys: it must be
+ * a user certificate, valid now, for the principal, without critical
+ * options, signed by one of the certificate authorities and revoked neither
+ * itself, nor its key, nor its authority.
+ *
+ * All of it but the signature of the authority is read from the blob of the
+ * certificate without allocating, and the authorities and the revoked keys
+ * are looked up by their blobs in ssh_authorized_keys stores. The signature
+ * is the only public key operation, and a certificate whose signature was
+ * verified is remembered by the SHA-256 of its blob: the next logins with it
+ * skip the verification but still go through every other check, so that
+ * the cache never outlives an expiry, a revocation or a removed authority.
+ *
+ * The cache is a table of sets of SSH_CERT_CACHE_WAYS entries, the least
+ * recently used entry of a set making room for a new certificate.
+ */
+
+#define SSH_CERT_TYPE_USER 1
+#define SSH_CERT_CACHE_WAYS 4
+
+struct ssh_cert_cache_entry {
+    unsigned char digest[SHA256_DIGEST_LEN];
+    /* when the entry was last used, 0 for a free entry */
+    uint64_t used;
+};
+
+struct ssh_cert_verifier_struct {
+    ssh_authorized_keys cas;
+    ssh_authorized_keys revoked;
+
+    struct ssh_cert_cache_entry *cache;
+    uint32_t sets_mask;
+    uint64_t clock;
+};
+
+/* the fields of a certificate, pointing into its blob */
+struct ssh_cert_fields {
+    const char *type;
+    const unsigned char *key;
+    size_t key_len;
+    uint32_t cert_type;
+    const unsigned char *principals;
+    size_t principals_len;
+    uint64_t valid_after;
+    uint64_t valid_before;
+    size_t critical_len;
+    const unsigned char *signature_key;
+    size_t signature_key_len;
+    const unsigned char *signature;
+    size_t signature_len;
+    /* the signature covers the blob up to the signature key included */
+    size_t signed_len;
+};
+
+struct ssh_cert_reader {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+};
+
+/* the verifiers are shared by the threads serving the sessions */
+static SSH_MUTEX ssh_cert_verifier_mutex = SSH_MUTEX_STATIC_INIT;
+
+/**
+ * @addtogroup libssh_server
+ *
+ * @{
+ */
+
+static int ssh_cert_read_u32(struct ssh_cert_reader *r, uint32_t *value)
+{
+    if (r->len - r->pos < sizeof(uint32_t)) {
+        return SSH_ERROR;
+    }
+    *value = PULL_BE_U32(r->data, r->pos);
+    r->pos += sizeof(uint32_t);
+
+    return SSH_OK;
+}
+
+static int ssh_cert_read_u64(struct ssh_cert_reader *r, uint64_t *value)
+{
+    if (r->len - r->pos < sizeof(uint64_t)) {
+        return SSH_ERROR;
+    }
+    *value = PULL_BE_U64(r->data, r->pos);
+    r->pos += sizeof(uint64_t);
+
+    return SSH_OK;
+}
+
+static int ssh_cert_read_string(struct ssh_cert_reader *r,
+                                const unsigned char **data,
+                                size_t *len)
+{
+    uint32_t n;
+
+    if (ssh_cert_read_u32(r, &n) != SSH_OK || n > r->len - r->pos) {
+        return SSH_ERROR;
+    }
+    if (data != NULL) {
+        *data = r->data + r->pos;
+    }
+    if (len != NULL) {
+        *len = n;
+    }
+    r->pos += n;
+
+    return SSH_OK;
+}
+
+static int ssh_cert_parse(const ssh_key cert, struct ssh_cert_fields *f)
+{
+    struct ssh_cert_reader r;
+    size_t key_start;
+    uint64_t serial;
+    int nkey;
+    int i;
+
+    switch (cert->type) {
+        case SSH_KEYTYPE_DSS_CERT01:
+            f->type = "ssh-dss";
+            nkey = 4;
+            break;
+        case SSH_KEYTYPE_RSA_CERT01:
+            f->type = "ssh-rsa";
+            nkey = 2;
+            break;
+        default:
+            return SSH_ERROR;
+    }
+
+    r.data = ssh_buffer_get(cert->cert);
+    r.len = ssh_buffer_get_len(cert->cert);
+    r.pos = 0;
+
+    /* the type, checked on import, and the nonce */
+    if (ssh_cert_read_string(&r, NULL, NULL) != SSH_OK ||
+        ssh_cert_read_string(&r, NULL, NULL) != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    key_start = r.pos;
+    for (i = 0; i < nkey; i++) {
+        if (ssh_cert_read_string(&r, NULL, NULL) != SSH_OK) {
+            return SSH_ERROR;
+        }
+    }
+    f->key = r.data + key_start;
+    f->key_len = r.pos - key_start;
+
+    if (ssh_cert_read_u64(&r, &serial) != SSH_OK ||
+        ssh_cert_read_u32(&r, &f->cert_type) != SSH_OK ||
+        ssh_cert_read_string(&r, NULL, NULL) != SSH_OK || /* key id */
+        ssh_cert_read_string(&r,
+                             &f->principals,
+                             &f->principals_len) != SSH_OK ||
+        ssh_cert_read_u64(&r, &f->valid_after) != SSH_OK ||
+        ssh_cert_read_u64(&r, &f->valid_before) != SSH_OK ||
+        ssh_cert_read_string(&r, NULL, &f->critical_len) != SSH_OK ||
+        ssh_cert_read_string(&r, NULL, NULL) != SSH_OK || /* extensions */
+        ssh_cert_read_string(&r, NULL, NULL) != SSH_OK || /* reserved */
+        ssh_cert_read_string(&r,
+                             &f->signature_key,
+                             &f->signature_key_len) != SSH_OK) {
+        return SSH_ERROR;
+    }
+    f->signed_len = r.pos;
+
+    if (ssh_cert_read_string(&r,
+                             &f->signature,
+                             &f->signature_len) != SSH_OK ||
+        r.pos != r.len) {
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+static int ssh_cert_has_principal(const struct ssh_cert_fields *f,
+                                  const char *principal)
+{
+    struct ssh_cert_reader r;
+    const unsigned char *name = NULL;
+    size_t principal_len = strlen(principal);
+    size_t len;
+
+    r.data = f->principals;
+    r.len = f->principals_len;
+    r.pos = 0;
+
+    while (r.pos < r.len) {
+        if (ssh_cert_read_string(&r, &name, &len) != SSH_OK) {
+            return 0;
+        }
+        if (len == principal_len && memcmp(name, principal, len) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Whether the certificate, its key or its authority is revoked */
+static int ssh_cert_is_revoked(ssh_authorized_keys revoked,
+                               const ssh_key cert,
+                               const struct ssh_cert_fields *f)
+{
+    ssh_buffer key = NULL;
+    int rc;
+
+    rc = ssh_authorized_keys_match_blob(revoked,
+                                        ssh_buffer_get(cert->cert),
+                                        ssh_buffer_get_len(cert->cert),
+                                        NULL);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = ssh_authorized_keys_match_blob(revoked,
+                                        f->signature_key,
+                                        f->signature_key_len,
+                                        NULL);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* the blob of the key is its type followed by the fields in the cert */
+    key = ssh_buffer_new();
+    if (key == NULL) {
+        return SSH_ERROR;
+    }
+    rc = ssh_buffer_pack(key, "sP", f->type, f->key_len, f->key);
+    if (rc == SSH_OK) {
+        rc = ssh_authorized_keys_match_blob(revoked,
+                                            ssh_buffer_get(key),
+                                            ssh_buffer_get_len(key),
+                                            NULL);
+    }
+    ssh_buffer_free(key);
+
+    return rc;
+}
+
+static struct ssh_cert_cache_entry *
+ssh_cert_cache_set(ssh_cert_verifier verifier, const unsigned char *digest)
+{
+    uint32_t set = PULL_BE_U32(digest, 0) & verifier->sets_mask;
+
+    return &verifier->cache[(size_t)set * SSH_CERT_CACHE_WAYS];
+}
+
+static int ssh_cert_cache_lookup(ssh_cert_verifier verifier,
+                                 const unsigned char *digest)
+{
+    struct ssh_cert_cache_entry *set = NULL;
+    int found = 0;
+    int i;
+
+    if (verifier->cache == NULL) {
+        return 0;
+    }
+
+    ssh_mutex_lock(&ssh_cert_verifier_mutex);
+    set = ssh_cert_cache_set(verifier, digest);
+    for (i = 0; i < SSH_CERT_CACHE_WAYS; i++) {
+        if (set[i].used != 0 &&
+            memcmp(set[i].digest, digest, SHA256_DIGEST_LEN) == 0) {
+            set[i].used = ++verifier->clock;
+            found = 1;
+            break;
+        }
+    }
+    ssh_mutex_unlock(&ssh_cert_verifier_mutex);
+
+    return found;
+}
+
+static void ssh_cert_cache_add(ssh_cert_verifier verifier,
+                               const unsigned char *digest)
+{
+    struct ssh_cert_cache_entry *set = NULL;
+    struct ssh_cert_cache_entry *victim = NULL;
+    int i;
+
+    if (verifier->cache == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&ssh_cert_verifier_mutex);
+    set = ssh_cert_cache_set(verifier, digest);
+    victim = &set[0];
+    for (i = 0; i < SSH_CERT_CACHE_WAYS; i++) {
+        if (set[i].used != 0 &&
+            memcmp(set[i].digest, digest, SHA256_DIGEST_LEN) == 0) {
+            /* added by another session meanwhile */
+            victim = &set[i];
+            break;
+        }
+        if (set[i].used < victim->used) {
+            victim = &set[i];
+        }
+    }
+    memcpy(victim->digest, digest, SHA256_DIGEST_LEN);
+    victim->used = ++verifier->clock;
+    ssh_mutex_unlock(&ssh_cert_verifier_mutex);
+}
+
+/* Verify the signature of the authority over the certificate */
+static int ssh_cert_verify_signature(ssh_session session,
+                                     const ssh_key cert,
+                                     const struct ssh_cert_fields *f)
+{
+    ssh_string blob = NULL;
+    ssh_key ca = NULL;
+    ssh_signature sig = NULL;
+    int rc;
+
+    blob = ssh_string_new(f->signature_key_len);
+    if (blob == NULL) {
+        return SSH_ERROR;
+    }
+    ssh_string_fill(blob, f->signature_key, f->signature_key_len);
+    rc = ssh_pki_import_pubkey_blob(blob, &ca);
+    ssh_string_free(blob);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    blob = ssh_string_new(f->signature_len);
+    if (blob == NULL) {
+        ssh_key_free(ca);
+        return SSH_ERROR;
+    }
+    ssh_string_fill(blob, f->signature, f->signature_len);
+    rc = ssh_pki_import_signature_blob(blob, ca, &sig);
+    ssh_string_free(blob);
+    if (rc == SSH_OK) {
+        rc = ssh_pki_signature_verify(session,
+                                      sig,
+                                      ca,
+                                      ssh_buffer_get(cert->cert),
+                                      f->signed_len);
+    }
+    ssh_signature_free(sig);
+    ssh_key_free(ca);
+
+    return rc;
+}
+
+/**
+ * @brief Create a verifier of the user certificates.
+ *
+ * The verifier accepts the certificates signed by the given authorities,
+ * as sshd does with its TrustedUserCAKeys. The signatures it verified are
+ * remembered, so that the next logins with the same certificates cost no
+ * public key operation.
+ *
+ * @param[in]  cas      The public keys of the certificate authorities, read
+ *                      with ssh_authorized_keys_load_file(). It must not be
+ *                      freed before the verifier.
+ *
+ * @param[in]  cache_size The number of certificates to remember, 0 to
+ *                      verify every signature.
+ *
+ * @return              The new verifier, NULL on error.
+ *
+ * @see ssh_cert_verifier_free()
+ */
+ssh_cert_verifier ssh_cert_verifier_new(ssh_authorized_keys cas,
+                                        unsigned int cache_size)
+{
+    ssh_cert_verifier verifier = NULL;
+    uint32_t sets = 1;
+
+    if (cas == NULL) {
+        return NULL;
+    }
+
+    verifier = calloc(1, sizeof(struct ssh_cert_verifier_struct));
+    if (verifier == NULL) {
+        return NULL;
+    }
+    verifier->cas = cas;
+
+    if (cache_size > 0) {
+        while (sets * SSH_CERT_CACHE_WAYS < cache_size && sets < (1U << 24)) {
+            sets <<= 1;
+        }
+        verifier->cache = calloc((size_t)sets * SSH_CERT_CACHE_WAYS,
+                                 sizeof(struct ssh_cert_cache_entry));
+        if (verifier->cache == NULL) {
+            SAFE_FREE(verifier);
+            return NULL;
+        }
+        verifier->sets_mask = sets - 1;
+    }
+
+    return verifier;
+}
+
+/**
+ * @brief Free a verifier of user certificates.
+ *
+ * The stores of keys it was given are not freed.
+ *
+ * @param[in]  verifier The verifier to free.
+ */
+void ssh_cert_verifier_free(ssh_cert_verifier verifier)
+{
+    if (verifier == NULL) {
+        return;
+    }
+
+    SAFE_FREE(verifier->cache);
+    SAFE_FREE(verifier);
+}
+
+/**
+ * @brief Set the revoked keys of a verifier of user certificates.
+ *
+ * A certificate is refused if it, the key it was issued for or the
+ * authority which signed it is in the store, as with the RevokedKeys of
+ * sshd given a list of public keys. The store is looked at on every
+ * verification, remembered certificates included, and follows the changes
+ * of its file.
+ *
+ * @param[in]  verifier The verifier.
+ *
+ * @param[in]  revoked  The revoked keys, NULL for none. It must not be freed
+ *                      before the verifier.
+ */
+void ssh_cert_verifier_set_revoked(ssh_cert_verifier verifier,
+                                   ssh_authorized_keys revoked)
+{
+    if (verifier == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&ssh_cert_verifier_mutex);
+    verifier->revoked = revoked;
+    ssh_mutex_unlock(&ssh_cert_verifier_mutex);
+}
+
+/**
+ * @brief Verify a user certificate.
+ *
+ * The certificate must be a user certificate, valid now, list the
+ * principal, be signed by one of the authorities of the verifier and not be
+ * revoked. The certificates with critical options are refused, the
+ * verifier does not enforce them.
+ *
+ * @param[in]  verifier The verifier.
+ *
+ * @param[in]  session  The session the certificate was received on, for
+ *                      the errors.
+ *
+ * @param[in]  cert     The certificate, e.g. ssh_message_auth_pubkey().
+ *
+ * @param[in]  principal The name the certificate must be valid for,
+ *                      usually the user name of the request.
+ *
+ * @return              1 if the certificate is valid, 0 if not, SSH_ERROR on
+ *                      error.
+ */
+int ssh_cert_verifier_check(ssh_cert_verifier verifier,
+                            ssh_session session,
+                            const ssh_key cert,
+                            const char *principal)
+{
+    struct ssh_cert_fields f;
+    unsigned char digest[SHA256_DIGEST_LEN];
+    ssh_authorized_keys revoked = NULL;
+    uint64_t now;
+    int rc;
+
+    if (verifier == NULL || session == NULL || cert == NULL ||
+        principal == NULL) {
+        return SSH_ERROR;
+    }
+    if (cert->cert == NULL) {
+        return 0;
+    }
+
+    if (ssh_cert_parse(cert, &f) != SSH_OK) {
+        SSH_LOG(SSH_LOG_PACKET, "Malformed certificate");
+        return 0;
+    }
+    if (f.cert_type != SSH_CERT_TYPE_USER) {
+        SSH_LOG(SSH_LOG_PACKET, "Not a user certificate");
+        return 0;
+    }
+    now = (uint64_t)time(NULL);
+    if (now < f.valid_after || now >= f.valid_before) {
+        SSH_LOG(SSH_LOG_PACKET, "Certificate not valid now");
+        return 0;
+    }
+    if (f.critical_len != 0) {
+        SSH_LOG(SSH_LOG_PACKET, "Certificate with critical options refused");
+        return 0;
+    }
+    if (!ssh_cert_has_principal(&f, principal)) {
+        SSH_LOG(SSH_LOG_PACKET,
+                "Certificate not valid for principal %s",
+                principal);
+        return 0;
+    }
+
+    rc = ssh_authorized_keys_match_blob(verifier->cas,
+                                        f.signature_key,
+                                        f.signature_key_len,
+                                        NULL);
+    if (rc != 1) {
+        if (rc == 0) {
+            SSH_LOG(SSH_LOG_PACKET, "Certificate of an unknown authority");
+        }
+        return rc;
+    }
+
+    ssh_mutex_lock(&ssh_cert_verifier_mutex);
+    revoked = verifier->revoked;
+    ssh_mutex_unlock(&ssh_cert_verifier_mutex);
+    if (revoked != NULL) {
+        rc = ssh_cert_is_revoked(revoked, cert, &f);
+        if (rc != 0) {
+            if (rc == 1) {
+                SSH_LOG(SSH_LOG_PACKET, "Certificate revoked");
+                return 0;
+            }
+            return SSH_ERROR;
+        }
+    }
+
+    sha256(ssh_buffer_get(cert->cert),
+           (int)ssh_buffer_get_len(cert->cert),
+           digest);
+    if (ssh_cert_cache_lookup(verifier, digest)) {
+        return 1;
+    }
+
+    rc = ssh_cert_verify_signature(session, cert, &f);
+    if (rc != SSH_OK) {
+        SSH_LOG(SSH_LOG_PACKET, "Invalid signature of the certificate");
+        return 0;
+    }
+    ssh_cert_cache_add(verifier, digest);
+
+    return 1;
+}
+
+/**
+ * @brief Resolve a public key authentication request made with a user
+ *        certificate.
+ *
+ * Like ssh_message_auth_authorized_keys(), the request is answered unless
+ * the certificate is valid for the user of the request and the signature
+ * made with its key is valid.
+ *
+ * @param[in]  msg      A SSH_REQUEST_AUTH message of the publickey method.
+ *
+ * @param[in]  verifier The verifier of the certificates.
+ *
+ * @return              SSH_AUTH_SUCCESS if the certificate is valid and its
+ *                      key signed the request, the caller replies then;\n
+ *                      SSH_AUTH_AGAIN if the certificate is valid and the
+ *                      client was told so, it will sign a request next;\n
+ *                      SSH_AUTH_DENIED if the request was refused;\n
+ *                      SSH_AUTH_ERROR on error.
+ */
+int ssh_message_auth_cert(ssh_message msg, ssh_cert_verifier verifier)
+{
+    enum ssh_publickey_state_e state;
+    int rc;
+
+    if (msg == NULL || verifier == NULL ||
+        ssh_message_type(msg) != SSH_REQUEST_AUTH ||
+        ssh_message_subtype(msg) != SSH_AUTH_METHOD_PUBLICKEY) {
+        return SSH_AUTH_ERROR;
+    }
+
+    state = ssh_message_auth_publickey_state(msg);
+    if (state != SSH_PUBLICKEY_STATE_NONE &&
+        state != SSH_PUBLICKEY_STATE_VALID) {
+        ssh_message_reply_default(msg);
+        return SSH_AUTH_DENIED;
+    }
+
+    rc = ssh_cert_verifier_check(verifier,
+                                 msg->session,
+                                 ssh_message_auth_pubkey(msg),
+                                 ssh_message_auth_user(msg));
+    if (rc != 1) {
+        ssh_message_reply_default(msg);
+        return rc == 0 ? SSH_AUTH_DENIED : SSH_AUTH_ERROR;
+    }
+
+    if (state == SSH_PUBLICKEY_STATE_NONE) {
+        rc = ssh_message_auth_reply_pk_ok_simple(msg);
+        return rc == SSH_OK ? SSH_AUTH_AGAIN : SSH_AUTH_ERROR;
+    }
+
+    return SSH_AUTH_SUCCESS;
+}
+
+/** @} */
@@ -44,6 +44,7 @@
 #include "libssh/session.h"
 #include "libssh/misc.h"
 #include "libssh/messages.h"
+#include "libssh/probes.h"
 #if WITH_SERVER
 #include "libssh/server.h"
 #endif
@@ -139,6 +140,35 @@ uint32_t ssh_channel_new_id(ssh_session session) {
  *
  * Constructs the channel object.
  */
+/*
+ * Close a channel which was freed while it was being opened, now that the
+ * server opened it. It is freed once the server closed it too.
+ */
+static void channel_close_freed(ssh_channel channel)
+{
+    ssh_session session = channel->session;
+    int rc;
+
+    rc = ssh_buffer_pack(session->out_buffer,
+                         "bd",
+                         SSH2_MSG_CHANNEL_CLOSE,
+                         channel->remote_channel);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        return;
+    }
+    rc = ssh_packet_send(session);
+    if (rc == SSH_ERROR) {
+        return;
+    }
+    SSH_LOG(SSH_LOG_PACKET,
+            "Sent a close on freed channel (%d:%d)",
+            channel->local_channel,
+            channel->remote_channel);
+    channel->state = SSH_CHANNEL_STATE_CLOSED;
+    channel->flags |= SSH_CHANNEL_FLAG_CLOSED_LOCAL;
+}
+
 SSH_PACKET_CALLBACK(ssh_packet_channel_open_conf){
   uint32_t channelid=0;
   ssh_channel channel;
@@ -188,6 +218,19 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_open_conf){
 
   channel->state = SSH_CHANNEL_STATE_OPEN;
   channel->flags &= ~SSH_CHANNEL_FLAG_NOT_BOUND;
+
+  if (channel->flags & SSH_CHANNEL_FLAG_FREED_LOCAL) {
+      channel_close_freed(channel);
+      return SSH_PACKET_USED;
+  }
+
+  ssh_callbacks_execute_list(channel->callbacks,
+                             ssh_channel_callbacks,
+                             channel_open_response_function,
+                             session,
+                             channel,
+                             1);
+
   return SSH_PACKET_USED;
 
 error:
@@ -236,6 +279,19 @@ SSH_PACKET_CALLBACK(ssh_packet_channel_open_fail){
       error);
   SAFE_FREE(error);
   channel->state=SSH_CHANNEL_STATE_OPEN_DENIED;
+
+  if (channel->flags & SSH_CHANNEL_FLAG_FREED_LOCAL) {
+      ssh_channel_do_free(channel);
+      return SSH_PACKET_USED;
+  }
+
+  ssh_callbacks_execute_list(channel->callbacks,
+                             ssh_channel_callbacks,
+                             channel_open_response_function,
+                             session,
+                             channel,
+                             0);
+
   return SSH_PACKET_USED;
 
 error:
@@ -255,39 +311,16 @@ static int ssh_channel_open_termination(void *c){
 /**
  * @internal
  *
- * @brief Open a channel by sending a SSH_OPEN_CHANNEL message and
- *        wait for the reply.
- *
- * @param[in]  channel  The current channel.
- *
- * @param[in]  type   A C string describing the kind of channel (e.g. "exec").
- *
- * @param[in]  window   The receiving window of the channel. The window is the
- *                      maximum size of data that can stay in buffers and
- *                      network.
- *
- * @param[in]  maxpacket The maximum packet size allowed (like MTU).
+ * @brief Send the SSH_OPEN_CHANNEL message of a channel which is not open yet,
+ *        without waiting for the reply.
  *
- * @param[in]  payload   The buffer containing additional payload for the query.
+ * @see channel_open()
  */
-static int channel_open(ssh_channel channel, const char *type, int window,
+static int channel_open_send(ssh_channel channel, const char *type, int window,
     int maxpacket, ssh_buffer payload) {
   ssh_session session = channel->session;
-  int err=SSH_ERROR;
   int rc;
 
-  switch(channel->state){
-  case SSH_CHANNEL_STATE_NOT_OPEN:
-    break;
-  case SSH_CHANNEL_STATE_OPENING:
-    goto pending;
-  case SSH_CHANNEL_STATE_OPEN:
-  case SSH_CHANNEL_STATE_CLOSED:
-  case SSH_CHANNEL_STATE_OPEN_DENIED:
-    goto end;
-  default:
-    ssh_set_error(session,SSH_FATAL,"Bad state in channel_open: %d",channel->state);
-  }
   channel->local_channel = ssh_channel_new_id(session);
   channel->local_maxpacket = maxpacket;
   channel->local_window = window;
@@ -305,25 +338,67 @@ static int channel_open(ssh_channel channel, const char *type, int window,
                        channel->local_maxpacket);
   if (rc != SSH_OK){
     ssh_set_error_oom(session);
-    return err;
+    return SSH_ERROR;
   }
 
   if (payload != NULL) {
     if (ssh_buffer_add_buffer(session->out_buffer, payload) < 0) {
       ssh_set_error_oom(session);
 
-      return err;
+      return SSH_ERROR;
     }
   }
   channel->state = SSH_CHANNEL_STATE_OPENING;
   if (ssh_packet_send(session) == SSH_ERROR) {
 
-    return err;
+    return SSH_ERROR;
   }
 
   SSH_LOG(SSH_LOG_PACKET,
       "Sent a SSH_MSG_CHANNEL_OPEN type %s for channel %d",
       type, channel->local_channel);
+
+  return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Open a channel by sending a SSH_OPEN_CHANNEL message and
+ *        wait for the reply.
+ *
+ * @param[in]  channel  The current channel.
+ *
+ * @param[in]  type   A C string describing the kind of channel (e.g. "exec").
+ *
+ * @param[in]  window   The receiving window of the channel. The window is the
+ *                      maximum size of data that can stay in buffers and
+ *                      network.
+ *
+ * @param[in]  maxpacket The maximum packet size allowed (like MTU).
+ *
+ * @param[in]  payload   The buffer containing additional payload for the query.
+ */
+static int channel_open(ssh_channel channel, const char *type, int window,
+    int maxpacket, ssh_buffer payload) {
+  ssh_session session = channel->session;
+  int err=SSH_ERROR;
+
+  switch(channel->state){
+  case SSH_CHANNEL_STATE_NOT_OPEN:
+    break;
+  case SSH_CHANNEL_STATE_OPENING:
+    goto pending;
+  case SSH_CHANNEL_STATE_OPEN:
+  case SSH_CHANNEL_STATE_CLOSED:
+  case SSH_CHANNEL_STATE_OPEN_DENIED:
+    goto end;
+  default:
+    ssh_set_error(session,SSH_FATAL,"Bad state in channel_open: %d",channel->state);
+  }
+  if (channel_open_send(channel, type, window, maxpacket, payload) != SSH_OK) {
+    return err;
+  }
 pending:
   /* wait until channel is opened by server */
   err = ssh_handle_packets_termination(session,
@@ -401,6 +476,10 @@ static int grow_window(ssh_session session, ssh_channel channel, int minimumsize
       new_window);
 
   channel->local_window = new_window;
+  SSH_PROBE3(channel__window__grow,
+             session,
+             channel->local_channel,
+             new_window);
 
   return SSH_OK;
 error:
@@ -472,6 +551,18 @@ SSH_PACKET_CALLBACK(channel_rcv_change_window) {
       channel->remote_window);
 
   channel->remote_window += bytes;
+  SSH_PROBE4(channel__window__adjust,
+             session,
+             channel->local_channel,
+             bytes,
+             channel->remote_window);
+
+  ssh_callbacks_execute_list(channel->callbacks,
+                             ssh_channel_callbacks,
+                             channel_write_wontblock_function,
+                             session,
+                             channel,
+                             channel->remote_window);
 
   return SSH_PACKET_USED;
 }
@@ -923,36 +1014,15 @@ int ssh_channel_open_auth_agent(ssh_channel channel){
 }
 
 
-/**
- * @brief Open a TCP/IP forwarding channel.
- *
- * @param[in]  channel  An allocated channel.
- *
- * @param[in]  remotehost The remote host to connected (host name or IP).
- *
- * @param[in]  remoteport The remote port.
- *
- * @param[in]  sourcehost The numeric IP address of the machine from where the
- *                        connection request originates. This is mostly for
- *                        logging purposes.
- *
- * @param[in]  localport  The port on the host from where the connection
- *                        originated. This is mostly for logging purposes.
- *
- * @return              SSH_OK on success,
- *                      SSH_ERROR if an error occurred,
- *                      SSH_AGAIN if in nonblocking mode and call has
- *                      to be done again.
- *
- * @warning This function does not bind the local port and does not automatically
- *          forward the content of a socket to the channel. You still have to
- *          use channel_read and channel_write for this.
- */
-int ssh_channel_open_forward(ssh_channel channel, const char *remotehost,
-    int remoteport, const char *sourcehost, int localport) {
+static int channel_open_forward_common(ssh_channel channel,
+                                       const char *remotehost,
+                                       int remoteport,
+                                       const char *sourcehost,
+                                       int localport,
+                                       bool wait)
+{
   ssh_session session;
   ssh_buffer payload = NULL;
-  ssh_string str = NULL;
   int rc = SSH_ERROR;
 
   if(channel == NULL) {
@@ -983,23 +1053,133 @@ int ssh_channel_open_forward(ssh_channel channel, const char *remotehost,
     goto error;
   }
 
-  rc = channel_open(channel,
-                    "direct-tcpip",
-                    CHANNEL_INITIAL_WINDOW,
-                    CHANNEL_MAX_PACKET,
-                    payload);
+  if (wait) {
+    rc = channel_open(channel,
+                      "direct-tcpip",
+                      CHANNEL_INITIAL_WINDOW,
+                      CHANNEL_MAX_PACKET,
+                      payload);
+  } else if (channel->state == SSH_CHANNEL_STATE_NOT_OPEN) {
+    rc = channel_open_send(channel,
+                           "direct-tcpip",
+                           CHANNEL_INITIAL_WINDOW,
+                           CHANNEL_MAX_PACKET,
+                           payload);
+  } else {
+    ssh_set_error(session, SSH_FATAL,
+                  "Bad state in channel_open: %d", channel->state);
+    rc = SSH_ERROR;
+  }
 
 error:
   ssh_buffer_free(payload);
-  ssh_string_free(str);
 
   return rc;
 }
 
+/**
+ * @brief Open a TCP/IP forwarding channel.
+ *
+ * @param[in]  channel  An allocated channel.
+ *
+ * @param[in]  remotehost The remote host to connected (host name or IP).
+ *
+ * @param[in]  remoteport The remote port.
+ *
+ * @param[in]  sourcehost The numeric IP address of the machine from where the
+ *                        connection request originates. This is mostly for
+ *                        logging purposes.
+ *
+ * @param[in]  localport  The port on the host from where the connection
+ *                        originated. This is mostly for logging purposes.
+ *
+ * @return              SSH_OK on success,
+ *                      SSH_ERROR if an error occurred,
+ *                      SSH_AGAIN if in nonblocking mode and call has
+ *                      to be done again.
+ *
+ * @warning This function does not bind the local port and does not automatically
+ *          forward the content of a socket to the channel. You still have to
+ *          use channel_read and channel_write for this, or let a forwarder
+ *          do all of it.
+ *
+ * @see ssh_forwarder_new()
+ */
+int ssh_channel_open_forward(ssh_channel channel, const char *remotehost,
+    int remoteport, const char *sourcehost, int localport) {
+  return channel_open_forward_common(channel,
+                                     remotehost,
+                                     remoteport,
+                                     sourcehost,
+                                     localport,
+                                     true);
+}
+
+/**
+ * @internal
+ *
+ * @brief Send the opening of a TCP/IP forwarding channel without waiting for
+ * the reply of the server.
+ *
+ * The channel_open_response_function callback of the channel is called with
+ * the reply, from the processing of the packets of the session.
+ *
+ * @return              SSH_OK if the request was sent, SSH_ERROR otherwise.
+ *
+ * @see ssh_channel_open_forward()
+ */
+int channel_open_forward_nowait(ssh_channel channel,
+                                const char *remotehost,
+                                int remoteport,
+                                const char *sourcehost,
+                                int localport)
+{
+  return channel_open_forward_common(channel,
+                                     remotehost,
+                                     remoteport,
+                                     sourcehost,
+                                     localport,
+                                     false);
+}
+
+
+/**
+ * @internal
+ *
+ * @brief Send the opening of a session channel without waiting for the reply
+ * of the server.
+ *
+ * The channel_open_response_function callback of the channel is called with
+ * the reply, from the processing of the packets of the session.
+ *
+ * @return              SSH_OK if the request was sent, SSH_ERROR otherwise.
+ *
+ * @see ssh_channel_open_session()
+ */
+int channel_open_session_nowait(ssh_channel channel)
+{
+  if (channel == NULL) {
+      return SSH_ERROR;
+  }
+  if (channel->state != SSH_CHANNEL_STATE_NOT_OPEN) {
+    ssh_set_error(channel->session, SSH_FATAL,
+                  "Bad state in channel_open: %d", channel->state);
+    return SSH_ERROR;
+  }
+
+  return channel_open_send(channel,
+                           "session",
+                           CHANNEL_INITIAL_WINDOW,
+                           CHANNEL_MAX_PACKET,
+                           NULL);
+}
 
 /**
  * @brief Close and free a channel.
  *
+ * A channel whose opening was requested without waiting for the answer is
+ * kept by the session until the server answers, and closed then.
+ *
  * @param[in]  channel  The channel to free.
  *
  * @warning Any data unread on this channel will be lost.
@@ -1044,8 +1224,10 @@ void ssh_channel_free(ssh_channel channel)
      * We definitively close the channel when we receive a close message *and*
      * the user closed it.
      */
+    /* the server would answer the open request of a freed channel */
     if ((channel->flags & SSH_CHANNEL_FLAG_CLOSED_REMOTE) ||
-        (channel->flags & SSH_CHANNEL_FLAG_NOT_BOUND)) {
+        ((channel->flags & SSH_CHANNEL_FLAG_NOT_BOUND) &&
+         (channel->state != SSH_CHANNEL_STATE_OPENING || !session->alive))) {
         ssh_channel_do_free(channel);
     }
 }
@@ -1253,30 +1435,74 @@ int ssh_channel_flush(ssh_channel channel){
   return ssh_blocking_flush(channel->session, SSH_TIMEOUT_DEFAULT);
 }
 
+/*
+ * Append len bytes of the vector to the buffer, from the piece *i at *offset,
+ * and advance both past them.
+ */
+static int channel_append_iov(ssh_buffer buffer,
+                              const struct ssh_iovec *iov,
+                              int *i,
+                              size_t *offset,
+                              size_t len)
+{
+  while (len > 0) {
+    size_t n = MIN(len, iov[*i].len - *offset);
+
+    if (n > 0) {
+      if (ssh_buffer_add_data(buffer,
+                              (const uint8_t *)iov[*i].data + *offset,
+                              n) < 0) {
+        return SSH_ERROR;
+      }
+    }
+    len -= n;
+    *offset += n;
+    if (*offset == iov[*i].len) {
+      (*i)++;
+      *offset = 0;
+    }
+  }
+
+  return SSH_OK;
+}
+
 static int channel_write_common(ssh_channel channel,
-                                const void *data,
-                                uint32_t len, int is_stderr)
+                                const struct ssh_iovec *iov,
+                                int iovcnt,
+                                int is_stderr,
+                                bool wait)
 {
   ssh_session session;
-  uint32_t origlen = len;
+  uint32_t origlen;
+  uint32_t len = 0;
   size_t effectivelen;
   size_t maxpacketlen;
+  size_t offset = 0;
+  int i;
   int rc;
 
   if(channel == NULL) {
       return -1;
   }
   session = channel->session;
-  if(data == NULL) {
+  if (iov == NULL || iovcnt < 0) {
       ssh_set_error_invalid(session);
       return -1;
   }
-
-  if (len > INT_MAX) {
-      SSH_LOG(SSH_LOG_PROTOCOL,
-              "Length (%u) is bigger than INT_MAX", len);
-      return SSH_ERROR;
+  for (i = 0; i < iovcnt; i++) {
+      if (iov[i].data == NULL && iov[i].len > 0) {
+          ssh_set_error_invalid(session);
+          return -1;
+      }
+      if (iov[i].len > INT_MAX - len) {
+          SSH_LOG(SSH_LOG_PROTOCOL,
+                  "Length of the vector is bigger than INT_MAX");
+          return SSH_ERROR;
+      }
+      len += iov[i].len;
   }
+  origlen = len;
+  i = 0;
 
   /*
    * Handle the max packet len from remote side, be nice
@@ -1302,7 +1528,8 @@ static int channel_write_common(ssh_channel channel,
     return SSH_ERROR;
   }
 
-  if (ssh_waitsession_unblocked(session) == 0){
+  /* packets sent during a key re-exchange are queued */
+  if (wait && ssh_waitsession_unblocked(session) == 0){
     rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
             ssh_waitsession_unblocked, session);
     if (rc == SSH_ERROR || !ssh_waitsession_unblocked(session))
@@ -1315,10 +1542,17 @@ static int channel_write_common(ssh_channel channel,
           channel->remote_window,
           len);
       /* What happens when the channel window is zero? */
+      if (channel->remote_window == 0 && !wait) {
+          break;
+      }
       if(channel->remote_window == 0) {
           /* nothing can be written */
           SSH_LOG(SSH_LOG_PROTOCOL,
                 "Wait for a growing window message...");
+          SSH_PROBE3(channel__window__exhausted,
+                     session,
+                     channel->local_channel,
+                     len);
           rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
               ssh_channel_waitwindow_termination,channel);
           if (rc == SSH_ERROR ||
@@ -1355,11 +1589,14 @@ static int channel_write_common(ssh_channel channel,
         }
     }
 
-    /* append payload data */
-    rc = ssh_buffer_pack(session->out_buffer,
-                         "dP",
-                         effectivelen,
-                         (size_t)effectivelen, data);
+    /* append payload data, gathered from the vector */
+    rc = ssh_buffer_pack(session->out_buffer, "d", effectivelen);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    rc = channel_append_iov(session->out_buffer, iov, &i, &offset,
+                            effectivelen);
     if (rc != SSH_OK) {
         ssh_set_error_oom(session);
         goto error;
@@ -1375,16 +1612,17 @@ static int channel_write_common(ssh_channel channel,
 
     channel->remote_window -= effectivelen;
     len -= effectivelen;
-    data = ((uint8_t*)data + effectivelen);
     if (channel->counter != NULL) {
         channel->counter->out_bytes += effectivelen;
     }
   }
 
   /* it's a good idea to flush the socket now */
-  rc = ssh_channel_flush(channel);
-  if (rc == SSH_ERROR) {
-      goto error;
+  if (wait) {
+      rc = ssh_channel_flush(channel);
+      if (rc == SSH_ERROR) {
+          goto error;
+      }
   }
 
 out:
@@ -1431,7 +1669,74 @@ uint32_t ssh_channel_window_size(ssh_channel channel) {
  * @see ssh_channel_read()
  */
 int ssh_channel_write(ssh_channel channel, const void *data, uint32_t len) {
-  return channel_write_common(channel, data, len, 0);
+  struct ssh_iovec iov = {data, len};
+
+  if (data == NULL && channel != NULL) {
+    ssh_set_error_invalid(channel->session);
+    return -1;
+  }
+
+  return channel_write_common(channel, &iov, 1, 0, true);
+}
+
+/**
+ * @brief Blocking write on a channel of data gathered from several buffers.
+ *
+ * The buffers are written as one stream, packed into as few packets as the
+ * channel allows, so that they do not need to be copied together first.
+ *
+ * @param[in]  channel  The channel to write to.
+ *
+ * @param[in]  iov      The buffers to write.
+ *
+ * @param[in]  iovcnt   The number of buffers.
+ *
+ * @return              The number of bytes written, SSH_ERROR on error.
+ *
+ * @see ssh_channel_write()
+ */
+int ssh_channel_writev(ssh_channel channel,
+                       const struct ssh_iovec *iov,
+                       int iovcnt)
+{
+  return channel_write_common(channel, iov, iovcnt, 0, true);
+}
+
+/**
+ * @internal
+ *
+ * @brief Write on a channel as much as its window allows, without waiting.
+ *
+ * Neither the window nor the flush of the socket are waited for, so this never
+ * processes packets. It is meant for the writers driven by an event loop,
+ * which learn from the channel_write_wontblock_function callback when the
+ * window grows again.
+ *
+ * @return              The number of bytes written, which may be 0,
+ *                      SSH_ERROR on error.
+ */
+int channel_write_nowait(ssh_channel channel, const void *data, uint32_t len)
+{
+  struct ssh_iovec iov = {data, len};
+
+  return channel_write_common(channel, &iov, 1, 0, false);
+}
+
+/**
+ * @internal
+ *
+ * @brief Write on the stderr stream of a channel as much as its window
+ * allows, without waiting.
+ *
+ * @see channel_write_nowait()
+ */
+int channel_write_stderr_nowait(ssh_channel channel,
+                                const void *data,
+                                uint32_t len)
+{
+  struct ssh_iovec iov = {data, len};
+
+  return channel_write_common(channel, &iov, 1, 1, false);
 }
 
 /**
@@ -1575,26 +1880,19 @@ static int ssh_channel_request_termination(void *c){
     return 0;
 }
 
-static int channel_request(ssh_channel channel, const char *request,
+/* Send a SSH_MSG_CHANNEL_REQUEST, without waiting for its reply */
+static int channel_request_send(ssh_channel channel, const char *request,
     ssh_buffer buffer, int reply) {
   ssh_session session = channel->session;
-  int rc = SSH_ERROR;
-  int ret;
-
-  switch(channel->request_state){
-  case SSH_CHANNEL_REQ_STATE_NONE:
-    break;
-  default:
-    goto pending;
-  }
+  int rc;
 
-  ret = ssh_buffer_pack(session->out_buffer,
-                        "bdsb",
-                        SSH2_MSG_CHANNEL_REQUEST,
-                        channel->remote_channel,
-                        request,
-                        reply == 0 ? 0 : 1);
-  if (ret != SSH_OK) {
+  rc = ssh_buffer_pack(session->out_buffer,
+                       "bdsb",
+                       SSH2_MSG_CHANNEL_REQUEST,
+                       channel->remote_channel,
+                       request,
+                       reply == 0 ? 0 : 1);
+  if (rc != SSH_OK) {
     ssh_set_error_oom(session);
     goto error;
   }
@@ -1606,17 +1904,37 @@ static int channel_request(ssh_channel channel, const char *request,
       goto error;
     }
   }
-  channel->request_state = SSH_CHANNEL_REQ_STATE_PENDING;
   if (ssh_packet_send(session) == SSH_ERROR) {
-    return rc;
+    return SSH_ERROR;
   }
 
   SSH_LOG(SSH_LOG_PACKET,
       "Sent a SSH_MSG_CHANNEL_REQUEST %s", request);
-  if (reply == 0) {
-    channel->request_state = SSH_CHANNEL_REQ_STATE_NONE;
-    return SSH_OK;
+
+  return SSH_OK;
+error:
+  ssh_buffer_reinit(session->out_buffer);
+
+  return SSH_ERROR;
+}
+
+static int channel_request(ssh_channel channel, const char *request,
+    ssh_buffer buffer, int reply) {
+  ssh_session session = channel->session;
+  int rc = SSH_ERROR;
+
+  switch(channel->request_state){
+  case SSH_CHANNEL_REQ_STATE_NONE:
+    break;
+  default:
+    goto pending;
+  }
+
+  rc = channel_request_send(channel, request, buffer, reply);
+  if (rc != SSH_OK || reply == 0) {
+    return rc;
   }
+  channel->request_state = SSH_CHANNEL_REQ_STATE_PENDING;
 pending:
   rc = ssh_handle_packets_termination(session,
                                       SSH_TIMEOUT_DEFAULT,
@@ -1653,8 +1971,46 @@ pending:
   channel->request_state=SSH_CHANNEL_REQ_STATE_NONE;
 
   return rc;
-error:
-  ssh_buffer_reinit(session->out_buffer);
+}
+
+/**
+ * @internal
+ *
+ * @brief Send a channel request without waiting for its reply.
+ *
+ * When a reply is wanted, the request_state of the channel is pending until
+ * the server answers, and no other request wanting a reply may be sent in
+ * the meantime. The caller resets it to SSH_CHANNEL_REQ_STATE_NONE once it
+ * read the answer.
+ *
+ * @param[in]  channel  The channel to send the request on.
+ *
+ * @param[in]  request  The name of the request.
+ *
+ * @param[in]  buffer   The payload of the request, or NULL.
+ *
+ * @param[in]  reply    Whether the server should reply.
+ *
+ * @return              SSH_OK if the request was sent, SSH_ERROR otherwise.
+ */
+int channel_request_nowait(ssh_channel channel, const char *request,
+    ssh_buffer buffer, int reply) {
+  int rc;
+
+  if (channel == NULL) {
+      return SSH_ERROR;
+  }
+  if (reply && channel->request_state != SSH_CHANNEL_REQ_STATE_NONE) {
+    ssh_set_error(channel->session, SSH_FATAL,
+                  "A request is already pending on channel %d",
+                  channel->local_channel);
+    return SSH_ERROR;
+  }
+
+  rc = channel_request_send(channel, request, buffer, reply);
+  if (rc == SSH_OK && reply) {
+    channel->request_state = SSH_CHANNEL_REQ_STATE_PENDING;
+  }
 
   return rc;
 }
@@ -2705,6 +3061,70 @@ int ssh_channel_read(ssh_channel channel, void *dest, uint32_t count, int is_std
                                     SSH_TIMEOUT_DEFAULT);
 }
 
+/*
+ * Wait until at least one byte is buffered on the channel, it reached the end
+ * of file, or the timeout expired.
+ */
+static int channel_read_wait(ssh_channel channel,
+                             ssh_buffer stdbuf,
+                             int timeout_ms)
+{
+  ssh_session session = channel->session;
+  struct ssh_channel_read_termination_struct ctx;
+  int rc;
+
+  /* block reading until at least one byte has been read */
+  ctx.channel = channel;
+  ctx.buffer = stdbuf;
+  ctx.count = 1;
+
+  if (timeout_ms < SSH_TIMEOUT_DEFAULT) {
+      timeout_ms = SSH_TIMEOUT_INFINITE;
+  }
+
+  rc = ssh_handle_packets_termination(session,
+                                      timeout_ms,
+                                      ssh_channel_read_termination,
+                                      &ctx);
+  if (rc == SSH_ERROR){
+    return rc;
+  }
+
+  /*
+   * If the channel is closed or in an error state, reading from it is an error
+   */
+  if (session->session_state == SSH_SESSION_STATE_ERROR) {
+      return SSH_ERROR;
+  }
+  if (channel->state == SSH_CHANNEL_STATE_CLOSED) {
+      ssh_set_error(session,
+                    SSH_FATAL,
+                    "Remote channel is closed.");
+      return SSH_ERROR;
+  }
+
+  return SSH_OK;
+}
+
+/* Drop what the application read from the buffer, and grow the window */
+static int channel_read_consume(ssh_channel channel,
+                                ssh_buffer stdbuf,
+                                uint32_t len)
+{
+  ssh_buffer_pass_bytes(stdbuf, len);
+  if (channel->counter != NULL) {
+      channel->counter->in_bytes += len;
+  }
+  /* Authorize some buffering while userapp is busy */
+  if (channel->local_window < WINDOWLIMIT) {
+    if (grow_window(channel->session, channel, 0) < 0) {
+      return -1;
+    }
+  }
+
+  return SSH_OK;
+}
+
 /**
  * @brief Reads data from a channel.
  *
@@ -2737,7 +3157,6 @@ int ssh_channel_read_timeout(ssh_channel channel,
   ssh_session session;
   ssh_buffer stdbuf;
   uint32_t len;
-  struct ssh_channel_read_termination_struct ctx;
   int rc;
 
   if(channel == NULL) {
@@ -2775,56 +3194,117 @@ int ssh_channel_read_timeout(ssh_channel channel,
     }
   }
 
-  /* block reading until at least one byte has been read
-  *  and ignore the trivial case count=0
-  */
-  ctx.channel = channel;
-  ctx.buffer = stdbuf;
-  ctx.count = 1;
-
-  if (timeout_ms < SSH_TIMEOUT_DEFAULT) {
-      timeout_ms = SSH_TIMEOUT_INFINITE;
+  rc = channel_read_wait(channel, stdbuf, timeout_ms);
+  if (rc == SSH_ERROR) {
+    return rc;
   }
+  if (channel->remote_eof && ssh_buffer_get_len(stdbuf) == 0) {
+    return 0;
+  }
+  len = ssh_buffer_get_len(stdbuf);
+  /* Read count bytes if len is greater, everything otherwise */
+  len = (len > count ? count : len);
+  memcpy(dest, ssh_buffer_get(stdbuf), len);
 
-  rc = ssh_handle_packets_termination(session,
-                                      timeout_ms,
-                                      ssh_channel_read_termination,
-                                      &ctx);
-  if (rc == SSH_ERROR){
+  rc = channel_read_consume(channel, stdbuf, len);
+  if (rc < 0) {
     return rc;
   }
 
-  /*
-   * If the channel is closed or in an error state, reading from it is an error
-   */
-  if (session->session_state == SSH_SESSION_STATE_ERROR) {
+  return len;
+}
+
+/**
+ * @brief Lend the data buffered on a channel, waiting for some to arrive.
+ *
+ * This is a read without copy: the data stays in the buffer of the channel
+ * until ssh_channel_consume() is called, and the window of the channel does
+ * not grow until then.
+ *
+ * @param[in]  channel    The channel to read from.
+ *
+ * @param[out] data       Set to the buffered data. It stays valid until
+ *                        ssh_channel_consume() is called, or any function
+ *                        processing the packets of the session.
+ *
+ * @param[in]  is_stderr  A boolean value to mark reading from the stderr
+ *                        stream.
+ *
+ * @param[in]  timeout_ms A timeout in milliseconds. A value of -1 means
+ *                        infinite timeout.
+ *
+ * @return              The number of bytes available, 0 on end of file or
+ *                      if nothing arrived in nonblocking mode or before the
+ *                      timeout, SSH_ERROR on error.
+ *
+ * @see ssh_channel_consume()
+ * @see ssh_channel_read_timeout()
+ */
+int ssh_channel_peek_timeout(ssh_channel channel,
+                             const void **data,
+                             int is_stderr,
+                             int timeout_ms)
+{
+  ssh_buffer stdbuf;
+  uint32_t len;
+  int rc;
+
+  if (channel == NULL) {
       return SSH_ERROR;
   }
-  if (channel->state == SSH_CHANNEL_STATE_CLOSED) {
-      ssh_set_error(session,
-                    SSH_FATAL,
-                    "Remote channel is closed.");
+  if (data == NULL) {
+      ssh_set_error_invalid(channel->session);
       return SSH_ERROR;
   }
-  if (channel->remote_eof && ssh_buffer_get_len(stdbuf) == 0) {
-    return 0;
+  *data = NULL;
+
+  stdbuf = is_stderr ? channel->stderr_buffer : channel->stdout_buffer;
+
+  rc = channel_read_wait(channel, stdbuf, timeout_ms);
+  if (rc == SSH_ERROR) {
+    return rc;
   }
+
   len = ssh_buffer_get_len(stdbuf);
-  /* Read count bytes if len is greater, everything otherwise */
-  len = (len > count ? count : len);
-  memcpy(dest, ssh_buffer_get(stdbuf), len);
-  ssh_buffer_pass_bytes(stdbuf,len);
-  if (channel->counter != NULL) {
-      channel->counter->in_bytes += len;
+  if (len == 0) {
+    return 0;
   }
-  /* Authorize some buffering while userapp is busy */
-  if (channel->local_window < WINDOWLIMIT) {
-    if (grow_window(session, channel, 0) < 0) {
-      return -1;
-    }
+  *data = ssh_buffer_get(stdbuf);
+
+  return len > INT_MAX ? INT_MAX : (int)len;
+}
+
+/**
+ * @brief Remove data lent by ssh_channel_peek_timeout() from the buffer of a
+ * channel.
+ *
+ * @param[in]  channel    The channel the data was read from.
+ *
+ * @param[in]  len        The number of bytes to consume, at most what was
+ *                        lent.
+ *
+ * @param[in]  is_stderr  A boolean value to mark reading from the stderr
+ *                        stream.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see ssh_channel_peek_timeout()
+ */
+int ssh_channel_consume(ssh_channel channel, uint32_t len, int is_stderr)
+{
+  ssh_buffer stdbuf;
+
+  if (channel == NULL) {
+      return SSH_ERROR;
   }
 
-  return len;
+  stdbuf = is_stderr ? channel->stderr_buffer : channel->stdout_buffer;
+  if (len > ssh_buffer_get_len(stdbuf)) {
+      ssh_set_error_invalid(channel->session);
+      return SSH_ERROR;
+  }
+
+  return channel_read_consume(channel, stdbuf, len);
 }
 
 /**
@@ -3287,7 +3767,35 @@ void ssh_channel_set_counter(ssh_channel channel,
  * @see ssh_channel_read()
  */
 int ssh_channel_write_stderr(ssh_channel channel, const void *data, uint32_t len) {
-  return channel_write_common(channel, data, len, 1);
+  struct ssh_iovec iov = {data, len};
+
+  if (data == NULL && channel != NULL) {
+    ssh_set_error_invalid(channel->session);
+    return -1;
+  }
+
+  return channel_write_common(channel, &iov, 1, 1, true);
+}
+
+/**
+ * @brief Blocking write on a channel stderr of data gathered from several
+ * buffers.
+ *
+ * @param[in]  channel  The channel to write to.
+ *
+ * @param[in]  iov      The buffers to write.
+ *
+ * @param[in]  iovcnt   The number of buffers.
+ *
+ * @return              The number of bytes written, SSH_ERROR on error.
+ *
+ * @see ssh_channel_writev()
+ */
+int ssh_channel_writev_stderr(ssh_channel channel,
+                              const struct ssh_iovec *iov,
+                              int iovcnt)
+{
+  return channel_write_common(channel, iov, iovcnt, 1, true);
 }
 
 #if WITH_SERVER
@@ -37,6 +37,7 @@
 #include "libssh/options.h"
 #include "libssh/socket.h"
 #include "libssh/session.h"
+#include "libssh/forwarder.h"
 #include "libssh/dh.h"
 #ifdef WITH_GEX
 #include "libssh/dh-gex.h"
@@ -381,7 +382,7 @@ pending:
  * @brief A function to be called each time a step has been done in the
  * connection.
  */
-static void ssh_client_connection_callback(ssh_session session)
+void ssh_client_connection_callback(ssh_session session)
 {
     int rc;
 
@@ -495,6 +496,10 @@ static int ssh_connect_termination(void *user){
 /**
  * @brief Connect to the ssh server.
  *
+ * When SSH_OPTIONS_CONTROL_PATH is set and a forwarder of the same user
+ * listens on it, the session goes through the session of the forwarder
+ * instead of connecting to the server.
+ *
  * @param[in]  session  The ssh session to connect.
  *
  * @returns             SSH_OK on success, SSH_ERROR on error.
@@ -505,6 +510,7 @@ static int ssh_connect_termination(void *user){
  * @see ssh_disconnect()
  */
 int ssh_connect(ssh_session session) {
+  socket_t fd = SSH_INVALID_SOCKET;
   int ret;
 
   if (session == NULL) {
@@ -526,7 +532,8 @@ int ssh_connect(ssh_session session) {
 
   if (session->opts.fd == SSH_INVALID_SOCKET &&
       session->opts.host == NULL &&
-      session->opts.ProxyCommand == NULL) {
+      session->opts.ProxyCommand == NULL &&
+      session->opts.control_path == NULL) {
     ssh_set_error(session, SSH_FATAL, "Hostname required");
     return SSH_ERROR;
   }
@@ -559,7 +566,29 @@ int ssh_connect(ssh_session session) {
   session->socket_callbacks.data=callback_receive_banner;
   session->socket_callbacks.exception=ssh_socket_exception_callback;
   session->socket_callbacks.userdata=session;
-  if (session->opts.fd != SSH_INVALID_SOCKET) {
+  session->flags &= ~SSH_SESSION_FLAG_CONTROL;
+  if (session->opts.fd == SSH_INVALID_SOCKET &&
+      session->opts.control_path != NULL) {
+    /* through the session of a forwarder when one is listening there */
+    fd = ssh_forwarder_control_open(session->opts.control_path);
+    if (fd != SSH_INVALID_SOCKET) {
+      SSH_LOG(SSH_LOG_PROTOCOL,
+              "Connected through the control socket %s",
+              session->opts.control_path);
+      session->flags |= SSH_SESSION_FLAG_CONTROL;
+    } else if (session->opts.host == NULL &&
+               session->opts.ProxyCommand == NULL) {
+      ssh_set_error(session, SSH_FATAL,
+                    "Connecting to the control socket %s failed",
+                    session->opts.control_path);
+      return SSH_ERROR;
+    }
+  }
+  if (session->flags & SSH_SESSION_FLAG_CONTROL) {
+    session->session_state=SSH_SESSION_STATE_SOCKET_CONNECTED;
+    ssh_socket_set_fd(session->socket, fd);
+    ret=SSH_OK;
+  } else if (session->opts.fd != SSH_INVALID_SOCKET) {
     session->session_state=SSH_SESSION_STATE_SOCKET_CONNECTED;
     ssh_socket_set_fd(session->socket, session->opts.fd);
     ret=SSH_OK;
@@ -34,6 +34,7 @@
 #include "libssh/ssh2.h"
 #include "libssh/pki.h"
 #include "libssh/bignum.h"
+#include "libssh/threads.h"
 
 static unsigned char p_group1_value[] = {
         0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xC9, 0x0F, 0xDA, 0xA2,
@@ -226,6 +227,253 @@ static bignum p_group16;
 static bignum p_group18;
 static int dh_crypto_initialized;
 
+#ifdef HAVE_LIBCRYPTO
+/*
+ * Fixed-base exponentiation for the built-in groups with a Lim-Lee comb.
+ * The exponent is read as DH_COMB_TEETH rows of DH_COMB_SPACING bits, and the
+ * products of g^(2^(DH_COMB_SPACING * k)) for all the combinations of rows
+ * are precomputed in Montgomery form. g^x then costs DH_COMB_SPACING
+ * squarings and as many multiplications, instead of one squaring per bit of
+ * x. The secrets are generated smaller than DH_SECURITY_BITS * 2 bits.
+ *
+ * The entries are indexed by bits of the secret, so each one is gathered by
+ * reading the whole table with masks, as BN_mod_exp_mont_consttime() does,
+ * and every column is multiplied in, even with the entry of 1.
+ */
+#define DH_COMB_TEETH 5
+#define DH_COMB_SPACING \
+    ((DH_SECURITY_BITS * 2 + DH_COMB_TEETH - 1) / DH_COMB_TEETH)
+#define DH_COMB_ENTRIES (1 << DH_COMB_TEETH)
+
+struct dh_fixed_base {
+    bignum *p;
+    BN_MONT_CTX *mont;
+    /* the entries, big endian, of entry_len bytes each */
+    uint64_t *table;
+    size_t entry_len;
+};
+
+/* The tables are built on first use, group18 takes a while */
+static struct dh_fixed_base dh_fixed_bases[] = {
+    { .p = &p_group14 },
+    { .p = &p_group16 },
+    { .p = &p_group18 },
+};
+static SSH_MUTEX dh_fixed_base_mutex = SSH_MUTEX_STATIC_INIT;
+
+#define DH_FIXED_BASES_COUNT \
+    (sizeof(dh_fixed_bases) / sizeof(dh_fixed_bases[0]))
+
+static void dh_fixed_base_free(struct dh_fixed_base *fb)
+{
+    SAFE_FREE(fb->table);
+    if (fb->mont != NULL) {
+        BN_MONT_CTX_free(fb->mont);
+        fb->mont = NULL;
+    }
+}
+
+static int dh_fixed_base_build(struct dh_fixed_base *fb, bignum_CTX ctx)
+{
+    BN_MONT_CTX *mont = NULL;
+    bignum table[DH_COMB_ENTRIES] = {0};
+    uint64_t *flat = NULL;
+    unsigned char *entry = NULL;
+    size_t entry_len;
+    size_t high;
+    size_t i;
+    int rc;
+
+    mont = BN_MONT_CTX_new();
+    if (mont == NULL) {
+        return SSH_ERROR;
+    }
+    rc = BN_MONT_CTX_set(mont, *fb->p, ctx);
+    if (rc != 1) {
+        goto error;
+    }
+
+    for (i = 0; i < DH_COMB_ENTRIES; i++) {
+        table[i] = bignum_new();
+        if (table[i] == NULL) {
+            goto error;
+        }
+    }
+
+    /* table[0] is 1 and table[1 << k] is g^(2^(DH_COMB_SPACING * k)) */
+    rc = BN_to_montgomery(table[0], BN_value_one(), mont, ctx);
+    if (rc != 1) {
+        goto error;
+    }
+    rc = BN_to_montgomery(table[1], g, mont, ctx);
+    if (rc != 1) {
+        goto error;
+    }
+    for (high = 2; high < DH_COMB_ENTRIES; high <<= 1) {
+        if (BN_copy(table[high], table[high >> 1]) == NULL) {
+            goto error;
+        }
+        for (i = 0; i < DH_COMB_SPACING; i++) {
+            rc = BN_mod_mul_montgomery(table[high], table[high], table[high],
+                                       mont, ctx);
+            if (rc != 1) {
+                goto error;
+            }
+        }
+    }
+
+    /* the other entries are products of those */
+    high = 1;
+    for (i = 3; i < DH_COMB_ENTRIES; i++) {
+        if ((i & (i - 1)) == 0) {
+            high = i;
+            continue;
+        }
+        rc = BN_mod_mul_montgomery(table[i], table[i ^ high], table[high],
+                                   mont, ctx);
+        if (rc != 1) {
+            goto error;
+        }
+    }
+
+    /* laid out flat, whole words per entry for the gathering */
+    entry_len = (BN_num_bytes(*fb->p) + 7) & ~(size_t)7;
+    flat = calloc(DH_COMB_ENTRIES, entry_len);
+    if (flat == NULL) {
+        goto error;
+    }
+    for (i = 0; i < DH_COMB_ENTRIES; i++) {
+        entry = (unsigned char *)flat + i * entry_len;
+        BN_bn2bin(table[i], entry + entry_len - BN_num_bytes(table[i]));
+        bignum_safe_free(table[i]);
+    }
+
+    fb->mont = mont;
+    fb->table = flat;
+    fb->entry_len = entry_len;
+
+    return SSH_OK;
+error:
+    BN_MONT_CTX_free(mont);
+    for (i = 0; i < DH_COMB_ENTRIES; i++) {
+        bignum_safe_free(table[i]);
+    }
+    return SSH_ERROR;
+}
+
+/* Get the precomputed values of a built-in group, NULL if there are none */
+static struct dh_fixed_base *dh_fixed_base_get(bignum p, bignum_CTX ctx)
+{
+    struct dh_fixed_base *fb = NULL;
+    size_t i;
+    int rc;
+
+    for (i = 0; i < DH_FIXED_BASES_COUNT; i++) {
+        if (*dh_fixed_bases[i].p == p) {
+            fb = &dh_fixed_bases[i];
+            break;
+        }
+    }
+    if (fb == NULL) {
+        return NULL;
+    }
+
+    ssh_mutex_lock(&dh_fixed_base_mutex);
+    if (fb->mont == NULL) {
+        rc = dh_fixed_base_build(fb, ctx);
+        if (rc != SSH_OK) {
+            fb = NULL;
+        }
+    }
+    ssh_mutex_unlock(&dh_fixed_base_mutex);
+
+    return fb;
+}
+
+/* Copy the entry idx of the table to out, reading all of them alike */
+static void dh_fixed_base_gather(const struct dh_fixed_base *fb,
+                                 unsigned int idx,
+                                 uint64_t *out)
+{
+    size_t words = fb->entry_len / sizeof(uint64_t);
+    const uint64_t *entry = fb->table;
+    uint64_t mask;
+    unsigned int i;
+    size_t w;
+
+    memset(out, 0, fb->entry_len);
+    for (i = 0; i < DH_COMB_ENTRIES; i++, entry += words) {
+        /* all ones when i == idx, 0 otherwise */
+        mask = (uint64_t)0 - (uint64_t)(((i ^ idx) - 1) >> 31 & 1);
+        for (w = 0; w < words; w++) {
+            out[w] |= entry[w] & mask;
+        }
+    }
+}
+
+static int dh_fixed_base_exp(struct dh_fixed_base *fb,
+                             bignum dest,
+                             bignum exp,
+                             bignum_CTX ctx)
+{
+    uint64_t *entry = NULL;
+    bignum r = NULL;
+    bignum t = NULL;
+    unsigned int idx;
+    int col;
+    int k;
+    int rc = 0;
+
+    entry = malloc(fb->entry_len);
+    r = bignum_new();
+    t = bignum_new();
+    if (entry == NULL || r == NULL || t == NULL) {
+        goto out;
+    }
+    BN_set_flags(r, BN_FLG_CONSTTIME);
+    BN_set_flags(t, BN_FLG_CONSTTIME);
+
+    dh_fixed_base_gather(fb, 0, entry);
+    if (BN_bin2bn((unsigned char *)entry, fb->entry_len, r) == NULL) {
+        goto out;
+    }
+
+    rc = 1;
+    for (col = DH_COMB_SPACING - 1; col >= 0 && rc == 1; col--) {
+        rc = BN_mod_mul_montgomery(r, r, r, fb->mont, ctx);
+        if (rc != 1) {
+            break;
+        }
+
+        idx = 0;
+        for (k = 0; k < DH_COMB_TEETH; k++) {
+            idx |= (unsigned int)bignum_is_bit_set(exp,
+                                                   k * DH_COMB_SPACING + col)
+                   << k;
+        }
+        dh_fixed_base_gather(fb, idx, entry);
+        if (BN_bin2bn((unsigned char *)entry, fb->entry_len, t) == NULL) {
+            rc = 0;
+            break;
+        }
+        rc = BN_mod_mul_montgomery(r, r, t, fb->mont, ctx);
+    }
+    if (rc == 1) {
+        rc = BN_from_montgomery(dest, r, fb->mont, ctx);
+    }
+
+out:
+    if (entry != NULL) {
+        explicit_bzero(entry, fb->entry_len);
+    }
+    SAFE_FREE(entry);
+    bignum_safe_free(r);
+    bignum_safe_free(t);
+
+    return rc;
+}
+#endif /* HAVE_LIBCRYPTO */
+
 /**
  * @internal
  * @brief Initialize global constants used in DH key agreement
@@ -307,6 +555,16 @@ void ssh_dh_finalize(void)
     bignum_safe_free(p_group16);
     bignum_safe_free(p_group18);
 
+#ifdef HAVE_LIBCRYPTO
+    {
+        size_t i;
+
+        for (i = 0; i < DH_FIXED_BASES_COUNT; i++) {
+            dh_fixed_base_free(&dh_fixed_bases[i]);
+        }
+    }
+#endif /* HAVE_LIBCRYPTO */
+
     dh_crypto_initialized = 0;
 }
 
@@ -445,8 +703,50 @@ error:
     return SSH_ERROR;
 }
 
+/** @internal
+ * @brief Compute the public value g^secret mod p of the key exchange, with
+ *        the precomputed tables of the group when there are some.
+ * @param[out] dest preallocated bignum where to store the value
+ * @return SSH_OK on success, SSH_ERROR on error
+ */
+int ssh_dh_compute_pubkey(struct ssh_crypto_struct *crypto,
+                          bignum secret,
+                          bignum dest)
+{
+    bignum_CTX ctx = bignum_ctx_new();
+#ifdef HAVE_LIBCRYPTO
+    struct dh_fixed_base *fb = NULL;
+#endif
+    int rc;
+
+    if (bignum_ctx_invalid(ctx)) {
+        return SSH_ERROR;
+    }
+
+#ifdef HAVE_LIBCRYPTO
+    if (!crypto->dh_group_is_mutable && crypto->g == g &&
+        bignum_num_bits(secret) <= DH_COMB_TEETH * DH_COMB_SPACING) {
+        fb = dh_fixed_base_get(crypto->p, ctx);
+    }
+    if (fb != NULL) {
+        rc = dh_fixed_base_exp(fb, dest, secret, ctx);
+    } else
+#endif /* HAVE_LIBCRYPTO */
+    rc = bignum_mod_exp(dest, crypto->g, secret, crypto->p, ctx);
+
+    bignum_ctx_free(ctx);
+    if (rc != 1) {
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
 int ssh_dh_build_k(ssh_session session)
 {
+    struct ssh_crypto_struct *crypto = session->next_crypto;
+    bignum pubkey;
+    bignum secret;
     int rc;
     bignum_CTX ctx = bignum_ctx_new();
     if (bignum_ctx_invalid(ctx)) {
@@ -455,19 +755,31 @@ int ssh_dh_build_k(ssh_session session)
 
     /* the server and clients don't use the same numbers */
     if (session->client) {
-        rc = bignum_mod_exp(session->next_crypto->k,
-                            session->next_crypto->f,
-                            session->next_crypto->x,
-                            session->next_crypto->p,
-                            ctx);
+        pubkey = crypto->f;
+        secret = crypto->x;
     } else {
-        rc = bignum_mod_exp(session->next_crypto->k,
-                            session->next_crypto->e,
-                            session->next_crypto->y,
-                            session->next_crypto->p,
-                            ctx);
+        pubkey = crypto->e;
+        secret = crypto->y;
     }
 
+#ifdef HAVE_LIBCRYPTO
+    /* at least reuse the Montgomery context of the group */
+    if (!crypto->dh_group_is_mutable) {
+        struct dh_fixed_base *fb = dh_fixed_base_get(crypto->p, ctx);
+
+        if (fb != NULL) {
+            rc = BN_mod_exp_mont(crypto->k, pubkey, secret, crypto->p,
+                                 ctx, fb->mont);
+            goto done;
+        }
+    }
+#endif /* HAVE_LIBCRYPTO */
+    rc = bignum_mod_exp(crypto->k, pubkey, secret, crypto->p, ctx);
+
+#ifdef HAVE_LIBCRYPTO
+done:
+#endif
+
     bignum_ctx_free(ctx);
     ssh_dh_debug(session);
     if (rc != 1) {
@@ -493,12 +805,8 @@ static struct ssh_packet_callbacks_struct ssh_dh_client_callbacks = {
  * @brief Starts diffie-hellman-group1 key exchange
  */
 int ssh_client_dh_init(ssh_session session){
-  bignum_CTX ctx = bignum_ctx_new();
   int rc;
 
-  if (bignum_ctx_invalid(ctx)) {
-    goto error;
-  }
   rc = ssh_dh_init_common(session);
   if (rc == SSH_ERROR) {
     goto error;
@@ -512,11 +820,10 @@ int ssh_client_dh_init(ssh_session session){
   if (session->next_crypto->e == NULL){
       goto error;
   }
-  rc = bignum_mod_exp(session->next_crypto->e, session->next_crypto->g, session->next_crypto->x,
-      session->next_crypto->p, ctx);
-
-  bignum_ctx_free(ctx);
-  if (rc != 1) {
+  rc = ssh_dh_compute_pubkey(session->next_crypto,
+                             session->next_crypto->x,
+                             session->next_crypto->e);
+  if (rc != SSH_OK) {
     goto error;
   }
   rc = ssh_buffer_pack(session->out_buffer, "bB", SSH2_MSG_KEXDH_INIT, session->next_crypto->e);
@@ -637,13 +944,12 @@ int ssh_server_dh_process_init(ssh_session session, ssh_buffer packet)
     if (session->next_crypto->f == NULL){
         goto error;
     }
-    rc = bignum_mod_exp(session->next_crypto->f,
-                        session->next_crypto->g,
-                        session->next_crypto->y,
-                        session->next_crypto->p, ctx);
+    rc = ssh_dh_compute_pubkey(session->next_crypto,
+                               session->next_crypto->y,
+                               session->next_crypto->f);
     bignum_ctx_free(ctx);
     ctx = NULL;
-    if (rc != 1) {
+    if (rc != SSH_OK) {
         goto error;
     }
 
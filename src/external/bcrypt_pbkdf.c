@@ -24,7 +24,14 @@
 #include "libssh/priv.h"
 #include "libssh/wrapper.h"
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef HAVE_SYS_PARAM_H
 #include <sys/param.h>
 #endif
@@ -48,7 +55,8 @@
  *    expansion. (More rounds are performed by iterating the hash.)
  *
  * Note that this implementation pulls the SHA512 operations into the caller
- * as a performance optimization.
+ * as a performance optimization, and computes the blocks of output key
+ * material in parallel.
  *
  * One modification from official pbkdf2. Instead of outputting key material
  * linearly, we mix it. pbkdf2 has a known weakness where if one uses it to
@@ -62,24 +70,29 @@
 #define BCRYPT_BLOCKS 8
 #define BCRYPT_HASHSIZE (BCRYPT_BLOCKS * 4)
 
+/* Upper bound of threads computing the output blocks of one call */
+#define BCRYPT_MAX_THREADS 8
+
 static void
-bcrypt_hash(uint8_t *sha2pass, uint8_t *sha2salt, uint8_t *out)
+bcrypt_hash_start(ssh_blf_ctx *state, uint32_t *saltwords,
+    const uint8_t *sha2pass, const uint8_t *sha2salt)
+{
+	uint16_t shalen = SHA512_DIGEST_LENGTH;
+
+	/* the keys are converted to words only once for all the rounds */
+	Blowfish_stream2words(sha2salt, shalen, saltwords, BLF_N + 2);
+	Blowfish_initstate(state);
+	Blowfish_expandstate(state, sha2salt, shalen, sha2pass, shalen);
+}
+
+static void
+bcrypt_hash_finish(ssh_blf_ctx *state, uint8_t *out)
 {
-	ssh_blf_ctx state;
 	uint8_t ciphertext[BCRYPT_HASHSIZE] =
 	    "OxychromaticBlowfishSwatDynamite";
 	uint32_t cdata[BCRYPT_BLOCKS];
 	int i;
 	uint16_t j;
-	uint16_t shalen = SHA512_DIGEST_LENGTH;
-
-	/* key expansion */
-	Blowfish_initstate(&state);
-	Blowfish_expandstate(&state, sha2salt, shalen, sha2pass, shalen);
-	for (i = 0; i < 64; i++) {
-		Blowfish_expand0state(&state, sha2salt, shalen);
-		Blowfish_expand0state(&state, sha2pass, shalen);
-	}
 
 	/* encryption */
 	j = 0;
@@ -87,7 +100,7 @@ bcrypt_hash(uint8_t *sha2pass, uint8_t *sha2salt, uint8_t *out)
 		cdata[i] = Blowfish_stream2word(ciphertext, sizeof(ciphertext),
 		    &j);
 	for (i = 0; i < 64; i++)
-		ssh_blf_enc(&state, cdata, sizeof(cdata) / sizeof(uint64_t));
+		ssh_blf_enc(state, cdata, sizeof(cdata) / sizeof(uint64_t));
 
 	/* copy out */
 	for (i = 0; i < BCRYPT_BLOCKS; i++) {
@@ -100,84 +113,324 @@ bcrypt_hash(uint8_t *sha2pass, uint8_t *sha2salt, uint8_t *out)
 	/* zap */
 	explicit_bzero(ciphertext, sizeof(ciphertext));
 	explicit_bzero(cdata, sizeof(cdata));
-	ZERO_STRUCT(state);
+	ZERO_STRUCTP(state);
+}
+
+static void
+bcrypt_hash(const uint32_t *passwords, const uint8_t *sha2pass,
+    const uint8_t *sha2salt, uint8_t *out)
+{
+	ssh_blf_ctx state;
+	uint32_t saltwords[BLF_N + 2];
+	int i;
+
+	/* key expansion */
+	bcrypt_hash_start(&state, saltwords, sha2pass, sha2salt);
+	for (i = 0; i < 64; i++) {
+		Blowfish_expand0state_words(&state, saltwords);
+		Blowfish_expand0state_words(&state, passwords);
+	}
+
+	bcrypt_hash_finish(&state, out);
+	explicit_bzero(saltwords, sizeof(saltwords));
+}
+
+/* Two bcrypt_hash() of the same password, interleaved */
+static void
+bcrypt_hash2(const uint32_t *passwords, const uint8_t *sha2pass,
+    const uint8_t *sha2salt1, uint8_t *out1,
+    const uint8_t *sha2salt2, uint8_t *out2)
+{
+	ssh_blf_ctx state[2];
+	uint32_t saltwords[2][BLF_N + 2];
+	int i;
+
+	/* key expansion */
+	bcrypt_hash_start(&state[0], saltwords[0], sha2pass, sha2salt1);
+	bcrypt_hash_start(&state[1], saltwords[1], sha2pass, sha2salt2);
+	for (i = 0; i < 64; i++) {
+		Blowfish_expand0state_words2(&state[0], saltwords[0],
+		    &state[1], saltwords[1]);
+		Blowfish_expand0state_words2(&state[0], passwords,
+		    &state[1], passwords);
+	}
+
+	bcrypt_hash_finish(&state[0], out1);
+	bcrypt_hash_finish(&state[1], out2);
+	explicit_bzero(saltwords, sizeof(saltwords));
+}
+
+/*
+ * The blocks of output key material only share the password, each one is
+ * an independent chain of rounds. They are spread over threads and, when
+ * there are fewer CPUs than blocks, computed two at a time by each thread
+ * to hide the latency of Blowfish.
+ */
+struct bcrypt_pbkdf_job {
+	const uint8_t *sha2pass;
+	const uint8_t *salt;
+	size_t saltlen;
+	unsigned int rounds;
+	/* groups of lanes blocks first, first + step, ... below nblocks */
+	uint32_t first;
+	uint32_t step;
+	int lanes;
+	uint32_t nblocks;
+	/* nblocks * BCRYPT_HASHSIZE bytes */
+	uint8_t *out;
+	int rc;
+};
+
+static int
+bcrypt_pbkdf_salt(const uint8_t *salt, size_t saltlen, uint32_t count,
+    uint8_t *sha2salt)
+{
+	uint8_t countbytes[4];
+	SHA512CTX ctx;
+
+	countbytes[0] = (count >> 24) & 0xff;
+	countbytes[1] = (count >> 16) & 0xff;
+	countbytes[2] = (count >> 8) & 0xff;
+	countbytes[3] = count & 0xff;
+
+	ctx = sha512_init();
+	if (ctx == NULL)
+		return -1;
+	sha512_update(ctx, salt, saltlen);
+	sha512_update(ctx, countbytes, sizeof(countbytes));
+	sha512_final(sha2salt, ctx);
+
+	return 0;
+}
+
+/* Output blocks count and, if nlanes is 2, count + 1 */
+static int
+bcrypt_pbkdf_blocks(const uint8_t *sha2pass, const uint32_t *passwords,
+    const uint8_t *salt, size_t saltlen, uint32_t count, int nlanes,
+    unsigned int rounds, uint8_t *out)
+{
+	uint8_t sha2salt[2][SHA512_DIGEST_LENGTH];
+	uint8_t tmpout[2][BCRYPT_HASHSIZE];
+	unsigned int i;
+	size_t j;
+	int l;
+	int rc = -1;
+
+	/* first round, salt is salt */
+	for (l = 0; l < nlanes; l++) {
+		if (bcrypt_pbkdf_salt(salt, saltlen, count + l,
+		    sha2salt[l]) < 0)
+			goto out;
+	}
+
+	for (i = 0; i < rounds; i++) {
+		if (i > 0) {
+			/* subsequent rounds, salt is previous output */
+			for (l = 0; l < nlanes; l++) {
+				SHA512CTX ctx = sha512_init();
+
+				if (ctx == NULL)
+					goto out;
+				sha512_update(ctx, tmpout[l],
+				    sizeof(tmpout[l]));
+				sha512_final(sha2salt[l], ctx);
+			}
+		}
+
+		if (nlanes == 2) {
+			bcrypt_hash2(passwords, sha2pass,
+			    sha2salt[0], tmpout[0],
+			    sha2salt[1], tmpout[1]);
+		} else {
+			bcrypt_hash(passwords, sha2pass,
+			    sha2salt[0], tmpout[0]);
+		}
+
+		for (l = 0; l < nlanes; l++) {
+			uint8_t *dest = out + l * BCRYPT_HASHSIZE;
+
+			if (i == 0) {
+				memcpy(dest, tmpout[l], BCRYPT_HASHSIZE);
+				continue;
+			}
+			for (j = 0; j < BCRYPT_HASHSIZE; j++)
+				dest[j] ^= tmpout[l][j];
+		}
+	}
+	rc = 0;
+
+out:
+	explicit_bzero(sha2salt, sizeof(sha2salt));
+	explicit_bzero(tmpout, sizeof(tmpout));
+
+	return rc;
+}
+
+static void *
+bcrypt_pbkdf_worker(void *arg)
+{
+	struct bcrypt_pbkdf_job *job = arg;
+	uint32_t passwords[BLF_N + 2];
+	uint32_t b;
+
+	Blowfish_stream2words(job->sha2pass, SHA512_DIGEST_LENGTH,
+	    passwords, BLF_N + 2);
+
+	job->rc = 0;
+	for (b = job->lanes * job->first; b < job->nblocks;
+	    b += job->lanes * job->step) {
+		job->rc = bcrypt_pbkdf_blocks(job->sha2pass, passwords,
+		    job->salt, job->saltlen, b + 1,
+		    MIN(job->lanes, (int)(job->nblocks - b)), job->rounds,
+		    job->out + b * BCRYPT_HASHSIZE);
+		if (job->rc < 0)
+			break;
+	}
+
+	explicit_bzero(passwords, sizeof(passwords));
+
+	return NULL;
+}
+
+static int
+bcrypt_pbkdf_nthreads(uint32_t nblocks, int *lanes)
+{
+	long ncpu = 1;
+
+#ifdef HAVE_PTHREAD
+#ifdef _SC_NPROCESSORS_ONLN
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (ncpu < 1)
+		ncpu = 1;
+	ncpu = MIN(ncpu, BCRYPT_MAX_THREADS);
+#endif /* HAVE_PTHREAD */
+
+	if (ncpu >= (long)nblocks) {
+		*lanes = 1;
+		return (int)nblocks;
+	}
+	*lanes = 2;
+
+	return (int)MIN((long)(nblocks + 1) / 2, ncpu);
+}
+
+static int
+bcrypt_pbkdf_run(struct bcrypt_pbkdf_job *template, uint8_t *out)
+{
+	struct bcrypt_pbkdf_job jobs[BCRYPT_MAX_THREADS];
+#ifdef HAVE_PTHREAD
+	pthread_t threads[BCRYPT_MAX_THREADS];
+	int started[BCRYPT_MAX_THREADS] = {0};
+#endif
+	int nthreads;
+	int lanes;
+	int t;
+	int rc = 0;
+
+	nthreads = bcrypt_pbkdf_nthreads(template->nblocks, &lanes);
+	for (t = 0; t < nthreads; t++) {
+		jobs[t] = *template;
+		jobs[t].first = t;
+		jobs[t].step = nthreads;
+		jobs[t].lanes = lanes;
+		jobs[t].out = out;
+	}
+
+#ifdef HAVE_PTHREAD
+	/* the calling thread takes the first share */
+	for (t = 1; t < nthreads; t++) {
+		if (pthread_create(&threads[t], NULL, bcrypt_pbkdf_worker,
+		    &jobs[t]) == 0) {
+			started[t] = 1;
+		}
+	}
+#endif
+	bcrypt_pbkdf_worker(&jobs[0]);
+	rc = jobs[0].rc;
+
+	for (t = 1; t < nthreads; t++) {
+#ifdef HAVE_PTHREAD
+		if (started[t]) {
+			pthread_join(threads[t], NULL);
+		} else
+#endif
+		{
+			/* could not start it, do its share here */
+			bcrypt_pbkdf_worker(&jobs[t]);
+		}
+		if (jobs[t].rc < 0)
+			rc = -1;
+	}
+
+	return rc;
 }
 
 int
 bcrypt_pbkdf(const char *pass, size_t passlen, const uint8_t *salt, size_t saltlen,
     uint8_t *key, size_t keylen, unsigned int rounds)
 {
+	struct bcrypt_pbkdf_job job;
 	uint8_t sha2pass[SHA512_DIGEST_LENGTH];
-	uint8_t sha2salt[SHA512_DIGEST_LENGTH];
-	uint8_t out[BCRYPT_HASHSIZE];
-	uint8_t tmpout[BCRYPT_HASHSIZE];
-	uint8_t *countsalt;
-	size_t i, j, amt, stride;
+	uint8_t *out;
+	size_t i, amt, stride;
 	uint32_t count;
-	size_t origkeylen = keylen;
 	SHA512CTX ctx;
+	int rc;
 
 	/* nothing crazy */
 	if (rounds < 1)
 		return -1;
 	if (passlen == 0 || saltlen == 0 || keylen == 0 ||
-	    keylen > sizeof(out) * sizeof(out) || saltlen > 1<<20)
+	    keylen > BCRYPT_HASHSIZE * BCRYPT_HASHSIZE || saltlen > 1<<20)
 		return -1;
-	if ((countsalt = calloc(1, saltlen + 4)) == NULL)
-		return -1;
-	stride = (keylen + sizeof(out) - 1) / sizeof(out);
+	stride = (keylen + BCRYPT_HASHSIZE - 1) / BCRYPT_HASHSIZE;
 	amt = (keylen + stride - 1) / stride;
 
-	memcpy(countsalt, salt, saltlen);
+	if ((out = calloc(stride, BCRYPT_HASHSIZE)) == NULL)
+		return -1;
 
 	/* collapse password */
 	ctx = sha512_init();
+	if (ctx == NULL) {
+		free(out);
+		return -1;
+	}
 	sha512_update(ctx, pass, passlen);
 	sha512_final(sha2pass, ctx);
 
-	/* generate key, sizeof(out) at a time */
-	for (count = 1; keylen > 0; count++) {
-		countsalt[saltlen + 0] = (count >> 24) & 0xff;
-		countsalt[saltlen + 1] = (count >> 16) & 0xff;
-		countsalt[saltlen + 2] = (count >> 8) & 0xff;
-		countsalt[saltlen + 3] = count & 0xff;
-
-		/* first round, salt is salt */
-		ctx = sha512_init();
-		sha512_update(ctx, countsalt, saltlen + 4);
-		sha512_final(sha2salt, ctx);
-
-		bcrypt_hash(sha2pass, sha2salt, tmpout);
-		memcpy(out, tmpout, sizeof(out));
+	/* generate key, BCRYPT_HASHSIZE at a time */
+	ZERO_STRUCT(job);
+	job.sha2pass = sha2pass;
+	job.salt = salt;
+	job.saltlen = saltlen;
+	job.rounds = rounds;
+	job.nblocks = stride;
+	rc = bcrypt_pbkdf_run(&job, out);
+	if (rc < 0)
+		goto out;
 
-		for (i = 1; i < rounds; i++) {
-			/* subsequent rounds, salt is previous output */
-			ctx = sha512_init();
-			sha512_update(ctx, tmpout, sizeof(tmpout));
-			sha512_final(sha2salt, ctx);
-			bcrypt_hash(sha2pass, sha2salt, tmpout);
-			for (j = 0; j < sizeof(out); j++)
-				out[j] ^= tmpout[j];
-		}
+	/*
+	 * pbkdf2 deviation: ouput the key material non-linearly.
+	 */
+	for (count = 1; count <= stride; count++) {
+		const uint8_t *block = out + (count - 1) * BCRYPT_HASHSIZE;
 
-		/*
-		 * pbkdf2 deviation: ouput the key material non-linearly.
-		 */
-		amt = MIN(amt, keylen);
 		for (i = 0; i < amt; i++) {
 			size_t dest = i * stride + (count - 1);
-			if (dest >= origkeylen) {
+			if (dest >= keylen) {
 				break;
 			}
-			key[dest] = out[i];
+			key[dest] = block[i];
 		}
-		keylen -= i;
 	}
 
+out:
 	/* zap */
-	explicit_bzero(out, sizeof(out));
-	free(countsalt);
+	explicit_bzero(sha2pass, sizeof(sha2pass));
+	explicit_bzero(out, stride * BCRYPT_HASHSIZE);
+	free(out);
 
-	return 0;
+	return rc;
 }
 #endif /* HAVE_BCRYPT_PBKDF */
@@ -48,6 +48,7 @@
 #include <string.h>
 #endif
 
+#include <stddef.h>
 #include <sys/types.h>
 #include <stdint.h>
 
@@ -69,6 +70,23 @@
 
 #define BLFRND(s,p,i,j,n) (i ^= F(s,j) ^ (p)[n])
 
+/* One block through all 16 rounds, on locals so it can be kept in registers */
+#define BLFENC(s, p, Xl, Xr) do {					\
+	uint32_t _t;							\
+	Xl ^= (p)[0];							\
+	BLFRND(s, p, Xr, Xl, 1); BLFRND(s, p, Xl, Xr, 2);		\
+	BLFRND(s, p, Xr, Xl, 3); BLFRND(s, p, Xl, Xr, 4);		\
+	BLFRND(s, p, Xr, Xl, 5); BLFRND(s, p, Xl, Xr, 6);		\
+	BLFRND(s, p, Xr, Xl, 7); BLFRND(s, p, Xl, Xr, 8);		\
+	BLFRND(s, p, Xr, Xl, 9); BLFRND(s, p, Xl, Xr, 10);		\
+	BLFRND(s, p, Xr, Xl, 11); BLFRND(s, p, Xl, Xr, 12);		\
+	BLFRND(s, p, Xr, Xl, 13); BLFRND(s, p, Xl, Xr, 14);		\
+	BLFRND(s, p, Xr, Xl, 15); BLFRND(s, p, Xl, Xr, 16);		\
+	_t = Xr ^ (p)[17];						\
+	Xr = Xl;							\
+	Xl = _t;							\
+} while (0)
+
 void
 Blowfish_encipher(ssh_blf_ctx *c, uint32_t *xl, uint32_t *xr)
 {
@@ -80,18 +98,10 @@ Blowfish_encipher(ssh_blf_ctx *c, uint32_t *xl, uint32_t *xr)
 	Xl = *xl;
 	Xr = *xr;
 
-	Xl ^= p[0];
-	BLFRND(s, p, Xr, Xl, 1); BLFRND(s, p, Xl, Xr, 2);
-	BLFRND(s, p, Xr, Xl, 3); BLFRND(s, p, Xl, Xr, 4);
-	BLFRND(s, p, Xr, Xl, 5); BLFRND(s, p, Xl, Xr, 6);
-	BLFRND(s, p, Xr, Xl, 7); BLFRND(s, p, Xl, Xr, 8);
-	BLFRND(s, p, Xr, Xl, 9); BLFRND(s, p, Xl, Xr, 10);
-	BLFRND(s, p, Xr, Xl, 11); BLFRND(s, p, Xl, Xr, 12);
-	BLFRND(s, p, Xr, Xl, 13); BLFRND(s, p, Xl, Xr, 14);
-	BLFRND(s, p, Xr, Xl, 15); BLFRND(s, p, Xl, Xr, 16);
-
-	*xl = Xr ^ p[17];
-	*xr = Xl;
+	BLFENC(s, p, Xl, Xr);
+
+	*xl = Xl;
+	*xr = Xr;
 }
 
 void
@@ -420,84 +430,196 @@ Blowfish_stream2word(const uint8_t *data, uint16_t databytes,
 }
 
 void
-Blowfish_expand0state(ssh_blf_ctx *c, const uint8_t *key, uint16_t keybytes)
+Blowfish_stream2words(const uint8_t *data, uint16_t databytes,
+    uint32_t *words, uint16_t nwords)
 {
 	uint16_t i;
 	uint16_t j;
-	uint16_t k;
-	uint32_t temp;
-	uint32_t datal;
-	uint32_t datar;
 
 	j = 0;
-	for (i = 0; i < BLF_N + 2; i++) {
-		/* Extract 4 int8 to 1 int32 from keystream */
-		temp = Blowfish_stream2word(key, keybytes, &j);
-		c->P[i] = c->P[i] ^ temp;
-	}
+	for (i = 0; i < nwords; i++)
+		words[i] = Blowfish_stream2word(data, databytes, &j);
+}
+
+/*
+ * Rebuild the subkeys and the S-boxes by encrypting the state with itself,
+ * the part shared by both key schedules. The data words, if any, are
+ * xored in before each block, cycling through ndata of them.
+ */
+static void
+Blowfish_rekey(ssh_blf_ctx *c, const uint32_t *data, uint16_t ndata)
+{
+	uint32_t *s = c->S[0];
+	uint32_t *p = c->P;
+	uint32_t pl[BLF_N + 2];
+	uint32_t datal;
+	uint32_t datar;
+	int i;
+	int j;
 
-	j = 0;
 	datal = 0x00000000;
 	datar = 0x00000000;
-	for (i = 0; i < BLF_N + 2; i += 2) {
-		Blowfish_encipher(c, &datal, &datar);
 
-		c->P[i] = datal;
-		c->P[i + 1] = datar;
+	j = 0;
+	for (i = 0; i < BLF_N + 2; i += 2) {
+		if (ndata > 0) {
+			datal ^= data[j];
+			j = j + 1 == ndata ? 0 : j + 1;
+			datar ^= data[j];
+			j = j + 1 == ndata ? 0 : j + 1;
+		}
+		BLFENC(s, p, datal, datar);
+		p[i] = datal;
+		p[i + 1] = datar;
 	}
 
-	for (i = 0; i < 4; i++) {
-		for (k = 0; k < 256; k += 2) {
-			Blowfish_encipher(c, &datal, &datar);
-
-			c->S[i][k] = datal;
-			c->S[i][k + 1] = datar;
+	/*
+	 * The subkeys are final from here on, a local copy of them can stay in
+	 * registers while the stores to the S-boxes go on.
+	 */
+	for (i = 0; i < BLF_N + 2; i++)
+		pl[i] = p[i];
+
+	if (ndata == 0) {
+		for (i = 0; i < 4 * 256; i += 2) {
+			BLFENC(s, pl, datal, datar);
+			s[i] = datal;
+			s[i + 1] = datar;
+		}
+	} else {
+		for (i = 0; i < 4 * 256; i += 2) {
+			datal ^= data[j];
+			j = j + 1 == ndata ? 0 : j + 1;
+			datar ^= data[j];
+			j = j + 1 == ndata ? 0 : j + 1;
+			BLFENC(s, pl, datal, datar);
+			s[i] = datal;
+			s[i + 1] = datar;
 		}
 	}
 }
 
+void
+Blowfish_expand0state_words(ssh_blf_ctx *c, const uint32_t *keywords)
+{
+	int i;
+
+	for (i = 0; i < BLF_N + 2; i++)
+		c->P[i] ^= keywords[i];
 
+	Blowfish_rekey(c, NULL, 0);
+}
+
+/*
+ * Blowfish_expand0state_words() on two independent states at once. A single
+ * key schedule is bound by the latency of the dependent S-box lookups,
+ * interleaving two of them lets the CPU overlap their rounds.
+ */
 void
-Blowfish_expandstate(ssh_blf_ctx *c, const uint8_t *data, uint16_t databytes,
-    const uint8_t *key, uint16_t keybytes)
+Blowfish_expand0state_words2(ssh_blf_ctx *c1, const uint32_t *keywords1,
+    ssh_blf_ctx *c2, const uint32_t *keywords2)
 {
-	uint16_t i;
-	uint16_t j;
-	uint16_t k;
-	uint32_t temp;
-	uint32_t datal;
-	uint32_t datar;
+	uint32_t *s1 = c1->S[0];
+	uint32_t *p1 = c1->P;
+	uint32_t *s2 = c2->S[0];
+	uint32_t *p2 = c2->P;
+	uint32_t pl1[BLF_N + 2];
+	uint32_t pl2[BLF_N + 2];
+	uint32_t datal1 = 0, datar1 = 0;
+	uint32_t datal2 = 0, datar2 = 0;
+	int i;
 
-	j = 0;
 	for (i = 0; i < BLF_N + 2; i++) {
-		/* Extract 4 int8 to 1 int32 from keystream */
-		temp = Blowfish_stream2word(key, keybytes, &j);
-		c->P[i] = c->P[i] ^ temp;
+		p1[i] ^= keywords1[i];
+		p2[i] ^= keywords2[i];
 	}
 
-	j = 0;
-	datal = 0x00000000;
-	datar = 0x00000000;
 	for (i = 0; i < BLF_N + 2; i += 2) {
-		datal ^= Blowfish_stream2word(data, databytes, &j);
-		datar ^= Blowfish_stream2word(data, databytes, &j);
-		Blowfish_encipher(c, &datal, &datar);
+		BLFENC(s1, p1, datal1, datar1);
+		BLFENC(s2, p2, datal2, datar2);
+		p1[i] = datal1;
+		p1[i + 1] = datar1;
+		p2[i] = datal2;
+		p2[i + 1] = datar2;
+	}
+
+	for (i = 0; i < BLF_N + 2; i++) {
+		pl1[i] = p1[i];
+		pl2[i] = p2[i];
+	}
 
-		c->P[i] = datal;
-		c->P[i + 1] = datar;
+	for (i = 0; i < 4 * 256; i += 2) {
+		BLFENC(s1, pl1, datal1, datar1);
+		BLFENC(s2, pl2, datal2, datar2);
+		s1[i] = datal1;
+		s1[i + 1] = datar1;
+		s2[i] = datal2;
+		s2[i + 1] = datar2;
 	}
+}
 
-	for (i = 0; i < 4; i++) {
-		for (k = 0; k < 256; k += 2) {
+void
+Blowfish_expand0state(ssh_blf_ctx *c, const uint8_t *key, uint16_t keybytes)
+{
+	uint32_t keywords[BLF_N + 2];
+
+	/* Extract 4 int8 to 1 int32 from keystream */
+	Blowfish_stream2words(key, keybytes, keywords, BLF_N + 2);
+	Blowfish_expand0state_words(c, keywords);
+}
+
+
+void
+Blowfish_expandstate(ssh_blf_ctx *c, const uint8_t *data, uint16_t databytes,
+    const uint8_t *key, uint16_t keybytes)
+{
+	uint32_t keywords[BLF_N + 2];
+	uint32_t datawords[BLF_N + 2];
+	uint16_t ndata;
+	uint16_t i;
+
+	Blowfish_stream2words(key, keybytes, keywords, BLF_N + 2);
+	for (i = 0; i < BLF_N + 2; i++)
+		c->P[i] ^= keywords[i];
+
+	/*
+	 * The data is consumed as a cyclic stream of words, when it is made of
+	 * whole words convert it once instead of for every block.
+	 */
+	if (databytes > 0 && databytes % 4 == 0 &&
+	    databytes / 4 <= BLF_N + 2) {
+		ndata = databytes / 4;
+		Blowfish_stream2words(data, databytes, datawords, ndata);
+		Blowfish_rekey(c, datawords, ndata);
+	} else {
+		uint16_t j;
+		uint16_t k;
+		uint32_t datal;
+		uint32_t datar;
+
+		j = 0;
+		datal = 0x00000000;
+		datar = 0x00000000;
+		for (i = 0; i < BLF_N + 2; i += 2) {
 			datal ^= Blowfish_stream2word(data, databytes, &j);
 			datar ^= Blowfish_stream2word(data, databytes, &j);
 			Blowfish_encipher(c, &datal, &datar);
 
-			c->S[i][k] = datal;
-			c->S[i][k + 1] = datar;
+			c->P[i] = datal;
+			c->P[i + 1] = datar;
 		}
-	}
 
+		for (i = 0; i < 4; i++) {
+			for (k = 0; k < 256; k += 2) {
+				datal ^= Blowfish_stream2word(data, databytes, &j);
+				datar ^= Blowfish_stream2word(data, databytes, &j);
+				Blowfish_encipher(c, &datal, &datar);
+
+				c->S[i][k] = datal;
+				c->S[i][k + 1] = datar;
+			}
+		}
+	}
 }
 
 void
@@ -220,3 +220,110 @@ int crypto_sign_ed25519_open(unsigned char *m,
 
     return ret;
 }
+
+/*
+ * Verify n signatures at once, checking that
+ *   [8]([sum z_i s_i]B - sum [z_i h_i]A_i - sum [z_i]R_i)
+ * is the neutral element for random 128-bit z_i. This shares the doublings
+ * of all the scalar multiplications. Returns 0 if all the signatures are
+ * valid and -1 otherwise, or if the batch could not be checked: the caller
+ * then has to verify them one by one to find out which are wrong.
+ *
+ * The equation is multiplied by the cofactor, so its outcome does not depend
+ * on the z_i. crypto_sign_ed25519_open() checks the equation without the
+ * cofactor: both agree on all signatures made by the ed25519 signing
+ * algorithm, but a signature whose R or A has a component of small order
+ * can pass the batch and fail on its own. Only the holder of the private
+ * key can make such a signature.
+ */
+int crypto_sign_ed25519_open_batch(const unsigned char * const *sig,
+                                   const unsigned char * const *m,
+                                   const unsigned long long *mlen,
+                                   const unsigned char * const *pk,
+                                   size_t n)
+{
+    ge25519 *points = NULL;
+    sc25519 *scalars = NULL;
+    ge25519 sum;
+    sc25519 schram, scs, scz, t;
+    shortsc25519 z;
+    unsigned char hram[SHA512_DIGEST_LEN];
+    unsigned char rnd[16];
+    SHA512CTX ctx;
+    size_t i;
+    int ret = -1;
+    int ok;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    /* B, then -A_i and -R_i for each signature */
+    points = malloc((2 * n + 1) * sizeof(ge25519));
+    scalars = malloc((2 * n + 1) * sizeof(sc25519));
+    if (points == NULL || scalars == NULL) {
+        goto out;
+    }
+
+    points[0] = ge25519_base;
+    memset(&scalars[0], 0, sizeof(sc25519));
+
+    for (i = 0; i < n; i++) {
+        /* the encoding of R must be canonical, its y below 2^255 - 19 */
+        if ((sig[i][31] & 0x7f) == 0x7f && sig[i][0] >= 0xed) {
+            unsigned int j;
+
+            for (j = 1; j < 31 && sig[i][j] == 0xff; j++);
+            if (j == 31) {
+                goto out;
+            }
+        }
+
+        if (ge25519_unpackneg_vartime(&points[2 * i + 1], pk[i]) != 0) {
+            goto out;
+        }
+        if (ge25519_unpackneg_vartime(&points[2 * i + 2], sig[i]) != 0) {
+            goto out;
+        }
+
+        ctx = sha512_init();
+        if (ctx == NULL) {
+            goto out;
+        }
+        sha512_update(ctx, sig[i], 32);
+        sha512_update(ctx, pk[i], 32);
+        sha512_update(ctx, m[i], mlen[i]);
+        sha512_final(hram, ctx);
+        sc25519_from64bytes(&schram, hram);
+
+        sc25519_from32bytes(&scs, sig[i] + 32);
+
+        ok = ssh_get_random(rnd, sizeof(rnd), 0);
+        if (!ok) {
+            goto out;
+        }
+        shortsc25519_from16bytes(&z, rnd);
+        sc25519_from_shortsc(&scz, &z);
+
+        /* [z_i s_i] for B, [z_i h_i] for -A_i and [z_i] for -R_i */
+        sc25519_mul(&t, &scz, &scs);
+        sc25519_add(&scalars[0], &scalars[0], &t);
+        sc25519_mul(&scalars[2 * i + 1], &scz, &schram);
+        scalars[2 * i + 2] = scz;
+    }
+
+    if (ge25519_multi_scalarmult_vartime(&sum, points, scalars, 2 * n + 1) != 0) {
+        goto out;
+    }
+
+    ge25519_mul_cofactor(&sum, &sum);
+    if (ge25519_isneutral_vartime(&sum)) {
+        ret = 0;
+    }
+
+out:
+    SAFE_FREE(points);
+    SAFE_FREE(scalars);
+
+    return ret;
+}
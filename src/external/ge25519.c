@@ -8,6 +8,8 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "libssh/fe25519.h"
 #include "libssh/sc25519.h"
 #include "libssh/ge25519.h"
@@ -351,6 +353,96 @@ void ge25519_double_scalarmult_vartime(ge25519_p3 *r, const ge25519_p3 *p1, cons
     }
 }
 
+/*
+ * computes [s_0]p_0 + ... + [s_n-1]p_n-1 with Straus' method, so all the
+ * points share the doublings. Signed 5-bit windows, 16 multiples per point.
+ * Returns 0 on success, -1 if the tables could not be allocated.
+ */
+int ge25519_multi_scalarmult_vartime(ge25519_p3 *r,
+                                     const ge25519_p3 *p,
+                                     const sc25519 *s,
+                                     size_t n)
+{
+    ge25519_p1p1 tp1p1;
+    ge25519_p3 *pre;
+    ge25519_p3 q;
+    signed char *b;
+    int started = 0;
+    size_t j;
+    int i, k;
+
+    pre = malloc(n * 16 * sizeof(ge25519_p3));
+    b = malloc(n * 51);
+    if (pre == NULL || b == NULL) {
+        free(pre);
+        free(b);
+        return -1;
+    }
+
+    /* precomputation of p_j, [2]p_j, ..., [16]p_j */
+    for (j = 0; j < n; j++) {
+        ge25519_p3 *t = &pre[16 * j];
+
+        t[0] = p[j];
+        dbl_p1p1(&tp1p1, (ge25519_p2 *)&p[j]);
+        p1p1_to_p3(&t[1], &tp1p1);
+        for (k = 2; k < 16; k++) {
+            add_p1p1(&tp1p1, &t[k - 1], &p[j]);
+            p1p1_to_p3(&t[k], &tp1p1);
+        }
+        sc25519_window5(&b[51 * j], &s[j]);
+    }
+
+    /* scalar multiplication */
+    setneutral(r);
+    for (i = 50; i >= 0; i--) {
+        if (started) {
+            for (k = 0; k < 4; k++) {
+                dbl_p1p1(&tp1p1, (ge25519_p2 *)r);
+                p1p1_to_p2((ge25519_p2 *)r, &tp1p1);
+            }
+            dbl_p1p1(&tp1p1, (ge25519_p2 *)r);
+            p1p1_to_p3(r, &tp1p1);
+        }
+        for (j = 0; j < n; j++) {
+            signed char d = b[51 * j + i];
+
+            if (d == 0) {
+                continue;
+            }
+            if (d > 0) {
+                q = pre[16 * j + d - 1];
+            } else {
+                q = pre[16 * j - d - 1];
+                fe25519_neg(&q.x, &q.x);
+                fe25519_neg(&q.t, &q.t);
+            }
+            add_p1p1(&tp1p1, r, &q);
+            p1p1_to_p3(r, &tp1p1);
+            started = 1;
+        }
+    }
+
+    free(pre);
+    free(b);
+
+    return 0;
+}
+
+/* computes [8]p, which clears the component of small order of p */
+void ge25519_mul_cofactor(ge25519_p3 *r, const ge25519_p3 *p)
+{
+    ge25519_p1p1 tp1p1;
+    ge25519_p2 t;
+
+    dbl_p1p1(&tp1p1, (const ge25519_p2 *)p);
+    p1p1_to_p2(&t, &tp1p1);
+    dbl_p1p1(&tp1p1, &t);
+    p1p1_to_p2(&t, &tp1p1);
+    dbl_p1p1(&tp1p1, &t);
+    p1p1_to_p3(r, &tp1p1);
+}
+
 void ge25519_scalarmult_base(ge25519_p3 *r, const sc25519 *s)
 {
     signed char b[85];
@@ -0,0 +1,2667 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#define SHUT_WR SD_SEND
+#else /* _WIN32 */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+#include "libssh/priv.h"
+#include "libssh/callbacks.h"
+#include "libssh/buffer.h"
+#include "libssh/channels.h"
+#include "libssh/forwarder.h"
+#include "libssh/misc.h"
+#include "libssh/poll.h"
+#include "libssh/session.h"
+#include "libssh/socket.h"
+#ifdef WITH_SERVER
+#include "libssh/server.h"
+#include "libssh/messages.h"
+#endif /* WITH_SERVER */
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* the most read from a socket at once, one packet of the channel */
+#define FORWARDER_CHUNK_SIZE 32768
+
+/* the most chunks read from a socket before polling the others */
+#define FORWARDER_READ_MAX 4
+
+/* the most connections accepted before polling the others */
+#define FORWARDER_ACCEPT_MAX 64
+
+/* how long a listener stops accepting when no descriptor is left, in ms */
+#define FORWARDER_ACCEPT_BACKOFF 100
+
+/*
+ * The most read from a SOCKS client before its channel is open: a SOCKS5
+ * greeting or request, or a SOCKS4a request with its user and host names.
+ */
+#define FORWARDER_SOCKS_MAX 512
+
+#define FORWARDER_SOCKS4_GRANTED 0x5a
+#define FORWARDER_SOCKS4_REJECTED 0x5b
+
+#define FORWARDER_SOCKS5_SUCCEEDED 0x00
+#define FORWARDER_SOCKS5_FAILURE 0x01
+#define FORWARDER_SOCKS5_REFUSED 0x05
+#define FORWARDER_SOCKS5_CMD_UNSUPPORTED 0x07
+#define FORWARDER_SOCKS5_ATYP_UNSUPPORTED 0x08
+
+/**
+ * @defgroup libssh_forwarder The SSH local port forwarding functions
+ * @ingroup libssh
+ *
+ * Forward the connections accepted on local ports through direct-tcpip
+ * channels of a session, like ssh -L does, or to the destinations their
+ * clients ask for with SOCKS, like ssh -D does.
+ *
+ * All the connections are driven by a single event loop: the channels are
+ * opened without waiting for the server, and the data is moved between the
+ * sockets and the channels as they become ready, within the windows of the
+ * channels.
+ *
+ * @{
+ */
+
+enum ssh_forwarder_conn_state_e {
+    /* the SOCKS request of the client is being read */
+    SSH_FORWARDER_CONN_SOCKS = 0,
+    /* the channel was requested, the server did not answer yet */
+    SSH_FORWARDER_CONN_OPENING,
+    SSH_FORWARDER_CONN_OPEN,
+    /* finished, freed after the current poll */
+    SSH_FORWARDER_CONN_DONE
+};
+
+struct ssh_forwarder_listener {
+    ssh_forwarder forwarder;
+    socket_t fd;
+    ssh_poll_handle poll;
+    /* NULL for a SOCKS proxy */
+    char *remote_host;
+    int remote_port;
+    /* the path of a control socket, removed with it */
+    char *path;
+    /* accept() ran out of descriptors, POLLIN is off until the backoff */
+    bool paused;
+    struct ssh_timestamp paused_at;
+    struct ssh_forwarder_listener *next;
+};
+
+struct ssh_forwarder_socks {
+    /* 4 or 5, 0 before the first byte */
+    uint8_t version;
+    /* the SOCKS5 method was chosen */
+    bool greeted;
+    char host[256];
+    int port;
+    /* once the request is parsed, what the client sent after it */
+    size_t len;
+    uint8_t buf[FORWARDER_SOCKS_MAX];
+};
+
+struct ssh_forwarder_conn {
+    ssh_forwarder forwarder;
+    socket_t fd;
+    ssh_poll_handle poll;
+    ssh_channel channel;
+    struct ssh_channel_callbacks_struct channel_cb;
+    enum ssh_forwarder_conn_state_e state;
+    /* the SOCKS exchange, until it is answered and its data forwarded */
+    struct ssh_forwarder_socks *socks;
+    /* accepted on a control socket, it may be a session to multiplex */
+    bool control;
+    /* the socket reached its end, the EOF was sent on the channel */
+    bool local_eof;
+    /* the channel reached its end, the socket is shut down once flushed */
+    bool remote_eof;
+    /* the channel was closed by the server */
+    bool remote_closed;
+    /* the socket was shut down for writing */
+    bool shut;
+    struct ssh_forwarder_conn *prev;
+    struct ssh_forwarder_conn *next;
+};
+
+struct ssh_forwarder_struct {
+    ssh_session session;
+    ssh_event event;
+    int was_blocking;
+    struct ssh_forwarder_listener *listeners;
+    /* the listeners waiting for their backoff */
+    int npaused;
+    /* the connections being forwarded */
+    struct ssh_forwarder_conn *conns;
+    int nconns;
+    /* the connections finished during the current poll */
+    struct ssh_forwarder_conn *done;
+#ifdef WITH_SERVER
+    /* serves the sessions of the clients of the control sockets */
+    ssh_bind bind;
+    struct ssh_forwarder_mux *muxes;
+#endif /* WITH_SERVER */
+    uint8_t chunk[FORWARDER_CHUNK_SIZE];
+};
+
+#ifdef WITH_SERVER
+/*
+ * A channel of a client of the control socket, relayed on a channel of the
+ * session of the forwarder.
+ */
+struct ssh_forwarder_mux_channel {
+    struct ssh_forwarder_mux *mux;
+    /* the opening asked by the client, until the server answered it */
+    ssh_message open;
+    /* the channel of the client, once open, and the one of the server */
+    ssh_channel local;
+    ssh_channel remote;
+    struct ssh_channel_callbacks_struct local_cb;
+    struct ssh_channel_callbacks_struct remote_cb;
+    /*
+     * The requests of the client, relayed in order. The head waits for the
+     * reply of the server when one is wanted.
+     */
+    struct ssh_list *requests;
+    bool request_sent;
+    /* the exit-status or exit-signal of the server, relayed after the data */
+    const char *exit_request;
+    ssh_buffer exit_payload;
+    /* the client sent its EOF, or the server did */
+    bool local_eof;
+    bool remote_eof;
+    /* the channel was closed by the server */
+    bool remote_closed;
+    /* finished, freed after the current poll */
+    bool done;
+    struct ssh_forwarder_mux_channel *next;
+};
+
+/* A client of a control socket with a SSH session of its own */
+struct ssh_forwarder_mux {
+    ssh_forwarder forwarder;
+    /* the server side of the session of the client */
+    ssh_session session;
+    struct ssh_forwarder_mux_channel *channels;
+    struct ssh_forwarder_mux *next;
+};
+#endif /* WITH_SERVER */
+
+static bool forwarder_would_block(void)
+{
+#ifdef _WIN32
+    int err = WSAGetLastError();
+
+    return err == WSAEWOULDBLOCK || err == WSAEINTR;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+/* accept() failed for lack of descriptors or memory, not the connection */
+static bool forwarder_out_of_resources(void)
+{
+#ifdef _WIN32
+    int err = WSAGetLastError();
+
+    return err == WSAEMFILE || err == WSAENOBUFS;
+#else
+    return errno == EMFILE || errno == ENFILE ||
+           errno == ENOBUFS || errno == ENOMEM;
+#endif
+}
+
+/*
+ * Stop forwarding a connection. It cannot be freed here since the poll
+ * handles of the event or the callbacks of the channel may be iterated, it is
+ * freed by forwarder_reap() once the poll is over.
+ */
+static void forwarder_conn_done(struct ssh_forwarder_conn *conn)
+{
+    ssh_forwarder forwarder = conn->forwarder;
+
+    if (conn->state == SSH_FORWARDER_CONN_DONE) {
+        return;
+    }
+    conn->state = SSH_FORWARDER_CONN_DONE;
+    if (conn->poll != NULL) {
+        ssh_poll_set_events(conn->poll, 0);
+    }
+
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        forwarder->conns = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    conn->prev = NULL;
+    conn->next = forwarder->done;
+    forwarder->done = conn;
+    forwarder->nconns--;
+}
+
+static void forwarder_conn_free(struct ssh_forwarder_conn *conn)
+{
+    if (conn->poll != NULL) {
+        ssh_poll_free(conn->poll);
+    }
+    CLOSE_SOCKET(conn->fd);
+
+    /* this sends the close of the channel if needed */
+    if (conn->channel != NULL) {
+        ssh_remove_channel_callbacks(conn->channel, &conn->channel_cb);
+        ssh_channel_free(conn->channel);
+    }
+
+    SAFE_FREE(conn->socks);
+    free(conn);
+}
+
+static void forwarder_reap(ssh_forwarder forwarder)
+{
+    struct ssh_forwarder_conn *conn;
+
+    /* freeing a channel may process packets and finish more connections */
+    while (forwarder->done != NULL) {
+        conn = forwarder->done;
+        forwarder->done = conn->next;
+        forwarder_conn_free(conn);
+    }
+}
+
+#ifdef WITH_SERVER
+/*
+ * Sessions multiplexed over the control sockets.
+ *
+ * A client connecting with SSH_OPTIONS_CONTROL_PATH speaks SSH on the control
+ * socket. The forwarder serves it with a session of its own, whose channels
+ * are opened on the session of the forwarder: the requests and the data of
+ * the client are relayed to the server, and the data, the end and the exit
+ * status of the server back to the client.
+ */
+
+static void forwarder_mux_channel_done(struct ssh_forwarder_mux_channel *ch)
+{
+    ch->done = true;
+}
+
+static void forwarder_mux_channel_free(struct ssh_forwarder_mux_channel *ch)
+{
+    ssh_message msg;
+
+    /* this sends the close of the channels if needed */
+    if (ch->remote != NULL) {
+        ssh_remove_channel_callbacks(ch->remote, &ch->remote_cb);
+        ssh_channel_free(ch->remote);
+    }
+    if (ch->local != NULL) {
+        ssh_remove_channel_callbacks(ch->local, &ch->local_cb);
+        ssh_channel_free(ch->local);
+    }
+
+    ssh_message_free(ch->open);
+    if (ch->requests != NULL) {
+        while ((msg = ssh_list_pop_head(ssh_message, ch->requests)) != NULL) {
+            ssh_message_free(msg);
+        }
+        ssh_list_free(ch->requests);
+    }
+    ssh_buffer_free(ch->exit_payload);
+    free(ch);
+}
+
+/* Relay what is left in a buffer of a channel, within the window of the other */
+static int forwarder_mux_relay(ssh_channel from, ssh_channel to, int is_stderr)
+{
+    ssh_buffer buffer = is_stderr ? from->stderr_buffer : from->stdout_buffer;
+    uint32_t len;
+    int w;
+
+    len = ssh_buffer_get_len(buffer);
+    if (len == 0) {
+        return SSH_OK;
+    }
+    if (is_stderr) {
+        w = channel_write_stderr_nowait(to, ssh_buffer_get(buffer), len);
+    } else {
+        w = channel_write_nowait(to, ssh_buffer_get(buffer), len);
+    }
+    if (w < 0) {
+        return SSH_ERROR;
+    }
+    if (w == 0) {
+        return SSH_OK;
+    }
+
+    return ssh_channel_consume(from, (uint32_t)w, is_stderr);
+}
+
+/*
+ * Move the data left in the channels as far as the windows allow, and pass
+ * the ends on once the data before them went through.
+ */
+static void forwarder_mux_channel_update(struct ssh_forwarder_mux_channel *ch)
+{
+    int rc;
+
+    if (ch->done || ch->local == NULL) {
+        return;
+    }
+
+    /* from the client to the server */
+    if (!ch->remote_closed) {
+        rc = forwarder_mux_relay(ch->local, ch->remote, 0);
+        if (rc != SSH_OK) {
+            forwarder_mux_channel_done(ch);
+            return;
+        }
+        if (ch->local_eof && !ch->remote->local_eof &&
+            ssh_buffer_get_len(ch->local->stdout_buffer) == 0) {
+            ssh_channel_send_eof(ch->remote);
+        }
+    }
+
+    /* from the server to the client */
+    rc = forwarder_mux_relay(ch->remote, ch->local, 0);
+    if (rc == SSH_OK) {
+        rc = forwarder_mux_relay(ch->remote, ch->local, 1);
+    }
+    if (rc != SSH_OK) {
+        forwarder_mux_channel_done(ch);
+        return;
+    }
+    if (ssh_buffer_get_len(ch->remote->stdout_buffer) > 0 ||
+        ssh_buffer_get_len(ch->remote->stderr_buffer) > 0) {
+        return;
+    }
+    if (ch->exit_request != NULL) {
+        channel_request_nowait(ch->local,
+                               ch->exit_request,
+                               ch->exit_payload,
+                               0);
+        ch->exit_request = NULL;
+        SSH_BUFFER_FREE(ch->exit_payload);
+    }
+    if (ch->remote_eof && !ch->local->local_eof) {
+        ssh_channel_send_eof(ch->local);
+    }
+    if (ch->remote_closed) {
+        forwarder_mux_channel_done(ch);
+    }
+}
+
+static int forwarder_mux_data_cb(ssh_session session,
+                                 ssh_channel channel,
+                                 void *data,
+                                 uint32_t len,
+                                 int is_stderr,
+                                 void *userdata)
+{
+    struct ssh_forwarder_mux_channel *ch = userdata;
+    int w;
+
+    (void)session;
+
+    if (ch->done) {
+        return len;
+    }
+
+    if (channel == ch->remote) {
+        if (is_stderr) {
+            w = channel_write_stderr_nowait(ch->local, data, len);
+        } else {
+            w = channel_write_nowait(ch->local, data, len);
+        }
+    } else if (is_stderr || ch->remote_closed) {
+        /* nowhere to go */
+        return len;
+    } else {
+        w = channel_write_nowait(ch->remote, data, len);
+    }
+    if (w < 0) {
+        forwarder_mux_channel_done(ch);
+        return len;
+    }
+
+    /* the rest stays in the channel, and its window, until the other grows */
+    return w;
+}
+
+static void forwarder_mux_eof_cb(ssh_session session,
+                                 ssh_channel channel,
+                                 void *userdata)
+{
+    struct ssh_forwarder_mux_channel *ch = userdata;
+
+    (void)session;
+
+    if (channel == ch->remote) {
+        ch->remote_eof = true;
+    } else {
+        ch->local_eof = true;
+    }
+    forwarder_mux_channel_update(ch);
+}
+
+static void forwarder_mux_close_cb(ssh_session session,
+                                   ssh_channel channel,
+                                   void *userdata)
+{
+    struct ssh_forwarder_mux_channel *ch = userdata;
+
+    if (channel == ch->remote) {
+        /* the client gets what the server sent before */
+        ch->remote_closed = true;
+        forwarder_mux_eof_cb(session, channel, userdata);
+    } else {
+        forwarder_mux_channel_done(ch);
+    }
+}
+
+static int forwarder_mux_write_wontblock_cb(ssh_session session,
+                                            ssh_channel channel,
+                                            size_t bytes,
+                                            void *userdata)
+{
+    (void)session;
+    (void)channel;
+    (void)bytes;
+
+    forwarder_mux_channel_update(userdata);
+
+    return 0;
+}
+
+static void forwarder_mux_signal_cb(ssh_session session,
+                                    ssh_channel channel,
+                                    const char *signal,
+                                    void *userdata)
+{
+    struct ssh_forwarder_mux_channel *ch = userdata;
+    ssh_buffer payload;
+
+    (void)session;
+    (void)channel;
+
+    if (ch->done || ch->remote_closed) {
+        return;
+    }
+    payload = ssh_buffer_new();
+    if (payload == NULL) {
+        return;
+    }
+    if (ssh_buffer_pack(payload, "s", signal) == SSH_OK) {
+        channel_request_nowait(ch->remote, "signal", payload, 0);
+    }
+    SSH_BUFFER_FREE(payload);
+}
+
+/* Keep the exit request of the server until the data before it is relayed */
+static ssh_buffer forwarder_mux_exit_payload(struct ssh_forwarder_mux_channel *ch,
+                                             const char *request)
+{
+    ch->exit_request = NULL;
+    SSH_BUFFER_FREE(ch->exit_payload);
+
+    ch->exit_payload = ssh_buffer_new();
+    if (ch->exit_payload == NULL) {
+        return NULL;
+    }
+    ch->exit_request = request;
+
+    return ch->exit_payload;
+}
+
+static void forwarder_mux_exit_status_cb(ssh_session session,
+                                         ssh_channel channel,
+                                         int exit_status,
+                                         void *userdata)
+{
+    struct ssh_forwarder_mux_channel *ch = userdata;
+    ssh_buffer payload;
+
+    (void)session;
+    (void)channel;
+
+    payload = forwarder_mux_exit_payload(ch, "exit-status");
+    if (payload == NULL ||
+        ssh_buffer_pack(payload, "d", exit_status) != SSH_OK) {
+        ch->exit_request = NULL;
+        return;
+    }
+    forwarder_mux_channel_update(ch);
+}
+
+static void forwarder_mux_exit_signal_cb(ssh_session session,
+                                         ssh_channel channel,
+                                         const char *signal,
+                                         int core,
+                                         const char *errmsg,
+                                         const char *lang,
+                                         void *userdata)
+{
+    struct ssh_forwarder_mux_channel *ch = userdata;
+    ssh_buffer payload;
+
+    (void)session;
+    (void)channel;
+
+    payload = forwarder_mux_exit_payload(ch, "exit-signal");
+    if (payload == NULL ||
+        ssh_buffer_pack(payload,
+                        "sbss",
+                        signal,
+                        core ? 1 : 0,
+                        errmsg,
+                        lang) != SSH_OK) {
+        ch->exit_request = NULL;
+        return;
+    }
+    forwarder_mux_channel_update(ch);
+}
+
+/* The server answered the opening, the client gets the same answer */
+static void forwarder_mux_open_response_cb(ssh_session session,
+                                           ssh_channel channel,
+                                           int is_success,
+                                           void *userdata)
+{
+    struct ssh_forwarder_mux_channel *ch = userdata;
+    int rc;
+
+    (void)session;
+    (void)channel;
+
+    if (ch->open == NULL) {
+        return;
+    }
+    if (!is_success) {
+        ssh_message_reply_default(ch->open);
+        SSH_MESSAGE_FREE(ch->open);
+        forwarder_mux_channel_done(ch);
+        return;
+    }
+
+    ch->local = ssh_message_channel_request_open_reply_accept(ch->open);
+    SSH_MESSAGE_FREE(ch->open);
+    if (ch->local == NULL) {
+        forwarder_mux_channel_done(ch);
+        return;
+    }
+
+    ssh_callbacks_init(&ch->local_cb);
+    ch->local_cb.userdata = ch;
+    ch->local_cb.channel_data_function = forwarder_mux_data_cb;
+    ch->local_cb.channel_eof_function = forwarder_mux_eof_cb;
+    ch->local_cb.channel_close_function = forwarder_mux_close_cb;
+    ch->local_cb.channel_signal_function = forwarder_mux_signal_cb;
+    ch->local_cb.channel_write_wontblock_function =
+        forwarder_mux_write_wontblock_cb;
+    rc = ssh_add_channel_callbacks(ch->local, &ch->local_cb);
+    if (rc != SSH_OK) {
+        forwarder_mux_channel_done(ch);
+    }
+}
+
+/*
+ * Open the channel the client asks for on the session of the forwarder. The
+ * client is answered once the server answered.
+ */
+static int forwarder_mux_channel_new(struct ssh_forwarder_mux *mux,
+                                     ssh_message msg)
+{
+    ssh_session session = mux->forwarder->session;
+    struct ssh_channel_request_open *open = &msg->channel_request_open;
+    struct ssh_forwarder_mux_channel *ch;
+    int rc;
+
+    ch = calloc(1, sizeof(struct ssh_forwarder_mux_channel));
+    if (ch == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    ch->mux = mux;
+
+    ch->requests = ssh_list_new();
+    if (ch->requests == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    ch->remote = ssh_channel_new(session);
+    if (ch->remote == NULL) {
+        goto error;
+    }
+
+    ssh_callbacks_init(&ch->remote_cb);
+    ch->remote_cb.userdata = ch;
+    ch->remote_cb.channel_data_function = forwarder_mux_data_cb;
+    ch->remote_cb.channel_eof_function = forwarder_mux_eof_cb;
+    ch->remote_cb.channel_close_function = forwarder_mux_close_cb;
+    ch->remote_cb.channel_exit_status_function = forwarder_mux_exit_status_cb;
+    ch->remote_cb.channel_exit_signal_function = forwarder_mux_exit_signal_cb;
+    ch->remote_cb.channel_write_wontblock_function =
+        forwarder_mux_write_wontblock_cb;
+    ch->remote_cb.channel_open_response_function =
+        forwarder_mux_open_response_cb;
+    rc = ssh_add_channel_callbacks(ch->remote, &ch->remote_cb);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    switch (open->type) {
+    case SSH_CHANNEL_SESSION:
+        rc = channel_open_session_nowait(ch->remote);
+        break;
+    case SSH_CHANNEL_DIRECT_TCPIP:
+        rc = channel_open_forward_nowait(ch->remote,
+                                         open->destination,
+                                         open->destination_port,
+                                         open->originator,
+                                         open->originator_port);
+        break;
+    default:
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Channel type %d not multiplexed",
+                open->type);
+        rc = SSH_ERROR;
+        break;
+    }
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    ch->open = msg;
+    ch->next = mux->channels;
+    mux->channels = ch;
+
+    return SSH_OK;
+
+error:
+    forwarder_mux_channel_free(ch);
+
+    return SSH_ERROR;
+}
+
+/* Send a channel request of the client on the channel of the server */
+static int forwarder_mux_request_send(struct ssh_forwarder_mux_channel *ch,
+                                      ssh_message msg)
+{
+    struct ssh_channel_request *req = &msg->channel_request;
+    const char *name = NULL;
+    ssh_buffer payload;
+    int rc;
+
+    payload = ssh_buffer_new();
+    if (payload == NULL) {
+        return SSH_ERROR;
+    }
+
+    switch (req->type) {
+    case SSH_CHANNEL_REQUEST_PTY:
+        name = "pty-req";
+        rc = ssh_buffer_pack(payload,
+                             "sddddS",
+                             req->TERM,
+                             req->width,
+                             req->height,
+                             req->pxwidth,
+                             req->pxheight,
+                             req->modes);
+        break;
+    case SSH_CHANNEL_REQUEST_ENV:
+        name = "env";
+        rc = ssh_buffer_pack(payload, "ss", req->var_name, req->var_value);
+        break;
+    case SSH_CHANNEL_REQUEST_EXEC:
+        name = "exec";
+        rc = ssh_buffer_pack(payload, "s", req->command);
+        break;
+    case SSH_CHANNEL_REQUEST_SUBSYSTEM:
+        name = "subsystem";
+        rc = ssh_buffer_pack(payload, "s", req->subsystem);
+        break;
+    case SSH_CHANNEL_REQUEST_SHELL:
+        name = "shell";
+        rc = SSH_OK;
+        break;
+    case SSH_CHANNEL_REQUEST_WINDOW_CHANGE:
+        name = "window-change";
+        rc = ssh_buffer_pack(payload,
+                             "dddd",
+                             req->width,
+                             req->height,
+                             req->pxwidth,
+                             req->pxheight);
+        break;
+    default:
+        /* X11 forwarding would need channels opened towards the client */
+        rc = SSH_ERROR;
+        break;
+    }
+    if (rc == SSH_OK) {
+        rc = channel_request_nowait(ch->remote,
+                                    name,
+                                    payload,
+                                    req->want_reply);
+    }
+    SSH_BUFFER_FREE(payload);
+
+    return rc;
+}
+
+/*
+ * Relay the requests of the client in order: one waiting for the reply of the
+ * server holds back the others, the client gets the same reply.
+ */
+static void forwarder_mux_requests(struct ssh_forwarder_mux_channel *ch)
+{
+    struct ssh_iterator *it;
+    ssh_message msg;
+    int rc;
+
+    for (;;) {
+        it = ssh_list_get_iterator(ch->requests);
+        if (it == NULL || ch->done) {
+            return;
+        }
+        msg = ssh_iterator_value(ssh_message, it);
+
+        if (ch->request_sent) {
+            switch (ch->remote->request_state) {
+            case SSH_CHANNEL_REQ_STATE_PENDING:
+                return;
+            case SSH_CHANNEL_REQ_STATE_ACCEPTED:
+                ssh_message_channel_request_reply_success(msg);
+                break;
+            default:
+                ssh_message_reply_default(msg);
+                break;
+            }
+            ch->remote->request_state = SSH_CHANNEL_REQ_STATE_NONE;
+            ch->request_sent = false;
+        } else {
+            rc = SSH_ERROR;
+            if (!ch->remote_closed) {
+                rc = forwarder_mux_request_send(ch, msg);
+            }
+            if (rc != SSH_OK) {
+                ssh_message_reply_default(msg);
+            } else if (msg->channel_request.want_reply) {
+                ch->request_sent = true;
+                return;
+            }
+        }
+
+        ssh_list_remove(ch->requests, it);
+        ssh_message_free(msg);
+    }
+}
+
+static struct ssh_forwarder_mux_channel *
+forwarder_mux_channel_find(struct ssh_forwarder_mux *mux, ssh_channel local)
+{
+    struct ssh_forwarder_mux_channel *ch;
+
+    for (ch = mux->channels; ch != NULL; ch = ch->next) {
+        if (ch->local == local) {
+            return ch;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Only the user of the forwarder, or root, can reach the control socket: the
+ * client is let in with the first method it tries.
+ */
+static void forwarder_mux_auth(ssh_message msg)
+{
+    switch (ssh_message_subtype(msg)) {
+    case SSH_AUTH_METHOD_NONE:
+    case SSH_AUTH_METHOD_PASSWORD:
+    case SSH_AUTH_METHOD_INTERACTIVE:
+        ssh_message_auth_reply_success(msg, 0);
+        break;
+    case SSH_AUTH_METHOD_PUBLICKEY:
+        switch (ssh_message_auth_publickey_state(msg)) {
+        case SSH_PUBLICKEY_STATE_NONE:
+            ssh_message_auth_reply_pk_ok_simple(msg);
+            break;
+        case SSH_PUBLICKEY_STATE_VALID:
+            ssh_message_auth_reply_success(msg, 0);
+            break;
+        default:
+            ssh_message_reply_default(msg);
+            break;
+        }
+        break;
+    default:
+        ssh_message_reply_default(msg);
+        break;
+    }
+}
+
+/* Answer the messages the session of a client received during the poll */
+static void forwarder_mux_messages(struct ssh_forwarder_mux *mux)
+{
+    struct ssh_forwarder_mux_channel *ch;
+    ssh_message msg;
+    int rc;
+
+    while ((msg = ssh_message_pop_head(mux->session)) != NULL) {
+        switch (ssh_message_type(msg)) {
+        case SSH_REQUEST_SERVICE:
+            ssh_message_service_reply_success(msg);
+            break;
+        case SSH_REQUEST_AUTH:
+            forwarder_mux_auth(msg);
+            break;
+        case SSH_REQUEST_CHANNEL_OPEN:
+            rc = forwarder_mux_channel_new(mux, msg);
+            if (rc == SSH_OK) {
+                /* kept until the server answers */
+                continue;
+            }
+            ssh_message_reply_default(msg);
+            break;
+        case SSH_REQUEST_CHANNEL:
+            ch = forwarder_mux_channel_find(mux, msg->channel_request.channel);
+            if (ch != NULL && !ch->done) {
+                rc = ssh_list_append(ch->requests, msg);
+                if (rc == SSH_OK) {
+                    continue;
+                }
+            }
+            ssh_message_reply_default(msg);
+            break;
+        default:
+            ssh_message_reply_default(msg);
+            break;
+        }
+        ssh_message_free(msg);
+    }
+}
+
+static void forwarder_mux_free(struct ssh_forwarder_mux *mux)
+{
+    struct ssh_forwarder_mux_channel *ch;
+
+    while (mux->channels != NULL) {
+        ch = mux->channels;
+        mux->channels = ch->next;
+        forwarder_mux_channel_free(ch);
+    }
+
+    ssh_event_remove_session(mux->forwarder->event, mux->session);
+    ssh_free(mux->session);
+    free(mux);
+}
+
+/*
+ * Serve the clients of the control sockets once the poll is over: answer
+ * their messages, relay their requests, and free what is finished.
+ */
+static void forwarder_mux_process(ssh_forwarder forwarder)
+{
+    struct ssh_forwarder_mux **pmux = &forwarder->muxes;
+    struct ssh_forwarder_mux_channel **pch;
+    struct ssh_forwarder_mux_channel *ch;
+    struct ssh_forwarder_mux *mux;
+    enum ssh_session_state_e state;
+
+    while (*pmux != NULL) {
+        mux = *pmux;
+        forwarder_mux_messages(mux);
+
+        pch = &mux->channels;
+        while (*pch != NULL) {
+            ch = *pch;
+            forwarder_mux_requests(ch);
+            if (ch->done) {
+                *pch = ch->next;
+                forwarder_mux_channel_free(ch);
+                continue;
+            }
+            pch = &ch->next;
+        }
+
+        state = mux->session->session_state;
+        if (state == SSH_SESSION_STATE_ERROR ||
+            state == SSH_SESSION_STATE_DISCONNECTED) {
+            SSH_LOG(SSH_LOG_PROTOCOL, "A multiplexed session is over");
+            *pmux = mux->next;
+            forwarder_mux_free(mux);
+            continue;
+        }
+        pmux = &mux->next;
+    }
+}
+
+/* Serve the session of a client of a control socket, owning its socket */
+static void forwarder_mux_new(ssh_forwarder forwarder, socket_t fd)
+{
+    struct ssh_forwarder_mux *mux;
+    int rc;
+
+    mux = calloc(1, sizeof(struct ssh_forwarder_mux));
+    if (mux == NULL) {
+        CLOSE_SOCKET(fd);
+        return;
+    }
+    mux->forwarder = forwarder;
+
+    mux->session = ssh_new();
+    if (mux->session == NULL) {
+        CLOSE_SOCKET(fd);
+        free(mux);
+        return;
+    }
+    rc = ssh_bind_accept_fd(forwarder->bind, mux->session, fd);
+    if (rc != SSH_OK) {
+        SSH_LOG(SSH_LOG_RARE,
+                "Could not serve a multiplexed session: %s",
+                ssh_get_error(forwarder->bind));
+        CLOSE_SOCKET(fd);
+        ssh_free(mux->session);
+        free(mux);
+        return;
+    }
+
+    /* the key exchange goes on in the event of the forwarder */
+    ssh_set_blocking(mux->session, 0);
+    rc = ssh_handle_key_exchange(mux->session);
+    if (rc != SSH_ERROR) {
+        rc = ssh_event_add_session(forwarder->event, mux->session);
+    }
+    if (rc == SSH_ERROR) {
+        SSH_LOG(SSH_LOG_RARE,
+                "Could not serve a multiplexed session: %s",
+                ssh_get_error(mux->session));
+        ssh_free(mux->session);
+        free(mux);
+        return;
+    }
+    SSH_LOG(SSH_LOG_PROTOCOL, "Multiplexing a session on fd %d", fd);
+
+    mux->next = forwarder->muxes;
+    forwarder->muxes = mux;
+}
+
+/*
+ * A client of a control socket either sends a SOCKS request, whose first
+ * byte is its version, or the banner of a SSH session ("SSH-2.0-..."), which
+ * no SOCKS version starts with. Returns true when the socket was handed over
+ * to a multiplexed session.
+ */
+static bool forwarder_mux_detect(struct ssh_forwarder_conn *conn)
+{
+    ssh_forwarder forwarder = conn->forwarder;
+    uint8_t first;
+    ssize_t r;
+
+    if (forwarder->bind == NULL || conn->socks->len > 0) {
+        return false;
+    }
+    r = recv(conn->fd, (void *)&first, 1, MSG_PEEK);
+    if (r != 1 || first != 'S') {
+        return false;
+    }
+
+    forwarder_mux_new(forwarder, conn->fd);
+
+    return true;
+}
+
+/* The key of the sessions of the control sockets, never checked by clients */
+static int forwarder_mux_bind(ssh_forwarder forwarder)
+{
+    ssh_key key = NULL;
+    int rc;
+
+    if (forwarder->bind != NULL) {
+        return SSH_OK;
+    }
+
+    rc = ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &key);
+    if (rc != SSH_OK) {
+        ssh_set_error(forwarder->session,
+                      SSH_FATAL,
+                      "Could not generate a key for the control socket");
+        return SSH_ERROR;
+    }
+    forwarder->bind = ssh_bind_new();
+    if (forwarder->bind == NULL) {
+        ssh_key_free(key);
+        ssh_set_error_oom(forwarder->session);
+        return SSH_ERROR;
+    }
+    /* the bind owns the key from now on */
+    rc = ssh_bind_options_set(forwarder->bind,
+                              SSH_BIND_OPTIONS_IMPORT_KEY,
+                              key);
+    if (rc != 0) {
+        ssh_key_free(key);
+        ssh_set_error(forwarder->session,
+                      SSH_FATAL,
+                      "%s",
+                      ssh_get_error(forwarder->bind));
+        ssh_bind_free(forwarder->bind);
+        forwarder->bind = NULL;
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+#endif /* WITH_SERVER */
+
+/*
+ * Write to the socket what the server sent on the channel, and shut the
+ * socket down once everything was written after the end of the channel.
+ */
+static int forwarder_conn_flush(struct ssh_forwarder_conn *conn)
+{
+    ssh_buffer buffer = conn->channel->stdout_buffer;
+    uint32_t len;
+    ssize_t w;
+    int rc;
+
+    len = ssh_buffer_get_len(buffer);
+    if (len > 0) {
+        w = send(conn->fd, ssh_buffer_get(buffer), len, MSG_NOSIGNAL);
+        if (w < 0) {
+            return forwarder_would_block() ? SSH_OK : SSH_ERROR;
+        }
+        rc = ssh_channel_consume(conn->channel, (uint32_t)w, 0);
+        if (rc != SSH_OK) {
+            return SSH_ERROR;
+        }
+        len -= (uint32_t)w;
+    }
+
+    if (len == 0 && conn->remote_eof && !conn->shut) {
+        shutdown(conn->fd, SHUT_WR);
+        conn->shut = true;
+    }
+
+    return SSH_OK;
+}
+
+/* Send on the channel what the socket received, within the window */
+static void forwarder_conn_read(struct ssh_forwarder_conn *conn)
+{
+    ssh_forwarder forwarder = conn->forwarder;
+    uint32_t toread;
+    ssize_t r;
+    int w;
+    int i;
+
+    for (i = 0; i < FORWARDER_READ_MAX; i++) {
+        toread = MIN(conn->channel->remote_window, FORWARDER_CHUNK_SIZE);
+        if (toread == 0) {
+            return;
+        }
+
+        r = recv(conn->fd, (void *)forwarder->chunk, toread, 0);
+        if (r < 0) {
+            if (!forwarder_would_block()) {
+                forwarder_conn_done(conn);
+            }
+            return;
+        }
+        if (r == 0) {
+            conn->local_eof = true;
+            /* may process packets, and finish the connection */
+            ssh_channel_send_eof(conn->channel);
+            return;
+        }
+
+        w = channel_write_nowait(conn->channel, forwarder->chunk, (uint32_t)r);
+        if (w != r) {
+            SSH_LOG(SSH_LOG_RARE,
+                    "Could not forward %d bytes: %s",
+                    (int)r,
+                    ssh_get_error(forwarder->session));
+            forwarder_conn_done(conn);
+            return;
+        }
+        if (r < (ssize_t)toread) {
+            return;
+        }
+    }
+}
+
+/*
+ * Ask the server for the channel of a connection, without waiting for its
+ * answer. Nothing is read from the socket until the channel is open.
+ */
+static int forwarder_conn_open(struct ssh_forwarder_conn *conn,
+                               const char *host,
+                               int port,
+                               struct sockaddr *addr,
+                               socklen_t addrlen)
+{
+    char originator[NI_MAXHOST];
+    char service[NI_MAXSERV];
+    int rc;
+
+    /* the originator is only informative */
+    rc = getnameinfo(addr,
+                     addrlen,
+                     originator,
+                     sizeof(originator),
+                     service,
+                     sizeof(service),
+                     NI_NUMERICHOST | NI_NUMERICSERV);
+    if (rc != 0) {
+        snprintf(originator, sizeof(originator), "127.0.0.1");
+        snprintf(service, sizeof(service), "0");
+    }
+
+    rc = channel_open_forward_nowait(conn->channel,
+                                     host,
+                                     port,
+                                     originator,
+                                     atoi(service));
+    if (rc != SSH_OK) {
+        return rc;
+    }
+
+    conn->state = SSH_FORWARDER_CONN_OPENING;
+    ssh_poll_set_events(conn->poll, 0);
+
+    return SSH_OK;
+}
+
+static int forwarder_socks_send(struct ssh_forwarder_conn *conn,
+                                const uint8_t *data,
+                                size_t len)
+{
+    ssize_t w;
+
+    /* a few bytes, nothing else is queued on the socket yet */
+    w = send(conn->fd, (const void *)data, len, MSG_NOSIGNAL);
+
+    return w == (ssize_t)len ? SSH_OK : SSH_ERROR;
+}
+
+/* The bound address is not known, it is answered as zeros like ssh -D does */
+static int forwarder_socks_reply(struct ssh_forwarder_conn *conn,
+                                 uint8_t code)
+{
+    uint8_t reply[10] = {0};
+
+    reply[1] = code;
+    if (conn->socks->version == 4) {
+        return forwarder_socks_send(conn, reply, 8);
+    }
+    reply[0] = 5;
+    reply[3] = 1;
+
+    return forwarder_socks_send(conn, reply, sizeof(reply));
+}
+
+static void forwarder_socks_consume(struct ssh_forwarder_socks *socks,
+                                    size_t len)
+{
+    memmove(socks->buf, socks->buf + len, socks->len - len);
+    socks->len -= len;
+}
+
+static int forwarder_socks_numeric_host(struct ssh_forwarder_socks *socks,
+                                        int family,
+                                        const uint8_t *addr)
+{
+    struct sockaddr_storage ss;
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+    socklen_t sslen;
+    int rc;
+
+    ZERO_STRUCT(ss);
+    if (family == AF_INET) {
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, addr, 4);
+        sslen = sizeof(struct sockaddr_in);
+    } else {
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, addr, 16);
+        sslen = sizeof(struct sockaddr_in6);
+    }
+
+    rc = getnameinfo((struct sockaddr *)&ss,
+                     sslen,
+                     socks->host,
+                     sizeof(socks->host),
+                     NULL,
+                     0,
+                     NI_NUMERICHOST);
+
+    return rc == 0 ? SSH_OK : SSH_ERROR;
+}
+
+/*
+ * SOCKS4: VN CD DSTPORT DSTIP USERID NUL, and with SOCKS4a a DSTIP of 0.0.0.x
+ * followed by the host name and a NUL.
+ */
+static int forwarder_socks4_parse(struct ssh_forwarder_conn *conn)
+{
+    struct ssh_forwarder_socks *socks = conn->socks;
+    uint8_t *buf = socks->buf;
+    uint8_t *end = buf + socks->len;
+    uint8_t *user_end;
+    uint8_t *host;
+    uint8_t *host_end;
+    size_t len;
+    int rc;
+
+    if (socks->len < 9) {
+        return SSH_AGAIN;
+    }
+    user_end = memchr(buf + 8, '\0', end - (buf + 8));
+    if (user_end == NULL) {
+        return SSH_AGAIN;
+    }
+
+    /* CONNECT only */
+    if (buf[1] != 1) {
+        forwarder_socks_reply(conn, FORWARDER_SOCKS4_REJECTED);
+        return SSH_ERROR;
+    }
+    socks->port = (buf[2] << 8) | buf[3];
+
+    if (buf[4] == 0 && buf[5] == 0 && buf[6] == 0 && buf[7] != 0) {
+        host = user_end + 1;
+        host_end = memchr(host, '\0', end - host);
+        if (host_end == NULL) {
+            return SSH_AGAIN;
+        }
+        len = host_end - host;
+        if (len == 0 || len >= sizeof(socks->host)) {
+            forwarder_socks_reply(conn, FORWARDER_SOCKS4_REJECTED);
+            return SSH_ERROR;
+        }
+        memcpy(socks->host, host, len + 1);
+        forwarder_socks_consume(socks, host_end + 1 - buf);
+
+        return SSH_OK;
+    }
+
+    rc = forwarder_socks_numeric_host(socks, AF_INET, buf + 4);
+    if (rc != SSH_OK) {
+        forwarder_socks_reply(conn, FORWARDER_SOCKS4_REJECTED);
+        return SSH_ERROR;
+    }
+    forwarder_socks_consume(socks, user_end + 1 - buf);
+
+    return SSH_OK;
+}
+
+/*
+ * SOCKS5 (RFC 1928): a greeting VER NMETHODS METHODS, answered with the
+ * method without authentication, then a request VER CMD RSV ATYP DST.ADDR
+ * DST.PORT. The client may send both at once.
+ */
+static int forwarder_socks5_parse(struct ssh_forwarder_conn *conn)
+{
+    struct ssh_forwarder_socks *socks = conn->socks;
+    uint8_t *buf = socks->buf;
+    uint8_t method[2] = {5, 0};
+    size_t addrlen;
+    size_t len;
+    int family = AF_INET;
+    int rc;
+
+    if (!socks->greeted) {
+        if (socks->len < 2) {
+            return SSH_AGAIN;
+        }
+        len = 2 + (size_t)buf[1];
+        if (socks->len < len) {
+            return SSH_AGAIN;
+        }
+        if (memchr(buf + 2, 0, buf[1]) == NULL) {
+            /* no acceptable method */
+            method[1] = 0xff;
+            forwarder_socks_send(conn, method, sizeof(method));
+            return SSH_ERROR;
+        }
+        rc = forwarder_socks_send(conn, method, sizeof(method));
+        if (rc != SSH_OK) {
+            return SSH_ERROR;
+        }
+        forwarder_socks_consume(socks, len);
+        socks->greeted = true;
+    }
+
+    if (socks->len < 5) {
+        return SSH_AGAIN;
+    }
+    if (buf[0] != 5) {
+        forwarder_socks_reply(conn, FORWARDER_SOCKS5_FAILURE);
+        return SSH_ERROR;
+    }
+    /* CONNECT only */
+    if (buf[1] != 1) {
+        forwarder_socks_reply(conn, FORWARDER_SOCKS5_CMD_UNSUPPORTED);
+        return SSH_ERROR;
+    }
+    switch (buf[3]) {
+    case 1:
+        addrlen = 4;
+        len = 4 + addrlen + 2;
+        break;
+    case 3:
+        addrlen = buf[4];
+        len = 5 + addrlen + 2;
+        break;
+    case 4:
+        family = AF_INET6;
+        addrlen = 16;
+        len = 4 + addrlen + 2;
+        break;
+    default:
+        forwarder_socks_reply(conn, FORWARDER_SOCKS5_ATYP_UNSUPPORTED);
+        return SSH_ERROR;
+    }
+    if (socks->len < len) {
+        return SSH_AGAIN;
+    }
+
+    if (buf[3] == 3) {
+        if (addrlen == 0) {
+            forwarder_socks_reply(conn, FORWARDER_SOCKS5_FAILURE);
+            return SSH_ERROR;
+        }
+        memcpy(socks->host, buf + 5, addrlen);
+        socks->host[addrlen] = '\0';
+    } else {
+        rc = forwarder_socks_numeric_host(socks, family, buf + 4);
+        if (rc != SSH_OK) {
+            forwarder_socks_reply(conn, FORWARDER_SOCKS5_FAILURE);
+            return SSH_ERROR;
+        }
+    }
+    socks->port = (buf[len - 2] << 8) | buf[len - 1];
+    forwarder_socks_consume(socks, len);
+
+    return SSH_OK;
+}
+
+/*
+ * Read the SOCKS request of a client, and ask for its channel once the
+ * request is complete. What the client sends after the request without
+ * waiting for the answer is kept until the channel is open.
+ */
+static void forwarder_socks_read(struct ssh_forwarder_conn *conn)
+{
+    struct ssh_forwarder_socks *socks = conn->socks;
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    ssize_t r;
+    int rc;
+
+    r = recv(conn->fd,
+             (void *)(socks->buf + socks->len),
+             FORWARDER_SOCKS_MAX - socks->len,
+             0);
+    if (r < 0) {
+        if (!forwarder_would_block()) {
+            forwarder_conn_done(conn);
+        }
+        return;
+    }
+    if (r == 0) {
+        /* gone before asking for anything */
+        forwarder_conn_done(conn);
+        return;
+    }
+    if (socks->len == 0 && socks->version == 0) {
+        socks->version = socks->buf[0];
+    }
+    socks->len += r;
+
+    switch (socks->version) {
+    case 4:
+        rc = forwarder_socks4_parse(conn);
+        break;
+    case 5:
+        rc = forwarder_socks5_parse(conn);
+        break;
+    default:
+        SSH_LOG(SSH_LOG_RARE, "Unknown SOCKS version %d", socks->version);
+        rc = SSH_ERROR;
+        break;
+    }
+    if (rc == SSH_AGAIN && socks->len == FORWARDER_SOCKS_MAX) {
+        SSH_LOG(SSH_LOG_RARE, "SOCKS request too long");
+        rc = SSH_ERROR;
+    }
+    if (rc == SSH_AGAIN) {
+        return;
+    }
+    if (rc == SSH_ERROR) {
+        forwarder_conn_done(conn);
+        return;
+    }
+
+    SSH_LOG(SSH_LOG_PROTOCOL,
+            "SOCKS%d connection to %s:%d",
+            socks->version,
+            socks->host,
+            socks->port);
+
+    if (getpeername(conn->fd, (struct sockaddr *)&addr, &addrlen) != 0) {
+        addrlen = 0;
+    }
+    rc = forwarder_conn_open(conn,
+                             socks->host,
+                             socks->port,
+                             (struct sockaddr *)&addr,
+                             addrlen);
+    if (rc != SSH_OK) {
+        forwarder_socks_reply(conn,
+                              socks->version == 4 ?
+                              FORWARDER_SOCKS4_REJECTED :
+                              FORWARDER_SOCKS5_FAILURE);
+        forwarder_conn_done(conn);
+    }
+}
+
+/* Send on the open channel what the client sent along with its request */
+static int forwarder_socks_flush(struct ssh_forwarder_conn *conn)
+{
+    struct ssh_forwarder_socks *socks = conn->socks;
+    uint32_t len;
+    int w;
+
+    len = MIN(socks->len, conn->channel->remote_window);
+    if (len > 0) {
+        w = channel_write_nowait(conn->channel, socks->buf, len);
+        if (w != (int)len) {
+            return SSH_ERROR;
+        }
+        forwarder_socks_consume(socks, len);
+    }
+    if (socks->len == 0) {
+        SAFE_FREE(conn->socks);
+    }
+
+    return SSH_OK;
+}
+
+/* Follow the events the connection can handle now */
+static void forwarder_conn_update(struct ssh_forwarder_conn *conn)
+{
+    short events = 0;
+
+    if (conn->state != SSH_FORWARDER_CONN_OPEN) {
+        return;
+    }
+
+    if (conn->socks != NULL && forwarder_socks_flush(conn) != SSH_OK) {
+        forwarder_conn_done(conn);
+        return;
+    }
+    if (conn->shut && (conn->local_eof || conn->remote_closed)) {
+        forwarder_conn_done(conn);
+        return;
+    }
+
+    if (conn->socks == NULL && !conn->local_eof && !conn->remote_closed &&
+        conn->channel->remote_window > 0) {
+        events |= POLLIN;
+    }
+    if (ssh_buffer_get_len(conn->channel->stdout_buffer) > 0) {
+        events |= POLLOUT;
+    }
+    ssh_poll_set_events(conn->poll, events);
+}
+
+static int forwarder_conn_fd_cb(ssh_poll_handle p,
+                                socket_t fd,
+                                int revents,
+                                void *userdata)
+{
+    struct ssh_forwarder_conn *conn = userdata;
+
+    (void)fd;
+
+    if (conn->state == SSH_FORWARDER_CONN_SOCKS) {
+#ifdef WITH_SERVER
+        if (conn->control && forwarder_mux_detect(conn)) {
+            /* the socket belongs to the multiplexed session now */
+            ssh_poll_free(p);
+            conn->poll = NULL;
+            conn->fd = SSH_INVALID_SOCKET;
+            forwarder_conn_done(conn);
+            return -1;
+        }
+#endif /* WITH_SERVER */
+        forwarder_socks_read(conn);
+        return 0;
+    }
+    if (conn->state == SSH_FORWARDER_CONN_OPENING &&
+        (revents & (POLLERR | POLLHUP))) {
+        /*
+         * The client is gone before the channel could be opened. The handle
+         * is freed now so it does not report the error again, the connection
+         * is finished once the server answered.
+         */
+        ssh_poll_free(p);
+        conn->poll = NULL;
+        return -1;
+    }
+    if (conn->state != SSH_FORWARDER_CONN_OPEN) {
+        return 0;
+    }
+
+    if (revents & POLLOUT) {
+        if (forwarder_conn_flush(conn) != SSH_OK) {
+            forwarder_conn_done(conn);
+            return 0;
+        }
+    }
+    if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        if (!conn->local_eof && !conn->remote_closed) {
+            forwarder_conn_read(conn);
+        } else if (revents & (POLLHUP | POLLERR)) {
+            forwarder_conn_done(conn);
+        }
+    }
+    forwarder_conn_update(conn);
+
+    return 0;
+}
+
+static int forwarder_channel_data_cb(ssh_session session,
+                                     ssh_channel channel,
+                                     void *data,
+                                     uint32_t len,
+                                     int is_stderr,
+                                     void *userdata)
+{
+    struct ssh_forwarder_conn *conn = userdata;
+    ssize_t w;
+
+    (void)session;
+    (void)channel;
+
+    /* direct-tcpip channels have no stderr, drop it like the rest */
+    if (is_stderr || conn->state != SSH_FORWARDER_CONN_OPEN) {
+        return len;
+    }
+
+    w = send(conn->fd, data, len, MSG_NOSIGNAL);
+    if (w < 0) {
+        if (!forwarder_would_block()) {
+            forwarder_conn_done(conn);
+            return len;
+        }
+        w = 0;
+    }
+    /* the rest stays in the channel, and its window, until POLLOUT */
+    if ((uint32_t)w < len) {
+        ssh_poll_add_events(conn->poll, POLLOUT);
+    }
+
+    return (int)w;
+}
+
+static void forwarder_channel_eof_cb(ssh_session session,
+                                     ssh_channel channel,
+                                     void *userdata)
+{
+    struct ssh_forwarder_conn *conn = userdata;
+
+    (void)session;
+    (void)channel;
+
+    conn->remote_eof = true;
+    if (conn->state != SSH_FORWARDER_CONN_OPEN) {
+        return;
+    }
+    if (forwarder_conn_flush(conn) != SSH_OK) {
+        forwarder_conn_done(conn);
+        return;
+    }
+    forwarder_conn_update(conn);
+}
+
+static void forwarder_channel_close_cb(ssh_session session,
+                                       ssh_channel channel,
+                                       void *userdata)
+{
+    struct ssh_forwarder_conn *conn = userdata;
+
+    conn->remote_closed = true;
+    forwarder_channel_eof_cb(session, channel, userdata);
+}
+
+static int forwarder_channel_write_wontblock_cb(ssh_session session,
+                                                ssh_channel channel,
+                                                size_t bytes,
+                                                void *userdata)
+{
+    struct ssh_forwarder_conn *conn = userdata;
+
+    (void)session;
+    (void)channel;
+    (void)bytes;
+
+    forwarder_conn_update(conn);
+
+    return 0;
+}
+
+static void forwarder_channel_open_response_cb(ssh_session session,
+                                               ssh_channel channel,
+                                               int is_success,
+                                               void *userdata)
+{
+    struct ssh_forwarder_conn *conn = userdata;
+    int rc;
+
+    (void)session;
+    (void)channel;
+
+    if (conn->state != SSH_FORWARDER_CONN_OPENING) {
+        return;
+    }
+    if (!is_success || conn->poll == NULL) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Forwarded connection on fd %d not opened",
+                conn->fd);
+        if (conn->socks != NULL && conn->poll != NULL) {
+            forwarder_socks_reply(conn,
+                                  conn->socks->version == 4 ?
+                                  FORWARDER_SOCKS4_REJECTED :
+                                  FORWARDER_SOCKS5_REFUSED);
+        }
+        forwarder_conn_done(conn);
+        return;
+    }
+    if (conn->socks != NULL) {
+        rc = forwarder_socks_reply(conn,
+                                   conn->socks->version == 4 ?
+                                   FORWARDER_SOCKS4_GRANTED :
+                                   FORWARDER_SOCKS5_SUCCEEDED);
+        if (rc != SSH_OK) {
+            forwarder_conn_done(conn);
+            return;
+        }
+    }
+
+    conn->state = SSH_FORWARDER_CONN_OPEN;
+    forwarder_conn_update(conn);
+}
+
+static int forwarder_conn_new(struct ssh_forwarder_listener *listener,
+                              socket_t fd,
+                              struct sockaddr *addr,
+                              socklen_t addrlen)
+{
+    ssh_forwarder forwarder = listener->forwarder;
+    ssh_session session = forwarder->session;
+    struct ssh_forwarder_conn *conn;
+    int rc;
+
+    conn = calloc(1, sizeof(struct ssh_forwarder_conn));
+    if (conn == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    conn->forwarder = forwarder;
+    conn->fd = fd;
+    conn->state = SSH_FORWARDER_CONN_SOCKS;
+    conn->control = listener->path != NULL;
+
+    conn->channel = ssh_channel_new(session);
+    if (conn->channel == NULL) {
+        goto error;
+    }
+
+    ssh_callbacks_init(&conn->channel_cb);
+    conn->channel_cb.userdata = conn;
+    conn->channel_cb.channel_data_function = forwarder_channel_data_cb;
+    conn->channel_cb.channel_eof_function = forwarder_channel_eof_cb;
+    conn->channel_cb.channel_close_function = forwarder_channel_close_cb;
+    conn->channel_cb.channel_write_wontblock_function =
+        forwarder_channel_write_wontblock_cb;
+    conn->channel_cb.channel_open_response_function =
+        forwarder_channel_open_response_cb;
+    rc = ssh_add_channel_callbacks(conn->channel, &conn->channel_cb);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    conn->poll = ssh_poll_new(fd, POLLIN, forwarder_conn_fd_cb, conn);
+    if (conn->poll == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    rc = ssh_event_add_poll(forwarder->event, conn->poll);
+    if (rc < 0) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    if (listener->remote_host == NULL) {
+        /* the destination is given by the SOCKS request */
+        conn->socks = calloc(1, sizeof(struct ssh_forwarder_socks));
+        if (conn->socks == NULL) {
+            ssh_set_error_oom(session);
+            goto error;
+        }
+    } else {
+        rc = forwarder_conn_open(conn,
+                                 listener->remote_host,
+                                 listener->remote_port,
+                                 addr,
+                                 addrlen);
+        if (rc != SSH_OK) {
+            goto error;
+        }
+    }
+
+    conn->next = forwarder->conns;
+    if (conn->next != NULL) {
+        conn->next->prev = conn;
+    }
+    forwarder->conns = conn;
+    forwarder->nconns++;
+
+    return SSH_OK;
+
+error:
+    /* the socket is closed by the caller */
+    conn->fd = SSH_INVALID_SOCKET;
+    forwarder_conn_free(conn);
+
+    return SSH_ERROR;
+}
+
+static void forwarder_listener_free(struct ssh_forwarder_listener *listener)
+{
+    if (listener->poll != NULL) {
+        ssh_poll_free(listener->poll);
+    }
+    CLOSE_SOCKET(listener->fd);
+#ifndef _WIN32
+    if (listener->path != NULL) {
+        unlink(listener->path);
+    }
+#endif
+    SAFE_FREE(listener->path);
+    SAFE_FREE(listener->remote_host);
+    free(listener);
+}
+
+/*
+ * Only the user of the forwarder, or root, may use a control socket. The
+ * mode of the socket already says so, this does not depend on it.
+ */
+static bool forwarder_control_peer_allowed(socket_t fd)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        SSH_LOG(SSH_LOG_RARE,
+                "Could not get the peer of the control socket: %s",
+                strerror(errno));
+        return false;
+    }
+    if (cred.uid != 0 && cred.uid != geteuid()) {
+        SSH_LOG(SSH_LOG_RARE,
+                "Refused a control connection of uid %u",
+                (unsigned int)cred.uid);
+        return false;
+    }
+#elif defined(HAVE_GETPEEREID)
+    uid_t uid;
+    gid_t gid;
+
+    if (getpeereid(fd, &uid, &gid) != 0) {
+        SSH_LOG(SSH_LOG_RARE,
+                "Could not get the peer of the control socket: %s",
+                strerror(errno));
+        return false;
+    }
+    if (uid != 0 && uid != geteuid()) {
+        SSH_LOG(SSH_LOG_RARE,
+                "Refused a control connection of uid %u",
+                (unsigned int)uid);
+        return false;
+    }
+#else
+    (void)fd;
+#endif
+
+    return true;
+}
+
+static int forwarder_listener_cb(ssh_poll_handle p,
+                                 socket_t fd,
+                                 int revents,
+                                 void *userdata)
+{
+    struct ssh_forwarder_listener *listener = userdata;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    socket_t s;
+    int rc;
+    int i;
+
+    (void)revents;
+
+    for (i = 0; i < FORWARDER_ACCEPT_MAX; i++) {
+        addrlen = sizeof(addr);
+        s = accept(fd, (struct sockaddr *)&addr, &addrlen);
+        if (s == SSH_INVALID_SOCKET) {
+            if (forwarder_out_of_resources()) {
+                /*
+                 * The pending connection stays in the backlog and the socket
+                 * readable, stop polling it for a while instead of spinning.
+                 */
+                SSH_LOG(SSH_LOG_RARE,
+                        "Accepting a forwarded connection failed: %s, "
+                        "retrying in %d ms",
+                        strerror(errno),
+                        FORWARDER_ACCEPT_BACKOFF);
+                ssh_poll_set_events(p, 0);
+                listener->paused = true;
+                ssh_timestamp_init(&listener->paused_at);
+                listener->forwarder->npaused++;
+            } else if (!forwarder_would_block()) {
+                SSH_LOG(SSH_LOG_RARE,
+                        "Accepting a forwarded connection failed: %s",
+                        strerror(errno));
+            }
+            break;
+        }
+
+#ifndef _WIN32
+        if (listener->path != NULL && !forwarder_control_peer_allowed(s)) {
+            CLOSE_SOCKET(s);
+            continue;
+        }
+#endif
+
+        ssh_socket_set_nonblocking(s);
+        rc = forwarder_conn_new(listener,
+                                s,
+                                (struct sockaddr *)&addr,
+                                addrlen);
+        if (rc != SSH_OK) {
+            SSH_LOG(SSH_LOG_RARE,
+                    "Could not forward a connection: %s",
+                    ssh_get_error(listener->forwarder->session));
+            CLOSE_SOCKET(s);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Create a forwarder of local ports over a session.
+ *
+ * The session must be connected and authenticated. It is put in nonblocking
+ * mode until the forwarder is freed, and it must not be used from anywhere
+ * else in the meantime.
+ *
+ * The forwarded connections are often interactive, SSH_OPTIONS_NODELAY should
+ * be set on the session before it is connected.
+ *
+ * @param[in]  session  The session to forward the connections over.
+ *
+ * @return              A new forwarder, NULL on error.
+ *
+ * @see ssh_forwarder_listen()
+ * @see ssh_forwarder_listen_dynamic()
+ * @see ssh_forwarder_listen_control()
+ * @see ssh_forwarder_dopoll()
+ */
+ssh_forwarder ssh_forwarder_new(ssh_session session)
+{
+    ssh_forwarder forwarder;
+    int rc;
+
+    if (session == NULL) {
+        return NULL;
+    }
+
+    forwarder = calloc(1, sizeof(struct ssh_forwarder_struct));
+    if (forwarder == NULL) {
+        ssh_set_error_oom(session);
+        return NULL;
+    }
+    forwarder->session = session;
+
+    forwarder->event = ssh_event_new();
+    if (forwarder->event == NULL) {
+        ssh_set_error_oom(session);
+        free(forwarder);
+        return NULL;
+    }
+    rc = ssh_event_add_session(forwarder->event, session);
+    if (rc != SSH_OK) {
+        ssh_set_error(session, SSH_FATAL, "The session is not connected");
+        ssh_event_free(forwarder->event);
+        free(forwarder);
+        return NULL;
+    }
+
+    forwarder->was_blocking = ssh_is_blocking(session);
+    ssh_set_blocking(session, 0);
+
+    return forwarder;
+}
+
+/**
+ * @brief Free a forwarder, closing its listening sockets and the connections
+ * it forwards.
+ *
+ * The session is given its previous blocking mode back.
+ *
+ * @param[in]  forwarder  The forwarder to free.
+ */
+void ssh_forwarder_free(ssh_forwarder forwarder)
+{
+    struct ssh_forwarder_listener *listener;
+
+    if (forwarder == NULL) {
+        return;
+    }
+
+    while (forwarder->listeners != NULL) {
+        listener = forwarder->listeners;
+        forwarder->listeners = listener->next;
+        forwarder_listener_free(listener);
+    }
+
+    while (forwarder->conns != NULL) {
+        forwarder_conn_done(forwarder->conns);
+    }
+    forwarder_reap(forwarder);
+
+#ifdef WITH_SERVER
+    while (forwarder->muxes != NULL) {
+        struct ssh_forwarder_mux *mux = forwarder->muxes;
+
+        forwarder->muxes = mux->next;
+        forwarder_mux_free(mux);
+    }
+    ssh_bind_free(forwarder->bind);
+#endif /* WITH_SERVER */
+
+    ssh_event_remove_session(forwarder->event, forwarder->session);
+    ssh_event_free(forwarder->event);
+    ssh_set_blocking(forwarder->session, forwarder->was_blocking);
+
+    free(forwarder);
+}
+
+/* Accept the connections of a listening socket from now on */
+static int forwarder_listener_start(struct ssh_forwarder_listener *listener)
+{
+    ssh_forwarder forwarder = listener->forwarder;
+    int rc;
+
+    ssh_socket_set_nonblocking(listener->fd);
+
+    listener->poll = ssh_poll_new(listener->fd,
+                                  POLLIN,
+                                  forwarder_listener_cb,
+                                  listener);
+    if (listener->poll == NULL) {
+        ssh_set_error_oom(forwarder->session);
+        return SSH_ERROR;
+    }
+    rc = ssh_event_add_poll(forwarder->event, listener->poll);
+    if (rc < 0) {
+        ssh_set_error_oom(forwarder->session);
+        return SSH_ERROR;
+    }
+
+    listener->next = forwarder->listeners;
+    forwarder->listeners = listener;
+
+    return SSH_OK;
+}
+
+/* Listen on a local port, for a SOCKS proxy when remote_host is NULL */
+static int forwarder_listener_new(ssh_forwarder forwarder,
+                                  const char *address,
+                                  int port,
+                                  const char *remote_host,
+                                  int remote_port,
+                                  int *bound_port)
+{
+    ssh_session session = forwarder->session;
+    struct ssh_forwarder_listener *listener = NULL;
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    struct addrinfo hints;
+    struct addrinfo *ai = NULL;
+    char port_c[6];
+    int opt = 1;
+    int rc;
+
+    if (port < 0 || port > 65535) {
+        ssh_set_error_invalid(session);
+        return SSH_ERROR;
+    }
+    if (address == NULL) {
+        address = "localhost";
+    }
+
+    listener = calloc(1, sizeof(struct ssh_forwarder_listener));
+    if (listener == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    listener->forwarder = forwarder;
+    listener->fd = SSH_INVALID_SOCKET;
+    listener->remote_port = remote_port;
+    if (remote_host != NULL) {
+        listener->remote_host = strdup(remote_host);
+        if (listener->remote_host == NULL) {
+            ssh_set_error_oom(session);
+            goto error;
+        }
+    }
+
+    ZERO_STRUCT(hints);
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_socktype = SOCK_STREAM;
+
+    snprintf(port_c, sizeof(port_c), "%d", port);
+    rc = getaddrinfo(address, port_c, &hints, &ai);
+    if (rc != 0) {
+        ssh_set_error(session,
+                      SSH_FATAL,
+                      "Resolving %s: %s", address, gai_strerror(rc));
+        goto error;
+    }
+
+    listener->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (listener->fd == SSH_INVALID_SOCKET) {
+        ssh_set_error(session, SSH_FATAL, "%s", strerror(errno));
+        goto error;
+    }
+    if (setsockopt(listener->fd, SOL_SOCKET, SO_REUSEADDR,
+                   (char *)&opt, sizeof(opt)) < 0) {
+        ssh_set_error(session,
+                      SSH_FATAL,
+                      "Setting socket options failed: %s",
+                      strerror(errno));
+        goto error;
+    }
+    if (bind(listener->fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        ssh_set_error(session,
+                      SSH_FATAL,
+                      "Binding to %s:%d: %s",
+                      address,
+                      port,
+                      strerror(errno));
+        goto error;
+    }
+    if (listen(listener->fd, SOMAXCONN) != 0) {
+        ssh_set_error(session,
+                      SSH_FATAL,
+                      "Listening to %s:%d: %s",
+                      address,
+                      port,
+                      strerror(errno));
+        goto error;
+    }
+
+    if (bound_port != NULL) {
+        rc = getsockname(listener->fd, (struct sockaddr *)&addr, &addrlen);
+        if (rc != 0) {
+            ssh_set_error(session, SSH_FATAL, "%s", strerror(errno));
+            goto error;
+        }
+        if (addr.ss_family == AF_INET6) {
+            *bound_port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+        } else {
+            *bound_port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+        }
+    }
+
+    rc = forwarder_listener_start(listener);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+    freeaddrinfo(ai);
+
+    return SSH_OK;
+
+error:
+    if (ai != NULL) {
+        freeaddrinfo(ai);
+    }
+    forwarder_listener_free(listener);
+
+    return SSH_ERROR;
+}
+
+/**
+ * @brief Listen on a local port and forward its connections to a host and
+ * port reached from the server.
+ *
+ * This is the equivalent of ssh -L [address:]port:remote_host:remote_port.
+ * Several ports may be forwarded by the same forwarder.
+ *
+ * @param[in]  forwarder   The forwarder.
+ *
+ * @param[in]  address     The local address to listen on, NULL for
+ *                         "localhost". Only the first address it resolves
+ *                         to is used.
+ *
+ * @param[in]  port        The local port to listen on, 0 for any.
+ *
+ * @param[in]  remote_host The host the server connects to.
+ *
+ * @param[in]  remote_port The port the server connects to.
+ *
+ * @param[out] bound_port  A pointer to get the local port, or NULL.
+ *
+ * @return                 SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_forwarder_listen(ssh_forwarder forwarder,
+                         const char *address,
+                         int port,
+                         const char *remote_host,
+                         int remote_port,
+                         int *bound_port)
+{
+    if (forwarder == NULL) {
+        return SSH_ERROR;
+    }
+    if (remote_host == NULL) {
+        ssh_set_error_invalid(forwarder->session);
+        return SSH_ERROR;
+    }
+
+    return forwarder_listener_new(forwarder,
+                                  address,
+                                  port,
+                                  remote_host,
+                                  remote_port,
+                                  bound_port);
+}
+
+/**
+ * @brief Listen on a local port for SOCKS clients, and forward their
+ * connections to the hosts and ports they ask for.
+ *
+ * This is the equivalent of ssh -D [address:]port. SOCKS4, SOCKS4a and
+ * SOCKS5 without authentication are understood, with the CONNECT command
+ * only. A client may send its data right after its request without waiting
+ * for the answer.
+ *
+ * @param[in]  forwarder   The forwarder.
+ *
+ * @param[in]  address     The local address to listen on, NULL for
+ *                         "localhost". Only the first address it resolves
+ *                         to is used.
+ *
+ * @param[in]  port        The local port to listen on, 0 for any.
+ *
+ * @param[out] bound_port  A pointer to get the local port, or NULL.
+ *
+ * @return                 SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_forwarder_listen_dynamic(ssh_forwarder forwarder,
+                                 const char *address,
+                                 int port,
+                                 int *bound_port)
+{
+    if (forwarder == NULL) {
+        return SSH_ERROR;
+    }
+
+    return forwarder_listener_new(forwarder,
+                                  address,
+                                  port,
+                                  NULL,
+                                  0,
+                                  bound_port);
+}
+
+/**
+ * @brief Listen on a control socket, through which other processes reach
+ * hosts from the server without a session of their own.
+ *
+ * This is the equivalent of the ssh ControlMaster. The other processes
+ * either set SSH_OPTIONS_CONTROL_PATH on their sessions, which ssh_connect()
+ * then connects through the session of the forwarder, or reach hosts with
+ * ssh_forwarder_connect_control() or any SOCKS5 client which can connect to
+ * a Unix socket.
+ *
+ * The socket is only accessible by the user, and removed when the forwarder
+ * is freed. It is created under a temporary name in the same directory and
+ * renamed once its mode is 0600, so its path must leave room for 9 more
+ * characters. The connections of other users are refused where the peer can
+ * be identified (SO_PEERCRED or getpeereid()), except the ones of root. It
+ * is not supported on Windows.
+ *
+ * A session connected through the control socket needs neither a key
+ * exchange with the server nor an authentication: its authentication always
+ * succeeds, and its session and direct-tcpip channels are opened over the
+ * session of the forwarder, with their pty, env, exec, shell, subsystem,
+ * window-change and signal requests, their data and their exit status. X11
+ * and agent forwarding are not multiplexed. This needs libssh built with
+ * the server support, without it the control socket only serves SOCKS.
+ *
+ * @param[in]  forwarder  The forwarder.
+ *
+ * @param[in]  path       The path of the Unix socket to create.
+ *
+ * @return                SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see ssh_forwarder_connect_control()
+ */
+int ssh_forwarder_listen_control(ssh_forwarder forwarder, const char *path)
+{
+#ifdef _WIN32
+    if (forwarder == NULL) {
+        return SSH_ERROR;
+    }
+    (void)path;
+    ssh_set_error(forwarder->session,
+                  SSH_FATAL,
+                  "Control sockets are not supported on this platform");
+
+    return SSH_ERROR;
+#else
+    ssh_session session;
+    struct ssh_forwarder_listener *listener = NULL;
+    struct sockaddr_un addr;
+    char tmp_path[sizeof(addr.sun_path)];
+    uint32_t suffix = 0;
+    int rc;
+
+    if (forwarder == NULL) {
+        return SSH_ERROR;
+    }
+    session = forwarder->session;
+    if (path == NULL || strlen(path) + 9 >= sizeof(addr.sun_path)) {
+        ssh_set_error_invalid(session);
+        return SSH_ERROR;
+    }
+#ifdef WITH_SERVER
+    rc = forwarder_mux_bind(forwarder);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+#endif /* WITH_SERVER */
+
+    listener = calloc(1, sizeof(struct ssh_forwarder_listener));
+    if (listener == NULL) {
+        ssh_set_error_oom(session);
+        return SSH_ERROR;
+    }
+    listener->forwarder = forwarder;
+
+    /*
+     * The umask is process wide, so the socket is bound to a temporary name
+     * and made private before it listens and takes its name. Nobody can
+     * connect to it before it listens.
+     */
+    ssh_get_random(&suffix, sizeof(suffix), 0);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%08x", path, suffix);
+
+    ZERO_STRUCT(addr);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", tmp_path);
+
+    listener->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener->fd == SSH_INVALID_SOCKET) {
+        ssh_set_error(session, SSH_FATAL, "%s", strerror(errno));
+        goto error;
+    }
+    rc = bind(listener->fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (rc != 0) {
+        ssh_set_error(session,
+                      SSH_FATAL,
+                      "Binding to %s: %s",
+                      tmp_path,
+                      strerror(errno));
+        goto error;
+    }
+    if (chmod(tmp_path, S_IRUSR | S_IWUSR) != 0 ||
+        listen(listener->fd, SOMAXCONN) != 0 ||
+        rename(tmp_path, path) != 0) {
+        ssh_set_error(session,
+                      SSH_FATAL,
+                      "Listening to %s: %s",
+                      path,
+                      strerror(errno));
+        unlink(tmp_path);
+        goto error;
+    }
+    listener->path = strdup(path);
+    if (listener->path == NULL) {
+        unlink(path);
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    rc = forwarder_listener_start(listener);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    return SSH_OK;
+
+error:
+    forwarder_listener_free(listener);
+
+    return SSH_ERROR;
+#endif /* _WIN32 */
+}
+
+/**
+ * @internal
+ *
+ * @brief Connect to the control socket of a forwarder.
+ *
+ * The forwarder must be run by the same user, or by root.
+ *
+ * @param[in]  path       The path of the control socket.
+ *
+ * @return                The connected socket, SSH_INVALID_SOCKET if no
+ *                        forwarder of the user listens there.
+ */
+socket_t ssh_forwarder_control_open(const char *path)
+{
+#ifdef _WIN32
+    (void)path;
+
+    return SSH_INVALID_SOCKET;
+#else
+    struct sockaddr_un addr;
+    socket_t fd;
+
+    if (path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+        return SSH_INVALID_SOCKET;
+    }
+
+    ZERO_STRUCT(addr);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == SSH_INVALID_SOCKET) {
+        return SSH_INVALID_SOCKET;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Connecting to %s: %s",
+                path,
+                strerror(errno));
+        CLOSE_SOCKET(fd);
+        return SSH_INVALID_SOCKET;
+    }
+    /* the same check as the forwarder does, the other way round */
+    if (!forwarder_control_peer_allowed(fd)) {
+        CLOSE_SOCKET(fd);
+        return SSH_INVALID_SOCKET;
+    }
+
+    return fd;
+#endif /* _WIN32 */
+}
+
+/**
+ * @brief Connect to a host and port through the control socket of a
+ * forwarder, running in another process.
+ *
+ * Neither a connection to the server nor a key exchange nor an
+ * authentication is needed: the channel is opened over the session of the
+ * forwarder. This blocks until the channel is open or was refused.
+ *
+ * @param[in]  path       The path of the control socket.
+ *
+ * @param[in]  host       The host the server connects to.
+ *
+ * @param[in]  port       The port the server connects to.
+ *
+ * @return                A socket connected to the host, to be closed with
+ *                        close(), or SSH_INVALID_SOCKET on error.
+ *
+ * @see ssh_forwarder_listen_control()
+ */
+socket_t ssh_forwarder_connect_control(const char *path,
+                                       const char *host,
+                                       int port)
+{
+#ifdef _WIN32
+    (void)path;
+    (void)host;
+    (void)port;
+
+    return SSH_INVALID_SOCKET;
+#else
+    struct sockaddr_un addr;
+    uint8_t request[3 + 5 + 255 + 2];
+    uint8_t reply[2 + 10];
+    size_t request_len;
+    size_t host_len;
+    size_t received = 0;
+    ssize_t r;
+    socket_t fd;
+
+    if (path == NULL || strlen(path) >= sizeof(addr.sun_path) ||
+        host == NULL || port < 0 || port > 65535) {
+        return SSH_INVALID_SOCKET;
+    }
+    host_len = strlen(host);
+    if (host_len == 0 || host_len > 255) {
+        return SSH_INVALID_SOCKET;
+    }
+
+    /* the SOCKS5 greeting without authentication and the CONNECT at once */
+    request[0] = 5;
+    request[1] = 1;
+    request[2] = 0;
+    request[3] = 5;
+    request[4] = 1;
+    request[5] = 0;
+    request[6] = 3;
+    request[7] = (uint8_t)host_len;
+    memcpy(request + 8, host, host_len);
+    request[8 + host_len] = (uint8_t)(port >> 8);
+    request[9 + host_len] = (uint8_t)port;
+    request_len = 10 + host_len;
+
+    fd = ssh_forwarder_control_open(path);
+    if (fd == SSH_INVALID_SOCKET) {
+        return SSH_INVALID_SOCKET;
+    }
+    r = send(fd, (void *)request, request_len, MSG_NOSIGNAL);
+    if (r != (ssize_t)request_len) {
+        goto error;
+    }
+
+    /* the method chosen, then the answer to the CONNECT */
+    while (received < sizeof(reply)) {
+        r = recv(fd, (void *)(reply + received), sizeof(reply) - received, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            SSH_LOG(SSH_LOG_RARE, "The control socket %s hung up", path);
+            goto error;
+        }
+        received += r;
+        if (received >= 2 && (reply[0] != 5 || reply[1] != 0)) {
+            goto error;
+        }
+    }
+    if (reply[2] != 5 || reply[3] != FORWARDER_SOCKS5_SUCCEEDED) {
+        SSH_LOG(SSH_LOG_RARE,
+                "Connecting to %s:%d through %s was refused (%d)",
+                host,
+                port,
+                path,
+                reply[3]);
+        goto error;
+    }
+
+    return fd;
+
+error:
+    CLOSE_SOCKET(fd);
+
+    return SSH_INVALID_SOCKET;
+#endif /* _WIN32 */
+}
+
+/*
+ * Poll again the listeners whose backoff is over. Returns the time until the
+ * next one is over in milliseconds, -1 if none is waiting.
+ */
+static int forwarder_listeners_resume(ssh_forwarder forwarder)
+{
+    struct ssh_forwarder_listener *listener;
+    int next = -1;
+    int left;
+
+    for (listener = forwarder->listeners;
+         listener != NULL && forwarder->npaused > 0;
+         listener = listener->next) {
+        if (!listener->paused) {
+            continue;
+        }
+        left = ssh_timeout_update(&listener->paused_at,
+                                  FORWARDER_ACCEPT_BACKOFF);
+        if (left == 0) {
+            ssh_poll_set_events(listener->poll, POLLIN);
+            listener->paused = false;
+            forwarder->npaused--;
+            continue;
+        }
+        if (next < 0 || left < next) {
+            next = left;
+        }
+    }
+
+    return next;
+}
+
+/**
+ * @brief Accept the connections and forward their data for a while.
+ *
+ * This should be called in a loop for as long as the ports are forwarded.
+ *
+ * @param[in]  forwarder  The forwarder.
+ *
+ * @param[in]  timeout    An upper limit on the time for which the poll will
+ *                        block, in milliseconds. Specifying a negative value
+ *                        means an infinite timeout.
+ *
+ * @return                SSH_OK on success, SSH_AGAIN if the timeout
+ *                        expired, SSH_ERROR if the session is lost.
+ */
+int ssh_forwarder_dopoll(ssh_forwarder forwarder, int timeout)
+{
+    ssh_session session;
+    int backoff = -1;
+    int rc;
+
+    if (forwarder == NULL) {
+        return SSH_ERROR;
+    }
+    session = forwarder->session;
+
+    if (forwarder->npaused > 0) {
+        backoff = forwarder_listeners_resume(forwarder);
+    }
+    if (backoff >= 0 && (timeout < 0 || backoff < timeout)) {
+        rc = ssh_event_dopoll(forwarder->event, backoff);
+        if (rc == SSH_AGAIN) {
+            /* a listener is polled again, not the timeout of the caller */
+            rc = SSH_OK;
+        }
+    } else {
+        rc = ssh_event_dopoll(forwarder->event, timeout);
+    }
+#ifdef WITH_SERVER
+    forwarder_mux_process(forwarder);
+#endif /* WITH_SERVER */
+    forwarder_reap(forwarder);
+    if (forwarder->npaused > 0) {
+        forwarder_listeners_resume(forwarder);
+    }
+
+    if (session->session_state == SSH_SESSION_STATE_ERROR ||
+        session->session_state == SSH_SESSION_STATE_DISCONNECTED) {
+        return SSH_ERROR;
+    }
+
+    return rc == SSH_AGAIN ? SSH_AGAIN : SSH_OK;
+}
+
+/**
+ * @brief Get the number of connections being forwarded.
+ *
+ * @param[in]  forwarder  The forwarder.
+ *
+ * @return                The number of connections whose channel is open or
+ *                        being opened.
+ */
+int ssh_forwarder_get_connections(ssh_forwarder forwarder)
+{
+    if (forwarder == NULL) {
+        return 0;
+    }
+
+    return forwarder->nconns;
+}
+
+/** @} */
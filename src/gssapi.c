@@ -23,6 +23,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -37,6 +39,7 @@
 #include <libssh/callbacks.h>
 #include <libssh/string.h>
 #include <libssh/server.h>
+#include <libssh/threads.h>
 
 /** current state of an GSSAPI authentication */
 enum ssh_gssapi_state_e {
@@ -61,9 +64,259 @@ struct ssh_gssapi_struct{
         gss_OID oid; /* mech being used for authentication */
         gss_cred_id_t creds; /* creds used to initialize context */
         gss_cred_id_t client_deleg_creds; /* delegated creds (const, not freeable) */
+        struct ssh_gssapi_cached_creds *cached; /* where creds come from */
     } client;
 };
 
+/*
+ * The credentials acquired for the clients are kept for the process, by
+ * client identity, so that the sessions after the first one neither read
+ * the credentials cache again nor look for the mechanisms they can use.
+ * Sharing the credentials also shares the service tickets the Kerberos
+ * mechanism obtains with them: they are stored along the TGT and found
+ * there by the next sessions to the same hosts.
+ *
+ * The credentials are dropped from the cache SSH_GSSAPI_CACHE_MARGIN
+ * seconds before they expire, and acquired again by the next session. A
+ * session holds a reference on the ones it uses until it is freed.
+ */
+#define SSH_GSSAPI_CACHE_SIZE 16
+#define SSH_GSSAPI_CACHE_MARGIN 60
+/* the longest they are kept, for those which never expire */
+#define SSH_GSSAPI_CACHE_LIFETIME 86400
+
+struct ssh_gssapi_cached_creds {
+    char *identity; /* NULL for the default one */
+    gss_cred_id_t creds;
+    gss_OID_set mechs; /* the mechanisms with a lifetime left */
+    time_t expires;
+    unsigned int refs; /* the cache and the sessions using them */
+};
+
+static struct ssh_gssapi_cached_creds *ssh_gssapi_cache[SSH_GSSAPI_CACHE_SIZE];
+static SSH_MUTEX ssh_gssapi_cache_mutex = SSH_MUTEX_STATIC_INIT;
+
+static void ssh_gssapi_log_error(int verb,
+                                 const char *msg,
+                                 int maj_stat,
+                                 int min_stat);
+
+/* must be called with ssh_gssapi_cache_mutex held */
+static void ssh_gssapi_cached_creds_unref(struct ssh_gssapi_cached_creds *c)
+{
+    OM_uint32 min_stat;
+
+    if (--c->refs > 0) {
+        return;
+    }
+
+    gss_release_cred(&min_stat, &c->creds);
+    gss_release_oid_set(&min_stat, &c->mechs);
+    SAFE_FREE(c->identity);
+    SAFE_FREE(c);
+}
+
+static int ssh_gssapi_identity_equal(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+
+    return strcmp(a, b) == 0;
+}
+
+/** @internal
+ * @brief Looks the credentials of an identity up in the cache.
+ *
+ * @returns a reference on the credentials, NULL if none are cached
+ */
+static struct ssh_gssapi_cached_creds *
+ssh_gssapi_cache_get(const char *identity)
+{
+    struct ssh_gssapi_cached_creds *found = NULL;
+    time_t now = time(NULL);
+    int i;
+
+    ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+    for (i = 0; i < SSH_GSSAPI_CACHE_SIZE; i++) {
+        struct ssh_gssapi_cached_creds *c = ssh_gssapi_cache[i];
+
+        if (c == NULL || !ssh_gssapi_identity_equal(c->identity, identity)) {
+            continue;
+        }
+        if (c->expires - SSH_GSSAPI_CACHE_MARGIN <= now) {
+            ssh_gssapi_cache[i] = NULL;
+            ssh_gssapi_cached_creds_unref(c);
+            continue;
+        }
+        c->refs++;
+        found = c;
+        break;
+    }
+    ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+
+    return found;
+}
+
+/** @internal
+ * @brief Adds freshly acquired credentials to the cache.
+ *
+ * @returns a reference on the credentials to use, which are the ones of
+ * another session if it added some for the identity meanwhile
+ */
+static struct ssh_gssapi_cached_creds *
+ssh_gssapi_cache_put(struct ssh_gssapi_cached_creds *creds)
+{
+    struct ssh_gssapi_cached_creds *c = NULL;
+    int victim = 0;
+    int i;
+
+    ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+    for (i = 0; i < SSH_GSSAPI_CACHE_SIZE; i++) {
+        c = ssh_gssapi_cache[i];
+        if (c == NULL) {
+            victim = i;
+            break;
+        }
+        if (ssh_gssapi_identity_equal(c->identity, creds->identity) &&
+            c->expires >= creds->expires) {
+            c->refs++;
+            ssh_gssapi_cached_creds_unref(creds);
+            ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+            return c;
+        }
+        /* the ones expiring first make room */
+        if (c->expires < ssh_gssapi_cache[victim]->expires) {
+            victim = i;
+        }
+    }
+    if (ssh_gssapi_cache[victim] != NULL) {
+        ssh_gssapi_cached_creds_unref(ssh_gssapi_cache[victim]);
+    }
+    creds->refs++;
+    ssh_gssapi_cache[victim] = creds;
+    ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+
+    return creds;
+}
+
+/** @internal
+ * @brief Acquires the credentials of the client identity of a session and
+ * adds them to the cache.
+ *
+ * @returns a reference on the credentials, NULL on error
+ */
+static struct ssh_gssapi_cached_creds *
+ssh_gssapi_cache_acquire(ssh_session session)
+{
+    struct ssh_gssapi_cached_creds *c = NULL;
+    OM_uint32 maj_stat, min_stat, lifetime, min_lifetime = GSS_C_INDEFINITE;
+    gss_OID_set actual_mechs = GSS_C_NO_OID_SET;
+    gss_buffer_desc namebuf;
+    gss_name_t client_id = GSS_C_NO_NAME;
+    gss_OID oid;
+    unsigned int i;
+    char *ptr;
+
+    c = calloc(1, sizeof(struct ssh_gssapi_cached_creds));
+    if (c == NULL) {
+        ssh_set_error_oom(session);
+        return NULL;
+    }
+    c->creds = GSS_C_NO_CREDENTIAL;
+    c->mechs = GSS_C_NO_OID_SET;
+    c->refs = 1;
+
+    if (session->opts.gss_client_identity != NULL) {
+        c->identity = strdup(session->opts.gss_client_identity);
+        if (c->identity == NULL) {
+            ssh_set_error_oom(session);
+            goto error;
+        }
+
+        namebuf.value = (void *)session->opts.gss_client_identity;
+        namebuf.length = strlen(session->opts.gss_client_identity);
+
+        maj_stat = gss_import_name(&min_stat, &namebuf,
+                                   GSS_C_NT_USER_NAME, &client_id);
+        if (GSS_ERROR(maj_stat)) {
+            goto error;
+        }
+    }
+
+    maj_stat = gss_acquire_cred(&min_stat, client_id, GSS_C_INDEFINITE,
+                                GSS_C_NO_OID_SET, GSS_C_INITIATE,
+                                &c->creds, &actual_mechs, NULL);
+    gss_release_name(&min_stat, &client_id);
+    if (GSS_ERROR(maj_stat)) {
+        ssh_gssapi_log_error(SSH_LOG_PROTOCOL,
+                             "acquiring credentials",
+                             maj_stat,
+                             min_stat);
+        goto error;
+    }
+
+    maj_stat = gss_create_empty_oid_set(&min_stat, &c->mechs);
+    if (GSS_ERROR(maj_stat)) {
+        goto error;
+    }
+
+    /* double check each single cred */
+    for (i = 0; i < actual_mechs->count; i++) {
+        /* check lifetime is not 0 or skip */
+        lifetime = 0;
+        oid = &actual_mechs->elements[i];
+        maj_stat = gss_inquire_cred_by_mech(&min_stat,
+                                            c->creds,
+                                            oid, NULL, &lifetime, NULL, NULL);
+        if (maj_stat == GSS_S_COMPLETE && lifetime > 0) {
+            gss_add_oid_set_member(&min_stat, oid, &c->mechs);
+            if (lifetime < min_lifetime) {
+                min_lifetime = lifetime;
+            }
+            ptr = ssh_get_hexa(oid->elements, oid->length);
+            SSH_LOG(SSH_LOG_DEBUG, "GSSAPI valid oid %d : %s", i, ptr);
+            SAFE_FREE(ptr);
+        }
+    }
+    gss_release_oid_set(&min_stat, &actual_mechs);
+
+    /* e.g. an expired TGT, a kinit later must not find them in the cache */
+    if (c->mechs->count == 0) {
+        ssh_set_error(session, SSH_REQUEST_DENIED,
+                      "No GSSAPI credentials with a lifetime left");
+        goto error;
+    }
+    if (min_lifetime > SSH_GSSAPI_CACHE_LIFETIME) {
+        min_lifetime = SSH_GSSAPI_CACHE_LIFETIME;
+    }
+    c->expires = time(NULL) + min_lifetime;
+
+    return ssh_gssapi_cache_put(c);
+
+error:
+    gss_release_oid_set(&min_stat, &actual_mechs);
+    ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+    ssh_gssapi_cached_creds_unref(c);
+    ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+
+    return NULL;
+}
+
+static struct ssh_gssapi_cached_creds *
+ssh_gssapi_cache_lookup(ssh_session session)
+{
+    struct ssh_gssapi_cached_creds *c = NULL;
+
+    c = ssh_gssapi_cache_get(session->opts.gss_client_identity);
+    if (c != NULL) {
+        SSH_LOG(SSH_LOG_DEBUG, "GSSAPI credentials found in the cache");
+        return c;
+    }
+
+    return ssh_gssapi_cache_acquire(session);
+}
+
 
 /** @internal
  * @initializes a gssapi context for authentication
@@ -87,14 +340,18 @@ static int ssh_gssapi_init(ssh_session session){
 /** @internal
  * @frees a gssapi context
  */
-static void ssh_gssapi_free(ssh_session session){
+void ssh_gssapi_free(ssh_session session){
     OM_uint32 min;
     if (session->gssapi == NULL)
         return;
     SAFE_FREE(session->gssapi->user);
     SAFE_FREE(session->gssapi->mech.elements);
     gss_release_cred(&min,&session->gssapi->server_creds);
-    if (session->gssapi->client.creds !=
+    if (session->gssapi->client.cached != NULL) {
+        ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+        ssh_gssapi_cached_creds_unref(session->gssapi->client.cached);
+        ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+    } else if (session->gssapi->client.creds !=
                     session->gssapi->client.client_deleg_creds) {
         gss_release_cred(&min, &session->gssapi->client.creds);
     }
@@ -587,6 +844,107 @@ void ssh_gssapi_set_creds(ssh_session session, const ssh_gssapi_creds creds)
     session->gssapi->client.client_deleg_creds = (gss_cred_id_t)creds;
 }
 
+/**
+ * @brief Acquire the GSSAPI credentials of a session and the service ticket
+ * of its server ahead of the authentication.
+ *
+ * ssh_userauth_gssapi() may block on the credentials cache and on the KDC,
+ * which an event loop driving many sessions in nonblocking mode cannot
+ * afford. Calling this from another thread first, e.g. while the session
+ * connects, leaves the authentication only the exchange with the server:
+ * the credentials are kept for the process by client identity, and the
+ * ticket of the server is stored with them by the Kerberos mechanism.
+ *
+ * @param[in] session   The session, with its host and its GSSAPI options
+ *                      set. It is only read, and may be used by another
+ *                      thread meanwhile.
+ *
+ * @returns SSH_OK on success, SSH_ERROR if no credentials could be acquired
+ *          or no context established with them.
+ *
+ * @see ssh_gssapi_cache_flush()
+ */
+int ssh_gssapi_prefetch(ssh_session session)
+{
+    struct ssh_gssapi_cached_creds *cached = NULL;
+    OM_uint32 maj_stat, min_stat;
+    gss_ctx_id_t ctx = GSS_C_NO_CONTEXT;
+    gss_name_t server_name = GSS_C_NO_NAME;
+    gss_buffer_desc hostname;
+    gss_buffer_desc output_token = GSS_C_EMPTY_BUFFER;
+    const char *gss_host = NULL;
+    char name_buf[256];
+
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+    gss_host = session->opts.gss_server_identity != NULL ?
+               session->opts.gss_server_identity : session->opts.host;
+    if (gss_host == NULL) {
+        ssh_set_error_invalid(session);
+        return SSH_ERROR;
+    }
+
+    cached = ssh_gssapi_cache_lookup(session);
+    if (cached == NULL) {
+        return SSH_ERROR;
+    }
+
+    snprintf(name_buf, sizeof(name_buf), "host@%s", gss_host);
+    hostname.value = name_buf;
+    hostname.length = strlen(name_buf) + 1;
+    maj_stat = gss_import_name(&min_stat, &hostname,
+                               (gss_OID)GSS_C_NT_HOSTBASED_SERVICE,
+                               &server_name);
+    if (maj_stat == GSS_S_COMPLETE) {
+        /* the first token is enough for the mechanism to get the ticket */
+        maj_stat = gss_init_sec_context(&min_stat,
+                                        cached->creds,
+                                        &ctx,
+                                        server_name,
+                                        GSS_C_NO_OID,
+                                        GSS_C_MUTUAL_FLAG | GSS_C_INTEG_FLAG,
+                                        0, NULL, GSS_C_NO_BUFFER, NULL,
+                                        &output_token, NULL, NULL);
+        gss_release_buffer(&min_stat, &output_token);
+        gss_delete_sec_context(&min_stat, &ctx, GSS_C_NO_BUFFER);
+        gss_release_name(&min_stat, &server_name);
+    }
+    if (GSS_ERROR(maj_stat)) {
+        ssh_gssapi_log_error(SSH_LOG_PROTOCOL,
+                             "prefetching the service ticket",
+                             maj_stat,
+                             min_stat);
+    }
+
+    ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+    ssh_gssapi_cached_creds_unref(cached);
+    ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+
+    return GSS_ERROR(maj_stat) ? SSH_ERROR : SSH_OK;
+}
+
+/**
+ * @brief Forget the GSSAPI credentials kept for the process.
+ *
+ * The next sessions acquire their credentials again, e.g. after a kinit
+ * for another principal. The sessions which already got credentials keep
+ * using them.
+ */
+void ssh_gssapi_cache_flush(void)
+{
+    int i;
+
+    ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+    for (i = 0; i < SSH_GSSAPI_CACHE_SIZE; i++) {
+        if (ssh_gssapi_cache[i] != NULL) {
+            ssh_gssapi_cached_creds_unref(ssh_gssapi_cache[i]);
+            ssh_gssapi_cache[i] = NULL;
+        }
+    }
+    ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+}
+
 static int ssh_gssapi_send_auth_mic(ssh_session session, ssh_string *oid_set, int n_oid){
     int rc;
     int i;
@@ -624,44 +982,38 @@ static int ssh_gssapi_match(ssh_session session, gss_OID_set *valid_oids)
 {
     OM_uint32 maj_stat, min_stat, lifetime;
     gss_OID_set actual_mechs;
-    gss_buffer_desc namebuf;
     gss_name_t client_id = GSS_C_NO_NAME;
+    struct ssh_gssapi_cached_creds *cached = NULL;
     gss_OID oid;
     unsigned int i;
     char *ptr;
     int ret;
 
     if (session->gssapi->client.client_deleg_creds == NULL) {
-        if (session->opts.gss_client_identity != NULL) {
-            namebuf.value = (void *)session->opts.gss_client_identity;
-            namebuf.length = strlen(session->opts.gss_client_identity);
-
-            maj_stat = gss_import_name(&min_stat, &namebuf,
-                                       GSS_C_NT_USER_NAME, &client_id);
-            if (GSS_ERROR(maj_stat)) {
-                ret = SSH_ERROR;
-                goto end;
-            }
+        cached = ssh_gssapi_cache_lookup(session);
+        if (cached == NULL) {
+            return SSH_ERROR;
         }
-
-        maj_stat = gss_acquire_cred(&min_stat, client_id, GSS_C_INDEFINITE,
-                                    GSS_C_NO_OID_SET, GSS_C_INITIATE,
-                                    &session->gssapi->client.creds,
-                                    &actual_mechs, NULL);
-        if (GSS_ERROR(maj_stat)) {
-            ret = SSH_ERROR;
-            goto end;
+        session->gssapi->client.cached = cached;
+        session->gssapi->client.creds = cached->creds;
+
+        gss_create_empty_oid_set(&min_stat, valid_oids);
+        for (i = 0; i < cached->mechs->count; i++) {
+            gss_add_oid_set_member(&min_stat,
+                                   &cached->mechs->elements[i],
+                                   valid_oids);
         }
-    } else {
-        session->gssapi->client.creds =
-                                    session->gssapi->client.client_deleg_creds;
 
-        maj_stat = gss_inquire_cred(&min_stat, session->gssapi->client.creds,
-                                    &client_id, NULL, NULL, &actual_mechs);
-        if (GSS_ERROR(maj_stat)) {
-            ret = SSH_ERROR;
-            goto end;
-        }
+        return SSH_OK;
+    }
+
+    session->gssapi->client.creds = session->gssapi->client.client_deleg_creds;
+
+    maj_stat = gss_inquire_cred(&min_stat, session->gssapi->client.creds,
+                                &client_id, NULL, NULL, &actual_mechs);
+    if (GSS_ERROR(maj_stat)) {
+        ret = SSH_ERROR;
+        goto end;
     }
 
     gss_create_empty_oid_set(&min_stat, valid_oids);
@@ -681,6 +1033,7 @@ static int ssh_gssapi_match(ssh_session session, gss_OID_set *valid_oids)
             SAFE_FREE(ptr);
         }
     }
+    gss_release_oid_set(&min_stat, &actual_mechs);
 
     ret = SSH_OK;
 
@@ -751,6 +1104,7 @@ int ssh_gssapi_auth_mic(ssh_session session){
 
     oids = calloc(n_oids, sizeof(ssh_string));
     if (oids == NULL) {
+        gss_release_oid_set(&min_stat, &selected);
         ssh_set_error_oom(session);
         return SSH_AUTH_ERROR;
     }
@@ -763,6 +1117,8 @@ int ssh_gssapi_auth_mic(ssh_session session){
                 selected->elements[i].length);
     }
 
+    gss_release_oid_set(&min_stat, &selected);
+
     rc = ssh_gssapi_send_auth_mic(session, oids, n_oids);
     for (i = 0; i < n_oids; i++) {
         ssh_string_free(oids[i]);
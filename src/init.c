@@ -167,6 +167,12 @@ static int _ssh_finalize(unsigned destructor) {
     }
 
     /* If the counter reaches zero or it is the destructor calling, finalize */
+#ifdef WITH_GSSAPI
+    /* the GSSAPI library may be unloaded already when unloading */
+    if (!destructor) {
+        ssh_gssapi_cache_flush();
+    }
+#endif
     ssh_dh_finalize();
     ssh_crypto_finalize();
     ssh_socket_cleanup();
@@ -43,6 +43,7 @@
 #include "libssh/misc.h"
 #include "libssh/pki.h"
 #include "libssh/bignum.h"
+#include "libssh/probes.h"
 
 #ifdef WITH_BLOWFISH_CIPHER
 # if defined(HAVE_OPENSSL_BLOWFISH_H) || defined(HAVE_LIBGCRYPT) || defined(HAVE_LIBMBEDCRYPTO)
@@ -185,44 +186,153 @@ static const char *ssh_kex_descriptions[] = {
   NULL
 };
 
-/* tokenize will return a token of strings delimited by ",". the first element has to be freed */
-static char **tokenize(const char *chain){
-    char **tokens;
-    size_t n=1;
-    size_t i=0;
-    char *tmp;
-    char *ptr;
+/*
+ * All the algorithm names we know about. Algorithm lists are parsed once into
+ * indexes into this table, so the negotiation compares small integers. The
+ * table covers every build configuration, ssh_keep_known_algos() takes care
+ * of what is actually supported.
+ */
+static const struct ssh_kex_algo_entry {
+    const char *name;
+    size_t len;
+    int kex_type;
+} ssh_kex_algorithms[] = {
+#define KEX_ALGO(name, kex_type) { name, sizeof(name) - 1, kex_type }
+    /* key exchange */
+    KEX_ALGO("curve25519-sha256", SSH_KEX_CURVE25519_SHA256),
+    KEX_ALGO("curve25519-sha256@libssh.org", SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG),
+    KEX_ALGO("ecdh-sha2-nistp256", SSH_KEX_ECDH_SHA2_NISTP256),
+    KEX_ALGO("ecdh-sha2-nistp384", SSH_KEX_ECDH_SHA2_NISTP384),
+    KEX_ALGO("ecdh-sha2-nistp521", SSH_KEX_ECDH_SHA2_NISTP521),
+    KEX_ALGO("diffie-hellman-group18-sha512", SSH_KEX_DH_GROUP18_SHA512),
+    KEX_ALGO("diffie-hellman-group16-sha512", SSH_KEX_DH_GROUP16_SHA512),
+#ifdef WITH_GEX
+    KEX_ALGO("diffie-hellman-group-exchange-sha256", SSH_KEX_DH_GEX_SHA256),
+    KEX_ALGO("diffie-hellman-group-exchange-sha1", SSH_KEX_DH_GEX_SHA1),
+#endif /* WITH_GEX */
+    KEX_ALGO("diffie-hellman-group14-sha1", SSH_KEX_DH_GROUP14_SHA1),
+    KEX_ALGO("diffie-hellman-group1-sha1", SSH_KEX_DH_GROUP1_SHA1),
+    KEX_ALGO(KEX_EXTENSION_CLIENT, 0),
+    /* host keys */
+    KEX_ALGO("ssh-ed25519", 0),
+    KEX_ALGO("ecdsa-sha2-nistp256", 0),
+    KEX_ALGO("ecdsa-sha2-nistp384", 0),
+    KEX_ALGO("ecdsa-sha2-nistp521", 0),
+    KEX_ALGO("rsa-sha2-512", 0),
+    KEX_ALGO("rsa-sha2-256", 0),
+    KEX_ALGO("ssh-rsa", 0),
+    KEX_ALGO("ssh-dss", 0),
+    /* ciphers */
+    KEX_ALGO("chacha20-poly1305@openssh.com", 0),
+    KEX_ALGO("aes256-gcm@openssh.com", 0),
+    KEX_ALGO("aes128-gcm@openssh.com", 0),
+    KEX_ALGO("aes256-ctr", 0),
+    KEX_ALGO("aes192-ctr", 0),
+    KEX_ALGO("aes128-ctr", 0),
+    KEX_ALGO("aes256-cbc", 0),
+    KEX_ALGO("aes192-cbc", 0),
+    KEX_ALGO("aes128-cbc", 0),
+    KEX_ALGO("blowfish-cbc", 0),
+    KEX_ALGO("3des-cbc", 0),
+    /* macs */
+    KEX_ALGO("hmac-sha2-256-etm@openssh.com", 0),
+    KEX_ALGO("hmac-sha2-512-etm@openssh.com", 0),
+    KEX_ALGO("hmac-sha1-etm@openssh.com", 0),
+    KEX_ALGO("hmac-sha2-256", 0),
+    KEX_ALGO("hmac-sha2-512", 0),
+    KEX_ALGO("hmac-sha1", 0),
+    /* compression */
+    KEX_ALGO("none", 0),
+    KEX_ALGO("zlib", 0),
+    KEX_ALGO("zlib@openssh.com", 0),
+#undef KEX_ALGO
+};
 
-    tmp = strdup(chain);
-    if (tmp == NULL) {
-      return NULL;
-    }
-    ptr = tmp;
-    while(*ptr){
-        if(*ptr==','){
-            n++;
-            *ptr=0;
+#define KEX_ALGO_COUNT \
+    (sizeof(ssh_kex_algorithms) / sizeof(ssh_kex_algorithms[0]))
+
+/*
+ * The lists are kept as bitsets of the indexes in an uint64_t, the build
+ * fails here once the table outgrows it.
+ */
+typedef char ssh_kex_algo_count_check[KEX_ALGO_COUNT <= SSH_KEX_ALGO_MAX ?
+                                      1 : -1];
+
+/* Get the index of an algorithm name, -1 if it is unknown */
+int ssh_kex_algo_id(const char *name, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < KEX_ALGO_COUNT; i++) {
+        if (ssh_kex_algorithms[i].len == len &&
+            memcmp(ssh_kex_algorithms[i].name, name, len) == 0) {
+            return (int)i;
         }
-        ptr++;
     }
-    /* now n contains the number of tokens, the first possibly empty if the list was empty too e.g. "" */
-    tokens = calloc(n + 1, sizeof(char *)); /* +1 for the null */
-    if (tokens == NULL) {
-      SAFE_FREE(tmp);
-      return NULL;
+
+    return -1;
+}
+
+const char *ssh_kex_algo_name(int id)
+{
+    if (id < 0 || (size_t)id >= KEX_ALGO_COUNT) {
+        return NULL;
     }
-    ptr=tmp;
-    for(i=0;i<n;i++){
-        tokens[i]=ptr;
-        while(*ptr)
-            ptr++; // find a zero
-        ptr++; // then go one step further
+
+    return ssh_kex_algorithms[id].name;
+}
+
+/*
+ * Parse a comma separated list of algorithms, keeping the order. Unknown
+ * and repeated names are skipped: we can't agree on algorithms we don't know.
+ */
+void ssh_kex_algos_parse(struct ssh_kex_algos *algos, const char *list)
+{
+    const char *p = list;
+    size_t len;
+    int id;
+
+    algos->set = 0;
+    algos->count = 0;
+
+    if (list == NULL) {
+        return;
     }
-    tokens[i]=NULL;
-    return tokens;
+
+    for (;;) {
+        len = strcspn(p, ",");
+        id = ssh_kex_algo_id(p, len);
+        if (id >= 0 && (algos->set & ((uint64_t)1 << id)) == 0) {
+            algos->set |= (uint64_t)1 << id;
+            algos->ids[algos->count] = (uint8_t)id;
+            algos->count++;
+        }
+        if (p[len] == '\0') {
+            break;
+        }
+        p += len + 1;
+    }
+}
+
+/*
+ * Return the first algorithm of the client which is supported by the server
+ * (RFC 4253 7.1), -1 if there is none.
+ */
+static int ssh_kex_algos_match(const struct ssh_kex_algos *client,
+                               const struct ssh_kex_algos *server)
+{
+    size_t i;
+
+    for (i = 0; i < client->count; i++) {
+        if (server->set & ((uint64_t)1 << client->ids[i])) {
+            return client->ids[i];
+        }
+    }
+
+    return -1;
 }
 
-/* same as tokenize(), but with spaces instead of ',' */
+/* tokenize a list of strings delimited by spaces. the first element has to be freed */
 /* TODO FIXME rewrite me! */
 char **ssh_space_tokenize(const char *chain){
     char **tokens;
@@ -300,110 +410,84 @@ const char *ssh_kex_get_description(uint32_t algo) {
 /* and a list of preferred objects (preferred_d) */
 /* it will return a strduped pointer on the first preferred object found in the available objects list */
 
-char *ssh_find_matching(const char *available_d, const char *preferred_d){
-    char ** tok_available, **tok_preferred;
-    int i_avail, i_pref;
-    char *ret;
+/* Check if the token of length len is an element of the list */
+static int ssh_list_has_token(const char *list, const char *token, size_t len)
+{
+    const char *p = list;
+    size_t n;
 
-    if ((available_d == NULL) || (preferred_d == NULL)) {
-      return NULL; /* don't deal with null args */
+    for (;;) {
+        n = strcspn(p, ",");
+        if (n == len && memcmp(p, token, len) == 0) {
+            return 1;
+        }
+        if (p[n] == '\0') {
+            return 0;
+        }
+        p += n + 1;
     }
+}
 
-    tok_available = tokenize(available_d);
-    if (tok_available == NULL) {
-      return NULL;
-    }
+char *ssh_find_matching(const char *available_d, const char *preferred_d){
+    const char *p;
+    size_t len;
 
-    tok_preferred = tokenize(preferred_d);
-    if (tok_preferred == NULL) {
-      SAFE_FREE(tok_available[0]);
-      SAFE_FREE(tok_available);
-      return NULL;
+    if ((available_d == NULL) || (preferred_d == NULL)) {
+      return NULL; /* don't deal with null args */
     }
 
-    for(i_pref=0; tok_preferred[i_pref] ; ++i_pref){
-      for(i_avail=0; tok_available[i_avail]; ++i_avail){
-        if(strcmp(tok_available[i_avail],tok_preferred[i_pref]) == 0){
-          /* match */
-          ret=strdup(tok_available[i_avail]);
-          /* free the tokens */
-          SAFE_FREE(tok_available[0]);
-          SAFE_FREE(tok_preferred[0]);
-          SAFE_FREE(tok_available);
-          SAFE_FREE(tok_preferred);
-          return ret;
+    for (p = preferred_d; ; p += len + 1) {
+        len = strcspn(p, ",");
+        if (ssh_list_has_token(available_d, p, len)) {
+            /* match */
+            return strndup(p, len);
+        }
+        if (p[len] == '\0') {
+            break;
         }
-      }
     }
-    SAFE_FREE(tok_available[0]);
-    SAFE_FREE(tok_preferred[0]);
-    SAFE_FREE(tok_available);
-    SAFE_FREE(tok_preferred);
+
     return NULL;
 }
 
 static char *ssh_find_all_matching(const char *available_d,
                                    const char *preferred_d)
 {
-    char **tok_available, **tok_preferred;
-    int i_avail, i_pref;
+    const char *p;
     char *ret;
-    unsigned max, len, pos = 0;
+    size_t len, pos = 0;
 
     if ((available_d == NULL) || (preferred_d == NULL)) {
         return NULL; /* don't deal with null args */
     }
 
-    max = MAX(strlen(available_d), strlen(preferred_d));
-
-    ret = malloc(max+1);
+    ret = malloc(strlen(preferred_d) + 1);
     if (ret == NULL) {
       return NULL;
     }
-    ret[0] = 0;
-
-    tok_available = tokenize(available_d);
-    if (tok_available == NULL) {
-        SAFE_FREE(ret);
-        return NULL;
-    }
 
-    tok_preferred = tokenize(preferred_d);
-    if (tok_preferred == NULL) {
-        SAFE_FREE(ret);
-        SAFE_FREE(tok_available[0]);
-        SAFE_FREE(tok_available);
-        return NULL;
-    }
-
-    for (i_pref = 0; tok_preferred[i_pref] ; ++i_pref) {
-        for (i_avail = 0; tok_available[i_avail]; ++i_avail) {
-            int cmp = strcmp(tok_available[i_avail],tok_preferred[i_pref]);
-            if (cmp == 0) {
-                /* match */
-                if (pos != 0) {
-                    ret[pos] = ',';
-                    pos++;
-                }
-
-                len = strlen(tok_available[i_avail]);
-                memcpy(&ret[pos], tok_available[i_avail], len);
-                pos += len;
-                ret[pos] = '\0';
+    for (p = preferred_d; ; p += len + 1) {
+        len = strcspn(p, ",");
+        if (ssh_list_has_token(available_d, p, len)) {
+            /* match */
+            if (pos != 0) {
+                ret[pos] = ',';
+                pos++;
             }
+            memcpy(&ret[pos], p, len);
+            pos += len;
+        }
+        if (p[len] == '\0') {
+            break;
         }
     }
+    ret[pos] = '\0';
 
     if (ret[0] == '\0') {
         SAFE_FREE(ret);
         ret = NULL;
     }
 
-    SAFE_FREE(tok_available[0]);
-    SAFE_FREE(tok_preferred[0]);
-    SAFE_FREE(tok_available);
-    SAFE_FREE(tok_preferred);
-
     return ret;
 }
 
@@ -416,38 +500,18 @@ static char *ssh_find_all_matching(const char *available_d,
  */
 static int cmp_first_kex_algo(const char *client_str,
                               const char *server_str) {
-    int is_wrong = 1;
-    char **server_str_tokens = NULL;
-    char **client_str_tokens = NULL;
+    size_t client_len;
+    size_t server_len;
 
     if ((client_str == NULL) || (server_str == NULL)) {
-        goto out;
-    }
-
-    client_str_tokens = tokenize(client_str);
-
-    if (client_str_tokens == NULL) {
-        goto out;
-    }
-
-    if (client_str_tokens[0] == NULL) {
-        goto freeout;
-    }
-
-    server_str_tokens = tokenize(server_str);
-    if (server_str_tokens == NULL) {
-        goto freeout;
+        return 1;
     }
 
-    is_wrong = (strcmp(client_str_tokens[0], server_str_tokens[0]) != 0);
+    client_len = strcspn(client_str, ",");
+    server_len = strcspn(server_str, ",");
 
-    SAFE_FREE(server_str_tokens[0]);
-    SAFE_FREE(server_str_tokens);
-freeout:
-    SAFE_FREE(client_str_tokens[0]);
-    SAFE_FREE(client_str_tokens);
-out:
-    return is_wrong;
+    return client_len != server_len ||
+           memcmp(client_str, server_str, client_len) != 0;
 }
 
 SSH_PACKET_CALLBACK(ssh_packet_kexinit)
@@ -530,6 +594,14 @@ SSH_PACKET_CALLBACK(ssh_packet_kexinit)
         }
     }
 
+    /* and parse the algorithm lists once for the negotiation */
+    for (i = 0; i < SSH_LANG_C_S; i++) {
+        ssh_kex_algos_parse(server_kex ?
+                            &session->next_crypto->client_kex.algos[i] :
+                            &session->next_crypto->server_kex.algos[i],
+                            strings[i]);
+    }
+
     /*
      * Handle the two final fields for the KEXINIT message (RFC 4253 7.1):
      *
@@ -770,6 +842,25 @@ char *ssh_client_select_hostkeys(ssh_session session)
     return new_hostkeys;
 }
 
+/**
+ * @internal
+ * @brief Set the algorithm ids of our side of the key exchange, from the
+ *        lists compiled when the options were set.
+ */
+void ssh_kex_set_algos(ssh_session session, struct ssh_kex_struct *kex)
+{
+    int i;
+
+    for (i = 0; i < SSH_LANG_C_S; i++) {
+        if (session->opts.wanted_methods[i] != NULL) {
+            kex->algos[i] = session->opts.wanted_algos[i];
+        } else {
+            /* only the defaults are left, they are short */
+            ssh_kex_algos_parse(&kex->algos[i], kex->methods[i]);
+        }
+    }
+}
+
 /**
  * @brief sets the key exchange parameters to be sent to the server,
  *        in function of the options and available methods.
@@ -796,6 +887,8 @@ int ssh_set_client_kex(ssh_session session)
     	/* Only if no override */
     	session->opts.wanted_methods[SSH_HOSTKEYS] =
             ssh_client_select_hostkeys(session);
+        ssh_kex_algos_parse(&session->opts.wanted_algos[SSH_HOSTKEYS],
+                            session->opts.wanted_methods[SSH_HOSTKEYS]);
     }
 
     for (i = 0; i < KEX_METHODS_SIZE; i++) {
@@ -808,6 +901,7 @@ int ssh_set_client_kex(ssh_session session)
             return SSH_ERROR;
         }
     }
+    ssh_kex_set_algos(session, client);
 
     /* For rekeying, skip the extension negotiation */
     if (session->flags & SSH_SESSION_FLAG_AUTHENTICATED) {
@@ -851,41 +945,30 @@ int ssh_kex_select_methods (ssh_session session){
     }
 
     for (i = 0; i < KEX_METHODS_SIZE; i++) {
-        session->next_crypto->kex_methods[i]=ssh_find_matching(server->methods[i],client->methods[i]);
-        if(session->next_crypto->kex_methods[i] == NULL && i < SSH_LANG_C_S){
-            ssh_set_error(session,SSH_FATAL,"kex error : no match for method %s: server [%s], client [%s]",
-                    ssh_kex_descriptions[i],server->methods[i],client->methods[i]);
+        if (i < SSH_LANG_C_S) {
+            int id = ssh_kex_algos_match(&client->algos[i], &server->algos[i]);
+
+            if (id < 0) {
+                ssh_set_error(session,SSH_FATAL,"kex error : no match for method %s: server [%s], client [%s]",
+                        ssh_kex_descriptions[i],server->methods[i],client->methods[i]);
+                return SSH_ERROR;
+            }
+            session->next_crypto->kex_algos[i] = (uint8_t)id;
+            session->next_crypto->kex_methods[i] = strdup(ssh_kex_algo_name(id));
+        } else {
+            session->next_crypto->kex_methods[i]=ssh_find_matching(server->methods[i],client->methods[i]);
+            if (session->next_crypto->kex_methods[i] == NULL) {
+                /* we can safely do that for languages */
+                session->next_crypto->kex_methods[i] = strdup("");
+            }
+        }
+        if (session->next_crypto->kex_methods[i] == NULL) {
+            ssh_set_error_oom(session);
             return SSH_ERROR;
-        } else if ((i >= SSH_LANG_C_S) && (session->next_crypto->kex_methods[i] == NULL)) {
-            /* we can safely do that for languages */
-            session->next_crypto->kex_methods[i] = strdup("");
         }
     }
-    if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group1-sha1") == 0){
-      session->next_crypto->kex_type=SSH_KEX_DH_GROUP1_SHA1;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group14-sha1") == 0){
-      session->next_crypto->kex_type=SSH_KEX_DH_GROUP14_SHA1;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group16-sha512") == 0){
-      session->next_crypto->kex_type=SSH_KEX_DH_GROUP16_SHA512;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group18-sha512") == 0){
-      session->next_crypto->kex_type=SSH_KEX_DH_GROUP18_SHA512;
-#ifdef WITH_GEX
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group-exchange-sha1") == 0){
-      session->next_crypto->kex_type=SSH_KEX_DH_GEX_SHA1;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "diffie-hellman-group-exchange-sha256") == 0){
-        session->next_crypto->kex_type=SSH_KEX_DH_GEX_SHA256;
-#endif /* WITH_GEX */
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "ecdh-sha2-nistp256") == 0){
-      session->next_crypto->kex_type=SSH_KEX_ECDH_SHA2_NISTP256;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "ecdh-sha2-nistp384") == 0){
-      session->next_crypto->kex_type=SSH_KEX_ECDH_SHA2_NISTP384;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "ecdh-sha2-nistp521") == 0){
-      session->next_crypto->kex_type=SSH_KEX_ECDH_SHA2_NISTP521;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "curve25519-sha256@libssh.org") == 0){
-      session->next_crypto->kex_type=SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG;
-    } else if(strcmp(session->next_crypto->kex_methods[SSH_KEX], "curve25519-sha256") == 0){
-      session->next_crypto->kex_type=SSH_KEX_CURVE25519_SHA256;
-    }
+    session->next_crypto->kex_type =
+        ssh_kex_algorithms[session->next_crypto->kex_algos[SSH_KEX]].kex_type;
     SSH_LOG(SSH_LOG_INFO, "Negotiated %s,%s,%s,%s,%s,%s,%s,%s,%s,%s",
             session->next_crypto->kex_methods[SSH_KEX],
             session->next_crypto->kex_methods[SSH_HOSTKEYS],
@@ -951,6 +1034,7 @@ int ssh_send_kex(ssh_session session, int server_kex) {
     return -1;
   }
 
+  SSH_PROBE2(kex__start, session, server_kex);
   SSH_LOG(SSH_LOG_PACKET, "SSH_MSG_KEXINIT sent");
   return 0;
 error:
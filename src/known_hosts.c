@@ -307,6 +307,11 @@ int ssh_is_server_known(ssh_session session) {
   char * files[3];
   int ret = SSH_SERVER_NOT_KNOWN;
 
+  /* the forwarder checked the server, see ssh_session_is_known_server() */
+  if (session->flags & SSH_SESSION_FLAG_CONTROL) {
+    return SSH_SERVER_KNOWN_OK;
+  }
+
   if (session->opts.knownhosts == NULL) {
     if (ssh_options_apply(session) < 0) {
       ssh_set_error(session, SSH_REQUEST_DENIED,
@@ -508,6 +513,10 @@ int ssh_write_knownhost(ssh_session session) {
     char *buffer;
     char *dir;
 
+    if (session->flags & SSH_SESSION_FLAG_CONTROL) {
+        return SSH_OK;
+    }
+
     if (session->opts.knownhosts == NULL) {
         if (ssh_options_apply(session) < 0) {
             ssh_set_error(session, SSH_FATAL, "Can't find a known_hosts file");
@@ -706,6 +706,11 @@ int ssh_session_update_known_hosts(ssh_session session)
     size_t len;
     int rc;
 
+    /* the key of a forwarder is not the one of the server */
+    if (session->flags & SSH_SESSION_FLAG_CONTROL) {
+        return SSH_OK;
+    }
+
     if (session->opts.knownhosts == NULL) {
         rc = ssh_options_apply(session);
         if (rc != SSH_OK) {
@@ -858,6 +863,14 @@ ssh_session_get_known_hosts_entry(ssh_session session,
 {
     enum ssh_known_hosts_e old_rv, rv = SSH_KNOWN_HOSTS_UNKNOWN;
 
+    /*
+     * Through a control socket, the key is the one of the forwarder, which
+     * checked the server when its own session was connected.
+     */
+    if (session->flags & SSH_SESSION_FLAG_CONTROL) {
+        return SSH_KNOWN_HOSTS_OK;
+    }
+
     if (session->opts.knownhosts == NULL) {
         if (ssh_options_apply(session) < 0) {
             ssh_set_error(session,
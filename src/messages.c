@@ -844,6 +844,8 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
     if(has_sign) {
         ssh_string sig_blob = NULL;
         ssh_buffer digest = NULL;
+        ssh_key certified = NULL;
+        ssh_key key = msg->auth_request.pubkey;
 
         sig_blob = ssh_buffer_get_ssh_string(packet);
         if(sig_blob == NULL) {
@@ -864,19 +866,41 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
             goto error;
         }
 
-        rc = ssh_pki_import_signature_blob(sig_blob,
-                                           msg->auth_request.pubkey,
-                                           &sig);
+        if (key->cert != NULL) {
+            /* the user key of the certificate made the signature */
+            rc = ssh_pki_import_cert_key(key, &certified);
+            if (rc == SSH_OK) {
+                key = certified;
+            }
+        }
+        if (rc == SSH_OK) {
+            rc = ssh_pki_import_signature_blob(sig_blob, key, &sig);
+        }
+        if (rc == SSH_OK &&
+            session->srv.verify_queue != NULL &&
+            sig->type == SSH_KEYTYPE_ED25519 &&
+            msg->auth_request.pubkey->type == SSH_KEYTYPE_ED25519) {
+            /*
+             * Verified later in a batch with the requests of other sessions,
+             * the message is queued then.
+             */
+            ssh_string_free(sig_blob);
+            ssh_verify_queue_push(session->srv.verify_queue, msg, sig, digest);
+            SAFE_FREE(service);
+
+            return SSH_PACKET_USED;
+        }
         if (rc == SSH_OK) {
             rc = ssh_pki_signature_verify(session,
                                           sig,
-                                          msg->auth_request.pubkey,
+                                          key,
                                           ssh_buffer_get(digest),
                                           ssh_buffer_get_len(digest));
         }
         ssh_string_free(sig_blob);
         ssh_buffer_free(digest);
         ssh_signature_free(sig);
+        ssh_key_free(certified);
         if (rc < 0) {
             SSH_LOG(
                     SSH_LOG_PACKET,
@@ -962,6 +986,31 @@ end:
   return SSH_PACKET_USED;
 }
 
+/**
+ * @internal
+ *
+ * @brief Resume a publickey authentication request once its signature was
+ * verified by the verification queue of the session.
+ *
+ * @param[in]  msg      The SSH_REQUEST_AUTH message waiting for its signature.
+ *
+ * @param[in]  valid    Whether the signature is valid.
+ */
+void ssh_message_userauth_verified(ssh_message msg, int valid)
+{
+    if (!valid) {
+        SSH_LOG(SSH_LOG_PACKET, "Received an invalid signature from peer");
+        msg->auth_request.signature_state = SSH_PUBLICKEY_STATE_WRONG;
+        SSH_MESSAGE_FREE(msg);
+        return;
+    }
+
+    SSH_LOG(SSH_LOG_PACKET, "Valid signature received");
+    msg->auth_request.signature_state = SSH_PUBLICKEY_STATE_VALID;
+
+    ssh_message_queue(msg->session, msg);
+}
+
 #endif /* WITH_SERVER */
 /**
  * @internal
@@ -160,6 +160,7 @@ int ssh_options_copy(ssh_session src, ssh_session *dest)
                 ssh_free(new);
                 return -1;
             }
+            new->opts.wanted_algos[i] = src->opts.wanted_algos[i];
         }
     }
 
@@ -171,6 +172,14 @@ int ssh_options_copy(ssh_session src, ssh_session *dest)
         }
     }
 
+    if (src->opts.control_path != NULL) {
+        new->opts.control_path = strdup(src->opts.control_path);
+        if (new->opts.control_path == NULL) {
+            ssh_free(new);
+            return -1;
+        }
+    }
+
     if (src->opts.pubkey_accepted_types != NULL) {
         new->opts.pubkey_accepted_types = strdup(src->opts.pubkey_accepted_types);
         if (new->opts.pubkey_accepted_types == NULL) {
@@ -230,8 +239,9 @@ int ssh_options_set_algo(ssh_session session,
         return -1;
     }
 
-    SAFE_FREE(session->opts.wanted_methods[algo]);
+    SSH_OPTIONS_FREE(session, session->opts.wanted_methods[algo]);
     session->opts.wanted_methods[algo] = p;
+    ssh_kex_algos_parse(&session->opts.wanted_algos[algo], p);
 
     return 0;
 }
@@ -464,6 +474,19 @@ int ssh_options_set_algo(ssh_session session,
  *                in seconds. RFC 4253 Section 9 recommends one hour.
  *                (uint32_t, 0=off)
  *
+ *              - SSH_OPTIONS_CONTROL_PATH
+ *                Set the path of the control socket of a forwarder holding
+ *                a session to the same server (const char *). When a
+ *                forwarder of the same user listens on it, ssh_connect()
+ *                goes through its session instead of connecting to the
+ *                server, otherwise it connects as usual. Once connected,
+ *                the session is used as any other. The host key seen is
+ *                the one of the forwarder, it is not checked against the
+ *                known hosts: the server was checked when the session of
+ *                the forwarder was connected. It is expanded like the
+ *                ProxyCommand, so it may use %h, %p and %r. Setting it to
+ *                "none" unsets it.
+ *
  * @param  value The value to set. This is a generic pointer and the
  *               datatype which is used should be set according to the
  *               type set.
@@ -496,7 +519,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 }
                 p = strchr(q, '@');
 
-                SAFE_FREE(session->opts.host);
+                SSH_OPTIONS_FREE(session, session->opts.host);
 
                 if (p) {
                     *p = '\0';
@@ -507,7 +530,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                         return -1;
                     }
 
-                    SAFE_FREE(session->opts.username);
+                    SSH_OPTIONS_FREE(session, session->opts.username);
                     session->opts.username = strdup(q);
                     SAFE_FREE(q);
                     if (session->opts.username == NULL) {
@@ -584,12 +607,12 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             if (q == NULL) {
                 return -1;
             }
-            SAFE_FREE(session->opts.bindaddr);
+            SSH_OPTIONS_FREE(session, session->opts.bindaddr);
             session->opts.bindaddr = q;
             break;
         case SSH_OPTIONS_USER:
             v = value;
-            SAFE_FREE(session->opts.username);
+            SSH_OPTIONS_FREE(session, session->opts.username);
             if (v == NULL) {
                 q = ssh_get_local_username();
                 if (q == NULL) {
@@ -610,7 +633,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             break;
         case SSH_OPTIONS_SSH_DIR:
             v = value;
-            SAFE_FREE(session->opts.sshdir);
+            SSH_OPTIONS_FREE(session, session->opts.sshdir);
             if (v == NULL) {
                 session->opts.sshdir = ssh_path_expand_tilde("~/.ssh");
                 if (session->opts.sshdir == NULL) {
@@ -646,7 +669,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             break;
         case SSH_OPTIONS_KNOWNHOSTS:
             v = value;
-            SAFE_FREE(session->opts.knownhosts);
+            SSH_OPTIONS_FREE(session, session->opts.knownhosts);
             if (v == NULL) {
                 /* The default value will be set by the ssh_options_apply() */
             } else if (v[0] == '\0') {
@@ -662,7 +685,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
             break;
         case SSH_OPTIONS_GLOBAL_KNOWNHOSTS:
             v = value;
-            SAFE_FREE(session->opts.global_knownhosts);
+            SSH_OPTIONS_FREE(session, session->opts.global_knownhosts);
             if (v == NULL) {
                 session->opts.global_knownhosts =
                     strdup("/etc/ssh/ssh_known_hosts");
@@ -808,7 +831,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                     return -1;
                 }
 
-                SAFE_FREE(session->opts.pubkey_accepted_types);
+                SSH_OPTIONS_FREE(session, session->opts.pubkey_accepted_types);
                 session->opts.pubkey_accepted_types = p;
             }
             break;
@@ -909,7 +932,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 ssh_set_error_invalid(session);
                 return -1;
             } else {
-                SAFE_FREE(session->opts.ProxyCommand);
+                SSH_OPTIONS_FREE(session, session->opts.ProxyCommand);
                 /* Setting the command to 'none' disables this option. */
                 rc = strcasecmp(v, "none");
                 if (rc != 0) {
@@ -927,7 +950,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 ssh_set_error_invalid(session);
                 return -1;
             } else {
-                SAFE_FREE(session->opts.gss_server_identity);
+                SSH_OPTIONS_FREE(session, session->opts.gss_server_identity);
                 session->opts.gss_server_identity = strdup(v);
                 if (session->opts.gss_server_identity == NULL) {
                     ssh_set_error_oom(session);
@@ -941,7 +964,7 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 ssh_set_error_invalid(session);
                 return -1;
             } else {
-                SAFE_FREE(session->opts.gss_client_identity);
+                SSH_OPTIONS_FREE(session, session->opts.gss_client_identity);
                 session->opts.gss_client_identity = strdup(v);
                 if (session->opts.gss_client_identity == NULL) {
                     ssh_set_error_oom(session);
@@ -1025,6 +1048,23 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 session->opts.rekey_time = (*x) * 1000;
             }
             break;
+        case SSH_OPTIONS_CONTROL_PATH:
+            v = value;
+            if (v == NULL || v[0] == '\0') {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                SSH_OPTIONS_FREE(session, session->opts.control_path);
+                rc = strcasecmp(v, "none");
+                if (rc != 0) {
+                    q = strdup(v);
+                    if (q == NULL) {
+                        return -1;
+                    }
+                    session->opts.control_path = q;
+                }
+            }
+            break;
         default:
             ssh_set_error(session, SSH_REQUEST_DENIED, "Unknown ssh option %d", type);
             return -1;
@@ -1093,6 +1133,10 @@ int ssh_options_get_port(ssh_session session, unsigned int* port_target) {
  *                remote host. When not explicitly set, it will be read
  *                from the ~/.ssh/config file.
  *
+ *              - SSH_OPTIONS_CONTROL_PATH:
+ *                Get the path of the control socket of a forwarder, set by
+ *                SSH_OPTIONS_CONTROL_PATH.
+ *
  *              - SSH_OPTIONS_GLOBAL_KNOWNHOSTS:
  *                Get the path to the global known_hosts file being used.
  *
@@ -1141,6 +1185,10 @@ int ssh_options_get(ssh_session session, enum ssh_options_e type, char** value)
             src = session->opts.ProxyCommand;
             break;
         }
+        case SSH_OPTIONS_CONTROL_PATH: {
+            src = session->opts.control_path;
+            break;
+        }
         case SSH_OPTIONS_KNOWNHOSTS: {
             src = session->opts.knownhosts;
             break;
@@ -1413,9 +1461,31 @@ out:
   return r;
 }
 
+/*
+ * Expand the escapes and the tilde of an option value. Values which have
+ * nothing to expand, like the ones resolved once by a session template, are
+ * kept as they are.
+ */
+static int ssh_options_expand_value(ssh_session session, char **value)
+{
+    char *tmp;
+
+    if ((*value)[0] != '~' && strchr(*value, '%') == NULL) {
+        return 0;
+    }
+
+    tmp = ssh_path_expand_escape(session, *value);
+    if (tmp == NULL) {
+        return -1;
+    }
+    SSH_OPTIONS_FREE(session, *value);
+    *value = tmp;
+
+    return 0;
+}
+
 int ssh_options_apply(ssh_session session) {
     struct ssh_iterator *it;
-    char *tmp;
     int rc;
 
     if (session->opts.sshdir == NULL) {
@@ -1433,46 +1503,50 @@ int ssh_options_apply(ssh_session session) {
     }
 
     if (session->opts.knownhosts == NULL) {
-        tmp = ssh_path_expand_escape(session, "%d/known_hosts");
-    } else {
-        tmp = ssh_path_expand_escape(session, session->opts.knownhosts);
-    }
-    if (tmp == NULL) {
+        session->opts.knownhosts = ssh_path_expand_escape(session,
+                                                          "%d/known_hosts");
+        if (session->opts.knownhosts == NULL) {
+            return -1;
+        }
+    } else if (ssh_options_expand_value(session,
+                                        &session->opts.knownhosts) < 0) {
         return -1;
     }
-    free(session->opts.knownhosts);
-    session->opts.knownhosts = tmp;
 
     if (session->opts.global_knownhosts == NULL) {
-        tmp = strdup("/etc/ssh/ssh_known_hosts");
-    } else {
-        tmp = ssh_path_expand_escape(session, session->opts.global_knownhosts);
-    }
-    if (tmp == NULL) {
+        session->opts.global_knownhosts = strdup("/etc/ssh/ssh_known_hosts");
+        if (session->opts.global_knownhosts == NULL) {
+            return -1;
+        }
+    } else if (ssh_options_expand_value(session,
+                                        &session->opts.global_knownhosts) < 0) {
         return -1;
     }
-    free(session->opts.global_knownhosts);
-    session->opts.global_knownhosts = tmp;
 
     if (session->opts.ProxyCommand != NULL) {
-        tmp = ssh_path_expand_escape(session, session->opts.ProxyCommand);
-        if (tmp == NULL) {
+        rc = ssh_options_expand_value(session, &session->opts.ProxyCommand);
+        if (rc < 0) {
+            return -1;
+        }
+    }
+
+    if (session->opts.control_path != NULL) {
+        rc = ssh_options_expand_value(session, &session->opts.control_path);
+        if (rc < 0) {
             return -1;
         }
-        free(session->opts.ProxyCommand);
-        session->opts.ProxyCommand = tmp;
     }
 
     for (it = ssh_list_get_iterator(session->opts.identity);
          it != NULL;
          it = it->next) {
         char *id = (char *) it->data;
-        tmp = ssh_path_expand_escape(session, id);
-        if (tmp == NULL) {
+
+        rc = ssh_options_expand_value(session, &id);
+        if (rc < 0) {
             return -1;
         }
-        free(id);
-        it->data = tmp;
+        it->data = id;
     }
 
     return 0;
@@ -1517,6 +1591,7 @@ static int ssh_bind_set_algo(ssh_bind sshbind,
 
     SAFE_FREE(sshbind->wanted_methods[algo]);
     sshbind->wanted_methods[algo] = p;
+    ssh_kex_algos_parse(&sshbind->wanted_algos[algo], p);
 
     return 0;
 }
@@ -1606,6 +1681,29 @@ static int ssh_bind_set_algo(ssh_bind sshbind,
  *                        Set the Message Authentication Code algorithm server
  *                        to client (const char *, comma-separated list).
  *
+ *                      - SSH_BIND_OPTIONS_MAX_STARTUPS:
+ *                        Limit the sessions accepted by the bind which did
+ *                        not authenticate yet, like MaxStartups of sshd
+ *                        (const char *, "full" or "begin:rate:full"). From
+ *                        begin sessions on, rate percent of the new
+ *                        connections are closed as soon as they are
+ *                        accepted, growing to all of them at full. A
+ *                        session stops counting once it authenticated, is
+ *                        imported with ssh_session_import() or is freed,
+ *                        by the process which accepted it. "0" removes
+ *                        the limit. A server which forks a child for each
+ *                        connection and frees the session in the parent
+ *                        keeps it counted with ssh_bind_admission_detach()
+ *                        until it calls ssh_bind_admission_done().
+ *
+ *                      - SSH_BIND_OPTIONS_SOURCE_LIMIT:
+ *                        Limit the connections opened from a single source
+ *                        address, or /64 network for IPv6 (const char *,
+ *                        "count:seconds"). A source may open count
+ *                        connections at once, then one more every
+ *                        seconds / count seconds. The others are closed as
+ *                        soon as they are accepted. "0" removes the limit.
+ *
  *
  * @param  value        The value to set. This is a generic pointer and the
  *                      datatype which should be used is described at the
@@ -1891,6 +1989,28 @@ int ssh_bind_options_set(ssh_bind sshbind, enum ssh_bind_options_e type,
                 return -1;
         }
         break;
+    case SSH_BIND_OPTIONS_MAX_STARTUPS:
+        v = value;
+        if (v == NULL) {
+            ssh_set_error_invalid(sshbind);
+            return -1;
+        }
+        rc = ssh_bind_admission_set_startups(sshbind, v);
+        if (rc != SSH_OK) {
+            return -1;
+        }
+        break;
+    case SSH_BIND_OPTIONS_SOURCE_LIMIT:
+        v = value;
+        if (v == NULL) {
+            ssh_set_error_invalid(sshbind);
+            return -1;
+        }
+        rc = ssh_bind_admission_set_source_limit(sshbind, v);
+        if (rc != SSH_OK) {
+            return -1;
+        }
+        break;
     default:
       ssh_set_error(sshbind, SSH_REQUEST_DENIED, "Unknown ssh option %d", type);
       return -1;
@@ -44,6 +44,7 @@
 #include "libssh/session.h"
 #include "libssh/messages.h"
 #include "libssh/pcap.h"
+#include "libssh/probes.h"
 #include "libssh/kex.h"
 #include "libssh/auth.h"
 #include "libssh/gssapi.h"
@@ -1299,6 +1300,11 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
             SSH_LOG(SSH_LOG_PACKET,
                     "packet: read type %hhd [len=%d,padding=%hhd,comp=%d,payload=%d]",
                     session->in_packet.type, packet_len, padding, compsize, payloadsize);
+            SSH_PROBE4(packet__receive,
+                       session,
+                       session->in_packet.type,
+                       payloadsize,
+                       session->recv_seq - 1);
 
             /* Check if the packet is expected */
             filter_result = ssh_packet_incoming_filter(session);
@@ -1652,6 +1658,7 @@ static int packet_send2(ssh_session session)
         goto error;
     }
     session->send_seq++;
+    SSH_PROBE4(packet__send, session, type, payloadsize, session->send_seq - 1);
     if (crypto != NULL) {
         struct ssh_cipher_struct *cipher = NULL;
 
@@ -1796,13 +1803,14 @@ int ssh_packet_send(ssh_session session)
     return rc;
 }
 
-static void
+void
 ssh_init_rekey_state(struct ssh_session_struct *session,
                      struct ssh_cipher_struct *cipher)
 {
     /* Reset the counters: should be NOOP */
     cipher->packets = 0;
     cipher->blocks = 0;
+    cipher->stream_blocks = 0;
 
     /* Default rekey limits for ciphers as specified in RFC4344, Section 3.2 */
     if (cipher->blocksize >= 16) {
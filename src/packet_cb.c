@@ -35,6 +35,7 @@
 #include "libssh/misc.h"
 #include "libssh/packet.h"
 #include "libssh/pki.h"
+#include "libssh/probes.h"
 #include "libssh/session.h"
 #include "libssh/socket.h"
 #include "libssh/ssh2.h"
@@ -168,6 +169,7 @@ SSH_PACKET_CALLBACK(ssh_packet_newkeys){
     }
   }
   session->dh_handshake_state = DH_STATE_FINISHED;
+  SSH_PROBE2(kex__finish, session, session->server);
   session->ssh_connection_callback(session);
   return SSH_PACKET_USED;
 error:
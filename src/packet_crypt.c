@@ -122,6 +122,7 @@ int ssh_packet_decrypt(ssh_session session,
                                     session->recv_seq);
     } else {
         cipher->decrypt(cipher, source + start, destination, encrypted_size);
+        cipher->stream_blocks += encrypted_size / cipher->blocksize;
     }
 
     return 0;
@@ -187,6 +188,7 @@ unsigned char *ssh_packet_encrypt(ssh_session session, void *data, uint32_t len)
       }
 
       cipher->encrypt(cipher, (uint8_t*)data + etm_packet_offset, out, len - etm_packet_offset);
+      cipher->stream_blocks += (len - etm_packet_offset) / blocksize;
       memcpy((uint8_t*)data + etm_packet_offset, out, len - etm_packet_offset);
 
       if (etm) {
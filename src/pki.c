@@ -63,6 +63,7 @@
 #include "libssh/buffer.h"
 #include "libssh/misc.h"
 #include "libssh/agent.h"
+#include "libssh/threads.h"
 
 enum ssh_keytypes_e pki_privatekey_type_from_string(const char *privkey) {
     if (strncmp(privkey, DSA_HEADER_BEGIN, strlen(DSA_HEADER_BEGIN)) == 0) {
@@ -755,6 +756,367 @@ int ssh_pki_import_privkey_file(const char *filename,
     return rc;
 }
 
+struct ssh_key_cache_entry {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+    int has_passphrase;
+    unsigned char passphrase_hash[SHA256_DIGEST_LEN];
+    unsigned long last_use;
+    ssh_key key;
+};
+
+struct ssh_key_cache_struct {
+    SSH_MUTEX mutex;
+    struct ssh_key_cache_entry *entries;
+    size_t max_entries;
+    size_t count;
+    unsigned long uses;
+};
+
+/**
+ * @brief Create a cache of decrypted private keys.
+ *
+ * Decrypting an OpenSSH private key runs bcrypt_pbkdf with many rounds on
+ * purpose, which is slow. A long-running process loading the same keys again
+ * can keep them with ssh_pki_import_privkey_file_cached(), entries are
+ * dropped as soon as the file changes.
+ *
+ * The cache is thread-safe.
+ *
+ * @param[in]  max_entries  The number of keys to keep, the least recently
+ *                          used one is dropped to make room.
+ *
+ * @return A new cache or NULL on error.
+ *
+ * @see ssh_key_cache_free()
+ */
+ssh_key_cache ssh_key_cache_new(size_t max_entries)
+{
+    static const SSH_MUTEX mutex_init = SSH_MUTEX_STATIC_INIT;
+    ssh_key_cache cache;
+
+    if (max_entries == 0) {
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(struct ssh_key_cache_struct));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->entries = calloc(max_entries, sizeof(struct ssh_key_cache_entry));
+    if (cache->entries == NULL) {
+        SAFE_FREE(cache);
+        return NULL;
+    }
+    cache->max_entries = max_entries;
+    cache->mutex = mutex_init;
+
+    return cache;
+}
+
+static void ssh_key_cache_entry_clear(struct ssh_key_cache_entry *entry)
+{
+    SAFE_FREE(entry->path);
+    ssh_key_free(entry->key);
+    explicit_bzero(entry, sizeof(struct ssh_key_cache_entry));
+}
+
+/**
+ * @brief Drop all the keys of a cache.
+ *
+ * @param[in]  cache    The cache to empty.
+ */
+void ssh_key_cache_flush(ssh_key_cache cache)
+{
+    size_t i;
+
+    if (cache == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    for (i = 0; i < cache->count; i++) {
+        ssh_key_cache_entry_clear(&cache->entries[i]);
+    }
+    cache->count = 0;
+    ssh_mutex_unlock(&cache->mutex);
+}
+
+/**
+ * @brief Free a cache of decrypted private keys and the keys it holds.
+ *
+ * @param[in]  cache    The cache to free.
+ */
+void ssh_key_cache_free(ssh_key_cache cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    ssh_key_cache_flush(cache);
+    SAFE_FREE(cache->entries);
+    SAFE_FREE(cache);
+}
+
+static void ssh_key_cache_hash_passphrase(const char *passphrase,
+                                          unsigned char *hash)
+{
+    sha256((unsigned char *)passphrase, strlen(passphrase), hash);
+}
+
+static long ssh_key_cache_mtime_nsec(const struct stat *sb)
+{
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+    return sb->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+    return sb->st_mtimespec.tv_nsec;
+#else
+    (void)sb;
+    return 0;
+#endif
+}
+
+/*
+ * Passes the prompt to the caller's auth function and remembers the hash of
+ * the passphrase it returned, so the key is cached under that passphrase and
+ * not as one which needed none.
+ */
+struct ssh_key_cache_auth {
+    ssh_auth_callback auth_fn;
+    void *auth_data;
+    int used;
+    unsigned char passphrase_hash[SHA256_DIGEST_LEN];
+};
+
+static int ssh_key_cache_auth_fn(const char *prompt,
+                                 char *buf,
+                                 size_t len,
+                                 int echo,
+                                 int verify,
+                                 void *userdata)
+{
+    struct ssh_key_cache_auth *auth = userdata;
+    int rc;
+
+    rc = auth->auth_fn(prompt, buf, len, echo, verify, auth->auth_data);
+    if (rc == 0 && len > 0) {
+        sha256((unsigned char *)buf, strnlen(buf, len), auth->passphrase_hash);
+        auth->used = 1;
+    }
+
+    return rc;
+}
+
+static struct ssh_key_cache_entry *
+ssh_key_cache_lookup(ssh_key_cache cache,
+                     const char *filename,
+                     const struct stat *sb,
+                     int has_passphrase,
+                     const unsigned char *passphrase_hash)
+{
+    size_t i;
+
+    for (i = 0; i < cache->count; i++) {
+        struct ssh_key_cache_entry *entry = &cache->entries[i];
+
+        if (strcmp(entry->path, filename) != 0) {
+            continue;
+        }
+        if (entry->dev != sb->st_dev ||
+            entry->ino != sb->st_ino ||
+            entry->size != sb->st_size ||
+            entry->mtime != sb->st_mtime ||
+            entry->mtime_nsec != ssh_key_cache_mtime_nsec(sb)) {
+            return NULL;
+        }
+        if (entry->has_passphrase != has_passphrase) {
+            return NULL;
+        }
+        if (has_passphrase &&
+            memcmp(entry->passphrase_hash,
+                   passphrase_hash,
+                   SHA256_DIGEST_LEN) != 0) {
+            return NULL;
+        }
+
+        return entry;
+    }
+
+    return NULL;
+}
+
+static void ssh_key_cache_store(ssh_key_cache cache,
+                                const char *filename,
+                                const struct stat *sb,
+                                int has_passphrase,
+                                const unsigned char *passphrase_hash,
+                                const ssh_key key)
+{
+    struct ssh_key_cache_entry *entry = NULL;
+    ssh_key copy;
+    char *path;
+    size_t i;
+
+    copy = pki_key_dup(key, 0);
+    path = strdup(filename);
+    if (copy == NULL || path == NULL) {
+        ssh_key_free(copy);
+        SAFE_FREE(path);
+        return;
+    }
+
+    /* replace a stale key of the same file, or the least recently used */
+    for (i = 0; i < cache->count; i++) {
+        if (strcmp(cache->entries[i].path, filename) == 0) {
+            entry = &cache->entries[i];
+            break;
+        }
+    }
+    if (entry == NULL && cache->count < cache->max_entries) {
+        entry = &cache->entries[cache->count++];
+    }
+    if (entry == NULL) {
+        entry = &cache->entries[0];
+        for (i = 1; i < cache->count; i++) {
+            if (cache->entries[i].last_use < entry->last_use) {
+                entry = &cache->entries[i];
+            }
+        }
+    }
+    ssh_key_cache_entry_clear(entry);
+
+    entry->path = path;
+    entry->dev = sb->st_dev;
+    entry->ino = sb->st_ino;
+    entry->size = sb->st_size;
+    entry->mtime = sb->st_mtime;
+    entry->mtime_nsec = ssh_key_cache_mtime_nsec(sb);
+    entry->has_passphrase = has_passphrase;
+    if (has_passphrase) {
+        memcpy(entry->passphrase_hash, passphrase_hash, SHA256_DIGEST_LEN);
+    }
+    entry->last_use = ++cache->uses;
+    entry->key = copy;
+}
+
+/**
+ * @brief Import a key from a file, through a cache of decrypted keys.
+ *
+ * Works like ssh_pki_import_privkey_file(), but a key already loaded from the
+ * same file with the same passphrase is copied from the cache instead of
+ * being read and decrypted again. The file is identified by its path, device,
+ * inode, size and modification time, any change loads it again.
+ *
+ * A key decrypted with a passphrase returned by auth_fn is cached under that
+ * passphrase. A later call without a passphrase does not get it from the
+ * cache, auth_fn is asked again.
+ *
+ * @param[in]  cache    The cache to use, or NULL to not use any.
+ *
+ * @param[in]  filename The filename of the the private key.
+ *
+ * @param[in]  passphrase The passphrase to decrypt the private key. Set to NULL
+ *                        if none is needed or it is unknown.
+ *
+ * @param[in]  auth_fn  An auth function you may want to use or NULL.
+ *
+ * @param[in]  auth_data Private data passed to the auth function.
+ *
+ * @param[out] pkey     A pointer to store the allocated ssh_key. You need to
+ *                      free the key.
+ *
+ * @returns SSH_OK on success, SSH_EOF if the file doesn't exist or permission
+ *          denied, SSH_ERROR otherwise.
+ *
+ * @see ssh_key_cache_new()
+ * @see ssh_pki_import_privkey_file()
+ **/
+int ssh_pki_import_privkey_file_cached(ssh_key_cache cache,
+                                       const char *filename,
+                                       const char *passphrase,
+                                       ssh_auth_callback auth_fn,
+                                       void *auth_data,
+                                       ssh_key *pkey)
+{
+    unsigned char passphrase_hash[SHA256_DIGEST_LEN] = {0};
+    struct ssh_key_cache_auth auth;
+    struct ssh_key_cache_entry *entry;
+    struct stat sb;
+    ssh_key key = NULL;
+    int rc;
+
+    if (cache == NULL ||
+        pkey == NULL ||
+        filename == NULL ||
+        stat(filename, &sb) < 0) {
+        /* the uncached import reports the errors */
+        return ssh_pki_import_privkey_file(filename,
+                                           passphrase,
+                                           auth_fn,
+                                           auth_data,
+                                           pkey);
+    }
+
+    if (passphrase != NULL) {
+        ssh_key_cache_hash_passphrase(passphrase, passphrase_hash);
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    entry = ssh_key_cache_lookup(cache,
+                                 filename,
+                                 &sb,
+                                 passphrase != NULL,
+                                 passphrase_hash);
+    if (entry != NULL) {
+        entry->last_use = ++cache->uses;
+        key = pki_key_dup(entry->key, 0);
+    }
+    ssh_mutex_unlock(&cache->mutex);
+
+    if (entry != NULL) {
+        explicit_bzero(passphrase_hash, sizeof(passphrase_hash));
+        if (key == NULL) {
+            return SSH_ERROR;
+        }
+        *pkey = key;
+        return SSH_OK;
+    }
+
+    ZERO_STRUCT(auth);
+    auth.auth_fn = auth_fn;
+    auth.auth_data = auth_data;
+
+    rc = ssh_pki_import_privkey_file(filename,
+                                     passphrase,
+                                     auth_fn != NULL ? ssh_key_cache_auth_fn
+                                                     : NULL,
+                                     &auth,
+                                     &key);
+    if (rc == SSH_OK) {
+        if (passphrase == NULL && auth.used) {
+            memcpy(passphrase_hash, auth.passphrase_hash, SHA256_DIGEST_LEN);
+        }
+        ssh_mutex_lock(&cache->mutex);
+        ssh_key_cache_store(cache,
+                            filename,
+                            &sb,
+                            passphrase != NULL || auth.used,
+                            passphrase_hash,
+                            key);
+        ssh_mutex_unlock(&cache->mutex);
+        *pkey = key;
+    }
+    explicit_bzero(passphrase_hash, sizeof(passphrase_hash));
+    explicit_bzero(&auth, sizeof(auth));
+
+    return rc;
+}
+
 /**
  * @brief Export a private key to a pem file on disk, or OpenSSH format for
  *        keytype ssh-ed25519
@@ -1513,6 +1875,73 @@ int ssh_pki_import_cert_blob(const ssh_string cert_blob,
     return ssh_pki_import_pubkey_blob(cert_blob, pkey);
 }
 
+/**
+ * @internal
+ *
+ * @brief Import the public key a certificate was issued for.
+ *
+ * The key of the user is the one to verify the signatures made with the
+ * certificate, the certificate itself does not hold it as a key.
+ *
+ * @param[in]  cert     The certificate.
+ *
+ * @param[out] pkey     A pointer where the allocated key can be stored. You
+ *                      need to free the memory.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ *
+ * @see ssh_key_free()
+ */
+int ssh_pki_import_cert_key(const ssh_key cert, ssh_key *pkey)
+{
+    ssh_buffer buffer = NULL;
+    ssh_string type_s = NULL;
+    ssh_string nonce = NULL;
+    enum ssh_keytypes_e type;
+    int rc;
+
+    if (cert == NULL || cert->cert == NULL || pkey == NULL) {
+        return SSH_ERROR;
+    }
+
+    switch (cert->type) {
+        case SSH_KEYTYPE_DSS_CERT01:
+            type = SSH_KEYTYPE_DSS;
+            break;
+        case SSH_KEYTYPE_RSA_CERT01:
+            type = SSH_KEYTYPE_RSA;
+            break;
+        default:
+            return SSH_ERROR;
+    }
+
+    buffer = ssh_buffer_new();
+    if (buffer == NULL) {
+        return SSH_ERROR;
+    }
+    rc = ssh_buffer_add_data(buffer,
+                             ssh_buffer_get(cert->cert),
+                             ssh_buffer_get_len(cert->cert));
+    if (rc < 0) {
+        ssh_buffer_free(buffer);
+        return SSH_ERROR;
+    }
+
+    /* the key follows the type and the nonce */
+    rc = ssh_buffer_unpack(buffer, "SS", &type_s, &nonce);
+    ssh_string_free(type_s);
+    ssh_string_free(nonce);
+    if (rc != SSH_OK) {
+        ssh_buffer_free(buffer);
+        return SSH_ERROR;
+    }
+
+    rc = pki_import_pubkey_buffer(buffer, type, pkey);
+    ssh_buffer_free(buffer);
+
+    return rc;
+}
+
 /**
  * @brief Import a certificate from the given filename.
  *
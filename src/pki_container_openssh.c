@@ -76,6 +76,7 @@ static int pki_openssh_import_privkey_blob(ssh_buffer key_blob_buffer,
     type = ssh_key_type_from_name(type_s);
     if (type == SSH_KEYTYPE_UNKNOWN) {
         SSH_LOG(SSH_LOG_WARN, "Unknown key type '%s' found!", type_s);
+        SAFE_FREE(type_s);
         return SSH_ERROR;
     }
     SAFE_FREE(type_s);
@@ -170,6 +170,57 @@ error:
     return SSH_ERROR;
 }
 
+/**
+ * @internal
+ *
+ * @brief Verify several ed25519 signatures at once.
+ *
+ * @return SSH_OK if all the signatures are valid, SSH_ERROR if at least one
+ *         is not or if they could not be checked. Verify them one by one with
+ *         pki_ed25519_verify() to find the wrong ones.
+ */
+int pki_ed25519_verify_batch(const ssh_key *pubkeys,
+                             const ssh_signature *sigs,
+                             const unsigned char * const *hashes,
+                             const size_t *hlens,
+                             size_t n)
+{
+    const unsigned char **sig = NULL;
+    const unsigned char **pk = NULL;
+    unsigned long long *mlen = NULL;
+    size_t i;
+    int rc = SSH_ERROR;
+
+    sig = malloc(n * sizeof(*sig));
+    pk = malloc(n * sizeof(*pk));
+    mlen = malloc(n * sizeof(*mlen));
+    if (sig == NULL || pk == NULL || mlen == NULL) {
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (pubkeys[i] == NULL || pubkeys[i]->ed25519_pubkey == NULL ||
+            sigs[i] == NULL || sigs[i]->ed25519_sig == NULL ||
+            hashes[i] == NULL) {
+            goto out;
+        }
+        sig[i] = *sigs[i]->ed25519_sig;
+        pk[i] = *pubkeys[i]->ed25519_pubkey;
+        mlen[i] = hlens[i];
+    }
+
+    if (crypto_sign_ed25519_open_batch(sig, hashes, mlen, pk, n) == 0) {
+        rc = SSH_OK;
+    }
+
+out:
+    SAFE_FREE(sig);
+    SAFE_FREE(pk);
+    SAFE_FREE(mlen);
+
+    return rc;
+}
+
 /**
  * @internal
  *
@@ -55,10 +55,12 @@
 #include "libssh/kex.h"
 #include "libssh/misc.h"
 #include "libssh/pki.h"
+#include "libssh/pki_priv.h"
 #include "libssh/dh.h"
 #include "libssh/messages.h"
 #include "libssh/options.h"
 #include "libssh/curve25519.h"
+#include "libssh/bind.h"
 
 #define set_status(session, status) do {\
         if (session->common.callbacks && session->common.callbacks->connect_status_function) \
@@ -156,6 +158,7 @@ int server_set_kex(ssh_session session)
       return -1;
     }
   }
+  ssh_kex_set_algos(session, server);
 
   return 0;
 }
@@ -287,7 +290,7 @@ int ssh_get_key_params(ssh_session session, ssh_key *privkey){
  * @brief A function to be called each time a step has been done in the
  * connection.
  */
-static void ssh_server_connection_callback(ssh_session session){
+void ssh_server_connection_callback(ssh_session session){
     int rc;
 
     switch(session->session_state){
@@ -895,6 +898,7 @@ int ssh_auth_reply_success(ssh_session session, int partial)
 
     session->session_state = SSH_SESSION_STATE_AUTHENTICATED;
     session->flags |= SSH_SESSION_FLAG_AUTHENTICATED;
+    ssh_bind_admission_release(session);
 
     r = ssh_buffer_add_u8(session->out_buffer,SSH2_MSG_USERAUTH_SUCCESS);
     if (r < 0) {
@@ -1102,4 +1106,285 @@ int ssh_send_keepalive(ssh_session session)
     return SSH_OK;
 }
 
+#define SSH_VERIFY_QUEUE_DEFAULT_BATCH 32
+#define SSH_VERIFY_QUEUE_MAX_BATCH 64
+
+struct ssh_verify_item {
+    ssh_message msg;
+    ssh_signature sig;
+    ssh_buffer digest;
+};
+
+/* a batch taken out of the queue, whose sessions are being resumed */
+struct ssh_verify_batch {
+    struct ssh_verify_item items[SSH_VERIFY_QUEUE_MAX_BATCH];
+    unsigned int count;
+    /* the batch of the flush this one is nested in */
+    struct ssh_verify_batch *next;
+};
+
+struct ssh_verify_queue_struct {
+    struct ssh_verify_item items[SSH_VERIFY_QUEUE_MAX_BATCH];
+    unsigned int batch_size;
+    unsigned int count;
+    /* the batches in flight, a session resumed may flush again */
+    struct ssh_verify_batch *flushing;
+};
+
+/**
+ * @brief Create a queue to verify the signatures of publickey authentication
+ *        requests in batches.
+ *
+ * Ed25519 signatures can be checked together for about half the cost of
+ * checking them one by one. Once set on sessions with ssh_set_verify_queue(),
+ * their signed publickey requests with an ed25519 key are held in the queue
+ * instead of being verified on arrival. The queue is verified when it holds
+ * batch_size requests or when ssh_verify_queue_flush() is called, then the
+ * requests are handed to the server callbacks or the message queue of their
+ * session as if they had just been received.
+ *
+ * The sessions sharing a queue must be driven by the same thread, usually
+ * with an ssh_event. Call ssh_verify_queue_flush() after each
+ * ssh_event_dopoll() so no request waits for a full batch.
+ *
+ * @param[in]  batch_size  The number of requests verified together, 0 for the
+ *                         default. It is limited to 64.
+ *
+ * @return                 The new queue, NULL on error.
+ *
+ * @see ssh_verify_queue_free()
+ */
+ssh_verify_queue ssh_verify_queue_new(unsigned int batch_size)
+{
+    ssh_verify_queue queue;
+
+    queue = calloc(1, sizeof(struct ssh_verify_queue_struct));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    if (batch_size == 0) {
+        batch_size = SSH_VERIFY_QUEUE_DEFAULT_BATCH;
+    }
+    queue->batch_size = MIN(batch_size, SSH_VERIFY_QUEUE_MAX_BATCH);
+
+    return queue;
+}
+
+/**
+ * @brief Free a verification queue, verifying the requests it still holds.
+ *
+ * The sessions using the queue must have been freed or detached with
+ * ssh_set_verify_queue(session, NULL) before.
+ *
+ * @param[in]  queue    The queue to free.
+ */
+void ssh_verify_queue_free(ssh_verify_queue queue)
+{
+    if (queue == NULL) {
+        return;
+    }
+
+    ssh_verify_queue_flush(queue);
+    SAFE_FREE(queue);
+}
+
+/**
+ * @brief Set the verification queue of the publickey authentication requests
+ *        of a server session.
+ *
+ * @param[in]  session  The server session.
+ *
+ * @param[in]  queue    The queue, or NULL to verify the signatures on arrival
+ *                      again. The requests held in the previous queue are
+ *                      verified first.
+ *
+ * @return              SSH_OK on success, SSH_ERROR on error.
+ */
+int ssh_set_verify_queue(ssh_session session, ssh_verify_queue queue)
+{
+    if (session == NULL || session->client) {
+        return SSH_ERROR;
+    }
+
+    if (session->srv.verify_queue != NULL &&
+        session->srv.verify_queue != queue) {
+        ssh_verify_queue_flush(session->srv.verify_queue);
+    }
+    session->srv.verify_queue = queue;
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Verify the requests held in a queue and resume their sessions.
+ *
+ * If the batch does not verify, the signatures are checked one by one so
+ * only the wrong ones are rejected. The batch check includes the cofactor
+ * of the curve: a signature crafted by the key holder with a component of
+ * small order may be accepted in a batch and rejected on its own.
+ *
+ * @param[in]  queue    The queue to verify.
+ *
+ * @return              The number of requests verified, SSH_ERROR on error.
+ */
+int ssh_verify_queue_flush(ssh_verify_queue queue)
+{
+    struct ssh_verify_batch batch;
+    struct ssh_verify_item *items = batch.items;
+    ssh_key keys[SSH_VERIFY_QUEUE_MAX_BATCH];
+    ssh_signature sigs[SSH_VERIFY_QUEUE_MAX_BATCH];
+    const unsigned char *hashes[SSH_VERIFY_QUEUE_MAX_BATCH];
+    size_t hlens[SSH_VERIFY_QUEUE_MAX_BATCH];
+    ssh_message msg;
+    unsigned int count;
+    unsigned int i;
+    int valid;
+    int rc;
+
+    if (queue == NULL) {
+        return SSH_ERROR;
+    }
+
+    count = queue->count;
+    if (count == 0) {
+        return 0;
+    }
+
+    /*
+     * resuming the sessions may queue new requests, or free sessions whose
+     * requests are still in the batch: ssh_verify_queue_cancel() drops them
+     * from it
+     */
+    memcpy(items, queue->items, count * sizeof(items[0]));
+    batch.count = count;
+    batch.next = queue->flushing;
+    queue->flushing = &batch;
+    queue->count = 0;
+
+    for (i = 0; i < count; i++) {
+        keys[i] = items[i].msg->auth_request.pubkey;
+        sigs[i] = items[i].sig;
+        hashes[i] = ssh_buffer_get(items[i].digest);
+        hlens[i] = ssh_buffer_get_len(items[i].digest);
+    }
+
+    rc = pki_ed25519_verify_batch(keys, sigs, hashes, hlens, count);
+    if (rc != SSH_OK) {
+        SSH_LOG(SSH_LOG_PACKET,
+                "Batch of %u signatures failed, verifying them one by one",
+                count);
+    }
+
+    for (i = 0; i < count; i++) {
+        msg = items[i].msg;
+        if (msg == NULL) {
+            /* its session was freed by a previous one */
+            continue;
+        }
+        items[i].msg = NULL;
+
+        valid = rc == SSH_OK ||
+                pki_ed25519_verify(keys[i], sigs[i], hashes[i], hlens[i]) == SSH_OK;
+
+        ssh_signature_free(items[i].sig);
+        SSH_BUFFER_FREE(items[i].digest);
+        ssh_message_userauth_verified(msg, valid);
+    }
+    queue->flushing = batch.next;
+
+    return (int)count;
+}
+
+/**
+ * @brief Get the number of requests waiting in a verification queue.
+ *
+ * @param[in]  queue    The queue.
+ *
+ * @return              The number of requests waiting.
+ */
+unsigned int ssh_verify_queue_pending(ssh_verify_queue queue)
+{
+    if (queue == NULL) {
+        return 0;
+    }
+
+    return queue->count;
+}
+
+/**
+ * @internal
+ *
+ * @brief Hold a publickey authentication request until its signature is
+ * verified with the others of the queue. Takes ownership of all parameters.
+ */
+void ssh_verify_queue_push(ssh_verify_queue queue,
+                           ssh_message msg,
+                           ssh_signature sig,
+                           ssh_buffer digest)
+{
+    unsigned int i;
+
+    /* keep the requests of a session in order */
+    for (i = 0; i < queue->count; i++) {
+        if (queue->items[i].msg->session == msg->session) {
+            ssh_verify_queue_flush(queue);
+            break;
+        }
+    }
+
+    queue->items[queue->count].msg = msg;
+    queue->items[queue->count].sig = sig;
+    queue->items[queue->count].digest = digest;
+    queue->count++;
+
+    if (queue->count >= queue->batch_size) {
+        ssh_verify_queue_flush(queue);
+    }
+}
+
+/**
+ * @internal
+ *
+ * @brief Drop the requests of a session being freed from its queue.
+ */
+void ssh_verify_queue_cancel(ssh_session session)
+{
+    ssh_verify_queue queue = session->srv.verify_queue;
+    struct ssh_verify_batch *batch = NULL;
+    unsigned int i;
+    unsigned int j = 0;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    /* the batches being flushed skip the items left without a message */
+    for (batch = queue->flushing; batch != NULL; batch = batch->next) {
+        for (i = 0; i < batch->count; i++) {
+            struct ssh_verify_item *item = &batch->items[i];
+
+            if (item->msg != NULL && item->msg->session == session) {
+                ssh_signature_free(item->sig);
+                SSH_BUFFER_FREE(item->digest);
+                SSH_MESSAGE_FREE(item->msg);
+            }
+        }
+    }
+
+    for (i = 0; i < queue->count; i++) {
+        struct ssh_verify_item *item = &queue->items[i];
+
+        if (item->msg->session == session) {
+            ssh_signature_free(item->sig);
+            SSH_BUFFER_FREE(item->digest);
+            SSH_MESSAGE_FREE(item->msg);
+            continue;
+        }
+        queue->items[j++] = *item;
+    }
+    queue->count = j;
+    session->srv.verify_queue = NULL;
+}
+
 /** @} */
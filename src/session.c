@@ -39,6 +39,11 @@
 #include "libssh/buffer.h"
 #include "libssh/poll.h"
 #include "libssh/pki.h"
+#include "libssh/messages.h"
+#include "libssh/bind.h"
+#ifdef WITH_GSSAPI
+#include "libssh/gssapi.h"
+#endif
 
 #define FIRST_CHANNEL 42 // why not ? it helps to find bugs.
 
@@ -182,6 +187,16 @@ void ssh_free(ssh_session session)
     return;
   }
 
+#ifdef WITH_SERVER
+  ssh_verify_queue_cancel(session);
+  ssh_bind_admission_release(session);
+#endif /* WITH_SERVER */
+
+#ifdef WITH_GSSAPI
+  /* drops the credentials the session shares with the others */
+  ssh_gssapi_free(session);
+#endif /* WITH_GSSAPI */
+
   /*
    * Delete all channels
    *
@@ -265,7 +280,7 @@ void ssh_free(ssh_session session)
       for (id = ssh_list_pop_head(char *, session->opts.identity);
            id != NULL;
            id = ssh_list_pop_head(char *, session->opts.identity)) {
-          SAFE_FREE(id);
+          SSH_OPTIONS_FREE(session, id);
       }
       ssh_list_free(session->opts.identity);
   }
@@ -286,24 +301,28 @@ void ssh_free(ssh_session session)
   SAFE_FREE(session->clientbanner);
   SAFE_FREE(session->banner);
 
-  SAFE_FREE(session->opts.bindaddr);
-  SAFE_FREE(session->opts.custombanner);
-  SAFE_FREE(session->opts.username);
-  SAFE_FREE(session->opts.host);
-  SAFE_FREE(session->opts.sshdir);
-  SAFE_FREE(session->opts.knownhosts);
-  SAFE_FREE(session->opts.global_knownhosts);
-  SAFE_FREE(session->opts.ProxyCommand);
-  SAFE_FREE(session->opts.gss_server_identity);
-  SAFE_FREE(session->opts.gss_client_identity);
-  SAFE_FREE(session->opts.pubkey_accepted_types);
+  SSH_OPTIONS_FREE(session, session->opts.bindaddr);
+  SSH_OPTIONS_FREE(session, session->opts.custombanner);
+  SSH_OPTIONS_FREE(session, session->opts.username);
+  SSH_OPTIONS_FREE(session, session->opts.host);
+  SSH_OPTIONS_FREE(session, session->opts.sshdir);
+  SSH_OPTIONS_FREE(session, session->opts.knownhosts);
+  SSH_OPTIONS_FREE(session, session->opts.global_knownhosts);
+  SSH_OPTIONS_FREE(session, session->opts.ProxyCommand);
+  SSH_OPTIONS_FREE(session, session->opts.control_path);
+  SSH_OPTIONS_FREE(session, session->opts.gss_server_identity);
+  SSH_OPTIONS_FREE(session, session->opts.gss_client_identity);
+  SSH_OPTIONS_FREE(session, session->opts.pubkey_accepted_types);
 
   for (i = 0; i < 10; i++) {
       if (session->opts.wanted_methods[i]) {
-          SAFE_FREE(session->opts.wanted_methods[i]);
+          SSH_OPTIONS_FREE(session, session->opts.wanted_methods[i]);
       }
   }
 
+  ssh_session_template_free(session->session_template);
+  session->session_template = NULL;
+
   /* burn connection, it could contain sensitive data */
   explicit_bzero(session, sizeof(struct ssh_session_struct));
   SAFE_FREE(session);
@@ -642,6 +661,14 @@ int ssh_handle_packets(ssh_session session, int timeout) {
     }
     rc = ssh_poll_ctx_dopoll(ctx, tm);
     if (rc == SSH_ERROR) {
+        if (ctx != session->default_poll_ctx &&
+            session->session_state != SSH_SESSION_STATE_ERROR) {
+            /*
+             * The context of an event is shared: the socket of another
+             * session was closed, this one is polled again.
+             */
+            return SSH_OK;
+        }
         session->session_state = SSH_SESSION_STATE_ERROR;
     }
 
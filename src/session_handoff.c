@@ -0,0 +1,835 @@
+/*
+ * session_handoff.c - hand an established session over to another process
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libssh/priv.h"
+#include "libssh/libssh.h"
+#include "libssh/auth.h"
+#include "libssh/bind.h"
+#include "libssh/buffer.h"
+#include "libssh/channels.h"
+#include "libssh/crypto.h"
+#include "libssh/kex.h"
+#include "libssh/packet.h"
+#include "libssh/pki.h"
+#include "libssh/session.h"
+#include "libssh/socket.h"
+#include "libssh/string.h"
+#include "libssh/wrapper.h"
+
+/* bumped whenever the layout of the exported state changes */
+#define SSH_SESSION_HANDOFF_VERSION 1
+
+/* the fixed field of the nonce of AES-GCM, followed by its counter */
+#define SSH_SESSION_HANDOFF_GCM_FIXED 4
+
+/**
+ * @addtogroup libssh_session
+ *
+ * @{
+ */
+
+/*
+ * Only the ciphers whose state follows from the keys and the counters can be
+ * carried over: those of CBC chain on the last block which went through them.
+ */
+static bool ssh_session_handoff_supported(struct ssh_cipher_struct *cipher)
+{
+    switch (cipher->ciphertype) {
+    case SSH_AES128_CTR:
+    case SSH_AES192_CTR:
+    case SSH_AES256_CTR:
+    case SSH_AEAD_AES128_GCM:
+    case SSH_AEAD_AES256_GCM:
+    case SSH_AEAD_CHACHA20_POLY1305:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Adds n to the big endian counter of len bytes at iv */
+static void ssh_session_handoff_advance(unsigned char *iv,
+                                        size_t len,
+                                        uint64_t n)
+{
+    size_t i;
+
+    for (i = len; i > 0 && n != 0; i--) {
+        uint64_t sum = iv[i - 1] + (n & 0xff);
+
+        iv[i - 1] = sum & 0xff;
+        n = (n >> 8) + (sum >> 8);
+    }
+}
+
+static int ssh_session_export_cipher(ssh_buffer buffer,
+                                     struct ssh_cipher_struct *cipher,
+                                     unsigned char *key,
+                                     unsigned char *iv,
+                                     size_t iv_len,
+                                     unsigned char *mac,
+                                     size_t mac_len)
+{
+    size_t key_len = cipher->keysize / 8;
+
+    return ssh_buffer_pack(buffer,
+                           "dPdPdPdqq",
+                           (uint32_t)key_len, key_len, key,
+                           (uint32_t)iv_len, iv_len, iv,
+                           (uint32_t)mac_len, mac_len, mac,
+                           cipher->packets,
+                           cipher->blocks,
+                           cipher->stream_blocks);
+}
+
+static int ssh_session_export_channel(ssh_buffer buffer, ssh_channel channel)
+{
+    uint32_t out_len = ssh_buffer_get_len(channel->stdout_buffer);
+    uint32_t err_len = ssh_buffer_get_len(channel->stderr_buffer);
+
+    return ssh_buffer_pack(buffer,
+                           "dddddddddddddPdP",
+                           channel->local_channel,
+                           channel->local_window,
+                           (uint32_t)channel->local_eof,
+                           channel->local_maxpacket,
+                           channel->remote_channel,
+                           channel->remote_window,
+                           (uint32_t)channel->remote_eof,
+                           channel->remote_maxpacket,
+                           (uint32_t)channel->state,
+                           (uint32_t)channel->delayed_close,
+                           (uint32_t)channel->flags,
+                           (uint32_t)channel->exit_status,
+                           out_len,
+                           (size_t)out_len,
+                           ssh_buffer_get(channel->stdout_buffer),
+                           err_len,
+                           (size_t)err_len,
+                           ssh_buffer_get(channel->stderr_buffer));
+}
+
+/**
+ * @brief Export the state of an authenticated session, so another process
+ * or thread can resume it with ssh_session_import().
+ *
+ * This is meant for servers where a front process accepts and authenticates
+ * the clients, then hands each session over to a worker: the socket is
+ * passed along (with SCM_RIGHTS for a process) and the worker carries on
+ * with the keys, the sequence numbers and the channels of the session,
+ * without a new key exchange.
+ *
+ * Only the sessions encrypted with AES-CTR, AES-GCM or chacha20-poly1305 and
+ * without compression can be exported. The messages of the session not
+ * handled yet and the callbacks of its channels are not part of the state.
+ *
+ * Once exported, nothing should be sent or received on the session: it is
+ * to be released with ssh_free(), not ssh_disconnect().
+ *
+ * @param[in]  session  The authenticated session to export.
+ *
+ * @param[in]  buffer   The buffer to append the state to. It holds the
+ *                      session keys, and is cleared when freed.
+ *
+ * @return              SSH_OK on success,
+ *                      SSH_AGAIN if a key exchange is in progress, data is
+ *                      left to send or a global or channel request waits
+ *                      for its reply: let the session process its packets
+ *                      or flush it, then retry,
+ *                      SSH_ERROR on error.
+ *
+ * @see ssh_session_import()
+ * @see ssh_blocking_flush()
+ */
+int ssh_session_export(ssh_session session, ssh_buffer buffer)
+{
+    struct ssh_crypto_struct *crypto = NULL;
+    struct ssh_iterator *it = NULL;
+    ssh_buffer in_buffer = NULL;
+    ssh_string pubkey = NULL;
+    void *first_block = NULL;
+    uint32_t first_block_len = 0;
+    uint32_t packet_len = 0;
+    uint32_t count = 0;
+    int rc;
+    int i;
+
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+    if (buffer == NULL) {
+        ssh_set_error_invalid(session);
+        return SSH_ERROR;
+    }
+
+    if (session->session_state != SSH_SESSION_STATE_AUTHENTICATED) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Only authenticated sessions can be exported");
+        return SSH_ERROR;
+    }
+
+    crypto = session->current_crypto;
+    if (crypto == NULL ||
+        session->dh_handshake_state != DH_STATE_FINISHED ||
+        session->next_crypto->used != 0 ||
+        ssh_list_count(session->out_queue) > 0 ||
+        session->packet_state == PACKET_STATE_PROCESSING ||
+        ssh_socket_buffered_write_bytes(session->socket) > 0) {
+        return SSH_AGAIN;
+    }
+
+    /* the reply to a pending request would be dropped by the importer */
+    if (session->global_req_state == SSH_CHANNEL_REQ_STATE_PENDING) {
+        return SSH_AGAIN;
+    }
+    for (it = ssh_list_get_iterator(session->channels);
+         it != NULL;
+         it = it->next) {
+        ssh_channel channel = ssh_iterator_value(ssh_channel, it);
+
+        if (channel->request_state == SSH_CHANNEL_REQ_STATE_PENDING) {
+            return SSH_AGAIN;
+        }
+    }
+
+    if (crypto->do_compress_in || crypto->do_compress_out ||
+        crypto->delayed_compress_in || crypto->delayed_compress_out) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Compressed sessions cannot be exported");
+        return SSH_ERROR;
+    }
+    if (!ssh_session_handoff_supported(crypto->out_cipher) ||
+        !ssh_session_handoff_supported(crypto->in_cipher)) {
+        ssh_set_error(session, SSH_FATAL,
+                      "The state of cipher %s cannot be exported",
+                      ssh_session_handoff_supported(crypto->out_cipher) ?
+                      crypto->in_cipher->name : crypto->out_cipher->name);
+        return SSH_ERROR;
+    }
+    if (ssh_list_count(session->ssh_message_list) > 0) {
+        ssh_set_error(session, SSH_FATAL,
+                      "The pending messages must be handled before exporting "
+                      "the session");
+        return SSH_ERROR;
+    }
+
+    if (crypto->server_pubkey != NULL) {
+        rc = ssh_pki_export_pubkey_blob(crypto->server_pubkey, &pubkey);
+        if (rc != SSH_OK) {
+            ssh_set_error_oom(session);
+            return SSH_ERROR;
+        }
+    } else {
+        pubkey = ssh_string_new(0);
+        if (pubkey == NULL) {
+            ssh_set_error_oom(session);
+            return SSH_ERROR;
+        }
+    }
+
+    ssh_buffer_set_secure(buffer);
+
+    rc = ssh_buffer_pack(buffer,
+                         "dbssddddddddPS",
+                         SSH_SESSION_HANDOFF_VERSION,
+                         (uint8_t)(session->server ? 1 : 0),
+                         session->serverbanner,
+                         session->clientbanner,
+                         (uint32_t)session->openssh,
+                         (uint32_t)(session->flags &
+                                    SSH_SESSION_FLAG_AUTHENTICATED),
+                         session->extensions,
+                         session->send_seq,
+                         session->recv_seq,
+                         (uint32_t)session->srv.hostkey,
+                         (uint32_t)crypto->kex_type,
+                         (uint32_t)crypto->digest_len,
+                         crypto->digest_len,
+                         crypto->session_id,
+                         pubkey);
+    SSH_STRING_FREE(pubkey);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    for (i = 0; i < SSH_KEX_METHODS; i++) {
+        rc = ssh_buffer_pack(buffer,
+                             "sb",
+                             crypto->kex_methods[i] != NULL ?
+                             crypto->kex_methods[i] : "",
+                             crypto->kex_algos[i]);
+        if (rc != SSH_OK) {
+            goto error;
+        }
+    }
+
+    rc = ssh_session_export_cipher(buffer,
+                                   crypto->out_cipher,
+                                   crypto->encryptkey,
+                                   crypto->encryptIV,
+                                   crypto->digest_len,
+                                   crypto->encryptMAC,
+                                   hmac_digest_len(crypto->out_hmac));
+    if (rc != SSH_OK) {
+        goto error;
+    }
+    rc = ssh_session_export_cipher(buffer,
+                                   crypto->in_cipher,
+                                   crypto->decryptkey,
+                                   crypto->decryptIV,
+                                   crypto->digest_len,
+                                   crypto->decryptMAC,
+                                   hmac_digest_len(crypto->in_hmac));
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    /*
+     * The start of the next packet, already read from the socket, and its
+     * first block if it was decrypted to get its length.
+     */
+    in_buffer = ssh_socket_get_in_buffer(session->socket);
+    first_block = ssh_buffer_get(session->in_buffer);
+    if (session->packet_state == PACKET_STATE_SIZEREAD) {
+        packet_len = session->in_packet.len;
+        first_block_len = ssh_buffer_get_len(session->in_buffer);
+    }
+    for (it = ssh_list_get_iterator(session->channels);
+         it != NULL;
+         it = it->next) {
+        count++;
+    }
+    rc = ssh_buffer_pack(buffer,
+                         "dPbddPdd",
+                         ssh_buffer_get_len(in_buffer),
+                         (size_t)ssh_buffer_get_len(in_buffer),
+                         ssh_buffer_get(in_buffer),
+                         (uint8_t)session->packet_state,
+                         packet_len,
+                         first_block_len,
+                         (size_t)first_block_len,
+                         first_block,
+                         (uint32_t)session->maxchannel,
+                         count);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    for (it = ssh_list_get_iterator(session->channels);
+         it != NULL;
+         it = it->next) {
+        rc = ssh_session_export_channel(buffer,
+                                        ssh_iterator_value(ssh_channel, it));
+        if (rc != SSH_OK) {
+            goto error;
+        }
+    }
+
+    return SSH_OK;
+
+error:
+    ssh_set_error_oom(session);
+    return SSH_ERROR;
+}
+
+/*
+ * Reads the keys of one direction into the crypto structure and starts its
+ * cipher where the exporting process left it.
+ */
+static int ssh_session_import_cipher(ssh_session session,
+                                     ssh_buffer buffer,
+                                     struct ssh_cipher_struct *cipher,
+                                     enum ssh_hmac_e hmac,
+                                     unsigned char **key,
+                                     unsigned char **iv,
+                                     unsigned char **mac,
+                                     bool encrypt)
+{
+    struct ssh_crypto_struct *crypto = session->next_crypto;
+    unsigned char current_iv[DIGEST_MAX_LEN];
+    ssh_string key_s = NULL;
+    ssh_string iv_s = NULL;
+    ssh_string mac_s = NULL;
+    uint32_t packets;
+    uint64_t blocks, stream_blocks;
+    size_t key_len = cipher->keysize / 8;
+    size_t mac_len = hmac_digest_len(hmac);
+    int rc;
+
+    rc = ssh_buffer_unpack(buffer,
+                           "SSSdqq",
+                           &key_s,
+                           &iv_s,
+                           &mac_s,
+                           &packets,
+                           &blocks,
+                           &stream_blocks);
+    if (rc != SSH_OK) {
+        ssh_set_error(session, SSH_FATAL, "Invalid exported session");
+        return SSH_ERROR;
+    }
+
+    if (ssh_string_len(key_s) != key_len ||
+        ssh_string_len(iv_s) != crypto->digest_len ||
+        ssh_string_len(mac_s) != mac_len ||
+        crypto->digest_len > sizeof(current_iv)) {
+        ssh_set_error(session, SSH_FATAL, "Invalid exported session");
+        rc = SSH_ERROR;
+        goto out;
+    }
+
+    /* crypto_free() clears the keys over digest_len bytes */
+    *key = calloc(1, MAX(key_len, crypto->digest_len));
+    *iv = malloc(crypto->digest_len);
+    *mac = calloc(1, MAX(mac_len, 1));
+    if (*key == NULL || *iv == NULL || *mac == NULL) {
+        ssh_set_error_oom(session);
+        rc = SSH_ERROR;
+        goto out;
+    }
+    memcpy(*key, ssh_string_data(key_s), key_len);
+    memcpy(*iv, ssh_string_data(iv_s), crypto->digest_len);
+    memcpy(*mac, ssh_string_data(mac_s), mac_len);
+
+    ssh_init_rekey_state(session, cipher);
+    cipher->packets = packets;
+    cipher->blocks = blocks;
+    cipher->stream_blocks = stream_blocks;
+
+    memcpy(current_iv, *iv, crypto->digest_len);
+    switch (cipher->ciphertype) {
+    case SSH_AES128_CTR:
+    case SSH_AES192_CTR:
+    case SSH_AES256_CTR:
+        ssh_session_handoff_advance(current_iv,
+                                    cipher->blocksize,
+                                    stream_blocks);
+        break;
+    case SSH_AEAD_AES128_GCM:
+    case SSH_AEAD_AES256_GCM:
+        ssh_session_handoff_advance(current_iv + SSH_SESSION_HANDOFF_GCM_FIXED,
+                                    AES_GCM_IVLEN -
+                                    SSH_SESSION_HANDOFF_GCM_FIXED,
+                                    packets);
+        break;
+    case SSH_AEAD_CHACHA20_POLY1305:
+        /* the nonce is the sequence number */
+        break;
+    default:
+        ssh_set_error(session, SSH_FATAL,
+                      "The state of cipher %s cannot be imported",
+                      cipher->name);
+        rc = SSH_ERROR;
+        goto out;
+    }
+
+    if (encrypt) {
+        rc = cipher->set_encrypt_key(cipher, *key, current_iv);
+    } else {
+        rc = cipher->set_decrypt_key(cipher, *key, current_iv);
+    }
+    if (rc < 0) {
+        ssh_set_error(session, SSH_FATAL, "Setting the imported keys failed");
+        rc = SSH_ERROR;
+        goto out;
+    }
+    rc = SSH_OK;
+
+out:
+    explicit_bzero(current_iv, sizeof(current_iv));
+    ssh_string_burn(key_s);
+    SSH_STRING_FREE(key_s);
+    SSH_STRING_FREE(iv_s);
+    ssh_string_burn(mac_s);
+    SSH_STRING_FREE(mac_s);
+    return rc;
+}
+
+static ssh_channel ssh_session_import_channel(ssh_session session,
+                                              ssh_buffer buffer)
+{
+    ssh_channel channel = NULL;
+    ssh_string out = NULL;
+    ssh_string err = NULL;
+    uint32_t local_eof, remote_eof, state, delayed_close, flags;
+    uint32_t exit_status;
+    int rc;
+
+    channel = ssh_channel_new(session);
+    if (channel == NULL) {
+        return NULL;
+    }
+
+    rc = ssh_buffer_unpack(buffer,
+                           "ddddddddddddSS",
+                           &channel->local_channel,
+                           &channel->local_window,
+                           &local_eof,
+                           &channel->local_maxpacket,
+                           &channel->remote_channel,
+                           &channel->remote_window,
+                           &remote_eof,
+                           &channel->remote_maxpacket,
+                           &state,
+                           &delayed_close,
+                           &flags,
+                           &exit_status,
+                           &out,
+                           &err);
+    if (rc != SSH_OK || state > SSH_CHANNEL_STATE_CLOSED) {
+        ssh_set_error(session, SSH_FATAL, "Invalid exported channel");
+        goto error;
+    }
+    channel->local_eof = (int)local_eof;
+    channel->remote_eof = (int)remote_eof;
+    channel->state = (enum ssh_channel_state_e)state;
+    channel->delayed_close = (int)delayed_close;
+    channel->flags = (int)flags;
+    channel->exit_status = (int)exit_status;
+
+    if (ssh_buffer_add_data(channel->stdout_buffer,
+                            ssh_string_data(out),
+                            ssh_string_len(out)) < 0 ||
+        ssh_buffer_add_data(channel->stderr_buffer,
+                            ssh_string_data(err),
+                            ssh_string_len(err)) < 0) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    SSH_STRING_FREE(out);
+    SSH_STRING_FREE(err);
+
+    return channel;
+
+error:
+    SSH_STRING_FREE(out);
+    SSH_STRING_FREE(err);
+    /* the channel is not known to the peer, nothing to close */
+    channel->flags |= SSH_CHANNEL_FLAG_FREED_LOCAL;
+    ssh_channel_do_free(channel);
+    return NULL;
+}
+
+/**
+ * @brief Resume a session exported with ssh_session_export() in another
+ * process or thread.
+ *
+ * The session picks up the keys, the sequence numbers and the channels of
+ * the exported one, then carries on over the socket without a new key
+ * exchange: the peer cannot tell the difference.
+ *
+ * For a server, call ssh_bind_accept_fd() with the socket first so the
+ * session gets the host keys and the options of the ssh_bind, which later
+ * key exchanges need. A client only needs a new session from ssh_new(),
+ * with the options of the exporting one.
+ *
+ * The channels are given back in the order they were exported, except those
+ * already freed by the exporting process, which are only kept until the peer
+ * closes them. Their callbacks have to be set again.
+ *
+ * If this fails the session is left half restored and must be freed.
+ *
+ * @param[in]  session  A new session, never connected.
+ *
+ * @param[in]  fd       The socket of the exported session.
+ *
+ * @param[in]  buffer   The buffer holding the exported state, it is consumed.
+ *
+ * @param[out] channels An array of max entries to store the restored
+ *                      channels in, or NULL.
+ *
+ * @param[in]  max      The number of entries of channels.
+ *
+ * @return              The number of channels restored, which may be more
+ *                      than max, or SSH_ERROR on error.
+ *
+ * @see ssh_session_export()
+ */
+int ssh_session_import(ssh_session session,
+                       socket_t fd,
+                       ssh_buffer buffer,
+                       ssh_channel *channels,
+                       int max)
+{
+    struct ssh_crypto_struct *crypto = NULL;
+    ssh_string session_id = NULL;
+    ssh_string pubkey = NULL;
+    ssh_string input = NULL;
+    ssh_string first_block = NULL;
+    char *serverbanner = NULL;
+    char *clientbanner = NULL;
+    uint32_t version, openssh, flags, extensions, send_seq, recv_seq;
+    uint32_t hostkey, kex_type, digest_len, maxchannel, count, n;
+    uint32_t packet_len;
+    uint8_t server, packet_state;
+    int restored = 0;
+    int rc;
+    int i;
+
+    if (session == NULL) {
+        return SSH_ERROR;
+    }
+    if (buffer == NULL || fd == SSH_INVALID_SOCKET || max < 0 ||
+        (channels == NULL && max > 0)) {
+        ssh_set_error_invalid(session);
+        return SSH_ERROR;
+    }
+    if (session->session_state != SSH_SESSION_STATE_NONE ||
+        session->current_crypto != NULL) {
+        ssh_set_error(session, SSH_FATAL,
+                      "A session can only be imported into a new one");
+        return SSH_ERROR;
+    }
+
+    ssh_buffer_set_secure(buffer);
+
+    rc = ssh_buffer_unpack(buffer,
+                           "dbssdddddddSS",
+                           &version,
+                           &server,
+                           &serverbanner,
+                           &clientbanner,
+                           &openssh,
+                           &flags,
+                           &extensions,
+                           &send_seq,
+                           &recv_seq,
+                           &hostkey,
+                           &kex_type,
+                           &session_id,
+                           &pubkey);
+    if (rc != SSH_OK) {
+        ssh_set_error(session, SSH_FATAL, "Invalid exported session");
+        return SSH_ERROR;
+    }
+    digest_len = ssh_string_len(session_id);
+    if (version != SSH_SESSION_HANDOFF_VERSION ||
+        digest_len == 0 || digest_len > DIGEST_MAX_LEN) {
+        ssh_set_error(session, SSH_FATAL, "Invalid exported session");
+        goto error;
+    }
+
+    session->server = server ? 1 : 0;
+    session->client = !session->server;
+    SAFE_FREE(session->serverbanner);
+    SAFE_FREE(session->clientbanner);
+    session->serverbanner = serverbanner;
+    session->clientbanner = clientbanner;
+    serverbanner = NULL;
+    clientbanner = NULL;
+    session->protoversion = 2;
+    session->openssh = (int)openssh;
+    session->flags |= flags & SSH_SESSION_FLAG_AUTHENTICATED;
+    session->extensions = extensions;
+    session->send_seq = send_seq;
+    session->recv_seq = recv_seq;
+    session->srv.hostkey = (enum ssh_keytypes_e)hostkey;
+
+    crypto = session->next_crypto;
+    crypto->kex_type = (enum ssh_key_exchange_e)kex_type;
+    crypto->digest_len = digest_len;
+    SAFE_FREE(crypto->session_id);
+    crypto->session_id = malloc(digest_len);
+    if (crypto->session_id == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    memcpy(crypto->session_id, ssh_string_data(session_id), digest_len);
+
+    if (ssh_string_len(pubkey) > 0) {
+        rc = ssh_pki_import_pubkey_blob(pubkey, &crypto->server_pubkey);
+        if (rc != SSH_OK) {
+            ssh_set_error(session, SSH_FATAL, "Invalid exported host key");
+            goto error;
+        }
+    }
+
+    for (i = 0; i < SSH_KEX_METHODS; i++) {
+        SAFE_FREE(crypto->kex_methods[i]);
+        rc = ssh_buffer_unpack(buffer,
+                               "sb",
+                               &crypto->kex_methods[i],
+                               &crypto->kex_algos[i]);
+        if (rc != SSH_OK) {
+            ssh_set_error(session, SSH_FATAL, "Invalid exported session");
+            goto error;
+        }
+    }
+
+    if (session->server) {
+#ifdef WITH_SERVER
+        rc = crypt_set_algorithms_server(session);
+#else
+        ssh_set_error(session, SSH_FATAL, "Server support is not built in");
+        rc = SSH_ERROR;
+#endif /* WITH_SERVER */
+    } else {
+        rc = crypt_set_algorithms_client(session);
+    }
+    if (rc != SSH_OK) {
+        goto error;
+    }
+    if (crypto->do_compress_in || crypto->do_compress_out ||
+        crypto->delayed_compress_in || crypto->delayed_compress_out) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Compressed sessions cannot be imported");
+        goto error;
+    }
+
+    rc = ssh_session_import_cipher(session,
+                                   buffer,
+                                   crypto->out_cipher,
+                                   crypto->out_hmac,
+                                   &crypto->encryptkey,
+                                   &crypto->encryptIV,
+                                   &crypto->encryptMAC,
+                                   true);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+    rc = ssh_session_import_cipher(session,
+                                   buffer,
+                                   crypto->in_cipher,
+                                   crypto->in_hmac,
+                                   &crypto->decryptkey,
+                                   &crypto->decryptIV,
+                                   &crypto->decryptMAC,
+                                   false);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+
+    /* Both directions switch at once, as after SSH2_MSG_NEWKEYS */
+    rc = ssh_packet_set_newkeys(session, SSH_DIRECTION_BOTH);
+    if (rc != SSH_OK) {
+        goto error;
+    }
+    if (session->opts.rekey_time != 0) {
+        ssh_timestamp_init(&session->last_rekey_time);
+    }
+
+    rc = ssh_buffer_unpack(buffer,
+                           "SbdSdd",
+                           &input,
+                           &packet_state,
+                           &packet_len,
+                           &first_block,
+                           &maxchannel,
+                           &count);
+    if (rc != SSH_OK ||
+        (packet_state != PACKET_STATE_INIT &&
+         packet_state != PACKET_STATE_SIZEREAD)) {
+        ssh_set_error(session, SSH_FATAL, "Invalid exported session");
+        goto error;
+    }
+
+    if (packet_state == PACKET_STATE_SIZEREAD) {
+        rc = ssh_buffer_reinit(session->in_buffer);
+        if (rc == 0) {
+            rc = ssh_buffer_add_data(session->in_buffer,
+                                     ssh_string_data(first_block),
+                                     ssh_string_len(first_block));
+        }
+        if (rc < 0) {
+            ssh_set_error_oom(session);
+            goto error;
+        }
+        session->in_packet.len = packet_len;
+        session->packet_state = PACKET_STATE_SIZEREAD;
+    }
+    ssh_string_burn(first_block);
+    SSH_STRING_FREE(first_block);
+
+    if (ssh_socket_get_fd(session->socket) != fd) {
+        ssh_socket_set_fd(session->socket, fd);
+    }
+    rc = ssh_buffer_add_data(ssh_socket_get_in_buffer(session->socket),
+                             ssh_string_data(input),
+                             ssh_string_len(input));
+    SSH_STRING_FREE(input);
+    if (rc < 0) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+
+    session->socket_callbacks.exception = ssh_socket_exception_callback;
+    ssh_packet_register_socket_callback(session, session->socket);
+    ssh_packet_set_default_callbacks(session);
+#ifdef WITH_SERVER
+    if (session->server) {
+        session->ssh_connection_callback = ssh_server_connection_callback;
+    } else
+#endif /* WITH_SERVER */
+    {
+        session->ssh_connection_callback = ssh_client_connection_callback;
+    }
+
+    session->session_state = SSH_SESSION_STATE_AUTHENTICATED;
+    session->dh_handshake_state = DH_STATE_FINISHED;
+    session->auth.service_state = SSH_AUTH_SERVICE_ACCEPTED;
+    session->auth.state = SSH_AUTH_STATE_SUCCESS;
+    session->connected = 1;
+    session->alive = 1;
+    session->maxchannel = (int)maxchannel;
+#ifdef WITH_SERVER
+    /* authenticated, it no longer counts against the startups limit */
+    ssh_bind_admission_release(session);
+#endif /* WITH_SERVER */
+
+    for (n = 0; n < count; n++) {
+        ssh_channel channel;
+
+        channel = ssh_session_import_channel(session, buffer);
+        if (channel == NULL) {
+            goto error;
+        }
+        if (channel->flags & SSH_CHANNEL_FLAG_FREED_LOCAL) {
+            continue;
+        }
+        if (restored < max) {
+            channels[restored] = channel;
+        }
+        restored++;
+    }
+
+    ssh_string_burn(session_id);
+    SSH_STRING_FREE(session_id);
+    SSH_STRING_FREE(pubkey);
+    return restored;
+
+error:
+    SAFE_FREE(serverbanner);
+    SAFE_FREE(clientbanner);
+    ssh_string_burn(first_block);
+    SSH_STRING_FREE(first_block);
+    SSH_STRING_FREE(input);
+    ssh_string_burn(session_id);
+    SSH_STRING_FREE(session_id);
+    SSH_STRING_FREE(pubkey);
+    return SSH_ERROR;
+}
+
+/** @} */
@@ -0,0 +1,522 @@
+/*
+ * session_template.c - shareable templates for many similar sessions
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libssh/priv.h"
+#include "libssh/libssh.h"
+#include "libssh/callbacks.h"
+#include "libssh/session.h"
+#include "libssh/misc.h"
+#include "libssh/pki.h"
+#include "libssh/pki_priv.h"
+#include "libssh/threads.h"
+
+struct ssh_session_template_identity {
+    /* owned by the identity list of the prototype session */
+    const char *path;
+    ssh_key privkey;
+};
+
+struct ssh_session_template_struct {
+    SSH_MUTEX mutex;
+    /* the caller of ssh_session_template_new() and every session */
+    unsigned int refcount;
+
+    /* holds the resolved options, never modified once built */
+    ssh_session proto;
+
+    struct ssh_session_template_identity *identities;
+    size_t identities_count;
+};
+
+/**
+ * @addtogroup libssh_session
+ *
+ * @{
+ */
+
+/*
+ * The escapes which depend on the host, the port or the remote user are left
+ * for the sessions to expand, as they may connect elsewhere.
+ */
+static bool ssh_session_template_host_specific(const char *value)
+{
+    const char *p;
+
+    for (p = strchr(value, '%'); p != NULL; p = strchr(p + 2, '%')) {
+        if (p[1] == 'h' || p[1] == 'p' || p[1] == 'r') {
+            return true;
+        }
+        if (p[1] == '\0') {
+            break;
+        }
+    }
+
+    return false;
+}
+
+static int ssh_session_template_expand(ssh_session proto, char **value)
+{
+    char *tmp;
+
+    if (*value == NULL || ssh_session_template_host_specific(*value)) {
+        return SSH_OK;
+    }
+
+    tmp = ssh_path_expand_escape(proto, *value);
+    if (tmp == NULL) {
+        return SSH_ERROR;
+    }
+    free(*value);
+    *value = tmp;
+
+    return SSH_OK;
+}
+
+static int ssh_session_template_resolve(ssh_session proto)
+{
+    struct ssh_iterator *it;
+    int rc;
+
+    /* Process the configuration files once for all the sessions */
+    if (!proto->opts.config_processed && proto->opts.host != NULL) {
+        rc = ssh_options_parse_config(proto, NULL);
+        if (rc != 0) {
+            return SSH_ERROR;
+        }
+    }
+
+    if (proto->opts.sshdir == NULL) {
+        rc = ssh_options_set(proto, SSH_OPTIONS_SSH_DIR, NULL);
+        if (rc < 0) {
+            return SSH_ERROR;
+        }
+    }
+
+    if (proto->opts.username == NULL) {
+        rc = ssh_options_set(proto, SSH_OPTIONS_USER, NULL);
+        if (rc < 0) {
+            return SSH_ERROR;
+        }
+    }
+
+    if (proto->opts.knownhosts == NULL) {
+        proto->opts.knownhosts = strdup("%d/known_hosts");
+        if (proto->opts.knownhosts == NULL) {
+            return SSH_ERROR;
+        }
+    }
+    if (proto->opts.global_knownhosts == NULL) {
+        proto->opts.global_knownhosts = strdup("/etc/ssh/ssh_known_hosts");
+        if (proto->opts.global_knownhosts == NULL) {
+            return SSH_ERROR;
+        }
+    }
+
+    rc = ssh_session_template_expand(proto, &proto->opts.knownhosts);
+    if (rc != SSH_OK) {
+        return rc;
+    }
+    rc = ssh_session_template_expand(proto, &proto->opts.global_knownhosts);
+    if (rc != SSH_OK) {
+        return rc;
+    }
+    rc = ssh_session_template_expand(proto, &proto->opts.ProxyCommand);
+    if (rc != SSH_OK) {
+        return rc;
+    }
+    rc = ssh_session_template_expand(proto, &proto->opts.control_path);
+    if (rc != SSH_OK) {
+        return rc;
+    }
+
+    for (it = ssh_list_get_iterator(proto->opts.identity);
+         it != NULL;
+         it = it->next) {
+        char *id = (char *)it->data;
+
+        rc = ssh_session_template_expand(proto, &id);
+        if (rc != SSH_OK) {
+            return rc;
+        }
+        it->data = id;
+    }
+
+    return SSH_OK;
+}
+
+/* Read the private keys of the identities, the missing ones are skipped */
+static int ssh_session_template_preload(ssh_session_template tmpl)
+{
+    ssh_session proto = tmpl->proto;
+    ssh_auth_callback auth_fn = NULL;
+    void *auth_data = NULL;
+    struct ssh_iterator *it;
+    size_t count = 0;
+    int rc;
+
+    if (!(proto->opts.flags & SSH_OPT_FLAG_PUBKEY_AUTH)) {
+        return SSH_OK;
+    }
+    if (proto->common.callbacks != NULL) {
+        auth_fn = proto->common.callbacks->auth_function;
+        auth_data = proto->common.callbacks->userdata;
+    }
+
+    for (it = ssh_list_get_iterator(proto->opts.identity);
+         it != NULL;
+         it = it->next) {
+        count++;
+    }
+    if (count == 0) {
+        return SSH_OK;
+    }
+
+    tmpl->identities = calloc(count,
+                              sizeof(struct ssh_session_template_identity));
+    if (tmpl->identities == NULL) {
+        return SSH_ERROR;
+    }
+
+    for (it = ssh_list_get_iterator(proto->opts.identity);
+         it != NULL;
+         it = it->next) {
+        const char *path = (const char *)it->data;
+        ssh_key privkey = NULL;
+
+        if (strchr(path, '%') != NULL) {
+            continue;
+        }
+
+        rc = ssh_pki_import_privkey_file(path,
+                                         NULL,
+                                         auth_fn,
+                                         auth_data,
+                                         &privkey);
+        if (rc != SSH_OK) {
+            SSH_LOG(SSH_LOG_DEBUG,
+                    "Identity %s not preloaded in the session template",
+                    path);
+            continue;
+        }
+
+        tmpl->identities[tmpl->identities_count].path = path;
+        tmpl->identities[tmpl->identities_count].privkey = privkey;
+        tmpl->identities_count++;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Create a session template from the options of a session.
+ *
+ * The options of the session are resolved once: the configuration files are
+ * processed if a host is set, the paths of the identities and of the known
+ * hosts files are expanded, and the private keys of the identities are read,
+ * using the authentication callback of the session for the passphrases.
+ * Escapes depending on the host, the port or the remote user are expanded by
+ * each session.
+ *
+ * The template is immutable, the sessions created with
+ * ssh_new_from_template() share its options and keys instead of copying
+ * them, and can be created from several threads at once.
+ *
+ * @param[in]  session  The session holding the options, it is not modified.
+ *
+ * @return              A new template, NULL on error.
+ *
+ * @see ssh_new_from_template()
+ * @see ssh_session_template_free()
+ */
+ssh_session_template ssh_session_template_new(ssh_session session)
+{
+    static const SSH_MUTEX mutex_init = SSH_MUTEX_STATIC_INIT;
+    ssh_session_template tmpl = NULL;
+    ssh_session proto = NULL;
+    int rc;
+
+    if (session == NULL) {
+        return NULL;
+    }
+
+    rc = ssh_options_copy(session, &proto);
+    if (rc != 0) {
+        ssh_set_error_oom(session);
+        return NULL;
+    }
+
+    if (session->opts.custombanner != NULL) {
+        proto->opts.custombanner = strdup(session->opts.custombanner);
+        if (proto->opts.custombanner == NULL) {
+            ssh_set_error_oom(session);
+            goto error;
+        }
+    }
+    proto->opts.rekey_data = session->opts.rekey_data;
+    proto->opts.rekey_time = session->opts.rekey_time;
+
+    rc = ssh_session_template_resolve(proto);
+    if (rc != SSH_OK) {
+        ssh_set_error(session, SSH_FATAL,
+                      "Failed to resolve the options of the template: %s",
+                      ssh_get_error(proto));
+        goto error;
+    }
+
+    tmpl = calloc(1, sizeof(struct ssh_session_template_struct));
+    if (tmpl == NULL) {
+        ssh_set_error_oom(session);
+        goto error;
+    }
+    tmpl->mutex = mutex_init;
+    tmpl->refcount = 1;
+    tmpl->proto = proto;
+
+    rc = ssh_session_template_preload(tmpl);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(session);
+        ssh_session_template_free(tmpl);
+        return NULL;
+    }
+
+    return tmpl;
+
+error:
+    ssh_free(proto);
+    return NULL;
+}
+
+/**
+ * @brief Release a session template.
+ *
+ * The sessions created from the template keep using it, it is deallocated
+ * with the last of them.
+ *
+ * @param[in]  tmpl     The template to release.
+ */
+void ssh_session_template_free(ssh_session_template tmpl)
+{
+    unsigned int refcount;
+    size_t i;
+
+    if (tmpl == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&tmpl->mutex);
+    refcount = --tmpl->refcount;
+    ssh_mutex_unlock(&tmpl->mutex);
+
+    if (refcount > 0) {
+        return;
+    }
+
+    for (i = 0; i < tmpl->identities_count; i++) {
+        ssh_key_free(tmpl->identities[i].privkey);
+    }
+    SAFE_FREE(tmpl->identities);
+    ssh_free(tmpl->proto);
+    SAFE_FREE(tmpl);
+}
+
+/**
+ * @brief Create a new session with the options of a template.
+ *
+ * The options of the session reference the ones of the template, they are
+ * only copied when changed with ssh_options_set(). The public key
+ * authentication uses the keys preloaded in the template.
+ *
+ * @param[in]  tmpl     The template to instantiate.
+ *
+ * @return              A new ssh_session pointer, NULL on error.
+ *
+ * @see ssh_session_template_new()
+ */
+ssh_session ssh_new_from_template(ssh_session_template tmpl)
+{
+    ssh_session session;
+    ssh_session proto;
+    struct ssh_iterator *it;
+    char *id;
+    int rc;
+
+    if (tmpl == NULL) {
+        return NULL;
+    }
+    proto = tmpl->proto;
+
+    session = ssh_new();
+    if (session == NULL) {
+        return NULL;
+    }
+
+    ssh_mutex_lock(&tmpl->mutex);
+    tmpl->refcount++;
+    ssh_mutex_unlock(&tmpl->mutex);
+    session->session_template = tmpl;
+
+    /* Replace the default identities with the ones of the template */
+    for (id = ssh_list_pop_head(char *, session->opts.identity);
+         id != NULL;
+         id = ssh_list_pop_head(char *, session->opts.identity)) {
+        SAFE_FREE(id);
+    }
+    for (it = ssh_list_get_iterator(proto->opts.identity);
+         it != NULL;
+         it = it->next) {
+        rc = ssh_list_append(session->opts.identity, it->data);
+        if (rc < 0) {
+            ssh_free(session);
+            return NULL;
+        }
+    }
+
+    session->opts.username = proto->opts.username;
+    session->opts.host = proto->opts.host;
+    session->opts.bindaddr = proto->opts.bindaddr;
+    session->opts.sshdir = proto->opts.sshdir;
+    session->opts.knownhosts = proto->opts.knownhosts;
+    session->opts.global_knownhosts = proto->opts.global_knownhosts;
+    memcpy(session->opts.wanted_methods, proto->opts.wanted_methods,
+           sizeof(session->opts.wanted_methods));
+    memcpy(session->opts.wanted_algos, proto->opts.wanted_algos,
+           sizeof(session->opts.wanted_algos));
+    session->opts.pubkey_accepted_types = proto->opts.pubkey_accepted_types;
+    session->opts.ProxyCommand = proto->opts.ProxyCommand;
+    session->opts.control_path = proto->opts.control_path;
+    session->opts.custombanner = proto->opts.custombanner;
+    session->opts.gss_server_identity = proto->opts.gss_server_identity;
+    session->opts.gss_client_identity = proto->opts.gss_client_identity;
+
+    memcpy(session->opts.options_seen, proto->opts.options_seen,
+           sizeof(session->opts.options_seen));
+
+    session->opts.fd                    = proto->opts.fd;
+    session->opts.port                  = proto->opts.port;
+    session->opts.timeout               = proto->opts.timeout;
+    session->opts.timeout_usec          = proto->opts.timeout_usec;
+    session->opts.compressionlevel      = proto->opts.compressionlevel;
+    session->opts.StrictHostKeyChecking = proto->opts.StrictHostKeyChecking;
+    session->opts.gss_delegate_creds    = proto->opts.gss_delegate_creds;
+    session->opts.flags                 = proto->opts.flags;
+    session->opts.nodelay               = proto->opts.nodelay;
+    session->opts.config_processed      = proto->opts.config_processed;
+    session->opts.rekey_data            = proto->opts.rekey_data;
+    session->opts.rekey_time            = proto->opts.rekey_time;
+    session->common.log_verbosity       = proto->common.log_verbosity;
+    session->common.callbacks           = proto->common.callbacks;
+
+    return session;
+}
+
+/** @} */
+
+/** @internal
+ * @brief Check if an option value of a session belongs to its template.
+ */
+bool ssh_session_template_owns(ssh_session session, const void *value)
+{
+    ssh_session proto;
+    struct ssh_iterator *it;
+    size_t i;
+
+    if (session == NULL || session->session_template == NULL ||
+        value == NULL) {
+        return false;
+    }
+    proto = session->session_template->proto;
+
+    if (value == proto->opts.username ||
+        value == proto->opts.host ||
+        value == proto->opts.bindaddr ||
+        value == proto->opts.sshdir ||
+        value == proto->opts.knownhosts ||
+        value == proto->opts.global_knownhosts ||
+        value == proto->opts.pubkey_accepted_types ||
+        value == proto->opts.ProxyCommand ||
+        value == proto->opts.control_path ||
+        value == proto->opts.custombanner ||
+        value == proto->opts.gss_server_identity ||
+        value == proto->opts.gss_client_identity) {
+        return true;
+    }
+    for (i = 0; i < 10; i++) {
+        if (value == proto->opts.wanted_methods[i]) {
+            return true;
+        }
+    }
+    for (it = ssh_list_get_iterator(proto->opts.identity);
+         it != NULL;
+         it = it->next) {
+        if (value == it->data) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** @internal
+ * @brief Get copies of the keys preloaded by the template for an identity.
+ *
+ * @returns SSH_OK on success, SSH_EOF if the identity was not preloaded,
+ *          SSH_ERROR on error.
+ */
+int ssh_session_template_get_identity(ssh_session session,
+                                      const char *path,
+                                      ssh_key *privkey,
+                                      ssh_key *pubkey)
+{
+    ssh_session_template tmpl;
+    ssh_key priv;
+    ssh_key pub;
+    size_t i;
+
+    if (session == NULL || session->session_template == NULL) {
+        return SSH_EOF;
+    }
+    tmpl = session->session_template;
+
+    for (i = 0; i < tmpl->identities_count; i++) {
+        if (strcmp(tmpl->identities[i].path, path) != 0) {
+            continue;
+        }
+
+        priv = pki_key_dup(tmpl->identities[i].privkey, 0);
+        pub = pki_key_dup(tmpl->identities[i].privkey, 1);
+        if (priv == NULL || pub == NULL) {
+            ssh_key_free(priv);
+            ssh_key_free(pub);
+            return SSH_ERROR;
+        }
+        *privkey = priv;
+        *pubkey = pub;
+
+        return SSH_OK;
+    }
+
+    return SSH_EOF;
+}
@@ -41,14 +41,21 @@
 #include <arpa/inet.h>
 #endif
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 #include "libssh/priv.h"
 #include "libssh/ssh2.h"
 #include "libssh/sftp.h"
+#include "libssh/sftp_cache.h"
 #include "libssh/buffer.h"
+#include "libssh/callbacks.h"
 #include "libssh/channels.h"
 #include "libssh/session.h"
 #include "libssh/misc.h"
 #include "libssh/bytearray.h"
+#include "libssh/probes.h"
 
 #ifdef WITH_SFTP
 
@@ -56,6 +63,17 @@
 #define SFTP_PACKET_SIZE_MAX 0x10000000
 #define SFTP_BUFFER_SIZE_MAX 16384
 
+/* Striped transfers */
+#define SFTP_STRIPE_CHUNK_SIZE 32768
+#define SFTP_STRIPE_DEPTH 16
+#define SFTP_STRIPE_RANGE_SIZE (8 * 1024 * 1024)
+
+#define SFTP_STRIPE_UPLOAD 0x01
+#define SFTP_STRIPE_RESUME 0x02
+
+/* Default size of the tail of a partial file compared before resuming */
+#define SFTP_RESUME_VERIFY_SIZE (1024 * 1024)
+
 struct sftp_ext_struct {
   unsigned int count;
   char **name;
@@ -67,6 +85,10 @@ static int sftp_enqueue(sftp_session session, sftp_message msg);
 static void sftp_message_free(sftp_message msg);
 static void sftp_set_error(sftp_session sftp, int errnum);
 static void status_msg_free(sftp_status_message status);
+static int sftp_async_dispatch(sftp_session sftp, sftp_message msg);
+static void sftp_async_free(sftp_session sftp);
+static void sftp_async_forget_dir(sftp_session sftp, sftp_dir dir);
+static int sftp_packet_available(sftp_session sftp);
 
 static sftp_ext sftp_ext_new(void) {
   sftp_ext ext;
@@ -194,6 +216,15 @@ sftp_session sftp_new_channel(ssh_session session, ssh_channel channel){
     return NULL;
   }
 
+  sftp->read_packet = calloc(1, sizeof(struct sftp_packet_struct));
+  if (sftp->read_packet == NULL) {
+    ssh_set_error_oom(session);
+    sftp_ext_free(sftp->ext);
+    SAFE_FREE(sftp);
+
+    return NULL;
+  }
+
   sftp->session = session;
   sftp->channel = channel;
 
@@ -318,6 +349,8 @@ void sftp_free(sftp_session sftp)
         ptr = old;
     }
 
+    sftp_async_free(sftp);
+
     ssh_channel_free(sftp->channel);
 
     SAFE_FREE(sftp->handles);
@@ -348,6 +381,18 @@ int sftp_packet_write(sftp_session sftp, uint8_t type, ssh_buffer payload)
         return -1;
     }
 
+    /*
+     * All the requests but the first start with their id. The probe fires
+     * before the write, which may wait for the channel window.
+     */
+    if (!sftp->session->server && type != SSH_FXP_INIT) {
+        SSH_PROBE4(sftp__request,
+                   sftp,
+                   type,
+                   PULL_BE_U32(ssh_buffer_get(payload), sizeof(header)),
+                   payload_size);
+    }
+
     size = ssh_channel_write(sftp->channel,
                              ssh_buffer_get(payload),
                              ssh_buffer_get_len(payload));
@@ -566,6 +611,7 @@ static sftp_message sftp_get_message(sftp_packet packet)
             "Packet with id %d type %d",
             msg->id,
             msg->packet_type);
+    SSH_PROBE3(sftp__response, sftp, msg->packet_type, msg->id);
 
     return msg;
 }
@@ -586,6 +632,11 @@ static int sftp_read_and_dispatch(sftp_session sftp)
         return -1;
     }
 
+    /* Replies to asynchronous requests are completed right away */
+    if (sftp_async_dispatch(sftp, msg)) {
+        return 0;
+    }
+
     if (sftp_enqueue(sftp, msg) < 0) {
         sftp_message_free(msg);
         return -1;
@@ -763,6 +814,17 @@ int sftp_extension_supported(sftp_session sftp, const char *name,
   return 0;
 }
 
+int sftp_set_cache(sftp_session sftp, sftp_cache cache)
+{
+    if (sftp == NULL) {
+        return -1;
+    }
+
+    sftp->cache = cache;
+
+    return 0;
+}
+
 static sftp_request_queue request_queue_new(sftp_message msg) {
   sftp_request_queue queue = NULL;
 
@@ -970,6 +1032,41 @@ sftp_dir sftp_opendir(sftp_session sftp, const char *path)
         return NULL;
     }
 
+    if (sftp->cache != NULL) {
+        sftp_attributes *listing = NULL;
+        uint32_t count = 0;
+
+        rc = sftp_cache_listing_lookup(sftp->cache, path, &listing, &count);
+        if (rc == SSH_OK) {
+            dir = calloc(1, sizeof(struct sftp_dir_struct));
+            if (dir == NULL) {
+                ssh_set_error_oom(sftp->session);
+                for (id = 0; id < count; id++) {
+                    sftp_attributes_free(listing[id]);
+                }
+                SAFE_FREE(listing);
+                return NULL;
+            }
+
+            dir->sftp = sftp;
+            dir->name = strdup(path);
+            if (dir->name == NULL) {
+                ssh_set_error_oom(sftp->session);
+                for (id = 0; id < count; id++) {
+                    sftp_attributes_free(listing[id]);
+                }
+                SAFE_FREE(listing);
+                SAFE_FREE(dir);
+                return NULL;
+            }
+            /* No handle, sftp_readdir() walks the cached listing */
+            dir->listing = listing;
+            dir->listing_count = count;
+
+            return dir;
+        }
+    }
+
     payload = ssh_buffer_new();
     if (payload == NULL) {
         ssh_set_error_oom(sftp->session);
@@ -1232,35 +1329,112 @@ enum sftp_longname_field_e {
   SFTP_LONGNAME_NAME,
 };
 
+#define SFTP_LONGNAME_SPACES " \t\n\v\f\r"
+
 static char *sftp_parse_longname(const char *longname,
         enum sftp_longname_field_e longname_field) {
-    const char *p, *q;
-    size_t len, field = 0;
+    const char *p = longname;
+    size_t field = 0;
+    size_t len;
 
-    p = longname;
     /* Find the beginning of the field which is specified by sftp_longanme_field_e. */
-    while(field != longname_field) {
-        if(isspace(*p)) {
-            field++;
-            p++;
-            while(*p && isspace(*p)) {
-                p++;
-            }
-        } else {
-            p++;
+    while (field != longname_field) {
+        p += strcspn(p, SFTP_LONGNAME_SPACES);
+        if (*p == '\0') {
+            return NULL;
         }
+        p += strspn(p, SFTP_LONGNAME_SPACES);
+        field++;
     }
 
-    q = p;
-    while (! isspace(*q)) {
-        q++;
+    len = strcspn(p, SFTP_LONGNAME_SPACES);
+    if (len == 0) {
+        return NULL;
     }
 
-    len = q - p;
-
     return strndup(p, len);
 }
 
+/*
+ * Helpers to parse the attributes directly from the payload. They check the
+ * bounds and advance the pointer, returning -1 on truncated data.
+ */
+static int sftp_pull_u32(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+    if (end - *p < 4) {
+        return -1;
+    }
+    *v = PULL_BE_U32(*p, 0);
+    *p += 4;
+
+    return 0;
+}
+
+static int sftp_pull_u64(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    if (end - *p < 8) {
+        return -1;
+    }
+    *v = PULL_BE_U64(*p, 0);
+    *p += 8;
+
+    return 0;
+}
+
+/* Get a pointer to the data of a string without copying it */
+static int sftp_pull_data(const uint8_t **p,
+                          const uint8_t *end,
+                          const uint8_t **data,
+                          uint32_t *len)
+{
+    if (sftp_pull_u32(p, end, len) < 0 || (size_t)(end - *p) < *len) {
+        return -1;
+    }
+    *data = *p;
+    *p += *len;
+
+    return 0;
+}
+
+static char *sftp_pull_cstring(const uint8_t **p, const uint8_t *end)
+{
+    const uint8_t *data;
+    uint32_t len;
+    char *str;
+
+    if (sftp_pull_data(p, end, &data, &len) < 0) {
+        return NULL;
+    }
+
+    str = malloc(len + 1);
+    if (str == NULL) {
+        return NULL;
+    }
+    memcpy(str, data, len);
+    str[len] = '\0';
+
+    return str;
+}
+
+static ssh_string sftp_pull_string(const uint8_t **p, const uint8_t *end)
+{
+    const uint8_t *data;
+    ssh_string str;
+    uint32_t len;
+
+    if (sftp_pull_data(p, end, &data, &len) < 0) {
+        return NULL;
+    }
+
+    str = ssh_string_new(len);
+    if (str == NULL) {
+        return NULL;
+    }
+    memcpy(ssh_string_data(str), data, len);
+
+    return str;
+}
+
 /* sftp version 0-3 code. It is different from the v4 */
 /* maybe a paste of the draft is better than the code */
 /*
@@ -1278,8 +1452,11 @@ static char *sftp_parse_longname(const char *longname,
                    so that number of pairs equals extended_count              */
 static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
         int expectname) {
+    const uint8_t *start = ssh_buffer_get(buf);
+    const uint8_t *end = start + ssh_buffer_get_len(buf);
+    const uint8_t *p = start;
     sftp_attributes attr;
-    int rc;
+    uint32_t count;
 
     attr = calloc(1, sizeof(struct sftp_attributes_struct));
     if (attr == NULL) {
@@ -1289,38 +1466,40 @@ static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
     }
 
     if (expectname) {
-        rc = ssh_buffer_unpack(buf, "ss",
-                &attr->name,
-                &attr->longname);
-        if (rc != SSH_OK){
+        attr->name = sftp_pull_cstring(&p, end);
+        if (attr->name == NULL) {
+            goto error;
+        }
+        attr->longname = sftp_pull_cstring(&p, end);
+        if (attr->longname == NULL) {
             goto error;
         }
         SSH_LOG(SSH_LOG_RARE, "Name: %s", attr->name);
 
-        /* Set owner and group if we talk to openssh and have the longname */
+        /*
+         * Set owner and group if we talk to openssh and have the longname,
+         * unless they are only extracted when asked for.
+         */
         if (ssh_get_openssh_version(sftp->session)) {
-            attr->owner = sftp_parse_longname(attr->longname, SFTP_LONGNAME_OWNER);
-            if (attr->owner == NULL) {
-                goto error;
-            }
-
-            attr->group = sftp_parse_longname(attr->longname, SFTP_LONGNAME_GROUP);
-            if (attr->group == NULL) {
-                goto error;
+            if (sftp->lazy_owner_group) {
+                attr->owner_group_lazy = 1;
+            } else {
+                attr->owner = sftp_parse_longname(attr->longname,
+                                                  SFTP_LONGNAME_OWNER);
+                attr->group = sftp_parse_longname(attr->longname,
+                                                  SFTP_LONGNAME_GROUP);
             }
         }
     }
 
-    rc = ssh_buffer_unpack(buf, "d", &attr->flags);
-    if (rc != SSH_OK){
+    if (sftp_pull_u32(&p, end, &attr->flags) < 0) {
         goto error;
     }
     SSH_LOG(SSH_LOG_RARE,
             "Flags: %.8lx\n", (long unsigned int) attr->flags);
 
     if (attr->flags & SSH_FILEXFER_ATTR_SIZE) {
-        rc = ssh_buffer_unpack(buf, "q", &attr->size);
-        if(rc != SSH_OK) {
+        if (sftp_pull_u64(&p, end, &attr->size) < 0) {
             goto error;
         }
         SSH_LOG(SSH_LOG_RARE,
@@ -1329,17 +1508,14 @@ static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
     }
 
     if (attr->flags & SSH_FILEXFER_ATTR_UIDGID) {
-        rc = ssh_buffer_unpack(buf, "dd",
-                &attr->uid,
-                &attr->gid);
-        if (rc != SSH_OK){
+        if (sftp_pull_u32(&p, end, &attr->uid) < 0 ||
+            sftp_pull_u32(&p, end, &attr->gid) < 0) {
             goto error;
         }
     }
 
     if (attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS) {
-        rc = ssh_buffer_unpack(buf, "d", &attr->permissions);
-        if (rc != SSH_OK){
+        if (sftp_pull_u32(&p, end, &attr->permissions) < 0) {
             goto error;
         }
 
@@ -1366,43 +1542,44 @@ static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
     }
 
     if (attr->flags & SSH_FILEXFER_ATTR_ACMODTIME) {
-        rc = ssh_buffer_unpack(buf, "dd",
-                &attr->atime,
-                &attr->mtime);
-        if (rc != SSH_OK){
+        if (sftp_pull_u32(&p, end, &attr->atime) < 0 ||
+            sftp_pull_u32(&p, end, &attr->mtime) < 0) {
             goto error;
         }
     }
 
     if (attr->flags & SSH_FILEXFER_ATTR_EXTENDED) {
-        rc = ssh_buffer_unpack(buf, "d", &attr->extended_count);
-        if (rc != SSH_OK){
+        if (sftp_pull_u32(&p, end, &attr->extended_count) < 0) {
             goto error;
         }
 
         if (attr->extended_count > 0){
-            rc = ssh_buffer_unpack(buf, "ss",
-                    &attr->extended_type,
-                    &attr->extended_data);
-            if (rc != SSH_OK){
+            attr->extended_type = sftp_pull_string(&p, end);
+            if (attr->extended_type == NULL) {
+                goto error;
+            }
+            attr->extended_data = sftp_pull_string(&p, end);
+            if (attr->extended_data == NULL) {
                 goto error;
             }
             attr->extended_count--;
         }
-        /* just ignore the remaining extensions */
 
-        while (attr->extended_count > 0){
-            ssh_string tmp1,tmp2;
-            rc = ssh_buffer_unpack(buf, "SS", &tmp1, &tmp2);
-            if (rc != SSH_OK){
+        /* just skip the remaining extensions */
+        for (count = attr->extended_count; count > 0; count--) {
+            const uint8_t *data;
+            uint32_t len;
+
+            if (sftp_pull_data(&p, end, &data, &len) < 0 ||
+                sftp_pull_data(&p, end, &data, &len) < 0) {
                 goto error;
             }
-            SAFE_FREE(tmp1);
-            SAFE_FREE(tmp2);
-            attr->extended_count--;
         }
+        attr->extended_count = 0;
     }
 
+    ssh_buffer_pass_bytes(buf, (uint32_t)(p - start));
+
     return attr;
 
     error:
@@ -1419,6 +1596,46 @@ static sftp_attributes sftp_parse_attr_3(sftp_session sftp, ssh_buffer buf,
     return NULL;
 }
 
+const char *sftp_attributes_get_owner(sftp_attributes attr)
+{
+    if (attr == NULL) {
+        return NULL;
+    }
+
+    /* Only OpenSSH longnames are parsed, as when it is done eagerly */
+    if (attr->owner == NULL && attr->owner_group_lazy &&
+        attr->longname != NULL) {
+        attr->owner = sftp_parse_longname(attr->longname, SFTP_LONGNAME_OWNER);
+    }
+
+    return attr->owner;
+}
+
+const char *sftp_attributes_get_group(sftp_attributes attr)
+{
+    if (attr == NULL) {
+        return NULL;
+    }
+
+    if (attr->group == NULL && attr->owner_group_lazy &&
+        attr->longname != NULL) {
+        attr->group = sftp_parse_longname(attr->longname, SFTP_LONGNAME_GROUP);
+    }
+
+    return attr->group;
+}
+
+int sftp_set_lazy_owner_group(sftp_session sftp, int enable)
+{
+    if (sftp == NULL) {
+        return -1;
+    }
+
+    sftp->lazy_owner_group = enable ? 1 : 0;
+
+    return 0;
+}
+
 /* FIXME is this really needed as a public function? */
 int buffer_add_attributes(ssh_buffer buffer, sftp_attributes attr) {
   uint32_t flags = (attr ? attr->flags : 0);
@@ -1489,6 +1706,47 @@ int sftp_server_version(sftp_session sftp) {
   return sftp->server_version;
 }
 
+/*
+ * Remember a directory entry so the complete listing can be handed to the
+ * cache once the end of the directory is reached.
+ */
+static void sftp_readdir_collect(sftp_dir dir, sftp_attributes attr)
+{
+    sftp_attributes *tmp;
+    uint32_t n = dir->listing_count;
+    uint32_t i;
+
+    /* A non-zero position marks an incomplete listing, see below */
+    if (dir->listing_pos != 0) {
+        return;
+    }
+
+    /* grow in powers of two */
+    if (n == 0 || (n >= 16 && (n & (n - 1)) == 0)) {
+        tmp = realloc(dir->listing,
+                      (n == 0 ? 16 : 2 * n) * sizeof(sftp_attributes));
+        if (tmp == NULL) {
+            goto error;
+        }
+        dir->listing = tmp;
+    }
+
+    dir->listing[n] = sftp_attributes_dup(attr);
+    if (dir->listing[n] == NULL) {
+        goto error;
+    }
+    dir->listing_count++;
+
+    return;
+error:
+    for (i = 0; i < dir->listing_count; i++) {
+        sftp_attributes_free(dir->listing[i]);
+    }
+    SAFE_FREE(dir->listing);
+    dir->listing_count = 0;
+    dir->listing_pos = 1;
+}
+
 /* Get a single file attributes structure of a directory. */
 sftp_attributes sftp_readdir(sftp_session sftp, sftp_dir dir)
 {
@@ -1499,6 +1757,20 @@ sftp_attributes sftp_readdir(sftp_session sftp, sftp_dir dir)
     uint32_t id;
     int rc;
 
+    if (dir->handle == NULL) {
+        /* Opened from the cache */
+        if (dir->listing == NULL || dir->listing_pos >= dir->listing_count) {
+            dir->eof = 1;
+            return NULL;
+        }
+
+        attr = dir->listing[dir->listing_pos];
+        dir->listing[dir->listing_pos] = NULL;
+        dir->listing_pos++;
+
+        return attr;
+    }
+
     if (dir->buffer == NULL) {
         payload = ssh_buffer_new();
         if (payload == NULL) {
@@ -1549,6 +1821,15 @@ sftp_attributes sftp_readdir(sftp_session sftp, sftp_dir dir)
                     case SSH_FX_EOF:
                         dir->eof = 1;
                         status_msg_free(status);
+                        if (sftp->cache != NULL && dir->listing_pos == 0) {
+                            /* The cache takes ownership of the listing */
+                            sftp_cache_listing_store(sftp->cache,
+                                                     dir->name,
+                                                     dir->listing,
+                                                     dir->listing_count);
+                            dir->listing = NULL;
+                            dir->listing_count = 0;
+                        }
                         return NULL;
                     default:
                         break;
@@ -1599,6 +1880,11 @@ sftp_attributes sftp_readdir(sftp_session sftp, sftp_dir dir)
         dir->buffer = NULL;
     }
 
+    if (sftp->cache != NULL) {
+        sftp_cache_store_dir_entry(sftp->cache, dir->name, attr);
+        sftp_readdir_collect(dir, attr);
+    }
+
     return attr;
 }
 
@@ -1715,8 +2001,14 @@ int sftp_close(sftp_file file){
 /* Close an open directory. */
 int sftp_closedir(sftp_dir dir){
   int err = SSH_NO_ERROR;
+  uint32_t i;
 
+  sftp_async_forget_dir(dir->sftp, dir);
   SAFE_FREE(dir->name);
+  for (i = 0; i < dir->listing_count; i++) {
+    sftp_attributes_free(dir->listing[i]);
+  }
+  SAFE_FREE(dir->listing);
   if (dir->handle) {
     err = sftp_handle_close(dir->sftp, dir->handle);
     ssh_string_free(dir->handle);
@@ -1728,6 +2020,31 @@ int sftp_closedir(sftp_dir dir){
   return err;
 }
 
+/* Convert open(2) flags to SSH_FXF_* flags */
+static uint32_t sftp_open_flags(int flags)
+{
+    uint32_t sftp_flags = 0;
+
+    if ((flags & O_RDWR) == O_RDWR) {
+        sftp_flags |= (SSH_FXF_WRITE | SSH_FXF_READ);
+    } else if ((flags & O_WRONLY) == O_WRONLY) {
+        sftp_flags |= SSH_FXF_WRITE;
+    } else {
+        sftp_flags |= SSH_FXF_READ;
+    }
+    if ((flags & O_CREAT) == O_CREAT)
+        sftp_flags |= SSH_FXF_CREAT;
+    if ((flags & O_TRUNC) == O_TRUNC)
+        sftp_flags |= SSH_FXF_TRUNC;
+    if ((flags & O_EXCL) == O_EXCL)
+        sftp_flags |= SSH_FXF_EXCL;
+    if ((flags & O_APPEND) == O_APPEND) {
+        sftp_flags |= SSH_FXF_APPEND;
+    }
+
+    return sftp_flags;
+}
+
 /* Open a file on the server. */
 sftp_file sftp_open(sftp_session sftp,
                     const char *file,
@@ -1740,7 +2057,7 @@ sftp_file sftp_open(sftp_session sftp,
     sftp_file handle;
     ssh_buffer buffer;
     sftp_attributes stat_data;
-    uint32_t sftp_flags = 0;
+    uint32_t sftp_flags;
     uint32_t id;
     int rc;
 
@@ -1754,22 +2071,7 @@ sftp_file sftp_open(sftp_session sftp,
     attr.permissions = mode;
     attr.flags = SSH_FILEXFER_ATTR_PERMISSIONS;
 
-    if ((flags & O_RDWR) == O_RDWR) {
-        sftp_flags |= (SSH_FXF_WRITE | SSH_FXF_READ);
-    } else if ((flags & O_WRONLY) == O_WRONLY) {
-        sftp_flags |= SSH_FXF_WRITE;
-    } else {
-        sftp_flags |= SSH_FXF_READ;
-    }
-    if ((flags & O_CREAT) == O_CREAT)
-        sftp_flags |= SSH_FXF_CREAT;
-    if ((flags & O_TRUNC) == O_TRUNC)
-        sftp_flags |= SSH_FXF_TRUNC;
-    if ((flags & O_EXCL) == O_EXCL)
-        sftp_flags |= SSH_FXF_EXCL;
-    if ((flags & O_APPEND) == O_APPEND) {
-        sftp_flags |= SSH_FXF_APPEND;
-    }
+    sftp_flags = sftp_open_flags(flags);
     SSH_LOG(SSH_LOG_PACKET,"Opening file %s with sftp flags %x",file,sftp_flags);
     id = sftp_get_new_id(sftp);
 
@@ -1823,6 +2125,19 @@ sftp_file sftp_open(sftp_session sftp,
         case SSH_FXP_HANDLE:
             handle = parse_handle_msg(msg);
             sftp_message_free(msg);
+            if (handle == NULL) {
+                return NULL;
+            }
+            handle->name = strdup(file);
+            if (handle->name == NULL) {
+                ssh_set_error_oom(sftp->session);
+                sftp_close(handle);
+                sftp_set_error(sftp, SSH_FX_FAILURE);
+                return NULL;
+            }
+            if (sftp_flags & (SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC)) {
+                sftp_cache_invalidate(sftp->cache, file);
+            }
             if ((flags & O_APPEND) == O_APPEND) {
                 stat_data = sftp_stat(sftp, file);
                 if (stat_data == NULL) {
@@ -2023,10 +2338,22 @@ int sftp_async_read(sftp_file file, void *data, uint32_t size, uint32_t id){
     return 0;
   }
 
-  /* handle an existing request */
+  /* handle an existing request, its reply may already be queued */
+  msg = sftp_dequeue(sftp, id);
   while (msg == NULL) {
     if (file->nonblocking){
-      if (ssh_channel_poll(sftp->channel, 0) == 0) {
+      int rc = ssh_channel_poll(sftp->channel, 0);
+
+      if (rc == SSH_ERROR) {
+        return SSH_ERROR;
+      }
+      if (!sftp_packet_available(sftp)) {
+        if (rc == SSH_EOF) {
+          ssh_set_error(sftp->session, SSH_FATAL,
+              "Received EOF while waiting for a read reply");
+          sftp_set_error(sftp, SSH_FX_EOF);
+          return SSH_ERROR;
+        }
         /* we cannot block */
         return SSH_AGAIN;
       }
@@ -2139,6 +2466,8 @@ ssize_t sftp_write(sftp_file file, const void *buf, size_t count) {
     msg = sftp_dequeue(file->sftp, id);
   }
 
+  sftp_cache_invalidate(sftp->cache, file->name);
+
   switch (msg->packet_type) {
     case SSH_FXP_STATUS:
       status = parse_status_msg(msg);
@@ -2250,6 +2579,8 @@ int sftp_unlink(sftp_session sftp, const char *file) {
     msg = sftp_dequeue(sftp, id);
   }
 
+  sftp_cache_invalidate(sftp->cache, file);
+
   if (msg->packet_type == SSH_FXP_STATUS) {
     /* by specification, this command's only supposed to return SSH_FXP_STATUS */
     status = parse_status_msg(msg);
@@ -2324,6 +2655,8 @@ int sftp_rmdir(sftp_session sftp, const char *directory) {
     msg = sftp_dequeue(sftp, id);
   }
 
+  sftp_cache_invalidate_tree(sftp->cache, directory);
+
   /* By specification, this command returns SSH_FXP_STATUS */
   if (msg->packet_type == SSH_FXP_STATUS) {
     status = parse_status_msg(msg);
@@ -2411,6 +2744,8 @@ int sftp_mkdir(sftp_session sftp, const char *directory, mode_t mode)
         msg = sftp_dequeue(sftp, id);
     }
 
+    sftp_cache_invalidate(sftp->cache, directory);
+
     /* By specification, this command only returns SSH_FXP_STATUS */
     if (msg->packet_type == SSH_FXP_STATUS) {
         status = parse_status_msg(msg);
@@ -2506,6 +2841,9 @@ int sftp_rename(sftp_session sftp, const char *original, const char *newname) {
     msg = sftp_dequeue(sftp, id);
   }
 
+  sftp_cache_invalidate_tree(sftp->cache, original);
+  sftp_cache_invalidate_tree(sftp->cache, newname);
+
   /* By specification, this command only returns SSH_FXP_STATUS */
   if (msg->packet_type == SSH_FXP_STATUS) {
     status = parse_status_msg(msg);
@@ -2591,6 +2929,8 @@ int sftp_setstat(sftp_session sftp, const char *file, sftp_attributes attr)
         msg = sftp_dequeue(sftp, id);
     }
 
+    sftp_cache_invalidate(sftp->cache, file);
+
     /* By specification, this command only returns SSH_FXP_STATUS */
     if (msg->packet_type == SSH_FXP_STATUS) {
         status = parse_status_msg(msg);
@@ -2723,6 +3063,8 @@ int sftp_symlink(sftp_session sftp, const char *target, const char *dest) {
     msg = sftp_dequeue(sftp, id);
   }
 
+  sftp_cache_invalidate(sftp->cache, dest);
+
   /* By specification, this command only returns SSH_FXP_STATUS */
   if (msg->packet_type == SSH_FXP_STATUS) {
     status = parse_status_msg(msg);
@@ -3257,6 +3599,16 @@ static sftp_attributes sftp_xstat(sftp_session sftp,
         return NULL;
     }
 
+    if (sftp->cache != NULL) {
+        sftp_attributes attr;
+
+        attr = sftp_cache_lookup(sftp->cache, path, param == SSH_FXP_STAT);
+        if (attr != NULL) {
+            sftp_set_error(sftp, SSH_FX_OK);
+            return attr;
+        }
+    }
+
     buffer = ssh_buffer_new();
     if (buffer == NULL) {
         ssh_set_error_oom(sftp->session);
@@ -3294,6 +3646,10 @@ static sftp_attributes sftp_xstat(sftp_session sftp,
         sftp_attributes attr = sftp_parse_attr(sftp, msg->payload, 0);
         sftp_message_free(msg);
 
+        if (sftp->cache != NULL && attr != NULL) {
+            sftp_cache_store(sftp->cache, path, param == SSH_FXP_STAT, attr);
+        }
+
         return attr;
     } else if (msg->packet_type == SSH_FXP_STATUS) {
         status = parse_status_msg(msg);
@@ -3394,4 +3750,1970 @@ sftp_attributes sftp_fstat(sftp_file file)
     return NULL;
 }
 
+/* Asynchronous requests */
+
+#define SFTP_ASYNC_BUCKETS 256
+
+struct sftp_request_struct {
+    sftp_session sftp;
+    /* hash chain of pending requests */
+    sftp_request next;
+
+    uint32_t id;
+    uint8_t type;
+    int done;
+    /* freed by the user before the reply arrived */
+    int detached;
+
+    int status;
+    char *errormsg;
+
+    char *path;
+    sftp_attributes attr;
+    sftp_file file;
+    sftp_dir dir;
+    ssh_buffer names;
+    uint32_t names_count;
+
+    sftp_request_callback callback;
+    void *userdata;
+};
+
+struct sftp_async_struct {
+    sftp_request buckets[SFTP_ASYNC_BUCKETS];
+    size_t pending;
+    /* requests completed during the current sftp_async_process() call */
+    size_t completed;
+
+    /* set by sftp_async_event_add() */
+    ssh_event event;
+    struct ssh_channel_callbacks_struct channel_cb;
+};
+
+static int sftp_async_init(sftp_session sftp)
+{
+    if (sftp->async != NULL) {
+        return SSH_OK;
+    }
+
+    sftp->async = calloc(1, sizeof(struct sftp_async_struct));
+    if (sftp->async == NULL) {
+        ssh_set_error_oom(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+static sftp_request sftp_request_handle(sftp_session sftp,
+                                        uint8_t type,
+                                        ssh_string handle,
+                                        sftp_request_callback callback,
+                                        void *userdata);
+
+/*
+ * Close the handle of a request freed before the user took it. This happens
+ * while the replies are processed, so the reply to the close is not waited
+ * for.
+ */
+static void sftp_request_close_handle(sftp_session sftp, ssh_string handle)
+{
+    sftp_request req;
+
+    if (sftp == NULL) {
+        return;
+    }
+
+    req = sftp_request_handle(sftp, SSH_FXP_CLOSE, handle, NULL, NULL);
+    if (req != NULL) {
+        sftp_request_free(req);
+    }
+}
+
+static void sftp_request_release(sftp_request req)
+{
+    SAFE_FREE(req->errormsg);
+    SAFE_FREE(req->path);
+    sftp_attributes_free(req->attr);
+    if (req->type == SSH_FXP_OPEN && req->file != NULL) {
+        sftp_request_close_handle(req->sftp, req->file->handle);
+        ssh_string_free(req->file->handle);
+        SAFE_FREE(req->file->name);
+        SAFE_FREE(req->file);
+    }
+    if (req->type == SSH_FXP_OPENDIR && req->dir != NULL) {
+        sftp_request_close_handle(req->sftp, req->dir->handle);
+        ssh_string_free(req->dir->handle);
+        SAFE_FREE(req->dir->name);
+        SAFE_FREE(req->dir);
+    }
+    SSH_BUFFER_FREE(req->names);
+    SAFE_FREE(req);
+}
+
+static sftp_request sftp_request_new(sftp_session sftp,
+                                     uint8_t type,
+                                     sftp_request_callback callback,
+                                     void *userdata)
+{
+    sftp_request req;
+    int rc;
+
+    rc = sftp_async_init(sftp);
+    if (rc != SSH_OK) {
+        return NULL;
+    }
+
+    req = calloc(1, sizeof(struct sftp_request_struct));
+    if (req == NULL) {
+        ssh_set_error_oom(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return NULL;
+    }
+
+    req->sftp = sftp;
+    req->id = sftp_get_new_id(sftp);
+    req->type = type;
+    req->status = SSH_AGAIN;
+    req->callback = callback;
+    req->userdata = userdata;
+
+    return req;
+}
+
+/* Send the payload of a request and register it as pending */
+static sftp_request sftp_request_send(sftp_request req, ssh_buffer payload)
+{
+    sftp_session sftp = req->sftp;
+    uint32_t idx;
+    int rc;
+
+    rc = sftp_packet_write(sftp, req->type, payload);
+    ssh_buffer_free(payload);
+    if (rc < 0) {
+        sftp_request_release(req);
+        return NULL;
+    }
+
+    idx = req->id % SFTP_ASYNC_BUCKETS;
+    req->next = sftp->async->buckets[idx];
+    sftp->async->buckets[idx] = req;
+    sftp->async->pending++;
+
+    return req;
+}
+
+static sftp_request sftp_request_path(sftp_session sftp,
+                                      uint8_t type,
+                                      const char *path,
+                                      sftp_request_callback callback,
+                                      void *userdata)
+{
+    sftp_request req;
+    ssh_buffer payload;
+    int rc;
+
+    if (sftp == NULL) {
+        return NULL;
+    }
+    if (path == NULL) {
+        ssh_set_error_invalid(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return NULL;
+    }
+
+    req = sftp_request_new(sftp, type, callback, userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    req->path = strdup(path);
+    payload = ssh_buffer_new();
+    if (req->path == NULL || payload == NULL) {
+        ssh_set_error_oom(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        SSH_BUFFER_FREE(payload);
+        sftp_request_release(req);
+        return NULL;
+    }
+
+    rc = ssh_buffer_pack(payload, "ds", req->id, path);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        ssh_buffer_free(payload);
+        sftp_request_release(req);
+        return NULL;
+    }
+
+    return sftp_request_send(req, payload);
+}
+
+static sftp_request sftp_request_handle(sftp_session sftp,
+                                        uint8_t type,
+                                        ssh_string handle,
+                                        sftp_request_callback callback,
+                                        void *userdata)
+{
+    sftp_request req;
+    ssh_buffer payload;
+    int rc;
+
+    req = sftp_request_new(sftp, type, callback, userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    payload = ssh_buffer_new();
+    if (payload == NULL) {
+        ssh_set_error_oom(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        sftp_request_release(req);
+        return NULL;
+    }
+
+    rc = ssh_buffer_pack(payload, "dS", req->id, handle);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        ssh_buffer_free(payload);
+        sftp_request_release(req);
+        return NULL;
+    }
+
+    return sftp_request_send(req, payload);
+}
+
+/* Find the link to the pending request with the given id */
+static sftp_request *sftp_async_find(sftp_session sftp, uint32_t id)
+{
+    sftp_request *pp;
+
+    pp = &sftp->async->buckets[id % SFTP_ASYNC_BUCKETS];
+    while (*pp != NULL && (*pp)->id != id) {
+        pp = &(*pp)->next;
+    }
+
+    return pp;
+}
+
+/*
+ * Complete the pending request the message answers. Returns 1 if the message
+ * has been consumed, 0 if it is not for an asynchronous request.
+ */
+static int sftp_async_dispatch(sftp_session sftp, sftp_message msg)
+{
+    sftp_status_message status;
+    sftp_request *pp;
+    sftp_request req;
+    sftp_file file;
+    int rc;
+
+    if (sftp->async == NULL || sftp->async->pending == 0) {
+        return 0;
+    }
+
+    pp = sftp_async_find(sftp, msg->id);
+    req = *pp;
+    if (req == NULL) {
+        return 0;
+    }
+    *pp = req->next;
+    req->next = NULL;
+    sftp->async->pending--;
+
+    switch (msg->packet_type) {
+    case SSH_FXP_STATUS:
+        status = parse_status_msg(msg);
+        if (status == NULL) {
+            req->status = SSH_FX_FAILURE;
+            break;
+        }
+        req->status = status->status;
+        if (status->status != SSH_FX_OK) {
+            req->errormsg = status->errormsg;
+            status->errormsg = NULL;
+        }
+        status_msg_free(status);
+
+        if (req->type == SSH_FXP_READDIR && req->status == SSH_FX_EOF &&
+            req->dir != NULL) {
+            req->dir->eof = 1;
+        }
+        break;
+    case SSH_FXP_HANDLE:
+        if (req->type != SSH_FXP_OPEN && req->type != SSH_FXP_OPENDIR) {
+            req->status = SSH_FX_BAD_MESSAGE;
+            break;
+        }
+        file = parse_handle_msg(msg);
+        if (file == NULL) {
+            req->status = SSH_FX_FAILURE;
+            break;
+        }
+
+        if (req->type == SSH_FXP_OPEN) {
+            /* The file keeps the path for cache invalidation */
+            file->name = req->path;
+            req->path = NULL;
+            req->file = file;
+        } else {
+            req->dir = calloc(1, sizeof(struct sftp_dir_struct));
+            if (req->dir == NULL) {
+                ssh_string_free(file->handle);
+                SAFE_FREE(file);
+                req->status = SSH_FX_FAILURE;
+                break;
+            }
+            req->dir->sftp = sftp;
+            req->dir->name = req->path;
+            req->dir->handle = file->handle;
+            req->path = NULL;
+            SAFE_FREE(file);
+        }
+        req->status = SSH_FX_OK;
+        break;
+    case SSH_FXP_ATTRS:
+        req->attr = sftp_parse_attr(sftp, msg->payload, 0);
+        if (req->attr == NULL) {
+            req->status = SSH_FX_FAILURE;
+            break;
+        }
+        if (sftp->cache != NULL && req->path != NULL) {
+            sftp_cache_store(sftp->cache,
+                             req->path,
+                             req->type == SSH_FXP_STAT,
+                             req->attr);
+        }
+        req->status = SSH_FX_OK;
+        break;
+    case SSH_FXP_NAME:
+        if (req->type != SSH_FXP_READDIR) {
+            req->status = SSH_FX_BAD_MESSAGE;
+            break;
+        }
+        rc = ssh_buffer_get_u32(msg->payload, &req->names_count);
+        if (rc != sizeof(uint32_t)) {
+            req->status = SSH_FX_BAD_MESSAGE;
+            break;
+        }
+        req->names_count = ntohl(req->names_count);
+        req->names = msg->payload;
+        msg->payload = NULL;
+        req->status = SSH_FX_OK;
+        break;
+    default:
+        req->status = SSH_FX_BAD_MESSAGE;
+        break;
+    }
+    sftp_message_free(msg);
+
+    /* The directory may be closed before the request is freed */
+    if (req->type == SSH_FXP_READDIR) {
+        req->dir = NULL;
+    }
+
+    switch (req->type) {
+    case SSH_FXP_REMOVE:
+    case SSH_FXP_MKDIR:
+    case SSH_FXP_SETSTAT:
+        sftp_cache_invalidate(sftp->cache, req->path);
+        break;
+    case SSH_FXP_RMDIR:
+    case SSH_FXP_RENAME:
+        sftp_cache_invalidate_tree(sftp->cache, req->path);
+        break;
+    default:
+        break;
+    }
+
+    req->done = 1;
+    sftp->async->completed++;
+
+    SSH_LOG(SSH_LOG_PACKET,
+            "Completed asynchronous request id %d type %d with status %d",
+            req->id, req->type, req->status);
+
+    if (req->detached) {
+        sftp_request_release(req);
+    } else if (req->callback != NULL) {
+        /* The callback may free the request, don't touch it afterwards */
+        req->callback(req, req->userdata);
+    }
+
+    return 1;
+}
+
+/* Check if a complete sftp packet is waiting in the channel buffer */
+static int sftp_packet_available(sftp_session sftp)
+{
+    ssh_buffer buffer = sftp->channel->stdout_buffer;
+    uint32_t len;
+
+    if (buffer == NULL || ssh_buffer_get_len(buffer) < sizeof(uint32_t)) {
+        return 0;
+    }
+
+    len = PULL_BE_U32(ssh_buffer_get(buffer), 0);
+
+    return ssh_buffer_get_len(buffer) - sizeof(uint32_t) >= len;
+}
+
+int sftp_async_process(sftp_session sftp, int timeout)
+{
+    struct ssh_timestamp ts;
+    int rc;
+
+    if (sftp == NULL) {
+        return SSH_ERROR;
+    }
+
+    if (sftp->async == NULL) {
+        return 0;
+    }
+    sftp->async->completed = 0;
+
+    ssh_timestamp_init(&ts);
+    for (;;) {
+        /* Process what arrived on the socket without blocking */
+        rc = ssh_channel_poll(sftp->channel, 0);
+        if (rc == SSH_ERROR) {
+            sftp_set_error(sftp, SSH_FX_FAILURE);
+            return SSH_ERROR;
+        }
+
+        while (sftp_packet_available(sftp)) {
+            if (sftp_read_and_dispatch(sftp) < 0) {
+                return SSH_ERROR;
+            }
+        }
+
+        if (sftp->async->completed > 0 || sftp->async->pending == 0 ||
+            timeout == 0) {
+            break;
+        }
+
+        if (rc == SSH_EOF) {
+            ssh_set_error(sftp->session, SSH_FATAL,
+                          "Received EOF with asynchronous requests pending");
+            sftp_set_error(sftp, SSH_FX_EOF);
+            return SSH_ERROR;
+        }
+
+        rc = ssh_timeout_update(&ts, timeout);
+        if (timeout > 0 && rc == 0) {
+            break;
+        }
+
+        /* Wait for more data on the socket */
+        rc = ssh_handle_packets(sftp->session, rc);
+        if (rc == SSH_ERROR) {
+            sftp_set_error(sftp, SSH_FX_FAILURE);
+            return SSH_ERROR;
+        }
+    }
+
+    return (int)sftp->async->completed;
+}
+
+/*
+ * Check if the next complete packet in the channel buffer answers an
+ * asynchronous request. The other replies are left to the blocking function
+ * waiting for them.
+ */
+static int sftp_async_reply_available(sftp_session sftp)
+{
+    ssh_buffer buffer = sftp->channel->stdout_buffer;
+    uint32_t id;
+
+    if (!sftp_packet_available(sftp) || ssh_buffer_get_len(buffer) < 9) {
+        return 0;
+    }
+
+    id = PULL_BE_U32(ssh_buffer_get(buffer), 5);
+
+    return *sftp_async_find(sftp, id) != NULL;
+}
+
+static int sftp_async_channel_data(ssh_session session,
+                                   ssh_channel channel,
+                                   void *data,
+                                   uint32_t len,
+                                   int is_stderr,
+                                   void *userdata)
+{
+    sftp_session sftp = userdata;
+    int rc;
+
+    (void)session;
+    (void)channel;
+    (void)data;
+    (void)len;
+
+    if (is_stderr) {
+        return 0;
+    }
+
+    /*
+     * The packets are read from the channel buffer, the data is never
+     * consumed here.
+     */
+    while (sftp->async != NULL && sftp->async->pending > 0 &&
+           sftp_async_reply_available(sftp)) {
+        rc = sftp_read_and_dispatch(sftp);
+        if (rc < 0) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int sftp_async_event_add(sftp_session sftp, ssh_event event)
+{
+    int rc;
+
+    if (sftp == NULL) {
+        return SSH_ERROR;
+    }
+    if (event == NULL) {
+        ssh_set_error_invalid(sftp->session);
+        return SSH_ERROR;
+    }
+
+    rc = sftp_async_init(sftp);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+    if (sftp->async->event != NULL) {
+        ssh_set_error(sftp->session,
+                      SSH_FATAL,
+                      "The sftp session is already in an event");
+        return SSH_ERROR;
+    }
+
+    rc = ssh_event_add_session(event, sftp->session);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    sftp->async->channel_cb.userdata = sftp;
+    sftp->async->channel_cb.channel_data_function = sftp_async_channel_data;
+    ssh_callbacks_init(&sftp->async->channel_cb);
+    rc = ssh_add_channel_callbacks(sftp->channel, &sftp->async->channel_cb);
+    if (rc != SSH_OK) {
+        ssh_event_remove_session(event, sftp->session);
+        return SSH_ERROR;
+    }
+    sftp->async->event = event;
+
+    /* Replies which arrived before */
+    sftp_async_channel_data(sftp->session, sftp->channel, NULL, 0, 0, sftp);
+
+    return SSH_OK;
+}
+
+int sftp_async_event_remove(sftp_session sftp, ssh_event event)
+{
+    if (sftp == NULL || sftp->async == NULL ||
+        sftp->async->event == NULL || sftp->async->event != event) {
+        return SSH_ERROR;
+    }
+
+    ssh_remove_channel_callbacks(sftp->channel, &sftp->async->channel_cb);
+    ssh_event_remove_session(event, sftp->session);
+    sftp->async->event = NULL;
+
+    return SSH_OK;
+}
+
+int sftp_async_pending(sftp_session sftp)
+{
+    if (sftp == NULL || sftp->async == NULL) {
+        return 0;
+    }
+
+    return (int)sftp->async->pending;
+}
+
+int sftp_request_wait(sftp_request req)
+{
+    int rc;
+
+    if (req == NULL) {
+        return SSH_ERROR;
+    }
+
+    while (!req->done) {
+        if (req->sftp == NULL) {
+            return SSH_ERROR;
+        }
+        rc = sftp_async_process(req->sftp, -1);
+        if (rc < 0) {
+            return SSH_ERROR;
+        }
+    }
+
+    return req->status;
+}
+
+int sftp_request_is_done(sftp_request req)
+{
+    if (req == NULL) {
+        return 0;
+    }
+
+    return req->done;
+}
+
+uint32_t sftp_request_get_id(sftp_request req)
+{
+    if (req == NULL) {
+        return 0;
+    }
+
+    return req->id;
+}
+
+int sftp_request_get_status(sftp_request req)
+{
+    if (req == NULL) {
+        return SSH_ERROR;
+    }
+
+    return req->status;
+}
+
+const char *sftp_request_get_error(sftp_request req)
+{
+    if (req == NULL) {
+        return NULL;
+    }
+
+    return req->errormsg;
+}
+
+sftp_attributes sftp_request_get_attributes(sftp_request req)
+{
+    sftp_attributes attr;
+
+    if (req == NULL || !req->done) {
+        return NULL;
+    }
+
+    if (req->type == SSH_FXP_READDIR) {
+        if (req->sftp == NULL || req->names == NULL ||
+            req->names_count == 0) {
+            return NULL;
+        }
+
+        attr = sftp_parse_attr(req->sftp, req->names, 1);
+        req->names_count--;
+        if (req->names_count == 0) {
+            SSH_BUFFER_FREE(req->names);
+        }
+        if (attr != NULL && req->path != NULL && req->sftp->cache != NULL) {
+            sftp_cache_store_dir_entry(req->sftp->cache, req->path, attr);
+        }
+
+        return attr;
+    }
+
+    attr = req->attr;
+    req->attr = NULL;
+
+    return attr;
+}
+
+sftp_file sftp_request_get_file(sftp_request req)
+{
+    sftp_file file;
+
+    if (req == NULL || !req->done || req->type != SSH_FXP_OPEN) {
+        return NULL;
+    }
+
+    file = req->file;
+    req->file = NULL;
+
+    return file;
+}
+
+sftp_dir sftp_request_get_dir(sftp_request req)
+{
+    sftp_dir dir;
+
+    if (req == NULL || !req->done || req->type != SSH_FXP_OPENDIR) {
+        return NULL;
+    }
+
+    dir = req->dir;
+    req->dir = NULL;
+
+    return dir;
+}
+
+void sftp_request_free(sftp_request req)
+{
+    if (req == NULL) {
+        return;
+    }
+
+    if (!req->done && req->sftp != NULL) {
+        /* Drop the reply when it arrives */
+        req->detached = 1;
+        req->callback = NULL;
+        return;
+    }
+
+    sftp_request_release(req);
+}
+
+/* Forget all pending requests when the sftp session goes away */
+static void sftp_async_free(sftp_session sftp)
+{
+    sftp_request req;
+    sftp_request next;
+    size_t i;
+
+    if (sftp->async == NULL) {
+        return;
+    }
+
+    if (sftp->async->event != NULL) {
+        sftp_async_event_remove(sftp, sftp->async->event);
+    }
+
+    for (i = 0; i < SFTP_ASYNC_BUCKETS; i++) {
+        for (req = sftp->async->buckets[i]; req != NULL; req = next) {
+            next = req->next;
+            if (req->detached) {
+                sftp_request_release(req);
+            } else {
+                req->next = NULL;
+                req->sftp = NULL;
+                req->dir = NULL;
+                req->done = 1;
+                req->status = SSH_FX_CONNECTION_LOST;
+            }
+        }
+    }
+
+    SAFE_FREE(sftp->async);
+}
+
+/* Keep the pending readdir requests from marking a closed directory */
+static void sftp_async_forget_dir(sftp_session sftp, sftp_dir dir)
+{
+    sftp_request req;
+    size_t i;
+
+    if (sftp == NULL || sftp->async == NULL) {
+        return;
+    }
+
+    for (i = 0; i < SFTP_ASYNC_BUCKETS; i++) {
+        for (req = sftp->async->buckets[i]; req != NULL; req = req->next) {
+            if (req->type == SSH_FXP_READDIR && req->dir == dir) {
+                req->dir = NULL;
+            }
+        }
+    }
+}
+
+sftp_request sftp_async_open(sftp_session sftp,
+                             const char *path,
+                             int flags,
+                             mode_t mode,
+                             sftp_request_callback callback,
+                             void *userdata)
+{
+    struct sftp_attributes_struct attr;
+    sftp_request req;
+    ssh_buffer payload;
+    uint32_t sftp_flags;
+    int rc;
+
+    if (sftp == NULL) {
+        return NULL;
+    }
+    if (path == NULL || (flags & O_APPEND) == O_APPEND) {
+        /* append needs the file size, use sftp_open() */
+        ssh_set_error_invalid(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return NULL;
+    }
+
+    req = sftp_request_new(sftp, SSH_FXP_OPEN, callback, userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    req->path = strdup(path);
+    payload = ssh_buffer_new();
+    if (req->path == NULL || payload == NULL) {
+        goto oom;
+    }
+
+    ZERO_STRUCT(attr);
+    attr.permissions = mode;
+    attr.flags = SSH_FILEXFER_ATTR_PERMISSIONS;
+
+    sftp_flags = sftp_open_flags(flags);
+
+    rc = ssh_buffer_pack(payload, "dsd", req->id, path, sftp_flags);
+    if (rc != SSH_OK) {
+        goto oom;
+    }
+    rc = buffer_add_attributes(payload, &attr);
+    if (rc < 0) {
+        goto oom;
+    }
+
+    if (sftp_flags & (SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC)) {
+        sftp_cache_invalidate(sftp->cache, path);
+    }
+
+    return sftp_request_send(req, payload);
+oom:
+    ssh_set_error_oom(sftp->session);
+    sftp_set_error(sftp, SSH_FX_FAILURE);
+    SSH_BUFFER_FREE(payload);
+    sftp_request_release(req);
+    return NULL;
+}
+
+sftp_request sftp_async_close(sftp_file file,
+                              sftp_request_callback callback,
+                              void *userdata)
+{
+    sftp_request req;
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    req = sftp_request_handle(file->sftp,
+                              SSH_FXP_CLOSE,
+                              file->handle,
+                              callback,
+                              userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    /* The handle has been sent, the file is not needed anymore */
+    ssh_string_free(file->handle);
+    SAFE_FREE(file->name);
+    SAFE_FREE(file);
+
+    return req;
+}
+
+sftp_request sftp_async_opendir(sftp_session sftp,
+                                const char *path,
+                                sftp_request_callback callback,
+                                void *userdata)
+{
+    return sftp_request_path(sftp, SSH_FXP_OPENDIR, path, callback, userdata);
+}
+
+sftp_request sftp_async_readdir(sftp_dir dir,
+                                sftp_request_callback callback,
+                                void *userdata)
+{
+    sftp_request req;
+
+    if (dir == NULL || dir->handle == NULL) {
+        return NULL;
+    }
+
+    req = sftp_request_handle(dir->sftp,
+                              SSH_FXP_READDIR,
+                              dir->handle,
+                              callback,
+                              userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+    req->dir = dir;
+    /* The entries are cached under the name, which outlives the directory */
+    if (dir->name != NULL) {
+        req->path = strdup(dir->name);
+    }
+
+    return req;
+}
+
+sftp_request sftp_async_closedir(sftp_dir dir,
+                                 sftp_request_callback callback,
+                                 void *userdata)
+{
+    sftp_request req;
+    uint32_t i;
+
+    if (dir == NULL || dir->handle == NULL) {
+        return NULL;
+    }
+
+    req = sftp_request_handle(dir->sftp,
+                              SSH_FXP_CLOSE,
+                              dir->handle,
+                              callback,
+                              userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    sftp_async_forget_dir(dir->sftp, dir);
+    ssh_string_free(dir->handle);
+    SSH_BUFFER_FREE(dir->buffer);
+    for (i = 0; i < dir->listing_count; i++) {
+        sftp_attributes_free(dir->listing[i]);
+    }
+    SAFE_FREE(dir->listing);
+    SAFE_FREE(dir->name);
+    SAFE_FREE(dir);
+
+    return req;
+}
+
+sftp_request sftp_async_stat(sftp_session sftp,
+                             const char *path,
+                             sftp_request_callback callback,
+                             void *userdata)
+{
+    return sftp_request_path(sftp, SSH_FXP_STAT, path, callback, userdata);
+}
+
+sftp_request sftp_async_lstat(sftp_session sftp,
+                              const char *path,
+                              sftp_request_callback callback,
+                              void *userdata)
+{
+    return sftp_request_path(sftp, SSH_FXP_LSTAT, path, callback, userdata);
+}
+
+sftp_request sftp_async_unlink(sftp_session sftp,
+                               const char *path,
+                               sftp_request_callback callback,
+                               void *userdata)
+{
+    return sftp_request_path(sftp, SSH_FXP_REMOVE, path, callback, userdata);
+}
+
+sftp_request sftp_async_rmdir(sftp_session sftp,
+                              const char *path,
+                              sftp_request_callback callback,
+                              void *userdata)
+{
+    return sftp_request_path(sftp, SSH_FXP_RMDIR, path, callback, userdata);
+}
+
+/* Send a request made of a path and attributes */
+static sftp_request sftp_request_path_attr(sftp_session sftp,
+                                           uint8_t type,
+                                           const char *path,
+                                           sftp_attributes attr,
+                                           sftp_request_callback callback,
+                                           void *userdata)
+{
+    sftp_request req;
+    ssh_buffer payload;
+    int rc;
+
+    if (sftp == NULL) {
+        return NULL;
+    }
+    if (path == NULL) {
+        ssh_set_error_invalid(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return NULL;
+    }
+
+    req = sftp_request_new(sftp, type, callback, userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    req->path = strdup(path);
+    payload = ssh_buffer_new();
+    if (req->path == NULL || payload == NULL) {
+        goto oom;
+    }
+
+    rc = ssh_buffer_pack(payload, "ds", req->id, path);
+    if (rc != SSH_OK) {
+        goto oom;
+    }
+    rc = buffer_add_attributes(payload, attr);
+    if (rc < 0) {
+        goto oom;
+    }
+
+    return sftp_request_send(req, payload);
+oom:
+    ssh_set_error_oom(sftp->session);
+    sftp_set_error(sftp, SSH_FX_FAILURE);
+    SSH_BUFFER_FREE(payload);
+    sftp_request_release(req);
+    return NULL;
+}
+
+sftp_request sftp_async_mkdir(sftp_session sftp,
+                              const char *path,
+                              mode_t mode,
+                              sftp_request_callback callback,
+                              void *userdata)
+{
+    struct sftp_attributes_struct attr;
+
+    ZERO_STRUCT(attr);
+    attr.permissions = mode;
+    attr.flags = SSH_FILEXFER_ATTR_PERMISSIONS;
+
+    return sftp_request_path_attr(sftp,
+                                  SSH_FXP_MKDIR,
+                                  path,
+                                  &attr,
+                                  callback,
+                                  userdata);
+}
+
+sftp_request sftp_async_setstat(sftp_session sftp,
+                                const char *path,
+                                sftp_attributes attr,
+                                sftp_request_callback callback,
+                                void *userdata)
+{
+    return sftp_request_path_attr(sftp,
+                                  SSH_FXP_SETSTAT,
+                                  path,
+                                  attr,
+                                  callback,
+                                  userdata);
+}
+
+sftp_request sftp_async_rename(sftp_session sftp,
+                               const char *original,
+                               const char *newname,
+                               sftp_request_callback callback,
+                               void *userdata)
+{
+    sftp_request req;
+    ssh_buffer payload;
+    int rc;
+
+    if (sftp == NULL) {
+        return NULL;
+    }
+    if (original == NULL || newname == NULL) {
+        ssh_set_error_invalid(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return NULL;
+    }
+
+    req = sftp_request_new(sftp, SSH_FXP_RENAME, callback, userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    req->path = strdup(original);
+    payload = ssh_buffer_new();
+    if (req->path == NULL || payload == NULL) {
+        goto oom;
+    }
+
+    rc = ssh_buffer_pack(payload, "dss", req->id, original, newname);
+    if (rc != SSH_OK) {
+        goto oom;
+    }
+
+    if (sftp->version >= 4) {
+        rc = ssh_buffer_add_u32(payload, SSH_FXF_RENAME_OVERWRITE);
+        if (rc < 0) {
+            goto oom;
+        }
+    }
+
+    /* The reply only names the original path, drop the target now */
+    sftp_cache_invalidate_tree(sftp->cache, newname);
+
+    return sftp_request_send(req, payload);
+oom:
+    ssh_set_error_oom(sftp->session);
+    sftp_set_error(sftp, SSH_FX_FAILURE);
+    SSH_BUFFER_FREE(payload);
+    sftp_request_release(req);
+    return NULL;
+}
+
+sftp_request sftp_async_write(sftp_file file,
+                              const void *buf,
+                              size_t count,
+                              sftp_request_callback callback,
+                              void *userdata)
+{
+    sftp_session sftp;
+    sftp_request req;
+    ssh_buffer payload;
+    int rc;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    sftp = file->sftp;
+
+    if (buf == NULL || count > SFTP_ASYNC_WRITE_SIZE_MAX) {
+        ssh_set_error_invalid(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return NULL;
+    }
+
+    req = sftp_request_new(sftp, SSH_FXP_WRITE, callback, userdata);
+    if (req == NULL) {
+        return NULL;
+    }
+
+    payload = ssh_buffer_new();
+    if (payload == NULL) {
+        goto oom;
+    }
+
+    rc = ssh_buffer_pack(payload,
+                         "dSqdP",
+                         req->id,
+                         file->handle,
+                         file->offset,
+                         (uint32_t)count,
+                         count, buf);
+    if (rc != SSH_OK) {
+        goto oom;
+    }
+
+    sftp_cache_invalidate(sftp->cache, file->name);
+
+    req = sftp_request_send(req, payload);
+    if (req != NULL) {
+        /* assume the write succeeds, like sftp_async_read_begin() */
+        file->offset += count;
+    }
+
+    return req;
+oom:
+    ssh_set_error_oom(sftp->session);
+    sftp_set_error(sftp, SSH_FX_FAILURE);
+    SSH_BUFFER_FREE(payload);
+    sftp_request_release(req);
+    return NULL;
+}
+
+#ifndef _WIN32
+struct sftp_stripe_range {
+    uint64_t offset;
+    uint64_t end;
+};
+
+struct sftp_stripe_request {
+    uint32_t id;
+    uint64_t offset;
+    uint32_t len;
+};
+
+struct sftp_stripe_worker {
+    sftp_session sftp;
+    sftp_file file;
+    /* the part of the current range which has not been requested yet */
+    struct sftp_stripe_range range;
+    /* ring of outstanding requests, oldest first */
+    struct sftp_stripe_request req[SFTP_STRIPE_DEPTH];
+    unsigned int head;
+    unsigned int pending;
+    int failed;
+};
+
+struct sftp_stripe {
+    int fd;
+    int upload;
+    /* stack of ranges which still need to be transferred */
+    struct sftp_stripe_range *ranges;
+    size_t nranges;
+    size_t allocated;
+    uint8_t buffer[SFTP_STRIPE_CHUNK_SIZE];
+};
+
+static int sftp_stripe_push(struct sftp_stripe *stripe,
+                            uint64_t offset,
+                            uint64_t end)
+{
+    struct sftp_stripe_range *tmp;
+
+    if (offset >= end) {
+        return SSH_OK;
+    }
+
+    if (stripe->nranges == stripe->allocated) {
+        size_t allocated = stripe->allocated ? 2 * stripe->allocated : 16;
+
+        tmp = realloc(stripe->ranges,
+                      allocated * sizeof(struct sftp_stripe_range));
+        if (tmp == NULL) {
+            return SSH_ERROR;
+        }
+        stripe->ranges = tmp;
+        stripe->allocated = allocated;
+    }
+
+    stripe->ranges[stripe->nranges].offset = offset;
+    stripe->ranges[stripe->nranges].end = end;
+    stripe->nranges++;
+
+    return SSH_OK;
+}
+
+/* Send a WRITE request without waiting for the reply */
+static int sftp_write_request(sftp_file file,
+                              const void *buf,
+                              uint32_t len,
+                              uint64_t offset)
+{
+    sftp_session sftp = file->sftp;
+    ssh_buffer buffer;
+    uint32_t id;
+    int rc;
+
+    buffer = ssh_buffer_new();
+    if (buffer == NULL) {
+        ssh_set_error_oom(sftp->session);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return -1;
+    }
+
+    id = sftp_get_new_id(sftp);
+
+    rc = ssh_buffer_pack(buffer,
+                         "dSqdP",
+                         id,
+                         file->handle,
+                         offset,
+                         len,
+                         (size_t)len, buf);
+    if (rc != SSH_OK) {
+        ssh_set_error_oom(sftp->session);
+        ssh_buffer_free(buffer);
+        sftp_set_error(sftp, SSH_FX_FAILURE);
+        return -1;
+    }
+
+    rc = sftp_packet_write(sftp, SSH_FXP_WRITE, buffer);
+    ssh_buffer_free(buffer);
+    if (rc < 0) {
+        return -1;
+    }
+
+    return id;
+}
+
+/* Wait for the reply to a request sent with sftp_write_request() */
+static int sftp_write_reply(sftp_file file, uint32_t id)
+{
+    sftp_session sftp = file->sftp;
+    sftp_status_message status;
+    sftp_message msg = NULL;
+
+    while (msg == NULL) {
+        if (sftp_read_and_dispatch(sftp) < 0) {
+            return SSH_ERROR;
+        }
+        msg = sftp_dequeue(sftp, id);
+    }
+
+    sftp_cache_invalidate(sftp->cache, file->name);
+
+    if (msg->packet_type != SSH_FXP_STATUS) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+                "Received message %d during write!", msg->packet_type);
+        sftp_message_free(msg);
+        sftp_set_error(sftp, SSH_FX_BAD_MESSAGE);
+        return SSH_ERROR;
+    }
+
+    status = parse_status_msg(msg);
+    sftp_message_free(msg);
+    if (status == NULL) {
+        return SSH_ERROR;
+    }
+    sftp_set_error(sftp, status->status);
+    if (status->status != SSH_FX_OK) {
+        ssh_set_error(sftp->session, SSH_REQUEST_DENIED,
+                "SFTP server: %s", status->errormsg);
+        status_msg_free(status);
+        return SSH_ERROR;
+    }
+    status_msg_free(status);
+
+    return SSH_OK;
+}
+
+/*
+ * Give the outstanding and unrequested ranges of a worker back to the
+ * others, so they are retried on a different channel.
+ */
+static int sftp_stripe_worker_fail(struct sftp_stripe *stripe,
+                                   struct sftp_stripe_worker *w)
+{
+    struct sftp_stripe_request *req;
+    int rc;
+
+    SSH_LOG(SSH_LOG_WARN,
+            "Striped transfer failed on a channel, requeuing its ranges: %s",
+            ssh_get_error(w->sftp->session));
+
+    w->failed = 1;
+
+    while (w->pending > 0) {
+        req = &w->req[w->head];
+        rc = sftp_stripe_push(stripe, req->offset, req->offset + req->len);
+        if (rc != SSH_OK) {
+            return SSH_ERROR;
+        }
+        w->head = (w->head + 1) % SFTP_STRIPE_DEPTH;
+        w->pending--;
+    }
+
+    rc = sftp_stripe_push(stripe, w->range.offset, w->range.end);
+    w->range.offset = w->range.end = 0;
+
+    return rc;
+}
+
+/* Keep up to SFTP_STRIPE_DEPTH requests in flight on a worker */
+static int sftp_stripe_worker_fill(struct sftp_stripe *stripe,
+                                   struct sftp_stripe_worker *w)
+{
+    struct sftp_stripe_request *req;
+    ssize_t nread;
+    uint32_t len;
+    int id;
+
+    while (w->pending < SFTP_STRIPE_DEPTH) {
+        if (w->range.offset >= w->range.end) {
+            if (stripe->nranges == 0) {
+                break;
+            }
+            stripe->nranges--;
+            w->range = stripe->ranges[stripe->nranges];
+        }
+
+        len = SFTP_STRIPE_CHUNK_SIZE;
+        if (w->range.end - w->range.offset < len) {
+            len = (uint32_t)(w->range.end - w->range.offset);
+        }
+
+        if (stripe->upload) {
+            nread = pread(stripe->fd, stripe->buffer, len,
+                          (off_t)w->range.offset);
+            if (nread != (ssize_t)len) {
+                ssh_set_error(w->sftp->session, SSH_FATAL,
+                              "Short read on the local file at %llu",
+                              (unsigned long long)w->range.offset);
+                return SSH_ERROR;
+            }
+            id = sftp_write_request(w->file, stripe->buffer, len,
+                                    w->range.offset);
+        } else {
+            sftp_seek64(w->file, w->range.offset);
+            id = sftp_async_read_begin(w->file, len);
+        }
+        if (id < 0) {
+            return sftp_stripe_worker_fail(stripe, w);
+        }
+
+        req = &w->req[(w->head + w->pending) % SFTP_STRIPE_DEPTH];
+        req->id = id;
+        req->offset = w->range.offset;
+        req->len = len;
+        w->pending++;
+
+        w->range.offset += len;
+    }
+
+    return SSH_OK;
+}
+
+/* Complete the oldest outstanding request of a worker */
+static int sftp_stripe_worker_complete(struct sftp_stripe *stripe,
+                                       struct sftp_stripe_worker *w)
+{
+    struct sftp_stripe_request *req = &w->req[w->head];
+    ssize_t nwritten;
+    uint64_t offset;
+    uint32_t len;
+    int id;
+    int rc;
+
+    if (stripe->upload) {
+        rc = sftp_write_reply(w->file, req->id);
+        if (rc != SSH_OK) {
+            return sftp_stripe_worker_fail(stripe, w);
+        }
+    } else {
+        rc = sftp_async_read(w->file, stripe->buffer, req->len, req->id);
+        if (rc < 0) {
+            return sftp_stripe_worker_fail(stripe, w);
+        }
+        if (rc == 0) {
+            ssh_set_error(w->sftp->session, SSH_FATAL,
+                          "Remote file truncated during striped transfer");
+            return SSH_ERROR;
+        }
+
+        offset = req->offset;
+        len = req->len;
+        for (;;) {
+            nwritten = pwrite(stripe->fd, stripe->buffer, rc, (off_t)offset);
+            if (nwritten != rc) {
+                ssh_set_error(w->sftp->session, SSH_FATAL,
+                              "Failed to write to the local file at %llu",
+                              (unsigned long long)offset);
+                return SSH_ERROR;
+            }
+            offset += rc;
+            len -= rc;
+            if (len == 0) {
+                break;
+            }
+
+            /*
+             * The server is allowed to return less data than requested. The
+             * rest is read before the requests behind are completed, so the
+             * local file never has holes and stays a prefix to resume from.
+             */
+            sftp_seek64(w->file, offset);
+            id = sftp_async_read_begin(w->file, len);
+            if (id < 0) {
+                return sftp_stripe_worker_fail(stripe, w);
+            }
+            rc = sftp_async_read(w->file, stripe->buffer, len, (uint32_t)id);
+            if (rc < 0) {
+                return sftp_stripe_worker_fail(stripe, w);
+            }
+            if (rc == 0) {
+                ssh_set_error(w->sftp->session, SSH_FATAL,
+                              "Remote file truncated during striped transfer");
+                return SSH_ERROR;
+            }
+        }
+    }
+
+    w->head = (w->head + 1) % SFTP_STRIPE_DEPTH;
+    w->pending--;
+
+    return SSH_OK;
+}
+
+/*
+ * Compare the range [offset, end) of the remote file with the local file.
+ * Returns 1 if they are the same, 0 if they differ and SSH_ERROR on error.
+ */
+static int sftp_stripe_verify(sftp_file file,
+                              int fd,
+                              uint64_t offset,
+                              uint64_t end)
+{
+    struct sftp_stripe_request req[SFTP_STRIPE_DEPTH];
+    struct sftp_stripe_request *r;
+    unsigned int head = 0;
+    unsigned int pending = 0;
+    uint8_t *remote;
+    uint8_t *local;
+    ssize_t nread;
+    uint32_t len;
+    int match = 1;
+    int rc;
+
+    remote = malloc(2 * SFTP_STRIPE_CHUNK_SIZE);
+    if (remote == NULL) {
+        ssh_set_error_oom(file->sftp->session);
+        return SSH_ERROR;
+    }
+    local = remote + SFTP_STRIPE_CHUNK_SIZE;
+
+    while (offset < end || pending > 0) {
+        /* Stop sending requests after a mismatch, only drain the replies */
+        while (match && offset < end && pending < SFTP_STRIPE_DEPTH) {
+            len = SFTP_STRIPE_CHUNK_SIZE;
+            if (end - offset < len) {
+                len = (uint32_t)(end - offset);
+            }
+
+            sftp_seek64(file, offset);
+            rc = sftp_async_read_begin(file, len);
+            if (rc < 0) {
+                goto out;
+            }
+
+            r = &req[(head + pending) % SFTP_STRIPE_DEPTH];
+            r->id = (uint32_t)rc;
+            r->offset = offset;
+            r->len = len;
+            pending++;
+
+            offset += len;
+        }
+        if (pending == 0) {
+            break;
+        }
+
+        r = &req[head];
+        head = (head + 1) % SFTP_STRIPE_DEPTH;
+        pending--;
+
+        rc = sftp_async_read(file, remote, r->len, r->id);
+        if (rc < 0) {
+            goto out;
+        }
+        if (!match) {
+            continue;
+        }
+
+        /* A short read is treated as a mismatch, the transfer restarts */
+        if ((uint32_t)rc != r->len) {
+            match = 0;
+            continue;
+        }
+
+        nread = pread(fd, local, r->len, (off_t)r->offset);
+        if (nread != (ssize_t)r->len ||
+            memcmp(remote, local, r->len) != 0) {
+            match = 0;
+        }
+    }
+
+    rc = match;
+out:
+    SAFE_FREE(remote);
+
+    return rc;
+}
+
+/*
+ * Find the offset to resume a transfer from. The partial file must be a
+ * prefix of the complete one; its tail is compared with the other side and
+ * the transfer restarts from zero if it differs.
+ */
+static int sftp_stripe_resume_offset(sftp_file file,
+                                     int fd,
+                                     uint64_t partial,
+                                     uint64_t size,
+                                     uint64_t verify_size,
+                                     uint64_t *start)
+{
+    uint64_t offset = 0;
+    int rc;
+
+    *start = 0;
+
+    if (partial == 0) {
+        return SSH_OK;
+    }
+    if (partial > size) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Partial file larger than the source, restarting");
+        return SSH_OK;
+    }
+
+    if (verify_size < partial) {
+        offset = partial - verify_size;
+    }
+
+    rc = sftp_stripe_verify(file, fd, offset, partial);
+    if (rc < 0) {
+        return SSH_ERROR;
+    }
+    if (rc == 0) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Tail of the partial file differs, restarting");
+        return SSH_OK;
+    }
+
+    SSH_LOG(SSH_LOG_PROTOCOL,
+            "Resuming transfer at %llu of %llu bytes",
+            (unsigned long long)partial,
+            (unsigned long long)size);
+    *start = partial;
+
+    return SSH_OK;
+}
+
+static int sftp_stripe_run(sftp_session *sftp,
+                           size_t count,
+                           const char *path,
+                           int fd,
+                           int flags,
+                           mode_t mode,
+                           uint64_t verify_size,
+                           uint64_t *resumed)
+{
+    struct sftp_stripe_worker *workers = NULL;
+    struct sftp_stripe *stripe = NULL;
+    sftp_attributes attr = NULL;
+    int upload = (flags & SFTP_STRIPE_UPLOAD) != 0;
+    int resume = (flags & SFTP_STRIPE_RESUME) != 0;
+    uint64_t partial = 0;
+    uint64_t start = 0;
+    uint64_t size;
+    uint64_t offset;
+    uint64_t n;
+    size_t active;
+    size_t i;
+    int rc = SSH_ERROR;
+
+    if (sftp == NULL || count == 0 || sftp[0] == NULL || path == NULL ||
+        fd < 0) {
+        return SSH_ERROR;
+    }
+
+    stripe = calloc(1, sizeof(struct sftp_stripe));
+    workers = calloc(count, sizeof(struct sftp_stripe_worker));
+    if (stripe == NULL || workers == NULL) {
+        ssh_set_error_oom(sftp[0]->session);
+        goto out;
+    }
+    stripe->fd = fd;
+    stripe->upload = upload;
+
+    for (i = 0; i < count; i++) {
+        int oflags = O_RDONLY;
+
+        if (sftp[i] == NULL) {
+            ssh_set_error_invalid(sftp[0]->session);
+            goto out;
+        }
+        workers[i].sftp = sftp[i];
+
+        if (upload && resume) {
+            /* Keep the partial file and read its tail back */
+            oflags = (i == 0) ? O_RDWR | O_CREAT : O_WRONLY;
+        } else if (upload) {
+            /* Only the first one truncates, the others join in */
+            oflags = (i == 0) ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY;
+        }
+
+        workers[i].file = sftp_open(sftp[i], path, oflags, mode);
+        if (workers[i].file == NULL) {
+            if (i == 0) {
+                goto out;
+            }
+            /* Carry on with fewer channels */
+            workers[i].failed = 1;
+        }
+    }
+
+    if (upload) {
+        struct stat sb;
+
+        rc = fstat(fd, &sb);
+        if (rc < 0) {
+            ssh_set_error(sftp[0]->session, SSH_FATAL,
+                          "Failed to stat the local file");
+            rc = SSH_ERROR;
+            goto out;
+        }
+        size = (uint64_t)sb.st_size;
+
+        if (resume) {
+            attr = sftp_fstat(workers[0].file);
+            if (attr == NULL) {
+                rc = SSH_ERROR;
+                goto out;
+            }
+            if (attr->flags & SSH_FILEXFER_ATTR_SIZE) {
+                partial = attr->size;
+            }
+        }
+    } else {
+        attr = sftp_fstat(workers[0].file);
+        if (attr == NULL) {
+            rc = SSH_ERROR;
+            goto out;
+        }
+        if ((attr->flags & SSH_FILEXFER_ATTR_SIZE) == 0) {
+            ssh_set_error(sftp[0]->session, SSH_FATAL,
+                          "Remote file size unknown");
+            rc = SSH_ERROR;
+            goto out;
+        }
+        size = attr->size;
+
+        if (resume) {
+            struct stat sb;
+
+            rc = fstat(fd, &sb);
+            if (rc < 0) {
+                ssh_set_error(sftp[0]->session, SSH_FATAL,
+                              "Failed to stat the local file");
+                rc = SSH_ERROR;
+                goto out;
+            }
+            partial = (uint64_t)sb.st_size;
+        }
+    }
+
+    if (resume) {
+        rc = sftp_stripe_resume_offset(workers[0].file,
+                                       fd,
+                                       partial,
+                                       size,
+                                       verify_size,
+                                       &start);
+        if (rc != SSH_OK) {
+            goto out;
+        }
+    }
+
+    if (!upload) {
+        /*
+         * When resuming, the local file only grows as data arrives in order,
+         * so an interrupted transfer leaves a prefix to resume from.
+         */
+        rc = ftruncate(fd, (off_t)(resume ? start : size));
+        if (rc < 0) {
+            ssh_set_error(sftp[0]->session, SSH_FATAL,
+                          "Failed to resize the local file");
+            rc = SSH_ERROR;
+            goto out;
+        }
+    } else if (resume && partial != start) {
+        struct sftp_attributes_struct trunc_attr;
+
+        ZERO_STRUCT(trunc_attr);
+        trunc_attr.flags = SSH_FILEXFER_ATTR_SIZE;
+        trunc_attr.size = start;
+
+        rc = sftp_setstat(sftp[0], path, &trunc_attr);
+        if (rc < 0) {
+            rc = SSH_ERROR;
+            goto out;
+        }
+    }
+
+    /* Push in reverse order, so ranges are popped in ascending order */
+    n = (size - start + SFTP_STRIPE_RANGE_SIZE - 1) / SFTP_STRIPE_RANGE_SIZE;
+    while (n > 0) {
+        uint64_t end;
+
+        n--;
+        offset = start + n * SFTP_STRIPE_RANGE_SIZE;
+        end = offset + SFTP_STRIPE_RANGE_SIZE;
+
+        rc = sftp_stripe_push(stripe, offset, end < size ? end : size);
+        if (rc != SSH_OK) {
+            ssh_set_error_oom(sftp[0]->session);
+            goto out;
+        }
+    }
+
+    /*
+     * Round robin over the channels: top up the requests in flight and
+     * complete the oldest one, so every channel always has data in flight.
+     */
+    do {
+        active = 0;
+        for (i = 0; i < count; i++) {
+            struct sftp_stripe_worker *w = &workers[i];
+
+            if (w->failed) {
+                continue;
+            }
+
+            rc = sftp_stripe_worker_fill(stripe, w);
+            if (rc != SSH_OK) {
+                goto out;
+            }
+            if (w->failed || w->pending == 0) {
+                continue;
+            }
+            active++;
+
+            rc = sftp_stripe_worker_complete(stripe, w);
+            if (rc != SSH_OK) {
+                goto out;
+            }
+        }
+    } while (active > 0);
+
+    if (stripe->nranges > 0) {
+        /* all channels failed */
+        rc = SSH_ERROR;
+        goto out;
+    }
+
+    if (resumed != NULL) {
+        *resumed = start;
+    }
+
+    rc = SSH_OK;
+out:
+    if (workers != NULL) {
+        for (i = 0; i < count; i++) {
+            if (workers[i].file != NULL) {
+                sftp_close(workers[i].file);
+            }
+        }
+        SAFE_FREE(workers);
+    }
+    if (stripe != NULL) {
+        SAFE_FREE(stripe->ranges);
+        SAFE_FREE(stripe);
+    }
+    sftp_attributes_free(attr);
+
+    return rc;
+}
+
+int sftp_striped_download(sftp_session *sftp,
+                          size_t count,
+                          const char *path,
+                          int fd)
+{
+    return sftp_stripe_run(sftp, count, path, fd, 0, 0, 0, NULL);
+}
+
+int sftp_striped_upload(sftp_session *sftp,
+                        size_t count,
+                        int fd,
+                        const char *path,
+                        mode_t mode)
+{
+    return sftp_stripe_run(sftp,
+                           count,
+                           path,
+                           fd,
+                           SFTP_STRIPE_UPLOAD,
+                           mode,
+                           0,
+                           NULL);
+}
+
+int sftp_resume_download(sftp_session sftp,
+                         const char *path,
+                         int fd,
+                         uint64_t verify_size,
+                         uint64_t *resumed)
+{
+    if (verify_size == 0) {
+        verify_size = SFTP_RESUME_VERIFY_SIZE;
+    }
+
+    /* A single channel writes in order, so the file stays a prefix */
+    return sftp_stripe_run(&sftp,
+                           1,
+                           path,
+                           fd,
+                           SFTP_STRIPE_RESUME,
+                           0,
+                           verify_size,
+                           resumed);
+}
+
+int sftp_resume_upload(sftp_session sftp,
+                       int fd,
+                       const char *path,
+                       mode_t mode,
+                       uint64_t verify_size,
+                       uint64_t *resumed)
+{
+    if (verify_size == 0) {
+        verify_size = SFTP_RESUME_VERIFY_SIZE;
+    }
+
+    return sftp_stripe_run(&sftp,
+                           1,
+                           path,
+                           fd,
+                           SFTP_STRIPE_UPLOAD | SFTP_STRIPE_RESUME,
+                           mode,
+                           verify_size,
+                           resumed);
+}
+#else /* _WIN32 */
+int sftp_striped_download(sftp_session *sftp,
+                          size_t count,
+                          const char *path,
+                          int fd)
+{
+    (void)count;
+    (void)path;
+    (void)fd;
+
+    if (sftp != NULL && sftp[0] != NULL) {
+        ssh_set_error(sftp[0]->session, SSH_FATAL,
+                      "Striped transfers are not supported on this platform");
+    }
+
+    return SSH_ERROR;
+}
+
+int sftp_striped_upload(sftp_session *sftp,
+                        size_t count,
+                        int fd,
+                        const char *path,
+                        mode_t mode)
+{
+    (void)count;
+    (void)fd;
+    (void)path;
+    (void)mode;
+
+    if (sftp != NULL && sftp[0] != NULL) {
+        ssh_set_error(sftp[0]->session, SSH_FATAL,
+                      "Striped transfers are not supported on this platform");
+    }
+
+    return SSH_ERROR;
+}
+
+int sftp_resume_download(sftp_session sftp,
+                         const char *path,
+                         int fd,
+                         uint64_t verify_size,
+                         uint64_t *resumed)
+{
+    (void)path;
+    (void)fd;
+    (void)verify_size;
+    (void)resumed;
+
+    if (sftp != NULL) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+                      "Resumed transfers are not supported on this platform");
+    }
+
+    return SSH_ERROR;
+}
+
+int sftp_resume_upload(sftp_session sftp,
+                       int fd,
+                       const char *path,
+                       mode_t mode,
+                       uint64_t verify_size,
+                       uint64_t *resumed)
+{
+    (void)fd;
+    (void)path;
+    (void)mode;
+    (void)verify_size;
+    (void)resumed;
+
+    if (sftp != NULL) {
+        ssh_set_error(sftp->session, SSH_FATAL,
+                      "Resumed transfers are not supported on this platform");
+    }
+
+    return SSH_ERROR;
+}
+#endif /* _WIN32 */
+
 #endif /* WITH_SFTP */
@@ -0,0 +1,678 @@
+/*
+ * sftp_cache.c - SFTP attribute and directory listing cache
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libssh/priv.h"
+#include "libssh/sftp.h"
+#include "libssh/sftp_cache.h"
+#include "libssh/misc.h"
+#include "libssh/threads.h"
+
+#ifdef WITH_SFTP
+
+/* Minimum number of hash buckets, must be a power of two */
+#define SFTP_CACHE_MIN_BUCKETS 64
+
+enum sftp_cache_slot_e {
+    SFTP_CACHE_SLOT_LSTAT = 0,
+    SFTP_CACHE_SLOT_STAT,
+    SFTP_CACHE_SLOT_MAX
+};
+
+struct sftp_cache_slot {
+    sftp_attributes attr;
+    struct ssh_timestamp ts;
+};
+
+struct sftp_cache_entry {
+    /* hash chain */
+    struct sftp_cache_entry *next;
+    /* insertion order, used for eviction */
+    struct sftp_cache_entry *older;
+    struct sftp_cache_entry *newer;
+
+    uint32_t hash;
+    char *path;
+
+    struct sftp_cache_slot slot[SFTP_CACHE_SLOT_MAX];
+
+    sftp_attributes *listing;
+    uint32_t listing_count;
+    struct ssh_timestamp listing_ts;
+};
+
+struct sftp_cache_struct {
+    SSH_MUTEX mutex;
+
+    int ttl;
+    size_t max_entries;
+
+    struct sftp_cache_entry **buckets;
+    uint32_t nbuckets;
+    size_t count;
+
+    /* oldest and newest entries */
+    struct sftp_cache_entry *oldest;
+    struct sftp_cache_entry *newest;
+
+    struct sftp_cache_stats_struct stats;
+};
+
+/* FNV-1a */
+static uint32_t sftp_cache_hash(const char *path)
+{
+    const unsigned char *p = (const unsigned char *)path;
+    uint32_t h = 2166136261u;
+
+    while (*p != '\0') {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static char *sftp_cache_join(const char *dirname, const char *name)
+{
+    size_t dlen = strlen(dirname);
+    size_t nlen = strlen(name);
+    char *path;
+
+    /* strip a trailing slash, but keep "/" */
+    while (dlen > 1 && dirname[dlen - 1] == '/') {
+        dlen--;
+    }
+
+    path = malloc(dlen + nlen + 2);
+    if (path == NULL) {
+        return NULL;
+    }
+
+    memcpy(path, dirname, dlen);
+    if (dlen == 0 || dirname[dlen - 1] != '/') {
+        path[dlen++] = '/';
+    }
+    memcpy(path + dlen, name, nlen + 1);
+
+    return path;
+}
+
+static char *sftp_cache_dirname(const char *path)
+{
+    const char *p;
+    size_t len;
+
+    p = strrchr(path, '/');
+    if (p == NULL) {
+        return strdup(".");
+    }
+
+    len = p - path;
+    if (len == 0) {
+        return strdup("/");
+    }
+
+    return strndup(path, len);
+}
+
+sftp_attributes sftp_attributes_dup(sftp_attributes attr)
+{
+    sftp_attributes dup;
+
+    if (attr == NULL) {
+        return NULL;
+    }
+
+    dup = malloc(sizeof(struct sftp_attributes_struct));
+    if (dup == NULL) {
+        return NULL;
+    }
+    memcpy(dup, attr, sizeof(struct sftp_attributes_struct));
+
+    dup->name = NULL;
+    dup->longname = NULL;
+    dup->owner = NULL;
+    dup->group = NULL;
+    dup->acl = NULL;
+    dup->extended_type = NULL;
+    dup->extended_data = NULL;
+
+    if (attr->name != NULL) {
+        dup->name = strdup(attr->name);
+        if (dup->name == NULL) {
+            goto error;
+        }
+    }
+    if (attr->longname != NULL) {
+        dup->longname = strdup(attr->longname);
+        if (dup->longname == NULL) {
+            goto error;
+        }
+    }
+    if (attr->owner != NULL) {
+        dup->owner = strdup(attr->owner);
+        if (dup->owner == NULL) {
+            goto error;
+        }
+    }
+    if (attr->group != NULL) {
+        dup->group = strdup(attr->group);
+        if (dup->group == NULL) {
+            goto error;
+        }
+    }
+    if (attr->acl != NULL) {
+        dup->acl = ssh_string_copy(attr->acl);
+        if (dup->acl == NULL) {
+            goto error;
+        }
+    }
+    if (attr->extended_type != NULL) {
+        dup->extended_type = ssh_string_copy(attr->extended_type);
+        if (dup->extended_type == NULL) {
+            goto error;
+        }
+    }
+    if (attr->extended_data != NULL) {
+        dup->extended_data = ssh_string_copy(attr->extended_data);
+        if (dup->extended_data == NULL) {
+            goto error;
+        }
+    }
+
+    return dup;
+error:
+    sftp_attributes_free(dup);
+    return NULL;
+}
+
+static void sftp_cache_listing_free(sftp_attributes *listing, uint32_t count)
+{
+    uint32_t i;
+
+    if (listing == NULL) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        sftp_attributes_free(listing[i]);
+    }
+    SAFE_FREE(listing);
+}
+
+static void sftp_cache_entry_free(struct sftp_cache_entry *entry)
+{
+    int i;
+
+    for (i = 0; i < SFTP_CACHE_SLOT_MAX; i++) {
+        sftp_attributes_free(entry->slot[i].attr);
+    }
+    sftp_cache_listing_free(entry->listing, entry->listing_count);
+    SAFE_FREE(entry->path);
+    SAFE_FREE(entry);
+}
+
+static struct sftp_cache_entry *sftp_cache_find(sftp_cache cache,
+                                                const char *path,
+                                                uint32_t hash)
+{
+    struct sftp_cache_entry *entry;
+
+    entry = cache->buckets[hash & (cache->nbuckets - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+
+    return NULL;
+}
+
+static void sftp_cache_unlink(sftp_cache cache, struct sftp_cache_entry *entry)
+{
+    struct sftp_cache_entry **pp;
+
+    pp = &cache->buckets[entry->hash & (cache->nbuckets - 1)];
+    while (*pp != NULL) {
+        if (*pp == entry) {
+            *pp = entry->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+
+    cache->count--;
+}
+
+static void sftp_cache_remove(sftp_cache cache, struct sftp_cache_entry *entry)
+{
+    sftp_cache_unlink(cache, entry);
+    sftp_cache_entry_free(entry);
+}
+
+/* Find or create the entry for path. Must be called with the mutex held. */
+static struct sftp_cache_entry *sftp_cache_get_entry(sftp_cache cache,
+                                                     const char *path)
+{
+    struct sftp_cache_entry *entry;
+    uint32_t hash;
+    uint32_t idx;
+
+    hash = sftp_cache_hash(path);
+    entry = sftp_cache_find(cache, path, hash);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    if (cache->count >= cache->max_entries && cache->oldest != NULL) {
+        sftp_cache_remove(cache, cache->oldest);
+        cache->stats.evictions++;
+    }
+
+    entry = calloc(1, sizeof(struct sftp_cache_entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    entry->path = strdup(path);
+    if (entry->path == NULL) {
+        SAFE_FREE(entry);
+        return NULL;
+    }
+    entry->hash = hash;
+
+    idx = hash & (cache->nbuckets - 1);
+    entry->next = cache->buckets[idx];
+    cache->buckets[idx] = entry;
+
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+
+    cache->count++;
+
+    return entry;
+}
+
+static int sftp_cache_slot_valid(sftp_cache cache,
+                                 struct sftp_cache_slot *slot)
+{
+    if (slot->attr == NULL) {
+        return 0;
+    }
+
+    if (ssh_timeout_elapsed(&slot->ts, cache->ttl)) {
+        sftp_attributes_free(slot->attr);
+        slot->attr = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+sftp_cache sftp_cache_new(unsigned int ttl_ms, size_t max_entries)
+{
+    static const SSH_MUTEX mutex_init = SSH_MUTEX_STATIC_INIT;
+    sftp_cache cache;
+    uint32_t nbuckets = SFTP_CACHE_MIN_BUCKETS;
+
+    if (ttl_ms == 0 || ttl_ms > INT_MAX || max_entries == 0) {
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(struct sftp_cache_struct));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    while (nbuckets < max_entries && nbuckets < (1u << 20)) {
+        nbuckets <<= 1;
+    }
+
+    cache->buckets = calloc(nbuckets, sizeof(struct sftp_cache_entry *));
+    if (cache->buckets == NULL) {
+        SAFE_FREE(cache);
+        return NULL;
+    }
+
+    cache->mutex = mutex_init;
+    cache->nbuckets = nbuckets;
+    cache->ttl = (int)ttl_ms;
+    cache->max_entries = max_entries;
+
+    return cache;
+}
+
+void sftp_cache_free(sftp_cache cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    sftp_cache_flush(cache);
+
+    SAFE_FREE(cache->buckets);
+    SAFE_FREE(cache);
+}
+
+void sftp_cache_flush(sftp_cache cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    while (cache->oldest != NULL) {
+        sftp_cache_remove(cache, cache->oldest);
+    }
+    ssh_mutex_unlock(&cache->mutex);
+}
+
+void sftp_cache_invalidate(sftp_cache cache, const char *path)
+{
+    struct sftp_cache_entry *entry;
+    char *parent;
+
+    if (cache == NULL || path == NULL) {
+        return;
+    }
+
+    parent = sftp_cache_dirname(path);
+
+    ssh_mutex_lock(&cache->mutex);
+    entry = sftp_cache_find(cache, path, sftp_cache_hash(path));
+    if (entry != NULL) {
+        sftp_cache_remove(cache, entry);
+        cache->stats.invalidations++;
+    }
+
+    /* The listing of the parent directory carries attributes of path too */
+    if (parent != NULL) {
+        entry = sftp_cache_find(cache, parent, sftp_cache_hash(parent));
+        if (entry != NULL && entry->listing != NULL) {
+            sftp_cache_listing_free(entry->listing, entry->listing_count);
+            entry->listing = NULL;
+            entry->listing_count = 0;
+            cache->stats.invalidations++;
+        }
+    }
+    ssh_mutex_unlock(&cache->mutex);
+
+    SAFE_FREE(parent);
+}
+
+void sftp_cache_invalidate_tree(sftp_cache cache, const char *path)
+{
+    struct sftp_cache_entry *entry;
+    struct sftp_cache_entry *newer;
+    size_t len;
+
+    if (cache == NULL || path == NULL) {
+        return;
+    }
+
+    sftp_cache_invalidate(cache, path);
+
+    len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    for (entry = cache->oldest; entry != NULL; entry = newer) {
+        newer = entry->newer;
+        if (strncmp(entry->path, path, len) == 0 &&
+            entry->path[len] == '/') {
+            sftp_cache_remove(cache, entry);
+            cache->stats.invalidations++;
+        }
+    }
+    ssh_mutex_unlock(&cache->mutex);
+}
+
+void sftp_cache_get_stats(sftp_cache cache, sftp_cache_stats stats)
+{
+    if (cache == NULL || stats == NULL) {
+        return;
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    *stats = cache->stats;
+    stats->entries = cache->count;
+    ssh_mutex_unlock(&cache->mutex);
+}
+
+sftp_attributes sftp_cache_lookup(sftp_cache cache,
+                                  const char *path,
+                                  int follow_links)
+{
+    struct sftp_cache_entry *entry;
+    struct sftp_cache_slot *slot;
+    sftp_attributes attr = NULL;
+
+    if (cache == NULL || path == NULL) {
+        return NULL;
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    entry = sftp_cache_find(cache, path, sftp_cache_hash(path));
+    if (entry == NULL) {
+        goto out;
+    }
+
+    slot = &entry->slot[follow_links ? SFTP_CACHE_SLOT_STAT :
+                                       SFTP_CACHE_SLOT_LSTAT];
+    if (sftp_cache_slot_valid(cache, slot)) {
+        attr = sftp_attributes_dup(slot->attr);
+        goto out;
+    }
+
+    /*
+     * stat() and lstat() only differ for symbolic links, so an lstat() result
+     * of anything else answers a stat() too.
+     */
+    if (follow_links) {
+        slot = &entry->slot[SFTP_CACHE_SLOT_LSTAT];
+        if (sftp_cache_slot_valid(cache, slot) &&
+            (slot->attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS) &&
+            slot->attr->type != SSH_FILEXFER_TYPE_SYMLINK &&
+            slot->attr->type != SSH_FILEXFER_TYPE_UNKNOWN) {
+            attr = sftp_attributes_dup(slot->attr);
+        }
+    }
+
+out:
+    if (attr != NULL) {
+        cache->stats.hits++;
+    } else {
+        cache->stats.misses++;
+    }
+    ssh_mutex_unlock(&cache->mutex);
+
+    return attr;
+}
+
+void sftp_cache_store(sftp_cache cache,
+                      const char *path,
+                      int follow_links,
+                      sftp_attributes attr)
+{
+    struct sftp_cache_entry *entry;
+    struct sftp_cache_slot *slot;
+    sftp_attributes dup;
+
+    if (cache == NULL || path == NULL || attr == NULL) {
+        return;
+    }
+
+    dup = sftp_attributes_dup(attr);
+    if (dup == NULL) {
+        return;
+    }
+    /* stat replies carry no name, keep it that way for cached answers */
+    SAFE_FREE(dup->name);
+    SAFE_FREE(dup->longname);
+
+    ssh_mutex_lock(&cache->mutex);
+    entry = sftp_cache_get_entry(cache, path);
+    if (entry == NULL) {
+        ssh_mutex_unlock(&cache->mutex);
+        sftp_attributes_free(dup);
+        return;
+    }
+
+    slot = &entry->slot[follow_links ? SFTP_CACHE_SLOT_STAT :
+                                       SFTP_CACHE_SLOT_LSTAT];
+    sftp_attributes_free(slot->attr);
+    slot->attr = dup;
+    ssh_timestamp_init(&slot->ts);
+    ssh_mutex_unlock(&cache->mutex);
+}
+
+void sftp_cache_store_dir_entry(sftp_cache cache,
+                                const char *dirname,
+                                sftp_attributes attr)
+{
+    char *path;
+
+    if (cache == NULL || dirname == NULL || attr == NULL ||
+        attr->name == NULL) {
+        return;
+    }
+
+    if (strcmp(attr->name, ".") == 0 || strcmp(attr->name, "..") == 0) {
+        return;
+    }
+
+    path = sftp_cache_join(dirname, attr->name);
+    if (path == NULL) {
+        return;
+    }
+
+    /* READDIR returns the attributes of the entry itself, as lstat() does */
+    sftp_cache_store(cache, path, 0, attr);
+    SAFE_FREE(path);
+}
+
+int sftp_cache_listing_lookup(sftp_cache cache,
+                              const char *dirname,
+                              sftp_attributes **entries,
+                              uint32_t *count)
+{
+    struct sftp_cache_entry *entry;
+    sftp_attributes *listing = NULL;
+    uint32_t i;
+    int rc = SSH_ERROR;
+
+    if (cache == NULL || dirname == NULL) {
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    entry = sftp_cache_find(cache, dirname, sftp_cache_hash(dirname));
+    if (entry == NULL || entry->listing == NULL) {
+        goto out;
+    }
+
+    if (ssh_timeout_elapsed(&entry->listing_ts, cache->ttl)) {
+        sftp_cache_listing_free(entry->listing, entry->listing_count);
+        entry->listing = NULL;
+        entry->listing_count = 0;
+        goto out;
+    }
+
+    listing = calloc(entry->listing_count + 1, sizeof(sftp_attributes));
+    if (listing == NULL) {
+        goto out;
+    }
+
+    for (i = 0; i < entry->listing_count; i++) {
+        listing[i] = sftp_attributes_dup(entry->listing[i]);
+        if (listing[i] == NULL) {
+            sftp_cache_listing_free(listing, i);
+            listing = NULL;
+            goto out;
+        }
+    }
+
+    *entries = listing;
+    *count = entry->listing_count;
+    rc = SSH_OK;
+out:
+    if (rc == SSH_OK) {
+        cache->stats.hits++;
+    } else {
+        cache->stats.misses++;
+    }
+    ssh_mutex_unlock(&cache->mutex);
+
+    return rc;
+}
+
+void sftp_cache_listing_store(sftp_cache cache,
+                              const char *dirname,
+                              sftp_attributes *entries,
+                              uint32_t count)
+{
+    struct sftp_cache_entry *entry;
+
+    if (cache == NULL || dirname == NULL) {
+        sftp_cache_listing_free(entries, count);
+        return;
+    }
+
+    ssh_mutex_lock(&cache->mutex);
+    entry = sftp_cache_get_entry(cache, dirname);
+    if (entry == NULL) {
+        ssh_mutex_unlock(&cache->mutex);
+        sftp_cache_listing_free(entries, count);
+        return;
+    }
+
+    sftp_cache_listing_free(entry->listing, entry->listing_count);
+    entry->listing = entries;
+    entry->listing_count = count;
+    ssh_timestamp_init(&entry->listing_ts);
+    ssh_mutex_unlock(&cache->mutex);
+}
+
+#endif /* WITH_SFTP */
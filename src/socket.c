@@ -716,6 +716,16 @@ int ssh_socket_buffered_write_bytes(ssh_socket s){
 	return ssh_buffer_get_len(s->out_buffer);
 }
 
+/** @internal
+ * @brief returns the data read from the socket which the packet layer did
+ *        not process yet, the start of a packet.
+ * @param s the socket
+ */
+ssh_buffer ssh_socket_get_in_buffer(ssh_socket s)
+{
+    return s->in_buffer;
+}
+
 
 int ssh_socket_get_status(ssh_socket s) {
   int r = 0;
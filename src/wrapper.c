@@ -230,12 +230,41 @@ void crypto_free(struct ssh_crypto_struct *crypto)
     SAFE_FREE(crypto);
 }
 
+/* Get the index of a cipher in the table of the crypto backend, -1 if unknown */
+static int crypt_cipher_index(const char *name)
+{
+    struct ssh_cipher_struct *ssh_ciphertab = ssh_get_ciphertab();
+    int i;
+
+    for (i = 0; i < 64 && ssh_ciphertab[i].name != NULL; i++) {
+        if (strcmp(name, ssh_ciphertab[i].name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Get the index of a hmac in the hmac table, -1 if unknown */
+static int crypt_hmac_index(const char *name)
+{
+    struct ssh_hmac_struct *ssh_hmactab = ssh_get_hmactab();
+    int i;
+
+    for (i = 0; ssh_hmactab[i].name != NULL; i++) {
+        if (strcmp(name, ssh_hmactab[i].name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 static int crypt_set_algorithms2(ssh_session session)
 {
     const char *wanted = NULL;
-    struct ssh_cipher_struct *ssh_ciphertab=ssh_get_ciphertab();
     struct ssh_hmac_struct *ssh_hmactab=ssh_get_hmactab();
-    size_t i = 0;
+    int idx;
     int cmp;
 
     /*
@@ -245,14 +274,8 @@ static int crypt_set_algorithms2(ssh_session session)
 
     /* out */
     wanted = session->next_crypto->kex_methods[SSH_CRYPT_C_S];
-    for (i = 0; i < 64 && ssh_ciphertab[i].name != NULL; ++i) {
-        cmp = strcmp(wanted, ssh_ciphertab[i].name);
-        if (cmp == 0) {
-            break;
-        }
-    }
-
-    if (ssh_ciphertab[i].name == NULL) {
+    idx = crypt_cipher_index(wanted);
+    if (idx < 0) {
         ssh_set_error(session, SSH_FATAL,
                 "crypt_set_algorithms2: no crypto algorithm function found for %s",
                 wanted);
@@ -260,7 +283,7 @@ static int crypt_set_algorithms2(ssh_session session)
     }
     SSH_LOG(SSH_LOG_PACKET, "Set output algorithm to %s", wanted);
 
-    session->next_crypto->out_cipher = cipher_new(i);
+    session->next_crypto->out_cipher = cipher_new(idx);
     if (session->next_crypto->out_cipher == NULL) {
         ssh_set_error_oom(session);
         return SSH_ERROR;
@@ -283,14 +306,8 @@ static int crypt_set_algorithms2(ssh_session session)
         wanted = session->next_crypto->kex_methods[SSH_MAC_C_S];
     }
 
-    for (i = 0; ssh_hmactab[i].name != NULL; i++) {
-        cmp = strcmp(wanted, ssh_hmactab[i].name);
-        if (cmp == 0) {
-            break;
-        }
-    }
-
-    if (ssh_hmactab[i].name == NULL) {
+    idx = crypt_hmac_index(wanted);
+    if (idx < 0) {
         ssh_set_error(session, SSH_FATAL,
                 "crypt_set_algorithms2: no hmac algorithm function found for %s",
                 wanted);
@@ -298,20 +315,13 @@ static int crypt_set_algorithms2(ssh_session session)
     }
     SSH_LOG(SSH_LOG_PACKET, "Set HMAC output algorithm to %s", wanted);
 
-    session->next_crypto->out_hmac = ssh_hmactab[i].hmac_type;
-    session->next_crypto->out_hmac_etm = ssh_hmactab[i].etm;
+    session->next_crypto->out_hmac = ssh_hmactab[idx].hmac_type;
+    session->next_crypto->out_hmac_etm = ssh_hmactab[idx].etm;
 
     /* in */
     wanted = session->next_crypto->kex_methods[SSH_CRYPT_S_C];
-
-    for (i = 0; ssh_ciphertab[i].name != NULL; i++) {
-        cmp = strcmp(wanted, ssh_ciphertab[i].name);
-        if (cmp == 0) {
-            break;
-        }
-    }
-
-    if (ssh_ciphertab[i].name == NULL) {
+    idx = crypt_cipher_index(wanted);
+    if (idx < 0) {
         ssh_set_error(session, SSH_FATAL,
                 "Crypt_set_algorithms: no crypto algorithm function found for %s",
                 wanted);
@@ -319,7 +329,7 @@ static int crypt_set_algorithms2(ssh_session session)
     }
     SSH_LOG(SSH_LOG_PACKET, "Set input algorithm to %s", wanted);
 
-    session->next_crypto->in_cipher = cipher_new(i);
+    session->next_crypto->in_cipher = cipher_new(idx);
     if (session->next_crypto->in_cipher == NULL) {
         ssh_set_error_oom(session);
         return SSH_ERROR;
@@ -337,14 +347,8 @@ static int crypt_set_algorithms2(ssh_session session)
         wanted = session->next_crypto->kex_methods[SSH_MAC_S_C];
     }
 
-    for (i = 0; ssh_hmactab[i].name != NULL; i++) {
-        cmp = strcmp(wanted, ssh_hmactab[i].name);
-        if (cmp == 0) {
-            break;
-        }
-    }
-
-    if (ssh_hmactab[i].name == NULL) {
+    idx = crypt_hmac_index(wanted);
+    if (idx < 0) {
         ssh_set_error(session, SSH_FATAL,
                 "crypt_set_algorithms2: no hmac algorithm function found for %s",
                 wanted);
@@ -352,8 +356,8 @@ static int crypt_set_algorithms2(ssh_session session)
     }
     SSH_LOG(SSH_LOG_PACKET, "Set HMAC input algorithm to %s", wanted);
 
-    session->next_crypto->in_hmac = ssh_hmactab[i].hmac_type;
-    session->next_crypto->in_hmac_etm = ssh_hmactab[i].etm;
+    session->next_crypto->in_hmac = ssh_hmactab[idx].hmac_type;
+    session->next_crypto->in_hmac_etm = ssh_hmactab[idx].etm;
 
     /* compression */
     cmp = strcmp(session->next_crypto->kex_methods[SSH_COMP_C_S], "zlib");
@@ -384,10 +388,8 @@ int crypt_set_algorithms_client(ssh_session session)
 #ifdef WITH_SERVER
 int crypt_set_algorithms_server(ssh_session session){
     const char *method = NULL;
-    size_t i = 0;
-    struct ssh_cipher_struct *ssh_ciphertab=ssh_get_ciphertab();
     struct ssh_hmac_struct   *ssh_hmactab=ssh_get_hmactab();
-    int cmp;
+    int idx;
 
 
     if (session == NULL) {
@@ -400,22 +402,15 @@ int crypt_set_algorithms_server(ssh_session session){
      */
     /* out */
     method = session->next_crypto->kex_methods[SSH_CRYPT_S_C];
-
-    for (i = 0; ssh_ciphertab[i].name != NULL; i++) {
-        cmp = strcmp(method, ssh_ciphertab[i].name);
-        if (cmp == 0) {
-          break;
-        }
-    }
-
-    if (ssh_ciphertab[i].name == NULL) {
+    idx = crypt_cipher_index(method);
+    if (idx < 0) {
         ssh_set_error(session,SSH_FATAL,"crypt_set_algorithms_server : "
                 "no crypto algorithm function found for %s",method);
         return SSH_ERROR;
     }
     SSH_LOG(SSH_LOG_PACKET,"Set output algorithm %s",method);
 
-    session->next_crypto->out_cipher = cipher_new(i);
+    session->next_crypto->out_cipher = cipher_new(idx);
     if (session->next_crypto->out_cipher == NULL) {
         ssh_set_error_oom(session);
         return SSH_ERROR;
@@ -434,15 +429,8 @@ int crypt_set_algorithms_server(ssh_session session){
         method = session->next_crypto->kex_methods[SSH_MAC_S_C];
     }
     /* HMAC algorithm selection */
-
-    for (i = 0; ssh_hmactab[i].name != NULL; i++) {
-        cmp = strcmp(method, ssh_hmactab[i].name);
-        if (cmp == 0) {
-            break;
-        }
-    }
-
-    if (ssh_hmactab[i].name == NULL) {
+    idx = crypt_hmac_index(method);
+    if (idx < 0) {
       ssh_set_error(session, SSH_FATAL,
           "crypt_set_algorithms_server: no hmac algorithm function found for %s",
           method);
@@ -450,27 +438,20 @@ int crypt_set_algorithms_server(ssh_session session){
     }
     SSH_LOG(SSH_LOG_PACKET, "Set HMAC output algorithm to %s", method);
 
-    session->next_crypto->out_hmac = ssh_hmactab[i].hmac_type;
-    session->next_crypto->out_hmac_etm = ssh_hmactab[i].etm;
+    session->next_crypto->out_hmac = ssh_hmactab[idx].hmac_type;
+    session->next_crypto->out_hmac_etm = ssh_hmactab[idx].etm;
 
     /* in */
     method = session->next_crypto->kex_methods[SSH_CRYPT_C_S];
-
-    for (i = 0; ssh_ciphertab[i].name; i++) {
-        cmp = strcmp(method, ssh_ciphertab[i].name);
-        if (cmp == 0) {
-            break;
-        }
-    }
-
-    if (ssh_ciphertab[i].name == NULL) {
+    idx = crypt_cipher_index(method);
+    if (idx < 0) {
         ssh_set_error(session,SSH_FATAL,"Crypt_set_algorithms_server :"
                 "no crypto algorithm function found for %s",method);
         return SSH_ERROR;
     }
     SSH_LOG(SSH_LOG_PACKET,"Set input algorithm %s",method);
 
-    session->next_crypto->in_cipher = cipher_new(i);
+    session->next_crypto->in_cipher = cipher_new(idx);
     if (session->next_crypto->in_cipher == NULL) {
         ssh_set_error_oom(session);
         return SSH_ERROR;
@@ -488,14 +469,8 @@ int crypt_set_algorithms_server(ssh_session session){
         method = session->next_crypto->kex_methods[SSH_MAC_C_S];
     }
 
-    for (i = 0; ssh_hmactab[i].name != NULL; i++) {
-        cmp = strcmp(method, ssh_hmactab[i].name);
-        if (cmp == 0) {
-            break;
-        }
-    }
-
-    if (ssh_hmactab[i].name == NULL) {
+    idx = crypt_hmac_index(method);
+    if (idx < 0) {
       ssh_set_error(session, SSH_FATAL,
           "crypt_set_algorithms_server: no hmac algorithm function found for %s",
           method);
@@ -503,8 +478,8 @@ int crypt_set_algorithms_server(ssh_session session){
     }
     SSH_LOG(SSH_LOG_PACKET, "Set HMAC input algorithm to %s", method);
 
-    session->next_crypto->in_hmac = ssh_hmactab[i].hmac_type;
-    session->next_crypto->in_hmac_etm = ssh_hmactab[i].etm;
+    session->next_crypto->in_hmac = ssh_hmactab[idx].hmac_type;
+    session->next_crypto->in_hmac_etm = ssh_hmactab[idx].etm;
 
     /* compression */
     method = session->next_crypto->kex_methods[SSH_COMP_C_S];
@@ -0,0 +1,150 @@
+/*
+ * alloc_stats.c - allocation and copy accounting for the tests
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * The wrappers the linker substitutes for the allocator and memcpy() with
+ * -Wl,--wrap=<symbol>. The calls made by the tests themselves are counted
+ * too, so they only start counting around the operation they measure.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "alloc_stats.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+void *__real_memcpy(void *dest, const void *src, size_t n);
+void *__real___memcpy_chk(void *dest, const void *src, size_t n, size_t destlen);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+char *__wrap_strdup(const char *s);
+char *__wrap_strndup(const char *s, size_t n);
+void *__wrap_memcpy(void *dest, const void *src, size_t n);
+void *__wrap___memcpy_chk(void *dest, const void *src, size_t n, size_t destlen);
+
+static int counting;
+static struct alloc_stats current;
+
+void alloc_stats_start(void)
+{
+    memset(&current, 0, sizeof(current));
+    counting = 1;
+}
+
+void alloc_stats_stop(struct alloc_stats *stats)
+{
+    counting = 0;
+    *stats = current;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    if (counting) {
+        current.mallocs++;
+        current.bytes_allocated += size;
+    }
+
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    if (counting) {
+        current.mallocs++;
+        current.bytes_allocated += nmemb * size;
+    }
+
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (counting) {
+        if (ptr == NULL) {
+            current.mallocs++;
+        } else {
+            current.reallocs++;
+        }
+        current.bytes_allocated += size;
+    }
+
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (counting && ptr != NULL) {
+        current.frees++;
+    }
+
+    __real_free(ptr);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    if (counting) {
+        current.mallocs++;
+        current.bytes_allocated += strlen(s) + 1;
+    }
+
+    return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n)
+{
+    if (counting) {
+        current.mallocs++;
+        current.bytes_allocated += strnlen(s, n) + 1;
+    }
+
+    return __real_strndup(s, n);
+}
+
+void *__wrap_memcpy(void *dest, const void *src, size_t n)
+{
+    if (counting) {
+        current.memcpys++;
+        current.bytes_copied += n;
+    }
+
+    return __real_memcpy(dest, src, n);
+}
+
+/* what memcpy() becomes with _FORTIFY_SOURCE */
+void *__wrap___memcpy_chk(void *dest, const void *src, size_t n, size_t destlen)
+{
+    if (counting) {
+        current.memcpys++;
+        current.bytes_copied += n;
+    }
+
+    return __real___memcpy_chk(dest, src, n, destlen);
+}
@@ -0,0 +1,48 @@
+/*
+ * alloc_stats.h - allocation and copy accounting for the tests
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef _ALLOC_STATS_H
+#define _ALLOC_STATS_H
+
+#include <stdint.h>
+
+/*
+ * The counters of the allocator and memcpy() calls made between
+ * alloc_stats_start() and alloc_stats_stop(). The executable has to be
+ * linked with the wrappers, see tests/alloc/CMakeLists.txt, and only the
+ * calls made by the objects linked into it are seen: libssh itself, not the
+ * crypto library or the C library.
+ */
+struct alloc_stats {
+    uint64_t mallocs; /* malloc, calloc, strdup and strndup */
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes_allocated; /* the sizes requested, realloc included */
+    uint64_t memcpys;
+    uint64_t bytes_copied;
+};
+
+#define ALLOC_STATS_FIELDS 6
+
+void alloc_stats_start(void);
+void alloc_stats_stop(struct alloc_stats *stats);
+
+#endif /* _ALLOC_STATS_H */
@@ -0,0 +1,657 @@
+/*
+ * torture_alloc_stats.c - allocations and copies of the protocol operations
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Every test runs one client operation against a libssh server forked on the
+ * other end of a socketpair, counts the allocations and the copies the client
+ * side of libssh makes for it, and fails when a counter exceeds its limit in
+ * the thresholds file. The counters of all the operations are printed in the
+ * format of that file, and written to $ALLOC_STATS_REPORT when it is set.
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "alloc_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+#include <libssh/sftp.h>
+
+#define TRANSFER_SIZE (1024 * 1024)
+#define CHUNK_SIZE (32 * 1024)
+#define DIRECTORY_ENTRIES 10000
+#define NAMES_PER_REPLY 100
+
+#define SINK_COMMAND "alloc-stats-sink"
+#define SFTP_FILE "alloc-stats-file"
+
+enum alloc_operation {
+    OPERATION_HANDSHAKE,
+    OPERATION_AUTH,
+    OPERATION_CHANNEL_WRITE,
+    OPERATION_SFTP_READ,
+    OPERATION_SFTP_READDIR,
+    OPERATION_NUMBER
+};
+
+static const char *operation_names[OPERATION_NUMBER] = {
+    "handshake",
+    "auth",
+    "channel_write_1M",
+    "sftp_read_1M",
+    "sftp_readdir_10k",
+};
+
+struct alloc_limits {
+    /* UINT64_MAX for the counters without a limit */
+    uint64_t limit[ALLOC_STATS_FIELDS];
+};
+
+static struct alloc_limits thresholds[OPERATION_NUMBER];
+static struct alloc_stats results[OPERATION_NUMBER];
+static int measured[OPERATION_NUMBER];
+
+static ssh_key host_key;
+static ssh_key user_key;
+
+static char pattern[CHUNK_SIZE];
+
+struct torture_connection {
+    ssh_session session;
+    ssh_channel channel;
+    sftp_session sftp;
+    pid_t server;
+};
+
+static uint64_t *stats_field(struct alloc_stats *stats, int i)
+{
+    uint64_t *fields[ALLOC_STATS_FIELDS] = {
+        &stats->mallocs,
+        &stats->reallocs,
+        &stats->frees,
+        &stats->bytes_allocated,
+        &stats->memcpys,
+        &stats->bytes_copied,
+    };
+
+    return fields[i];
+}
+
+/*
+ * The thresholds file has a line per operation with the six counters in the
+ * order of struct alloc_stats, "-" for no limit. Lines starting with a '#'
+ * are comments.
+ */
+static int load_thresholds(const char *path)
+{
+    char line[512];
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < OPERATION_NUMBER; i++) {
+        memset(&thresholds[i], 0xff, sizeof(thresholds[i]));
+    }
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *saveptr = NULL;
+        char *tok;
+        int op;
+
+        tok = strtok_r(line, " \t\n", &saveptr);
+        if (tok == NULL || tok[0] == '#') {
+            continue;
+        }
+        for (op = 0; op < OPERATION_NUMBER; op++) {
+            if (strcmp(tok, operation_names[op]) == 0) {
+                break;
+            }
+        }
+        if (op == OPERATION_NUMBER) {
+            fprintf(stderr, "Unknown operation %s in %s\n", tok, path);
+            fclose(fp);
+            return -1;
+        }
+        for (i = 0; i < ALLOC_STATS_FIELDS; i++) {
+            tok = strtok_r(NULL, " \t\n", &saveptr);
+            if (tok == NULL) {
+                break;
+            }
+            if (strcmp(tok, "-") != 0) {
+                thresholds[op].limit[i] = strtoull(tok, NULL, 10);
+            }
+        }
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static void print_report(FILE *fp)
+{
+    int op;
+    int i;
+
+    fprintf(fp, "# %-18s %8s %8s %8s %12s %8s %12s\n",
+            "operation", "mallocs", "reallocs", "frees",
+            "bytes_alloc", "memcpys", "bytes_copied");
+    for (op = 0; op < OPERATION_NUMBER; op++) {
+        if (!measured[op]) {
+            continue;
+        }
+        fprintf(fp, "%-20s", operation_names[op]);
+        for (i = 0; i < ALLOC_STATS_FIELDS; i++) {
+            fprintf(fp, " %*" PRIu64,
+                    (i == 3 || i == 5) ? 12 : 8,
+                    *stats_field(&results[op], i));
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+static void check_thresholds(enum alloc_operation op, struct alloc_stats *stats)
+{
+    int failed = 0;
+    int i;
+
+    results[op] = *stats;
+    measured[op] = 1;
+
+    for (i = 0; i < ALLOC_STATS_FIELDS; i++) {
+        uint64_t value = *stats_field(stats, i);
+
+        if (value > thresholds[op].limit[i]) {
+            fprintf(stderr,
+                    "%s: counter %d is %" PRIu64 ", the limit is %" PRIu64 "\n",
+                    operation_names[op],
+                    i,
+                    value,
+                    thresholds[op].limit[i]);
+            failed = 1;
+        }
+    }
+    assert_false(failed);
+}
+
+/* The server side, in its own process */
+
+static void serve_sink(ssh_channel channel)
+{
+    char buf[CHUNK_SIZE];
+    int rc;
+
+    do {
+        rc = ssh_channel_read(channel, buf, sizeof(buf), 0);
+    } while (rc > 0);
+
+    ssh_channel_request_send_exit_status(channel, 0);
+    ssh_channel_send_eof(channel);
+    ssh_channel_close(channel);
+}
+
+static int serve_sftp_message(sftp_session sftp, sftp_client_message msg)
+{
+    static int file_handle;
+    static int dir_handle;
+    static int listed;
+    struct sftp_attributes_struct attr;
+    ssh_string handle = NULL;
+    char name[32];
+    void *h = NULL;
+    int rc;
+    int i;
+
+    switch (sftp_client_message_get_type(msg)) {
+    case SSH_FXP_OPEN:
+    case SSH_FXP_OPENDIR:
+        if (sftp_client_message_get_type(msg) == SSH_FXP_OPEN) {
+            h = &file_handle;
+        } else {
+            h = &dir_handle;
+            listed = 0;
+        }
+        handle = sftp_handle_alloc(sftp, h);
+        if (handle == NULL) {
+            return sftp_reply_status(msg, SSH_FX_FAILURE, NULL);
+        }
+        rc = sftp_reply_handle(msg, handle);
+        ssh_string_free(handle);
+        return rc;
+    case SSH_FXP_READ:
+        if (msg->offset >= TRANSFER_SIZE) {
+            return sftp_reply_status(msg, SSH_FX_EOF, NULL);
+        }
+        return sftp_reply_data(msg,
+                               pattern,
+                               msg->len < sizeof(pattern) ? msg->len : sizeof(pattern));
+    case SSH_FXP_READDIR:
+        if (listed >= DIRECTORY_ENTRIES) {
+            return sftp_reply_status(msg, SSH_FX_EOF, NULL);
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.flags = SSH_FILEXFER_ATTR_SIZE | SSH_FILEXFER_ATTR_PERMISSIONS;
+        attr.permissions = 0100644;
+        for (i = 0; i < NAMES_PER_REPLY && listed < DIRECTORY_ENTRIES; i++) {
+            snprintf(name, sizeof(name), "file-%05d", listed);
+            attr.size = listed;
+            rc = sftp_reply_names_add(msg, name, name, &attr);
+            if (rc < 0) {
+                return rc;
+            }
+            listed++;
+        }
+        return sftp_reply_names(msg);
+    case SSH_FXP_CLOSE:
+        h = sftp_handle(sftp, msg->handle);
+        if (h != NULL) {
+            sftp_handle_remove(sftp, h);
+        }
+        return sftp_reply_status(msg, SSH_FX_OK, NULL);
+    default:
+        return sftp_reply_status(msg, SSH_FX_OP_UNSUPPORTED, NULL);
+    }
+}
+
+static void serve_sftp(ssh_session session, ssh_channel channel)
+{
+    sftp_client_message msg;
+    sftp_session sftp;
+
+    sftp = sftp_server_new(session, channel);
+    if (sftp == NULL || sftp_server_init(sftp) < 0) {
+        sftp_free(sftp);
+        return;
+    }
+
+    while ((msg = sftp_get_client_message(sftp)) != NULL) {
+        serve_sftp_message(sftp, msg);
+        sftp_client_message_free(msg);
+    }
+
+    sftp_free(sftp);
+}
+
+static void serve_session(ssh_session session)
+{
+    ssh_channel channel;
+    ssh_message msg;
+    int type;
+    int subtype;
+
+    if (ssh_handle_key_exchange(session) != SSH_OK) {
+        return;
+    }
+
+    while ((msg = ssh_message_get(session)) != NULL) {
+        type = ssh_message_type(msg);
+        subtype = ssh_message_subtype(msg);
+
+        if (type == SSH_REQUEST_AUTH &&
+            subtype == SSH_AUTH_METHOD_PUBLICKEY &&
+            ssh_message_auth_publickey_state(msg) == SSH_PUBLICKEY_STATE_VALID) {
+            ssh_message_auth_reply_success(msg, 0);
+        } else if (type == SSH_REQUEST_AUTH) {
+            ssh_message_auth_set_methods(msg, SSH_AUTH_METHOD_PUBLICKEY);
+            ssh_message_reply_default(msg);
+        } else if (type == SSH_REQUEST_CHANNEL_OPEN &&
+                   subtype == SSH_CHANNEL_SESSION) {
+            if (ssh_message_channel_request_open_reply_accept(msg) == NULL) {
+                ssh_message_reply_default(msg);
+            }
+        } else if (type == SSH_REQUEST_CHANNEL &&
+                   subtype == SSH_CHANNEL_REQUEST_EXEC &&
+                   strcmp(ssh_message_channel_request_command(msg),
+                          SINK_COMMAND) == 0) {
+            channel = ssh_message_channel_request_channel(msg);
+            ssh_message_channel_request_reply_success(msg);
+            ssh_message_free(msg);
+            serve_sink(channel);
+            continue;
+        } else if (type == SSH_REQUEST_CHANNEL &&
+                   subtype == SSH_CHANNEL_REQUEST_SUBSYSTEM &&
+                   strcmp(ssh_message_channel_request_subsystem(msg),
+                          "sftp") == 0) {
+            channel = ssh_message_channel_request_channel(msg);
+            ssh_message_channel_request_reply_success(msg);
+            ssh_message_free(msg);
+            serve_sftp(session, channel);
+            continue;
+        } else {
+            ssh_message_reply_default(msg);
+        }
+        ssh_message_free(msg);
+    }
+}
+
+static pid_t start_server(int fd)
+{
+    ssh_session session;
+    ssh_bind sshbind;
+    pid_t pid;
+
+    pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    sshbind = ssh_bind_new();
+    session = ssh_new();
+    if (sshbind != NULL && session != NULL &&
+        ssh_bind_options_set(sshbind,
+                             SSH_BIND_OPTIONS_IMPORT_KEY,
+                             host_key) == SSH_OK &&
+        ssh_bind_accept_fd(sshbind, session, fd) == SSH_OK) {
+        serve_session(session);
+        ssh_disconnect(session);
+    }
+    _exit(0);
+}
+
+/* The client side */
+
+static int setup_connection(void **state)
+{
+    struct torture_connection *c = NULL;
+    bool process_config = false;
+    int sv[2];
+    int rc;
+
+    c = calloc(1, sizeof(struct torture_connection));
+    assert_non_null(c);
+
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert_int_equal(rc, 0);
+
+    c->server = start_server(sv[1]);
+    assert_true(c->server > 0);
+    close(sv[1]);
+
+    c->session = ssh_new();
+    assert_non_null(c->session);
+    ssh_options_set(c->session, SSH_OPTIONS_PROCESS_CONFIG, &process_config);
+    ssh_options_set(c->session, SSH_OPTIONS_HOST, "localhost");
+    ssh_options_set(c->session, SSH_OPTIONS_USER, "alice");
+    ssh_options_set(c->session, SSH_OPTIONS_FD, &sv[0]);
+
+    *state = c;
+
+    return 0;
+}
+
+static int teardown_connection(void **state)
+{
+    struct torture_connection *c = *state;
+
+    if (c->sftp != NULL) {
+        sftp_free(c->sftp);
+    }
+    if (c->channel != NULL) {
+        ssh_channel_free(c->channel);
+    }
+    ssh_disconnect(c->session);
+    ssh_free(c->session);
+
+    kill(c->server, SIGTERM);
+    waitpid(c->server, NULL, 0);
+    free(c);
+
+    return 0;
+}
+
+static void connect_and_auth(struct torture_connection *c)
+{
+    int rc;
+
+    rc = ssh_connect(c->session);
+    assert_ssh_return_code(c->session, rc);
+
+    rc = ssh_userauth_publickey(c->session, NULL, user_key);
+    assert_int_equal(rc, SSH_AUTH_SUCCESS);
+}
+
+static void torture_alloc_stats_handshake(void **state)
+{
+    struct torture_connection *c = *state;
+    struct alloc_stats stats;
+    int rc;
+
+    alloc_stats_start();
+    rc = ssh_connect(c->session);
+    alloc_stats_stop(&stats);
+    assert_ssh_return_code(c->session, rc);
+
+    check_thresholds(OPERATION_HANDSHAKE, &stats);
+}
+
+static void torture_alloc_stats_auth(void **state)
+{
+    struct torture_connection *c = *state;
+    struct alloc_stats stats;
+    int rc;
+
+    rc = ssh_connect(c->session);
+    assert_ssh_return_code(c->session, rc);
+
+    alloc_stats_start();
+    rc = ssh_userauth_publickey(c->session, NULL, user_key);
+    alloc_stats_stop(&stats);
+    assert_int_equal(rc, SSH_AUTH_SUCCESS);
+
+    check_thresholds(OPERATION_AUTH, &stats);
+}
+
+static void torture_alloc_stats_channel_write(void **state)
+{
+    struct torture_connection *c = *state;
+    struct alloc_stats stats;
+    size_t done = 0;
+    char buf[16];
+    int rc;
+
+    connect_and_auth(c);
+
+    c->channel = ssh_channel_new(c->session);
+    assert_non_null(c->channel);
+    rc = ssh_channel_open_session(c->channel);
+    assert_ssh_return_code(c->session, rc);
+    rc = ssh_channel_request_exec(c->channel, SINK_COMMAND);
+    assert_ssh_return_code(c->session, rc);
+
+    /* until the server has read everything */
+    alloc_stats_start();
+    while (done < TRANSFER_SIZE) {
+        rc = ssh_channel_write(c->channel, pattern, sizeof(pattern));
+        if (rc <= 0) {
+            break;
+        }
+        done += rc;
+    }
+    if (rc > 0) {
+        rc = ssh_channel_send_eof(c->channel);
+    }
+    while (rc >= 0 && !ssh_channel_is_eof(c->channel)) {
+        rc = ssh_channel_read(c->channel, buf, sizeof(buf), 0);
+    }
+    alloc_stats_stop(&stats);
+    assert_int_equal(done, TRANSFER_SIZE);
+
+    check_thresholds(OPERATION_CHANNEL_WRITE, &stats);
+}
+
+static void start_sftp(struct torture_connection *c)
+{
+    int rc;
+
+    connect_and_auth(c);
+
+    c->sftp = sftp_new(c->session);
+    assert_non_null(c->sftp);
+    rc = sftp_init(c->sftp);
+    assert_int_equal(rc, SSH_OK);
+}
+
+static void torture_alloc_stats_sftp_read(void **state)
+{
+    struct torture_connection *c = *state;
+    struct alloc_stats stats;
+    char buf[CHUNK_SIZE];
+    size_t done = 0;
+    sftp_file file;
+    ssize_t nread;
+
+    start_sftp(c);
+
+    alloc_stats_start();
+    file = sftp_open(c->sftp, SFTP_FILE, O_RDONLY, 0);
+    if (file != NULL) {
+        do {
+            nread = sftp_read(file, buf, sizeof(buf));
+            if (nread > 0) {
+                done += nread;
+            }
+        } while (nread > 0);
+        sftp_close(file);
+    }
+    alloc_stats_stop(&stats);
+    assert_non_null(file);
+    assert_int_equal(done, TRANSFER_SIZE);
+
+    check_thresholds(OPERATION_SFTP_READ, &stats);
+}
+
+static void torture_alloc_stats_sftp_readdir(void **state)
+{
+    struct torture_connection *c = *state;
+    struct alloc_stats stats;
+    sftp_attributes attr;
+    sftp_dir dir;
+    int entries = 0;
+
+    start_sftp(c);
+
+    alloc_stats_start();
+    dir = sftp_opendir(c->sftp, ".");
+    if (dir != NULL) {
+        while ((attr = sftp_readdir(c->sftp, dir)) != NULL) {
+            sftp_attributes_free(attr);
+            entries++;
+        }
+        sftp_closedir(dir);
+    }
+    alloc_stats_stop(&stats);
+    assert_non_null(dir);
+    assert_int_equal(entries, DIRECTORY_ENTRIES);
+
+    check_thresholds(OPERATION_SFTP_READDIR, &stats);
+}
+
+static int setup_keys(void **state)
+{
+    const char *path = getenv("ALLOC_STATS_THRESHOLDS");
+    int rc;
+
+    (void)state;
+
+    if (path == NULL) {
+        path = ALLOC_STATS_THRESHOLDS;
+    }
+    rc = load_thresholds(path);
+    assert_int_equal(rc, 0);
+
+    rc = ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &host_key);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &user_key);
+    assert_int_equal(rc, SSH_OK);
+
+    memset(pattern, 'A', sizeof(pattern));
+
+    return 0;
+}
+
+static int teardown_keys(void **state)
+{
+    const char *path = getenv("ALLOC_STATS_REPORT");
+    FILE *fp;
+
+    (void)state;
+
+    print_report(stdout);
+    if (path != NULL) {
+        fp = fopen(path, "w");
+        if (fp != NULL) {
+            print_report(fp);
+            fclose(fp);
+        }
+    }
+
+    ssh_key_free(host_key);
+    ssh_key_free(user_key);
+
+    return 0;
+}
+
+int torture_run_tests(void)
+{
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_alloc_stats_handshake,
+                                        setup_connection,
+                                        teardown_connection),
+        cmocka_unit_test_setup_teardown(torture_alloc_stats_auth,
+                                        setup_connection,
+                                        teardown_connection),
+        cmocka_unit_test_setup_teardown(torture_alloc_stats_channel_write,
+                                        setup_connection,
+                                        teardown_connection),
+        cmocka_unit_test_setup_teardown(torture_alloc_stats_sftp_read,
+                                        setup_connection,
+                                        teardown_connection),
+        cmocka_unit_test_setup_teardown(torture_alloc_stats_sftp_readdir,
+                                        setup_connection,
+                                        teardown_connection),
+    };
+
+    /* the connections go away with their server processes */
+    signal(SIGPIPE, SIG_IGN);
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, setup_keys, teardown_keys);
+    ssh_finalize();
+
+    return rc;
+}
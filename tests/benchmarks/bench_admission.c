@@ -0,0 +1,507 @@
+/* bench_admission.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Legitimate clients authenticating to a libssh server on the loopback while
+ * a flood of connections from another address runs key exchanges with it and
+ * drops them, to see what the admission control of ssh_bind leaves to the
+ * legitimate ones.
+ *
+ * The server serves every connection in a thread of its own process. The
+ * legitimate clients connect one after the other from 127.0.1.x, a different
+ * address each time, and authenticate with "none". The flooders connect from
+ * 127.0.0.2, send a canned key exchange which costs the server an X25519 and
+ * a signature but nothing to them, and disconnect once it was answered. They
+ * run niced, the way a flood from other hosts would not take the CPU of this
+ * one. Three phases are run: without the flood, with the flood, then with
+ * the flood and the limits set on the bind.
+ *
+ * usage: bench_admission [seconds per phase] [flooders] [max startups]
+ *                        [source limit]
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#define DEFAULT_SECONDS 5
+#define DEFAULT_FLOODERS 8
+#define DEFAULT_MAX_STARTUPS "10:30:60"
+#define DEFAULT_SOURCE_LIMIT "5:10"
+
+#define FLOOD_ADDRESS "127.0.0.2"
+
+struct flood_counts {
+    unsigned long connections;
+    unsigned long exchanges;
+};
+
+struct phase {
+    const char *name;
+    int flood;
+    int limits;
+};
+
+static const struct phase phases[] = {
+    { "no flood", 0, 0 },
+    { "flood", 1, 0 },
+    { "flood, admission control", 1, 1 },
+};
+
+static double seconds;
+static int flooders;
+static const char *max_startups;
+static const char *source_limit;
+static unsigned int port;
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void *serve(void *arg)
+{
+    ssh_session session = arg;
+    ssh_message msg;
+
+    if (ssh_handle_key_exchange(session) == SSH_OK) {
+        while ((msg = ssh_message_get(session)) != NULL) {
+            if (ssh_message_type(msg) == SSH_REQUEST_AUTH) {
+                ssh_message_auth_reply_success(msg, 0);
+            } else {
+                ssh_message_reply_default(msg);
+            }
+            ssh_message_free(msg);
+        }
+    }
+    ssh_disconnect(session);
+    ssh_free(session);
+
+    return NULL;
+}
+
+static void server_loop(ssh_bind sshbind)
+{
+    ssh_session session;
+    pthread_t thread;
+    int rc;
+
+    for (;;) {
+        session = ssh_new();
+        if (session == NULL) {
+            break;
+        }
+        rc = ssh_bind_accept(sshbind, session);
+        if (rc != SSH_OK) {
+            ssh_free(session);
+            if (ssh_get_error_code(sshbind) == SSH_REQUEST_DENIED) {
+                continue;
+            }
+            fprintf(stderr, "Accepting: %s\n", ssh_get_error(sshbind));
+            break;
+        }
+        if (pthread_create(&thread, NULL, serve, session) != 0) {
+            ssh_free(session);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+/* listens on an ephemeral port of the loopback, serving from a child */
+static pid_t server_start(int limits)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    unsigned int any = 0;
+    ssh_bind sshbind;
+    ssh_key key = NULL;
+    pid_t pid;
+
+    sshbind = ssh_bind_new();
+    if (sshbind == NULL ||
+        ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &key) != SSH_OK ||
+        ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_IMPORT_KEY, key) < 0 ||
+        ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDADDR,
+                             "127.0.0.1") < 0 ||
+        ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDPORT, &any) < 0) {
+        fprintf(stderr, "Could not set up the server\n");
+        return -1;
+    }
+    if (limits &&
+        (ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_MAX_STARTUPS,
+                              max_startups) < 0 ||
+         ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_SOURCE_LIMIT,
+                              source_limit) < 0)) {
+        fprintf(stderr, "Setting the limits: %s\n", ssh_get_error(sshbind));
+        ssh_bind_free(sshbind);
+        return -1;
+    }
+    if (ssh_bind_listen(sshbind) != SSH_OK ||
+        getsockname(ssh_bind_get_fd(sshbind),
+                    (struct sockaddr *)&addr, &addrlen) < 0) {
+        fprintf(stderr, "Listening: %s\n", ssh_get_error(sshbind));
+        ssh_bind_free(sshbind);
+        return -1;
+    }
+    port = ntohs(addr.sin_port);
+
+    pid = fork();
+    if (pid == 0) {
+        server_loop(sshbind);
+        _exit(1);
+    }
+    ssh_bind_free(sshbind);
+
+    return pid;
+}
+
+static ssh_session client_new(const char *bindaddr)
+{
+    ssh_session session;
+    int verbosity = SSH_LOG_NOLOG;
+
+    session = ssh_new();
+    if (session == NULL) {
+        return NULL;
+    }
+    if (ssh_options_set(session, SSH_OPTIONS_HOST, "127.0.0.1") < 0 ||
+        ssh_options_set(session, SSH_OPTIONS_PORT, &port) < 0 ||
+        ssh_options_set(session, SSH_OPTIONS_BINDADDR, bindaddr) < 0 ||
+        ssh_options_set(session, SSH_OPTIONS_USER, "bench") < 0 ||
+        ssh_options_set(session, SSH_OPTIONS_LOG_VERBOSITY, &verbosity) < 0) {
+        ssh_free(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+/* appends a binary packet without encryption nor MAC */
+static size_t put_packet(unsigned char *buf, const unsigned char *payload,
+                         size_t len)
+{
+    size_t padding = 8 - (len + 5) % 8;
+    size_t total;
+
+    if (padding < 4) {
+        padding += 8;
+    }
+    total = 1 + len + padding;
+    buf[0] = total >> 24;
+    buf[1] = total >> 16;
+    buf[2] = total >> 8;
+    buf[3] = total;
+    buf[4] = padding;
+    memcpy(buf + 5, payload, len);
+    memset(buf + 5 + len, 0, padding);
+
+    return 4 + total;
+}
+
+static size_t put_string(unsigned char *buf, const char *s)
+{
+    size_t len = strlen(s);
+
+    buf[0] = buf[1] = buf[2] = 0;
+    buf[3] = len;
+    memcpy(buf + 4, s, len);
+
+    return 4 + len;
+}
+
+/*
+ * The opening of a flooder: its banner, a KEXINIT, and the ECDH_INIT with
+ * an arbitrary public key, which the server answers with an X25519 and a
+ * signature of its host key. Nothing needs to be computed on this side.
+ */
+static size_t flood_request(unsigned char *buf)
+{
+    static const char *lists[] = {
+        "curve25519-sha256", "ssh-ed25519",
+        "aes128-ctr", "aes128-ctr",
+        "hmac-sha2-256", "hmac-sha2-256",
+        "none", "none", "", "",
+    };
+    unsigned char payload[512];
+    size_t len = 0, n;
+    size_t i;
+
+    n = strlen("SSH-2.0-flood\r\n");
+    memcpy(buf, "SSH-2.0-flood\r\n", n);
+
+    payload[len++] = 20;
+    memset(payload + len, 0x42, 16);
+    len += 16;
+    for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        len += put_string(payload + len, lists[i]);
+    }
+    memset(payload + len, 0, 5);
+    len += 5;
+    n += put_packet(buf + n, payload, len);
+
+    len = 0;
+    payload[len++] = 30;
+    payload[len++] = 0;
+    payload[len++] = 0;
+    payload[len++] = 0;
+    payload[len++] = 32;
+    memset(payload + len, 0x09, 32);
+    len += 32;
+    n += put_packet(buf + n, payload, len);
+
+    return n;
+}
+
+/* returns 1 once the ECDH_REPLY of the server was read, 0 otherwise */
+static int flood_reply(int fd)
+{
+    unsigned char buf[8192];
+    size_t len = 0, off = 0;
+    unsigned char *eol;
+    ssize_t r;
+
+    for (;;) {
+        r = recv(fd, buf + len, sizeof(buf) - len, 0);
+        if (r <= 0) {
+            return 0;
+        }
+        len += r;
+        if (off == 0) {
+            eol = memchr(buf, '\n', len);
+            if (eol == NULL) {
+                continue;
+            }
+            off = eol + 1 - buf;
+        }
+        while (off + 6 <= len) {
+            size_t total = 4 + ((size_t)buf[off] << 24 |
+                                (size_t)buf[off + 1] << 16 |
+                                (size_t)buf[off + 2] << 8 |
+                                buf[off + 3]);
+
+            if (buf[off + 5] == 31) {
+                return 1;
+            }
+            if (off + total > len) {
+                break;
+            }
+            off += total;
+        }
+        if (len == sizeof(buf)) {
+            return 0;
+        }
+    }
+}
+
+static void *flood(void *arg)
+{
+    struct flood_counts *counts = arg;
+    double end = now() + seconds;
+    struct sockaddr_in local, server;
+    struct timeval timeout = { 2, 0 };
+    unsigned char request[1024];
+    size_t len;
+    int fd;
+
+    len = flood_request(request);
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    inet_pton(AF_INET, FLOOD_ADDRESS, &local.sin_addr);
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(port);
+
+    while (now() < end) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            break;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        counts->connections++;
+        if (bind(fd, (struct sockaddr *)&local, sizeof(local)) == 0 &&
+            connect(fd, (struct sockaddr *)&server, sizeof(server)) == 0 &&
+            send(fd, request, len, MSG_NOSIGNAL) == (ssize_t)len &&
+            flood_reply(fd)) {
+            counts->exchanges++;
+        }
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/* runs the flooders in a child, their counts come back through fd */
+static pid_t flood_start(int fd)
+{
+    struct flood_counts *counts;
+    struct flood_counts total = { 0, 0 };
+    pthread_t *threads;
+    pid_t pid;
+    int i;
+
+    pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    /* the flood would come from elsewhere, it only gets the idle time */
+    if (nice(10) < 0) {
+        _exit(1);
+    }
+
+    counts = calloc(flooders, sizeof(struct flood_counts));
+    threads = calloc(flooders, sizeof(pthread_t));
+    if (counts == NULL || threads == NULL) {
+        _exit(1);
+    }
+    for (i = 0; i < flooders; i++) {
+        if (pthread_create(&threads[i], NULL, flood, &counts[i]) != 0) {
+            _exit(1);
+        }
+    }
+    for (i = 0; i < flooders; i++) {
+        pthread_join(threads[i], NULL);
+        total.connections += counts[i].connections;
+        total.exchanges += counts[i].exchanges;
+    }
+    if (write(fd, &total, sizeof(total)) != sizeof(total)) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+static int run_phase(const struct phase *phase)
+{
+    struct flood_counts counts = { 0, 0 };
+    unsigned long handshakes = 0;
+    unsigned long refused = 0;
+    char bindaddr[16];
+    double start, elapsed;
+    ssh_session session;
+    pid_t server, flooder = -1;
+    int pipefd[2];
+    int rc;
+
+    server = server_start(phase->limits);
+    if (server < 0) {
+        return -1;
+    }
+    if (phase->flood) {
+        if (pipe(pipefd) < 0) {
+            kill(server, SIGKILL);
+            waitpid(server, NULL, 0);
+            return -1;
+        }
+        flooder = flood_start(pipefd[1]);
+        close(pipefd[1]);
+        /* let the flood build up first */
+        usleep(200 * 1000);
+    }
+
+    start = now();
+    while ((elapsed = now() - start) < seconds) {
+        snprintf(bindaddr, sizeof(bindaddr), "127.0.1.%lu",
+                 1 + (handshakes + refused) % 254);
+        session = client_new(bindaddr);
+        if (session == NULL) {
+            break;
+        }
+        rc = ssh_connect(session);
+        if (rc == SSH_OK) {
+            rc = ssh_userauth_none(session, NULL);
+        }
+        if (rc == SSH_AUTH_SUCCESS) {
+            handshakes++;
+        } else {
+            refused++;
+        }
+        ssh_disconnect(session);
+        ssh_free(session);
+    }
+
+    if (flooder > 0) {
+        if (read(pipefd[0], &counts, sizeof(counts)) != sizeof(counts)) {
+            memset(&counts, 0, sizeof(counts));
+        }
+        close(pipefd[0]);
+        waitpid(flooder, NULL, 0);
+    }
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+
+    printf("%-26s %8.1f handshakes/s %6lu failed", phase->name,
+           handshakes / elapsed, refused);
+    if (phase->flood) {
+        printf("   flood: %8.1f connections/s %8.1f key exchanges/s",
+               counts.connections / elapsed, counts.exchanges / elapsed);
+    }
+    printf("\n");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    seconds = argc > 1 ? strtod(argv[1], NULL) : DEFAULT_SECONDS;
+    flooders = argc > 2 ? atoi(argv[2]) : DEFAULT_FLOODERS;
+    max_startups = argc > 3 ? argv[3] : DEFAULT_MAX_STARTUPS;
+    source_limit = argc > 4 ? argv[4] : DEFAULT_SOURCE_LIMIT;
+    if (seconds <= 0 || flooders <= 0) {
+        fprintf(stderr, "usage: %s [seconds per phase] [flooders] "
+                        "[max startups] [source limit]\n", argv[0]);
+        return 1;
+    }
+
+    ssh_init();
+    printf("%d flooders from %s, max startups %s, source limit %s\n",
+           flooders, FLOOD_ADDRESS, max_startups, source_limit);
+    for (i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+        if (run_phase(&phases[i]) < 0) {
+            ssh_finalize();
+            return 1;
+        }
+    }
+    ssh_finalize();
+
+    return 0;
+}
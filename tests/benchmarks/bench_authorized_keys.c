@@ -0,0 +1,241 @@
+/* bench_authorized_keys.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Write an authorized_keys file of ed25519 keys, then time loading it into
+ * an ssh_authorized_keys store, looking keys up in the store, and the scan
+ * of the whole file that imports every line and compares it with the key.
+ *
+ * usage: bench_authorized_keys [lines] [lookups]
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "libssh/priv.h"
+#include "libssh/server.h"
+#include "libssh/buffer.h"
+
+#define DEFAULT_LINES 100000
+#define DEFAULT_LOOKUPS 100000
+#define SCAN_LOOKUPS 10
+#define LINE_SIZE 2048
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* The base64 of an ed25519 public key blob of 32 random bytes */
+static char *random_ed25519(void)
+{
+    unsigned char blob[51] = {
+        0, 0, 0, 11, 's', 's', 'h', '-', 'e', 'd', '2', '5', '5', '1', '9',
+        0, 0, 0, 32,
+    };
+    size_t i;
+
+    for (i = 19; i < sizeof(blob); i++) {
+        blob[i] = (unsigned char)rand();
+    }
+
+    return (char *)bin_to_base64(blob, sizeof(blob));
+}
+
+static ssh_key import_ed25519(const char *b64)
+{
+    ssh_key key = NULL;
+    int rc;
+
+    rc = ssh_pki_import_pubkey_base64(b64, SSH_KEYTYPE_ED25519, &key);
+    if (rc != SSH_OK) {
+        return NULL;
+    }
+
+    return key;
+}
+
+/* The naive way: import every line of the file and compare it to the key */
+static int scan_file(const char *path, const ssh_key key)
+{
+    char line[LINE_SIZE];
+    ssh_key entry = NULL;
+    int found = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    while (!found && fgets(line, sizeof(line), fp) != NULL) {
+        char *b64 = strchr(line, ' ');
+
+        if (b64 == NULL) {
+            continue;
+        }
+        b64++;
+        b64[strcspn(b64, " \n")] = '\0';
+
+        entry = import_ed25519(b64);
+        if (entry == NULL) {
+            continue;
+        }
+        found = ssh_key_cmp(entry, key, SSH_KEY_CMP_PUBLIC) == 0;
+        ssh_key_free(entry);
+    }
+    fclose(fp);
+
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long lines = DEFAULT_LINES;
+    unsigned long lookups = DEFAULT_LOOKUPS;
+    char path[] = "/tmp/bench_authorized_keys_XXXXXX";
+    ssh_authorized_keys keys = NULL;
+    ssh_key hit = NULL;
+    ssh_key miss = NULL;
+    char *b64 = NULL;
+    unsigned long l;
+    unsigned long found;
+    double start;
+    double elapsed;
+    FILE *fp = NULL;
+    int fd = -1;
+    int rc = 1;
+
+    if (argc > 1) {
+        lines = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        lookups = strtoul(argv[2], NULL, 10);
+    }
+    if (lines == 0 || lookups == 0) {
+        fprintf(stderr, "usage: %s [lines] [lookups]\n", argv[0]);
+        return 1;
+    }
+
+    ssh_init();
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        goto out;
+    }
+    fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        unlink(path);
+        goto out;
+    }
+    for (l = 0; l < lines; l++) {
+        b64 = random_ed25519();
+        if (b64 == NULL) {
+            fclose(fp);
+            unlink(path);
+            goto out;
+        }
+        /* the last key of the file is the one that is looked up */
+        if (l == lines - 1) {
+            hit = import_ed25519(b64);
+        }
+        fprintf(fp, "ssh-ed25519 %s user%lu@bench\n", b64, l);
+        SAFE_FREE(b64);
+    }
+    fclose(fp);
+
+    b64 = random_ed25519();
+    if (b64 != NULL) {
+        miss = import_ed25519(b64);
+        SAFE_FREE(b64);
+    }
+    if (hit == NULL || miss == NULL) {
+        unlink(path);
+        goto out;
+    }
+
+    keys = ssh_authorized_keys_new();
+    if (keys == NULL) {
+        unlink(path);
+        goto out;
+    }
+    start = now();
+    if (ssh_authorized_keys_load_file(keys, path) != SSH_OK) {
+        unlink(path);
+        goto out;
+    }
+    elapsed = now() - start;
+    printf("%-24s %8u keys  %8.3f s %10.0f lines/s\n",
+           "load",
+           ssh_authorized_keys_count(keys),
+           elapsed,
+           lines / elapsed);
+
+    found = 0;
+    start = now();
+    for (l = 0; l < lookups; l++) {
+        found += ssh_authorized_keys_match(keys, l % 2 ? miss : hit, NULL);
+    }
+    elapsed = now() - start;
+    printf("%-24s %8lu found %8.3f s %10.0f lookups/s\n",
+           "indexed lookup",
+           found,
+           elapsed,
+           lookups / elapsed);
+
+    found = 0;
+    start = now();
+    for (l = 0; l < SCAN_LOOKUPS; l++) {
+        rc = scan_file(path, l % 2 ? miss : hit);
+        if (rc < 0) {
+            rc = 1;
+            unlink(path);
+            goto out;
+        }
+        found += rc;
+    }
+    elapsed = now() - start;
+    printf("%-24s %8lu found %8.3f s %10.1f lookups/s\n",
+           "file scan",
+           found,
+           elapsed,
+           SCAN_LOOKUPS / elapsed);
+    unlink(path);
+
+    rc = 0;
+out:
+    ssh_authorized_keys_free(keys);
+    ssh_key_free(hit);
+    ssh_key_free(miss);
+    ssh_finalize();
+
+    return rc;
+}
@@ -0,0 +1,96 @@
+/* bench_bcrypt_pbkdf.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Time the key derivation of encrypted OpenSSH private keys, as done when
+ * loading an aes256-ctr protected key (48 bytes of key material) with the
+ * usual numbers of rounds.
+ *
+ * usage: bench_bcrypt_pbkdf [runs]
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "libssh/priv.h"
+#include "libssh/pki_priv.h"
+
+#define DEFAULT_RUNS 10
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int rounds[] = { 16, 32, 64 };
+    static const uint8_t salt[16] = "0123456789abcdef";
+    uint8_t key[48];
+    int runs = DEFAULT_RUNS;
+    double start;
+    double elapsed;
+    size_t i;
+    int r;
+    int rc;
+
+    if (argc > 1) {
+        runs = atoi(argv[1]);
+        if (runs < 1) {
+            runs = 1;
+        }
+    }
+
+    ssh_init();
+
+    for (i = 0; i < sizeof(rounds) / sizeof(rounds[0]); i++) {
+        start = now();
+        for (r = 0; r < runs; r++) {
+            rc = bcrypt_pbkdf("passphrase", 10,
+                              salt, sizeof(salt),
+                              key, sizeof(key),
+                              rounds[i]);
+            if (rc < 0) {
+                fprintf(stderr, "bcrypt_pbkdf failed\n");
+                ssh_finalize();
+                return 1;
+            }
+        }
+        elapsed = now() - start;
+
+        printf("bcrypt_pbkdf %2u rounds %3zu bytes %8.1f ms\n",
+               rounds[i],
+               sizeof(key),
+               elapsed * 1000 / runs);
+    }
+
+    ssh_finalize();
+
+    return 0;
+}
@@ -0,0 +1,283 @@
+/* bench_cert_verifier.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Issue user certificates with ed25519, ecdsa and RSA authorities, then
+ * time verifying the same certificate over and over with and without the
+ * cache of the verifier, as repeated logins of a user do.
+ *
+ * usage: bench_cert_verifier [checks]
+ *
+ * The cached checks are CACHED_RATIO times the verified ones.
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "libssh/priv.h"
+#include "libssh/server.h"
+#include "libssh/buffer.h"
+#include "libssh/pki.h"
+#include "libssh/pki_priv.h"
+#include "libssh/wrapper.h"
+
+#define DEFAULT_CHECKS 200
+/* the cached checks are that many times more */
+#define CACHED_RATIO 100
+#define CACHE_SIZE 1024
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* A user certificate for the key, valid for an hour */
+static ssh_key issue_cert(const ssh_key ca, const ssh_key user)
+{
+    ssh_buffer cert = NULL;
+    ssh_string user_blob = NULL;
+    ssh_string ca_blob = NULL;
+    ssh_string sig_blob = NULL;
+    ssh_string cert_blob = NULL;
+    ssh_signature sig = NULL;
+    ssh_key key = NULL;
+    uint64_t t = (uint64_t)time(NULL);
+    /* the principal list of "bench", as a string of strings */
+    const char principals[] = "\0\0\0\x05" "bench";
+    unsigned char hash[EVP_DIGEST_LEN];
+    unsigned int hlen = 0;
+    int rc;
+
+    cert = ssh_buffer_new();
+    if (cert == NULL ||
+        ssh_pki_export_pubkey_blob(user, &user_blob) < 0 ||
+        ssh_pki_export_pubkey_blob(ca, &ca_blob) < 0) {
+        goto out;
+    }
+
+    /* the fields of the RSA key follow the "ssh-rsa" of its blob */
+    rc = ssh_buffer_pack(cert,
+                         "ssPqdsdPqqsssS",
+                         "ssh-rsa-cert-v01@openssh.com",
+                         "nonce",
+                         (size_t)ssh_string_len(user_blob) - 11,
+                         (char *)ssh_string_data(user_blob) + 11,
+                         (uint64_t)1,
+                         (uint32_t)1,
+                         "bench",
+                         (uint32_t)(sizeof(principals) - 1),
+                         sizeof(principals) - 1,
+                         principals,
+                         t - 60,
+                         t + 3600,
+                         "",
+                         "",
+                         "",
+                         ca_blob);
+    if (rc != SSH_OK) {
+        goto out;
+    }
+
+    /* but for ed25519, the keys sign a hash of the data */
+    switch (ca->type) {
+    case SSH_KEYTYPE_ECDSA:
+        evp(ca->ecdsa_nid,
+            ssh_buffer_get(cert),
+            ssh_buffer_get_len(cert),
+            hash,
+            &hlen);
+        sig = pki_do_sign(ca, hash, hlen);
+        break;
+    case SSH_KEYTYPE_RSA:
+        sha1(ssh_buffer_get(cert), ssh_buffer_get_len(cert), hash);
+        sig = pki_do_sign(ca, hash, SHA_DIGEST_LEN);
+        break;
+    default:
+        sig = pki_do_sign(ca, ssh_buffer_get(cert), ssh_buffer_get_len(cert));
+        break;
+    }
+    if (sig == NULL ||
+        ssh_pki_export_signature_blob(sig, &sig_blob) < 0 ||
+        ssh_buffer_pack(cert, "S", sig_blob) != SSH_OK) {
+        goto out;
+    }
+
+    cert_blob = ssh_string_new(ssh_buffer_get_len(cert));
+    if (cert_blob == NULL) {
+        goto out;
+    }
+    ssh_string_fill(cert_blob, ssh_buffer_get(cert), ssh_buffer_get_len(cert));
+    ssh_pki_import_cert_blob(cert_blob, &key);
+
+out:
+    ssh_string_free(cert_blob);
+    ssh_string_free(sig_blob);
+    ssh_signature_free(sig);
+    ssh_string_free(ca_blob);
+    ssh_string_free(user_blob);
+    ssh_buffer_free(cert);
+
+    return key;
+}
+
+static int bench_checks(ssh_session session,
+                        ssh_authorized_keys cas,
+                        const ssh_key cert,
+                        unsigned int cache_size,
+                        unsigned long checks,
+                        const char *label)
+{
+    ssh_cert_verifier verifier;
+    unsigned long valid = 0;
+    unsigned long i;
+    double start;
+    double elapsed;
+
+    verifier = ssh_cert_verifier_new(cas, cache_size);
+    if (verifier == NULL) {
+        return -1;
+    }
+
+    start = now();
+    for (i = 0; i < checks; i++) {
+        if (ssh_cert_verifier_check(verifier, session, cert, "bench") == 1) {
+            valid++;
+        }
+    }
+    elapsed = now() - start;
+    ssh_cert_verifier_free(verifier);
+
+    printf("%-24s %8lu valid %8.3f s %10.0f checks/s\n",
+           label,
+           valid,
+           elapsed,
+           checks / elapsed);
+
+    return valid == checks ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    struct {
+        enum ssh_keytypes_e type;
+        int parameter;
+        const char *name;
+    } authorities[] = {
+        { SSH_KEYTYPE_ED25519, 0, "ed25519" },
+        { SSH_KEYTYPE_ECDSA, 256, "ecdsa" },
+        { SSH_KEYTYPE_RSA, 3072, "rsa" },
+    };
+    size_t nauthorities = sizeof(authorities) / sizeof(authorities[0]);
+    unsigned long checks = DEFAULT_CHECKS;
+    char path[] = "/tmp/bench_cert_verifier_XXXXXX";
+    char label[64];
+    ssh_session session = NULL;
+    ssh_key user = NULL;
+    size_t i;
+    int rc = 1;
+
+    if (argc > 1) {
+        checks = strtoul(argv[1], NULL, 10);
+    }
+    if (checks == 0) {
+        fprintf(stderr, "usage: %s [checks]\n", argv[0]);
+        return 1;
+    }
+
+    ssh_init();
+    session = ssh_new();
+    if (session == NULL ||
+        ssh_pki_generate(SSH_KEYTYPE_RSA, 2048, &user) < 0) {
+        goto out;
+    }
+
+    for (i = 0; i < nauthorities; i++) {
+        ssh_authorized_keys cas = NULL;
+        ssh_key ca = NULL;
+        ssh_key cert = NULL;
+        char *b64 = NULL;
+        FILE *fp = NULL;
+        int fd;
+
+        if (ssh_pki_generate(authorities[i].type,
+                             authorities[i].parameter,
+                             &ca) < 0 ||
+            ssh_pki_export_pubkey_base64(ca, &b64) < 0) {
+            ssh_key_free(ca);
+            goto out;
+        }
+        fd = mkstemp(path);
+        if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+            SAFE_FREE(b64);
+            ssh_key_free(ca);
+            goto out;
+        }
+        fprintf(fp, "%s %s\n", ca->type_c, b64);
+        fclose(fp);
+        SAFE_FREE(b64);
+
+        cas = ssh_authorized_keys_new();
+        cert = issue_cert(ca, user);
+        rc = cas == NULL || cert == NULL ||
+             ssh_authorized_keys_load_file(cas, path) != SSH_OK;
+
+        /* the file is kept for the reloads of the store */
+        if (rc == 0) {
+            snprintf(label, sizeof(label), "%s CA, verified",
+                     authorities[i].name);
+            rc = bench_checks(session, cas, cert, 0, checks, label) < 0;
+        }
+        if (rc == 0) {
+            snprintf(label, sizeof(label), "%s CA, cached",
+                     authorities[i].name);
+            rc = bench_checks(session, cas, cert, CACHE_SIZE,
+                              checks * CACHED_RATIO, label) < 0;
+        }
+        unlink(path);
+        strcpy(path, "/tmp/bench_cert_verifier_XXXXXX");
+        ssh_key_free(cert);
+        ssh_authorized_keys_free(cas);
+        ssh_key_free(ca);
+        if (rc != 0) {
+            fprintf(stderr, "Failed to verify the certificates\n");
+            rc = 1;
+            goto out;
+        }
+    }
+
+    rc = 0;
+out:
+    ssh_key_free(user);
+    ssh_free(session);
+    ssh_finalize();
+
+    return rc;
+}
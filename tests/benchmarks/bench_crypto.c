@@ -0,0 +1,383 @@
+/* bench_crypto.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Run every entry of the cipher and MAC tables of the crypto backend the
+ * library was built with over packets of 64 bytes to 256 KiB, the way the
+ * packet layer calls them, and report packets per second, MB/s and cycles
+ * per byte. The cycles are read from the time stamp counter on x86 and are
+ * not reported on the other architectures.
+ *
+ * usage: bench_crypto [seconds per run] [algorithm]
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#include "libssh/priv.h"
+#include "libssh/crypto.h"
+#include "libssh/wrapper.h"
+
+#define DEFAULT_SECONDS 0.25
+
+/* the packets of one batch, so that decryption gets fresh ciphertexts */
+#define BATCH_BYTES (1024 * 1024)
+
+static const size_t packet_sizes[] = {
+    64, 256, 1024, 4096, 16384, 32768, 65536, 262144,
+};
+
+struct measure {
+    unsigned long packets;
+    double seconds;
+    uint64_t cycles;
+};
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void report(const char *name,
+                   const char *op,
+                   size_t size,
+                   struct measure *m)
+{
+    double bytes = (double)m->packets * size;
+
+    printf("%-34s %-8s %7zu B %11.0f pkt/s %9.1f MB/s",
+           name,
+           op,
+           size,
+           m->packets / m->seconds,
+           bytes / m->seconds / 1000000.0);
+#ifdef HAVE_CYCLES
+    printf(" %8.2f cycles/B\n", m->cycles / bytes);
+#else
+    printf("\n");
+#endif
+}
+
+static int get_cipher(struct ssh_cipher_struct *cipher,
+                      const struct ssh_cipher_struct *entry,
+                      int encrypt)
+{
+    uint8_t key[64];
+    uint8_t iv[32];
+    int rc;
+
+    memset(key, 0x42, sizeof(key));
+    memset(iv, 0x24, sizeof(iv));
+    memcpy(cipher, entry, sizeof(*cipher));
+
+    if (encrypt) {
+        rc = cipher->set_encrypt_key(cipher, key, iv);
+    } else {
+        rc = cipher->set_decrypt_key(cipher, key, iv);
+    }
+    if (rc < 0) {
+        ssh_cipher_clear(cipher);
+    }
+
+    return rc;
+}
+
+/*
+ * One batch of packets through both directions. The layout of the buffers is
+ * the one of the packet layer: the length field is part of the encrypted
+ * packet, the AEAD ciphers authenticate it without encrypting it, and their
+ * tag follows the ciphertext.
+ */
+static int run_batch(struct ssh_cipher_struct *out_cipher,
+                     struct ssh_cipher_struct *in_cipher,
+                     uint8_t *plain,
+                     uint8_t *packets,
+                     uint8_t *out,
+                     size_t size,
+                     size_t count,
+                     uint64_t *seq,
+                     struct measure *enc,
+                     struct measure *dec)
+{
+    size_t stride = size + out_cipher->tag_size;
+    uint8_t length[sizeof(uint32_t)];
+    uint64_t first_seq = *seq;
+    uint64_t c;
+    double start;
+    size_t i;
+    int rc;
+
+    start = now();
+    c = cycles();
+    for (i = 0; i < count; i++) {
+        uint8_t *packet = packets + i * stride;
+
+        if (out_cipher->aead_encrypt != NULL) {
+            out_cipher->aead_encrypt(out_cipher, plain, packet, size,
+                                     packet + size, *seq);
+        } else {
+            out_cipher->encrypt(out_cipher, plain, packet, size);
+        }
+        (*seq)++;
+    }
+    enc->cycles += cycles() - c;
+    enc->seconds += now() - start;
+    enc->packets += count;
+
+    start = now();
+    c = cycles();
+    for (i = 0; i < count; i++) {
+        uint8_t *packet = packets + i * stride;
+        uint64_t packet_seq = first_seq + i;
+
+        if (in_cipher->aead_decrypt != NULL) {
+            if (in_cipher->aead_decrypt_length != NULL) {
+                in_cipher->aead_decrypt_length(in_cipher, packet, length,
+                                               sizeof(length), packet_seq);
+            }
+            rc = in_cipher->aead_decrypt(in_cipher, packet, out,
+                                         size - in_cipher->lenfield_blocksize,
+                                         packet_seq);
+            if (rc != SSH_OK) {
+                return SSH_ERROR;
+            }
+        } else {
+            in_cipher->decrypt(in_cipher, packet, out, size);
+        }
+    }
+    dec->cycles += cycles() - c;
+    dec->seconds += now() - start;
+    dec->packets += count;
+
+    /* the last packet has to come back as it went in */
+    if (in_cipher->aead_decrypt != NULL) {
+        rc = memcmp(out,
+                    plain + in_cipher->lenfield_blocksize,
+                    size - in_cipher->lenfield_blocksize);
+    } else {
+        rc = memcmp(out, plain, size);
+    }
+
+    return rc == 0 ? SSH_OK : SSH_ERROR;
+}
+
+static int bench_cipher(const struct ssh_cipher_struct *entry, double seconds)
+{
+    struct ssh_cipher_struct out_cipher;
+    struct ssh_cipher_struct in_cipher;
+    uint8_t *plain = NULL;
+    uint8_t *packets = NULL;
+    uint8_t *out = NULL;
+    size_t max_size = packet_sizes[ARRAY_SIZE(packet_sizes) - 1];
+    size_t i;
+    int rc = SSH_ERROR;
+
+    plain = malloc(max_size);
+    packets = malloc(BATCH_BYTES + max_size + entry->tag_size);
+    out = malloc(max_size);
+    if (plain == NULL || packets == NULL || out == NULL) {
+        goto out;
+    }
+    for (i = 0; i < max_size; i++) {
+        plain[i] = i & 0xff;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(packet_sizes); i++) {
+        size_t size = packet_sizes[i];
+        size_t count = BATCH_BYTES / (size + entry->tag_size);
+        struct measure enc = {0, 0.0, 0};
+        struct measure dec = {0, 0.0, 0};
+        uint64_t seq = 0;
+
+        if (count == 0) {
+            count = 1;
+        }
+
+        /* fresh keys for every size, the counter modes restart with them */
+        rc = get_cipher(&out_cipher, entry, 1);
+        if (rc < 0) {
+            fprintf(stderr, "Failed to set the key of %s\n", entry->name);
+            goto out;
+        }
+        rc = get_cipher(&in_cipher, entry, 0);
+        if (rc < 0) {
+            fprintf(stderr, "Failed to set the key of %s\n", entry->name);
+            ssh_cipher_clear(&out_cipher);
+            goto out;
+        }
+
+        do {
+            rc = run_batch(&out_cipher, &in_cipher, plain, packets, out,
+                           size, count, &seq, &enc, &dec);
+            if (rc != SSH_OK) {
+                fprintf(stderr, "%s did not decrypt what it encrypted\n",
+                        entry->name);
+                break;
+            }
+        } while (enc.seconds + dec.seconds < seconds);
+
+        ssh_cipher_clear(&out_cipher);
+        ssh_cipher_clear(&in_cipher);
+        if (rc != SSH_OK) {
+            goto out;
+        }
+
+        report(entry->name, "encrypt", size, &enc);
+        report(entry->name, "decrypt", size, &dec);
+    }
+
+    rc = SSH_OK;
+out:
+    SAFE_FREE(plain);
+    SAFE_FREE(packets);
+    SAFE_FREE(out);
+
+    return rc;
+}
+
+/* The MAC of one packet, as computed by ssh_packet_encrypt() */
+static int bench_hmac(const struct ssh_hmac_struct *entry, double seconds)
+{
+    size_t max_size = packet_sizes[ARRAY_SIZE(packet_sizes) - 1];
+    size_t key_len = hmac_digest_len(entry->hmac_type);
+    unsigned char digest[DIGEST_MAX_LEN];
+    uint8_t key[DIGEST_MAX_LEN];
+    uint8_t *data = NULL;
+    size_t i;
+
+    data = malloc(max_size);
+    if (data == NULL) {
+        return SSH_ERROR;
+    }
+    memset(data, 0x5a, max_size);
+    memset(key, 0x42, sizeof(key));
+
+    for (i = 0; i < ARRAY_SIZE(packet_sizes); i++) {
+        size_t size = packet_sizes[i];
+        struct measure m = {0, 0.0, 0};
+        uint32_t seq = 0;
+
+        do {
+            double start = now();
+            uint64_t c = cycles();
+            unsigned long n;
+
+            for (n = 0; n < 64; n++) {
+                unsigned int len;
+                HMACCTX ctx;
+
+                ctx = hmac_init(key, key_len, entry->hmac_type);
+                if (ctx == NULL) {
+                    fprintf(stderr, "Failed to initialize %s\n", entry->name);
+                    SAFE_FREE(data);
+                    return SSH_ERROR;
+                }
+                hmac_update(ctx, &seq, sizeof(seq));
+                hmac_update(ctx, data, size);
+                hmac_final(ctx, digest, &len);
+                seq++;
+            }
+            m.cycles += cycles() - c;
+            m.seconds += now() - start;
+            m.packets += n;
+        } while (m.seconds < seconds);
+
+        report(entry->name, "mac", size, &m);
+    }
+
+    SAFE_FREE(data);
+
+    return SSH_OK;
+}
+
+int main(int argc, char **argv)
+{
+    struct ssh_cipher_struct *ciphers = NULL;
+    struct ssh_hmac_struct *hmacs = NULL;
+    double seconds = DEFAULT_SECONDS;
+    const char *only = NULL;
+    size_t i;
+    int rc = 1;
+
+    if (argc > 1) {
+        seconds = strtod(argv[1], NULL);
+    }
+    if (argc > 2) {
+        only = argv[2];
+    }
+
+    ssh_init();
+
+    printf("libssh %s\n", ssh_version(0));
+
+    ciphers = ssh_get_ciphertab();
+    for (i = 0; ciphers[i].name != NULL; i++) {
+        if (only != NULL && strcmp(only, ciphers[i].name) != 0) {
+            continue;
+        }
+        if (bench_cipher(&ciphers[i], seconds) != SSH_OK) {
+            goto out;
+        }
+    }
+
+    hmacs = ssh_get_hmactab();
+    for (i = 0; hmacs[i].name != NULL; i++) {
+        /* the AEAD ciphers authenticate the packets themselves */
+        if (hmacs[i].hmac_type == SSH_HMAC_AEAD_POLY1305 ||
+            hmacs[i].hmac_type == SSH_HMAC_AEAD_GCM) {
+            continue;
+        }
+        if (only != NULL && strcmp(only, hmacs[i].name) != 0) {
+            continue;
+        }
+        if (bench_hmac(&hmacs[i], seconds) != SSH_OK) {
+            goto out;
+        }
+    }
+
+    rc = 0;
+out:
+    ssh_finalize();
+
+    return rc;
+}
@@ -0,0 +1,225 @@
+/* bench_dh.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Run the arithmetic of both sides of the diffie-hellman key exchanges with
+ * the built-in groups, without any network, and report key exchanges per
+ * second with the generic modular exponentiation and with the precomputed
+ * fixed-base tables.
+ *
+ * usage: bench_dh [seconds per run]
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "libssh/priv.h"
+#include "libssh/session.h"
+#include "libssh/crypto.h"
+#include "libssh/dh.h"
+#include "libssh/bignum.h"
+
+#define DEFAULT_SECONDS 2.0
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* g^secret mod p without the precomputed tables */
+static int generic_pubkey(struct ssh_crypto_struct *crypto,
+                          bignum secret,
+                          bignum dest)
+{
+    bignum_CTX ctx = bignum_ctx_new();
+    int rc;
+
+    if (bignum_ctx_invalid(ctx)) {
+        return SSH_ERROR;
+    }
+    rc = bignum_mod_exp(dest, crypto->g, secret, crypto->p, ctx);
+    bignum_ctx_free(ctx);
+
+    return rc == 1 ? SSH_OK : SSH_ERROR;
+}
+
+/* Both halves of one key exchange, the shared secrets must agree */
+static int one_kex(ssh_session session, int precomputed)
+{
+    struct ssh_crypto_struct *crypto = session->next_crypto;
+    bignum client_k = NULL;
+    int rc;
+
+    rc = ssh_dh_init_common(session);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+    crypto->e = bignum_new();
+    crypto->f = bignum_new();
+    if (crypto->e == NULL || crypto->f == NULL) {
+        rc = SSH_ERROR;
+        goto out;
+    }
+
+    rc = ssh_dh_generate_secret(session, crypto->x);
+    if (rc != SSH_OK) {
+        goto out;
+    }
+    rc = ssh_dh_generate_secret(session, crypto->y);
+    if (rc != SSH_OK) {
+        goto out;
+    }
+
+    if (precomputed) {
+        rc = ssh_dh_compute_pubkey(crypto, crypto->x, crypto->e);
+        if (rc == SSH_OK) {
+            rc = ssh_dh_compute_pubkey(crypto, crypto->y, crypto->f);
+        }
+    } else {
+        rc = generic_pubkey(crypto, crypto->x, crypto->e);
+        if (rc == SSH_OK) {
+            rc = generic_pubkey(crypto, crypto->y, crypto->f);
+        }
+    }
+    if (rc != SSH_OK) {
+        goto out;
+    }
+
+    session->client = 1;
+    rc = ssh_dh_build_k(session);
+    if (rc != SSH_OK) {
+        goto out;
+    }
+    client_k = crypto->k;
+    crypto->k = bignum_new();
+    if (crypto->k == NULL) {
+        rc = SSH_ERROR;
+        goto out;
+    }
+
+    session->client = 0;
+    rc = ssh_dh_build_k(session);
+    if (rc != SSH_OK) {
+        goto out;
+    }
+    if (bignum_cmp(client_k, crypto->k) != 0) {
+        fprintf(stderr, "The shared secrets differ\n");
+        rc = SSH_ERROR;
+    }
+
+out:
+    bignum_safe_free(client_k);
+    bignum_safe_free(crypto->k);
+    ssh_dh_cleanup(crypto);
+
+    return rc;
+}
+
+static int run(ssh_session session,
+               enum ssh_key_exchange_e kex_type,
+               const char *name,
+               int precomputed,
+               double seconds)
+{
+    unsigned long done = 0;
+    double start;
+    double elapsed;
+    int rc;
+
+    session->next_crypto->kex_type = kex_type;
+
+    /* the tables of the group are built by the first exchange */
+    rc = one_kex(session, precomputed);
+    if (rc != SSH_OK) {
+        return -1;
+    }
+
+    start = now();
+    do {
+        rc = one_kex(session, precomputed);
+        if (rc != SSH_OK) {
+            return -1;
+        }
+        done++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("%-32s %-12s %8lu kex %8.3f s %10.1f kex/s\n",
+           name,
+           precomputed ? "precomputed" : "generic",
+           done,
+           elapsed,
+           done / elapsed);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        enum ssh_key_exchange_e kex_type;
+        const char *name;
+    } groups[] = {
+        { SSH_KEX_DH_GROUP14_SHA1, "diffie-hellman-group14-sha1" },
+        { SSH_KEX_DH_GROUP16_SHA512, "diffie-hellman-group16-sha512" },
+        { SSH_KEX_DH_GROUP18_SHA512, "diffie-hellman-group18-sha512" },
+    };
+    ssh_session session = NULL;
+    double seconds = DEFAULT_SECONDS;
+    size_t i;
+    int rc = 1;
+
+    if (argc > 1) {
+        seconds = strtod(argv[1], NULL);
+    }
+
+    ssh_init();
+
+    session = ssh_new();
+    if (session == NULL) {
+        goto out;
+    }
+
+    for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+        if (run(session, groups[i].kex_type, groups[i].name, 0, seconds) < 0) {
+            goto out;
+        }
+        if (run(session, groups[i].kex_type, groups[i].name, 1, seconds) < 0) {
+            goto out;
+        }
+    }
+
+    rc = 0;
+out:
+    ssh_free(session);
+    ssh_finalize();
+
+    return rc;
+}
@@ -0,0 +1,334 @@
+/* bench_forward.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Local port forwarding over the loopback: a child process plays the local
+ * clients, connecting many times at once to a port forwarded by
+ * ssh_forwarder, while this process runs the forwarder. The benchmark server
+ * discards what the forwarded channels carry and answers their end.
+ *
+ * With --dynamic the clients go through a SOCKS5 proxy of the forwarder, and
+ * send their greeting, their request and their data at once. With --control
+ * they do the same through its control socket, like processes sharing the
+ * session of another one would.
+ */
+
+#include "config.h"
+#include "benchmarks.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libssh/libssh.h>
+
+#define FORWARD_CHUNK 32768
+
+/* no authentication, then a CONNECT to localhost:9 */
+static const char socks_request[]={
+  5, 1, 0,
+  5, 1, 0, 3, 9, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't', 0, 9
+};
+/* the method chosen, then the success of the CONNECT */
+static const char socks_reply[]={
+  5, 0,
+  5, 0, 0, 1, 0, 0, 0, 0, 0, 0
+};
+
+struct forward_client {
+  int fd;
+  size_t request_sent;
+  unsigned long long sent;
+  char reply[32];
+  size_t replied;
+  int done;
+};
+
+/*
+ * Connect n clients at once to addr, send bytes on each and wait for the
+ * replies, through the SOCKS proxy when socks is set.
+ */
+static int forward_clients(const struct sockaddr *addr, socklen_t addrlen,
+    int n, unsigned long long bytes, int socks, float *ms){
+  struct forward_client *clients;
+  struct pollfd *pfds;
+  struct timestamp_struct ts;
+  static char chunk[FORWARD_CHUNK];
+  char expected[32];
+  size_t expected_len=0;
+  size_t request_len=socks ? sizeof(socks_request) : 0;
+  int remaining=n;
+  int rc=-1;
+  int i;
+
+  if(socks){
+    memcpy(expected,socks_reply,sizeof(socks_reply));
+    expected_len=sizeof(socks_reply);
+  }
+  memcpy(expected+expected_len,BENCH_SERVER_FORWARD_REPLY,
+      strlen(BENCH_SERVER_FORWARD_REPLY));
+  expected_len+=strlen(BENCH_SERVER_FORWARD_REPLY);
+
+  clients=calloc(n, sizeof(struct forward_client));
+  pfds=calloc(n, sizeof(struct pollfd));
+  if(clients==NULL || pfds==NULL)
+    goto out;
+  memset(chunk,'A',sizeof(chunk));
+
+  timestamp_init(&ts);
+  for(i=0;i<n;++i){
+    clients[i].fd=socket(addr->sa_family,SOCK_STREAM,0);
+    if(clients[i].fd<0){
+      fprintf(stderr,"socket: %s\n",strerror(errno));
+      n=i;
+      goto out;
+    }
+    fcntl(clients[i].fd,F_SETFL,O_NONBLOCK);
+    if(connect(clients[i].fd,addr,addrlen)<0 &&
+        errno != EINPROGRESS){
+      fprintf(stderr,"connect: %s\n",strerror(errno));
+      n=i+1;
+      goto out;
+    }
+    if(bytes==0 && request_len==0)
+      shutdown(clients[i].fd,SHUT_WR);
+  }
+
+  while(remaining>0){
+    for(i=0;i<n;++i){
+      pfds[i].fd=clients[i].done ? -1 : clients[i].fd;
+      pfds[i].events=POLLIN;
+      if(clients[i].request_sent<request_len || clients[i].sent<bytes)
+        pfds[i].events|=POLLOUT;
+    }
+    if(poll(pfds,n,-1)<0){
+      if(errno==EINTR)
+        continue;
+      goto out;
+    }
+    for(i=0;i<n;++i){
+      struct forward_client *c=&clients[i];
+      ssize_t r;
+
+      if((pfds[i].revents & POLLOUT) && c->request_sent<request_len){
+        r=send(c->fd,socks_request+c->request_sent,
+            request_len-c->request_sent,MSG_NOSIGNAL);
+        if(r<0 && errno!=EAGAIN){
+          fprintf(stderr,"send: %s\n",strerror(errno));
+          goto out;
+        }
+        if(r>0){
+          c->request_sent+=r;
+          if(c->request_sent==request_len && bytes==0)
+            shutdown(c->fd,SHUT_WR);
+        }
+      } else if(pfds[i].revents & POLLOUT){
+        size_t len=sizeof(chunk);
+
+        if(bytes-c->sent < len)
+          len=(size_t)(bytes-c->sent);
+        r=send(c->fd,chunk,len,MSG_NOSIGNAL);
+        if(r<0 && errno!=EAGAIN){
+          fprintf(stderr,"send: %s\n",strerror(errno));
+          goto out;
+        }
+        if(r>0){
+          c->sent+=r;
+          if(c->sent==bytes)
+            shutdown(c->fd,SHUT_WR);
+        }
+      }
+      if(pfds[i].revents & (POLLIN|POLLHUP|POLLERR)){
+        r=recv(c->fd,c->reply+c->replied,sizeof(c->reply)-c->replied,0);
+        if(r<0 && errno==EAGAIN)
+          continue;
+        if(r<=0){
+          if(c->replied != expected_len ||
+              memcmp(c->reply,expected,expected_len)!=0){
+            fprintf(stderr,"Forwarded connection %d ended without a reply\n",
+                i);
+            goto out;
+          }
+          c->done=1;
+          remaining--;
+        } else {
+          c->replied+=r;
+          if(c->replied==sizeof(c->reply))
+            goto out;
+        }
+      }
+    }
+  }
+  *ms=elapsed_time(&ts);
+  rc=0;
+
+out:
+  if(clients != NULL){
+    for(i=0;i<n;++i)
+      close(clients[i].fd);
+  }
+  free(clients);
+  free(pfds);
+  return rc;
+}
+
+/*
+ * Run the clients in a child process while this one forwards their
+ * connections, and get the time they took.
+ */
+static int forward_run(ssh_session session, int n, unsigned long long bytes,
+    struct argument_s *args, float *ms){
+  ssh_forwarder forwarder;
+  struct sockaddr_in sin;
+  struct sockaddr_un sun;
+  struct sockaddr *addr=(struct sockaddr *)&sin;
+  socklen_t addrlen=sizeof(sin);
+  int pipefd[2];
+  int status;
+  int port=0;
+  pid_t pid;
+  int rc;
+
+  forwarder=ssh_forwarder_new(session);
+  if(forwarder==NULL){
+    fprintf(stderr,"Error creating the forwarder : %s\n",
+        ssh_get_error(session));
+    return -1;
+  }
+  memset(&sun,0,sizeof(sun));
+  if(args->control){
+    sun.sun_family=AF_UNIX;
+    snprintf(sun.sun_path,sizeof(sun.sun_path),"/tmp/libssh-bench-%d.sock",
+        (int)getpid());
+    addr=(struct sockaddr *)&sun;
+    addrlen=sizeof(sun);
+    rc=ssh_forwarder_listen_control(forwarder,sun.sun_path);
+  } else if(args->dynamic)
+    rc=ssh_forwarder_listen_dynamic(forwarder,"127.0.0.1",0,&port);
+  else
+    rc=ssh_forwarder_listen(forwarder,"127.0.0.1",0,"localhost",9,&port);
+  if(rc != SSH_OK || pipe(pipefd)<0){
+    fprintf(stderr,"Error listening : %s\n",ssh_get_error(session));
+    ssh_forwarder_free(forwarder);
+    return -1;
+  }
+  memset(&sin,0,sizeof(sin));
+  sin.sin_family=AF_INET;
+  sin.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+  sin.sin_port=htons(port);
+
+  pid=fork();
+  if(pid<0){
+    fprintf(stderr,"fork: %s\n",strerror(errno));
+    ssh_forwarder_free(forwarder);
+    return -1;
+  }
+  if(pid==0){
+    close(pipefd[0]);
+    rc=forward_clients(addr,addrlen,n,bytes,args->dynamic || args->control,
+        ms);
+    if(rc==0 && write(pipefd[1],ms,sizeof(*ms)) != sizeof(*ms))
+      rc=-1;
+    _exit(rc==0 ? 0 : 1);
+  }
+  close(pipefd[1]);
+
+  do {
+    rc=ssh_forwarder_dopoll(forwarder,10);
+    if(rc==SSH_ERROR){
+      fprintf(stderr,"Error forwarding : %s\n",ssh_get_error(session));
+      kill(pid,SIGTERM);
+      break;
+    }
+  } while(waitpid(pid,&status,WNOHANG)==0);
+  if(rc==SSH_ERROR)
+    waitpid(pid,&status,0);
+
+  ssh_forwarder_free(forwarder);
+
+  rc=-1;
+  if(WIFEXITED(status) && WEXITSTATUS(status)==0 &&
+      read(pipefd[0],ms,sizeof(*ms))==sizeof(*ms))
+    rc=0;
+  close(pipefd[0]);
+  return rc;
+}
+
+/** @internal
+ * @brief uploads the data size through concurrent_requests forwarded
+ *        connections at once.
+ * @param[in] session Session the ports are forwarded over.
+ * @param[in] args Parsed command line arguments.
+ * @param[out] bps Throughput in bits per second.
+ * @return 0 on success, -1 on error.
+ */
+int benchmarks_forward_up(ssh_session session, struct argument_s *args,
+    float *bps){
+  unsigned long long total=(unsigned long long)args->datasize * 1024 * 1024;
+  int n=args->concurrent_requests > 0 ? args->concurrent_requests : 1;
+  float ms;
+
+  if(!args->local){
+    fprintf(stderr,"The forward benchmarks need the local server (--local)\n");
+    return -1;
+  }
+  if(forward_run(session,n,total / n,args,&ms) < 0)
+    return -1;
+  *bps=8000 * (float)(total / n * n) / ms;
+  if(args->verbose > 0)
+    fprintf(stderr,"Uploading %llu bytes over %d connections took %f ms\n",
+        total / n * n,n,ms);
+  return 0;
+}
+
+/** @internal
+ * @brief opens forwards connections at once, each of them closing as soon
+ *        as the server answered.
+ * @param[in] session Session the ports are forwarded over.
+ * @param[in] args Parsed command line arguments.
+ * @param[out] rate Connections per second.
+ * @return 0 on success, -1 on error.
+ */
+int benchmarks_forward_connections(ssh_session session,
+    struct argument_s *args, float *rate){
+  float ms;
+
+  if(!args->local){
+    fprintf(stderr,"The forward benchmarks need the local server (--local)\n");
+    return -1;
+  }
+  if(forward_run(session,args->forwards,0,args,&ms) < 0)
+    return -1;
+  *rate=1000 * (float)args->forwards / ms;
+  if(args->verbose > 0)
+    fprintf(stderr,"%d forwarded connections took %f ms\n",args->forwards,ms);
+  return 0;
+}
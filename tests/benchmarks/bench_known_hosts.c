@@ -0,0 +1,243 @@
+/* bench_known_hosts.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Write a known_hosts file of hashed entries with ed25519, ecdsa and RSA
+ * keys, then time parsing all of it, looking a host up through the hashes,
+ * and the base64 decoding of the keys alone.
+ *
+ * usage: bench_known_hosts [lines]
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "libssh/priv.h"
+#include "libssh/buffer.h"
+
+#define DEFAULT_LINES 50000
+#define LINE_SIZE 2048
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+struct bench_key {
+    enum ssh_keytypes_e type;
+    int parameter;
+    char *b64;
+};
+
+static int write_known_hosts(FILE *fp, struct bench_key *keys, size_t nkeys,
+                             unsigned long lines)
+{
+    unsigned char salt[20];
+    unsigned char hash[20];
+    unsigned char *b64_salt = NULL;
+    unsigned char *b64_hash = NULL;
+    unsigned long l;
+    size_t i;
+
+    for (l = 0; l < lines; l++) {
+        struct bench_key *key = &keys[l % nkeys];
+
+        for (i = 0; i < sizeof(salt); i++) {
+            salt[i] = (unsigned char)rand();
+            hash[i] = (unsigned char)rand();
+        }
+        b64_salt = bin_to_base64(salt, sizeof(salt));
+        b64_hash = bin_to_base64(hash, sizeof(hash));
+        if (b64_salt == NULL || b64_hash == NULL) {
+            SAFE_FREE(b64_salt);
+            SAFE_FREE(b64_hash);
+            return -1;
+        }
+
+        fprintf(fp, "|1|%s|%s %s %s\n",
+                b64_salt,
+                b64_hash,
+                ssh_key_type_to_char(key->type),
+                key->b64);
+        SAFE_FREE(b64_salt);
+        SAFE_FREE(b64_hash);
+    }
+
+    return 0;
+}
+
+/* Parse every line, for the given host or for all of them */
+static int parse_file(const char *path, const char *host, const char *label)
+{
+    struct ssh_knownhosts_entry *entry = NULL;
+    char line[LINE_SIZE];
+    unsigned long lines = 0;
+    unsigned long matches = 0;
+    double start;
+    double elapsed;
+    FILE *fp;
+    int rc;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    start = now();
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        lines++;
+
+        rc = ssh_known_hosts_parse_line(host, line, &entry);
+        if (rc == SSH_OK) {
+            matches++;
+            SSH_KNOWNHOSTS_ENTRY_FREE(entry);
+        } else if (rc != SSH_AGAIN) {
+            fclose(fp);
+            return -1;
+        }
+    }
+    elapsed = now() - start;
+    fclose(fp);
+
+    printf("%-24s %8lu lines %8lu matches %8.3f s %10.0f lines/s\n",
+           label,
+           lines,
+           matches,
+           elapsed,
+           lines / elapsed);
+
+    return 0;
+}
+
+static int decode_keys(struct bench_key *keys, size_t nkeys,
+                       unsigned long lines)
+{
+    ssh_buffer buffer;
+    size_t bytes = 0;
+    unsigned long l;
+    double start;
+    double elapsed;
+
+    start = now();
+    for (l = 0; l < lines; l++) {
+        struct bench_key *key = &keys[l % nkeys];
+
+        buffer = base64_to_bin(key->b64);
+        if (buffer == NULL) {
+            return -1;
+        }
+        bytes += strlen(key->b64);
+        SSH_BUFFER_FREE(buffer);
+    }
+    elapsed = now() - start;
+
+    printf("%-24s %8lu keys  %8.1f MB %8.3f s %10.1f MB/s\n",
+           "base64 decode",
+           lines,
+           bytes / 1e6,
+           elapsed,
+           bytes / 1e6 / elapsed);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_key keys[] = {
+        { SSH_KEYTYPE_ED25519, 0, NULL },
+        { SSH_KEYTYPE_ECDSA, 256, NULL },
+        { SSH_KEYTYPE_RSA, 3072, NULL },
+    };
+    size_t nkeys = sizeof(keys) / sizeof(keys[0]);
+    unsigned long lines = DEFAULT_LINES;
+    char path[] = "/tmp/bench_known_hosts_XXXXXX";
+    FILE *fp = NULL;
+    size_t i;
+    int fd = -1;
+    int rc = 1;
+
+    if (argc > 1) {
+        lines = strtoul(argv[1], NULL, 10);
+    }
+
+    ssh_init();
+
+    for (i = 0; i < nkeys; i++) {
+        ssh_key key = NULL;
+
+        if (ssh_pki_generate(keys[i].type, keys[i].parameter, &key) < 0) {
+            goto out;
+        }
+        rc = ssh_pki_export_pubkey_base64(key, &keys[i].b64);
+        ssh_key_free(key);
+        if (rc < 0) {
+            rc = 1;
+            goto out;
+        }
+    }
+    rc = 1;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        goto out;
+    }
+    fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        unlink(path);
+        goto out;
+    }
+    if (write_known_hosts(fp, keys, nkeys, lines) < 0) {
+        fclose(fp);
+        unlink(path);
+        goto out;
+    }
+    fclose(fp);
+
+    if (parse_file(path, NULL, "parse all") < 0 ||
+        parse_file(path, "bench.example.com", "hashed host lookup") < 0 ||
+        decode_keys(keys, nkeys, lines) < 0) {
+        fprintf(stderr, "Failed to parse %s\n", path);
+        unlink(path);
+        goto out;
+    }
+    unlink(path);
+
+    rc = 0;
+out:
+    for (i = 0; i < nkeys; i++) {
+        SAFE_FREE(keys[i].b64);
+    }
+    ssh_finalize();
+
+    return rc;
+}
@@ -116,17 +116,22 @@ int benchmarks_raw_up (ssh_session session, struct argument_s *args,
   unsigned long total=0;
 
   bytes = args->datasize * 1024 * 1024;
-  script =get_python_eater(bytes);
-  err=upload_script(session,"/tmp/eater.py",script);
-  free(script);
-  if(err<0)
-    return err;
+  if(args->local){
+    /* the benchmark server implements the script itself */
+    snprintf(cmd,sizeof(cmd),"%s %lu", BENCH_SERVER_SINK, bytes);
+  } else {
+    script =get_python_eater(bytes);
+    err=upload_script(session,"/tmp/eater.py",script);
+    free(script);
+    if(err<0)
+      return err;
+    snprintf(cmd,sizeof(cmd),"%s /tmp/eater.py", PYTHON_PATH);
+  }
   channel=ssh_channel_new(session);
   if(channel == NULL)
     goto error;
   if(ssh_channel_open_session(channel)==SSH_ERROR)
     goto error;
-  snprintf(cmd,sizeof(cmd),"%s /tmp/eater.py", PYTHON_PATH);
   if(ssh_channel_request_exec(channel,cmd)==SSH_ERROR)
     goto error;
   if((err=ssh_channel_read(channel,buffer,sizeof(buffer)-1,0))==SSH_ERROR)
@@ -139,7 +144,7 @@ int benchmarks_raw_up (ssh_session session, struct argument_s *args,
     return -1;
   }
   if(args->verbose>0)
-    fprintf(stdout,"Starting upload of %lu bytes now\n",bytes);
+    fprintf(stderr,"Starting upload of %lu bytes now\n",bytes);
   timestamp_init(&ts);
   while(total < bytes){
     unsigned long towrite = bytes - total;
@@ -153,7 +158,7 @@ int benchmarks_raw_up (ssh_session session, struct argument_s *args,
   }
 
   if(args->verbose>0)
-    fprintf(stdout,"Finished upload, now waiting the ack\n");
+    fprintf(stderr,"Finished upload, now waiting the ack\n");
 
   if((err=ssh_channel_read(channel,buffer,5,0))==SSH_ERROR)
       goto error;
@@ -167,7 +172,7 @@ int benchmarks_raw_up (ssh_session session, struct argument_s *args,
   ms=elapsed_time(&ts);
   *bps=8000 * (float)bytes / ms;
   if(args->verbose > 0)
-    fprintf(stdout,"Upload took %f ms for %lu bytes, at %f bps\n",ms,
+    fprintf(stderr,"Upload took %f ms for %lu bytes, at %f bps\n",ms,
         bytes,*bps);
   ssh_channel_close(channel);
   ssh_channel_free(channel);
@@ -236,23 +241,27 @@ int benchmarks_raw_down (ssh_session session, struct argument_s *args,
   unsigned long total=0;
 
   bytes = args->datasize * 1024 * 1024;
-  script =get_python_giver(bytes);
-  err=upload_script(session,"/tmp/giver.py",script);
-  free(script);
-  if(err<0)
-    return err;
+  if(args->local){
+    snprintf(cmd,sizeof(cmd),"%s %lu", BENCH_SERVER_SOURCE, bytes);
+  } else {
+    script =get_python_giver(bytes);
+    err=upload_script(session,"/tmp/giver.py",script);
+    free(script);
+    if(err<0)
+      return err;
+    snprintf(cmd,sizeof(cmd),"%s /tmp/giver.py", PYTHON_PATH);
+  }
   channel=ssh_channel_new(session);
   if(channel == NULL)
     goto error;
   if(ssh_channel_open_session(channel)==SSH_ERROR)
     goto error;
-  snprintf(cmd,sizeof(cmd),"%s /tmp/giver.py", PYTHON_PATH);
   if(ssh_channel_request_exec(channel,cmd)==SSH_ERROR)
     goto error;
   if((err=ssh_channel_write(channel,"go",2))==SSH_ERROR)
     goto error;
   if(args->verbose>0)
-    fprintf(stdout,"Starting download of %lu bytes now\n",bytes);
+    fprintf(stderr,"Starting download of %lu bytes now\n",bytes);
   timestamp_init(&ts);
   while(total < bytes){
     unsigned long toread = bytes - total;
@@ -266,11 +275,11 @@ int benchmarks_raw_down (ssh_session session, struct argument_s *args,
   }
 
   if(args->verbose>0)
-    fprintf(stdout,"Finished download\n");
+    fprintf(stderr,"Finished download\n");
   ms=elapsed_time(&ts);
   *bps=8000 * (float)bytes / ms;
   if(args->verbose > 0)
-    fprintf(stdout,"Download took %f ms for %lu bytes, at %f bps\n",ms,
+    fprintf(stderr,"Download took %f ms for %lu bytes, at %f bps\n",ms,
         bytes,*bps);
   ssh_channel_close(channel);
   ssh_channel_free(channel);
@@ -52,7 +52,7 @@ int benchmarks_scp_up (ssh_session session, struct argument_s *args,
   if(ssh_scp_push_file(scp,SCPFILE,bytes,0777) != SSH_OK)
     goto error;
   if(args->verbose>0)
-    fprintf(stdout,"Starting upload of %lu bytes now\n",bytes);
+    fprintf(stderr,"Starting upload of %lu bytes now\n",bytes);
   timestamp_init(&ts);
   while(total < bytes){
     unsigned long towrite = bytes - total;
@@ -67,7 +67,7 @@ int benchmarks_scp_up (ssh_session session, struct argument_s *args,
   ms=elapsed_time(&ts);
   *bps=8000 * (float)bytes / ms;
   if(args->verbose > 0)
-    fprintf(stdout,"Upload took %f ms for %lu bytes, at %f bps\n",ms,
+    fprintf(stderr,"Upload took %f ms for %lu bytes, at %f bps\n",ms,
         bytes,*bps);
   ssh_scp_close(scp);
   ssh_scp_free(scp);
@@ -109,14 +109,14 @@ int benchmarks_scp_down (ssh_session session, struct argument_s *args,
   if(r == SSH_SCP_REQUEST_NEWFILE){
     size=ssh_scp_request_get_size(scp);
     if(bytes > size){
-      printf("Only %zd bytes available (on %lu requested).\n",size,bytes);
+      fprintf(stderr,"Only %zd bytes available (on %lu requested).\n",size,bytes);
       bytes = size;
     }
     if(size > bytes){
-      printf("File is %zd bytes (on %lu requested). Will cut the end\n",size,bytes);
+      fprintf(stderr,"File is %zd bytes (on %lu requested). Will cut the end\n",size,bytes);
     }
     if(args->verbose>0)
-      fprintf(stdout,"Starting download of %lu bytes now\n",bytes);
+      fprintf(stderr,"Starting download of %lu bytes now\n",bytes);
     timestamp_init(&ts);
     ssh_scp_accept_request(scp);
     while(total < bytes){
@@ -131,7 +131,7 @@ int benchmarks_scp_down (ssh_session session, struct argument_s *args,
     ms=elapsed_time(&ts);
     *bps=8000 * (float)bytes / ms;
     if(args->verbose > 0)
-      fprintf(stdout,"download took %f ms for %lu bytes, at %f bps\n",ms,
+      fprintf(stderr,"download took %f ms for %lu bytes, at %f bps\n",ms,
           bytes,*bps);
   } else {
     fprintf(stderr,"Expected SSH_SCP_REQUEST_NEWFILE, got %d\n",r);
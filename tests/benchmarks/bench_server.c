@@ -0,0 +1,658 @@
+/* bench_server.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * A libssh server for the benchmarks, listening on the loopback in a child
+ * process, so that the benchmarks can run without a remote sshd. Every
+ * connection is served by its own process, like sshd does. Any user is
+ * accepted without authentication.
+ *
+ * It only implements what the benchmarks use: the raw sink and source
+ * commands, the scp sink and source, an SFTP server whose files discard
+ * what is written and read back as many bytes as were last uploaded, and
+ * direct-tcpip channels which are connected nowhere. Nothing touches the
+ * disk or the network, the benchmarks measure libssh on both ends.
+ */
+
+#include "config.h"
+#include "benchmarks.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <libssh/libssh.h>
+#include <libssh/callbacks.h>
+#ifdef WITH_SERVER
+#include <libssh/server.h>
+#endif
+#ifdef WITH_SFTP
+#include <libssh/sftp.h>
+#endif
+
+#ifdef WITH_SERVER
+
+#define BENCH_SERVER_FILE "benchmark"
+
+static pid_t server_pid = -1;
+
+/* the size of the file served to the downloads */
+static uint64_t stored_size;
+
+static char pattern[65536];
+
+static int read_full(ssh_channel channel, void *buf, uint32_t len)
+{
+    uint32_t done = 0;
+    int r;
+
+    while (done < len) {
+        r = ssh_channel_read(channel, (char *)buf + done, len - done, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        done += r;
+    }
+
+    return 0;
+}
+
+static int discard(ssh_channel channel, uint64_t len)
+{
+    char buf[65536];
+    uint64_t done = 0;
+    int r;
+
+    while (done < len) {
+        uint32_t toread = sizeof(buf);
+
+        if (len - done < toread) {
+            toread = (uint32_t)(len - done);
+        }
+        r = ssh_channel_read(channel, buf, toread, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        done += r;
+    }
+
+    return 0;
+}
+
+static int write_pattern(ssh_channel channel, uint64_t len)
+{
+    uint64_t done = 0;
+    int w;
+
+    while (done < len) {
+        uint32_t towrite = sizeof(pattern);
+
+        if (len - done < towrite) {
+            towrite = (uint32_t)(len - done);
+        }
+        w = ssh_channel_write(channel, pattern, towrite);
+        if (w == SSH_ERROR) {
+            return -1;
+        }
+        done += w;
+    }
+
+    return 0;
+}
+
+/* Returns 1 with a line, 0 at the end of the channel, -1 on error */
+static int read_line(ssh_channel channel, char *line, size_t size)
+{
+    size_t i = 0;
+    int r;
+
+    while (i < size - 1) {
+        r = ssh_channel_read(channel, &line[i], 1, 0);
+        if (r == 0 && i == 0) {
+            return 0;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        if (line[i] == '\n') {
+            break;
+        }
+        i++;
+    }
+    line[i] = '\0';
+
+    return 1;
+}
+
+/* Same protocol as the python scripts of the raw benchmarks */
+static int serve_sink(ssh_channel channel, uint64_t bytes)
+{
+    if (ssh_channel_write(channel, "go\n", 3) == SSH_ERROR) {
+        return -1;
+    }
+    if (discard(channel, bytes) < 0) {
+        return -1;
+    }
+    if (ssh_channel_write(channel, "done\n", 5) == SSH_ERROR) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int serve_source(ssh_channel channel, uint64_t bytes)
+{
+    char go[2];
+
+    if (read_full(channel, go, sizeof(go)) < 0) {
+        return -1;
+    }
+
+    return write_pattern(channel, bytes);
+}
+
+/* scp -t: receive files */
+static int serve_scp_sink(ssh_channel channel)
+{
+    char line[256];
+    uint64_t size;
+    char *p;
+    char code;
+    int rc;
+
+    if (ssh_channel_write(channel, "", 1) == SSH_ERROR) {
+        return -1;
+    }
+
+    for (;;) {
+        rc = read_line(channel, line, sizeof(line));
+        if (rc <= 0) {
+            return rc;
+        }
+
+        switch (line[0]) {
+        case 'C':
+            p = strchr(line, ' ');
+            if (p == NULL) {
+                return -1;
+            }
+            size = strtoull(p + 1, NULL, 10);
+            if (ssh_channel_write(channel, "", 1) == SSH_ERROR) {
+                return -1;
+            }
+            if (discard(channel, size) < 0 ||
+                read_full(channel, &code, 1) < 0) {
+                return -1;
+            }
+            stored_size = size;
+            break;
+        case 'D':
+        case 'E':
+        case 'T':
+            break;
+        default:
+            return -1;
+        }
+
+        if (ssh_channel_write(channel, "", 1) == SSH_ERROR) {
+            return -1;
+        }
+    }
+}
+
+/* scp -f: send the file */
+static int serve_scp_source(ssh_channel channel)
+{
+    char line[128];
+    char code;
+
+    if (read_full(channel, &code, 1) < 0) {
+        return -1;
+    }
+
+    snprintf(line, sizeof(line), "C0644 %" PRIu64 " %s\n",
+             stored_size, BENCH_SERVER_FILE);
+    if (ssh_channel_write(channel, line, strlen(line)) == SSH_ERROR) {
+        return -1;
+    }
+    if (read_full(channel, &code, 1) < 0) {
+        return -1;
+    }
+
+    if (write_pattern(channel, stored_size) < 0) {
+        return -1;
+    }
+    if (ssh_channel_write(channel, "", 1) == SSH_ERROR) {
+        return -1;
+    }
+
+    /* the benchmark may stop reading early and close */
+    read_full(channel, &code, 1);
+
+    return 0;
+}
+
+static int known_command(const char *cmd)
+{
+    return strncmp(cmd, BENCH_SERVER_SINK " ", strlen(BENCH_SERVER_SINK) + 1) == 0 ||
+           strncmp(cmd, BENCH_SERVER_SOURCE " ", strlen(BENCH_SERVER_SOURCE) + 1) == 0 ||
+           strncmp(cmd, "scp -t ", 7) == 0 ||
+           strncmp(cmd, "scp -f ", 7) == 0;
+}
+
+static void serve_exec(ssh_channel channel, const char *cmd)
+{
+    int rc;
+
+    if (strncmp(cmd, BENCH_SERVER_SINK " ", strlen(BENCH_SERVER_SINK) + 1) == 0) {
+        rc = serve_sink(channel,
+                        strtoull(cmd + strlen(BENCH_SERVER_SINK) + 1, NULL, 10));
+    } else if (strncmp(cmd, BENCH_SERVER_SOURCE " ", strlen(BENCH_SERVER_SOURCE) + 1) == 0) {
+        rc = serve_source(channel,
+                          strtoull(cmd + strlen(BENCH_SERVER_SOURCE) + 1, NULL, 10));
+    } else if (strncmp(cmd, "scp -t ", 7) == 0) {
+        rc = serve_scp_sink(channel);
+    } else {
+        rc = serve_scp_source(channel);
+    }
+
+    ssh_channel_request_send_exit_status(channel, rc == 0 ? 0 : 1);
+    ssh_channel_send_eof(channel);
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+}
+
+#ifdef WITH_SFTP
+struct bench_file {
+    int write;
+    uint64_t size;
+};
+
+static int serve_sftp_message(sftp_session sftp, sftp_client_message msg)
+{
+    struct bench_file *file = NULL;
+    ssh_string handle = NULL;
+    uint64_t len;
+    int rc;
+
+    switch (sftp_client_message_get_type(msg)) {
+    case SSH_FXP_OPEN:
+        file = calloc(1, sizeof(struct bench_file));
+        if (file == NULL) {
+            return sftp_reply_status(msg, SSH_FX_FAILURE, "Out of memory");
+        }
+        file->write = (sftp_client_message_get_flags(msg) & SSH_FXF_WRITE) != 0;
+        file->size = file->write ? 0 : stored_size;
+
+        handle = sftp_handle_alloc(sftp, file);
+        if (handle == NULL) {
+            free(file);
+            return sftp_reply_status(msg, SSH_FX_FAILURE, "Too many open files");
+        }
+        rc = sftp_reply_handle(msg, handle);
+        ssh_string_free(handle);
+        return rc;
+    case SSH_FXP_READ:
+        file = sftp_handle(sftp, msg->handle);
+        if (file == NULL) {
+            return sftp_reply_status(msg, SSH_FX_FAILURE, "Invalid handle");
+        }
+        if (msg->offset >= file->size) {
+            return sftp_reply_status(msg, SSH_FX_EOF, NULL);
+        }
+        len = file->size - msg->offset;
+        if (len > msg->len) {
+            len = msg->len;
+        }
+        if (len > sizeof(pattern)) {
+            len = sizeof(pattern);
+        }
+        return sftp_reply_data(msg, pattern, (int)len);
+    case SSH_FXP_WRITE:
+        file = sftp_handle(sftp, msg->handle);
+        if (file == NULL) {
+            return sftp_reply_status(msg, SSH_FX_FAILURE, "Invalid handle");
+        }
+        len = msg->offset + ssh_string_len(msg->data);
+        if (len > file->size) {
+            file->size = len;
+        }
+        return sftp_reply_status(msg, SSH_FX_OK, NULL);
+    case SSH_FXP_CLOSE:
+        file = sftp_handle(sftp, msg->handle);
+        if (file == NULL) {
+            return sftp_reply_status(msg, SSH_FX_FAILURE, "Invalid handle");
+        }
+        if (file->write) {
+            stored_size = file->size;
+        }
+        sftp_handle_remove(sftp, file);
+        free(file);
+        return sftp_reply_status(msg, SSH_FX_OK, NULL);
+    default:
+        return sftp_reply_status(msg, SSH_FX_OP_UNSUPPORTED, NULL);
+    }
+}
+
+static void serve_sftp(ssh_session session, ssh_channel channel)
+{
+    sftp_client_message msg;
+    sftp_session sftp;
+
+    sftp = sftp_server_new(session, channel);
+    if (sftp == NULL) {
+        ssh_channel_close(channel);
+        ssh_channel_free(channel);
+        return;
+    }
+    if (sftp_server_init(sftp) < 0) {
+        sftp_free(sftp);
+        return;
+    }
+
+    while ((msg = sftp_get_client_message(sftp)) != NULL) {
+        serve_sftp_message(sftp, msg);
+        sftp_client_message_free(msg);
+    }
+
+    sftp_free(sftp);
+}
+#endif /* WITH_SFTP */
+
+/*
+ * The forwarded connections are served from the callbacks of their channels,
+ * so that any number of them run at the same time: the data is discarded and
+ * the end of it is answered by BENCH_SERVER_FORWARD_REPLY before closing.
+ */
+static int forward_data(ssh_session session,
+                        ssh_channel channel,
+                        void *data,
+                        uint32_t len,
+                        int is_stderr,
+                        void *userdata)
+{
+    (void)session;
+    (void)channel;
+    (void)data;
+    (void)is_stderr;
+    (void)userdata;
+
+    return len;
+}
+
+static void forward_eof(ssh_session session,
+                        ssh_channel channel,
+                        void *userdata)
+{
+    (void)userdata;
+
+    /*
+     * The socket of the session cannot be flushed from its own callbacks,
+     * ssh_message_get() sends what is left once they returned.
+     */
+    ssh_set_blocking(session, 0);
+    ssh_channel_write(channel,
+                      BENCH_SERVER_FORWARD_REPLY,
+                      strlen(BENCH_SERVER_FORWARD_REPLY));
+    ssh_channel_close(channel);
+    ssh_set_blocking(session, 1);
+}
+
+static void forward_close(ssh_session session,
+                          ssh_channel channel,
+                          void *userdata)
+{
+    /* the channel itself is released once the callbacks returned */
+    ssh_set_blocking(session, 0);
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+    ssh_set_blocking(session, 1);
+    free(userdata);
+}
+
+static void serve_forward(ssh_message msg)
+{
+    struct ssh_channel_callbacks_struct *cb;
+    ssh_channel channel;
+
+    cb = calloc(1, sizeof(struct ssh_channel_callbacks_struct));
+    if (cb == NULL) {
+        ssh_message_reply_default(msg);
+        return;
+    }
+    ssh_callbacks_init(cb);
+    cb->userdata = cb;
+    cb->channel_data_function = forward_data;
+    cb->channel_eof_function = forward_eof;
+    cb->channel_close_function = forward_close;
+
+    channel = ssh_message_channel_request_open_reply_accept(msg);
+    if (channel == NULL) {
+        free(cb);
+        return;
+    }
+    ssh_set_channel_callbacks(channel, cb);
+}
+
+static void serve_session(ssh_session session)
+{
+    ssh_message msg;
+    ssh_channel channel;
+    char *cmd;
+
+    if (ssh_handle_key_exchange(session) != SSH_OK) {
+        fprintf(stderr, "Benchmark server key exchange failed: %s\n",
+                ssh_get_error(session));
+        return;
+    }
+
+    while ((msg = ssh_message_get(session)) != NULL) {
+        switch (ssh_message_type(msg)) {
+        case SSH_REQUEST_AUTH:
+            ssh_message_auth_reply_success(msg, 0);
+            break;
+        case SSH_REQUEST_CHANNEL_OPEN:
+            if (ssh_message_subtype(msg) == SSH_CHANNEL_DIRECT_TCPIP) {
+                serve_forward(msg);
+                break;
+            }
+            if (ssh_message_subtype(msg) != SSH_CHANNEL_SESSION ||
+                ssh_message_channel_request_open_reply_accept(msg) == NULL) {
+                ssh_message_reply_default(msg);
+            }
+            break;
+        case SSH_REQUEST_CHANNEL:
+            channel = ssh_message_channel_request_channel(msg);
+            if (ssh_message_subtype(msg) == SSH_CHANNEL_REQUEST_EXEC &&
+                known_command(ssh_message_channel_request_command(msg))) {
+                cmd = strdup(ssh_message_channel_request_command(msg));
+                if (cmd == NULL) {
+                    ssh_message_reply_default(msg);
+                    break;
+                }
+                ssh_message_channel_request_reply_success(msg);
+                ssh_message_free(msg);
+                serve_exec(channel, cmd);
+                free(cmd);
+                continue;
+            }
+#ifdef WITH_SFTP
+            if (ssh_message_subtype(msg) == SSH_CHANNEL_REQUEST_SUBSYSTEM &&
+                strcmp(ssh_message_channel_request_subsystem(msg), "sftp") == 0) {
+                ssh_message_channel_request_reply_success(msg);
+                ssh_message_free(msg);
+                serve_sftp(session, channel);
+                continue;
+            }
+#endif /* WITH_SFTP */
+            /* the environment requests of the latency benchmark too */
+            ssh_message_reply_default(msg);
+            break;
+        default:
+            ssh_message_reply_default(msg);
+            break;
+        }
+        ssh_message_free(msg);
+    }
+}
+
+static void server_loop(int listen_fd, ssh_bind sshbind)
+{
+    ssh_session session;
+    pid_t pid;
+    int on = 1;
+    int fd;
+
+    /* the processes of the connections need not be waited for */
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        /* as sshd does for interactive sessions */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            session = ssh_new();
+            if (session != NULL &&
+                ssh_bind_accept_fd(sshbind, session, fd) == SSH_OK) {
+                serve_session(session);
+                ssh_disconnect(session);
+            }
+            ssh_free(session);
+            _exit(0);
+        }
+        close(fd);
+    }
+}
+
+/** @internal
+ * @brief starts the benchmark server on an ephemeral port of the loopback.
+ * @param[in,out] args Parsed command line arguments, the port is set.
+ * @return 0 on success, -1 on error.
+ */
+int benchmarks_server_start(struct argument_s *args)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    ssh_bind sshbind;
+    ssh_key key = NULL;
+    int listen_fd;
+    pid_t pid;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 64) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        fprintf(stderr, "Benchmark server socket: %s\n", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    args->port = ntohs(addr.sin_port);
+
+    stored_size = (uint64_t)args->datasize * 1024 * 1024;
+    memset(pattern, 'A', sizeof(pattern));
+
+    pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "fork: %s\n", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+
+        sshbind = ssh_bind_new();
+        if (sshbind == NULL ||
+            ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &key) != SSH_OK ||
+            ssh_bind_options_set(sshbind,
+                                 SSH_BIND_OPTIONS_IMPORT_KEY,
+                                 key) != SSH_OK) {
+            fprintf(stderr, "Could not set up the benchmark server\n");
+            _exit(1);
+        }
+        server_loop(listen_fd, sshbind);
+        _exit(0);
+    }
+
+    /* both sides, so that the group exists before any kill */
+    setpgid(pid, pid);
+    server_pid = pid;
+    close(listen_fd);
+
+    return 0;
+}
+
+/** @internal
+ * @brief stops the benchmark server and the processes of its connections.
+ */
+void benchmarks_server_stop(void)
+{
+    if (server_pid <= 0) {
+        return;
+    }
+
+    kill(-server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+    server_pid = -1;
+}
+
+#else /* WITH_SERVER */
+
+int benchmarks_server_start(struct argument_s *args)
+{
+    (void)args;
+
+    fprintf(stderr, "The benchmark server requires libssh built with "
+                    "server support\n");
+
+    return -1;
+}
+
+void benchmarks_server_stop(void)
+{
+}
+
+#endif /* WITH_SERVER */
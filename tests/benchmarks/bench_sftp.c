@@ -57,7 +57,7 @@ int benchmarks_sync_sftp_up (ssh_session session, struct argument_s *args,
   if(!file)
     goto error;
   if(args->verbose>0)
-    fprintf(stdout,"Starting upload of %lu bytes now\n",bytes);
+    fprintf(stderr,"Starting upload of %lu bytes now\n",bytes);
   timestamp_init(&ts);
   while(total < bytes){
     unsigned long towrite = bytes - total;
@@ -73,7 +73,7 @@ int benchmarks_sync_sftp_up (ssh_session session, struct argument_s *args,
   ms=elapsed_time(&ts);
   *bps=8000 * (float)bytes / ms;
   if(args->verbose > 0)
-    fprintf(stdout,"Upload took %f ms for %lu bytes, at %f bps\n",ms,
+    fprintf(stderr,"Upload took %f ms for %lu bytes, at %f bps\n",ms,
         bytes,*bps);
   sftp_free(sftp);
   return 0;
@@ -114,7 +114,7 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
   if(!file)
     goto error;
   if(args->verbose>0)
-    fprintf(stdout,"Starting download of %lu bytes now\n",bytes);
+    fprintf(stderr,"Starting download of %lu bytes now\n",bytes);
   timestamp_init(&ts);
   while(total < bytes){
     unsigned long toread = bytes - total;
@@ -126,7 +126,7 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
     total += r;
     /* we had a smaller file */
     if(r==0){
-      fprintf(stdout,"File smaller than expected : %lu (expected %lu).\n",total,bytes);
+      fprintf(stderr,"File smaller than expected : %lu (expected %lu).\n",total,bytes);
       bytes = total;
       break;
     }
@@ -135,7 +135,7 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
   ms=elapsed_time(&ts);
   *bps=8000 * (float)bytes / ms;
   if(args->verbose > 0)
-    fprintf(stdout,"download took %f ms for %lu bytes, at %f bps\n",ms,
+    fprintf(stderr,"download took %f ms for %lu bytes, at %f bps\n",ms,
         bytes,*bps);
   sftp_free(sftp);
   return 0;
@@ -181,7 +181,7 @@ int benchmarks_async_sftp_down (ssh_session session, struct argument_s *args,
     goto error;
   ids = malloc(concurrent_downloads * sizeof(int));
   if(args->verbose>0)
-    fprintf(stdout,"Starting download of %lu bytes now, using %d concurrent downloads\n",bytes,
+    fprintf(stderr,"Starting download of %lu bytes now, using %d concurrent downloads\n",bytes,
         concurrent_downloads);
   timestamp_init(&ts);
   for (i=0;i<concurrent_downloads;++i){
@@ -203,7 +203,7 @@ int benchmarks_async_sftp_down (ssh_session session, struct argument_s *args,
     }
     /* we had a smaller file */
     if(r==0){
-      fprintf(stdout,"File smaller than expected : %lu (expected %lu).\n",total,bytes);
+      fprintf(stderr,"File smaller than expected : %lu (expected %lu).\n",total,bytes);
       bytes = total;
       break;
     }
@@ -223,7 +223,7 @@ int benchmarks_async_sftp_down (ssh_session session, struct argument_s *args,
   ms=elapsed_time(&ts);
   *bps=8000 * (float)bytes / ms;
   if(args->verbose > 0)
-    fprintf(stdout,"download took %f ms for %lu bytes, at %f bps\n",ms,
+    fprintf(stderr,"download took %f ms for %lu bytes, at %f bps\n",ms,
         bytes,*bps);
   sftp_free(sftp);
   free(ids);
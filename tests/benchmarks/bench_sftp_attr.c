@@ -0,0 +1,197 @@
+/* bench_sftp_attr.c
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * Parse the SSH_FXP_NAME replies of a large directory listing from a canned
+ * packet stream, without any network, to measure the attribute parser.
+ *
+ * usage: bench_sftp_attr [entries]
+ */
+
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "libssh/priv.h"
+#include "libssh/session.h"
+#include "libssh/buffer.h"
+#include "libssh/sftp.h"
+
+/* OpenSSH sends up to 100 entries per SSH_FXP_NAME reply */
+#define ENTRIES_PER_PACKET 100
+#define DEFAULT_ENTRIES 1000000
+
+static ssh_buffer canned_packet(void)
+{
+    ssh_buffer packet;
+    char longname[128];
+    char name[32];
+    int rc;
+    int i;
+
+    packet = ssh_buffer_new();
+    if (packet == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < ENTRIES_PER_PACKET; i++) {
+        snprintf(name, sizeof(name), "file-%06d.dat", i);
+        snprintf(longname, sizeof(longname),
+                 "-rw-r--r--    1 alice    developers  %8d Mar 14 12:00 %s",
+                 i * 17, name);
+
+        rc = ssh_buffer_pack(packet,
+                             "ssdqddddd",
+                             name,
+                             longname,
+                             SSH_FILEXFER_ATTR_SIZE |
+                             SSH_FILEXFER_ATTR_UIDGID |
+                             SSH_FILEXFER_ATTR_PERMISSIONS |
+                             SSH_FILEXFER_ATTR_ACMODTIME,
+                             (uint64_t)i * 17,
+                             1000, 1000,
+                             SSH_S_IFREG | 0644,
+                             1520000000, 1520000000);
+        if (rc != SSH_OK) {
+            SSH_BUFFER_FREE(packet);
+            return NULL;
+        }
+    }
+
+    return packet;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int run(sftp_session sftp,
+               ssh_buffer packet,
+               ssh_buffer buffer,
+               unsigned long entries,
+               int read_owner,
+               const char *label)
+{
+    sftp_attributes attr;
+    unsigned long done = 0;
+    double start;
+    double elapsed;
+    int rc;
+    int i;
+
+    start = now();
+    while (done < entries) {
+        rc = ssh_buffer_reinit(buffer);
+        if (rc != SSH_OK) {
+            return -1;
+        }
+        rc = ssh_buffer_add_data(buffer,
+                                 ssh_buffer_get(packet),
+                                 ssh_buffer_get_len(packet));
+        if (rc != SSH_OK) {
+            return -1;
+        }
+
+        for (i = 0; i < ENTRIES_PER_PACKET && done < entries; i++) {
+            attr = sftp_parse_attr(sftp, buffer, 1);
+            if (attr == NULL) {
+                fprintf(stderr, "Failed to parse entry %lu\n", done);
+                return -1;
+            }
+            if (read_owner && sftp_attributes_get_owner(attr) == NULL) {
+                fprintf(stderr, "No owner for entry %lu\n", done);
+                sftp_attributes_free(attr);
+                return -1;
+            }
+            sftp_attributes_free(attr);
+            done++;
+        }
+    }
+    elapsed = now() - start;
+
+    printf("%-28s %10lu entries %8.3f s %12.0f entries/s\n",
+           label,
+           done,
+           elapsed,
+           done / elapsed);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sftp_session_struct sftp;
+    ssh_buffer packet = NULL;
+    ssh_buffer buffer = NULL;
+    unsigned long entries = DEFAULT_ENTRIES;
+    int rc = 1;
+
+    if (argc > 1) {
+        entries = strtoul(argv[1], NULL, 10);
+    }
+
+    ssh_init();
+
+    ZERO_STRUCT(sftp);
+    sftp.version = 3;
+    sftp.session = ssh_new();
+    if (sftp.session == NULL) {
+        goto out;
+    }
+    /* owner and group are taken from the longname of OpenSSH servers */
+    sftp.session->openssh = SSH_VERSION_INT(7, 6, 0);
+
+    packet = canned_packet();
+    buffer = ssh_buffer_new();
+    if (packet == NULL || buffer == NULL) {
+        goto out;
+    }
+
+    if (run(&sftp, packet, buffer, entries, 0, "eager owner/group") < 0) {
+        goto out;
+    }
+
+    sftp_set_lazy_owner_group(&sftp, 1);
+    if (run(&sftp, packet, buffer, entries, 0, "lazy owner/group, unused") < 0) {
+        goto out;
+    }
+    if (run(&sftp, packet, buffer, entries, 1, "lazy owner/group, read") < 0) {
+        goto out;
+    }
+
+    rc = 0;
+out:
+    SSH_BUFFER_FREE(packet);
+    SSH_BUFFER_FREE(buffer);
+    ssh_free(sftp.session);
+    ssh_finalize();
+
+    return rc;
+}
@@ -62,6 +62,23 @@ struct benchmark benchmarks[]= {
         .name="benchmark_async_sftp_download",
         .fct=benchmarks_async_sftp_down,
         .enabled=0
+    },
+    {
+        .name="benchmark_handshake",
+        .fct=benchmarks_handshake,
+        .enabled=0,
+        .unit="handshakes/s"
+    },
+    {
+        .name="benchmark_forward_upload",
+        .fct=benchmarks_forward_up,
+        .enabled=0
+    },
+    {
+        .name="benchmark_forward_connections",
+        .fct=benchmarks_forward_connections,
+        .enabled=0,
+        .unit="connections/s"
     }
 };
 
@@ -146,6 +163,30 @@ static struct argp_option options[] = {
     .group = 0
 
   },
+  {
+    .name  = "handshake",
+    .key   = '8',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "Connect and authenticate repeatedly",
+    .group = 0
+  },
+  {
+    .name  = "forward-upload",
+    .key   = '9',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "Upload data through forwarded local connections (with --local)",
+    .group = 0
+  },
+  {
+    .name  = "forward-connections",
+    .key   = '0',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "Open and close forwarded local connections (with --local)",
+    .group = 0
+  },
   {
     .name  = "host",
     .key   = 'h',
@@ -175,7 +216,7 @@ static struct argp_option options[] = {
     .key   = 'p',
     .arg   = "number [20]",
     .flags = 0,
-    .doc   = "[async SFTP] number of concurrent requests",
+    .doc   = "[async SFTP, forward upload] number of concurrent requests or connections",
     .group = 0
   },
   {
@@ -186,6 +227,54 @@ static struct argp_option options[] = {
     .doc   = "Cryptographic cipher to be used",
     .group = 0
   },
+  {
+    .name  = "local",
+    .key   = 'l',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "Benchmark a libssh server started on the loopback instead of hosts",
+    .group = 0
+  },
+  {
+    .name  = "handshakes",
+    .key   = 'n',
+    .arg   = "number [50]",
+    .flags = 0,
+    .doc   = "[handshake] number of connections",
+    .group = 0
+  },
+  {
+    .name  = "forwards",
+    .key   = 'F',
+    .arg   = "number [500]",
+    .flags = 0,
+    .doc   = "[forward connections] number of simultaneous connections",
+    .group = 0
+  },
+  {
+    .name  = "dynamic",
+    .key   = 'D',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "[forward] connect through a SOCKS5 proxy instead of a forwarded port",
+    .group = 0
+  },
+  {
+    .name  = "control",
+    .key   = 'M',
+    .arg   = NULL,
+    .flags = 0,
+    .doc   = "[forward] connect through a control socket instead of a forwarded port",
+    .group = 0
+  },
+  {
+    .name  = "format",
+    .key   = 'f',
+    .arg   = "text|json|csv",
+    .flags = 0,
+    .doc   = "Format of the results",
+    .group = 0
+  },
 
   {NULL, 0, NULL, 0, NULL, 0}
 };
@@ -208,9 +297,15 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
     case '5':
     case '6':
     case '7':
+    case '8':
+    case '9':
       benchmarks[key - '1'].enabled = 1;
       arguments->ntests ++;
       break;
+    case '0':
+      benchmarks[BENCHMARK_FORWARD_CONNECTIONS].enabled = 1;
+      arguments->ntests ++;
+      break;
     case 'v':
       arguments->verbose++;
       break;
@@ -226,6 +321,32 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
     case 'C':
       arguments->cipher = arg;
       break;
+    case 'l':
+      arguments->local = 1;
+      break;
+    case 'n':
+      arguments->handshakes = atoi(arg);
+      break;
+    case 'F':
+      arguments->forwards = atoi(arg);
+      break;
+    case 'D':
+      arguments->dynamic = 1;
+      break;
+    case 'M':
+      arguments->control = 1;
+      break;
+    case 'f':
+      if (strcmp(arg, "text") == 0) {
+        arguments->format = BENCHMARK_FORMAT_TEXT;
+      } else if (strcmp(arg, "json") == 0) {
+        arguments->format = BENCHMARK_FORMAT_JSON;
+      } else if (strcmp(arg, "csv") == 0) {
+        arguments->format = BENCHMARK_FORMAT_CSV;
+      } else {
+        argp_error(state, "Unknown format \"%s\"", arg);
+      }
+      break;
     case 'h':
       if(arguments->nhosts >= MAX_HOSTS_CONNECT){
         fprintf(stderr, "Too much hosts\n");
@@ -271,25 +392,41 @@ static void arguments_init(struct argument_s *arguments){
   arguments->chunksize=32758;
   arguments->concurrent_requests=20;
   arguments->datasize = 10;
+  arguments->handshakes = 50;
+  arguments->forwards = 500;
 }
 
-static ssh_session connect_host(const char *host, int verbose, char *cipher){
+static ssh_session connect_host(const char *host, struct argument_s *args){
+  int process_config = 0;
+  int nodelay = 1;
+  int rc;
   ssh_session session=ssh_new();
   if(session==NULL)
     goto error;
   if(ssh_options_set(session,SSH_OPTIONS_HOST, host)<0)
     goto error;
-  ssh_options_set(session, SSH_OPTIONS_LOG_VERBOSITY, &verbose);
-  if(cipher != NULL){
-    if (ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, cipher) ||
-        ssh_options_set(session, SSH_OPTIONS_CIPHERS_S_C, cipher)){
+  ssh_options_set(session, SSH_OPTIONS_LOG_VERBOSITY, &args->verbose);
+  if(args->cipher != NULL){
+    if (ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, args->cipher) ||
+        ssh_options_set(session, SSH_OPTIONS_CIPHERS_S_C, args->cipher)){
       goto error;
     }
   }
-  ssh_options_parse_config(session, NULL);
+  if(args->local){
+    /* the user configuration must not change what is measured */
+    ssh_options_set(session, SSH_OPTIONS_PORT, &args->port);
+    ssh_options_set(session, SSH_OPTIONS_PROCESS_CONFIG, &process_config);
+    ssh_options_set(session, SSH_OPTIONS_NODELAY, &nodelay);
+  } else {
+    ssh_options_parse_config(session, NULL);
+  }
   if(ssh_connect(session)==SSH_ERROR)
     goto error;
-  if(ssh_userauth_autopubkey(session,NULL) != SSH_AUTH_SUCCESS)
+  if(args->local)
+    rc=ssh_userauth_none(session,NULL);
+  else
+    rc=ssh_userauth_autopubkey(session,NULL);
+  if(rc != SSH_AUTH_SUCCESS)
     goto error;
   return session;
 error:
@@ -314,8 +451,65 @@ static char *network_speed(float bps){
   return buf;
 }
 
+struct result {
+  const char *host;
+  const char *name;
+  float value;
+  const char *unit;
+};
+
+static struct result results[MAX_HOSTS_CONNECT * (BENCHMARK_NUMBER + 2)];
+static int nresults;
+
+static void add_result(const char *host, const char *name, float value,
+    const char *unit){
+  if(nresults < (int)(sizeof(results) / sizeof(results[0]))){
+    results[nresults].host=host;
+    results[nresults].name=name;
+    results[nresults].value=value;
+    results[nresults].unit=unit;
+    nresults++;
+  }
+}
+
+static void print_json_string(const char *s){
+  putchar('"');
+  for(; *s != '\0'; s++){
+    if(*s == '"' || *s == '\\')
+      putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+/* machine readable results, for tracking regressions */
+static void print_results(enum benchmarks_format format){
+  int i;
+
+  if(format == BENCHMARK_FORMAT_CSV){
+    fprintf(stdout,"host,benchmark,value,unit\n");
+    for(i=0;i<nresults;++i){
+      fprintf(stdout,"%s,%s,%f,%s\n",results[i].host,results[i].name,
+          results[i].value,results[i].unit);
+    }
+  } else if(format == BENCHMARK_FORMAT_JSON){
+    fprintf(stdout,"[\n");
+    for(i=0;i<nresults;++i){
+      fprintf(stdout,"  {\"host\": ");
+      print_json_string(results[i].host);
+      fprintf(stdout,", \"benchmark\": ");
+      print_json_string(results[i].name);
+      fprintf(stdout,", \"value\": %f, \"unit\": ",results[i].value);
+      print_json_string(results[i].unit);
+      fprintf(stdout,"}%s\n",i + 1 < nresults ? "," : "");
+    }
+    fprintf(stdout,"]\n");
+  }
+}
+
 static void do_benchmarks(ssh_session session, struct argument_s *arguments,
     const char *hostname){
+  int text = arguments->format == BENCHMARK_FORMAT_TEXT;
   float ping_rtt=0.0;
   float ssh_rtt=0.0;
   float bps=0.0;
@@ -323,22 +517,33 @@ static void do_benchmarks(ssh_session session, struct argument_s *arguments,
   int err;
   struct benchmark *b;
 
-  if(arguments->verbose>0)
-    fprintf(stdout,"Testing ICMP RTT\n");
-  err=benchmarks_ping_latency(hostname, &ping_rtt);
-  if(err == 0){
-    fprintf(stdout,"ping RTT : %f ms\n",ping_rtt);
+  /* pinging the loopback tells nothing */
+  if(!arguments->local){
+    if(arguments->verbose>0)
+      fprintf(stderr,"Testing ICMP RTT\n");
+    err=benchmarks_ping_latency(hostname, &ping_rtt);
+    if(err == 0){
+      add_result(hostname,"ping_rtt",ping_rtt,"ms");
+      if(text)
+        fprintf(stdout,"ping RTT : %f ms\n",ping_rtt);
+    }
   }
   err=benchmarks_ssh_latency(session, &ssh_rtt);
   if(err==0){
-    fprintf(stdout, "SSH RTT : %f ms. Theoretical max BW (win=128K) : %s\n",ssh_rtt,network_speed(128000.0/(ssh_rtt / 1000.0)));
+    add_result(hostname,"ssh_rtt",ssh_rtt,"ms");
+    if(text)
+      fprintf(stdout, "SSH RTT : %f ms. Theoretical max BW (win=128K) : %s\n",ssh_rtt,network_speed(128000.0/(ssh_rtt / 1000.0)));
   }
   for (i=0 ; i<BENCHMARK_NUMBER ; ++i){
     b = &benchmarks[i];
     if(b->enabled){
       err=b->fct(session,arguments,&bps);
       if(err==0){
-        fprintf(stdout, "%s : %s : %s\n",hostname, b->name, network_speed(bps));
+        add_result(hostname,b->name,bps,b->unit != NULL ? b->unit : "bps");
+        if(text && b->unit != NULL)
+          fprintf(stdout, "%s : %s : %f %s\n",hostname, b->name, bps, b->unit);
+        else if(text)
+          fprintf(stdout, "%s : %s : %s\n",hostname, b->name, network_speed(bps));
       }
     }
   }
@@ -353,6 +558,17 @@ int main(int argc, char **argv){
 
   arguments_init(&arguments);
   cmdline_parse(argc, argv, &arguments);
+  if (arguments.local){
+    if (arguments.nhosts > 0){
+      fprintf(stderr,"Hosts (-h) cannot be benchmarked with --local\n");
+      return EXIT_FAILURE;
+    }
+    if (benchmarks_server_start(&arguments) < 0){
+      return EXIT_FAILURE;
+    }
+    arguments.hosts[0]="127.0.0.1";
+    arguments.nhosts=1;
+  }
   if (arguments.nhosts==0){
     fprintf(stderr,"At least one host (-h) must be specified\n");
     return EXIT_FAILURE;
@@ -369,32 +585,35 @@ int main(int argc, char **argv){
     return EXIT_FAILURE;
   }
   if (arguments.verbose > 0){
-    fprintf(stdout, "Will try hosts ");
+    fprintf(stderr, "Will try hosts ");
     for(i=0;i<arguments.nhosts;++i){
-      fprintf(stdout,"\"%s\" ", arguments.hosts[i]);
+      fprintf(stderr,"\"%s\" ", arguments.hosts[i]);
     }
-    fprintf(stdout,"with benchmarks ");
+    fprintf(stderr,"with benchmarks ");
     for(i=0;i<BENCHMARK_NUMBER;++i){
       if(benchmarks[i].enabled)
-        fprintf(stdout,"\"%s\" ",benchmarks[i].name);
+        fprintf(stderr,"\"%s\" ",benchmarks[i].name);
     }
-    fprintf(stdout,"\n");
+    fprintf(stderr,"\n");
   }
 
   for(i=0; i<arguments.nhosts;++i){
     if(arguments.verbose > 0)
-      fprintf(stdout,"Connecting to \"%s\"...\n",arguments.hosts[i]);
-    session=connect_host(arguments.hosts[i], arguments.verbose, arguments.cipher);
+      fprintf(stderr,"Connecting to \"%s\"...\n",arguments.hosts[i]);
+    session=connect_host(arguments.hosts[i], &arguments);
     if(session != NULL && arguments.verbose > 0)
-      fprintf(stdout,"Success\n");
+      fprintf(stderr,"Success\n");
     if(session == NULL){
       fprintf(stderr,"Errors occurred, stopping\n");
+      benchmarks_server_stop();
       return EXIT_FAILURE;
     }
     do_benchmarks(session, &arguments, arguments.hosts[i]);
     ssh_disconnect(session);
     ssh_free(session);
   }
+  benchmarks_server_stop();
+  print_results(arguments.format);
   return EXIT_SUCCESS;
 }
 
@@ -37,9 +37,18 @@ enum libssh_benchmarks {
     BENCHMARK_SYNC_SFTP_UPLOAD,
     BENCHMARK_SYNC_SFTP_DOWNLOAD,
     BENCHMARK_ASYNC_SFTP_DOWNLOAD,
+    BENCHMARK_HANDSHAKE,
+    BENCHMARK_FORWARD_UPLOAD,
+    BENCHMARK_FORWARD_CONNECTIONS,
     BENCHMARK_NUMBER
 };
 
+enum benchmarks_format {
+    BENCHMARK_FORMAT_TEXT=0,
+    BENCHMARK_FORMAT_JSON,
+    BENCHMARK_FORMAT_CSV
+};
+
 struct argument_s {
   const char *hosts[MAX_HOSTS_CONNECT];
   int verbose;
@@ -49,6 +58,13 @@ struct argument_s {
   unsigned int chunksize;
   int concurrent_requests;
   char *cipher;
+  int local;
+  unsigned int port;
+  int handshakes;
+  int forwards;
+  int dynamic;
+  int control;
+  enum benchmarks_format format;
 };
 
 extern char *buffer;
@@ -60,6 +76,8 @@ struct benchmark {
   const char *name;
   bench_fct fct;
   int enabled;
+  /* unit of the result, bits per second if NULL */
+  const char *unit;
 };
 
 /* latency.c */
@@ -70,6 +88,8 @@ struct timestamp_struct {
 
 int benchmarks_ping_latency (const char *host, float *average);
 int benchmarks_ssh_latency (ssh_session session, float *average);
+int benchmarks_handshake (ssh_session session, struct argument_s *args,
+    float *rate);
 
 void timestamp_init(struct timestamp_struct *ts);
 float elapsed_time(struct timestamp_struct *ts);
@@ -96,4 +116,22 @@ int benchmarks_sync_sftp_down (ssh_session session, struct argument_s *args,
     float *bps);
 int benchmarks_async_sftp_down (ssh_session session, struct argument_s *args,
     float *bps);
+/* bench_forward.c */
+
+int benchmarks_forward_up (ssh_session session, struct argument_s *args,
+    float *bps);
+int benchmarks_forward_connections (ssh_session session,
+    struct argument_s *args, float *rate);
+
+/* bench_server.c */
+
+/* commands of the benchmark server replacing the python scripts */
+#define BENCH_SERVER_SINK "libssh-benchmark-sink"
+#define BENCH_SERVER_SOURCE "libssh-benchmark-source"
+/* answer of the forwarded connections, once all their data was received */
+#define BENCH_SERVER_FORWARD_REPLY "done\n"
+
+int benchmarks_server_start(struct argument_s *args);
+void benchmarks_server_stop(void);
+
 #endif /* BENCHMARKS_H_ */
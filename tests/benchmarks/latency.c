@@ -137,7 +137,7 @@ int benchmarks_ssh_latency(ssh_session session, float *average){
   ssh_channel_close(channel);
   ssh_channel_free(channel);
   channel=NULL;
-  printf("SSH request times : %f ms ; %f ms ; %f ms\n", times[0], times[1], times[2]);
+  fprintf(stderr, "SSH request times : %f ms ; %f ms ; %f ms\n", times[0], times[1], times[2]);
   *average=(times[0]+times[1]+times[2])/3;
   return 0;
 error:
@@ -146,3 +146,50 @@ error:
     ssh_channel_free(channel);
   return -1;
 }
+
+/** @internal
+ * @brief Measures the rate of new connections to the host of an existing
+ * session, each with a key exchange and an authentication.
+ * @param[in] session active SSH session whose options are used.
+ * @param[in] args Parsed command line arguments.
+ * @param[out] rate handshakes per second.
+ * @returns 0 on success, -1 if there is an error.
+ */
+int benchmarks_handshake(ssh_session session, struct argument_s *args,
+    float *rate){
+  struct timestamp_struct ts;
+  ssh_session new=NULL;
+  float ms;
+  int i;
+  int rc;
+
+  timestamp_init(&ts);
+  for(i=0;i<args->handshakes;++i){
+    if(ssh_options_copy(session,&new) < 0){
+      new=NULL;
+      goto error;
+    }
+    if(ssh_connect(new)==SSH_ERROR)
+      goto error;
+    if(args->local)
+      rc=ssh_userauth_none(new,NULL);
+    else
+      rc=ssh_userauth_autopubkey(new,NULL);
+    if(rc != SSH_AUTH_SUCCESS)
+      goto error;
+    ssh_disconnect(new);
+    ssh_free(new);
+    new=NULL;
+  }
+  ms=elapsed_time(&ts);
+  *rate=1000 * (float)args->handshakes / ms;
+  if(args->verbose > 0)
+    fprintf(stderr,"%d handshakes took %f ms\n",args->handshakes,ms);
+  return 0;
+error:
+  fprintf(stderr,"Error during handshake : %s\n",
+      ssh_get_error(new != NULL ? new : session));
+  if(new)
+    ssh_free(new);
+  return -1;
+}
@@ -28,6 +28,10 @@
 
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <pwd.h>
 
 static int sshd_setup(void **state)
@@ -98,6 +102,325 @@ static void torture_ssh_forward(void **state)
     ssh_channel_close(c);
 }
 
+static void torture_ssh_forwarder(void **state)
+{
+    struct torture_state *s = *state;
+    ssh_session session = s->ssh.session;
+    ssh_forwarder forwarder;
+    struct sockaddr_in addr;
+    char banner[4] = {0};
+    size_t received = 0;
+    ssize_t r;
+    int bound_port;
+    int fd;
+    int i;
+    int rc;
+
+    forwarder = ssh_forwarder_new(session);
+    assert_non_null(forwarder);
+
+    rc = ssh_forwarder_listen(forwarder,
+                              "127.0.0.1",
+                              0,
+                              TORTURE_SSH_SERVER,
+                              22,
+                              &bound_port);
+    assert_ssh_return_code(session, rc);
+    assert_true(bound_port > 0);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(fd >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(bound_port);
+    /* completed by the backlog of the listener */
+    rc = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    assert_return_code(rc, errno);
+
+    /* the sshd at the other end of the channel greets us */
+    for (i = 0; i < 100 && received < sizeof(banner); i++) {
+        rc = ssh_forwarder_dopoll(forwarder, 100);
+        assert_int_not_equal(rc, SSH_ERROR);
+
+        r = recv(fd,
+                 banner + received,
+                 sizeof(banner) - received,
+                 MSG_DONTWAIT);
+        if (r > 0) {
+            received += r;
+        }
+    }
+    assert_int_equal(received, sizeof(banner));
+    assert_memory_equal(banner, "SSH-", sizeof(banner));
+    assert_int_equal(ssh_forwarder_get_connections(forwarder), 1);
+
+    close(fd);
+    for (i = 0; i < 100 && ssh_forwarder_get_connections(forwarder) > 0; i++) {
+        rc = ssh_forwarder_dopoll(forwarder, 100);
+        assert_int_not_equal(rc, SSH_ERROR);
+    }
+    assert_int_equal(ssh_forwarder_get_connections(forwarder), 0);
+
+    ssh_forwarder_free(forwarder);
+}
+
+static void torture_ssh_forwarder_free_opening(void **state)
+{
+    struct torture_state *s = *state;
+    ssh_session session = s->ssh.session;
+    ssh_forwarder forwarder;
+    ssh_channel channel;
+    struct sockaddr_in addr;
+    int bound_port;
+    int fd;
+    int i;
+    int rc;
+
+    forwarder = ssh_forwarder_new(session);
+    assert_non_null(forwarder);
+
+    rc = ssh_forwarder_listen(forwarder,
+                              "127.0.0.1",
+                              0,
+                              TORTURE_SSH_SERVER,
+                              22,
+                              &bound_port);
+    assert_ssh_return_code(session, rc);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(fd >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(bound_port);
+    rc = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    assert_return_code(rc, errno);
+
+    /* accepted, the channel is requested but likely not answered yet */
+    for (i = 0; i < 100 && ssh_forwarder_get_connections(forwarder) == 0; i++) {
+        rc = ssh_forwarder_dopoll(forwarder, 0);
+        assert_int_not_equal(rc, SSH_ERROR);
+    }
+    assert_int_equal(ssh_forwarder_get_connections(forwarder), 1);
+    ssh_forwarder_free(forwarder);
+    close(fd);
+
+    /* the answer of the server finds its channel, which is closed then */
+    channel = ssh_channel_new(session);
+    assert_non_null(channel);
+    rc = ssh_channel_open_session(channel);
+    assert_ssh_return_code(session, rc);
+    assert_int_equal(ssh_get_error_code(session), SSH_NO_ERROR);
+
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+}
+
+static void torture_ssh_forwarder_dynamic(void **state)
+{
+    struct torture_state *s = *state;
+    ssh_session session = s->ssh.session;
+    ssh_forwarder forwarder;
+    struct sockaddr_in addr;
+    /* no authentication, then a CONNECT to the sshd itself, port 22 */
+    uint8_t request[13] = {5, 1, 0, 5, 1, 0, 1, 0, 0, 0, 0, 0, 22};
+    uint8_t reply[12 + 4] = {0};
+    size_t received = 0;
+    ssize_t r;
+    int bound_port;
+    int fd;
+    int i;
+    int rc;
+
+    rc = inet_pton(AF_INET, TORTURE_SSH_SERVER, &request[7]);
+    assert_int_equal(rc, 1);
+
+    forwarder = ssh_forwarder_new(session);
+    assert_non_null(forwarder);
+
+    rc = ssh_forwarder_listen_dynamic(forwarder, "127.0.0.1", 0, &bound_port);
+    assert_ssh_return_code(session, rc);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(fd >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(bound_port);
+    rc = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    assert_return_code(rc, errno);
+
+    /* the greeting and the request at once, without waiting */
+    r = send(fd, request, sizeof(request), 0);
+    assert_int_equal(r, sizeof(request));
+
+    for (i = 0; i < 100 && received < sizeof(reply); i++) {
+        rc = ssh_forwarder_dopoll(forwarder, 100);
+        assert_int_not_equal(rc, SSH_ERROR);
+
+        r = recv(fd,
+                 reply + received,
+                 sizeof(reply) - received,
+                 MSG_DONTWAIT);
+        if (r > 0) {
+            received += r;
+        }
+    }
+    assert_int_equal(received, sizeof(reply));
+    /* the method chosen, the CONNECT granted, then the banner of sshd */
+    assert_int_equal(reply[0], 5);
+    assert_int_equal(reply[1], 0);
+    assert_int_equal(reply[2], 5);
+    assert_int_equal(reply[3], 0);
+    assert_memory_equal(reply + 12, "SSH-", 4);
+
+    close(fd);
+    ssh_forwarder_free(forwarder);
+}
+
+static void torture_ssh_forwarder_control(void **state)
+{
+    struct torture_state *s = *state;
+    ssh_session session = s->ssh.session;
+    ssh_forwarder forwarder;
+    char path[64];
+    int status = -1;
+    pid_t pid;
+    int i;
+    int rc;
+
+    snprintf(path, sizeof(path), "/tmp/torture_control_%d.sock", (int)getpid());
+
+    forwarder = ssh_forwarder_new(session);
+    assert_non_null(forwarder);
+
+    rc = ssh_forwarder_listen_control(forwarder, path);
+    assert_ssh_return_code(session, rc);
+
+    /* another process, without a session, reaches the sshd through it */
+    pid = fork();
+    assert_return_code(pid, errno);
+    if (pid == 0) {
+        char banner[4];
+        size_t received = 0;
+        ssize_t r;
+        socket_t fd;
+
+        fd = ssh_forwarder_connect_control(path, TORTURE_SSH_SERVER, 22);
+        if (fd == SSH_INVALID_SOCKET) {
+            _exit(1);
+        }
+        while (received < sizeof(banner)) {
+            r = recv(fd, banner + received, sizeof(banner) - received, 0);
+            if (r <= 0) {
+                _exit(2);
+            }
+            received += r;
+        }
+        _exit(memcmp(banner, "SSH-", sizeof(banner)) == 0 ? 0 : 3);
+    }
+
+    for (i = 0; i < 100 && waitpid(pid, &status, WNOHANG) == 0; i++) {
+        rc = ssh_forwarder_dopoll(forwarder, 100);
+        assert_int_not_equal(rc, SSH_ERROR);
+    }
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+
+    /* the control socket goes away with the forwarder */
+    ssh_forwarder_free(forwarder);
+    rc = access(path, F_OK);
+    assert_int_equal(rc, -1);
+}
+
+#ifdef WITH_SERVER
+static void torture_ssh_forwarder_control_session(void **state)
+{
+    struct torture_state *s = *state;
+    ssh_session session = s->ssh.session;
+    ssh_forwarder forwarder;
+    char path[64];
+    int status = -1;
+    pid_t pid;
+    int i;
+    int rc;
+
+    snprintf(path, sizeof(path), "/tmp/torture_control_%d.sock", (int)getpid());
+
+    forwarder = ssh_forwarder_new(session);
+    assert_non_null(forwarder);
+
+    rc = ssh_forwarder_listen_control(forwarder, path);
+    assert_ssh_return_code(session, rc);
+
+    /* another process runs a command over the session of this one */
+    pid = fork();
+    assert_return_code(pid, errno);
+    if (pid == 0) {
+        ssh_session mux;
+        ssh_channel channel;
+        char buf[64] = {0};
+        int received = 0;
+        int r;
+
+        mux = ssh_new();
+        if (mux == NULL) {
+            _exit(1);
+        }
+        ssh_options_set(mux, SSH_OPTIONS_HOST, TORTURE_SSH_SERVER);
+        ssh_options_set(mux, SSH_OPTIONS_CONTROL_PATH, path);
+        if (ssh_connect(mux) != SSH_OK ||
+            ssh_session_is_known_server(mux) != SSH_KNOWN_HOSTS_OK ||
+            ssh_userauth_none(mux, NULL) != SSH_AUTH_SUCCESS) {
+            _exit(2);
+        }
+        channel = ssh_channel_new(mux);
+        if (channel == NULL ||
+            ssh_channel_open_session(channel) != SSH_OK ||
+            ssh_channel_request_exec(channel, "echo hello; exit 3") != SSH_OK) {
+            _exit(3);
+        }
+        while (received < (int)sizeof(buf) - 1) {
+            r = ssh_channel_read(channel,
+                                 buf + received,
+                                 sizeof(buf) - 1 - received,
+                                 0);
+            if (r <= 0) {
+                break;
+            }
+            received += r;
+        }
+        if (strcmp(buf, "hello\n") != 0) {
+            _exit(4);
+        }
+        if (ssh_channel_get_exit_status(channel) != 3) {
+            _exit(5);
+        }
+        ssh_channel_free(channel);
+        ssh_disconnect(mux);
+        ssh_free(mux);
+        _exit(0);
+    }
+
+    for (i = 0; i < 100 && waitpid(pid, &status, WNOHANG) == 0; i++) {
+        rc = ssh_forwarder_dopoll(forwarder, 100);
+        assert_int_not_equal(rc, SSH_ERROR);
+    }
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+
+    /* the session of the forwarder is still usable */
+    rc = ssh_forwarder_dopoll(forwarder, 0);
+    assert_int_not_equal(rc, SSH_ERROR);
+
+    ssh_forwarder_free(forwarder);
+}
+#endif /* WITH_SERVER */
+
 int torture_run_tests(void) {
     int rc;
 
@@ -105,6 +428,23 @@ int torture_run_tests(void) {
         cmocka_unit_test_setup_teardown(torture_ssh_forward,
                                         session_setup,
                                         session_teardown),
+        cmocka_unit_test_setup_teardown(torture_ssh_forwarder,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_ssh_forwarder_free_opening,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_ssh_forwarder_dynamic,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_ssh_forwarder_control,
+                                        session_setup,
+                                        session_teardown),
+#ifdef WITH_SERVER
+        cmocka_unit_test_setup_teardown(torture_ssh_forwarder_control_session,
+                                        session_setup,
+                                        session_teardown),
+#endif /* WITH_SERVER */
     };
 
     ssh_init();
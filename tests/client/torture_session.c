@@ -31,6 +31,7 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <errno.h>
+#include <unistd.h>
 
 #define BUFLEN 4096
 static char buffer[BUFLEN];
@@ -118,12 +119,244 @@ static void torture_channel_read_error(void **state) {
     ssh_channel_free(channel);
 }
 
+static void torture_channel_writev_peek(void **state) {
+    struct torture_state *s = *state;
+    ssh_session session = s->ssh.session;
+    struct ssh_iovec iov[3] = {
+        {"libssh ", 7},
+        {"", 0},
+        {"gathers writes", 14},
+    };
+    char received[64];
+    size_t len = 0;
+    const void *data;
+    ssh_channel channel;
+    uint32_t n;
+    int rc;
+
+    channel = ssh_channel_new(session);
+    assert_non_null(channel);
+
+    rc = ssh_channel_open_session(channel);
+    assert_ssh_return_code(session, rc);
+
+    rc = ssh_channel_request_exec(channel, "cat");
+    assert_ssh_return_code(session, rc);
+
+    rc = ssh_channel_writev(channel, iov, 3);
+    assert_int_equal(rc, 21);
+
+    rc = ssh_channel_send_eof(channel);
+    assert_ssh_return_code(session, rc);
+
+    for (;;) {
+        rc = ssh_channel_peek_timeout(channel, &data, 0, -1);
+        assert_return_code(rc, 0);
+        if (rc == 0) {
+            break;
+        }
+        assert_non_null(data);
+        assert_true(len + rc <= sizeof(received));
+        memcpy(received + len, data, rc);
+        len += rc;
+
+        /* consumed in two steps, the view stays valid in between */
+        n = (uint32_t)rc;
+        rc = ssh_channel_consume(channel, 1, 0);
+        assert_int_equal(rc, SSH_OK);
+        rc = ssh_channel_consume(channel, n - 1, 0);
+        assert_int_equal(rc, SSH_OK);
+    }
+    assert_int_equal(len, 21);
+    assert_memory_equal(received, "libssh gathers writes", 21);
+
+    ssh_channel_free(channel);
+}
+
+/* Connects a new session as alice with the given cipher in both directions */
+static void session_connect_cipher(struct torture_state *s, const char *cipher)
+{
+    int verbosity = torture_libssh_verbosity();
+    bool process_config = false;
+    int rc;
+
+    ssh_disconnect(s->ssh.session);
+    ssh_free(s->ssh.session);
+
+    s->ssh.session = ssh_new();
+    assert_non_null(s->ssh.session);
+
+    ssh_options_set(s->ssh.session, SSH_OPTIONS_LOG_VERBOSITY, &verbosity);
+    ssh_options_set(s->ssh.session, SSH_OPTIONS_HOST, TORTURE_SSH_SERVER);
+    ssh_options_set(s->ssh.session, SSH_OPTIONS_USER, TORTURE_SSH_USER_ALICE);
+    ssh_options_set(s->ssh.session, SSH_OPTIONS_PROCESS_CONFIG, &process_config);
+
+    rc = ssh_options_set(s->ssh.session, SSH_OPTIONS_CIPHERS_C_S, cipher);
+    assert_ssh_return_code(s->ssh.session, rc);
+    rc = ssh_options_set(s->ssh.session, SSH_OPTIONS_CIPHERS_S_C, cipher);
+    assert_ssh_return_code(s->ssh.session, rc);
+
+    rc = ssh_connect(s->ssh.session);
+    assert_ssh_return_code(s->ssh.session, rc);
+
+    rc = ssh_userauth_publickey_auto(s->ssh.session, NULL, NULL);
+    assert_int_equal(rc, SSH_AUTH_SUCCESS);
+}
+
+static void session_export_import(struct torture_state *s)
+{
+    ssh_session session = s->ssh.session;
+    ssh_session resumed;
+    ssh_channel channel;
+    ssh_channel channels[2];
+    ssh_buffer exported;
+    char received[64];
+    size_t len = 0;
+    int rc;
+
+    channel = ssh_channel_new(session);
+    assert_non_null(channel);
+
+    rc = ssh_channel_open_session(channel);
+    assert_ssh_return_code(session, rc);
+
+    rc = ssh_channel_request_exec(channel, "cat");
+    assert_ssh_return_code(session, rc);
+
+    rc = ssh_channel_write(channel, "libssh ", 7);
+    assert_int_equal(rc, 7);
+
+    exported = ssh_buffer_new();
+    assert_non_null(exported);
+
+    do {
+        rc = ssh_session_export(session, exported);
+        if (rc == SSH_AGAIN) {
+            ssh_blocking_flush(session, 1000);
+        }
+    } while (rc == SSH_AGAIN);
+    assert_ssh_return_code(session, rc);
+
+    /* another session carries on over the same connection */
+    resumed = ssh_new();
+    assert_non_null(resumed);
+
+    rc = ssh_session_import(resumed,
+                            dup(ssh_get_fd(session)),
+                            exported,
+                            channels,
+                            2);
+    assert_int_equal(rc, 1);
+    ssh_buffer_free(exported);
+
+    ssh_free(session);
+    s->ssh.session = resumed;
+    channel = channels[0];
+
+    rc = ssh_channel_write(channel, "hands over", 10);
+    assert_int_equal(rc, 10);
+
+    rc = ssh_channel_send_eof(channel);
+    assert_ssh_return_code(resumed, rc);
+
+    do {
+        rc = ssh_channel_read(channel,
+                              received + len,
+                              sizeof(received) - len,
+                              0);
+        assert_return_code(rc, 0);
+        len += rc;
+    } while (rc > 0);
+    assert_int_equal(len, 17);
+    assert_memory_equal(received, "libssh hands over", 17);
+
+    ssh_channel_free(channel);
+}
+
+static void torture_session_export_import(void **state) {
+    struct torture_state *s = *state;
+
+    session_export_import(s);
+}
+
+/* The counter mode IV moves by the blocks sent so far */
+static void torture_session_export_import_aes256_ctr(void **state) {
+    struct torture_state *s = *state;
+
+    session_connect_cipher(s, "aes256-ctr");
+    session_export_import(s);
+}
+
+/* The GCM invocation counter moves by the packets sent so far */
+static void torture_session_export_import_aes256_gcm(void **state) {
+    struct torture_state *s = *state;
+
+    session_connect_cipher(s, "aes256-gcm@openssh.com");
+    session_export_import(s);
+}
+
+static void torture_session_export_request_pending(void **state) {
+    struct torture_state *s = *state;
+    ssh_session session = s->ssh.session;
+    ssh_channel channel;
+    ssh_buffer exported;
+    int rc;
+
+    channel = ssh_channel_new(session);
+    assert_non_null(channel);
+
+    rc = ssh_channel_open_session(channel);
+    assert_ssh_return_code(session, rc);
+
+    exported = ssh_buffer_new();
+    assert_non_null(exported);
+
+    /* the reply to the exec request is still on its way */
+    ssh_set_blocking(session, 0);
+    rc = ssh_channel_request_exec(channel, "cat");
+    assert_int_equal(rc, SSH_AGAIN);
+
+    rc = ssh_session_export(session, exported);
+    assert_int_equal(rc, SSH_AGAIN);
+    assert_int_equal(ssh_buffer_get_len(exported), 0);
+
+    ssh_set_blocking(session, 1);
+    rc = ssh_channel_request_exec(channel, "cat");
+    assert_ssh_return_code(session, rc);
+
+    do {
+        rc = ssh_session_export(session, exported);
+        if (rc == SSH_AGAIN) {
+            ssh_blocking_flush(session, 1000);
+        }
+    } while (rc == SSH_AGAIN);
+    assert_ssh_return_code(session, rc);
+
+    ssh_buffer_free(exported);
+    ssh_channel_free(channel);
+}
+
 int torture_run_tests(void) {
     int rc;
     struct CMUnitTest tests[] = {
         cmocka_unit_test_setup_teardown(torture_channel_read_error,
                                         session_setup,
                                         session_teardown),
+        cmocka_unit_test_setup_teardown(torture_channel_writev_peek,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_session_export_import,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_session_export_import_aes256_ctr,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_session_export_import_aes256_gcm,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_session_export_request_pending,
+                                        session_setup,
+                                        session_teardown),
     };
 
     ssh_init();
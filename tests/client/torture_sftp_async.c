@@ -0,0 +1,385 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "sftp.c"
+
+#include <sys/types.h>
+#include <pwd.h>
+#include <errno.h>
+
+#define ASYNC_DIRS 64
+
+struct async_count {
+    int completed;
+    int failed;
+};
+
+static int sshd_setup(void **state)
+{
+    torture_setup_sshd_server(state, false);
+
+    return 0;
+}
+
+static int sshd_teardown(void **state) {
+    torture_teardown_sshd_server(state);
+
+    return 0;
+}
+
+static int session_setup(void **state)
+{
+    struct torture_state *s = *state;
+    struct passwd *pwd;
+    int rc;
+
+    pwd = getpwnam("bob");
+    assert_non_null(pwd);
+
+    rc = setuid(pwd->pw_uid);
+    assert_return_code(rc, errno);
+
+    s->ssh.session = torture_ssh_session(s,
+                                         TORTURE_SSH_SERVER,
+                                         NULL,
+                                         TORTURE_SSH_USER_ALICE,
+                                         NULL);
+    assert_non_null(s->ssh.session);
+
+    s->ssh.tsftp = torture_sftp_session(s->ssh.session);
+    assert_non_null(s->ssh.tsftp);
+
+    return 0;
+}
+
+static int session_teardown(void **state)
+{
+    struct torture_state *s = *state;
+
+    torture_rmdirs(s->ssh.tsftp->testdir);
+    torture_sftp_close(s->ssh.tsftp);
+    ssh_disconnect(s->ssh.session);
+    ssh_free(s->ssh.session);
+
+    return 0;
+}
+
+static void async_done(sftp_request req, void *userdata)
+{
+    struct async_count *count = userdata;
+
+    if (sftp_request_get_status(req) == SSH_FX_OK) {
+        count->completed++;
+    } else {
+        count->failed++;
+    }
+    sftp_request_free(req);
+}
+
+static void async_run(sftp_session sftp)
+{
+    int rc;
+
+    while (sftp_async_pending(sftp) > 0) {
+        rc = sftp_async_process(sftp, -1);
+        assert_true(rc > 0);
+    }
+}
+
+static void torture_sftp_async_mkdir_rmdir(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    struct async_count count = {0, 0};
+    char path[128] = {0};
+    sftp_request req;
+    sftp_attributes attr;
+    int i;
+
+    for (i = 0; i < ASYNC_DIRS; i++) {
+        snprintf(path, sizeof(path), "%s/dir%d", t->testdir, i);
+        req = sftp_async_mkdir(t->sftp, path, 0755, async_done, &count);
+        assert_non_null(req);
+    }
+    assert_int_equal(sftp_async_pending(t->sftp), ASYNC_DIRS);
+    async_run(t->sftp);
+    assert_int_equal(count.completed, ASYNC_DIRS);
+    assert_int_equal(count.failed, 0);
+
+    /* A blocking call in between the asynchronous ones */
+    snprintf(path, sizeof(path), "%s/dir0", t->testdir);
+    attr = sftp_stat(t->sftp, path);
+    assert_non_null(attr);
+    assert_int_equal(attr->type, SSH_FILEXFER_TYPE_DIRECTORY);
+    sftp_attributes_free(attr);
+
+    count.completed = 0;
+    for (i = 0; i < ASYNC_DIRS; i++) {
+        snprintf(path, sizeof(path), "%s/dir%d", t->testdir, i);
+        req = sftp_async_rmdir(t->sftp, path, async_done, &count);
+        assert_non_null(req);
+    }
+    async_run(t->sftp);
+    assert_int_equal(count.completed, ASYNC_DIRS);
+    assert_int_equal(count.failed, 0);
+
+    /* Removing them again fails */
+    snprintf(path, sizeof(path), "%s/dir0", t->testdir);
+    req = sftp_async_rmdir(t->sftp, path, NULL, NULL);
+    assert_non_null(req);
+    assert_int_not_equal(sftp_request_wait(req), SSH_FX_OK);
+    sftp_request_free(req);
+}
+
+static void torture_sftp_async_stat(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    char path[128] = {0};
+    sftp_request found;
+    sftp_request missing;
+    sftp_attributes attr;
+    int rc;
+
+    snprintf(path, sizeof(path), "%s/file", t->testdir);
+    torture_write_file(path, "async");
+
+    found = sftp_async_stat(t->sftp, path, NULL, NULL);
+    assert_non_null(found);
+
+    snprintf(path, sizeof(path), "%s/missing", t->testdir);
+    missing = sftp_async_lstat(t->sftp, path, NULL, NULL);
+    assert_non_null(missing);
+
+    /* Wait for the second one first */
+    rc = sftp_request_wait(missing);
+    assert_int_equal(rc, SSH_FX_NO_SUCH_FILE);
+    assert_null(sftp_request_get_attributes(missing));
+    sftp_request_free(missing);
+
+    rc = sftp_request_wait(found);
+    assert_int_equal(rc, SSH_FX_OK);
+    attr = sftp_request_get_attributes(found);
+    assert_non_null(attr);
+    assert_int_equal(attr->size, 5);
+    sftp_attributes_free(attr);
+    sftp_request_free(found);
+}
+
+static void torture_sftp_async_open_write(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    struct async_count count = {0, 0};
+    char path[128] = {0};
+    sftp_request req;
+    sftp_attributes attr;
+    sftp_file file;
+    int rc;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/written", t->testdir);
+
+    req = sftp_async_open(t->sftp, path, O_WRONLY | O_CREAT, 0644, NULL, NULL);
+    assert_non_null(req);
+    rc = sftp_request_wait(req);
+    assert_int_equal(rc, SSH_FX_OK);
+    file = sftp_request_get_file(req);
+    assert_non_null(file);
+    sftp_request_free(req);
+
+    for (i = 0; i < 16; i++) {
+        req = sftp_async_write(file, "0123456789", 10, async_done, &count);
+        assert_non_null(req);
+    }
+    async_run(t->sftp);
+    assert_int_equal(count.completed, 16);
+
+    req = sftp_async_close(file, async_done, &count);
+    assert_non_null(req);
+    async_run(t->sftp);
+    assert_int_equal(count.completed, 17);
+
+    attr = sftp_stat(t->sftp, path);
+    assert_non_null(attr);
+    assert_int_equal(attr->size, 160);
+    sftp_attributes_free(attr);
+}
+
+static void torture_sftp_async_readdir(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    char path[128] = {0};
+    sftp_request req;
+    sftp_attributes attr;
+    sftp_dir dir;
+    int found = 0;
+    int rc;
+
+    snprintf(path, sizeof(path), "%s/listed", t->testdir);
+    torture_write_file(path, "listed");
+
+    req = sftp_async_opendir(t->sftp, t->testdir, NULL, NULL);
+    assert_non_null(req);
+    rc = sftp_request_wait(req);
+    assert_int_equal(rc, SSH_FX_OK);
+    dir = sftp_request_get_dir(req);
+    assert_non_null(dir);
+    sftp_request_free(req);
+
+    for (;;) {
+        req = sftp_async_readdir(dir, NULL, NULL);
+        assert_non_null(req);
+        rc = sftp_request_wait(req);
+        if (rc == SSH_FX_EOF) {
+            sftp_request_free(req);
+            break;
+        }
+        assert_int_equal(rc, SSH_FX_OK);
+        while ((attr = sftp_request_get_attributes(req)) != NULL) {
+            if (strcmp(attr->name, "listed") == 0) {
+                found++;
+            }
+            sftp_attributes_free(attr);
+        }
+        sftp_request_free(req);
+    }
+    assert_int_equal(found, 1);
+    assert_true(sftp_dir_eof(dir));
+
+    req = sftp_async_closedir(dir, NULL, NULL);
+    assert_non_null(req);
+    /* Freed before the reply arrived */
+    sftp_request_free(req);
+    async_run(t->sftp);
+}
+
+static void torture_sftp_async_closedir_pending(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    sftp_request readdir_req;
+    sftp_request req;
+    sftp_dir dir;
+    int rc;
+
+    /* An open request freed before its reply closes the directory itself */
+    req = sftp_async_opendir(t->sftp, t->testdir, NULL, NULL);
+    assert_non_null(req);
+    sftp_request_free(req);
+    async_run(t->sftp);
+
+    req = sftp_async_opendir(t->sftp, t->testdir, NULL, NULL);
+    assert_non_null(req);
+    rc = sftp_request_wait(req);
+    assert_int_equal(rc, SSH_FX_OK);
+    dir = sftp_request_get_dir(req);
+    assert_non_null(dir);
+    sftp_request_free(req);
+
+    /* One readdir kept, one freed before the reply */
+    readdir_req = sftp_async_readdir(dir, NULL, NULL);
+    assert_non_null(readdir_req);
+    req = sftp_async_readdir(dir, NULL, NULL);
+    assert_non_null(req);
+    sftp_request_free(req);
+
+    /* The replies arrive after the directory is gone */
+    req = sftp_async_closedir(dir, NULL, NULL);
+    assert_non_null(req);
+    sftp_request_free(req);
+
+    rc = sftp_request_wait(readdir_req);
+    assert_int_equal(rc, SSH_FX_OK);
+    sftp_request_free(readdir_req);
+    async_run(t->sftp);
+}
+
+static void torture_sftp_async_event(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    struct async_count count = {0, 0};
+    char data[SFTP_ASYNC_WRITE_SIZE_MAX + 1] = {0};
+    char path[128] = {0};
+    sftp_attributes attr;
+    sftp_request req;
+    sftp_file file;
+    ssh_event event;
+    int rc;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/event", t->testdir);
+    file = sftp_open(t->sftp, path, O_WRONLY | O_CREAT, 0644);
+    assert_non_null(file);
+
+    /* Too large for a single request */
+    req = sftp_async_write(file, data, sizeof(data), NULL, NULL);
+    assert_null(req);
+
+    event = ssh_event_new();
+    assert_non_null(event);
+    rc = sftp_async_event_add(t->sftp, event);
+    assert_int_equal(rc, SSH_OK);
+
+    for (i = 0; i < 16; i++) {
+        req = sftp_async_write(file,
+                               data,
+                               SFTP_ASYNC_WRITE_SIZE_MAX,
+                               async_done,
+                               &count);
+        assert_non_null(req);
+    }
+    while (sftp_async_pending(t->sftp) > 0) {
+        rc = ssh_event_dopoll(event, -1);
+        assert_int_not_equal(rc, SSH_ERROR);
+    }
+    assert_int_equal(count.completed, 16);
+
+    rc = sftp_async_event_remove(t->sftp, event);
+    assert_int_equal(rc, SSH_OK);
+    ssh_event_free(event);
+
+    sftp_close(file);
+
+    attr = sftp_stat(t->sftp, path);
+    assert_non_null(attr);
+    assert_int_equal(attr->size, 16 * SFTP_ASYNC_WRITE_SIZE_MAX);
+    sftp_attributes_free(attr);
+}
+
+int torture_run_tests(void) {
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_sftp_async_mkdir_rmdir,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_async_stat,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_async_open_write,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_async_readdir,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_async_closedir_pending,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_async_event,
+                                        session_setup,
+                                        session_teardown)
+    };
+
+    ssh_init();
+
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, sshd_setup, sshd_teardown);
+
+    ssh_finalize();
+
+    return rc;
+}
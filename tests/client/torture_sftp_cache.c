@@ -0,0 +1,210 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "sftp.c"
+
+#include <sys/types.h>
+#include <pwd.h>
+#include <errno.h>
+
+static int sshd_setup(void **state)
+{
+    torture_setup_sshd_server(state, false);
+
+    return 0;
+}
+
+static int sshd_teardown(void **state) {
+    torture_teardown_sshd_server(state);
+
+    return 0;
+}
+
+static int session_setup(void **state)
+{
+    struct torture_state *s = *state;
+    struct passwd *pwd;
+    sftp_cache cache;
+    int rc;
+
+    pwd = getpwnam("bob");
+    assert_non_null(pwd);
+
+    rc = setuid(pwd->pw_uid);
+    assert_return_code(rc, errno);
+
+    s->ssh.session = torture_ssh_session(s,
+                                         TORTURE_SSH_SERVER,
+                                         NULL,
+                                         TORTURE_SSH_USER_ALICE,
+                                         NULL);
+    assert_non_null(s->ssh.session);
+
+    s->ssh.tsftp = torture_sftp_session(s->ssh.session);
+    assert_non_null(s->ssh.tsftp);
+
+    cache = sftp_cache_new(60 * 1000, 1024);
+    assert_non_null(cache);
+
+    rc = sftp_set_cache(s->ssh.tsftp->sftp, cache);
+    assert_int_equal(rc, 0);
+
+    return 0;
+}
+
+static int session_teardown(void **state)
+{
+    struct torture_state *s = *state;
+    sftp_cache cache = s->ssh.tsftp->sftp->cache;
+
+    torture_rmdirs(s->ssh.tsftp->testdir);
+    torture_sftp_close(s->ssh.tsftp);
+    sftp_cache_free(cache);
+    ssh_disconnect(s->ssh.session);
+    ssh_free(s->ssh.session);
+
+    return 0;
+}
+
+static void torture_sftp_cache_stat(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    struct sftp_cache_stats_struct stats;
+    char path[128] = {0};
+    sftp_attributes attr;
+
+    snprintf(path, sizeof(path), "%s/cached", t->testdir);
+    torture_write_file(path, "cached");
+
+    attr = sftp_stat(t->sftp, path);
+    assert_non_null(attr);
+    assert_int_equal(attr->size, 6);
+    sftp_attributes_free(attr);
+
+    /* Changed behind our back, the cache still has the old size */
+    torture_write_file(path, "cached but longer");
+
+    attr = sftp_stat(t->sftp, path);
+    assert_non_null(attr);
+    assert_int_equal(attr->size, 6);
+    sftp_attributes_free(attr);
+
+    sftp_cache_get_stats(t->sftp->cache, &stats);
+    assert_int_equal(stats.hits, 1);
+    assert_int_equal(stats.misses, 1);
+    assert_int_equal(stats.entries, 1);
+
+    sftp_cache_invalidate(t->sftp->cache, path);
+
+    attr = sftp_stat(t->sftp, path);
+    assert_non_null(attr);
+    assert_int_equal(attr->size, 17);
+    sftp_attributes_free(attr);
+}
+
+static void torture_sftp_cache_unlink(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    char path[128] = {0};
+    sftp_attributes attr;
+    int rc;
+
+    snprintf(path, sizeof(path), "%s/unlinked", t->testdir);
+    torture_write_file(path, "unlinked");
+
+    attr = sftp_lstat(t->sftp, path);
+    assert_non_null(attr);
+    sftp_attributes_free(attr);
+
+    rc = sftp_unlink(t->sftp, path);
+    assert_int_equal(rc, 0);
+
+    attr = sftp_lstat(t->sftp, path);
+    assert_null(attr);
+    assert_int_equal(sftp_get_error(t->sftp), SSH_FX_NO_SUCH_FILE);
+}
+
+static void torture_sftp_cache_readdir(void **state)
+{
+    struct torture_state *s = *state;
+    struct torture_sftp *t = s->ssh.tsftp;
+    struct sftp_cache_stats_struct stats;
+    char path[128] = {0};
+    sftp_attributes attr;
+    sftp_dir dir;
+    int count = 0;
+    int rc;
+
+    snprintf(path, sizeof(path), "%s/listed", t->testdir);
+    torture_write_file(path, "listed");
+
+    dir = sftp_opendir(t->sftp, t->testdir);
+    assert_non_null(dir);
+    while ((attr = sftp_readdir(t->sftp, dir)) != NULL) {
+        count++;
+        sftp_attributes_free(attr);
+    }
+    assert_true(sftp_dir_eof(dir));
+    rc = sftp_closedir(dir);
+    assert_int_equal(rc, 0);
+
+    /* The entry has been cached from the listing */
+    attr = sftp_stat(t->sftp, path);
+    assert_non_null(attr);
+    assert_int_equal(attr->size, 6);
+    sftp_attributes_free(attr);
+
+    /* The listing is replayed from the cache */
+    dir = sftp_opendir(t->sftp, t->testdir);
+    assert_non_null(dir);
+    assert_null(dir->handle);
+    while ((attr = sftp_readdir(t->sftp, dir)) != NULL) {
+        count--;
+        sftp_attributes_free(attr);
+    }
+    assert_int_equal(count, 0);
+    assert_true(sftp_dir_eof(dir));
+    rc = sftp_closedir(dir);
+    assert_int_equal(rc, 0);
+
+    sftp_cache_get_stats(t->sftp->cache, &stats);
+    assert_int_equal(stats.hits, 2);
+
+    /* Removing an entry drops the listing of its directory */
+    rc = sftp_unlink(t->sftp, path);
+    assert_int_equal(rc, 0);
+
+    dir = sftp_opendir(t->sftp, t->testdir);
+    assert_non_null(dir);
+    assert_non_null(dir->handle);
+    rc = sftp_closedir(dir);
+    assert_int_equal(rc, 0);
+}
+
+int torture_run_tests(void) {
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_sftp_cache_stat,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_cache_unlink,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_cache_readdir,
+                                        session_setup,
+                                        session_teardown)
+    };
+
+    ssh_init();
+
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, sshd_setup, sshd_teardown);
+
+    ssh_finalize();
+
+    return rc;
+}
@@ -0,0 +1,322 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "sftp.c"
+
+#include <sys/types.h>
+#include <pwd.h>
+#include <errno.h>
+
+#define STRIPED_CHANNELS 3
+#define STRIPED_FILE_SIZE (SFTP_STRIPE_RANGE_SIZE + SFTP_STRIPE_RANGE_SIZE / 2 + 12345)
+
+struct striped_state {
+    sftp_session sftp[STRIPED_CHANNELS];
+    char source[128];
+};
+
+static struct striped_state striped;
+
+static int sshd_setup(void **state)
+{
+    torture_setup_sshd_server(state, false);
+
+    return 0;
+}
+
+static int sshd_teardown(void **state) {
+    torture_teardown_sshd_server(state);
+
+    return 0;
+}
+
+static int session_setup(void **state)
+{
+    struct torture_state *s = *state;
+    struct striped_state *st;
+    struct passwd *pwd;
+    uint8_t buf[4096];
+    size_t i;
+    size_t j;
+    int fd;
+    int rc;
+
+    pwd = getpwnam("bob");
+    assert_non_null(pwd);
+
+    rc = setuid(pwd->pw_uid);
+    assert_return_code(rc, errno);
+
+    s->ssh.session = torture_ssh_session(s,
+                                         TORTURE_SSH_SERVER,
+                                         NULL,
+                                         TORTURE_SSH_USER_ALICE,
+                                         NULL);
+    assert_non_null(s->ssh.session);
+
+    s->ssh.tsftp = torture_sftp_session(s->ssh.session);
+    assert_non_null(s->ssh.tsftp);
+
+    st = &striped;
+    ZERO_STRUCTP(st);
+
+    /* more channels on the same session */
+    st->sftp[0] = s->ssh.tsftp->sftp;
+    for (i = 1; i < STRIPED_CHANNELS; i++) {
+        st->sftp[i] = sftp_new(s->ssh.session);
+        assert_non_null(st->sftp[i]);
+        rc = sftp_init(st->sftp[i]);
+        assert_int_equal(rc, 0);
+    }
+
+    snprintf(st->source, sizeof(st->source), "%s/source", s->ssh.tsftp->testdir);
+    fd = open(st->source, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert_true(fd >= 0);
+    for (i = 0; i < STRIPED_FILE_SIZE; i += sizeof(buf)) {
+        size_t len = sizeof(buf);
+
+        if (STRIPED_FILE_SIZE - i < len) {
+            len = STRIPED_FILE_SIZE - i;
+        }
+        for (j = 0; j < len; j++) {
+            buf[j] = (uint8_t)((i + j) * 7 + (i + j) / 251);
+        }
+        rc = write(fd, buf, len);
+        assert_return_code(rc, errno);
+    }
+    close(fd);
+
+    return 0;
+}
+
+static int session_teardown(void **state)
+{
+    struct torture_state *s = *state;
+    struct striped_state *st = &striped;
+    size_t i;
+
+    for (i = 1; i < STRIPED_CHANNELS; i++) {
+        sftp_free(st->sftp[i]);
+    }
+
+    torture_rmdirs(s->ssh.tsftp->testdir);
+    torture_sftp_close(s->ssh.tsftp);
+    ssh_disconnect(s->ssh.session);
+    ssh_free(s->ssh.session);
+
+    return 0;
+}
+
+static void assert_files_equal(const char *a, const char *b)
+{
+    uint8_t buf_a[4096];
+    uint8_t buf_b[4096];
+    ssize_t na;
+    ssize_t nb;
+    int fd_a;
+    int fd_b;
+
+    fd_a = open(a, O_RDONLY);
+    assert_true(fd_a >= 0);
+    fd_b = open(b, O_RDONLY);
+    assert_true(fd_b >= 0);
+
+    do {
+        na = read(fd_a, buf_a, sizeof(buf_a));
+        nb = read(fd_b, buf_b, sizeof(buf_b));
+        assert_int_equal(na, nb);
+        assert_memory_equal(buf_a, buf_b, na);
+    } while (na > 0);
+
+    close(fd_a);
+    close(fd_b);
+}
+
+static void torture_sftp_striped_download(void **state)
+{
+    struct torture_state *s = *state;
+    struct striped_state *st = &striped;
+    char target[128] = {0};
+    int fd;
+    int rc;
+
+    snprintf(target, sizeof(target), "%s/download", s->ssh.tsftp->testdir);
+    fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert_true(fd >= 0);
+
+    rc = sftp_striped_download(st->sftp, STRIPED_CHANNELS, st->source, fd);
+    assert_int_equal(rc, SSH_OK);
+    close(fd);
+
+    assert_files_equal(st->source, target);
+}
+
+static void torture_sftp_striped_upload(void **state)
+{
+    struct torture_state *s = *state;
+    struct striped_state *st = &striped;
+    char target[128] = {0};
+    int fd;
+    int rc;
+
+    snprintf(target, sizeof(target), "%s/upload", s->ssh.tsftp->testdir);
+    fd = open(st->source, O_RDONLY);
+    assert_true(fd >= 0);
+
+    rc = sftp_striped_upload(st->sftp, STRIPED_CHANNELS, fd, target, 0644);
+    assert_int_equal(rc, SSH_OK);
+    close(fd);
+
+    assert_files_equal(st->source, target);
+}
+
+/* Copy the first len bytes of a file, corrupting the last one if asked */
+static void copy_prefix(const char *from, const char *to, off_t len, int corrupt)
+{
+    uint8_t buf[4096];
+    ssize_t nread;
+    off_t done = 0;
+    int fd_from;
+    int fd_to;
+    int rc;
+
+    fd_from = open(from, O_RDONLY);
+    assert_true(fd_from >= 0);
+    fd_to = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert_true(fd_to >= 0);
+
+    while (done < len) {
+        size_t want = sizeof(buf);
+
+        if (len - done < (off_t)want) {
+            want = (size_t)(len - done);
+        }
+        nread = read(fd_from, buf, want);
+        assert_true(nread > 0);
+        if (corrupt && done + nread == len) {
+            buf[nread - 1] ^= 0xff;
+        }
+        rc = write(fd_to, buf, nread);
+        assert_return_code(rc, errno);
+        done += nread;
+    }
+
+    close(fd_from);
+    close(fd_to);
+}
+
+static void torture_sftp_resume_download(void **state)
+{
+    struct torture_state *s = *state;
+    struct striped_state *st = &striped;
+    char target[128] = {0};
+    uint64_t resumed;
+    int fd;
+    int rc;
+
+    snprintf(target, sizeof(target), "%s/download", s->ssh.tsftp->testdir);
+    copy_prefix(st->source, target, STRIPED_FILE_SIZE / 3, 0);
+
+    fd = open(target, O_RDWR);
+    assert_true(fd >= 0);
+    rc = sftp_resume_download(st->sftp[0], st->source, fd, 0, &resumed);
+    assert_int_equal(rc, SSH_OK);
+    close(fd);
+
+    assert_int_equal(resumed, STRIPED_FILE_SIZE / 3);
+    assert_files_equal(st->source, target);
+
+    /* Complete already, nothing to transfer */
+    fd = open(target, O_RDWR);
+    assert_true(fd >= 0);
+    rc = sftp_resume_download(st->sftp[0], st->source, fd, 4096, &resumed);
+    assert_int_equal(rc, SSH_OK);
+    close(fd);
+
+    assert_int_equal(resumed, STRIPED_FILE_SIZE);
+    assert_files_equal(st->source, target);
+}
+
+static void torture_sftp_resume_download_mismatch(void **state)
+{
+    struct torture_state *s = *state;
+    struct striped_state *st = &striped;
+    char target[128] = {0};
+    uint64_t resumed;
+    int fd;
+    int rc;
+
+    snprintf(target, sizeof(target), "%s/download", s->ssh.tsftp->testdir);
+    copy_prefix(st->source, target, STRIPED_FILE_SIZE / 2, 1);
+
+    fd = open(target, O_RDWR);
+    assert_true(fd >= 0);
+    rc = sftp_resume_download(st->sftp[0], st->source, fd, 0, &resumed);
+    assert_int_equal(rc, SSH_OK);
+    close(fd);
+
+    assert_int_equal(resumed, 0);
+    assert_files_equal(st->source, target);
+}
+
+static void torture_sftp_resume_upload(void **state)
+{
+    struct torture_state *s = *state;
+    struct striped_state *st = &striped;
+    char target[128] = {0};
+    uint64_t resumed;
+    int fd;
+    int rc;
+
+    snprintf(target, sizeof(target), "%s/upload", s->ssh.tsftp->testdir);
+    copy_prefix(st->source, target, STRIPED_FILE_SIZE / 2 + 1, 0);
+
+    fd = open(st->source, O_RDONLY);
+    assert_true(fd >= 0);
+    rc = sftp_resume_upload(st->sftp[0], fd, target, 0644, 0, &resumed);
+    assert_int_equal(rc, SSH_OK);
+
+    assert_int_equal(resumed, STRIPED_FILE_SIZE / 2 + 1);
+    assert_files_equal(st->source, target);
+
+    /* A remote file whose tail differs is uploaded again from the start */
+    copy_prefix(st->source, target, STRIPED_FILE_SIZE, 1);
+    rc = sftp_resume_upload(st->sftp[0], fd, target, 0644, 0, &resumed);
+    assert_int_equal(rc, SSH_OK);
+    close(fd);
+
+    assert_int_equal(resumed, 0);
+    assert_files_equal(st->source, target);
+}
+
+int torture_run_tests(void) {
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_sftp_striped_download,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_striped_upload,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_resume_download,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_resume_download_mismatch,
+                                        session_setup,
+                                        session_teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_resume_upload,
+                                        session_setup,
+                                        session_teardown)
+    };
+
+    ssh_init();
+
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, sshd_setup, sshd_teardown);
+
+    ssh_finalize();
+
+    return rc;
+}
@@ -0,0 +1,237 @@
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define LIBSSH_STATIC
+#include <libssh/priv.h>
+#include <libssh/server.h>
+#include <libssh/messages.h>
+#include <libssh/session.h>
+#include <libssh/socket.h>
+#include "torture.h"
+#include "torture_key.h"
+
+#define TMP_FILE_NAME "/tmp/authorized_keys_XXXXXX"
+
+#define RSA_KEY "ssh-rsa AAAAB3NzaC1yc2EAAAADAQABAAABAQDD7g+vV5cvxxGN0Ldmda4WZCPgRaxV1tV+1KRZoGUNUI61h0X4bmmGaAPRQBCz4G1d9bawqDqEqnpFWazrxBU5cQtISSjzuDJKovLGliky/ShTszee1Thszg3qVNk9gGOWj7jn/HDaOxRlp003Bp47MOdnMnK/oftllFDfY2fF5IRpE6sSIGtg2ZDtF95TV5/9W2oMOIAy8u/83tuibYlNPa1X/von5LgdaPLn6Bk16bQKIhAhlMtFZH8MBYEWe4ZtOGaSWKOsK9MM/RTMlwPi6PkfoHNl4MCMupjx+CdLXwbQEt9Ww+bBIaCui2VWBEiruVbIgJh0W2Tal0e2BzYZ"
+#define ED25519_KEY "ssh-ed25519 AAAAC3NzaC1lZDI1NTE5AAAAIA7M22fXD7OiS7kGMXP+OoIjCa+J+5sq8SgAZfIOmDgM"
+#define ECDSA_KEY "ecdsa-sha2-nistp256 AAAAE2VjZHNhLXNoYTItbmlzdHAyNTYAAAAIbmlzdHAyNTYAAABBBFWmI0n0Tn5+zR7pPGcKYszRbJ/T0T3QfzRBSMMiyebGKRY8tjkU5h2l/UMugzOrOyWqMGQDgQn+a0aMunhKMg0="
+
+#define OPTIONS "from=\"10.0.0.1\",command=\"echo \\\"a b\\\"\",no-pty"
+
+static int setup(void **state)
+{
+    char *tmp_file = NULL;
+
+    tmp_file = torture_create_temp_file(TMP_FILE_NAME);
+    assert_non_null(tmp_file);
+
+    torture_write_file(tmp_file,
+                       "# the keys of alice\n"
+                       "\n"
+                       OPTIONS " " RSA_KEY " alice@work\n"
+                       "  " ED25519_KEY "\n"
+                       "ssh-ed25519 not-base64 broken\n"
+                       "ssh-rsa AAAAC3NzaC1lZDI1NTE5AAAAIA7M22fXD7OiS7kGMXP+OoIjCa+J+5sq8SgAZfIOmDgM mismatch\n"
+                       "no-pty " ED25519_KEY " duplicate\n"
+                       "cert-authority,principals=\"alice\" " ECDSA_KEY " ca\n");
+    *state = tmp_file;
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    char *tmp_file = *state;
+
+    unlink(tmp_file);
+    free(tmp_file);
+
+    return 0;
+}
+
+static ssh_key import_key(const char *line)
+{
+    char type[32];
+    ssh_key key = NULL;
+    size_t len;
+    int rc;
+
+    len = strcspn(line, " ");
+    assert_true(len < sizeof(type));
+    memcpy(type, line, len);
+    type[len] = '\0';
+
+    rc = ssh_pki_import_pubkey_base64(line + len + 1,
+                                      ssh_key_type_from_name(type),
+                                      &key);
+    assert_int_equal(rc, SSH_OK);
+
+    return key;
+}
+
+static void torture_authorized_keys_match(void **state)
+{
+    const char *filename = *state;
+    ssh_authorized_keys keys;
+    ssh_key rsa, ed25519, ecdsa;
+    char *options = NULL;
+    int rc;
+
+    keys = ssh_authorized_keys_new();
+    assert_non_null(keys);
+    assert_int_equal(ssh_authorized_keys_count(keys), 0);
+
+    rc = ssh_authorized_keys_load_file(keys, filename);
+    assert_int_equal(rc, SSH_OK);
+    /*
+     * the invalid lines and the certificate authorities are skipped, the
+     * first of the same keys is kept
+     */
+    assert_int_equal(ssh_authorized_keys_count(keys), 2);
+
+    rsa = import_key(RSA_KEY);
+    ed25519 = import_key(ED25519_KEY);
+    ecdsa = import_key(ECDSA_KEY);
+
+    rc = ssh_authorized_keys_match(keys, rsa, &options);
+    assert_int_equal(rc, 1);
+    assert_non_null(options);
+    assert_string_equal(options, OPTIONS);
+    SSH_STRING_FREE_CHAR(options);
+
+    rc = ssh_authorized_keys_match(keys, ed25519, &options);
+    assert_int_equal(rc, 1);
+    assert_null(options);
+
+    rc = ssh_authorized_keys_match(keys, ecdsa, NULL);
+    assert_int_equal(rc, 0);
+
+    ssh_key_free(rsa);
+    ssh_key_free(ed25519);
+    ssh_key_free(ecdsa);
+    ssh_authorized_keys_free(keys);
+}
+
+static int auth_publickey(ssh_authorized_keys keys, ssh_key key)
+{
+    struct ssh_message_struct msg;
+    ssh_session session;
+    socket_t sockets[2];
+    int rc;
+
+    session = ssh_new();
+    assert_non_null(session);
+
+    /* where the refusals are written */
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+    assert_return_code(rc, errno);
+    ssh_socket_set_fd(session->socket, sockets[0]);
+
+    ZERO_STRUCT(msg);
+    msg.session = session;
+    msg.type = SSH_REQUEST_AUTH;
+    msg.auth_request.method = SSH_AUTH_METHOD_PUBLICKEY;
+    msg.auth_request.pubkey = key;
+    msg.auth_request.signature_state = SSH_PUBLICKEY_STATE_VALID;
+
+    rc = ssh_message_auth_authorized_keys(&msg, keys);
+
+    ssh_free(session);
+    close(sockets[1]);
+
+    return rc;
+}
+
+static void torture_authorized_keys_auth_options(void **state)
+{
+    const char *filename = *state;
+    ssh_authorized_keys keys;
+    ssh_key rsa, ed25519, ecdsa;
+    int rc;
+
+    keys = ssh_authorized_keys_new();
+    assert_non_null(keys);
+    rc = ssh_authorized_keys_load_file(keys, filename);
+    assert_int_equal(rc, SSH_OK);
+
+    rsa = import_key(RSA_KEY);
+    ed25519 = import_key(ED25519_KEY);
+    ecdsa = import_key(ECDSA_KEY);
+
+    /* its from= is not enforced there, so the key is refused */
+    assert_int_equal(auth_publickey(keys, rsa), SSH_AUTH_DENIED);
+    assert_int_equal(auth_publickey(keys, ed25519), SSH_AUTH_SUCCESS);
+    /* a certificate authority does not authorize itself */
+    assert_int_equal(auth_publickey(keys, ecdsa), SSH_AUTH_DENIED);
+
+    ssh_key_free(rsa);
+    ssh_key_free(ed25519);
+    ssh_key_free(ecdsa);
+    ssh_authorized_keys_free(keys);
+}
+
+static void torture_authorized_keys_reload(void **state)
+{
+    const char *filename = *state;
+    ssh_authorized_keys keys;
+    ssh_key rsa, ecdsa;
+    int rc;
+
+    keys = ssh_authorized_keys_new();
+    assert_non_null(keys);
+    rc = ssh_authorized_keys_load_file(keys, filename);
+    assert_int_equal(rc, SSH_OK);
+
+    rsa = import_key(RSA_KEY);
+    ecdsa = import_key(ECDSA_KEY);
+
+    /* unchanged */
+    rc = ssh_authorized_keys_reload(keys);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(ssh_authorized_keys_count(keys), 2);
+
+    torture_write_file(filename, ECDSA_KEY "\n");
+    rc = ssh_authorized_keys_reload(keys);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(ssh_authorized_keys_count(keys), 1);
+    assert_int_equal(ssh_authorized_keys_match(keys, rsa, NULL), 0);
+    assert_int_equal(ssh_authorized_keys_match(keys, ecdsa, NULL), 1);
+
+    /* a removed file authorizes no key anymore */
+    unlink(filename);
+    rc = ssh_authorized_keys_reload(keys);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(ssh_authorized_keys_count(keys), 0);
+    assert_int_equal(ssh_authorized_keys_match(keys, ecdsa, NULL), 0);
+
+    ssh_key_free(rsa);
+    ssh_key_free(ecdsa);
+    ssh_authorized_keys_free(keys);
+}
+
+int torture_run_tests(void)
+{
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_authorized_keys_match,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_authorized_keys_auth_options,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_authorized_keys_reload,
+                                        setup,
+                                        teardown),
+    };
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+
+    return rc;
+}
@@ -0,0 +1,126 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "libssh/priv.h"
+#include "libssh/buffer.h"
+
+/* RFC 4648 test vectors */
+static const struct {
+    const char *bin;
+    const char *b64;
+} vectors[] = {
+    { "f", "Zg==" },
+    { "fo", "Zm8=" },
+    { "foo", "Zm9v" },
+    { "foob", "Zm9vYg==" },
+    { "fooba", "Zm9vYmE=" },
+    { "foobar", "Zm9vYmFy" },
+};
+
+static void assert_decodes_to(const char *b64, const void *bin, size_t len)
+{
+    ssh_buffer buffer;
+
+    buffer = base64_to_bin(b64);
+    assert_non_null(buffer);
+    assert_int_equal(ssh_buffer_get_len(buffer), len);
+    assert_memory_equal(ssh_buffer_get(buffer), bin, len);
+    SSH_BUFFER_FREE(buffer);
+}
+
+static void torture_base64_vectors(void **state)
+{
+    unsigned char *b64;
+    size_t i;
+
+    (void)state;
+
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        size_t len = strlen(vectors[i].bin);
+
+        b64 = bin_to_base64((const unsigned char *)vectors[i].bin, (int)len);
+        assert_non_null(b64);
+        assert_string_equal((char *)b64, vectors[i].b64);
+        SAFE_FREE(b64);
+
+        assert_decodes_to(vectors[i].b64, vectors[i].bin, len);
+    }
+}
+
+static void torture_base64_invalid(void **state)
+{
+    const char *invalid[] = {
+        "",
+        "Z",
+        "Zg=",
+        "Zg",
+        "Zm8==",
+        "Zm9v=",
+        "Zm9vYg===",
+        "Zm9v Yg==",
+        "Zm9\x80",
+        "Zm9vYmFy.m9vYmFy",
+    };
+    ssh_buffer buffer;
+    size_t i;
+
+    (void)state;
+
+    for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        buffer = base64_to_bin(invalid[i]);
+        assert_null(buffer);
+    }
+}
+
+/* Long enough for the vectorized code, with an error at every position */
+static void torture_base64_long(void **state)
+{
+    unsigned char bin[300];
+    unsigned char *b64;
+    ssh_buffer buffer;
+    size_t b64_len;
+    size_t len;
+    size_t i;
+
+    (void)state;
+
+    for (i = 0; i < sizeof(bin); i++) {
+        bin[i] = (unsigned char)(i * 37 + 11);
+    }
+
+    for (len = sizeof(bin) - 3; len <= sizeof(bin); len++) {
+        b64 = bin_to_base64(bin, (int)len);
+        assert_non_null(b64);
+        b64_len = strlen((char *)b64);
+        assert_int_equal(b64_len, (len + 2) / 3 * 4);
+
+        assert_decodes_to((char *)b64, bin, len);
+
+        for (i = 0; i < b64_len && b64[i] != '='; i++) {
+            unsigned char c = b64[i];
+
+            b64[i] = '*';
+            buffer = base64_to_bin((char *)b64);
+            assert_null(buffer);
+            b64[i] = c;
+        }
+        SAFE_FREE(b64);
+    }
+}
+
+int torture_run_tests(void) {
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test(torture_base64_vectors),
+        cmocka_unit_test(torture_base64_invalid),
+        cmocka_unit_test(torture_base64_long),
+    };
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+    return rc;
+}
@@ -0,0 +1,327 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LIBSSH_STATIC
+#include <libssh/priv.h>
+#include <libssh/server.h>
+#include <libssh/buffer.h>
+#include <libssh/pki.h>
+#include <libssh/pki_priv.h>
+#include "torture.h"
+
+#define TMP_FILE_NAME "/tmp/cert_verifier_XXXXXX"
+
+struct cert_state {
+    ssh_session session;
+    ssh_key ca;
+    ssh_key other_ca;
+    ssh_key user;
+    char *ca_file;
+    char *revoked_file;
+};
+
+static void write_pubkey(const char *filename, const ssh_key key)
+{
+    char line[1024];
+    char *b64 = NULL;
+    int rc;
+
+    rc = ssh_pki_export_pubkey_base64(key, &b64);
+    assert_int_equal(rc, SSH_OK);
+    snprintf(line, sizeof(line), "%s %s\n", key->type_c, b64);
+    torture_write_file(filename, line);
+    free(b64);
+}
+
+static int setup(void **state)
+{
+    struct cert_state *s = NULL;
+    int rc;
+
+    s = calloc(1, sizeof(struct cert_state));
+    assert_non_null(s);
+
+    s->session = ssh_new();
+    assert_non_null(s->session);
+
+    rc = ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &s->ca);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &s->other_ca);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_pki_generate(SSH_KEYTYPE_RSA, 1024, &s->user);
+    assert_int_equal(rc, SSH_OK);
+
+    s->ca_file = torture_create_temp_file(TMP_FILE_NAME);
+    assert_non_null(s->ca_file);
+    write_pubkey(s->ca_file, s->ca);
+
+    s->revoked_file = torture_create_temp_file(TMP_FILE_NAME);
+    assert_non_null(s->revoked_file);
+    torture_write_file(s->revoked_file, "# nothing revoked\n");
+
+    *state = s;
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    struct cert_state *s = *state;
+
+    unlink(s->ca_file);
+    unlink(s->revoked_file);
+    free(s->ca_file);
+    free(s->revoked_file);
+    ssh_key_free(s->ca);
+    ssh_key_free(s->other_ca);
+    ssh_key_free(s->user);
+    ssh_free(s->session);
+    free(s);
+
+    return 0;
+}
+
+/* Issue a certificate for the user key, as ssh-keygen -s does */
+static ssh_key sign_cert(const ssh_key ca,
+                         const ssh_key user,
+                         uint32_t type,
+                         const char *principal,
+                         uint64_t valid_after,
+                         uint64_t valid_before,
+                         const char *critical)
+{
+    ssh_buffer cert = NULL;
+    ssh_buffer list = NULL;
+    ssh_buffer options = NULL;
+    ssh_string user_blob = NULL;
+    ssh_string ca_blob = NULL;
+    ssh_string sig_blob = NULL;
+    ssh_string cert_blob = NULL;
+    ssh_signature sig = NULL;
+    ssh_key key = NULL;
+    int rc;
+
+    cert = ssh_buffer_new();
+    list = ssh_buffer_new();
+    options = ssh_buffer_new();
+    assert_non_null(cert);
+    assert_non_null(list);
+    assert_non_null(options);
+
+    rc = ssh_buffer_pack(list, "s", principal);
+    assert_int_equal(rc, SSH_OK);
+    if (critical != NULL) {
+        rc = ssh_buffer_pack(options, "ss", critical, "");
+        assert_int_equal(rc, SSH_OK);
+    }
+
+    rc = ssh_pki_export_pubkey_blob(user, &user_blob);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_pki_export_pubkey_blob(ca, &ca_blob);
+    assert_int_equal(rc, SSH_OK);
+
+    /* the fields of the user key follow its type name in its blob */
+    rc = ssh_buffer_pack(cert,
+                         "ssPqdsdPqqdPssS",
+                         "ssh-rsa-cert-v01@openssh.com",
+                         "a nonce of 32 bytes, as ssh-keyg",
+                         (size_t)ssh_string_len(user_blob) - 11,
+                         (char *)ssh_string_data(user_blob) + 11,
+                         (uint64_t)42,
+                         type,
+                         "alice@example.com",
+                         ssh_buffer_get_len(list),
+                         (size_t)ssh_buffer_get_len(list),
+                         ssh_buffer_get(list),
+                         valid_after,
+                         valid_before,
+                         ssh_buffer_get_len(options),
+                         (size_t)ssh_buffer_get_len(options),
+                         ssh_buffer_get(options),
+                         "",
+                         "",
+                         ca_blob);
+    assert_int_equal(rc, SSH_OK);
+
+    sig = pki_do_sign(ca, ssh_buffer_get(cert), ssh_buffer_get_len(cert));
+    assert_non_null(sig);
+    rc = ssh_pki_export_signature_blob(sig, &sig_blob);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_buffer_pack(cert, "S", sig_blob);
+    assert_int_equal(rc, SSH_OK);
+
+    cert_blob = ssh_string_new(ssh_buffer_get_len(cert));
+    assert_non_null(cert_blob);
+    ssh_string_fill(cert_blob, ssh_buffer_get(cert), ssh_buffer_get_len(cert));
+    rc = ssh_pki_import_cert_blob(cert_blob, &key);
+    assert_int_equal(rc, SSH_OK);
+
+    ssh_string_free(cert_blob);
+    ssh_string_free(sig_blob);
+    ssh_signature_free(sig);
+    ssh_string_free(ca_blob);
+    ssh_string_free(user_blob);
+    ssh_buffer_free(options);
+    ssh_buffer_free(list);
+    ssh_buffer_free(cert);
+
+    return key;
+}
+
+static void torture_cert_verifier_check(void **state)
+{
+    struct cert_state *s = *state;
+    uint64_t now = (uint64_t)time(NULL);
+    ssh_authorized_keys cas;
+    ssh_cert_verifier verifier;
+    ssh_key cert;
+    ssh_key key = NULL;
+    int rc;
+
+    cas = ssh_authorized_keys_new();
+    assert_non_null(cas);
+    rc = ssh_authorized_keys_load_file(cas, s->ca_file);
+    assert_int_equal(rc, SSH_OK);
+
+    verifier = ssh_cert_verifier_new(cas, 16);
+    assert_non_null(verifier);
+
+    cert = sign_cert(s->ca, s->user, 1, "alice", now - 60, now + 60, NULL);
+
+    /* verified, then remembered */
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 1);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 1);
+    /* which does not make it valid for another principal */
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "bob");
+    assert_int_equal(rc, 0);
+
+    /* the signatures are made by the key of the certificate */
+    rc = ssh_pki_import_cert_key(cert, &key);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(ssh_key_cmp(key, s->user, SSH_KEY_CMP_PUBLIC), 0);
+    ssh_key_free(key);
+
+    /* a plain key is no certificate */
+    rc = ssh_cert_verifier_check(verifier, s->session, s->user, "alice");
+    assert_int_equal(rc, 0);
+    ssh_key_free(cert);
+
+    cert = sign_cert(s->ca, s->user, 1, "alice", now - 60, now - 30, NULL);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+    ssh_key_free(cert);
+
+    /* a host certificate */
+    cert = sign_cert(s->ca, s->user, 2, "alice", now - 60, now + 60, NULL);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+    ssh_key_free(cert);
+
+    cert = sign_cert(s->ca, s->user, 1, "alice", now - 60, now + 60,
+                     "force-command");
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+    ssh_key_free(cert);
+
+    cert = sign_cert(s->other_ca, s->user, 1, "alice",
+                     now - 60, now + 60, NULL);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+    ssh_key_free(cert);
+
+    /* a signature which does not match */
+    cert = sign_cert(s->ca, s->user, 1, "alice", now - 60, now + 60, NULL);
+    ((unsigned char *)ssh_buffer_get(cert->cert))[
+        ssh_buffer_get_len(cert->cert) - 1] ^= 0x01;
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+    ssh_key_free(cert);
+
+    ssh_cert_verifier_free(verifier);
+    ssh_authorized_keys_free(cas);
+}
+
+static void torture_cert_verifier_revoked(void **state)
+{
+    struct cert_state *s = *state;
+    uint64_t now = (uint64_t)time(NULL);
+    ssh_authorized_keys cas;
+    ssh_authorized_keys revoked;
+    ssh_cert_verifier verifier;
+    ssh_key cert;
+    int rc;
+
+    cas = ssh_authorized_keys_new();
+    assert_non_null(cas);
+    rc = ssh_authorized_keys_load_file(cas, s->ca_file);
+    assert_int_equal(rc, SSH_OK);
+    revoked = ssh_authorized_keys_new();
+    assert_non_null(revoked);
+    rc = ssh_authorized_keys_load_file(revoked, s->revoked_file);
+    assert_int_equal(rc, SSH_OK);
+
+    verifier = ssh_cert_verifier_new(cas, 16);
+    assert_non_null(verifier);
+    ssh_cert_verifier_set_revoked(verifier, revoked);
+
+    cert = sign_cert(s->ca, s->user, 1, "alice", now - 60, now + 60, NULL);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 1);
+
+    /* a remembered certificate is refused once its key is revoked */
+    write_pubkey(s->revoked_file, s->user);
+    rc = ssh_authorized_keys_reload(revoked);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+
+    /* and so is every certificate of a revoked authority */
+    write_pubkey(s->revoked_file, s->ca);
+    rc = ssh_authorized_keys_reload(revoked);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+
+    torture_write_file(s->revoked_file, "");
+    rc = ssh_authorized_keys_reload(revoked);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 1);
+
+    /* as well as those of an authority no longer trusted */
+    torture_write_file(s->ca_file, "");
+    rc = ssh_authorized_keys_reload(cas);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_cert_verifier_check(verifier, s->session, cert, "alice");
+    assert_int_equal(rc, 0);
+
+    ssh_key_free(cert);
+    ssh_cert_verifier_free(verifier);
+    ssh_authorized_keys_free(revoked);
+    ssh_authorized_keys_free(cas);
+}
+
+int torture_run_tests(void)
+{
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_cert_verifier_check,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_cert_verifier_revoked,
+                                        setup,
+                                        teardown),
+    };
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+
+    return rc;
+}
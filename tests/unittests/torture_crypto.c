@@ -4,6 +4,7 @@
 
 #include "torture.h"
 #include "libssh/crypto.h"
+#include "libssh/pki_priv.h"
 
 uint8_t key[32] =
     "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e"
@@ -110,10 +111,61 @@ static void torture_crypto_aes256_cbc(void **state)
     ssh_cipher_clear(&cipher);
 }
 
+/* bcrypt_pbkdf("password", "salt") with one and two blocks of output */
+static const struct {
+    unsigned int rounds;
+    size_t keylen;
+    const char *key;
+} bcrypt_pbkdf_vectors[] = {
+    { 4, 32,
+      "\x5b\xbf\x0c\xc2\x93\x58\x7f\x1c\x36\x35\x55\x5c\x27\x79\x65"
+      "\x98\xd4\x7e\x57\x90\x71\xbf\x42\x7e\x9d\x8f\xbe\x84\x2a\xba"
+      "\x34\xd9" },
+    { 16, 48,
+      "\xc3\x39\xd7\x04\xec\x23\x5f\x27\x69\x0d\x3f\x12\x16\x7c\x05"
+      "\xa5\x5b\xf8\x6d\x57\x2f\x27\x0a\xdb\xf9\xfe\x04\xc3\x79\xda"
+      "\x5f\x8c\x79\x42\xa9\x39\x24\x5d\xbb\x39\xeb\xe2\x6f\xc2\xbd"
+      "\x19\xb8\x8b" },
+    { 3, 64,
+      "\xcc\x1d\xb5\x2f\x08\xdc\x02\x09\x75\xff\x35\x93\xa9\xdd\x62"
+      "\x87\xf5\xd3\x91\xed\xd4\x3a\xa7\x25\xee\xb6\xa0\xd5\x8f\x11"
+      "\xe1\xc6\x5e\xa1\xe0\x12\xb6\x91\x80\x50\x44\x94\xb1\x59\xa7"
+      "\xc8\xb2\xc5\x09\xc4\x60\x40\x5f\x53\xdf\xe1\xbf\x88\xb4\x85"
+      "\x12\xeb\x28\x11" },
+};
+
+static void torture_crypto_bcrypt_pbkdf(void **state)
+{
+    uint8_t output[64];
+    size_t i;
+    int rc;
+    (void)state;
+
+    for (i = 0; i < sizeof(bcrypt_pbkdf_vectors) / sizeof(bcrypt_pbkdf_vectors[0]); i++) {
+        memset(output, 0, sizeof(output));
+        rc = bcrypt_pbkdf("password", 8,
+                          (const uint8_t *)"salt", 4,
+                          output,
+                          bcrypt_pbkdf_vectors[i].keylen,
+                          bcrypt_pbkdf_vectors[i].rounds);
+        assert_int_equal(rc, 0);
+        assert_memory_equal(output,
+                            bcrypt_pbkdf_vectors[i].key,
+                            bcrypt_pbkdf_vectors[i].keylen);
+    }
+
+    /* nothing crazy */
+    rc = bcrypt_pbkdf("password", 8, (const uint8_t *)"salt", 4, output, 32, 0);
+    assert_int_equal(rc, -1);
+    rc = bcrypt_pbkdf("password", 8, (const uint8_t *)"salt", 4, output, 0, 4);
+    assert_int_equal(rc, -1);
+}
+
 int torture_run_tests(void) {
     int rc;
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(torture_crypto_aes256_cbc),
+        cmocka_unit_test(torture_crypto_bcrypt_pbkdf),
     };
 
     ssh_init();
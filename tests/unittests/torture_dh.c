@@ -0,0 +1,120 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "libssh/priv.h"
+#include "libssh/session.h"
+#include "libssh/crypto.h"
+#include "libssh/dh.h"
+#include "libssh/bignum.h"
+
+static int setup(void **state)
+{
+    ssh_session session = ssh_new();
+
+    assert_non_null(session);
+    *state = session;
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    ssh_free(*state);
+
+    return 0;
+}
+
+/* The public value must be the same with or without the precomputations */
+static void assert_pubkey(ssh_session session, bignum secret)
+{
+    struct ssh_crypto_struct *crypto = session->next_crypto;
+    bignum_CTX ctx = bignum_ctx_new();
+    bignum expected = bignum_new();
+    bignum pubkey = bignum_new();
+    int rc;
+
+    assert_false(bignum_ctx_invalid(ctx));
+    assert_non_null(expected);
+    assert_non_null(pubkey);
+
+    rc = bignum_mod_exp(expected, crypto->g, secret, crypto->p, ctx);
+    assert_int_equal(rc, 1);
+
+    rc = ssh_dh_compute_pubkey(crypto, secret, pubkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(bignum_cmp(expected, pubkey), 0);
+
+    bignum_safe_free(expected);
+    bignum_safe_free(pubkey);
+    bignum_ctx_free(ctx);
+}
+
+static void torture_dh_compute_pubkey(void **state)
+{
+    ssh_session session = *state;
+    struct ssh_crypto_struct *crypto = session->next_crypto;
+    enum ssh_key_exchange_e groups[] = {
+        SSH_KEX_DH_GROUP1_SHA1,
+        SSH_KEX_DH_GROUP14_SHA1,
+        SSH_KEX_DH_GROUP16_SHA512,
+        SSH_KEX_DH_GROUP18_SHA512,
+    };
+    bignum secret;
+    size_t i;
+    int rc;
+    int j;
+
+    for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+        crypto->kex_type = groups[i];
+        rc = ssh_dh_init_common(session);
+        assert_int_equal(rc, SSH_OK);
+
+        for (j = 0; j < 4; j++) {
+            rc = ssh_dh_generate_secret(session, crypto->x);
+            assert_int_equal(rc, SSH_OK);
+            assert_pubkey(session, crypto->x);
+        }
+
+        secret = bignum_new();
+        assert_non_null(secret);
+
+        /* the corners of the comb */
+        rc = bignum_set_word(secret, 0);
+        assert_int_equal(rc, 1);
+        assert_pubkey(session, secret);
+
+        rc = bignum_set_word(secret, 1);
+        assert_int_equal(rc, 1);
+        assert_pubkey(session, secret);
+
+        rc = bignum_rand(secret, 1024);
+        assert_int_equal(rc, 1);
+        assert_pubkey(session, secret);
+
+        /* and larger exponents than the tables cover */
+        rc = bignum_rand(secret, 1025);
+        assert_int_equal(rc, 1);
+        assert_pubkey(session, secret);
+
+        bignum_safe_free(secret);
+        bignum_safe_free(crypto->k);
+        ssh_dh_cleanup(crypto);
+    }
+}
+
+int torture_run_tests(void) {
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_dh_compute_pubkey,
+                                        setup,
+                                        teardown),
+    };
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+    return rc;
+}
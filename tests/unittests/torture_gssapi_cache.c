@@ -0,0 +1,363 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "gssapi.c"
+
+/*
+ * The functions of the GSSAPI library reaching the credentials cache and the
+ * KDC are replaced here, the others are the ones of the library.
+ */
+static gss_OID_desc krb5_mech = {
+    9, (void *)"\x2a\x86\x48\x86\xf7\x12\x01\x02\x02"
+};
+static char fake_name;
+static char fake_ctx;
+
+/* the lifetime the credentials are acquired with */
+static OM_uint32 cred_lifetime;
+static int cred_acquired;
+static int cred_live;
+static int contexts;
+
+OM_uint32 gss_import_name(OM_uint32 *min_stat,
+                          gss_buffer_t name,
+                          gss_OID name_type,
+                          gss_name_t *output_name)
+{
+    (void)name;
+    (void)name_type;
+
+    *min_stat = 0;
+    *output_name = (gss_name_t)&fake_name;
+
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32 gss_release_name(OM_uint32 *min_stat, gss_name_t *name)
+{
+    *min_stat = 0;
+    *name = GSS_C_NO_NAME;
+
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32 gss_acquire_cred(OM_uint32 *min_stat,
+                           gss_name_t desired_name,
+                           OM_uint32 time_req,
+                           gss_OID_set desired_mechs,
+                           gss_cred_usage_t cred_usage,
+                           gss_cred_id_t *output_cred,
+                           gss_OID_set *actual_mechs,
+                           OM_uint32 *time_rec)
+{
+    (void)desired_name;
+    (void)time_req;
+    (void)desired_mechs;
+    (void)cred_usage;
+    (void)time_rec;
+
+    *output_cred = malloc(1);
+    assert_non_null(*output_cred);
+    gss_create_empty_oid_set(min_stat, actual_mechs);
+    gss_add_oid_set_member(min_stat, &krb5_mech, actual_mechs);
+    cred_acquired++;
+    cred_live++;
+
+    *min_stat = 0;
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32 gss_release_cred(OM_uint32 *min_stat, gss_cred_id_t *cred)
+{
+    *min_stat = 0;
+    if (*cred != GSS_C_NO_CREDENTIAL) {
+        free(*cred);
+        *cred = GSS_C_NO_CREDENTIAL;
+        cred_live--;
+    }
+
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32 gss_inquire_cred_by_mech(OM_uint32 *min_stat,
+                                   gss_cred_id_t cred,
+                                   gss_OID mech_type,
+                                   gss_name_t *name,
+                                   OM_uint32 *initiator_lifetime,
+                                   OM_uint32 *acceptor_lifetime,
+                                   gss_cred_usage_t *cred_usage)
+{
+    (void)cred;
+    (void)mech_type;
+    (void)name;
+    (void)acceptor_lifetime;
+    (void)cred_usage;
+
+    *min_stat = 0;
+    *initiator_lifetime = cred_lifetime;
+
+    return GSS_S_COMPLETE;
+}
+
+OM_uint32 gss_init_sec_context(OM_uint32 *min_stat,
+                               gss_cred_id_t cred,
+                               gss_ctx_id_t *ctx,
+                               gss_name_t target_name,
+                               gss_OID mech_type,
+                               OM_uint32 req_flags,
+                               OM_uint32 time_req,
+                               gss_channel_bindings_t bindings,
+                               gss_buffer_t input_token,
+                               gss_OID *actual_mech_type,
+                               gss_buffer_t output_token,
+                               OM_uint32 *ret_flags,
+                               OM_uint32 *time_rec)
+{
+    (void)target_name;
+    (void)mech_type;
+    (void)req_flags;
+    (void)time_req;
+    (void)bindings;
+    (void)input_token;
+    (void)actual_mech_type;
+    (void)ret_flags;
+    (void)time_rec;
+
+    assert_ptr_not_equal(cred, GSS_C_NO_CREDENTIAL);
+    contexts++;
+    *ctx = (gss_ctx_id_t)&fake_ctx;
+    output_token->length = 0;
+    output_token->value = NULL;
+
+    *min_stat = 0;
+    return GSS_S_CONTINUE_NEEDED;
+}
+
+OM_uint32 gss_delete_sec_context(OM_uint32 *min_stat,
+                                 gss_ctx_id_t *ctx,
+                                 gss_buffer_t output_token)
+{
+    (void)output_token;
+
+    *min_stat = 0;
+    *ctx = GSS_C_NO_CONTEXT;
+
+    return GSS_S_COMPLETE;
+}
+
+static int setup(void **state)
+{
+    ssh_session session;
+
+    cred_lifetime = 36000;
+    cred_acquired = 0;
+    cred_live = 0;
+    contexts = 0;
+
+    session = ssh_new();
+    assert_non_null(session);
+    ssh_options_set(session, SSH_OPTIONS_HOST, "server.example.com");
+
+    *state = session;
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    ssh_session session = *state;
+
+    ssh_free(session);
+    ssh_gssapi_cache_flush();
+    assert_int_equal(cred_live, 0);
+
+    return 0;
+}
+
+static void torture_gssapi_cache_hit_miss(void **state)
+{
+    ssh_session session = *state;
+    ssh_session other;
+    int rc;
+
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_OK);
+    /* acquired once, a context for each */
+    assert_int_equal(cred_acquired, 1);
+    assert_int_equal(contexts, 2);
+
+    /* another identity has credentials of its own */
+    other = ssh_new();
+    assert_non_null(other);
+    ssh_options_set(other, SSH_OPTIONS_HOST, "server.example.com");
+    ssh_options_set(other, SSH_OPTIONS_GSSAPI_CLIENT_IDENTITY,
+                    "alice@EXAMPLE.COM");
+    rc = ssh_gssapi_prefetch(other);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cred_acquired, 2);
+    rc = ssh_gssapi_prefetch(other);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cred_acquired, 2);
+    ssh_free(other);
+
+    /* acquired again once forgotten */
+    ssh_gssapi_cache_flush();
+    assert_int_equal(cred_live, 0);
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cred_acquired, 3);
+}
+
+static void torture_gssapi_cache_expiry(void **state)
+{
+    ssh_session session = *state;
+    struct ssh_gssapi_cached_creds *c = NULL;
+    struct ssh_gssapi_cached_creds *d = NULL;
+
+    c = ssh_gssapi_cache_lookup(session);
+    assert_non_null(c);
+    assert_int_equal(cred_acquired, 1);
+
+    /* kept until the margin before they expire */
+    c->expires = time(NULL) + SSH_GSSAPI_CACHE_MARGIN + 10;
+    d = ssh_gssapi_cache_lookup(session);
+    assert_ptr_equal(d, c);
+    assert_int_equal(cred_acquired, 1);
+    ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+    ssh_gssapi_cached_creds_unref(d);
+    ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+
+    c->expires = time(NULL) + SSH_GSSAPI_CACHE_MARGIN;
+    d = ssh_gssapi_cache_lookup(session);
+    assert_non_null(d);
+    assert_ptr_not_equal(d, c);
+    assert_int_equal(cred_acquired, 2);
+
+    /* the reference held on the evicted ones keeps them alive */
+    assert_int_equal(cred_live, 2);
+    ssh_mutex_lock(&ssh_gssapi_cache_mutex);
+    ssh_gssapi_cached_creds_unref(c);
+    ssh_gssapi_cached_creds_unref(d);
+    ssh_mutex_unlock(&ssh_gssapi_cache_mutex);
+    assert_int_equal(cred_live, 1);
+
+    /* never cached when acquired within the margin */
+    ssh_gssapi_cache_flush();
+    cred_lifetime = SSH_GSSAPI_CACHE_MARGIN / 2;
+    assert_int_equal(ssh_gssapi_prefetch(session), SSH_OK);
+    assert_int_equal(ssh_gssapi_prefetch(session), SSH_OK);
+    assert_int_equal(cred_acquired, 4);
+}
+
+static void torture_gssapi_cache_full(void **state)
+{
+    ssh_session session = *state;
+    char identity[32];
+    int i;
+    int rc;
+
+    /* the first identity expires first */
+    for (i = 0; i < SSH_GSSAPI_CACHE_SIZE; i++) {
+        cred_lifetime = 1000 + i;
+        snprintf(identity, sizeof(identity), "user%d@EXAMPLE.COM", i);
+        ssh_options_set(session, SSH_OPTIONS_GSSAPI_CLIENT_IDENTITY, identity);
+        rc = ssh_gssapi_prefetch(session);
+        assert_int_equal(rc, SSH_OK);
+    }
+    assert_int_equal(cred_live, SSH_GSSAPI_CACHE_SIZE);
+
+    cred_lifetime = 5000;
+    ssh_options_set(session, SSH_OPTIONS_GSSAPI_CLIENT_IDENTITY,
+                    "newcomer@EXAMPLE.COM");
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cred_live, SSH_GSSAPI_CACHE_SIZE);
+    assert_null(ssh_gssapi_cache_get("user0@EXAMPLE.COM"));
+
+    /* the others are still there */
+    ssh_options_set(session, SSH_OPTIONS_GSSAPI_CLIENT_IDENTITY,
+                    "user1@EXAMPLE.COM");
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cred_acquired, SSH_GSSAPI_CACHE_SIZE + 1);
+}
+
+static void torture_gssapi_cache_session_ref(void **state)
+{
+    ssh_session session = *state;
+    ssh_session user;
+    gss_OID_set mechs = GSS_C_NO_OID_SET;
+    OM_uint32 min_stat;
+    int rc;
+
+    /* as ssh_userauth_gssapi() takes them */
+    user = ssh_new();
+    assert_non_null(user);
+    rc = ssh_gssapi_init(user);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_gssapi_match(user, &mechs);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(mechs->count, 1);
+    gss_release_oid_set(&min_stat, &mechs);
+
+    /* the session keeps using them once the cache forgot them */
+    ssh_gssapi_cache_flush();
+    assert_int_equal(cred_live, 1);
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cred_live, 2);
+
+    ssh_free(user);
+    assert_int_equal(cred_live, 1);
+}
+
+static void torture_gssapi_cache_expired(void **state)
+{
+    ssh_session session = *state;
+    int rc;
+
+    /* an expired TGT: acquired, but no mechanism has a lifetime left */
+    cred_lifetime = 0;
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_ERROR);
+    assert_int_equal(cred_live, 0);
+
+    /* after a kinit */
+    cred_lifetime = 36000;
+    rc = ssh_gssapi_prefetch(session);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cred_acquired, 2);
+}
+
+int torture_run_tests(void)
+{
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_gssapi_cache_hit_miss,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_gssapi_cache_expiry,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_gssapi_cache_full,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_gssapi_cache_session_ref,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_gssapi_cache_expired,
+                                        setup,
+                                        teardown),
+    };
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+
+    return rc;
+}
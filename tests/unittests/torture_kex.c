@@ -0,0 +1,108 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "libssh/priv.h"
+#include "libssh/kex.h"
+
+static void torture_kex_find_matching(void **state)
+{
+    char *match;
+
+    (void)state;
+
+    match = ssh_find_matching("aes128-ctr,aes256-ctr", "aes256-ctr,aes128-ctr");
+    assert_non_null(match);
+    assert_string_equal(match, "aes256-ctr");
+    SAFE_FREE(match);
+
+    /* a prefix of an algorithm is not a match */
+    match = ssh_find_matching("hmac-sha2-256-etm@openssh.com,hmac-sha1",
+                              "hmac-sha2-256,hmac-sha1");
+    assert_non_null(match);
+    assert_string_equal(match, "hmac-sha1");
+    SAFE_FREE(match);
+
+    match = ssh_find_matching("aes128-ctr", "aes256-ctr");
+    assert_null(match);
+
+    match = ssh_find_matching("", "");
+    assert_non_null(match);
+    assert_string_equal(match, "");
+    SAFE_FREE(match);
+
+    match = ssh_find_matching(NULL, "aes256-ctr");
+    assert_null(match);
+}
+
+static void torture_kex_algo_id(void **state)
+{
+    int id;
+
+    (void)state;
+
+    id = ssh_kex_algo_id("ssh-ed25519", strlen("ssh-ed25519"));
+    assert_true(id >= 0);
+    assert_string_equal(ssh_kex_algo_name(id), "ssh-ed25519");
+
+    /* only the given length is compared */
+    assert_int_equal(ssh_kex_algo_id("ssh-rsa,ssh-dss", 7),
+                     ssh_kex_algo_id("ssh-rsa", 7));
+
+    assert_int_equal(ssh_kex_algo_id("ssh-ed2551", 10), -1);
+    assert_int_equal(ssh_kex_algo_id("", 0), -1);
+    assert_null(ssh_kex_algo_name(-1));
+    assert_null(ssh_kex_algo_name(SSH_KEX_ALGO_MAX));
+}
+
+static void torture_kex_algos_parse(void **state)
+{
+    struct ssh_kex_algos algos;
+    int i;
+
+    (void)state;
+
+    ssh_kex_algos_parse(&algos,
+                        "aes256-ctr,unknown@example.com,aes128-ctr,aes256-ctr");
+    assert_int_equal(algos.count, 2);
+    assert_string_equal(ssh_kex_algo_name(algos.ids[0]), "aes256-ctr");
+    assert_string_equal(ssh_kex_algo_name(algos.ids[1]), "aes128-ctr");
+
+    ssh_kex_algos_parse(&algos, "");
+    assert_int_equal(algos.count, 0);
+    assert_int_equal(algos.set, 0);
+
+    ssh_kex_algos_parse(&algos, NULL);
+    assert_int_equal(algos.count, 0);
+
+    /* every supported method must be known */
+    for (i = 0; i < SSH_LANG_C_S; i++) {
+        const char *list = ssh_kex_get_supported_method(i);
+        const char *p;
+        int names = 1;
+
+        for (p = list; *p != '\0'; p++) {
+            if (*p == ',') {
+                names++;
+            }
+        }
+        ssh_kex_algos_parse(&algos, list);
+        assert_int_equal(algos.count, names);
+    }
+}
+
+int torture_run_tests(void) {
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test(torture_kex_find_matching),
+        cmocka_unit_test(torture_kex_algo_id),
+        cmocka_unit_test(torture_kex_algos_parse),
+    };
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+    return rc;
+}
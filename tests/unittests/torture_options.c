@@ -13,6 +13,9 @@
 #include <libssh/misc.h>
 #include <libssh/pki_priv.h>
 #include <libssh/options.h>
+#ifdef WITH_SERVER
+#include <libssh/bind.h>
+#endif
 
 static int setup(void **state)
 {
@@ -731,7 +734,78 @@ static void torture_options_copy(void **state)
     ssh_free(new);
 }
 
+static void torture_options_template(void **state)
+{
+    ssh_session session = *state, a = NULL, b = NULL;
+    ssh_session_template tmpl = NULL;
+    ssh_key privkey = NULL, pubkey = NULL;
+    const char *knownhosts = NULL;
+    bool process_config = false;
+    int rv;
+
+    torture_write_file("template_id_ed25519",
+                       torture_get_openssh_testkey(SSH_KEYTYPE_ED25519, 0, 0));
+
+    rv = ssh_options_set(session, SSH_OPTIONS_HOST, "example");
+    assert_ssh_return_code(session, rv);
+    rv = ssh_options_set(session, SSH_OPTIONS_PROCESS_CONFIG, &process_config);
+    assert_ssh_return_code(session, rv);
+    rv = ssh_options_set(session, SSH_OPTIONS_KNOWNHOSTS, "%d/known_hosts2");
+    assert_ssh_return_code(session, rv);
+    rv = ssh_options_set(session, SSH_OPTIONS_PROXYCOMMAND, "nc %h %p");
+    assert_ssh_return_code(session, rv);
+    rv = ssh_options_set(session, SSH_OPTIONS_ADD_IDENTITY,
+                         "template_id_ed25519");
+    assert_ssh_return_code(session, rv);
 
+    tmpl = ssh_session_template_new(session);
+    assert_non_null(tmpl);
+
+    a = ssh_new_from_template(tmpl);
+    assert_non_null(a);
+    b = ssh_new_from_template(tmpl);
+    assert_non_null(b);
+
+    /* The sessions keep the template alive */
+    ssh_session_template_free(tmpl);
+
+    /* The resolved options are shared, the host specific ones expanded later */
+    assert_ptr_equal(a->opts.host, b->opts.host);
+    assert_ptr_equal(a->opts.knownhosts, b->opts.knownhosts);
+    assert_null(strchr(a->opts.knownhosts, '%'));
+    assert_string_equal(a->opts.ProxyCommand, "nc %h %p");
+    assert_true(a->opts.config_processed);
+
+    /* Changing an option does not touch the other sessions */
+    rv = ssh_options_set(a, SSH_OPTIONS_HOST, "other");
+    assert_ssh_return_code(a, rv);
+    assert_string_equal(a->opts.host, "other");
+    assert_string_equal(b->opts.host, "example");
+
+    knownhosts = a->opts.knownhosts;
+    rv = ssh_options_apply(a);
+    assert_int_equal(rv, 0);
+    assert_ptr_equal(a->opts.knownhosts, knownhosts);
+    assert_string_equal(a->opts.ProxyCommand, "nc other 22");
+
+    /* The identity was read by the template */
+    rv = ssh_session_template_get_identity(b, "template_id_ed25519",
+                                           &privkey, &pubkey);
+    assert_int_equal(rv, SSH_OK);
+    assert_true(ssh_key_is_private(privkey));
+    assert_false(ssh_key_is_private(pubkey));
+    assert_int_equal(ssh_key_cmp(privkey, pubkey, SSH_KEY_CMP_PUBLIC), 0);
+    SSH_KEY_FREE(privkey);
+    SSH_KEY_FREE(pubkey);
+
+    rv = ssh_session_template_get_identity(b, "template_id_missing",
+                                           &privkey, &pubkey);
+    assert_int_equal(rv, SSH_EOF);
+
+    ssh_free(a);
+    ssh_free(b);
+    unlink("template_id_ed25519");
+}
 
 #ifdef WITH_SERVER
 /* sshbind options */
@@ -790,6 +864,113 @@ static void torture_bind_options_import_key(void **state)
     rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_IMPORT_KEY, key);
     assert_int_equal(rc, 0);
 }
+
+static void torture_bind_options_admission(void **state)
+{
+    ssh_bind bind = *state;
+    ssh_session sessions[3];
+    struct sockaddr_in sin;
+    int i, rc;
+
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_MAX_STARTUPS, NULL);
+    assert_int_equal(rc, -1);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_MAX_STARTUPS, "");
+    assert_int_equal(rc, -1);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_MAX_STARTUPS, "10:30");
+    assert_int_equal(rc, -1);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_MAX_STARTUPS, "10:130:60");
+    assert_int_equal(rc, -1);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_MAX_STARTUPS, "60:30:10");
+    assert_int_equal(rc, -1);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_SOURCE_LIMIT, "5");
+    assert_int_equal(rc, -1);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_SOURCE_LIMIT, "5:0");
+    assert_int_equal(rc, -1);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_SOURCE_LIMIT, "5:x");
+    assert_int_equal(rc, -1);
+
+    for (i = 0; i < 3; i++) {
+        sessions[i] = ssh_new();
+        assert_non_null(sessions[i]);
+    }
+
+    /* two connections a minute from a source */
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_SOURCE_LIMIT, "2:60");
+    assert_int_equal(rc, 0);
+
+    ZERO_STRUCT(sin);
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(0x7f000002);
+    for (i = 0; i < 2; i++) {
+        rc = ssh_bind_admit(bind, sessions[i], SSH_INVALID_SOCKET,
+                            (struct sockaddr *)&sin);
+        assert_int_equal(rc, SSH_OK);
+    }
+    rc = ssh_bind_admit(bind, sessions[2], SSH_INVALID_SOCKET,
+                        (struct sockaddr *)&sin);
+    assert_int_equal(rc, SSH_ERROR);
+    assert_int_equal(ssh_get_error_code(bind), SSH_REQUEST_DENIED);
+    sin.sin_addr.s_addr = htonl(0x7f000003);
+    rc = ssh_bind_admit(bind, sessions[2], SSH_INVALID_SOCKET,
+                        (struct sockaddr *)&sin);
+    assert_int_equal(rc, SSH_OK);
+
+    for (i = 0; i < 3; i++) {
+        ssh_bind_admission_release(sessions[i]);
+    }
+
+    /* no more than two sessions which did not authenticate yet */
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_SOURCE_LIMIT, "0");
+    assert_int_equal(rc, 0);
+    rc = ssh_bind_options_set(bind, SSH_BIND_OPTIONS_MAX_STARTUPS, "2");
+    assert_int_equal(rc, 0);
+
+    for (i = 0; i < 2; i++) {
+        rc = ssh_bind_admit(bind, sessions[i], SSH_INVALID_SOCKET,
+                            (struct sockaddr *)&sin);
+        assert_int_equal(rc, SSH_OK);
+    }
+    rc = ssh_bind_admit(bind, sessions[2], SSH_INVALID_SOCKET,
+                        (struct sockaddr *)&sin);
+    assert_int_equal(rc, SSH_ERROR);
+
+    /* a session freed, or authenticated, leaves its place */
+    ssh_free(sessions[0]);
+    rc = ssh_bind_admit(bind, sessions[2], SSH_INVALID_SOCKET,
+                        (struct sockaddr *)&sin);
+    assert_int_equal(rc, SSH_OK);
+
+    /* a session handed to a child keeps its place until it is done */
+    rc = ssh_bind_admission_detach(sessions[1]);
+    assert_int_equal(rc, SSH_OK);
+    ssh_free(sessions[1]);
+    sessions[1] = ssh_new();
+    assert_non_null(sessions[1]);
+    rc = ssh_bind_admission_detach(sessions[1]);
+    assert_int_equal(rc, SSH_ERROR);
+    rc = ssh_bind_admit(bind, sessions[1], SSH_INVALID_SOCKET,
+                        (struct sockaddr *)&sin);
+    assert_int_equal(rc, SSH_ERROR);
+    ssh_bind_admission_done(bind);
+    rc = ssh_bind_admit(bind, sessions[1], SSH_INVALID_SOCKET,
+                        (struct sockaddr *)&sin);
+    assert_int_equal(rc, SSH_OK);
+
+    /* nothing is released for the sessions which were not detached */
+    ssh_bind_admission_done(bind);
+    sessions[0] = ssh_new();
+    assert_non_null(sessions[0]);
+    rc = ssh_bind_admit(bind, sessions[0], SSH_INVALID_SOCKET,
+                        (struct sockaddr *)&sin);
+    assert_int_equal(rc, SSH_ERROR);
+    ssh_free(sessions[0]);
+
+    /* the sessions may outlive the bind */
+    ssh_bind_free(bind);
+    *state = NULL;
+    ssh_free(sessions[1]);
+    ssh_free(sessions[2]);
+}
 #endif /* WITH_SERVER */
 
 
@@ -816,6 +997,7 @@ int torture_run_tests(void) {
         cmocka_unit_test_setup_teardown(torture_options_set_pubkey_accepted_types, setup, teardown),
         cmocka_unit_test_setup_teardown(torture_options_set_macs, setup, teardown),
         cmocka_unit_test_setup_teardown(torture_options_copy, setup, teardown),
+        cmocka_unit_test_setup_teardown(torture_options_template, setup, teardown),
         cmocka_unit_test_setup_teardown(torture_options_config_host, setup, teardown),
         cmocka_unit_test_setup_teardown(torture_options_config_match,
                                         setup, teardown)
@@ -824,6 +1006,7 @@ int torture_run_tests(void) {
 #ifdef WITH_SERVER
     struct CMUnitTest sshbind_tests[] = {
         cmocka_unit_test_setup_teardown(torture_bind_options_import_key, sshbind_setup, sshbind_teardown),
+        cmocka_unit_test_setup_teardown(torture_bind_options_admission, sshbind_setup, sshbind_teardown),
     };
 #endif /* WITH_SERVER */
 
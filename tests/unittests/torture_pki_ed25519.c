@@ -6,13 +6,15 @@
 #include "torture_key.h"
 #include "torture_pki.h"
 #include "pki.c"
+#include "libssh/messages.h"
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #define LIBSSH_ED25519_TESTKEY "libssh_testkey.id_ed25519"
 #define LIBSSH_ED25519_TESTKEY_PASSPHRASE "libssh_testkey_passphrase.id_ed25519"
 
-const char template[] = "temp_dir_XXXXXX";
+/* out of the source tree, should a run stop before the teardown */
+const char template[] = "/tmp/temp_dir_XXXXXX";
 const unsigned char HASH[] = "12345678901234567890";
 const uint8_t ref_signature[ED25519_SIG_LEN]=
     "\xbb\x8d\x55\x9f\x06\x14\x39\x24\xb4\xe1\x5a\x57\x3d\x9d\xbe\x22"
@@ -564,6 +566,262 @@ static void torture_pki_ed25519_verify_bad(void **state){
     free(pkey_ptr);
 }
 
+#define BATCH_SIZE 8
+
+static void torture_pki_ed25519_verify_batch(void **state)
+{
+    ssh_key keys[BATCH_SIZE];
+    ssh_signature sigs[BATCH_SIZE];
+    const unsigned char *hashes[BATCH_SIZE];
+    size_t hlens[BATCH_SIZE];
+    unsigned char messages[BATCH_SIZE][20];
+    int rc;
+    int i;
+    (void) state;
+
+    for (i = 0; i < BATCH_SIZE; i++) {
+        rc = ssh_pki_generate(SSH_KEYTYPE_ED25519, 256, &keys[i]);
+        assert_int_equal(rc, SSH_OK);
+
+        memcpy(messages[i], HASH, sizeof(messages[i]));
+        messages[i][0] = (unsigned char)i;
+        hashes[i] = messages[i];
+        hlens[i] = sizeof(messages[i]);
+
+        sigs[i] = pki_do_sign(keys[i], hashes[i], hlens[i]);
+        assert_non_null(sigs[i]);
+    }
+
+    rc = pki_ed25519_verify_batch(keys, sigs, hashes, hlens, BATCH_SIZE);
+    assert_int_equal(rc, SSH_OK);
+
+    rc = pki_ed25519_verify_batch(keys, sigs, hashes, hlens, 1);
+    assert_int_equal(rc, SSH_OK);
+
+    /* a wrong S */
+    (*sigs[3]->ed25519_sig)[40] ^= 0x01;
+    rc = pki_ed25519_verify_batch(keys, sigs, hashes, hlens, BATCH_SIZE);
+    assert_int_equal(rc, SSH_ERROR);
+    (*sigs[3]->ed25519_sig)[40] ^= 0x01;
+
+    /* a wrong R */
+    (*sigs[5]->ed25519_sig)[2] ^= 0x01;
+    rc = pki_ed25519_verify_batch(keys, sigs, hashes, hlens, BATCH_SIZE);
+    assert_int_equal(rc, SSH_ERROR);
+    (*sigs[5]->ed25519_sig)[2] ^= 0x01;
+
+    /* a signature of another message */
+    hashes[6] = messages[7];
+    rc = pki_ed25519_verify_batch(keys, sigs, hashes, hlens, BATCH_SIZE);
+    assert_int_equal(rc, SSH_ERROR);
+    hashes[6] = messages[6];
+
+    rc = pki_ed25519_verify_batch(keys, sigs, hashes, hlens, BATCH_SIZE);
+    assert_int_equal(rc, SSH_OK);
+
+    for (i = 0; i < BATCH_SIZE; i++) {
+        ssh_signature_free(sigs[i]);
+        SSH_KEY_FREE(keys[i]);
+    }
+}
+
+static void torture_pki_ed25519_import_privkey_file_cached(void **state)
+{
+    const char *passphrase = torture_get_testkey_passphrase();
+    ssh_key_cache cache = NULL;
+    ssh_key origkey = NULL;
+    ssh_key privkey = NULL;
+    int rc;
+
+    (void) state; /* unused */
+
+    cache = ssh_key_cache_new(1);
+    assert_non_null(cache);
+
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            passphrase,
+                                            NULL,
+                                            NULL,
+                                            &origkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_non_null(origkey);
+
+    /* from the cache */
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            passphrase,
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_non_null(privkey);
+    assert_ptr_not_equal(privkey, origkey);
+    rc = ssh_key_cmp(origkey, privkey, SSH_KEY_CMP_PRIVATE);
+    assert_int_equal(rc, 0);
+    SSH_KEY_FREE(privkey);
+
+    /* the passphrase must still be the right one */
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            "invalid secret",
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_ERROR);
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            NULL,
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_ERROR);
+
+    /* a changed file is loaded again */
+    torture_write_file(LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                       torture_get_openssh_testkey(SSH_KEYTYPE_ED25519, 0, 0));
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            passphrase,
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_non_null(privkey);
+    SSH_KEY_FREE(privkey);
+
+    /* another file takes the only entry */
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY,
+                                            NULL,
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_non_null(privkey);
+    SSH_KEY_FREE(privkey);
+
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            "no_such_key",
+                                            NULL,
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_EOF);
+
+    SSH_KEY_FREE(origkey);
+    ssh_key_cache_free(cache);
+}
+
+static int cached_auth_calls;
+
+static int cached_auth_fn(const char *prompt,
+                          char *buf,
+                          size_t len,
+                          int echo,
+                          int verify,
+                          void *userdata)
+{
+    (void) prompt;
+    (void) echo;
+    (void) verify;
+    (void) userdata;
+
+    cached_auth_calls++;
+    snprintf(buf, len, "%s", torture_get_testkey_passphrase());
+
+    return 0;
+}
+
+static void torture_pki_ed25519_import_privkey_file_cached_auth_fn(void **state)
+{
+    const char *passphrase = torture_get_testkey_passphrase();
+    ssh_key_cache cache = NULL;
+    ssh_key origkey = NULL;
+    ssh_key privkey = NULL;
+    char *keystring = NULL;
+    size_t middle;
+    int rc;
+
+    (void) state; /* unused */
+
+    cache = ssh_key_cache_new(2);
+    assert_non_null(cache);
+
+    cached_auth_calls = 0;
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            NULL,
+                                            cached_auth_fn,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cached_auth_calls, 1);
+    SSH_KEY_FREE(privkey);
+
+    /* a caller without the passphrase does not get the key */
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            NULL,
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_ERROR);
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            NULL,
+                                            cached_auth_fn,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cached_auth_calls, 2);
+    SSH_KEY_FREE(privkey);
+
+    /* the key is cached under the passphrase auth_fn returned */
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY_PASSPHRASE,
+                                            passphrase,
+                                            cached_auth_fn,
+                                            NULL,
+                                            &privkey);
+    assert_int_equal(rc, SSH_OK);
+    assert_int_equal(cached_auth_calls, 2);
+    SSH_KEY_FREE(privkey);
+
+    /* a rewrite of the same size, likely within the same second */
+    torture_write_file(LIBSSH_ED25519_TESTKEY,
+                       torture_get_openssh_testkey(SSH_KEYTYPE_ED25519, 0, 0));
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY,
+                                            NULL,
+                                            NULL,
+                                            NULL,
+                                            &origkey);
+    assert_int_equal(rc, SSH_OK);
+
+    keystring = strdup(torture_get_openssh_testkey(SSH_KEYTYPE_ED25519, 0, 0));
+    assert_non_null(keystring);
+    middle = strlen(keystring) / 2;
+    keystring[middle] = keystring[middle] == 'A' ? 'B' : 'A';
+    torture_write_file(LIBSSH_ED25519_TESTKEY, keystring);
+    free(keystring);
+
+    rc = ssh_pki_import_privkey_file_cached(cache,
+                                            LIBSSH_ED25519_TESTKEY,
+                                            NULL,
+                                            NULL,
+                                            NULL,
+                                            &privkey);
+    if (rc == SSH_OK) {
+        rc = ssh_key_cmp(origkey, privkey, SSH_KEY_CMP_PRIVATE);
+        assert_int_not_equal(rc, 0);
+        SSH_KEY_FREE(privkey);
+    }
+
+    SSH_KEY_FREE(origkey);
+    ssh_key_cache_free(cache);
+}
+
 static void torture_pki_ed25519_import_privkey_base64_passphrase(void **state)
 {
     int rc;
@@ -598,6 +856,150 @@ static void torture_pki_ed25519_import_privkey_base64_passphrase(void **state)
     SSH_KEY_FREE(key);
 }
 
+#ifdef WITH_SERVER
+/* Hold a signed publickey request of the session in its queue */
+static ssh_message queue_request(ssh_session session,
+                                 const ssh_key privkey,
+                                 int tamper)
+{
+    ssh_message msg;
+    ssh_signature sig;
+    ssh_buffer digest;
+    int rc;
+
+    msg = calloc(1, sizeof(struct ssh_message_struct));
+    assert_non_null(msg);
+    msg->session = session;
+    msg->type = SSH_REQUEST_AUTH;
+    msg->auth_request.method = SSH_AUTH_METHOD_PUBLICKEY;
+    rc = ssh_pki_export_privkey_to_pubkey(privkey, &msg->auth_request.pubkey);
+    assert_int_equal(rc, SSH_OK);
+
+    digest = ssh_buffer_new();
+    assert_non_null(digest);
+    rc = ssh_buffer_add_data(digest, HASH, sizeof(HASH));
+    assert_int_equal(rc, SSH_OK);
+
+    sig = pki_do_sign(privkey, HASH, sizeof(HASH));
+    assert_non_null(sig);
+    if (tamper) {
+        (*sig->ed25519_sig)[40] ^= 0x01;
+    }
+
+    ssh_verify_queue_push(session->srv.verify_queue, msg, sig, digest);
+
+    return msg;
+}
+
+static int queued_messages(ssh_session session)
+{
+    if (session->ssh_message_list == NULL) {
+        return 0;
+    }
+
+    return (int)ssh_list_count(session->ssh_message_list);
+}
+
+/* Frees another session of the queue as a request is resumed */
+static int free_session_cb(ssh_session session, ssh_message msg, void *data)
+{
+    ssh_session *other = data;
+    (void) session;
+    (void) msg;
+
+    ssh_free(*other);
+    *other = NULL;
+
+    return 0;
+}
+
+static void torture_pki_ed25519_verify_queue(void **state)
+{
+    ssh_verify_queue queue;
+    ssh_session sessions[4];
+    ssh_message first, second;
+    ssh_key privkey;
+    int rc;
+    int i;
+    (void) state;
+
+    rc = ssh_pki_generate(SSH_KEYTYPE_ED25519, 256, &privkey);
+    assert_int_equal(rc, SSH_OK);
+
+    queue = ssh_verify_queue_new(4);
+    assert_non_null(queue);
+    for (i = 0; i < 4; i++) {
+        sessions[i] = ssh_new();
+        assert_non_null(sessions[i]);
+        rc = ssh_set_verify_queue(sessions[i], queue);
+        assert_int_equal(rc, SSH_OK);
+    }
+
+    /* held until flushed */
+    first = queue_request(sessions[0], privkey, 0);
+    queue_request(sessions[1], privkey, 0);
+    assert_int_equal(ssh_verify_queue_pending(queue), 2);
+    assert_int_equal(queued_messages(sessions[0]), 0);
+
+    /* a second request of a session flushes the first one before */
+    second = queue_request(sessions[0], privkey, 0);
+    assert_int_equal(ssh_verify_queue_pending(queue), 1);
+    assert_int_equal(queued_messages(sessions[0]), 1);
+    assert_int_equal(queued_messages(sessions[1]), 1);
+
+    rc = ssh_verify_queue_flush(queue);
+    assert_int_equal(rc, 1);
+    assert_int_equal(queued_messages(sessions[0]), 2);
+    assert_ptr_equal(ssh_message_get(sessions[0]), first);
+    assert_ptr_equal(ssh_message_get(sessions[0]), second);
+    assert_int_equal(first->auth_request.signature_state,
+                     SSH_PUBLICKEY_STATE_VALID);
+    ssh_message_free(first);
+    ssh_message_free(second);
+
+    /* a wrong signature fails the batch, only it is rejected */
+    queue_request(sessions[0], privkey, 0);
+    queue_request(sessions[1], privkey, 1);
+    queue_request(sessions[2], privkey, 0);
+    rc = ssh_verify_queue_flush(queue);
+    assert_int_equal(rc, 3);
+    assert_int_equal(queued_messages(sessions[0]), 1);
+    assert_int_equal(queued_messages(sessions[1]), 1);
+    assert_int_equal(queued_messages(sessions[2]), 1);
+
+    /* a full batch is verified at once */
+    for (i = 0; i < 4; i++) {
+        queue_request(sessions[i], privkey, 0);
+    }
+    assert_int_equal(ssh_verify_queue_pending(queue), 0);
+    assert_int_equal(queued_messages(sessions[2]), 2);
+    assert_int_equal(queued_messages(sessions[3]), 1);
+
+    /* the requests of a freed session are dropped */
+    queue_request(sessions[1], privkey, 0);
+    queue_request(sessions[2], privkey, 0);
+    assert_int_equal(ssh_verify_queue_pending(queue), 2);
+    ssh_free(sessions[1]);
+    assert_int_equal(ssh_verify_queue_pending(queue), 1);
+    rc = ssh_verify_queue_flush(queue);
+    assert_int_equal(rc, 1);
+    assert_int_equal(queued_messages(sessions[2]), 3);
+
+    /* a session freed while the batch of its request is resumed */
+    ssh_set_message_callback(sessions[0], free_session_cb, &sessions[3]);
+    queue_request(sessions[0], privkey, 0);
+    queue_request(sessions[3], privkey, 0);
+    rc = ssh_verify_queue_flush(queue);
+    assert_int_equal(rc, 2);
+    assert_null(sessions[3]);
+
+    ssh_free(sessions[0]);
+    ssh_free(sessions[2]);
+    ssh_verify_queue_free(queue);
+    SSH_KEY_FREE(privkey);
+}
+#endif /* WITH_SERVER */
+
 static void torture_pki_ed25519_privkey_dup(void **state)
 {
     const char *passphrase = torture_get_testkey_passphrase();
@@ -694,9 +1096,19 @@ int torture_run_tests(void) {
                                         setup_ed25519_key,
                                         teardown),
         cmocka_unit_test(torture_pki_ed25519_import_privkey_base64_passphrase),
+        cmocka_unit_test_setup_teardown(torture_pki_ed25519_import_privkey_file_cached,
+                                        setup_ed25519_key,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_pki_ed25519_import_privkey_file_cached_auth_fn,
+                                        setup_ed25519_key,
+                                        teardown),
         cmocka_unit_test(torture_pki_ed25519_sign),
         cmocka_unit_test(torture_pki_ed25519_verify),
         cmocka_unit_test(torture_pki_ed25519_verify_bad),
+        cmocka_unit_test(torture_pki_ed25519_verify_batch),
+#ifdef WITH_SERVER
+        cmocka_unit_test(torture_pki_ed25519_verify_queue),
+#endif
         cmocka_unit_test(torture_pki_ed25519_privkey_dup),
         cmocka_unit_test(torture_pki_ed25519_pubkey_dup),
     };
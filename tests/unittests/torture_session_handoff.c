@@ -0,0 +1,321 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "torture.h"
+#include "torture_key.h"
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+#include <libssh/callbacks.h>
+
+struct hostkey_state {
+    char *hostkey_path;
+};
+
+struct client_state {
+    socket_t fd;
+    const char *cipher;
+    int rc;
+    char received[64];
+    size_t len;
+};
+
+static int setup(void **state)
+{
+    struct hostkey_state *h;
+    mode_t mask;
+    int fd;
+
+    h = malloc(sizeof(struct hostkey_state));
+    assert_non_null(h);
+
+    h->hostkey_path = strdup("/tmp/libssh_hostkey_XXXXXX");
+    assert_non_null(h->hostkey_path);
+
+    mask = umask(S_IRWXO | S_IRWXG);
+    fd = mkstemp(h->hostkey_path);
+    umask(mask);
+    assert_return_code(fd, errno);
+    close(fd);
+
+    torture_write_file(h->hostkey_path,
+                       torture_get_openssh_testkey(SSH_KEYTYPE_ED25519, 0, 0));
+
+    *state = h;
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    struct hostkey_state *h = *state;
+
+    unlink(h->hostkey_path);
+    free(h->hostkey_path);
+    free(h);
+
+    return 0;
+}
+
+/* Sends its data before and after the handoff, and reads the echo of it */
+static void *client_thread(void *arg)
+{
+    struct client_state *c = arg;
+    ssh_session session;
+    ssh_channel channel;
+    bool process_config = false;
+    int rc;
+
+    c->rc = SSH_ERROR;
+
+    session = ssh_new();
+    if (session == NULL) {
+        return NULL;
+    }
+    ssh_options_set(session, SSH_OPTIONS_FD, &c->fd);
+    ssh_options_set(session, SSH_OPTIONS_HOST, "localhost");
+    ssh_options_set(session, SSH_OPTIONS_USER, "foo");
+    ssh_options_set(session, SSH_OPTIONS_PROCESS_CONFIG, &process_config);
+    ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, c->cipher);
+    ssh_options_set(session, SSH_OPTIONS_CIPHERS_S_C, c->cipher);
+
+    rc = ssh_connect(session);
+    if (rc != SSH_OK) {
+        goto out;
+    }
+    rc = ssh_userauth_password(session, NULL, "bar");
+    if (rc != SSH_AUTH_SUCCESS) {
+        goto out;
+    }
+
+    channel = ssh_channel_new(session);
+    if (channel == NULL) {
+        goto out;
+    }
+    if (ssh_channel_open_session(channel) != SSH_OK ||
+        ssh_channel_request_exec(channel, "cat") != SSH_OK ||
+        ssh_channel_write(channel, "libssh ", 7) != 7 ||
+        ssh_channel_write(channel, "hands over", 10) != 10 ||
+        ssh_channel_send_eof(channel) != SSH_OK) {
+        ssh_channel_free(channel);
+        goto out;
+    }
+
+    do {
+        rc = ssh_channel_read(channel,
+                              c->received + c->len,
+                              sizeof(c->received) - c->len,
+                              0);
+        if (rc > 0) {
+            c->len += rc;
+        }
+    } while (rc > 0);
+    /* the server may have closed the channel right after its end of file */
+    if (ssh_channel_is_eof(channel)) {
+        c->rc = SSH_OK;
+    }
+
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+out:
+    ssh_disconnect(session);
+    ssh_free(session);
+
+    return NULL;
+}
+
+/*
+ * The front session of a pre-fork server: key exchange, authentication and
+ * the exec request, then the first bytes are echoed before the handoff.
+ */
+static ssh_session front_accept(ssh_bind sshbind,
+                                socket_t fd,
+                                ssh_channel *channel)
+{
+    ssh_session session;
+    ssh_message msg;
+    char buf[7];
+    size_t len = 0;
+    bool exec = false;
+    int rc;
+
+    session = ssh_new();
+    assert_non_null(session);
+
+    rc = ssh_bind_accept_fd(sshbind, session, fd);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_handle_key_exchange(session);
+    assert_ssh_return_code(session, rc);
+
+    *channel = NULL;
+    while (!exec && (msg = ssh_message_get(session)) != NULL) {
+        switch (ssh_message_type(msg)) {
+        case SSH_REQUEST_AUTH:
+            ssh_message_auth_reply_success(msg, 0);
+            break;
+        case SSH_REQUEST_CHANNEL_OPEN:
+            *channel = ssh_message_channel_request_open_reply_accept(msg);
+            break;
+        case SSH_REQUEST_CHANNEL:
+            ssh_message_channel_request_reply_success(msg);
+            exec = true;
+            break;
+        default:
+            ssh_message_reply_default(msg);
+            break;
+        }
+        ssh_message_free(msg);
+    }
+    assert_true(exec);
+    assert_non_null(*channel);
+
+    while (len < sizeof(buf)) {
+        rc = ssh_channel_read(*channel, buf + len, sizeof(buf) - len, 0);
+        assert_true(rc > 0);
+        len += rc;
+    }
+    rc = ssh_channel_write(*channel, buf, sizeof(buf));
+    assert_int_equal(rc, sizeof(buf));
+
+    return session;
+}
+
+static void torture_session_handoff_cipher(void **state, const char *cipher)
+{
+    struct hostkey_state *h = *state;
+    struct client_state c;
+    pthread_t client;
+    ssh_bind sshbind;
+    ssh_session front;
+    ssh_session worker;
+    ssh_session probe;
+    ssh_channel channel;
+    ssh_channel channels[2];
+    ssh_buffer exported;
+    socket_t sockets[2];
+    socket_t fd;
+    socket_t probe_fd;
+    char buf[64];
+    int rc;
+
+    sshbind = ssh_bind_new();
+    assert_non_null(sshbind);
+    rc = ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_HOSTKEY, h->hostkey_path);
+    assert_int_equal(rc, SSH_OK);
+    /* a single unauthenticated session at a time */
+    rc = ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_MAX_STARTUPS, "1");
+    assert_int_equal(rc, SSH_OK);
+
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+    assert_return_code(rc, errno);
+
+    memset(&c, 0, sizeof(c));
+    c.fd = sockets[1];
+    c.cipher = cipher;
+    rc = pthread_create(&client, NULL, client_thread, &c);
+    assert_int_equal(rc, 0);
+
+    front = front_accept(sshbind, sockets[0], &channel);
+    assert_string_equal(ssh_get_cipher_out(front), cipher);
+
+    exported = ssh_buffer_new();
+    assert_non_null(exported);
+    do {
+        rc = ssh_session_export(front, exported);
+        if (rc == SSH_AGAIN) {
+            ssh_blocking_flush(front, 1000);
+        }
+    } while (rc == SSH_AGAIN);
+    assert_ssh_return_code(front, rc);
+
+    /* the worker gets the socket and the state, the front lets go */
+    fd = dup(sockets[0]);
+    assert_return_code(fd, errno);
+    ssh_free(front);
+
+    worker = ssh_new();
+    assert_non_null(worker);
+    rc = ssh_bind_accept_fd(sshbind, worker, fd);
+    assert_int_equal(rc, SSH_OK);
+    rc = ssh_session_import(worker, fd, exported, channels, 2);
+    assert_int_equal(rc, 1);
+    ssh_buffer_free(exported);
+
+    /* the imported session is authenticated, another one is admitted */
+    probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert_return_code(probe_fd, errno);
+    probe = ssh_new();
+    assert_non_null(probe);
+    rc = ssh_bind_accept_fd(sshbind, probe, probe_fd);
+    assert_int_equal(rc, SSH_OK);
+    ssh_free(probe);
+
+    /* echo the rest, sent before or after the handoff */
+    for (;;) {
+        rc = ssh_channel_read(channels[0], buf, sizeof(buf), 0);
+        assert_return_code(rc, 0);
+        if (rc == 0) {
+            break;
+        }
+        assert_int_equal(ssh_channel_write(channels[0], buf, rc), rc);
+    }
+    ssh_channel_send_eof(channels[0]);
+    ssh_channel_close(channels[0]);
+
+    rc = pthread_join(client, NULL);
+    assert_int_equal(rc, 0);
+    assert_int_equal(c.rc, SSH_OK);
+    assert_int_equal(c.len, 17);
+    assert_memory_equal(c.received, "libssh hands over", 17);
+
+    ssh_channel_free(channels[0]);
+    ssh_free(worker);
+    ssh_bind_free(sshbind);
+}
+
+static void torture_session_handoff_aes256_ctr(void **state)
+{
+    torture_session_handoff_cipher(state, "aes256-ctr");
+}
+
+static void torture_session_handoff_aes256_gcm(void **state)
+{
+    torture_session_handoff_cipher(state, "aes256-gcm@openssh.com");
+}
+
+static void torture_session_handoff_chacha20(void **state)
+{
+    torture_session_handoff_cipher(state, "chacha20-poly1305@openssh.com");
+}
+
+int torture_run_tests(void)
+{
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_session_handoff_aes256_ctr,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_session_handoff_aes256_gcm,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_session_handoff_chacha20,
+                                        setup,
+                                        teardown),
+    };
+
+    ssh_threads_set_callbacks(ssh_threads_get_pthread());
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+
+    return rc;
+}
@@ -0,0 +1,223 @@
+#include "config.h"
+
+#define LIBSSH_STATIC
+
+#include "torture.h"
+#include "sftp.c"
+
+#define LONGNAME "-rw-r--r--    1 alice    users          42 Jan  1 00:00 file"
+
+struct attr_state {
+    struct sftp_session_struct sftp;
+    ssh_buffer buffer;
+};
+
+static int setup(void **state)
+{
+    struct attr_state *st;
+
+    st = calloc(1, sizeof(struct attr_state));
+    assert_non_null(st);
+
+    st->sftp.session = ssh_new();
+    assert_non_null(st->sftp.session);
+    st->sftp.version = 3;
+    /* owner and group are only taken from OpenSSH longnames */
+    st->sftp.session->openssh = SSH_VERSION_INT(7, 6, 0);
+
+    st->buffer = ssh_buffer_new();
+    assert_non_null(st->buffer);
+
+    *state = st;
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    struct attr_state *st = *state;
+
+    SSH_BUFFER_FREE(st->buffer);
+    ssh_free(st->sftp.session);
+    free(st);
+
+    return 0;
+}
+
+static void pack_entry(ssh_buffer buffer, const char *name, const char *longname)
+{
+    int rc;
+
+    rc = ssh_buffer_pack(buffer,
+                         "ssdqddddddssss",
+                         name,
+                         longname,
+                         SSH_FILEXFER_ATTR_SIZE |
+                         SSH_FILEXFER_ATTR_UIDGID |
+                         SSH_FILEXFER_ATTR_PERMISSIONS |
+                         SSH_FILEXFER_ATTR_ACMODTIME |
+                         SSH_FILEXFER_ATTR_EXTENDED,
+                         (uint64_t)42,
+                         1000, 100,
+                         SSH_S_IFREG | 0644,
+                         1500000000, 1500000001,
+                         2,
+                         "type@example.com", "data",
+                         "skipped@example.com", "skipped");
+    assert_int_equal(rc, SSH_OK);
+}
+
+static void torture_sftp_parse_attr_v3(void **state)
+{
+    struct attr_state *st = *state;
+    sftp_attributes attr;
+
+    pack_entry(st->buffer, "file", LONGNAME);
+    pack_entry(st->buffer, "second", LONGNAME);
+
+    attr = sftp_parse_attr(&st->sftp, st->buffer, 1);
+    assert_non_null(attr);
+
+    assert_string_equal(attr->name, "file");
+    assert_string_equal(attr->longname, LONGNAME);
+    assert_string_equal(attr->owner, "alice");
+    assert_string_equal(attr->group, "users");
+    assert_int_equal(attr->size, 42);
+    assert_int_equal(attr->uid, 1000);
+    assert_int_equal(attr->gid, 100);
+    assert_int_equal(attr->permissions, SSH_S_IFREG | 0644);
+    assert_int_equal(attr->type, SSH_FILEXFER_TYPE_REGULAR);
+    assert_int_equal(attr->atime, 1500000000);
+    assert_int_equal(attr->mtime, 1500000001);
+    assert_int_equal(attr->extended_count, 0);
+    assert_int_equal(ssh_string_len(attr->extended_type), 16);
+    assert_memory_equal(ssh_string_data(attr->extended_data), "data", 4);
+    sftp_attributes_free(attr);
+
+    /* The second entry starts right after the first one */
+    attr = sftp_parse_attr(&st->sftp, st->buffer, 1);
+    assert_non_null(attr);
+    assert_string_equal(attr->name, "second");
+    sftp_attributes_free(attr);
+
+    assert_int_equal(ssh_buffer_get_len(st->buffer), 0);
+}
+
+static void torture_sftp_parse_attr_truncated(void **state)
+{
+    struct attr_state *st = *state;
+    sftp_attributes attr;
+    ssh_buffer full;
+    uint32_t len;
+    uint32_t i;
+    int rc;
+
+    full = ssh_buffer_new();
+    assert_non_null(full);
+    pack_entry(full, "file", LONGNAME);
+    len = ssh_buffer_get_len(full);
+
+    for (i = 0; i < len; i++) {
+        rc = ssh_buffer_reinit(st->buffer);
+        assert_int_equal(rc, SSH_OK);
+        rc = ssh_buffer_add_data(st->buffer, ssh_buffer_get(full), i);
+        assert_int_equal(rc, SSH_OK);
+
+        attr = sftp_parse_attr(&st->sftp, st->buffer, 1);
+        assert_null(attr);
+    }
+
+    SSH_BUFFER_FREE(full);
+}
+
+static void torture_sftp_parse_attr_lazy_owner(void **state)
+{
+    struct attr_state *st = *state;
+    sftp_attributes attr;
+    int rc;
+
+    rc = sftp_set_lazy_owner_group(&st->sftp, 1);
+    assert_int_equal(rc, 0);
+
+    pack_entry(st->buffer, "file", LONGNAME);
+    attr = sftp_parse_attr(&st->sftp, st->buffer, 1);
+    assert_non_null(attr);
+
+    assert_null(attr->owner);
+    assert_null(attr->group);
+    assert_string_equal(sftp_attributes_get_owner(attr), "alice");
+    assert_string_equal(sftp_attributes_get_group(attr), "users");
+    assert_string_equal(attr->owner, "alice");
+
+    sftp_attributes_free(attr);
+}
+
+static void torture_sftp_parse_attr_lazy_other_server(void **state)
+{
+    struct attr_state *st = *state;
+    sftp_attributes attr;
+    int lazy;
+
+    /* The longname format is only known for OpenSSH, in both modes */
+    st->sftp.session->openssh = 0;
+
+    for (lazy = 0; lazy <= 1; lazy++) {
+        sftp_set_lazy_owner_group(&st->sftp, lazy);
+
+        pack_entry(st->buffer, "file", LONGNAME);
+        attr = sftp_parse_attr(&st->sftp, st->buffer, 1);
+        assert_non_null(attr);
+
+        assert_string_equal(attr->longname, LONGNAME);
+        assert_null(sftp_attributes_get_owner(attr));
+        assert_null(sftp_attributes_get_group(attr));
+
+        sftp_attributes_free(attr);
+    }
+}
+
+static void torture_sftp_parse_attr_bad_longname(void **state)
+{
+    struct attr_state *st = *state;
+    sftp_attributes attr;
+
+    /* Not enough fields for the owner and group */
+    pack_entry(st->buffer, "file", "-rw-r--r-- 1");
+    attr = sftp_parse_attr(&st->sftp, st->buffer, 1);
+    assert_non_null(attr);
+
+    assert_null(attr->owner);
+    assert_null(attr->group);
+    assert_null(sftp_attributes_get_owner(attr));
+    assert_int_equal(attr->size, 42);
+
+    sftp_attributes_free(attr);
+}
+
+int torture_run_tests(void) {
+    int rc;
+    struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(torture_sftp_parse_attr_v3,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_parse_attr_truncated,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_parse_attr_lazy_owner,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_parse_attr_lazy_other_server,
+                                        setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(torture_sftp_parse_attr_bad_longname,
+                                        setup,
+                                        teardown),
+    };
+
+    ssh_init();
+    torture_filter_tests(tests);
+    rc = cmocka_run_group_tests(tests, NULL, NULL);
+    ssh_finalize();
+
+    return rc;
+}